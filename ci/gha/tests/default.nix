@@ -52,6 +52,7 @@ rec {
       withASan = withSanitizers;
       withUBSan = withSanitizers;
 
+      nix-util-tests = prev.nix-util-tests.override { withBenchmarks = true; };
       nix-store-tests = prev.nix-store-tests.override { withBenchmarks = true; };
       # Boehm is incompatible with ASAN.
       nix-expr = prev.nix-expr.override { enableGC = !withSanitizers; };
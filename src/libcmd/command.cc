@@ -12,6 +12,7 @@
 #include "nix/cmd/repl.hh"
 #include "nix/util/strings.hh"
 #include "nix/util/environment-variables.hh"
+#include "nix/util/current-process.hh"
 
 namespace nix {
 
@@ -67,8 +68,10 @@ StoreCommand::StoreCommand() {}
 
 ref<Store> StoreCommand::getStore()
 {
-    if (!_store)
+    if (!_store) {
+        StartupPhaseTimer timer("openStore");
         _store = createStore();
+    }
     return ref<Store>(_store);
 }
 
@@ -220,6 +220,11 @@ struct InstallableCommand : virtual Args, SourceExprCommand
 
     std::vector<FlakeRef> getFlakeRefsForCompletion() override;
 
+    const std::string & getInstallable() const
+    {
+        return _installable;
+    }
+
 private:
 
     std::string _installable{"."};
@@ -381,6 +386,55 @@ std::string showVersions(const StringSet & versions);
 void printClosureDiff(
     ref<Store> store, const StorePath & beforePath, const StorePath & afterPath, std::string_view indent);
 
+/**
+ * Prints the differences between closures, like
+ * `printClosureDiff()`. It remembers the store paths and closures it
+ * has seen, so diffing a series of similar closures (such as the
+ * generations of a profile) queries and groups each store path only
+ * once.
+ */
+class ClosureDiffer
+{
+public:
+
+    ClosureDiffer(ref<Store> store);
+
+    /**
+     * Fetch the path infos of the closures of `paths`, with one
+     * batched query per level of references.
+     */
+    void prefetch(const StorePathSet & paths);
+
+    void printDiff(const StorePath & beforePath, const StorePath & afterPath, std::string_view indent);
+
+private:
+
+    ref<Store> store;
+
+    struct Entry
+    {
+        uint64_t narSize;
+        StorePathSet references;
+        /**
+         * The package name and version, pointing into the store
+         * path that is the key of this entry.
+         */
+        std::string_view name, version;
+    };
+
+    std::map<StorePath, Entry> entries;
+
+    /**
+     * The NAR size of the store paths in a closure, by package name and
+     * version.
+     */
+    using GroupedPaths = std::map<std::string_view, std::map<std::string_view, uint64_t>>;
+
+    std::map<StorePath, GroupedPaths> closures;
+
+    const GroupedPaths & getClosureInfo(const StorePath & toplevel);
+};
+
 /**
  * Create symlinks prefixed by `outLink` to the store paths in
  * `buildables`.
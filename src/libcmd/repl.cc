@@ -28,9 +28,15 @@
 #include "nix/expr/print.hh"
 #include "nix/util/ref.hh"
 #include "nix/expr/value.hh"
+#include "nix/expr/eval-cache.hh"
+#include "nix/util/sync.hh"
 
 #include "nix/util/strings.hh"
 
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
 namespace nix {
 
 /**
@@ -54,6 +60,141 @@ enum class ProcessLineResult {
     PromptAgain,
 };
 
+/**
+ * Evaluates attribute sets that are likely to be completed in a
+ * background thread while the REPL waits for input, so that completing
+ * them doesn't block.
+ *
+ * The evaluator is not thread-safe, so the main thread holds
+ * `evalMutex` except while it is blocked in `getLine()`. When it needs
+ * the evaluator again, the task being run is interrupted and retried
+ * during the next wait.
+ */
+struct ReplWarmup
+{
+    ReplWarmup()
+        : mainLock(evalMutex)
+    {
+    }
+
+    ~ReplWarmup()
+    {
+        {
+            auto state(state_.lock());
+            quit = true;
+        }
+        wakeup.notify_one();
+        if (mainLock.owns_lock())
+            mainLock.unlock();
+        if (thread.joinable())
+            thread.join();
+    }
+
+    /**
+     * Queue a task. Must be called by the main thread while it holds
+     * the evaluator.
+     */
+    void add(std::function<void()> task)
+    {
+        state_.lock()->tasks.push_back(std::move(task));
+        if (!thread.joinable())
+            thread = std::thread([this]() { run(); });
+    }
+
+    /**
+     * Drop the queued tasks, e.g. because the values they refer to are
+     * no longer in scope. Must be called by the main thread while it
+     * holds the evaluator.
+     */
+    void clear()
+    {
+        state_.lock()->tasks.clear();
+    }
+
+    /**
+     * Let the background thread evaluate until the next `pause()`.
+     */
+    void resume()
+    {
+        assert(mainLock.owns_lock());
+        {
+            auto state(state_.lock());
+            paused = false;
+        }
+        mainLock.unlock();
+        wakeup.notify_one();
+    }
+
+    /**
+     * Take the evaluator back from the background thread.
+     */
+    void pause()
+    {
+        paused = true;
+        mainLock.lock();
+    }
+
+private:
+
+    struct State
+    {
+        std::deque<std::function<void()>> tasks;
+    };
+
+    Sync<State> state_;
+
+    std::condition_variable wakeup;
+
+    std::mutex evalMutex;
+
+    std::unique_lock<std::mutex> mainLock;
+
+    std::atomic<bool> paused{true};
+
+    std::atomic<bool> quit{false};
+
+    std::thread thread;
+
+    void run()
+    {
+        GCThreadRegistration gcRegistration;
+
+#ifndef _WIN32
+        unix::interruptCheck = [this]() { return paused || quit; };
+#endif
+
+        while (!quit) {
+            {
+                auto state(state_.lock());
+                while (!quit && (paused || state->tasks.empty()))
+                    state.wait(wakeup);
+            }
+
+            std::unique_lock<std::mutex> evalLock(evalMutex);
+
+            std::function<void()> task;
+            {
+                auto state(state_.lock());
+                if (quit || paused || state->tasks.empty())
+                    continue;
+                task = std::move(state->tasks.front());
+                state->tasks.pop_front();
+            }
+
+            try {
+                task();
+            } catch (Interrupted &) {
+                /* Retry during the next wait. */
+                if (!quit)
+                    state_.lock()->tasks.push_front(std::move(task));
+            } catch (...) {
+                /* Errors are reported if the user evaluates the same
+                   thing. */
+            }
+        }
+    }
+};
+
 struct NixRepl : AbstractNixRepl, detail::ReplCompleterMixin, gc
 {
     size_t debugTraceIndex;
@@ -76,6 +217,29 @@ struct NixRepl : AbstractNixRepl, detail::ReplCompleterMixin, gc
 
     std::unique_ptr<ReplInteracter> interacter;
 
+    /**
+     * Evaluation caches of the locked flakes loaded with `:load-flake`,
+     * by the variables that they brought into scope, for completing
+     * their attributes.
+     */
+    std::map<std::string, ref<eval_cache::EvalCache>> flakeCaches;
+
+    /**
+     * The flake outputs that the caches in `flakeCaches` are rooted in.
+     */
+    std::vector<Value *, traceable_allocator<Value *>> flakeRoots;
+
+    /**
+     * Only used for interactive sessions outside the debugger. Declared
+     * last, so that its thread is stopped before anything that its tasks
+     * use is destroyed.
+     */
+    std::unique_ptr<ReplWarmup> warmup;
+
+    void warmUp(const std::string & name, Value & v);
+
+    std::optional<Strings> completeFromEvalCache(std::string_view expr);
+
     NixRepl(
         const LookupPath & lookupPath,
         nix::ref<Store> store,
@@ -144,6 +308,13 @@ NixRepl::NixRepl(
     , runNixPtr{runNix}
     , interacter(make_unique<ReadlineLikeInteracter>((getDataDir() / "repl-history").string()))
 {
+    /* Avoid re-parsing unchanged files on `:reload`. */
+    state->cacheParsedFiles = true;
+
+    /* Warming up could print warnings or traces in the middle of the
+       input, so only do it when someone is typing. */
+    if (!state->debugRepl && isatty(STDIN_FILENO))
+        warmup = std::make_unique<ReplWarmup>();
 }
 
 static std::ostream & showDebugTrace(std::ostream & out, const PosTable & positions, const DebugTrace & dt)
@@ -192,10 +363,21 @@ ReplExitStatus NixRepl::mainLoop()
         // Hide the progress bar while waiting for user input, so that it won't interfere.
         {
             auto suspension = logger->suspend();
-            // When continuing input from previous lines, don't print a prompt, just align to the same
-            // number of chars as the prompt.
-            if (!interacter->getLine(
-                    input, input.empty() ? ReplPromptType::ReplPrompt : ReplPromptType::ContinuationPrompt)) {
+            bool gotLine;
+            {
+                // Let the evaluator warm up while the user is typing.
+                if (warmup)
+                    warmup->resume();
+                Finally pauseWarmup([&]() {
+                    if (warmup)
+                        warmup->pause();
+                });
+                // When continuing input from previous lines, don't print a prompt, just align to the same
+                // number of chars as the prompt.
+                gotLine = interacter->getLine(
+                    input, input.empty() ? ReplPromptType::ReplPrompt : ReplPromptType::ContinuationPrompt);
+            }
+            if (!gotLine) {
                 // Ctrl-D should exit the debugger.
                 state->debugStop = false;
                 logger->cout("");
@@ -269,6 +451,14 @@ StringSet NixRepl::completePrefix(const std::string & prefix)
             i++;
         }
     } else {
+        /* Completion runs while the warmup thread may be evaluating. */
+        if (warmup)
+            warmup->pause();
+        Finally resumeWarmup([&]() {
+            if (warmup)
+                warmup->resume();
+        });
+
         /* Temporarily disable the debugger, to avoid re-entering readline. */
         auto debug_repl = state->debugRepl;
         state->debugRepl = nullptr;
@@ -280,6 +470,15 @@ StringSet NixRepl::completePrefix(const std::string & prefix)
             auto expr = cur.substr(0, dot);
             auto cur2 = cur.substr(dot + 1);
 
+            /* If it's an attribute path into a locked flake, the names
+               may be in its evaluation cache. */
+            if (auto names = completeFromEvalCache(expr)) {
+                for (auto & name : *names)
+                    if (hasPrefix(name, cur2))
+                        completions.insert(concatStrings(prev, expr, ".", name));
+                return completions;
+            }
+
             Expr * e = parseString(expr);
             Value v;
             e->eval(*state, *env, v);
@@ -324,6 +523,74 @@ static bool isVarName(std::string_view s)
     return true;
 }
 
+std::optional<Strings> NixRepl::completeFromEvalCache(std::string_view expr)
+{
+    auto attrPath = tokenizeString<std::vector<std::string>>(expr, ".");
+    if (attrPath.empty() || attrPath.size() != (size_t) std::ranges::count(expr, '.') + 1
+        || !std::ranges::all_of(attrPath, isVarName))
+        return std::nullopt;
+
+    auto i = flakeCaches.find(attrPath[0]);
+    if (i == flakeCaches.end())
+        return std::nullopt;
+
+    try {
+        auto cursor = i->second->getRoot();
+        for (auto & attr : attrPath) {
+            auto next = cursor->maybeGetAttr(attr);
+            if (!next)
+                return std::nullopt;
+            cursor = ref<eval_cache::AttrCursor>(next);
+        }
+        Strings names;
+        for (auto & name : cursor->getAttrs())
+            names.push_back(std::string(state->symbols[name]));
+        return names;
+    } catch (Error &) {
+        return std::nullopt;
+    }
+}
+
+void NixRepl::warmUp(const std::string & name, Value & v)
+{
+    /* The attribute sets that are completed most often: Nixpkgs, its
+       library, and a flake's packages for the current system. */
+    static const StringSet names{"pkgs", "lib", "legacyPackages", "packages"};
+
+    if (!warmup || !names.contains(name))
+        return;
+
+    std::vector<std::string> attrPath{name};
+    if (name == "legacyPackages" || name == "packages")
+        attrPath.push_back(state->settings.getCurrentSystem());
+
+    warmup->add([this, attrPath, &v]() {
+        /* Going through the evaluation cache also stores the names for
+           the next session. */
+        if (auto i = flakeCaches.find(attrPath[0]); i != flakeCaches.end()) {
+            auto cursor = i->second->getRoot();
+            for (auto & attr : attrPath) {
+                auto next = cursor->maybeGetAttr(attr);
+                if (!next)
+                    return;
+                cursor = ref<eval_cache::AttrCursor>(next);
+            }
+            cursor->getAttrs();
+            return;
+        }
+
+        auto * cur = &v;
+        state->forceAttrs(*cur, noPos, "while warming up the REPL");
+        for (size_t n = 1; n < attrPath.size(); ++n) {
+            auto attr = cur->attrs()->get(state->symbols.create(attrPath[n]));
+            if (!attr)
+                return;
+            cur = attr->value;
+            state->forceAttrs(*cur, noPos, "while warming up the REPL");
+        }
+    });
+}
+
 StorePath NixRepl::getDerivationPath(Value & v)
 {
     auto packageInfo = getDerivation(*state, v, false);
@@ -742,21 +1009,39 @@ void NixRepl::loadFlake(const std::string & flakeRefS)
     if (evalSettings.pureEval && !flakeRef.input.isLocked(fetchSettings))
         throw Error("cannot use ':load-flake' on unlocked flake reference '%s' (use --impure to override)", flakeRefS);
 
-    Value v;
-
-    flake::callFlake(
+    auto lockedFlake = make_ref<flake::LockedFlake>(flake::lockFlake(
+        flakeSettings,
         *state,
-        flake::lockFlake(
-            flakeSettings,
-            *state,
-            flakeRef,
-            flake::LockFlags{
-                .updateLockFile = false,
-                .useRegistries = !evalSettings.pureEval,
-                .allowUnlocked = !evalSettings.pureEval,
-            }),
-        v);
-    addAttrsToScope(v);
+        flakeRef,
+        flake::LockFlags{
+            .updateLockFile = false,
+            .useRegistries = !evalSettings.pureEval,
+            .allowUnlocked = !evalSettings.pureEval,
+        }));
+
+    auto v = state->allocValue();
+    flake::callFlake(*state, *lockedFlake, *v);
+
+    /* Completions of a locked flake's outputs can be served from an
+       evaluation cache that is rooted in the flake loaded here, so
+       it doesn't evaluate anything twice. The REPL is impure by
+       default, so this uses a cache of its own rather than the one
+       of `nix build` and friends. */
+    std::optional<ref<eval_cache::EvalCache>> evalCache;
+    if (evalSettings.useEvalCache)
+        if (auto fingerprint = lockedFlake->getFingerprint(*state->store, fetchSettings)) {
+            auto key = hashString(
+                HashAlgorithm::SHA256,
+                fmt("repl;%s;%d", fingerprint->to_string(HashFormat::SRI, true), evalSettings.pureEval.get()));
+            evalCache = make_ref<eval_cache::EvalCache>(key, *state, [v]() { return v; });
+            flakeRoots.push_back(v);
+        }
+
+    addAttrsToScope(*v);
+
+    if (evalCache)
+        for (auto & attr : *v->attrs())
+            flakeCaches.insert_or_assign(std::string(state->symbols[attr.name]), *evalCache);
 }
 
 void NixRepl::initEnv()
@@ -769,6 +1054,11 @@ void NixRepl::initEnv()
     varNames.clear();
     for (auto & i : state->staticBaseEnv->vars)
         varNames.emplace(state->symbols[i.first]);
+
+    if (warmup)
+        warmup->clear();
+    flakeCaches.clear();
+    flakeRoots.clear();
 }
 
 void NixRepl::showLastLoaded()
@@ -829,6 +1119,8 @@ void NixRepl::addAttrsToScope(Value & attrs)
         staticEnv->vars.emplace_back(i.name, displ);
         env->values[displ++] = i.value;
         varNames.emplace(state->symbols[i.name]);
+        flakeCaches.erase(std::string(state->symbols[i.name]));
+        warmUp(std::string(state->symbols[i.name]), *i.value);
     }
     staticEnv->sort();
     staticEnv->deduplicate();
@@ -866,6 +1158,7 @@ void NixRepl::addVarToScope(const Symbol name, Value & v)
     staticEnv->sort();
     env->values[displ++] = &v;
     varNames.emplace(state->symbols[name]);
+    flakeCaches.erase(std::string(state->symbols[name]));
 }
 
 Expr * NixRepl::parseString(std::string s)
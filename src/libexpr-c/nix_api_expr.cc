@@ -1,11 +1,14 @@
 #include <cstring>
+#include <limits>
 #include <stdexcept>
 #include <string>
 
+#include "nix/expr/ast-cache.hh"
 #include "nix/expr/eval.hh"
 #include "nix/expr/eval-gc.hh"
 #include "nix/store/globals.hh"
 #include "nix/expr/eval-settings.hh"
+#include "nix/util/finally.hh"
 #include "nix/util/ref.hh"
 
 #include "nix_api_expr.h"
@@ -62,6 +65,36 @@ nix_err nix_libexpr_init(nix_c_context * context)
     NIXC_CATCH_ERRS
 }
 
+nix_err nix_libexpr_register_thread(nix_c_context * context)
+{
+    if (context)
+        context->last_err_code = NIX_OK;
+    try {
+#if NIX_USE_BOEHMGC
+        if (GC_thread_is_registered())
+            return NIX_OK;
+        GC_stack_base sb;
+        if (GC_get_stack_base(&sb) != GC_SUCCESS)
+            throw nix::Error("cannot determine the stack of the current thread");
+        GC_register_my_thread(&sb);
+#endif
+    }
+    NIXC_CATCH_ERRS
+}
+
+nix_err nix_libexpr_unregister_thread(nix_c_context * context)
+{
+    if (context)
+        context->last_err_code = NIX_OK;
+    try {
+#if NIX_USE_BOEHMGC
+        if (GC_thread_is_registered())
+            GC_unregister_my_thread();
+#endif
+    }
+    NIXC_CATCH_ERRS
+}
+
 nix_err nix_expr_eval_from_string(
     nix_c_context * context, EvalState * state, const char * expr, const char * path, nix_value * value)
 {
@@ -176,18 +209,23 @@ nix_err nix_eval_state_builder_set_lookup_path(
     NIXC_CATCH_ERRS
 }
 
+static EvalState * buildEvalState(nix_eval_state_builder & builder)
+{
+    return unsafe_new_with_self<EvalState>([&](auto * self) {
+        return EvalState{
+            .fetchSettings = std::move(builder.fetchSettings),
+            .settings = std::move(builder.settings),
+            .state = nix::EvalState(builder.lookupPath, builder.store, self->fetchSettings, self->settings),
+        };
+    });
+}
+
 EvalState * nix_eval_state_build(nix_c_context * context, nix_eval_state_builder * builder)
 {
     if (context)
         context->last_err_code = NIX_OK;
     try {
-        return unsafe_new_with_self<EvalState>([&](auto * self) {
-            return EvalState{
-                .fetchSettings = std::move(builder->fetchSettings),
-                .settings = std::move(builder->settings),
-                .state = nix::EvalState(builder->lookupPath, builder->store, self->fetchSettings, self->settings),
-            };
-        });
+        return buildEvalState(*builder);
     }
     NIXC_CATCH_ERRS_NULL
 }
@@ -216,6 +254,91 @@ void nix_state_free(EvalState * state)
     operator delete(state, static_cast<std::align_val_t>(alignof(EvalState)));
 }
 
+static std::map<std::string, std::string> getOverriddenSettings(const nix::Config & config)
+{
+    std::map<std::string, nix::AbstractConfig::SettingInfo> settings;
+    config.getSettings(settings, true);
+    std::map<std::string, std::string> res;
+    for (auto & [name, info] : settings)
+        res.emplace(name, info.value);
+    return res;
+}
+
+nix_eval_state_pool::nix_eval_state_pool(const nix_eval_state_builder & builder, size_t maxStates)
+    : store(builder.store)
+    , lookupPath(builder.lookupPath)
+    , readOnlyMode(builder.readOnlyMode)
+    , settings(getOverriddenSettings(builder.settings))
+    , fetchSettings(getOverriddenSettings(builder.fetchSettings))
+    , astCache(std::make_shared<nix::SharedAstCache>())
+    , states(maxStates ? maxStates : std::numeric_limits<size_t>::max(), [this]() { return makeState(); })
+{
+}
+
+nix::ref<EvalState> nix_eval_state_pool::makeState()
+{
+    auto builder = unsafe_new_with_self<nix_eval_state_builder>([&](auto * self) {
+        return nix_eval_state_builder{
+            .store = store,
+            .settings = nix::EvalSettings{/* &bool */ self->readOnlyMode},
+            .fetchSettings = nix::fetchers::Settings{},
+            .lookupPath = lookupPath,
+            .readOnlyMode = readOnlyMode,
+        };
+    });
+    Finally freeBuilder([&]() { nix_eval_state_builder_free(builder); });
+    for (auto & [name, value] : settings)
+        builder->settings.set(name, value);
+    for (auto & [name, value] : fetchSettings)
+        builder->fetchSettings.set(name, value);
+    auto state = buildEvalState(*builder);
+    state->state.sharedAstCache = astCache;
+    return nix::ref<EvalState>(std::shared_ptr<EvalState>(state, nix_state_free));
+}
+
+nix_eval_state_pool *
+nix_eval_state_pool_new(nix_c_context * context, nix_eval_state_builder * builder, size_t max_states)
+{
+    if (context)
+        context->last_err_code = NIX_OK;
+    try {
+        return new nix_eval_state_pool(*builder, max_states);
+    }
+    NIXC_CATCH_ERRS_NULL
+}
+
+EvalState * nix_eval_state_pool_acquire(nix_c_context * context, nix_eval_state_pool * pool)
+{
+    if (context)
+        context->last_err_code = NIX_OK;
+    try {
+        auto handle = pool->states.get();
+        auto state = &*handle;
+        pool->inUse.lock()->emplace(state, std::move(handle));
+        return state;
+    }
+    NIXC_CATCH_ERRS_NULL
+}
+
+void nix_eval_state_pool_release(nix_eval_state_pool * pool, EvalState * state)
+{
+    /* Destroy the handle outside of the lock, since returning it may
+       wake up another thread waiting for a state. */
+    std::optional<nix::Pool<EvalState>::Handle> handle;
+    {
+        auto inUse(pool->inUse.lock());
+        if (auto i = inUse->find(state); i != inUse->end()) {
+            handle.emplace(std::move(i->second));
+            inUse->erase(i);
+        }
+    }
+}
+
+void nix_eval_state_pool_free(nix_eval_state_pool * pool)
+{
+    delete pool;
+}
+
 #if NIX_USE_BOEHMGC
 boost::concurrent_flat_map<
     const void *,
@@ -48,6 +48,14 @@ typedef struct nix_eval_state_builder nix_eval_state_builder;
  */
 typedef struct EvalState EvalState; // nix::EvalState
 
+/**
+ * @brief A pool of evaluator states that can be used from several threads.
+ *
+ * @struct nix_eval_state_pool
+ * @see nix_eval_state_pool_new
+ */
+typedef struct nix_eval_state_pool nix_eval_state_pool;
+
 /** @} */
 
 /** @brief A Nix language value, or thunk that may evaluate to a value.
@@ -83,6 +91,31 @@ NIX_DEPRECATED("use nix_value instead") typedef nix_value Value;
  */
 nix_err nix_libexpr_init(nix_c_context * context);
 
+/**
+ * @brief Register the calling thread with the garbage collector.
+ * @ingroup libexpr_init
+ *
+ * Threads other than the one that called nix_libexpr_init() must call this
+ * before using any evaluator state or value, and nix_libexpr_unregister_thread()
+ * before they exit. Calling it on a thread that is already registered has no
+ * effect.
+ *
+ * @param[out] context Optional, stores error information
+ * @return NIX_OK if the registration was successful, an error code otherwise.
+ */
+nix_err nix_libexpr_register_thread(nix_c_context * context);
+
+/**
+ * @brief Unregister the calling thread from the garbage collector.
+ * @ingroup libexpr_init
+ *
+ * The thread must not hold any values that are not referenced elsewhere.
+ *
+ * @param[out] context Optional, stores error information
+ * @return NIX_OK if the thread was unregistered, an error code otherwise.
+ */
+nix_err nix_libexpr_unregister_thread(nix_c_context * context);
+
 /**
  * @brief Parses and evaluates a Nix expression from a string.
  * @ingroup value_create
@@ -277,6 +310,68 @@ EvalState * nix_state_create(nix_c_context * context, const char ** lookupPath,
  */
 void nix_state_free(EvalState * state);
 
+/**
+ * @brief Create a pool of Nix language evaluator states
+ * @ingroup libexpr_init
+ *
+ * States are created on demand from the settings and lookup path of the
+ * builder, up to `max_states` of them. All states of the pool share the
+ * parsed form of the files they evaluate, so that each file is parsed only
+ * once, but each has its own heap and symbol table.
+ *
+ * A state may only be used by one thread at a time, and values may only be
+ * used with the state that created them.
+ *
+ * The builder is not modified and must be freed by the caller.
+ *
+ * @param[out] context Optional, stores error information
+ * @param[in] builder The builder to take the settings from
+ * @param[in] max_states The maximum number of states, `0` for unlimited
+ * @return A new pool or NULL on failure. Call nix_eval_state_pool_free() when you're done.
+ */
+nix_eval_state_pool *
+nix_eval_state_pool_new(nix_c_context * context, nix_eval_state_builder * builder, size_t max_states);
+
+/**
+ * @brief Take a state from the pool
+ * @ingroup libexpr_init
+ *
+ * Returns an idle state of the pool, or creates a new one. If the pool
+ * already has the maximum number of states in use, this blocks until one is
+ * released.
+ *
+ * @param[out] context Optional, stores error information
+ * @param[in] pool The pool to take a state from
+ * @return A state or NULL on failure. Give it back with nix_eval_state_pool_release().
+ */
+EvalState * nix_eval_state_pool_acquire(nix_c_context * context, nix_eval_state_pool * pool);
+
+/**
+ * @brief Give a state back to the pool
+ * @ingroup libexpr_init
+ *
+ * The state keeps its evaluated values and files, and may be
+ * returned by a later nix_eval_state_pool_acquire().
+ *
+ * Does not fail.
+ *
+ * @param[in] pool The pool the state was taken from
+ * @param[in] state The state to give back
+ */
+void nix_eval_state_pool_release(nix_eval_state_pool * pool, EvalState * state);
+
+/**
+ * @brief Free a pool and all its states
+ * @ingroup libexpr_init
+ *
+ * All states must have been released.
+ *
+ * Does not fail.
+ *
+ * @param[in] pool The pool to free
+ */
+void nix_eval_state_pool_free(nix_eval_state_pool * pool);
+
 /** @addtogroup GC
  * @ingroup libexpr
  * @brief Reference counting and garbage collector operations
@@ -7,6 +7,9 @@
 #include "nix/expr/attr-set.hh"
 #include "nix_api_value.h"
 #include "nix/expr/search-path.hh"
+#include "nix/util/pool.hh"
+
+#include <map>
 
 extern "C" {
 
@@ -27,6 +30,29 @@ struct EvalState
     nix::EvalState state;
 };
 
+struct nix_eval_state_pool
+{
+    nix::ref<nix::Store> store;
+    nix::LookupPath lookupPath;
+    bool readOnlyMode;
+    /**
+     * The settings of the builder the pool was created from, applied
+     * to every new state.
+     */
+    std::map<std::string, std::string> settings;
+    std::map<std::string, std::string> fetchSettings;
+    std::shared_ptr<nix::SharedAstCache> astCache;
+    nix::Pool<EvalState> states;
+    /**
+     * The handles of the states that are in use.
+     */
+    nix::Sync<std::map<EvalState *, nix::Pool<EvalState>::Handle>> inUse;
+
+    nix_eval_state_pool(const nix_eval_state_builder & builder, size_t maxStates);
+
+    nix::ref<EvalState> makeState();
+};
+
 struct BindingsBuilder
 {
     nix::BindingsBuilder builder;
@@ -257,6 +257,21 @@ nix_get_string(nix_c_context * context, const nix_value * value, nix_get_string_
     NIXC_CATCH_ERRS
 }
 
+const char * nix_get_string_view(nix_c_context * context, const nix_value * value, size_t * n)
+{
+    if (context)
+        context->last_err_code = NIX_OK;
+    try {
+        auto & v = check_value_in(value);
+        assert(v.type() == nix::nString);
+        auto s = v.string_view();
+        if (n)
+            *n = s.size();
+        return v.c_str();
+    }
+    NIXC_CATCH_ERRS_NULL
+}
+
 const char * nix_get_path_string(nix_c_context * context, const nix_value * value)
 {
     if (context)
@@ -497,6 +512,22 @@ const char * nix_get_attr_name_byidx(nix_c_context * context, nix_value * value,
     NIXC_CATCH_ERRS_NULL
 }
 
+nix_err nix_get_attrs_foreach(
+    nix_c_context * context, const nix_value * value, EvalState * state, nix_get_attr_callback callback, void * user_data)
+{
+    if (context)
+        context->last_err_code = NIX_OK;
+    try {
+        auto & v = check_value_in(value);
+        assert(v.type() == nix::nAttrs);
+        for (auto & a : *v.attrs()) {
+            nix_value borrowed{.value = a.value, .mem = &state->state.mem};
+            callback(user_data, state->state.symbols[a.name].c_str(), &borrowed);
+        }
+    }
+    NIXC_CATCH_ERRS
+}
+
 nix_err nix_init_bool(nix_c_context * context, nix_value * value, bool b)
 {
     if (context)
@@ -636,6 +667,21 @@ nix_err nix_make_list(nix_c_context * context, ListBuilder * list_builder, nix_v
     NIXC_CATCH_ERRS
 }
 
+nix_err nix_make_list_from_array(
+    nix_c_context * context, EvalState * state, nix_value * value, size_t n, nix_value * const * elems)
+{
+    if (context)
+        context->last_err_code = NIX_OK;
+    try {
+        auto & v = check_value_out(value);
+        auto list = state->state.buildList(n);
+        for (size_t i = 0; i < n; ++i)
+            list[i] = &check_value_not_null(elems[i]);
+        v.mkList(list);
+    }
+    NIXC_CATCH_ERRS
+}
+
 nix_err nix_init_primop(nix_c_context * context, nix_value * value, PrimOp * p)
 {
     if (context)
@@ -697,6 +743,34 @@ nix_err nix_bindings_builder_insert(nix_c_context * context, BindingsBuilder * b
     NIXC_CATCH_ERRS
 }
 
+nix_err nix_make_attrs_from_arrays(
+    nix_c_context * context,
+    EvalState * state,
+    nix_value * value,
+    size_t n,
+    const char * const * names,
+    nix_value * const * values)
+{
+    if (context)
+        context->last_err_code = NIX_OK;
+    try {
+        auto & v = check_value_out(value);
+        auto bindings = state->state.buildBindings(n);
+        for (size_t i = 0; i < n; ++i)
+            bindings.insert(state->state.symbols.create(names[i]), &check_value_not_null(values[i]));
+        auto attrs = bindings.finish();
+        /* The attributes are sorted by name now. */
+        for (size_t i = 1; i < attrs->size(); ++i)
+            if ((*attrs)[i - 1].name == (*attrs)[i].name)
+                return nix_set_err_msg(
+                    context,
+                    NIX_ERR_KEY,
+                    ("duplicate attribute '" + std::string(state->state.symbols[(*attrs)[i].name]) + "'").c_str());
+        v.mkAttrs(attrs);
+    }
+    NIXC_CATCH_ERRS
+}
+
 void nix_bindings_builder_free(BindingsBuilder * bb)
 {
 #if NIX_USE_BOEHMGC
@@ -303,6 +303,21 @@ bool nix_get_bool(nix_c_context * context, const nix_value * value);
 nix_err
 nix_get_string(nix_c_context * context, const nix_value * value, nix_get_string_callback callback, void * user_data);
 
+/** @brief Get the raw string without copying it
+ * @ingroup value_extract
+ *
+ * This may contain placeholders. Unlike nix_get_string(), this returns the
+ * evaluator's own buffer, which is immutable. It is valid for as long as
+ * `value` is referenced, i.e. until its last nix_value_decref(), or as long
+ * as the value is reachable from a referenced value.
+ *
+ * @param[out] context Optional, stores error information
+ * @param[in] value Nix value to inspect
+ * @param[out] n Optional, stores the length of the string in bytes
+ * @return pointer to the null-terminated string, NULL in case of error
+ */
+const char * nix_get_string_view(nix_c_context * context, const nix_value * value, size_t * n);
+
 /** @brief Get path as string
  * @ingroup value_extract
  * @param[out] context Optional, stores error information
@@ -496,6 +511,33 @@ nix_value * nix_get_attr_byidx_lazy(
  */
 const char * nix_get_attr_name_byidx(nix_c_context * context, nix_value * value, EvalState * state, unsigned int i);
 
+/** @brief Called for each attribute by nix_get_attrs_foreach()
+ *
+ * @param[in] user_data the user data passed to nix_get_attrs_foreach()
+ * @param[in] name attribute name, valid until state is freed
+ * @param[in] value attribute value, borrowed and only valid during the call.
+ *   It may be a thunk. It must not be passed to nix_value_incref() or
+ *   nix_value_decref(); copy it with nix_copy_value() to keep it.
+ */
+typedef void (*nix_get_attr_callback)(void * user_data, const char * name, nix_value * value);
+
+/** @brief Call a function on every attribute of an attribute set
+ * @ingroup value_extract
+ *
+ * Unlike nix_get_attr_byidx(), this doesn't allocate per attribute, and
+ * doesn't force the attribute values. Attributes are visited in the same
+ * order as by nix_get_attr_byidx().
+ *
+ * @param[out] context Optional, stores error information
+ * @param[in] value Nix value to inspect (must be an evaluated attribute set)
+ * @param[in] state nix evaluator state
+ * @param[in] callback called for each attribute
+ * @param[in] user_data optional, arbitrary data, passed to the callback
+ * @return error code, NIX_OK on success.
+ */
+nix_err nix_get_attrs_foreach(
+    nix_c_context * context, const nix_value * value, EvalState * state, nix_get_attr_callback callback, void * user_data);
+
 /** @name Initializers
  *
  * Values are typically "returned" by initializing already allocated memory that serves as the return value.
@@ -623,6 +665,22 @@ nix_list_builder_insert(nix_c_context * context, ListBuilder * list_builder, uns
  */
 void nix_list_builder_free(ListBuilder * list_builder);
 
+/** @brief Create a list from an array of values
+ * @ingroup value_create
+ *
+ * Like building the list with nix_make_list_builder(), but in a single call.
+ * The list refers to the values, so they may still be initialized afterwards.
+ *
+ * @param[out] context Optional, stores error information
+ * @param[in] state nix evaluator state
+ * @param[out] value Nix value to modify
+ * @param[in] n number of elements
+ * @param[in] elems array of `n` values, only used for the duration of the call
+ * @return error code, NIX_OK on success.
+ */
+nix_err nix_make_list_from_array(
+    nix_c_context * context, EvalState * state, nix_value * value, size_t n, nix_value * const * elems);
+
 /** @brief Create an attribute set from a bindings builder
  * @ingroup value_create
  *
@@ -681,6 +739,29 @@ nix_bindings_builder_insert(nix_c_context * context, BindingsBuilder * builder,
  */
 void nix_bindings_builder_free(BindingsBuilder * builder);
 
+/** @brief Create an attribute set from arrays of names and values
+ * @ingroup value_create
+ *
+ * Like building the attribute set with nix_make_bindings_builder(), but in a
+ * single call. The attribute set refers to the values, so they may still be
+ * initialized afterwards.
+ *
+ * @param[out] context Optional, stores error information
+ * @param[in] state nix evaluator state
+ * @param[out] value Nix value to modify
+ * @param[in] n number of attributes
+ * @param[in] names array of `n` distinct attribute names, only used for the duration of the call
+ * @param[in] values array of `n` values, only used for the duration of the call
+ * @return error code, NIX_OK on success. NIX_ERR_KEY if a name occurs more than once.
+ */
+nix_err nix_make_attrs_from_arrays(
+    nix_c_context * context,
+    EvalState * state,
+    nix_value * value,
+    size_t n,
+    const char * const * names,
+    nix_value * const * values);
+
 /** @brief Realise a string context.
  *
  * This will
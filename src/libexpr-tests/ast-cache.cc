@@ -0,0 +1,140 @@
+#include "nix/expr/tests/libexpr.hh"
+#include "nix/util/environment-variables.hh"
+#include "nix/util/file-system.hh"
+
+namespace nix {
+
+class AstCacheTest : public LibExprTest
+{
+protected:
+    std::filesystem::path tmpDir = createTempDir();
+    AutoDelete delTmpDir{tmpDir, true};
+
+    AstCacheTest()
+    {
+        evalSettings.useAstCache = true;
+        setEnv("NIX_CACHE_HOME", (tmpDir / "cache").string().c_str());
+    }
+
+    ~AstCacheTest()
+    {
+        unsetenv("NIX_CACHE_HOME");
+    }
+
+    SourcePath writeNixFile(std::string_view contents)
+    {
+        auto file = tmpDir / "test.nix";
+        writeFile(file.string(), contents);
+        return state.rootPath(CanonPath(file.string()));
+    }
+
+    std::string show(Expr * e)
+    {
+        std::ostringstream out;
+        e->show(state.symbols, out);
+        return out.str();
+    }
+};
+
+TEST_F(AstCacheTest, roundTrip)
+{
+    auto path = writeNixFile(R"(
+        let
+          /** Adds one. */
+          inc = x: x + 1;
+          attrs = rec {
+            a = 1;
+            b = a + 1;
+            inherit (builtins) length;
+            ${"dyn"} = [ 1.5 ./foo /bar ];
+          };
+          f = { x ? 1, ... }@args:
+            with attrs;
+            if a == 1 && !(b != 2) -> true then assert args ? x; "${toString (inc b)}" else null;
+        in
+          f { x = 2; } + attrs.c or "-" + (if attrs ? dyn then toString (attrs.length attrs.dyn) else "")
+    )");
+
+    auto parsed = state.parseExprFromFile(path);
+    ASSERT_EQ(std::distance(std::filesystem::directory_iterator(tmpDir / "cache" / "eval-ast-v1"), {}), 1);
+
+    auto cached = state.parseExprFromFile(path);
+    ASSERT_NE(parsed, cached);
+    ASSERT_EQ(show(parsed), show(cached));
+
+    for (auto e : {parsed, cached}) {
+        Value v;
+        state.eval(e, v);
+        ASSERT_THAT(v, IsStringEq("3-3"));
+    }
+}
+
+TEST_F(AstCacheTest, corruptEntryIsIgnored)
+{
+    auto path = writeNixFile("{ a = 1; }.a");
+
+    state.parseExprFromFile(path);
+    for (auto & entry : std::filesystem::directory_iterator(tmpDir / "cache" / "eval-ast-v1"))
+        writeFile(entry.path().string(), "nix-ast\x01garbage");
+
+    Value v;
+    state.eval(state.parseExprFromFile(path), v);
+    ASSERT_THAT(v, IsIntEq(1));
+}
+
+class FileParseCacheTest : public LibExprTest
+{
+protected:
+    std::filesystem::path tmpDir = createTempDir();
+    AutoDelete delTmpDir{tmpDir, true};
+
+    FileParseCacheTest()
+    {
+        state.cacheParsedFiles = true;
+    }
+};
+
+TEST_F(FileParseCacheTest, reparsesOnlyChangedFiles)
+{
+    auto file = tmpDir / "test.nix";
+    auto path = state.rootPath(CanonPath(file.string()));
+
+    writeFile(file.string(), "1");
+    auto e = state.parseExprFromFile(path);
+
+    state.resetFileCache();
+    ASSERT_EQ(state.parseExprFromFile(path), e);
+
+    writeFile(file.string(), "2");
+    state.resetFileCache();
+    auto e2 = state.parseExprFromFile(path);
+    ASSERT_NE(e2, e);
+
+    Value v;
+    state.eval(e2, v);
+    ASSERT_THAT(v, IsIntEq(2));
+}
+
+TEST_F(FileParseCacheTest, resetDropsUnusedPositions)
+{
+    auto file = tmpDir / "test.nix";
+    auto path = state.rootPath(CanonPath(file.string()));
+
+    writeFile(file.string(), "{ a = 1; }");
+    auto pos = state.parseExprFromFile(path)->getPos();
+    auto strPos = state.parseExprFromString("{ b = 2; }", state.rootPath(CanonPath::root))->getPos();
+
+    state.resetFileCache();
+    ASSERT_TRUE(state.positions.originOf(pos) == Pos::Origin(path));
+    ASSERT_TRUE(std::holds_alternative<std::monostate>(state.positions.originOf(strPos)));
+
+    writeFile(file.string(), "{ a = 2; }");
+    auto pos2 = state.parseExprFromFile(path)->getPos();
+
+    state.resetFileCache();
+    ASSERT_TRUE(std::holds_alternative<std::monostate>(state.positions.originOf(pos)));
+    ASSERT_TRUE(state.positions.originOf(pos2) == Pos::Origin(path));
+    ASSERT_TRUE(state.positions[pos2]);
+}
+
+} // namespace nix
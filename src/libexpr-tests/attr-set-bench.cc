@@ -0,0 +1,76 @@
+#include <benchmark/benchmark.h>
+
+#include "nix/expr/eval.hh"
+#include "nix/expr/eval-settings.hh"
+#include "nix/fetchers/fetch-settings.hh"
+#include "nix/store/store-open.hh"
+
+using namespace nix;
+
+static void BM_BindingsGet(benchmark::State & state)
+{
+    const auto attrCount = static_cast<size_t>(state.range(0));
+
+    auto store = openStore("dummy://");
+    fetchers::Settings fetchSettings{};
+    bool readOnlyMode = true;
+    EvalSettings evalSettings{readOnlyMode};
+    evalSettings.nixPath = {};
+
+    EvalState st({}, store, fetchSettings, evalSettings, nullptr);
+
+    std::vector<Symbol> names;
+    names.reserve(attrCount);
+    auto bindings = st.buildBindings(attrCount);
+    for (size_t i = 0; i < attrCount; ++i) {
+        names.push_back(st.symbols.create("a" + std::to_string(i)));
+        bindings.alloc(names.back()).mkInt(i);
+    }
+    auto attrs = bindings.finish();
+
+    for (auto _ : state) {
+        for (auto name : names)
+            benchmark::DoNotOptimize(attrs->get(name));
+    }
+
+    state.SetItemsProcessed(state.iterations() * attrCount);
+}
+
+BENCHMARK(BM_BindingsGet)->Arg(8)->Arg(64)->Arg(1'000)->Arg(50'000);
+
+// Selection from sets of two alternating shapes, as hit by the
+// inline cache in ExprSelect.
+static void BM_SelectAlternatingShapes(benchmark::State & state)
+{
+    const auto len = static_cast<size_t>(state.range(0));
+    const auto exprStr = fmt(
+        "builtins.foldl' (acc: s: acc + s.x.y) 0 "
+        "(builtins.genList (i: if builtins.bitAnd i 1 == 0 then { x.y = 1; a = 2; } else { b = 0; c = 0; x.y = 1; }) "
+        "%d)",
+        len);
+
+    for (auto _ : state) {
+        state.PauseTiming();
+
+        auto store = openStore("dummy://");
+        fetchers::Settings fetchSettings{};
+        bool readOnlyMode = true;
+        EvalSettings evalSettings{readOnlyMode};
+        evalSettings.nixPath = {};
+
+        EvalState st({}, store, fetchSettings, evalSettings, nullptr);
+        Expr * expr = st.parseExprFromString(exprStr, st.rootPath(CanonPath::root));
+
+        Value v;
+
+        state.ResumeTiming();
+
+        st.eval(expr, v);
+        st.forceValue(v, noPos);
+        benchmark::DoNotOptimize(v);
+    }
+
+    state.SetItemsProcessed(state.iterations() * len);
+}
+
+BENCHMARK(BM_SelectAlternatingShapes)->Arg(10'000)->Arg(100'000);
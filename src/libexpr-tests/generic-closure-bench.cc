@@ -0,0 +1,74 @@
+#include <benchmark/benchmark.h>
+
+#include "nix/expr/eval.hh"
+#include "nix/expr/eval-settings.hh"
+#include "nix/fetchers/fetch-settings.hh"
+#include "nix/store/store-open.hh"
+
+using namespace nix;
+
+/* Closures over `n` nodes where every node points to a few others,
+   like the module and dependency graphs that nixpkgs and NixOS
+   compute with `builtins.genericClosure`. */
+static void runGenericClosure(benchmark::State & state, std::string_view mkKey)
+{
+    const auto len = static_cast<size_t>(state.range(0));
+    const auto exprStr =
+        fmt("let n = %d; mkKey = i: %s; in builtins.length (builtins.genericClosure {"
+            "  startSet = [ { key = mkKey 0; i = 0; } ];"
+            "  operator = x: map (i: { key = mkKey i; inherit i; })"
+            "    (builtins.filter (i: i < n) [ (x.i * 2 + 1) (x.i * 2 + 2) (x.i + 1) ]);"
+            "})",
+            len,
+            mkKey);
+
+    for (auto _ : state) {
+        state.PauseTiming();
+
+        auto store = openStore("dummy://");
+        fetchers::Settings fetchSettings{};
+        bool readOnlyMode = true;
+        EvalSettings evalSettings{readOnlyMode};
+        evalSettings.nixPath = {};
+
+        EvalState st({}, store, fetchSettings, evalSettings, nullptr);
+        Expr * expr = st.parseExprFromString(exprStr, st.rootPath(CanonPath::root));
+
+        Value v;
+
+        state.ResumeTiming();
+
+        st.eval(expr, v);
+        st.forceValue(v, noPos);
+        benchmark::DoNotOptimize(v);
+    }
+
+    state.SetItemsProcessed(state.iterations() * len);
+}
+
+static void BM_GenericClosureIntKeys(benchmark::State & state)
+{
+    runGenericClosure(state, "i");
+}
+
+/* Like the `key`s of NixOS modules, which are file names. */
+static void BM_GenericClosureStringKeys(benchmark::State & state)
+{
+    runGenericClosure(state, "\"/nix/store/00000000000000000000000000000000-source/modules/${toString i}.nix\"");
+}
+
+static void BM_GenericClosureListKeys(benchmark::State & state)
+{
+    runGenericClosure(state, "[ 0 i ]");
+}
+
+/* Not hashable, so these use the ordered map. */
+static void BM_GenericClosureAttrsListKeys(benchmark::State & state)
+{
+    runGenericClosure(state, "[ { inherit i; } ]");
+}
+
+BENCHMARK(BM_GenericClosureIntKeys)->Arg(1'000)->Arg(100'000);
+BENCHMARK(BM_GenericClosureStringKeys)->Arg(1'000)->Arg(100'000);
+BENCHMARK(BM_GenericClosureListKeys)->Arg(1'000)->Arg(100'000);
+BENCHMARK(BM_GenericClosureAttrsListKeys)->Arg(1'000)->Arg(10'000);
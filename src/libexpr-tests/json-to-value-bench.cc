@@ -0,0 +1,57 @@
+#include <benchmark/benchmark.h>
+
+#include "nix/expr/eval.hh"
+#include "nix/expr/eval-settings.hh"
+#include "nix/expr/json-to-value.hh"
+#include "nix/fetchers/fetch-settings.hh"
+#include "nix/store/store-open.hh"
+
+using namespace nix;
+
+/**
+ * Something shaped like an npm `package-lock.json`, which is the kind
+ * of input `builtins.fromJSON` spends most of its time on in practice.
+ */
+static std::string makeLockfile(size_t packages)
+{
+    std::string s = R"({"name":"example","lockfileVersion":3,"requires":true,"packages":{)";
+    for (size_t i = 0; i < packages; ++i) {
+        auto n = std::to_string(i);
+        if (i)
+            s += ',';
+        s += "\"node_modules/pkg-" + n + "\":{";
+        s += "\"version\":\"1." + n + ".0\",";
+        s += "\"resolved\":\"https://registry.npmjs.org/pkg-" + n + "/-/pkg-" + n + "-1." + n + ".0.tgz\",";
+        s += "\"integrity\":\"sha512-" + std::string(86, 'a' + i % 26) + "==\",";
+        s += "\"dev\":" + std::string(i % 3 ? "true" : "false") + ",";
+        s += "\"license\":\"MIT\",";
+        s += "\"engines\":{\"node\":\">=" + std::to_string(i % 20) + "\"},";
+        s += "\"dependencies\":{\"dep-a\":\"^1.0.0\",\"dep-b\":\"~2." + n + "\"}";
+        s += '}';
+    }
+    s += "}}";
+    return s;
+}
+
+static void BM_ParseJSONLockfile(benchmark::State & state)
+{
+    auto store = openStore("dummy://");
+    fetchers::Settings fetchSettings{};
+    bool readOnlyMode = true;
+    EvalSettings evalSettings{readOnlyMode};
+    evalSettings.nixPath = {};
+
+    EvalState st({}, store, fetchSettings, evalSettings, nullptr);
+
+    auto json = makeLockfile(state.range(0));
+
+    for (auto _ : state) {
+        Value v;
+        parseJSON(st, json, v);
+        benchmark::DoNotOptimize(v);
+    }
+
+    state.SetBytesProcessed(state.iterations() * json.size());
+}
+
+BENCHMARK(BM_ParseJSONLockfile)->Arg(1'000)->Arg(50'000);
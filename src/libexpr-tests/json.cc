@@ -1,7 +1,10 @@
 #include "nix/expr/tests/libexpr.hh"
 #include "nix/expr/value-to-json.hh"
+#include "nix/expr/json-to-value.hh"
 #include "nix/expr/static-string-data.hh"
 
+#include <nlohmann/json.hpp>
+
 namespace nix {
 // Testing the conversion to JSON
 
@@ -67,6 +70,33 @@ TEST_F(JSONValueTest, StringQuotes)
     ASSERT_EQ(getJSONValue(v), "\"test\\\"\"");
 }
 
+TEST_F(JSONValueTest, StringEscapes)
+{
+    Value v;
+    v.mkStringNoCopy("a\\b\n\t\x01\x1f\x7f"_sds);
+    ASSERT_EQ(getJSONValue(v), "\"a\\\\b\\n\\t\\u0001\\u001f\x7f\"");
+}
+
+TEST_F(JSONValueTest, MatchesTree)
+{
+    auto v = eval(R"({
+      b = [ 1 2.5 1.0e100 null true "ünïcödé" ];
+      a = { y = "x\ty"; x = { }; };
+      c = { outPath = "out"; };
+      "key\n" = [ [ ] ];
+    })");
+
+    NixStringContext context;
+    ASSERT_EQ(getJSONValue(v), printValueAsJSON(state, true, v, noPos, context).dump());
+}
+
+TEST_F(JSONValueTest, InvalidUTF8)
+{
+    Value v;
+    v.mkStringNoCopy("\xff"_sds);
+    ASSERT_THROW(getJSONValue(v), JSONSerializationError);
+}
+
 // The dummy store doesn't support writing files. Fails with this exception message:
 // C++ exception with description "error: operation 'addToStoreFromDump' is
 // not supported by store 'dummy'" thrown in the test body.
@@ -76,4 +106,61 @@ TEST_F(JSONValueTest, DISABLED_Path)
     v.mkPath(state.rootPath(CanonPath("/test")), state.mem);
     ASSERT_EQ(getJSONValue(v), "\"/nix/store/g1w7hy3qg1w7hy3qg1w7hy3qg1w7hy3q-x\"");
 }
+
+// Testing the conversion from JSON
+
+class FromJSONTest : public LibExprTest
+{
+protected:
+    Value fromJSON(std::string_view s)
+    {
+        Value v;
+        parseJSON(state, s, v);
+        return v;
+    }
+};
+
+TEST_F(FromJSONTest, values)
+{
+    auto v = eval(R"(
+      builtins.fromJSON '' { "a" : [ 1, -2, 3.5, 1e2, true, false, null, "x\n\t\"\u00e9\ud83d\ude00/" ], "b": {}, "": [] } ''
+      == { a = [ 1 (-2) 3.5 100.0 true false null "x\n\t\"é😀/" ]; b = { }; "" = [ ]; }
+    )");
+    ASSERT_THAT(v, IsTrue());
+}
+
+TEST_F(FromJSONTest, duplicateKeysLastWins)
+{
+    auto v = fromJSON(R"({"a": 1, "b": 2, "a": 3})");
+    ASSERT_THAT(v, IsAttrsOfSize(2));
+    ASSERT_THAT(*v.attrs()->get(createSymbol("a"))->value, IsIntEq(3));
+}
+
+TEST_F(FromJSONTest, integerRange)
+{
+    ASSERT_THAT(fromJSON("9223372036854775807"), IsIntEq(std::numeric_limits<NixInt::Inner>::max()));
+    ASSERT_THAT(fromJSON("-9223372036854775808"), IsIntEq(std::numeric_limits<NixInt::Inner>::min()));
+    ASSERT_THAT(fromJSON("-0"), IsIntEq(0));
+    ASSERT_THAT(fromJSON("18446744073709551616"), IsFloatEq(18446744073709551616.0));
+    ASSERT_THROW(fromJSON("18446744073709551615"), Error);
+}
+
+TEST_F(FromJSONTest, nonASCII)
+{
+    ASSERT_THAT(fromJSON("\"\xc3\xa9\xf0\x9f\x98\x80\""), IsStringEq("é😀"));
+    // Byte order marks are skipped, as before.
+    ASSERT_THAT(fromJSON("\xef\xbb\xbf" "1"), IsIntEq(1));
+}
+
+TEST_F(FromJSONTest, syntaxErrors)
+{
+    for (auto s : {"", " ", "[1,]", "{\"a\" 1}", "01", "1.", "\"\\x\"", "\"\\ud800\"", "\"\xff\"", "[1] x", "nul"})
+        ASSERT_THROW(fromJSON(s), JSONParseError) << s;
+}
+
+TEST_F(FromJSONTest, nullBytes)
+{
+    ASSERT_THROW(fromJSON(R"("a\u0000b")"), Error);
+    ASSERT_THROW(fromJSON(R"({"a\u0000b": 1})"), Error);
+}
 } /* namespace nix */
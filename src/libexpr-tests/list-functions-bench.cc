@@ -0,0 +1,79 @@
+#include <benchmark/benchmark.h>
+
+#include "nix/expr/eval.hh"
+#include "nix/expr/eval-settings.hh"
+#include "nix/fetchers/fetch-settings.hh"
+#include "nix/store/store-open.hh"
+
+using namespace nix;
+
+/* Patterns modelled on the list helpers in nixpkgs `lib.lists`. */
+static void runListExpr(benchmark::State & state, std::string_view fun)
+{
+    const auto len = static_cast<size_t>(state.range(0));
+    const auto exprStr = fmt("let xs = builtins.genList (i: i * 7919 - i / 3) %d; in %s", len, fun);
+
+    for (auto _ : state) {
+        state.PauseTiming();
+
+        auto store = openStore("dummy://");
+        fetchers::Settings fetchSettings{};
+        bool readOnlyMode = true;
+        EvalSettings evalSettings{readOnlyMode};
+        evalSettings.nixPath = {};
+
+        EvalState st({}, store, fetchSettings, evalSettings, nullptr);
+        Expr * expr = st.parseExprFromString(exprStr, st.rootPath(CanonPath::root));
+
+        Value v;
+
+        state.ResumeTiming();
+
+        st.eval(expr, v);
+        st.forceValue(v, noPos);
+        benchmark::DoNotOptimize(v);
+    }
+
+    state.SetItemsProcessed(state.iterations() * len);
+}
+
+/* lib.lists.count */
+static void BM_FoldlStrictCount(benchmark::State & state)
+{
+    runListExpr(state, "builtins.foldl' (c: x: if x > 1000 then c + 1 else c) 0 xs");
+}
+
+static void BM_Filter(benchmark::State & state)
+{
+    runListExpr(state, "builtins.length (builtins.filter (x: x != 0) xs)");
+}
+
+/* lib.lists.elem */
+static void BM_Any(benchmark::State & state)
+{
+    runListExpr(state, "builtins.any (x: x == -1) xs");
+}
+
+static void BM_SortLessThan(benchmark::State & state)
+{
+    runListExpr(state, "builtins.length (builtins.sort (a: b: a < b) xs)");
+}
+
+/* Like sorting options and modules by name in the module system. */
+static void BM_SortByAttr(benchmark::State & state)
+{
+    runListExpr(state, "builtins.length (builtins.sort (a: b: a.name < b.name) (map (x: { name = toString x; }) xs))");
+}
+
+/* Captures its environment, so doesn't use the reused-Env path. */
+static void BM_ConcatMapClosure(benchmark::State & state)
+{
+    runListExpr(state, "builtins.length (builtins.concatMap (x: [ (x + 1) ]) xs)");
+}
+
+BENCHMARK(BM_FoldlStrictCount)->Arg(1'000)->Arg(100'000);
+BENCHMARK(BM_Filter)->Arg(1'000)->Arg(100'000);
+BENCHMARK(BM_Any)->Arg(1'000)->Arg(100'000);
+BENCHMARK(BM_SortLessThan)->Arg(1'000)->Arg(100'000);
+BENCHMARK(BM_SortByAttr)->Arg(1'000)->Arg(100'000);
+BENCHMARK(BM_ConcatMapClosure)->Arg(1'000)->Arg(100'000);
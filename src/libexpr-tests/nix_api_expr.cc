@@ -7,6 +7,8 @@
 #include "nix/util/tests/string_callback.hh"
 #include "nix/util/file-system.hh"
 
+#include <thread>
+
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 
@@ -517,4 +519,66 @@ TEST_F(nix_api_expr_test, nix_expr_attrset_update)
     assert_ctx_ok();
 }
 
+TEST_F(nix_api_expr_test, nix_eval_state_pool_reuse)
+{
+    auto builder = nix_eval_state_builder_new(ctx, store);
+    assert_ctx_ok();
+    auto pool = nix_eval_state_pool_new(ctx, builder, 2);
+    assert_ctx_ok();
+    nix_eval_state_builder_free(builder);
+
+    auto a = nix_eval_state_pool_acquire(ctx, pool);
+    assert_ctx_ok();
+    auto b = nix_eval_state_pool_acquire(ctx, pool);
+    assert_ctx_ok();
+    ASSERT_NE(a, b);
+
+    for (auto s : {a, b}) {
+        nix_value * v = nix_alloc_value(ctx, s);
+        nix_expr_eval_from_string(ctx, s, "1 + 2", ".", v);
+        assert_ctx_ok();
+        ASSERT_EQ(3, nix_get_int(ctx, v));
+        nix_gc_decref(nullptr, v);
+    }
+
+    nix_eval_state_pool_release(pool, a);
+    ASSERT_EQ(a, nix_eval_state_pool_acquire(ctx, pool));
+    assert_ctx_ok();
+
+    nix_eval_state_pool_release(pool, a);
+    nix_eval_state_pool_release(pool, b);
+    nix_eval_state_pool_free(pool);
+}
+
+TEST_F(nix_api_expr_test, nix_eval_state_pool_threads)
+{
+    auto builder = nix_eval_state_builder_new(ctx, store);
+    assert_ctx_ok();
+    auto pool = nix_eval_state_pool_new(ctx, builder, 0);
+    assert_ctx_ok();
+    nix_eval_state_builder_free(builder);
+
+    std::vector<std::thread> threads;
+    std::vector<int64_t> results(4);
+    for (size_t i = 0; i < results.size(); ++i)
+        threads.emplace_back([&, i]() {
+            nix_libexpr_register_thread(nullptr);
+            auto s = nix_eval_state_pool_acquire(nullptr, pool);
+            nix_value * v = nix_alloc_value(nullptr, s);
+            auto expr = "builtins.length (builtins.genList (x: x) " + std::to_string(i * 100) + ")";
+            nix_expr_eval_from_string(nullptr, s, expr.c_str(), ".", v);
+            results[i] = nix_get_int(nullptr, v);
+            nix_gc_decref(nullptr, v);
+            nix_eval_state_pool_release(pool, s);
+            nix_libexpr_unregister_thread(nullptr);
+        });
+    for (auto & thread : threads)
+        thread.join();
+
+    for (size_t i = 0; i < results.size(); ++i)
+        ASSERT_EQ(int64_t(i * 100), results[i]);
+
+    nix_eval_state_pool_free(pool);
+}
+
 } // namespace nixC
@@ -352,6 +352,93 @@ TEST_F(nix_api_expr_test, nix_build_and_init_attr)
     free(out_name);
 }
 
+TEST_F(nix_api_expr_test, nix_make_attrs_from_arrays)
+{
+    nix_value * intValue = nix_alloc_value(ctx, state);
+    nix_init_int(ctx, intValue, 42);
+    nix_value * stringValue = nix_alloc_value(ctx, state);
+    nix_init_string(ctx, stringValue, "foo");
+
+    const char * names[] = {"b", "a"};
+    nix_value * values[] = {stringValue, intValue};
+    ASSERT_EQ(NIX_OK, nix_make_attrs_from_arrays(ctx, state, value, 2, names, values));
+
+    ASSERT_EQ(2u, nix_get_attrs_size(ctx, value));
+    nix_value * out_value = nix_get_attr_byname(ctx, value, state, "a");
+    ASSERT_EQ(42, nix_get_int(ctx, out_value));
+    nix_gc_decref(ctx, out_value);
+
+    std::vector<std::pair<std::string, nix_value *>> seen;
+    ASSERT_EQ(
+        NIX_OK,
+        nix_get_attrs_foreach(
+            ctx,
+            value,
+            state,
+            [](void * user_data, const char * name, nix_value * value) {
+                ((decltype(seen) *) user_data)->emplace_back(name, value);
+            },
+            &seen));
+    ASSERT_EQ(2u, seen.size());
+    ASSERT_EQ("a", seen[0].first);
+    ASSERT_EQ("b", seen[1].first);
+
+    // Clean up
+    nix_gc_decref(ctx, intValue);
+    nix_gc_decref(ctx, stringValue);
+}
+
+TEST_F(nix_api_expr_test, nix_make_attrs_from_arrays_duplicate)
+{
+    nix_value * intValue = nix_alloc_value(ctx, state);
+    nix_init_int(ctx, intValue, 42);
+
+    const char * names[] = {"a", "a"};
+    nix_value * values[] = {intValue, intValue};
+    ASSERT_EQ(NIX_ERR_KEY, nix_make_attrs_from_arrays(ctx, state, value, 2, names, values));
+    ASSERT_EQ(NIX_ERR_KEY, nix_err_code(ctx));
+
+    nix_gc_decref(ctx, intValue);
+}
+
+TEST_F(nix_api_expr_test, nix_make_list_from_array)
+{
+    nix_value * intValue = nix_alloc_value(ctx, state);
+    nix_value * intValue2 = nix_alloc_value(ctx, state);
+    nix_value * elems[] = {intValue, intValue2};
+
+    ASSERT_EQ(NIX_OK, nix_make_list_from_array(ctx, state, value, 2, elems));
+    // Elements can be initialized after the list is made
+    nix_init_int(ctx, intValue, 42);
+    nix_init_int(ctx, intValue2, 43);
+
+    ASSERT_EQ(2u, nix_get_list_size(ctx, value));
+    ASSERT_EQ(42, nix_get_int(ctx, nix_get_list_byidx(ctx, value, state, 0)));
+    ASSERT_EQ(43, nix_get_int(ctx, nix_get_list_byidx(ctx, value, state, 1)));
+
+    // Clean up
+    nix_gc_decref(ctx, intValue);
+    nix_gc_decref(ctx, intValue2);
+}
+
+TEST_F(nix_api_expr_test, nix_get_string_view)
+{
+    nix_init_string(ctx, value, "hello world");
+
+    size_t n = 0;
+    const char * s = nix_get_string_view(ctx, value, &n);
+    assert_ctx_ok();
+    ASSERT_EQ(11u, n);
+    ASSERT_EQ("hello world", std::string_view(s, n));
+    // The view is the value's own buffer
+    ASSERT_EQ(s, nix_get_string_view(ctx, value, nullptr));
+
+    nix_value * uninitialized = nix_alloc_value(ctx, state);
+    ASSERT_EQ(nullptr, nix_get_string_view(ctx, uninitialized, &n));
+    assert_ctx_err();
+    nix_gc_decref(ctx, uninitialized);
+}
+
 TEST_F(nix_api_expr_test, nix_get_attr_byidx_large_indices)
 {
     // Create a small attribute set to test extremely large out-of-bounds access
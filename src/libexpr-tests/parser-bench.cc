@@ -0,0 +1,136 @@
+#include <benchmark/benchmark.h>
+
+#include "nix/expr/eval.hh"
+#include "nix/expr/eval-settings.hh"
+#include "nix/fetchers/fetch-settings.hh"
+#include "nix/store/store-open.hh"
+#include "nix/util/environment-variables.hh"
+#include "nix/util/file-system.hh"
+
+#include <filesystem>
+
+using namespace nix;
+
+namespace {
+
+struct ParseBench
+{
+    ref<Store> store = openStore("dummy://");
+    fetchers::Settings fetchSettings{};
+    bool readOnlyMode = true;
+    EvalSettings evalSettings{readOnlyMode};
+    std::optional<EvalState> st;
+
+    ParseBench()
+    {
+        evalSettings.nixPath = {};
+        reset();
+    }
+
+    /**
+     * Parsed expressions are never freed, so start with a fresh
+     * `EvalState` regularly.
+     */
+    void reset()
+    {
+        st.reset();
+        st.emplace(LookupPath{}, store, fetchSettings, evalSettings, nullptr);
+    }
+};
+
+/**
+ * A file in the style of nixpkgs package definitions, with `n`
+ * packages.
+ */
+std::string makePackages(size_t n)
+{
+    std::string s = "{ lib, stdenv, fetchurl, ... }:\n{\n";
+    for (size_t i = 0; i < n; ++i)
+        s += fmt(
+            "  pkg%1% = stdenv.mkDerivation (finalAttrs: {\n"
+            "    pname = \"pkg%1%\";\n"
+            "    version = \"1.%1%\";\n"
+            "    src = fetchurl {\n"
+            "      url = \"https://example.org/pkg%1%-${finalAttrs.version}.tar.gz\";\n"
+            "      hash = \"sha256-AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA=\";\n"
+            "    };\n"
+            "    patches = [ ./fix-build-%1%.patch ];\n"
+            "    configureFlags = [ \"--enable-shared\" \"--with-foo=${lib.getDev stdenv.cc}\" ];\n"
+            "    postInstall = ''\n"
+            "      mkdir -p $out/share/doc\n"
+            "      cp README $out/share/doc/\n"
+            "    '';\n"
+            "    meta = with lib; { description = \"Package number %1%\"; license = licenses.mit; };\n"
+            "  });\n",
+            i);
+    return s + "}\n";
+}
+
+} // namespace
+
+static void BM_ParsePackages(benchmark::State & state)
+{
+    ParseBench bench;
+    auto source = makePackages(state.range(0));
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(bench.st->parseExprFromString(source, bench.st->rootPath(CanonPath::root)));
+        if (state.iterations() % 100 == 0) {
+            state.PauseTiming();
+            bench.reset();
+            state.ResumeTiming();
+        }
+    }
+
+    state.SetBytesProcessed(state.iterations() * source.size());
+}
+
+BENCHMARK(BM_ParsePackages)->Arg(10)->Arg(1'000);
+
+/**
+ * Parse every `.nix` file of the nixpkgs tree in `NIX_BENCH_NIXPKGS`,
+ * which should be a fixed revision (e.g. the one from
+ * `nix flake prefetch github:NixOS/nixpkgs/<rev>`) so that results are
+ * comparable. Files that don't parse (nixpkgs has some on purpose, for
+ * its tests) are skipped.
+ */
+static void BM_ParseNixpkgs(benchmark::State & state)
+{
+    auto nixpkgs = getEnv("NIX_BENCH_NIXPKGS");
+    if (!nixpkgs) {
+        state.SkipWithError("NIX_BENCH_NIXPKGS is not set to a nixpkgs source tree");
+        return;
+    }
+
+    ParseBench bench;
+
+    std::vector<std::pair<std::string, SourcePath>> files;
+    size_t bytes = 0;
+    for (auto & entry : std::filesystem::recursive_directory_iterator(*nixpkgs)) {
+        if (!entry.is_regular_file() || entry.path().extension() != ".nix")
+            continue;
+        auto contents = readFile(entry.path());
+        auto basePath = bench.st->rootPath(CanonPath(entry.path().parent_path().string()));
+        try {
+            bench.st->parseExprFromString(contents, basePath);
+        } catch (Error &) {
+            continue;
+        }
+        bytes += contents.size();
+        files.emplace_back(std::move(contents), std::move(basePath));
+    }
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        bench.reset();
+        state.ResumeTiming();
+
+        for (auto & [contents, basePath] : files)
+            benchmark::DoNotOptimize(bench.st->parseExprFromString(contents, basePath));
+    }
+
+    state.SetItemsProcessed(state.iterations() * files.size());
+    state.SetBytesProcessed(state.iterations() * bytes);
+}
+
+BENCHMARK(BM_ParseNixpkgs)->Unit(benchmark::kMillisecond);
@@ -3,6 +3,7 @@
 
 #include "nix/expr/eval-settings.hh"
 #include "nix/util/memory-source-accessor.hh"
+#include "nix/util/file-system.hh"
 
 #include "nix/expr/tests/libexpr.hh"
 
@@ -139,6 +140,23 @@ TEST_F(PrimOpTest, deepSeq)
     ASSERT_THROW(eval("let x = { z =  throw \"test\"; }; in builtins.deepSeq x { }"), ThrownError);
 }
 
+TEST_F(PrimOpTest, deepSeqCyclic)
+{
+    auto v = eval("let x = { a = x; b = [ x y ]; }; y = [ x ]; in builtins.deepSeq x 1");
+    ASSERT_THAT(v, IsIntEq(1));
+}
+
+TEST_F(PrimOpTest, deepSeqNested)
+{
+    auto v = eval(R"(
+        let
+          nested = builtins.foldl' (tail: head: { inherit head tail; }) null (builtins.genList (x: x) 5000);
+        in
+        builtins.deepSeq nested nested.tail.head
+    )");
+    ASSERT_THAT(v, IsIntEq(4998));
+}
+
 TEST_F(PrimOpTest, trace)
 {
     CaptureLogging l;
@@ -280,6 +298,24 @@ TEST_F(PrimOpTest, intersectAttrs)
     ASSERT_THAT(*b->value, IsIntEq(3));
 }
 
+TEST_F(PrimOpTest, readDirIsCached)
+{
+    std::filesystem::path tmpDir = createTempDir();
+    AutoDelete delTmpDir{tmpDir, true};
+    writeFile((tmpDir / "a").string(), "");
+    createDirs(tmpDir / "b");
+
+    auto expr = fmt("builtins.readDir %s", tmpDir.string());
+    auto v1 = eval(expr);
+    ASSERT_THAT(v1, IsAttrsOfSize(2));
+    auto v2 = eval(expr);
+    ASSERT_EQ(v1.attrs(), v2.attrs());
+
+    auto b = v2.attrs()->get(createSymbol("b"));
+    ASSERT_NE(b, nullptr);
+    ASSERT_THAT(*b->value, IsStringEq("directory"));
+}
+
 TEST_F(PrimOpTest, catAttrs)
 {
     auto v = eval("builtins.catAttrs \"a\" [{a = 1;} {b = 0;} {a = 2;}]");
@@ -484,6 +520,47 @@ TEST_F(PrimOpTest, sortLessThan)
         ASSERT_THAT(*elem, IsIntEq(numbers[n]));
 }
 
+TEST_F(PrimOpTest, sortByAttr)
+{
+    // Stable, so the elements with equal keys keep their order
+    auto v = eval(
+        "let r = map (x: x.n) (builtins.sort (a: b: a.k.x < b.k.x) "
+        "[ { k.x = \"b\"; n = 1; } { k.x = \"a\"; n = 2; } { k.x = \"b\"; n = 3; } { k.x = \"a\"; n = 4; } ]); "
+        "in builtins.deepSeq r r");
+    const std::vector<int> numbers = {2, 4, 1, 3};
+    ASSERT_THAT(v, IsListOfSize(numbers.size()));
+    for (const auto [n, elem] : enumerate(v.listView()))
+        ASSERT_THAT(*elem, IsIntEq(numbers[n]));
+}
+
+TEST_F(PrimOpTest, sortByAttrDescending)
+{
+    auto v = eval(
+        "let r = map (x: x.k) (builtins.sort (a: b: a.k > b.k) [ { k = 1; } { k = 2.5; } { k = 2; } ]); "
+        "in builtins.deepSeq r r");
+    ASSERT_THAT(v, IsListOfSize(3));
+    ASSERT_THAT(*v.listView()[0], IsFloatEq(2.5));
+    ASSERT_THAT(*v.listView()[1], IsIntEq(2));
+    ASSERT_THAT(*v.listView()[2], IsIntEq(1));
+}
+
+TEST_F(PrimOpTest, sortShadowedLessThan)
+{
+    // `<` refers to whatever `__lessThan` is in scope
+    auto v = eval("let __lessThan = a: b: a > b; in builtins.sort (a: b: a < b) [ 1 3 2 ]");
+    const std::vector<int> numbers = {3, 2, 1};
+    ASSERT_THAT(v, IsListOfSize(numbers.size()));
+    for (const auto [n, elem] : enumerate(v.listView()))
+        ASSERT_THAT(*elem, IsIntEq(numbers[n]));
+}
+
+TEST_F(PrimOpTest, sortSingletonNotStrict)
+{
+    // The comparator is never called, so the key is never evaluated
+    auto v = eval("builtins.sort (a: b: a.x < b.x) [ { } ]");
+    ASSERT_THAT(v, IsListOfSize(1));
+}
+
 TEST_F(PrimOpTest, partition)
 {
     auto v = eval("builtins.partition (x: x > 10) [1 23 9 3 42]");
@@ -517,6 +594,29 @@ TEST_F(PrimOpTest, concatMap)
         ASSERT_THAT(*elem, IsIntEq(numbers[n]));
 }
 
+TEST_F(PrimOpTest, concatMapClosures)
+{
+    /* Each returned closure must keep its own environment. */
+    auto v = eval("map (f: f null) (builtins.concatMap (x: [ (y: x) ]) [ 1 2 3 ])");
+    ASSERT_EQ(v.type(), nList);
+    ASSERT_EQ(v.listSize(), 3u);
+
+    auto listView = v.listView();
+    for (const auto [n, elem] : enumerate(listView))
+        ASSERT_THAT(*elem, IsIntEq(n + 1));
+}
+
+TEST_F(PrimOpTest, foldlStrictAccumulateList)
+{
+    auto v = eval("builtins.foldl' (acc: x: acc ++ [ x ]) [ ] [ 1 2 3 ]");
+    ASSERT_EQ(v.type(), nList);
+    ASSERT_EQ(v.listSize(), 3u);
+
+    auto listView = v.listView();
+    for (const auto [n, elem] : enumerate(listView))
+        ASSERT_THAT(*elem, IsIntEq(n + 1));
+}
+
 TEST_F(PrimOpTest, addInt)
 {
     auto v = eval("builtins.add 3 5");
@@ -987,6 +1087,34 @@ TEST_F(PrimOpTest, match5)
     ASSERT_THAT(v, IsListOfSize(0));
 }
 
+TEST_F(PrimOpTest, matchLiteral)
+{
+    ASSERT_THAT(eval("builtins.match \"a\\\\.b\" \"a.b\""), IsListOfSize(0));
+    ASSERT_THAT(eval("builtins.match \"a\\\\.b\" \"axb\""), IsNull());
+}
+
+TEST_F(PrimOpTest, splitLiteral)
+{
+    auto v = eval("builtins.split \"::\" \"::a::b::::\"");
+    ASSERT_THAT(v, IsListOfSize(9));
+
+    const std::vector<std::string_view> parts{"", "a", "b", "", ""};
+    auto listView = v.listView();
+    for (const auto [n, elem] : enumerate(listView)) {
+        if (n % 2)
+            ASSERT_THAT(*elem, IsListOfSize(0));
+        else
+            ASSERT_THAT(*elem, IsStringEq(parts[n / 2]));
+    }
+}
+
+TEST_F(PrimOpTest, splitLiteralNoMatch)
+{
+    auto v = eval("builtins.split \"\\\\.\" \"abc\"");
+    ASSERT_THAT(v, IsListOfSize(1));
+    ASSERT_THAT(*v.listView()[0], IsStringEq("abc"));
+}
+
 TEST_F(PrimOpTest, attrNames)
 {
     auto v = eval("builtins.attrNames { x = 1; y = 2; z = 3; a = 2; }");
@@ -1005,4 +1133,29 @@ TEST_F(PrimOpTest, genericClosure_not_strict)
     auto v = eval("builtins.genericClosure { startSet = []; }");
     ASSERT_THAT(v, IsListOfSize(0));
 }
+
+TEST_F(PrimOpTest, genericClosure_dedupNumbers)
+{
+    // Integers and floats that compare equal are the same key
+    auto v = eval("builtins.genericClosure { startSet = [ { key = 1; } { key = 1.0; } { key = -0.0; } ]; "
+                  "operator = x: if x.key < 100 then [ { key = x.key * 2; } { key = 0; } ] else [ ]; }");
+    ASSERT_THAT(v, IsListOfSize(9));
+}
+
+TEST_F(PrimOpTest, genericClosure_dedupLists)
+{
+    auto v = eval("builtins.genericClosure { startSet = [ { key = [ ]; } ]; "
+                  "operator = x: if builtins.length x.key < 3 then [ { key = x.key ++ [ 1 ]; } { key = [ 1.0 ]; } ] "
+                  "else [ ]; }");
+    ASSERT_THAT(v, IsListOfSize(4));
+}
+
+TEST_F(PrimOpTest, genericClosure_unhashableKeys)
+{
+    // Keys that can't be hashed but can be compared move to an ordered map
+    auto v = eval("builtins.genericClosure { startSet = [ { key = [ 1 ]; } { key = [ 1 ]; } "
+                  "{ key = [ 1 { } ]; } { key = [ 1 { } ]; } ]; operator = x: [ ]; }");
+    ASSERT_THAT(v, IsListOfSize(2));
+}
+
 } /* namespace nix */
@@ -43,3 +43,56 @@ static void BM_EvalManyBuiltinsMatchSameRegex(benchmark::State & state)
 }
 
 BENCHMARK(BM_EvalManyBuiltinsMatchSameRegex);
+
+static void runRegexExpr(benchmark::State & state, std::string_view fun)
+{
+    const auto len = static_cast<size_t>(state.range(0));
+    const auto exprStr = fmt(
+        "builtins.foldl' (acc: s: acc + builtins.length (%s)) 0 "
+        "(builtins.genList (i: \"pkgs/development/libraries/lib${toString i}.nix\") %d)",
+        fun,
+        len);
+
+    for (auto _ : state) {
+        state.PauseTiming();
+
+        auto store = openStore("dummy://");
+        fetchers::Settings fetchSettings{};
+        bool readOnlyMode = true;
+        EvalSettings evalSettings{readOnlyMode};
+        evalSettings.nixPath = {};
+
+        EvalState st({}, store, fetchSettings, evalSettings, nullptr);
+        Expr * expr = st.parseExprFromString(exprStr, st.rootPath(CanonPath::root));
+
+        Value v;
+
+        state.ResumeTiming();
+
+        st.eval(expr, v);
+        st.forceValue(v, noPos);
+        benchmark::DoNotOptimize(v);
+    }
+
+    state.SetItemsProcessed(state.iterations() * len);
+}
+
+/* Literal separator, as in lib.strings.splitString. */
+static void BM_EvalBuiltinsSplitLiteral(benchmark::State & state)
+{
+    runRegexExpr(state, "builtins.split \"/\" s");
+}
+
+static void BM_EvalBuiltinsSplitRegex(benchmark::State & state)
+{
+    runRegexExpr(state, "builtins.split \"[/.]\" s");
+}
+
+static void BM_EvalBuiltinsMatchGroups(benchmark::State & state)
+{
+    runRegexExpr(state, "builtins.match \"(.*)/([^/]*)\\\\.nix\" s");
+}
+
+BENCHMARK(BM_EvalBuiltinsSplitLiteral)->Arg(5'000);
+BENCHMARK(BM_EvalBuiltinsSplitRegex)->Arg(5'000);
+BENCHMARK(BM_EvalBuiltinsMatchGroups)->Arg(5'000);
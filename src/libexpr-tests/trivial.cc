@@ -36,6 +36,33 @@ TEST_F(TrivialExpressionTest, 1plus1)
     ASSERT_THAT(v, IsIntEq(2));
 }
 
+TEST_F(TrivialExpressionTest, additionChain)
+{
+    std::string expr = "\"\"";
+    for (int i = 0; i < 10000; ++i)
+        expr += " + \"x\"";
+    auto v = eval(expr);
+    ASSERT_THAT(v, IsStringEq(std::string(10000, 'x')));
+}
+
+TEST_F(TrivialExpressionTest, additionChainPromotesToFloat)
+{
+    auto v = eval("1 + 2 + 0.5 + 1");
+    ASSERT_THAT(v, IsFloatEq(4.5));
+}
+
+TEST_F(TrivialExpressionTest, additionChainCanonicalisesIntermediatePaths)
+{
+    auto v = eval("/foo + \"/\" + \"bar\"");
+    ASSERT_THAT(v, IsPathEq("/foobar"));
+}
+
+TEST_F(TrivialExpressionTest, additionChainParenthesised)
+{
+    auto v = eval("/foo + (\"/\" + \"bar\")");
+    ASSERT_THAT(v, IsPathEq("/foo/bar"));
+}
+
 TEST_F(TrivialExpressionTest, minus1)
 {
     auto v = eval("-1");
@@ -85,6 +112,73 @@ TEST_F(TrivialExpressionTest, updateAttrs)
     ASSERT_THAT(*b->value, IsIntEq(2));
 }
 
+TEST_F(TrivialExpressionTest, largeAttrsLookup)
+{
+    // Large enough to get a hash index.
+    auto v = eval("builtins.listToAttrs (builtins.genList (i: { name = \"a${toString i}\"; value = i; }) 1000)");
+    ASSERT_THAT(v, IsAttrsOfSize(1000));
+    ASSERT_TRUE(v.attrs()->isIndexed());
+    for (auto i : {0, 1, 499, 999}) {
+        auto a = v.attrs()->get(createSymbol(("a" + std::to_string(i)).c_str()));
+        ASSERT_NE(a, nullptr);
+        ASSERT_THAT(*a->value, IsIntEq(i));
+    }
+    ASSERT_EQ(v.attrs()->get(createSymbol("a1000")), nullptr);
+    ASSERT_EQ(v.attrs()->get(createSymbol("b")), nullptr);
+}
+
+TEST_F(TrivialExpressionTest, updateLargeAttrs)
+{
+    auto v = eval(
+        "builtins.listToAttrs (builtins.genList (i: { name = \"a${toString i}\"; value = i; }) 100)"
+        " // { a5 = \"x\"; b = 1; }");
+    ASSERT_THAT(v, IsAttrsOfSize(101));
+    auto a5 = v.attrs()->get(createSymbol("a5"));
+    ASSERT_NE(a5, nullptr);
+    ASSERT_THAT(*a5->value, IsStringEq("x"));
+    auto a6 = v.attrs()->get(createSymbol("a6"));
+    ASSERT_NE(a6, nullptr);
+    ASSERT_THAT(*a6->value, IsIntEq(6));
+}
+
+TEST_F(TrivialExpressionTest, mergeLargeAttrs)
+{
+    // The right-hand side is too large to be layered, so the sets are
+    // merged into a new indexed one.
+    auto v = eval(
+        "builtins.listToAttrs (builtins.genList (i: { name = \"a${toString i}\"; value = i; }) 100)"
+        " // builtins.mapAttrs (n: v: v + 1000)"
+        " (builtins.listToAttrs (builtins.genList (i: { name = \"a${toString (i * 2)}\"; value = i; }) 100))");
+    ASSERT_THAT(v, IsAttrsOfSize(150));
+    ASSERT_TRUE(v.attrs()->isIndexed());
+    auto a4 = v.attrs()->get(createSymbol("a4"));
+    ASSERT_NE(a4, nullptr);
+    state.forceValue(*a4->value, noPos);
+    ASSERT_THAT(*a4->value, IsIntEq(1002));
+    auto a5 = v.attrs()->get(createSymbol("a5"));
+    ASSERT_NE(a5, nullptr);
+    ASSERT_THAT(*a5->value, IsIntEq(5));
+    ASSERT_EQ(v.attrs()->get(createSymbol("a199")), nullptr);
+}
+
+TEST_F(TrivialExpressionTest, selectDifferentShapes)
+{
+    // The same selection applied to sets where the attribute is at
+    // different positions, including layered and missing cases.
+    auto v = eval(R"(
+        toString (map (s: s.x.y or "-") [
+          { x.y = 1; }
+          { a = 0; x = { b = 0; y = 2; }; }
+          { a = 0; b = 0; x.y = 3; }
+          { x.y = 4; }
+          ({ a = 0; } // { x = { y = 5; } // { z = 0; }; })
+          { x.z = 0; }
+          { x = { a = 0; x = 0; y = 6; }; }
+        ])
+    )");
+    ASSERT_THAT(v, IsStringEq("1 2 3 4 5 - 6"));
+}
+
 TEST_F(TrivialExpressionTest, hasAttrOpFalse)
 {
     auto v = eval("{} ? a");
@@ -263,6 +357,15 @@ TEST_F(TrivialExpressionTest, functor)
     ASSERT_THAT(v, IsIntEq(15));
 }
 
+TEST_F(TrivialExpressionTest, manyArguments)
+{
+    // Exercises growing the argument array of a single call node.
+    auto v = eval(
+        "let f = a: b: c: d: e: f: g: h: i: [a b c d e f g h i]; in"
+        " builtins.elemAt (f 1 2 3 4 5 6 7 8 9) 8");
+    ASSERT_THAT(v, IsIntEq(9));
+}
+
 TEST_F(TrivialExpressionTest, forwardPipe)
 {
     auto v = eval("1 |> builtins.add 2 |> builtins.mul 3");
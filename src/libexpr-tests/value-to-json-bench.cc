@@ -0,0 +1,50 @@
+#include <benchmark/benchmark.h>
+
+#include "nix/expr/eval.hh"
+#include "nix/expr/eval-settings.hh"
+#include "nix/expr/value-to-json.hh"
+#include "nix/fetchers/fetch-settings.hh"
+#include "nix/store/store-open.hh"
+#include "nix/util/serialise.hh"
+
+#include <nlohmann/json.hpp>
+
+using namespace nix;
+
+static constexpr std::string_view exprStr =
+    "builtins.genList (i: { name = \"pkg-${toString i}\"; version = \"1.${toString i}\"; "
+    "meta = { description = \"Package number ${toString i}\\n\"; broken = false; priority = i; }; "
+    "outputs = [ \"out\" \"dev\" ]; }) 20000";
+
+static void BM_ValueToJSON(benchmark::State & state, bool streaming)
+{
+    auto store = openStore("dummy://");
+    fetchers::Settings fetchSettings{};
+    bool readOnlyMode = true;
+    EvalSettings evalSettings{readOnlyMode};
+    evalSettings.nixPath = {};
+
+    EvalState st({}, store, fetchSettings, evalSettings, nullptr);
+    Expr * expr = st.parseExprFromString(std::string(exprStr), st.rootPath(CanonPath::root));
+
+    Value v;
+    st.eval(expr, v);
+
+    size_t bytes = 0;
+
+    for (auto _ : state) {
+        NixStringContext context;
+        if (streaming) {
+            StringSink sink;
+            printValueAsJSON(st, true, v, noPos, sink, context, false);
+            bytes = sink.s.size();
+        } else
+            bytes = printValueAsJSON(st, true, v, noPos, context, false).dump().size();
+        benchmark::DoNotOptimize(bytes);
+    }
+
+    state.SetBytesProcessed(state.iterations() * bytes);
+}
+
+BENCHMARK_CAPTURE(BM_ValueToJSON, tree, false);
+BENCHMARK_CAPTURE(BM_ValueToJSON, streaming, true);
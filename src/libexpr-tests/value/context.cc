@@ -121,6 +121,45 @@ TEST(NixStringContextElemTest, built_built_xp)
         NixStringContextElem::parse("!foo!bar!g1w7hy3qg1w7hy3qg1w7hy3qg1w7hy3q-x.drv"), MissingExperimentalFeature);
 }
 
+class StringContextTest : public LibExprTest
+{
+protected:
+    NixStringContextElem a = NixStringContextElem::Opaque{.path = StorePath{"g1w7hy3qg1w7hy3qg1w7hy3qg1w7hy3q-a"}};
+    NixStringContextElem b = NixStringContextElem::DrvDeep{.drvPath = StorePath{"g1w7hy3qg1w7hy3qg1w7hy3qg1w7hy3q-b.drv"}};
+    NixStringContextElem c = NixStringContextElem::Opaque{.path = StorePath{"g1w7hy3qg1w7hy3qg1w7hy3qg1w7hy3q-c"}};
+
+    const Value::StringWithContext::Context * makeContext(const NixStringContext & context)
+    {
+        return Value::StringWithContext::Context::fromBuilder(context, state.mem);
+    }
+};
+
+TEST_F(StringContextTest, elemsAreInterned)
+{
+    auto ctx1 = makeContext({a, b});
+    auto ctx2 = makeContext({b, c});
+    ASSERT_NE(ctx1, ctx2);
+    ASSERT_EQ(*std::next(ctx1->begin()), *ctx2->begin());
+    ASSERT_EQ((*ctx2->begin())->view(), b.to_string());
+}
+
+TEST_F(StringContextTest, mergeSharesSuperset)
+{
+    auto ctx1 = makeContext({a, b, c});
+    auto ctx2 = makeContext({c});
+    auto ctx3 = makeContext({a});
+    const Value::StringWithContext::Context * contexts[] = {ctx2, ctx1, ctx3};
+    ASSERT_EQ(Value::StringWithContext::Context::merge(contexts, state.mem), ctx1);
+}
+
+TEST_F(StringContextTest, mergeUnion)
+{
+    const Value::StringWithContext::Context * contexts[] = {makeContext({c}), makeContext({a, c}), makeContext({b})};
+    auto merged = Value::StringWithContext::Context::merge(contexts, state.mem);
+    auto expected = makeContext({a, b, c});
+    ASSERT_TRUE(std::ranges::equal(*merged, *expected));
+}
+
 #ifndef COVERAGE
 
 RC_GTEST_PROP(NixStringContextElemTest, prop_round_rip, (const NixStringContextElem & o))
@@ -0,0 +1,721 @@
+#include "nix/expr/ast-cache.hh"
+
+#include <cstring>
+#include <ranges>
+#include <unordered_map>
+
+namespace nix {
+
+namespace {
+
+MakeError(AstCacheError, Error);
+
+/**
+ * Bump this whenever the encoding below or the layout of any `Expr`
+ * subclass changes in a way that affects what is stored.
+ */
+constexpr std::string_view magic = "nix-ast\x01";
+
+enum class Tag : uint8_t {
+    Null,
+    Backref,
+    Int,
+    Float,
+    String,
+    Path,
+    Var,
+    InheritFrom,
+    Select,
+    OpHasAttr,
+    Attrs,
+    List,
+    Lambda,
+    Call,
+    Let,
+    With,
+    If,
+    Assert,
+    OpNot,
+    OpEq,
+    OpNEq,
+    OpAnd,
+    OpOr,
+    OpImpl,
+    OpUpdate,
+    OpConcatLists,
+    ConcatStrings,
+    Pos,
+};
+
+struct Unsupported
+{};
+
+struct Writer
+{
+    const SymbolTable & symbols;
+    const PosTable::Origin & origin;
+    const SourceAccessor & rootFS;
+
+    std::string body;
+    std::unordered_map<Symbol, uint32_t> symbolIds;
+    std::vector<Symbol> symbolList;
+    std::unordered_map<const Expr *, uint32_t> seen;
+
+    void num(uint64_t n)
+    {
+        do {
+            uint8_t b = n & 0x7f;
+            n >>= 7;
+            body.push_back(char(n ? b | 0x80 : b));
+        } while (n);
+    }
+
+    void tag(Tag t)
+    {
+        body.push_back(char(t));
+    }
+
+    void str(std::string_view s)
+    {
+        num(s.size());
+        body.append(s);
+    }
+
+    void sym(Symbol s)
+    {
+        if (!s) {
+            num(0);
+            return;
+        }
+        auto [i, inserted] = symbolIds.try_emplace(s, symbolList.size() + 1);
+        if (inserted)
+            symbolList.push_back(s);
+        num(i->second);
+    }
+
+    bool inOrigin(PosIdx p) const
+    {
+        return !p || origin.offsetOf(p) < origin.size;
+    }
+
+    void pos(PosIdx p)
+    {
+        if (!p) {
+            num(0);
+            return;
+        }
+        if (!inOrigin(p))
+            throw Unsupported();
+        num(uint64_t(origin.offsetOf(p)) + 1);
+    }
+
+    void attrPath(std::span<const AttrName> path)
+    {
+        num(path.size());
+        for (auto & n : path) {
+            sym(n.symbol);
+            expr(n.expr);
+        }
+    }
+
+    template<typename T>
+    bool binOp(Tag t, Expr * e)
+    {
+        auto op = dynamic_cast<T *>(e);
+        if (!op)
+            return false;
+        tag(t);
+        pos(op->pos);
+        expr(op->e1);
+        expr(op->e2);
+        return true;
+    }
+
+    void expr(Expr * e)
+    {
+        if (!e) {
+            tag(Tag::Null);
+            return;
+        }
+
+        /* The parser may share nodes between several parents; keep
+           that sharing intact. */
+        auto [i, inserted] = seen.try_emplace(e, seen.size());
+        if (!inserted) {
+            tag(Tag::Backref);
+            num(i->second);
+            return;
+        }
+
+        if (auto x = dynamic_cast<ExprInt *>(e)) {
+            tag(Tag::Int);
+            num(uint64_t(x->v.integer().value));
+        } else if (auto x = dynamic_cast<ExprFloat *>(e)) {
+            tag(Tag::Float);
+            uint64_t bits;
+            auto f = x->v.fpoint();
+            static_assert(sizeof(f) == sizeof(bits));
+            std::memcpy(&bits, &f, sizeof(bits));
+            num(bits);
+        } else if (auto x = dynamic_cast<ExprString *>(e)) {
+            tag(Tag::String);
+            str(x->v.string_view());
+        } else if (auto x = dynamic_cast<ExprPath *>(e)) {
+            tag(Tag::Path);
+            num(&*x->accessor == &rootFS ? 1 : 0);
+            str(x->v.pathStrView());
+        } else if (auto x = dynamic_cast<ExprInheritFrom *>(e)) {
+            tag(Tag::InheritFrom);
+            pos(x->pos);
+            num(x->displ);
+        } else if (auto x = dynamic_cast<ExprVar *>(e)) {
+            tag(Tag::Var);
+            pos(x->pos);
+            sym(x->name);
+        } else if (auto x = dynamic_cast<ExprSelect *>(e)) {
+            tag(Tag::Select);
+            pos(x->pos);
+            expr(x->e);
+            expr(x->def);
+            attrPath(x->getAttrPath());
+        } else if (auto x = dynamic_cast<ExprOpHasAttr *>(e)) {
+            tag(Tag::OpHasAttr);
+            expr(x->e);
+            attrPath(x->attrPath);
+        } else if (auto x = dynamic_cast<ExprAttrs *>(e)) {
+            tag(Tag::Attrs);
+            attrs(*x);
+        } else if (auto x = dynamic_cast<ExprList *>(e)) {
+            tag(Tag::List);
+            num(x->elems.size());
+            for (auto elem : x->elems)
+                expr(elem);
+        } else if (auto x = dynamic_cast<ExprLambda *>(e)) {
+            tag(Tag::Lambda);
+            pos(x->pos);
+            sym(x->name);
+            sym(x->arg);
+            pos(x->docComment.begin);
+            pos(x->docComment.end);
+            auto formals = x->getFormals();
+            num(formals ? (formals->ellipsis ? 2 : 1) : 0);
+            if (formals) {
+                num(formals->formals.size());
+                for (auto & f : formals->formals) {
+                    pos(f.pos);
+                    sym(f.name);
+                    expr(f.def);
+                }
+            }
+            expr(x->body);
+        } else if (auto x = dynamic_cast<ExprCall *>(e)) {
+            tag(Tag::Call);
+            pos(x->pos);
+            expr(x->fun);
+            num(x->args.size());
+            for (auto arg : x->args)
+                expr(arg);
+        } else if (auto x = dynamic_cast<ExprLet *>(e)) {
+            tag(Tag::Let);
+            attrs(*x->attrs);
+            expr(x->body);
+        } else if (auto x = dynamic_cast<ExprWith *>(e)) {
+            tag(Tag::With);
+            pos(x->pos);
+            expr(x->attrs);
+            expr(x->body);
+        } else if (auto x = dynamic_cast<ExprIf *>(e)) {
+            tag(Tag::If);
+            pos(x->pos);
+            expr(x->cond);
+            expr(x->then);
+            expr(x->else_);
+        } else if (auto x = dynamic_cast<ExprAssert *>(e)) {
+            tag(Tag::Assert);
+            pos(x->pos);
+            expr(x->cond);
+            expr(x->body);
+        } else if (auto x = dynamic_cast<ExprOpNot *>(e)) {
+            tag(Tag::OpNot);
+            expr(x->e);
+        } else if (auto x = dynamic_cast<ExprConcatStrings *>(e)) {
+            tag(Tag::ConcatStrings);
+            pos(x->pos);
+            num(x->forceString);
+            num(x->es.size());
+            for (auto & [p, part] : x->es) {
+                pos(p);
+                expr(part);
+            }
+        } else if (auto x = dynamic_cast<ExprPos *>(e)) {
+            tag(Tag::Pos);
+            pos(x->pos);
+        } else if (
+            binOp<ExprOpEq>(Tag::OpEq, e) || binOp<ExprOpNEq>(Tag::OpNEq, e) || binOp<ExprOpAnd>(Tag::OpAnd, e)
+            || binOp<ExprOpOr>(Tag::OpOr, e) || binOp<ExprOpImpl>(Tag::OpImpl, e)
+            || binOp<ExprOpUpdate>(Tag::OpUpdate, e) || binOp<ExprOpConcatLists>(Tag::OpConcatLists, e)) {
+        } else
+            throw Unsupported();
+    }
+
+    /* `ExprLet` embeds its `ExprAttrs` directly, so this doesn't go
+       through expr(). */
+    void attrs(ExprAttrs & x)
+    {
+        num(x.recursive);
+        pos(x.pos);
+        num(x.attrs->size());
+        for (auto & [name, def] : *x.attrs) {
+            sym(name);
+            num(uint8_t(def.kind));
+            pos(def.pos);
+            expr(def.e);
+        }
+        num(x.inheritFromExprs ? x.inheritFromExprs->size() + 1 : 0);
+        if (x.inheritFromExprs)
+            for (auto from : *x.inheritFromExprs)
+                expr(from);
+        num(x.dynamicAttrs->size());
+        for (auto & def : *x.dynamicAttrs) {
+            pos(def.pos);
+            expr(def.nameExpr);
+            expr(def.valueExpr);
+        }
+    }
+};
+
+struct Reader
+{
+    std::string_view data;
+    Exprs & exprs;
+    SymbolTable & symbols;
+    PosTable & positions;
+    const PosTable::Origin & origin;
+    ref<SourceAccessor> rootFS;
+    ref<SourceAccessor> baseAccessor;
+
+    std::vector<Symbol> symbolList;
+    std::vector<Expr *> seen;
+
+    [[noreturn]] static void corrupt()
+    {
+        throw AstCacheError("AST cache entry is corrupt");
+    }
+
+    uint8_t byte()
+    {
+        if (data.empty())
+            corrupt();
+        uint8_t b = data[0];
+        data.remove_prefix(1);
+        return b;
+    }
+
+    uint64_t num()
+    {
+        uint64_t n = 0;
+        for (unsigned int shift = 0;; shift += 7) {
+            if (shift >= 64)
+                corrupt();
+            auto b = byte();
+            n |= uint64_t(b & 0x7f) << shift;
+            if (!(b & 0x80))
+                return n;
+        }
+    }
+
+    /**
+     * Read a count of items that each take at least one byte, so that
+     * a corrupt length can't make us allocate unbounded memory.
+     */
+    size_t count()
+    {
+        auto n = num();
+        if (n > data.size())
+            corrupt();
+        return n;
+    }
+
+    std::string_view str()
+    {
+        auto n = count();
+        auto s = data.substr(0, n);
+        data.remove_prefix(n);
+        return s;
+    }
+
+    Symbol sym()
+    {
+        auto i = num();
+        if (i == 0)
+            return Symbol();
+        if (i > symbolList.size())
+            corrupt();
+        return symbolList[i - 1];
+    }
+
+    PosIdx pos()
+    {
+        auto offset = num();
+        if (offset == 0)
+            return noPos;
+        if (offset > origin.size)
+            corrupt();
+        return positions.add(origin, offset - 1);
+    }
+
+    void attrPath(std::vector<AttrName> & path)
+    {
+        auto n = count();
+        path.reserve(n);
+        for (size_t i = 0; i < n; ++i) {
+            auto s = sym();
+            auto e = expr();
+            if (e)
+                path.emplace_back(e);
+            else
+                path.emplace_back(s);
+        }
+    }
+
+    template<typename T>
+    Expr * binOp()
+    {
+        auto p = pos();
+        auto e1 = nonNull();
+        auto e2 = nonNull();
+        return exprs.add<T>(p, e1, e2);
+    }
+
+    Expr * nonNull()
+    {
+        auto e = expr();
+        if (!e)
+            corrupt();
+        return e;
+    }
+
+    Expr * expr()
+    {
+        auto t = Tag(byte());
+
+        if (t == Tag::Null)
+            return nullptr;
+
+        if (t == Tag::Backref) {
+            auto i = num();
+            if (i >= seen.size() || !seen[i])
+                corrupt();
+            return seen[i];
+        }
+
+        /* Reserve the id before reading children, matching the
+           preorder numbering used by the writer. */
+        auto id = seen.size();
+        seen.push_back(nullptr);
+
+        Expr * e;
+
+        switch (t) {
+
+        case Tag::Int:
+            e = exprs.add<ExprInt>(NixInt::Inner(num()));
+            break;
+
+        case Tag::Float: {
+            auto bits = num();
+            NixFloat f;
+            std::memcpy(&f, &bits, sizeof(f));
+            e = exprs.add<ExprFloat>(f);
+            break;
+        }
+
+        case Tag::String:
+            e = exprs.add<ExprString>(exprs.alloc, str());
+            break;
+
+        case Tag::Path: {
+            auto isRoot = num();
+            e = exprs.add<ExprPath>(exprs.alloc, isRoot ? rootFS : baseAccessor, str());
+            break;
+        }
+
+        case Tag::InheritFrom: {
+            auto p = pos();
+            e = exprs.add<ExprInheritFrom>(p, Displacement(num()));
+            break;
+        }
+
+        case Tag::Var: {
+            auto p = pos();
+            e = exprs.add<ExprVar>(p, sym());
+            break;
+        }
+
+        case Tag::Select: {
+            auto p = pos();
+            auto subject = nonNull();
+            auto def = expr();
+            std::vector<AttrName> path;
+            attrPath(path);
+            e = exprs.add<ExprSelect>(exprs.alloc, p, subject, path, def);
+            break;
+        }
+
+        case Tag::OpHasAttr: {
+            auto subject = nonNull();
+            std::vector<AttrName> path;
+            attrPath(path);
+            e = exprs.add<ExprOpHasAttr>(exprs.alloc, subject, path);
+            break;
+        }
+
+        case Tag::Attrs:
+            e = attrs();
+            break;
+
+        case Tag::List: {
+            auto n = count();
+            std::vector<Expr *> elems;
+            elems.reserve(n);
+            for (size_t i = 0; i < n; ++i)
+                elems.push_back(nonNull());
+            e = exprs.add<ExprList>(exprs.alloc, elems);
+            break;
+        }
+
+        case Tag::Lambda: {
+            auto p = pos();
+            auto name = sym();
+            auto arg = sym();
+            DocComment doc{.begin = pos(), .end = pos()};
+            auto hasFormals = num();
+            ExprLambda * lambda;
+            if (hasFormals) {
+                FormalsBuilder formals;
+                formals.ellipsis = hasFormals == 2;
+                auto n = count();
+                formals.formals.reserve(n);
+                for (size_t i = 0; i < n; ++i) {
+                    auto fp = pos();
+                    auto fname = sym();
+                    formals.formals.push_back(Formal{.pos = fp, .name = fname, .def = expr()});
+                }
+                /* Symbol ids differ between symbol tables, so restore
+                   the sort order that `Formals::has()` relies on. */
+                std::sort(formals.formals.begin(), formals.formals.end(), [](const Formal & a, const Formal & b) {
+                    return std::tie(a.name, a.pos) < std::tie(b.name, b.pos);
+                });
+                lambda = exprs.add<ExprLambda>(positions, exprs.alloc, p, arg, formals, nonNull());
+            } else
+                lambda = exprs.add<ExprLambda>(p, arg, nonNull());
+            lambda->name = name;
+            lambda->docComment = doc;
+            e = lambda;
+            break;
+        }
+
+        case Tag::Call: {
+            auto p = pos();
+            auto fun = nonNull();
+            auto n = count();
+            std::vector<Expr *> args;
+            args.reserve(n);
+            for (size_t i = 0; i < n; ++i)
+                args.push_back(nonNull());
+            e = exprs.add<ExprCall>(exprs.alloc, p, fun, std::span<Expr * const>(args));
+            break;
+        }
+
+        case Tag::Let: {
+            auto a = attrs();
+            e = exprs.add<ExprLet>(a, nonNull());
+            break;
+        }
+
+        case Tag::With: {
+            auto p = pos();
+            auto a = nonNull();
+            e = exprs.add<ExprWith>(p, a, nonNull());
+            break;
+        }
+
+        case Tag::If: {
+            auto p = pos();
+            auto cond = nonNull();
+            auto then = nonNull();
+            e = exprs.add<ExprIf>(p, cond, then, nonNull());
+            break;
+        }
+
+        case Tag::Assert: {
+            auto p = pos();
+            auto cond = nonNull();
+            e = exprs.add<ExprAssert>(p, cond, nonNull());
+            break;
+        }
+
+        case Tag::OpNot:
+            e = exprs.add<ExprOpNot>(nonNull());
+            break;
+
+        case Tag::OpEq:
+            e = binOp<ExprOpEq>();
+            break;
+        case Tag::OpNEq:
+            e = binOp<ExprOpNEq>();
+            break;
+        case Tag::OpAnd:
+            e = binOp<ExprOpAnd>();
+            break;
+        case Tag::OpOr:
+            e = binOp<ExprOpOr>();
+            break;
+        case Tag::OpImpl:
+            e = binOp<ExprOpImpl>();
+            break;
+        case Tag::OpUpdate:
+            e = binOp<ExprOpUpdate>();
+            break;
+        case Tag::OpConcatLists:
+            e = binOp<ExprOpConcatLists>();
+            break;
+
+        case Tag::ConcatStrings: {
+            auto p = pos();
+            bool forceString = num();
+            auto n = count();
+            std::vector<std::pair<PosIdx, Expr *>> parts;
+            parts.reserve(n);
+            for (size_t i = 0; i < n; ++i) {
+                auto pp = pos();
+                parts.emplace_back(pp, nonNull());
+            }
+            e = exprs.add<ExprConcatStrings>(exprs.alloc, p, forceString, std::span(parts));
+            break;
+        }
+
+        case Tag::Pos:
+            e = exprs.add<ExprPos>(pos());
+            break;
+
+        default:
+            corrupt();
+        }
+
+        seen[id] = e;
+        return e;
+    }
+
+    ExprAttrs * attrs()
+    {
+        bool recursive = num();
+        auto e = exprs.add<ExprAttrs>(pos());
+        e->recursive = recursive;
+        auto n = count();
+        for (size_t i = 0; i < n; ++i) {
+            auto name = sym();
+            auto kind = num();
+            if (kind > uint8_t(ExprAttrs::AttrDef::Kind::InheritedFrom))
+                corrupt();
+            auto p = pos();
+            e->attrs->emplace(name, ExprAttrs::AttrDef(nonNull(), p, ExprAttrs::AttrDef::Kind(kind)));
+        }
+        if (auto nFrom = num()) {
+            e->inheritFromExprs = std::make_unique<std::pmr::vector<Expr *>>();
+            for (size_t i = 0; i < nFrom - 1; ++i)
+                e->inheritFromExprs->push_back(nonNull());
+        }
+        auto nDynamic = count();
+        for (size_t i = 0; i < nDynamic; ++i) {
+            auto p = pos();
+            auto name = nonNull();
+            e->dynamicAttrs->emplace_back(name, nonNull(), p);
+        }
+        return e;
+    }
+};
+
+} // namespace
+
+std::optional<std::string> serialiseExpr(
+    Expr & e,
+    const SymbolTable & symbols,
+    const PosTable::Origin & origin,
+    const SourceAccessor & rootFS,
+    const DocCommentMap & docComments)
+{
+    Writer writer{.symbols = symbols, .origin = origin, .rootFS = rootFS};
+
+    try {
+        writer.expr(&e);
+
+        /* The map is shared by all parses of the same file, so skip
+           entries that belong to an earlier parse. */
+        auto ours = [&](auto & entry) { return entry.first && writer.inOrigin(entry.first); };
+        writer.num(std::ranges::count_if(docComments, ours));
+        for (auto & [p, doc] : docComments | std::views::filter(ours)) {
+            writer.pos(p);
+            writer.pos(doc.begin);
+            writer.pos(doc.end);
+        }
+    } catch (Unsupported &) {
+        return std::nullopt;
+    }
+
+    /* The symbol table comes first so the reader can intern all names
+       before it encounters them. */
+    Writer header{.symbols = symbols, .origin = origin, .rootFS = rootFS};
+    header.body.append(magic);
+    header.num(writer.symbolList.size());
+    for (auto s : writer.symbolList)
+        header.str(symbols[s]);
+
+    return header.body + writer.body;
+}
+
+Expr * deserialiseExpr(
+    std::string_view data,
+    Exprs & exprs,
+    SymbolTable & symbols,
+    PosTable & positions,
+    const PosTable::Origin & origin,
+    ref<SourceAccessor> rootFS,
+    ref<SourceAccessor> baseAccessor,
+    DocCommentMap & docComments)
+{
+    if (!data.starts_with(magic))
+        throw AstCacheError("AST cache entry has an unsupported format");
+    data.remove_prefix(magic.size());
+
+    Reader reader{
+        .data = data,
+        .exprs = exprs,
+        .symbols = symbols,
+        .positions = positions,
+        .origin = origin,
+        .rootFS = rootFS,
+        .baseAccessor = baseAccessor,
+    };
+
+    auto nSymbols = reader.count();
+    reader.symbolList.reserve(nSymbols);
+    for (size_t i = 0; i < nSymbols; ++i)
+        reader.symbolList.push_back(symbols.create(reader.str()));
+
+    auto e = reader.nonNull();
+
+    auto nDocs = reader.count();
+    for (size_t i = 0; i < nDocs; ++i) {
+        auto p = reader.pos();
+        auto begin = reader.pos();
+        docComments.insert_or_assign(p, DocComment{.begin = begin, .end = reader.pos()});
+    }
+
+    if (!reader.data.empty())
+        reader.corrupt();
+
+    return e;
+}
+
+} // namespace nix
@@ -18,7 +18,7 @@ Bindings * EvalMemory::allocBindings(size_t capacity)
         throw Error("attribute set of size %d is too big", capacity);
     stats.nrAttrsets++;
     stats.nrAttrsInAttrsets += capacity;
-    return new (allocBytes(sizeof(Bindings) + sizeof(Attr) * capacity)) Bindings();
+    return new (allocBytes(sizeof(Bindings) + sizeof(Attr) * capacity + Bindings::indexBytes(capacity))) Bindings();
 }
 
 Value & BindingsBuilder::alloc(Symbol name, PosIdx pos)
@@ -35,9 +35,29 @@ Value & BindingsBuilder::alloc(std::string_view name, PosIdx pos)
 
 void Bindings::sort()
 {
+    indexed = false;
     std::sort(attrs, attrs + numAttrs);
 }
 
+void Bindings::buildIndex() noexcept
+{
+    const auto size = indexSize(numAttrs);
+    auto * slots = index();
+    std::fill_n(slots, size, 0);
+
+    for (size_type n = 0; n < numAttrs; ++n) {
+        auto i = indexSlot(attrs[n].name, size);
+        /* In case of duplicate names, the first one wins, as with
+           binary search. */
+        while (slots[i] && attrs[slots[i] - 1].name != attrs[n].name)
+            i = (i + 1) & (size - 1);
+        if (!slots[i])
+            slots[i] = n + 1;
+    }
+
+    indexed = true;
+}
+
 Value & Value::mkAttrs(BindingsBuilder & bindings)
 {
     mkAttrs(bindings.finish());
@@ -8,6 +8,11 @@
 // Need specialization involving `SymbolStr` just in this one module.
 #include "nix/util/strings-inline.hh"
 
+#include <condition_variable>
+#include <map>
+#include <thread>
+#include <unordered_set>
+
 namespace nix::eval_cache {
 
 CachedEvalError::CachedEvalError(ref<AttrCursor> cursor, Symbol attr)
@@ -32,6 +37,19 @@ void CachedEvalError::force()
         state, "evaluation of cached failed attribute '%s' unexpectedly succeeded", cursor->getAttrPathStr(attr));
 }
 
+/**
+ * How many levels below an attribute set `AttrDb::prefetch()` reads
+ * when a cursor first looks at that set. Going deeper would read the
+ * attributes of every package when opening `legacyPackages.<system>`.
+ */
+static constexpr unsigned int prefetchDepth = 1;
+
+/**
+ * Attribute sets with more attributes than this are not prefetched,
+ * since usually only a few of them are used (as with package sets).
+ */
+static constexpr size_t prefetchMaxAttrs = 1000;
+
 static const char * schema = R"sql(
 create table if not exists Attributes (
     parent      integer not null,
@@ -53,14 +71,87 @@ struct AttrDb
     {
         SQLite db;
         SQLiteStmt insertAttribute;
-        SQLiteStmt insertAttributeWithContext;
         SQLiteStmt queryAttribute;
         SQLiteStmt queryAttributes;
+        SQLiteStmt querySubtree;
         std::unique_ptr<SQLiteTxn> txn;
     };
 
     std::unique_ptr<Sync<State>> _state;
 
+    /**
+     * Rows that haven't been written yet get provisional row IDs from
+     * this value upwards, so children can refer to a parent that
+     * hasn't been written yet. The real row IDs are assigned by SQLite
+     * when the rows are written, since other processes may be writing
+     * to the same cache.
+     */
+    static constexpr AttrId firstPendingRowId = AttrId(1) << 62;
+
+    /**
+     * An attribute that has been assigned a provisional row ID but
+     * that may not have been written to the database yet.
+     */
+    struct Row
+    {
+        AttrId rowId;
+        AttrType type;
+        std::variant<std::monostate, int64_t, std::string> value;
+        std::optional<std::string> context;
+    };
+
+    typedef std::map<AttrKey, Row> Rows;
+
+    /**
+     * Number of pending rows after which the writer thread is woken
+     * up to write them in one go.
+     */
+    static constexpr size_t batchSize = 4096;
+
+    struct Pending
+    {
+        AttrId nextRowId = firstPendingRowId;
+
+        /**
+         * The real row IDs of the rows that have been written, by
+         * provisional row ID. Only the writer thread modifies this.
+         */
+        std::unordered_map<AttrId, AttrId> written;
+
+        /**
+         * Rows that haven't been picked up by the writer thread yet.
+         */
+        Rows rows;
+
+        /**
+         * Rows that the writer thread is currently writing. Only the
+         * writer thread modifies this.
+         */
+        Rows flushing;
+
+        bool quit = false;
+    };
+
+    Sync<Pending> _pending;
+    std::condition_variable wakeup;
+    std::thread writerThread;
+
+    struct Prefetched
+    {
+        /**
+         * Rows read ahead of time by `prefetch()`. `getAttr()` takes
+         * entries out of here before going to the database.
+         */
+        std::map<AttrKey, std::pair<AttrId, AttrValue>> attrs;
+
+        /**
+         * Rows whose children have already been prefetched.
+         */
+        std::unordered_set<AttrId> parents;
+    };
+
+    Sync<Prefetched> _prefetched;
+
     SymbolTable & symbols;
 
     AttrDb(const StoreDirConfig & cfg, const Hash & fingerprint, SymbolTable & symbols)
@@ -75,14 +166,20 @@ struct AttrDb
 
         auto dbPath = cacheDir / (fingerprint.to_string(HashFormat::Base16, false) + ".sqlite");
 
+        /* The fingerprint covers the entire source tree, so any edit
+           leads to a fresh cache. Make that visible, since it is the
+           usual reason for a slow "cached" evaluation. */
+        if (!pathExists(dbPath))
+            debug("creating new evaluation cache '%s'", dbPath);
+
         state->db = SQLite(dbPath);
         state->db.isCache();
+        /* Warm caches are read far more often than they're written,
+           so let SQLite read pages straight from the mapped file. */
+        state->db.exec("pragma mmap_size = 268435456");
         state->db.exec(schema);
 
         state->insertAttribute.create(
-            state->db, "insert or replace into Attributes(parent, name, type, value) values (?, ?, ?, ?)");
-
-        state->insertAttributeWithContext.create(
             state->db, "insert or replace into Attributes(parent, name, type, value, context) values (?, ?, ?, ?, ?)");
 
         state->queryAttribute.create(
@@ -90,12 +187,31 @@ struct AttrDb
 
         state->queryAttributes.create(state->db, "select name from Attributes where parent = ?");
 
+        state->querySubtree.create(
+            state->db,
+            R"sql(
+              with recursive Subtree(id, parent, name, type, value, context, depth) as (
+                select rowid, parent, name, type, value, context, 1 from Attributes where parent = ?1
+                union all
+                select a.rowid, a.parent, a.name, a.type, a.value, a.context, s.depth + 1
+                from Attributes a join Subtree s on a.parent = s.id
+                where s.depth < ?2
+              )
+              select id, parent, name, type, value, context, depth from Subtree
+            )sql");
+
         state->txn = std::make_unique<SQLiteTxn>(state->db);
+
+        writerThread = std::thread([this]() { writer(); });
     }
 
     ~AttrDb()
     {
         try {
+            _pending.lock()->quit = true;
+            wakeup.notify_one();
+            writerThread.join();
+
             auto state(_state->lock());
             if (!failed && state->txn->active)
                 state->txn->commit();
@@ -105,186 +221,370 @@ struct AttrDb
         }
     }
 
-    template<typename F>
-    AttrId doSQLite(F && fun)
+    /**
+     * Write pending rows to the database in large batches, so that
+     * the evaluator doesn't pay for every individual insert.
+     */
+    void writer()
+    {
+        while (true) {
+            Rows * batch;
+
+            {
+                auto pending(_pending.lock());
+                while (!pending->quit && pending->rows.size() < batchSize)
+                    pending.wait(wakeup);
+                if (pending->rows.empty())
+                    return;
+                pending->flushing = std::move(pending->rows);
+                pending->rows.clear();
+                batch = &pending->flushing;
+            }
+
+            /* The real row IDs of the rows in this batch. The rows are
+               ordered by parent, and a parent always has a lower row
+               ID than its children, so parents are written first. */
+            std::unordered_map<AttrId, AttrId> written;
+
+            if (!failed) {
+                try {
+                    auto state(_state->lock());
+                    for (auto & [key, row] : *batch) {
+                        auto parent = key.first;
+                        if (parent >= firstPendingRowId) {
+                            auto i = written.find(parent);
+                            if (i == written.end()) {
+                                auto pending(_pending.lock());
+                                i = pending->written.find(parent);
+                                /* The parent was replaced by another
+                                   row before it was written, so this
+                                   row is unreachable. */
+                                if (i == pending->written.end())
+                                    continue;
+                            }
+                            parent = i->second;
+                        }
+                        auto use(state->insertAttribute.use());
+                        use(parent)(symbols[key.second])(row.type);
+                        std::visit(
+                            overloaded{
+                                [&](std::monostate) { use(0, false); },
+                                [&](int64_t n) { use(n); },
+                                [&](const std::string & s) { use(s); },
+                            },
+                            row.value);
+                        if (row.context)
+                            use(*row.context);
+                        else
+                            use(0, false);
+                        use.exec();
+                        written.emplace(row.rowId, state->db.getLastInsertedRowId());
+                    }
+                } catch (...) {
+                    /* This runs on its own thread, so nothing may
+                       escape. */
+                    failed = true;
+                    ignoreExceptionInDestructor();
+                }
+            }
+
+            {
+                auto pending(_pending.lock());
+                pending->written.merge(written);
+                pending->flushing.clear();
+            }
+        }
+    }
+
+    /**
+     * Return the real row ID of `rowId` if it is a provisional one
+     * whose row has been written.
+     */
+    AttrId resolve(AttrId rowId)
+    {
+        if (rowId < firstPendingRowId)
+            return rowId;
+        auto pending(_pending.lock());
+        auto i = pending->written.find(rowId);
+        return i != pending->written.end() ? i->second : rowId;
+    }
+
+    AttrId addRow(
+        Pending & pending,
+        AttrKey key,
+        AttrType type,
+        decltype(Row::value) value = {},
+        std::optional<std::string> context = {})
+    {
+        auto rowId = pending.nextRowId++;
+        _prefetched.lock()->attrs.erase(key);
+        pending.rows.insert_or_assign(
+            key, Row{.rowId = rowId, .type = type, .value = std::move(value), .context = std::move(context)});
+        if (pending.rows.size() >= batchSize)
+            wakeup.notify_one();
+        return rowId;
+    }
+
+    AttrId addRow(AttrKey key, AttrType type, decltype(Row::value) value = {}, std::optional<std::string> context = {})
     {
         if (failed)
             return 0;
-        try {
-            return fun();
-        } catch (SQLiteError &) {
-            ignoreExceptionExceptInterrupt();
-            failed = true;
-            return 0;
-        }
+        return addRow(*_pending.lock(), key, type, std::move(value), std::move(context));
     }
 
     AttrId setAttrs(AttrKey key, const std::vector<Symbol> & attrs)
     {
-        return doSQLite([&]() {
-            auto state(_state->lock());
+        if (failed)
+            return 0;
 
-            state->insertAttribute.use()(key.first)(symbols[key.second])(AttrType::FullAttrs) (0, false).exec();
+        /* Add the children under the same lock, so they're always
+           written in the same batch as their parent. */
+        auto pending(_pending.lock());
 
-            AttrId rowId = state->db.getLastInsertedRowId();
-            assert(rowId);
+        auto rowId = addRow(*pending, key, AttrType::FullAttrs);
 
-            for (auto & attr : attrs)
-                state->insertAttribute.use()(rowId)(symbols[attr])(AttrType::Placeholder) (0, false).exec();
+        for (auto & attr : attrs)
+            addRow(*pending, {rowId, attr}, AttrType::Placeholder);
 
-            return rowId;
-        });
+        return rowId;
     }
 
     AttrId setString(AttrKey key, std::string_view s, const Value::StringWithContext::Context * context = nullptr)
     {
-        return doSQLite([&]() {
-            auto state(_state->lock());
-
-            if (context) {
-                std::string ctx;
-                bool first = true;
-                for (auto * elem : *context) {
-                    if (!first)
-                        ctx.push_back(' ');
-                    ctx.append(elem->view());
-                    first = false;
-                }
-                state->insertAttributeWithContext.use()(key.first)(symbols[key.second])(AttrType::String) (s) (ctx)
-                    .exec();
-            } else {
-                state->insertAttribute.use()(key.first)(symbols[key.second])(AttrType::String) (s).exec();
+        std::optional<std::string> ctx;
+        if (context) {
+            ctx.emplace();
+            bool first = true;
+            for (auto * elem : *context) {
+                if (!first)
+                    ctx->push_back(' ');
+                ctx->append(elem->view());
+                first = false;
             }
-
-            return state->db.getLastInsertedRowId();
-        });
+        }
+        return addRow(key, AttrType::String, std::string(s), std::move(ctx));
     }
 
     AttrId setBool(AttrKey key, bool b)
     {
-        return doSQLite([&]() {
-            auto state(_state->lock());
-
-            state->insertAttribute.use()(key.first)(symbols[key.second])(AttrType::Bool) (b ? 1 : 0).exec();
-
-            return state->db.getLastInsertedRowId();
-        });
+        return addRow(key, AttrType::Bool, int64_t(b ? 1 : 0));
     }
 
     AttrId setInt(AttrKey key, int n)
     {
-        return doSQLite([&]() {
-            auto state(_state->lock());
-
-            state->insertAttribute.use()(key.first)(symbols[key.second])(AttrType::Int) (n).exec();
-
-            return state->db.getLastInsertedRowId();
-        });
+        return addRow(key, AttrType::Int, int64_t(n));
     }
 
     AttrId setListOfStrings(AttrKey key, const std::vector<std::string> & l)
     {
-        return doSQLite([&]() {
-            auto state(_state->lock());
-
-            state->insertAttribute
-                .use()(key.first)(symbols[key.second])(
-                    AttrType::ListOfStrings) (dropEmptyInitThenConcatStringsSep("\t", l))
-                .exec();
-
-            return state->db.getLastInsertedRowId();
-        });
+        return addRow(key, AttrType::ListOfStrings, dropEmptyInitThenConcatStringsSep("\t", l));
     }
 
     AttrId setPlaceholder(AttrKey key)
     {
-        return doSQLite([&]() {
-            auto state(_state->lock());
-
-            state->insertAttribute.use()(key.first)(symbols[key.second])(AttrType::Placeholder) (0, false).exec();
-
-            return state->db.getLastInsertedRowId();
-        });
+        return addRow(key, AttrType::Placeholder);
     }
 
     AttrId setMissing(AttrKey key)
     {
-        return doSQLite([&]() {
-            auto state(_state->lock());
-
-            state->insertAttribute.use()(key.first)(symbols[key.second])(AttrType::Missing) (0, false).exec();
-
-            return state->db.getLastInsertedRowId();
-        });
+        return addRow(key, AttrType::Missing);
     }
 
     AttrId setMisc(AttrKey key)
     {
-        return doSQLite([&]() {
-            auto state(_state->lock());
-
-            state->insertAttribute.use()(key.first)(symbols[key.second])(AttrType::Misc) (0, false).exec();
-
-            return state->db.getLastInsertedRowId();
-        });
+        return addRow(key, AttrType::Misc);
     }
 
     AttrId setFailed(AttrKey key)
     {
-        return doSQLite([&]() {
-            auto state(_state->lock());
-
-            state->insertAttribute.use()(key.first)(symbols[key.second])(AttrType::Failed) (0, false).exec();
-
-            return state->db.getLastInsertedRowId();
-        });
+        return addRow(key, AttrType::Failed);
     }
 
-    std::optional<std::pair<AttrId, AttrValue>> getAttr(AttrKey key)
+    static std::pair<AttrId, AttrValue> decode(
+        AttrId rowId,
+        AttrType type,
+        std::function<std::string()> getStr,
+        std::function<int64_t()> getInt,
+        std::optional<std::string> context,
+        std::function<std::vector<Symbol>()> getChildren)
     {
-        auto state(_state->lock());
-
-        auto queryAttribute(state->queryAttribute.use()(key.first)(symbols[key.second]));
-        if (!queryAttribute.next())
-            return {};
-
-        auto rowId = (AttrId) queryAttribute.getInt(0);
-        auto type = (AttrType) queryAttribute.getInt(1);
-
         switch (type) {
         case AttrType::Placeholder:
-            return {{rowId, placeholder_t()}};
-        case AttrType::FullAttrs: {
-            // FIXME: expensive, should separate this out.
-            std::vector<Symbol> attrs;
-            auto queryAttributes(state->queryAttributes.use()(rowId));
-            while (queryAttributes.next())
-                attrs.emplace_back(symbols.create(queryAttributes.getStr(0)));
-            return {{rowId, attrs}};
-        }
+            return {rowId, placeholder_t()};
+        case AttrType::FullAttrs:
+            return {rowId, getChildren()};
         case AttrType::String: {
-            NixStringContext context;
-            if (!queryAttribute.isNull(3))
-                for (auto & s : tokenizeString<std::vector<std::string>>(queryAttribute.getStr(3), " "))
-                    context.insert(NixStringContextElem::parse(s));
-            return {{rowId, string_t{queryAttribute.getStr(2), context}}};
+            NixStringContext ctx;
+            if (context)
+                for (auto & s : tokenizeString<std::vector<std::string>>(*context, " "))
+                    ctx.insert(NixStringContextElem::parse(s));
+            return {rowId, string_t{getStr(), ctx}};
         }
         case AttrType::Bool:
-            return {{rowId, queryAttribute.getInt(2) != 0}};
+            return {rowId, getInt() != 0};
         case AttrType::Int:
-            return {{rowId, int_t{NixInt{queryAttribute.getInt(2)}}}};
+            return {rowId, int_t{NixInt{getInt()}}};
         case AttrType::ListOfStrings:
-            return {{rowId, tokenizeString<std::vector<std::string>>(queryAttribute.getStr(2), "\t")}};
+            return {rowId, tokenizeString<std::vector<std::string>>(getStr(), "\t")};
         case AttrType::Missing:
-            return {{rowId, missing_t()}};
+            return {rowId, missing_t()};
         case AttrType::Misc:
-            return {{rowId, misc_t()}};
+            return {rowId, misc_t()};
         case AttrType::Failed:
-            return {{rowId, failed_t()}};
+            return {rowId, failed_t()};
         default:
             throw Error("unexpected type in evaluation cache");
         }
     }
+
+    /**
+     * Look up `key` among the rows that haven't been written yet.
+     */
+    std::optional<std::pair<AttrId, AttrValue>> getPendingAttr(AttrKey key)
+    {
+        auto pending(_pending.lock());
+
+        const Row * row = nullptr;
+        for (auto * rows : {&pending->rows, &pending->flushing}) {
+            auto i = rows->find(key);
+            if (i != rows->end()) {
+                row = &i->second;
+                break;
+            }
+        }
+        if (!row)
+            return {};
+
+        return decode(
+            row->rowId,
+            row->type,
+            [&]() { return std::get<std::string>(row->value); },
+            [&]() { return std::get<int64_t>(row->value); },
+            row->context,
+            [&]() {
+                /* The children of a pending row were added together
+                   with it, so they're still pending as well. */
+                std::vector<Symbol> attrs;
+                for (auto * rows : {&pending->rows, &pending->flushing})
+                    for (auto i = rows->lower_bound({row->rowId, Symbol()});
+                         i != rows->end() && i->first.first == row->rowId;
+                         ++i)
+                        attrs.push_back(i->first.second);
+                std::sort(attrs.begin(), attrs.end());
+                attrs.erase(std::unique(attrs.begin(), attrs.end()), attrs.end());
+                return attrs;
+            });
+    }
+
+    /**
+     * Read all descendants of `rowId` up to `depth` levels down in a
+     * single query, so that walking that part of the tree doesn't
+     * need a query per attribute.
+     */
+    void prefetch(AttrId rowId, unsigned int depth)
+    {
+        rowId = resolve(rowId);
+        /* Rows that haven't been written yet have no children in the
+           database. */
+        if (failed || rowId >= firstPendingRowId || !_prefetched.lock()->parents.insert(rowId).second)
+            return;
+
+        struct Fetched
+        {
+            AttrId rowId;
+            AttrKey key;
+            AttrType type;
+            std::string str;
+            int64_t n;
+            std::optional<std::string> context;
+            unsigned int depth;
+        };
+
+        std::vector<Fetched> fetched;
+        std::unordered_map<AttrId, std::vector<Symbol>> children;
+
+        try {
+            auto state(_state->lock());
+            auto query(state->querySubtree.use()(rowId)(depth));
+            while (query.next()) {
+                auto & row = fetched.emplace_back(Fetched{
+                    .rowId = (AttrId) query.getInt(0),
+                    .key = {(AttrId) query.getInt(1), symbols.create(query.getStr(2))},
+                    .type = (AttrType) query.getInt(3),
+                    .str = query.isNull(4) ? "" : query.getStr(4),
+                    .n = query.getInt(4),
+                    .context = query.isNull(5) ? std::nullopt : std::optional(query.getStr(5)),
+                    .depth = (unsigned int) query.getInt(6),
+                });
+                children[row.key.first].push_back(row.key.second);
+            }
+        } catch (SQLiteError &) {
+            ignoreExceptionExceptInterrupt();
+            return;
+        }
+
+        auto prefetched(_prefetched.lock());
+
+        for (auto & row : fetched) {
+            /* The children of the deepest level weren't fetched, so
+               leave those rows to getAttr(). */
+            if (row.depth == depth && row.type == AttrType::FullAttrs)
+                continue;
+            if (row.depth < depth)
+                prefetched->parents.insert(row.rowId);
+            prefetched->attrs.insert_or_assign(
+                row.key,
+                decode(
+                    row.rowId,
+                    row.type,
+                    [&]() { return row.str; },
+                    [&]() { return row.n; },
+                    row.context,
+                    [&]() { return children[row.rowId]; }));
+        }
+    }
+
+    std::optional<std::pair<AttrId, AttrValue>> getAttr(AttrKey key)
+    {
+        if (auto attr = getPendingAttr(key))
+            return attr;
+
+        /* The parent may have been written since it was looked up. */
+        key.first = resolve(key.first);
+
+        {
+            auto prefetched(_prefetched.lock());
+            auto i = prefetched->attrs.find(key);
+            if (i != prefetched->attrs.end()) {
+                auto attr = std::move(i->second);
+                prefetched->attrs.erase(i);
+                return attr;
+            }
+        }
+
+        auto state(_state->lock());
+
+        auto queryAttribute(state->queryAttribute.use()(key.first)(symbols[key.second]));
+        if (!queryAttribute.next())
+            return {};
+
+        auto rowId = (AttrId) queryAttribute.getInt(0);
+
+        return decode(
+            rowId,
+            (AttrType) queryAttribute.getInt(1),
+            [&]() { return queryAttribute.getStr(2); },
+            [&]() { return queryAttribute.getInt(2); },
+            queryAttribute.isNull(3) ? std::nullopt : std::optional(queryAttribute.getStr(3)),
+            [&]() {
+                // FIXME: expensive, should separate this out.
+                std::vector<Symbol> attrs;
+                auto queryAttributes(state->queryAttributes.use()(rowId));
+                while (queryAttributes.next())
+                    attrs.emplace_back(symbols.create(queryAttributes.getStr(0)));
+                return attrs;
+            });
+    }
 };
 
 static std::shared_ptr<AttrDb> makeAttrDb(const StoreDirConfig & cfg, const Hash & fingerprint, SymbolTable & symbols)
@@ -358,8 +658,15 @@ Value & AttrCursor::getValue()
 
 void AttrCursor::fetchCachedValue()
 {
-    if (!cachedValue)
+    if (!cachedValue) {
         cachedValue = root->db->getAttr(getKey());
+        /* Tools that look at one attribute set usually go on to look
+           at its children, so read those in bulk. */
+        if (cachedValue)
+            if (auto attrs = std::get_if<std::vector<Symbol>>(&cachedValue->second);
+                attrs && attrs->size() <= prefetchMaxAttrs)
+                root->db->prefetch(cachedValue->first, prefetchDepth);
+    }
     if (cachedValue && std::get_if<failed_t>(&cachedValue->second) && parent)
         throw CachedEvalError(parent->first, parent->second);
 }
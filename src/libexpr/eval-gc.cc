@@ -3,6 +3,7 @@
 #include "nix/expr/eval-settings.hh"
 #include "nix/util/config-global.hh"
 #include "nix/util/serialise.hh"
+#include "nix/util/util.hh"
 #include "nix/expr/eval-gc.hh"
 #include "nix/expr/value.hh"
 
@@ -46,6 +47,26 @@ static void * oomHandler(size_t requested)
     throw std::bad_alloc();
 }
 
+/**
+ * If non-zero, collection is disabled until the heap grows beyond
+ * this many bytes. See `NIX_GC_ARENA_SIZE`.
+ */
+static size_t arenaSize = 0;
+
+/* Called by Boehm with the allocation lock held, so we can't use
+   GC_enable() here. Undoing GC_disable() by hand is safe under that
+   lock. */
+static void onHeapResize(GC_word heapSize)
+{
+    if (arenaSize && heapSize > arenaSize) {
+        arenaSize = 0;
+#  pragma GCC diagnostic push
+#  pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+        GC_dont_gc--;
+#  pragma GCC diagnostic pop
+    }
+}
+
 static inline void initGCReal()
 {
     /* Initialise the Boehm garbage collector. */
@@ -62,6 +83,10 @@ static inline void initGCReal()
        start of something. */
     GC_start_performance_measurement();
 
+    /* Let child processes that keep evaluating after fork() (such as
+       the workers of `nix eval-jobs`) use the heap they inherit. */
+    GC_set_handle_fork(1);
+
     GC_INIT();
 
     /* Enable parallel marking. */
@@ -99,6 +124,18 @@ static inline void initGCReal()
         debug("setting initial heap size to %1% bytes", size);
         GC_expand_hp(size);
     }
+
+    /* Short-lived evaluations usually finish long before they run out
+       of memory, so don't spend any time on marking until the heap
+       gets big. */
+    if (auto s = getEnv("NIX_GC_ARENA_SIZE")) {
+        arenaSize = string2IntWithUnitPrefix<size_t>(*s);
+        if (arenaSize) {
+            debug("disabling garbage collection until the heap exceeds %1% bytes", arenaSize);
+            GC_set_on_heap_resize(onHeapResize);
+            GC_disable();
+        }
+    }
 }
 
 static size_t gcCyclesAfterInit = 0;
@@ -138,4 +175,25 @@ void assertGCInitialized()
     assert(gcInitialised);
 }
 
+GCThreadRegistration::GCThreadRegistration()
+{
+#if NIX_USE_BOEHMGC
+    if (GC_thread_is_registered())
+        return;
+    GC_stack_base sb;
+    if (GC_get_stack_base(&sb) != GC_SUCCESS)
+        throw Error("cannot determine the stack of the current thread");
+    GC_register_my_thread(&sb);
+    registered = true;
+#endif
+}
+
+GCThreadRegistration::~GCThreadRegistration()
+{
+#if NIX_USE_BOEHMGC
+    if (registered)
+        GC_unregister_my_thread();
+#endif
+}
+
 } // namespace nix
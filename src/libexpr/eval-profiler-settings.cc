@@ -14,6 +14,12 @@ EvalProfilerMode BaseSetting<EvalProfilerMode>::parse(const std::string & str) c
         return EvalProfilerMode::disabled;
     else if (str == "flamegraph")
         return EvalProfilerMode::flamegraph;
+    else if (str == "sampling")
+        return EvalProfilerMode::sampling;
+    else if (str == "allocations")
+        return EvalProfilerMode::allocations;
+    else if (str == "retention")
+        return EvalProfilerMode::retention;
     else
         throw UsageError("option '%s' has invalid value '%s'", name, str);
 }
@@ -31,6 +37,12 @@ std::string BaseSetting<EvalProfilerMode>::to_string() const
         return "disabled";
     else if (value == EvalProfilerMode::flamegraph)
         return "flamegraph";
+    else if (value == EvalProfilerMode::sampling)
+        return "sampling";
+    else if (value == EvalProfilerMode::allocations)
+        return "allocations";
+    else if (value == EvalProfilerMode::retention)
+        return "retention";
     else
         unreachable();
 }
@@ -40,6 +52,9 @@ NLOHMANN_JSON_SERIALIZE_ENUM(
     {
         {EvalProfilerMode::disabled, "disabled"},
         {EvalProfilerMode::flamegraph, "flamegraph"},
+        {EvalProfilerMode::sampling, "sampling"},
+        {EvalProfilerMode::allocations, "allocations"},
+        {EvalProfilerMode::retention, "retention"},
     });
 
 /* Explicit instantiation of templates */
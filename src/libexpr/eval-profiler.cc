@@ -2,6 +2,18 @@
 #include "nix/expr/nixexpr.hh"
 #include "nix/expr/eval.hh"
 #include "nix/util/lru-cache.hh"
+#include "nix/util/sync.hh"
+#include "nix/util/std-hash.hh"
+
+#include <atomic>
+#include <thread>
+
+#include <boost/unordered/unordered_flat_map.hpp>
+#include <boost/unordered/unordered_flat_set.hpp>
+
+#if NIX_USE_BOEHMGC
+#  include <gc/gc.h>
+#endif
 
 namespace nix {
 
@@ -115,6 +127,14 @@ using FrameInfo =
     std::variant<LambdaFrameInfo, PrimOpFrameInfo, FunctorFrameInfo, DerivationStrictFrameInfo, GenericFrameInfo>;
 using FrameStack = std::vector<FrameInfo>;
 
+AutoCloseFD openProfileFile(const std::filesystem::path & profileFile)
+{
+    AutoCloseFD fd = toDescriptor(open(profileFile.string().c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0660));
+    if (!fd)
+        throw SysError("opening file %s", profileFile);
+    return fd;
+}
+
 /**
  * Stack sampling profiler.
  */
@@ -136,12 +156,7 @@ public:
     SampleStack(EvalState & state, std::filesystem::path profileFile, std::chrono::nanoseconds period)
         : state(state)
         , sampleInterval(period)
-        , profileFd([&]() {
-            AutoCloseFD fd = toDescriptor(open(profileFile.string().c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0660));
-            if (!fd)
-                throw SysError("opening file %s", profileFile);
-            return fd;
-        }())
+        , profileFd(openProfileFile(profileFile))
         , posCache(state)
     {
     }
@@ -341,6 +356,555 @@ SampleStack::~SampleStack()
     }
 }
 
+/**
+ * Cheap to construct and compare frame for profilers that record many
+ * stacks. Only holds pointers to objects that are not garbage
+ * collected, and is only symbolized when the profile is written out.
+ */
+struct CompactFrame
+{
+    enum struct Kind : uint8_t { lambda, primOp, functor, generic };
+
+    Kind kind;
+    ExprLambda * lambda = nullptr;
+    const PrimOp * primOp = nullptr;
+    /** Position where the function has been called. */
+    PosIdx callPos;
+
+    static CompactFrame fromCall(const Value & v, PosIdx pos)
+    {
+        if (v.isLambda())
+            return {.kind = Kind::lambda, .lambda = v.lambda().fun, .callPos = pos};
+        else if (v.isPrimOp())
+            return {.kind = Kind::primOp, .primOp = v.primOp(), .callPos = pos};
+        else if (v.isPrimOpApp())
+            return {.kind = Kind::primOp, .primOp = v.primOpAppPrimOp(), .callPos = pos};
+        else if (v.type() == nAttrs)
+            return {.kind = Kind::functor, .callPos = pos};
+        else
+            return {.kind = Kind::generic, .callPos = pos};
+    }
+
+    std::ostream & symbolize(const EvalState & state, std::ostream & os, PosCache & posCache) const
+    {
+        switch (kind) {
+        case Kind::lambda:
+            return LambdaFrameInfo{.expr = lambda, .callPos = callPos}.symbolize(state, os, posCache);
+        case Kind::primOp:
+            return PrimOpFrameInfo{.expr = primOp, .callPos = callPos}.symbolize(state, os, posCache);
+        case Kind::functor:
+            return FunctorFrameInfo{.pos = callPos}.symbolize(state, os, posCache);
+        case Kind::generic:
+            return GenericFrameInfo{.pos = callPos}.symbolize(state, os, posCache);
+        }
+        unreachable();
+    }
+
+    auto operator<=>(const CompactFrame & rhs) const = default;
+};
+
+/**
+ * Low-overhead variant of `SampleStack`. Function calls only maintain
+ * a shadow stack of `CompactFrame`s, and a timer thread requests a
+ * sample at the configured frequency, which is taken on the next
+ * function call.
+ */
+class TimerSampleStack : public EvalProfiler
+{
+    /* How often samples are written out, see `SampleStack`. */
+    static constexpr std::chrono::microseconds profileDumpInterval = std::chrono::milliseconds(2000);
+
+    Hooks getNeededHooksImpl() const override
+    {
+        return Hooks().set(preFunctionCall).set(postFunctionCall);
+    }
+
+public:
+    TimerSampleStack(EvalState & state, std::filesystem::path profileFile, std::chrono::nanoseconds period)
+        : state(state)
+        , profileFd(openProfileFile(profileFile))
+        , posCache(state)
+    {
+        if (period.count() == 0)
+            sampleRequested = true;
+        else
+            timerThread = std::thread([this, period]() {
+                auto quit(this->quit.lock());
+                while (!*quit) {
+                    quit.wait_for(quitCV, period);
+                    sampleRequested.store(true, std::memory_order_relaxed);
+                }
+            });
+    }
+
+    [[gnu::noinline]] void
+    preFunctionCallHook(EvalState & state, const Value & v, std::span<Value *> args, const PosIdx pos) override;
+    [[gnu::noinline]] void
+    postFunctionCallHook(EvalState & state, const Value & v, std::span<Value *> args, const PosIdx pos) override;
+
+    void saveProfile();
+
+    TimerSampleStack(const TimerSampleStack &) = delete;
+    TimerSampleStack & operator=(const TimerSampleStack &) = delete;
+    ~TimerSampleStack();
+
+private:
+    EvalState & state;
+    AutoCloseFD profileFd;
+    std::vector<CompactFrame> stack;
+    std::map<std::vector<CompactFrame>, uint32_t> samples;
+    std::chrono::time_point<std::chrono::steady_clock> lastDump = std::chrono::steady_clock::now();
+    PosCache posCache;
+
+    /** Set by the timer thread, cleared once a sample has been taken. */
+    std::atomic<bool> sampleRequested{false};
+    Sync<bool> quit{false};
+    std::condition_variable quitCV;
+    std::thread timerThread;
+};
+
+[[gnu::noinline]] void
+TimerSampleStack::preFunctionCallHook(EvalState & state, const Value & v, std::span<Value *> args, const PosIdx pos)
+{
+    stack.push_back(CompactFrame::fromCall(v, pos));
+
+    if (!sampleRequested.load(std::memory_order_relaxed)) [[likely]]
+        return;
+
+    if (timerThread.joinable())
+        sampleRequested.store(false, std::memory_order_relaxed);
+    samples[stack] += 1;
+
+    auto now = std::chrono::steady_clock::now();
+    if (now - lastDump >= profileDumpInterval) {
+        saveProfile();
+        samples.clear();
+        lastDump = std::chrono::steady_clock::now();
+    }
+}
+
+[[gnu::noinline]] void
+TimerSampleStack::postFunctionCallHook(EvalState & state, const Value & v, std::span<Value *> args, const PosIdx pos)
+{
+    if (!stack.empty())
+        stack.pop_back();
+}
+
+void TimerSampleStack::saveProfile()
+{
+    auto os = std::ostringstream{};
+    for (auto & [stack, count] : samples) {
+        auto first = true;
+        for (auto & frame : stack) {
+            if (first)
+                first = false;
+            else
+                os << ";";
+            frame.symbolize(state, os, posCache);
+        }
+        os << " " << count;
+        writeLine(profileFd.get(), os.str());
+        /* Clear ostringstream. */
+        os.str("");
+        os.clear();
+    }
+}
+
+TimerSampleStack::~TimerSampleStack()
+{
+    if (timerThread.joinable()) {
+        *quit.lock() = true;
+        quitCV.notify_one();
+        timerThread.join();
+    }
+
+    /* Guard against cases when we are already unwinding the stack. */
+    try {
+        saveProfile();
+    } catch (...) {
+        ignoreExceptionInDestructor();
+    }
+}
+
+/**
+ * A tree of frames weighted per node, for profilers that attribute a
+ * quantity to whole stacks. Keeping stacks as a tree only costs a hash
+ * lookup per frame. Node 0 is the root.
+ */
+struct FrameTree
+{
+    struct Node
+    {
+        CompactFrame frame;
+        uint32_t parent;
+        uint32_t depth = 0;
+        uint64_t weight = 0;
+    };
+
+    std::vector<Node> nodes{Node{.frame = {.kind = CompactFrame::Kind::generic}, .parent = 0}};
+
+    /**
+     * Return the child of `parent` for `frame`, adding it if needed.
+     */
+    uint32_t child(uint32_t parent, const CompactFrame & frame)
+    {
+        auto [i, inserted] = children.try_emplace({parent, frame}, (uint32_t) nodes.size());
+        if (inserted) {
+            auto depth = nodes[parent].depth + 1;
+            nodes.push_back({.frame = frame, .parent = parent, .depth = depth});
+        }
+        return i->second;
+    }
+
+    /**
+     * Write the stack of every node with a non-zero weight in folded
+     * format, with the root shown as `rootName`.
+     */
+    void save(const EvalState & state, Descriptor fd, PosCache & posCache, std::string_view rootName) const
+    {
+        auto os = std::ostringstream{};
+        std::vector<uint32_t> path;
+        for (uint32_t i = 0; i < nodes.size(); ++i) {
+            if (!nodes[i].weight)
+                continue;
+            os << rootName;
+            for (auto j = i; j != 0; j = nodes[j].parent)
+                path.push_back(j);
+            for (auto j = path.rbegin(); j != path.rend(); ++j) {
+                os << ";";
+                nodes[*j].frame.symbolize(state, os, posCache);
+            }
+            os << " " << nodes[i].weight;
+            writeLine(fd, os.str());
+            path.clear();
+            /* Clear ostringstream. */
+            os.str("");
+            os.clear();
+        }
+    }
+
+private:
+    struct ChildKey
+    {
+        uint32_t parent;
+        CompactFrame frame;
+
+        bool operator==(const ChildKey & rhs) const = default;
+    };
+
+    struct ChildKeyHash
+    {
+        size_t operator()(const ChildKey & key) const noexcept
+        {
+            size_t seed = 0;
+            hash_combine(seed, key.parent, key.frame.kind, key.frame.lambda, key.frame.primOp, key.frame.callPos);
+            return seed;
+        }
+    };
+
+    boost::unordered_flat_map<ChildKey, uint32_t, ChildKeyHash> children;
+};
+
+/**
+ * Attributes every byte allocated through `EvalMemory` to the call
+ * stack that was active at the time. Instead of sampling, the
+ * allocation counter is read on every function entry and exit, and the
+ * difference since the previous read is added to the current stack.
+ */
+class AllocationProfiler : public EvalProfiler
+{
+    Hooks getNeededHooksImpl() const override
+    {
+        return Hooks().set(preFunctionCall).set(postFunctionCall);
+    }
+
+    /** Add the bytes allocated since the last call to the current stack. */
+    void account()
+    {
+        auto bytes = state.mem.getStats().nrBytes.load();
+        tree.nodes[stack.back()].weight += bytes - lastBytes;
+        lastBytes = bytes;
+    }
+
+public:
+    AllocationProfiler(EvalState & state, std::filesystem::path profileFile)
+        : state(state)
+        , profileFd(openProfileFile(profileFile))
+        , posCache(state)
+    {
+        Counter::enabled = true;
+        lastBytes = state.mem.getStats().nrBytes.load();
+    }
+
+    [[gnu::noinline]] void
+    preFunctionCallHook(EvalState & state, const Value & v, std::span<Value *> args, const PosIdx pos) override
+    {
+        account();
+        stack.push_back(tree.child(stack.back(), CompactFrame::fromCall(v, pos)));
+    }
+
+    [[gnu::noinline]] void
+    postFunctionCallHook(EvalState & state, const Value & v, std::span<Value *> args, const PosIdx pos) override
+    {
+        account();
+        if (stack.size() > 1)
+            stack.pop_back();
+    }
+
+    AllocationProfiler(const AllocationProfiler &) = delete;
+    AllocationProfiler & operator=(const AllocationProfiler &) = delete;
+    ~AllocationProfiler();
+
+private:
+    EvalState & state;
+    AutoCloseFD profileFd;
+    /** The root is for allocations outside of any call. */
+    FrameTree tree;
+    std::vector<uint32_t> stack{0};
+    uint64_t lastBytes = 0;
+    PosCache posCache;
+};
+
+AllocationProfiler::~AllocationProfiler()
+{
+    /* Guard against cases when we are already unwinding the stack. */
+    try {
+        account();
+        tree.save(state, profileFd.get(), posCache, "«toplevel»");
+    } catch (...) {
+        ignoreExceptionInDestructor();
+    }
+}
+
+#if NIX_USE_BOEHMGC
+
+/**
+ * Attributes the heap retained by closures and thunks to the lambdas
+ * and expressions that created them. Whenever the GC heap has grown by
+ * a quarter since the last analysis, the values reachable from the
+ * imported files and from the arguments of the active function calls
+ * are traversed, and the size of every object is charged to the
+ * innermost closure or thunk whose environment it was first reached
+ * through. Only the last analysis, at the largest heap size, is written
+ * out, as folded retention paths weighted by bytes.
+ *
+ * Objects reachable through several paths are only charged to the
+ * first one, so this approximates a dominator tree.
+ */
+class RetentionProfiler : public EvalProfiler
+{
+    /** How many calls to make between checks of the heap size. */
+    static constexpr uint32_t checkInterval = 4096;
+
+    /** Deeper retention paths are charged to their ancestor at this depth. */
+    static constexpr uint32_t maxDepth = 64;
+
+    Hooks getNeededHooksImpl() const override
+    {
+        return Hooks().set(preFunctionCall).set(postFunctionCall);
+    }
+
+    struct Item
+    {
+        const Value * value;
+        const Env * env;
+        uint32_t owner;
+    };
+
+    /**
+     * The size of a GC-allocated object. Objects outside of the GC
+     * heap, like static values, and interior pointers, are not charged.
+     */
+    static size_t objectSize(const void * p)
+    {
+        return GC_base(const_cast<void *>(p)) == p ? GC_size(p) : 0;
+    }
+
+    void maybeAnalyse()
+    {
+        if (++nrCalls % checkInterval)
+            return;
+        auto heapSize = GC_get_heap_size();
+        if (heapSize < nextAnalysis)
+            return;
+        analyse();
+        nextAnalysis = heapSize + heapSize / 4;
+    }
+
+    void analyse();
+
+    void traverse(FrameTree & tree, std::vector<Item> & todo, boost::unordered_flat_set<const void *> & visited);
+
+public:
+    RetentionProfiler(EvalState & state, std::filesystem::path profileFile)
+        : state(state)
+        , profileFd(openProfileFile(profileFile))
+        , posCache(state)
+    {
+        auto heapSize = GC_get_heap_size();
+        nextAnalysis = heapSize + heapSize / 4;
+    }
+
+    [[gnu::noinline]] void
+    preFunctionCallHook(EvalState & state, const Value & v, std::span<Value *> args, const PosIdx pos) override
+    {
+        callRoots.push_back(&v);
+        callRoots.insert(callRoots.end(), args.begin(), args.end());
+        frameSizes.push_back(args.size() + 1);
+        maybeAnalyse();
+    }
+
+    [[gnu::noinline]] void
+    postFunctionCallHook(EvalState & state, const Value & v, std::span<Value *> args, const PosIdx pos) override
+    {
+        if (frameSizes.empty())
+            return;
+        callRoots.resize(callRoots.size() - frameSizes.back());
+        frameSizes.pop_back();
+    }
+
+    RetentionProfiler(const RetentionProfiler &) = delete;
+    RetentionProfiler & operator=(const RetentionProfiler &) = delete;
+    ~RetentionProfiler();
+
+private:
+    EvalState & state;
+    AutoCloseFD profileFd;
+    PosCache posCache;
+
+    /** The functions and arguments of the active calls. */
+    std::vector<const Value *> callRoots;
+    std::vector<size_t> frameSizes;
+
+    uint64_t nrCalls = 0;
+    size_t nextAnalysis = 0;
+    bool analysed = false;
+
+    FrameTree imports, callStack;
+};
+
+void RetentionProfiler::analyse()
+{
+    imports = {};
+    callStack = {};
+
+    boost::unordered_flat_set<const void *> visited;
+    /* Everything can reach the builtins, so don't charge them to
+       whoever gets there first. */
+    visited.insert(&state.baseEnv);
+
+    std::vector<Item> todo;
+    state.visitImportedFiles([&](const Value & v) {
+        if (visited.insert(&v).second)
+            todo.push_back({.value = &v, .env = nullptr, .owner = 0});
+    });
+    traverse(imports, todo, visited);
+
+    for (auto v : callRoots)
+        if (v && visited.insert(v).second)
+            todo.push_back({.value = v, .env = nullptr, .owner = 0});
+    traverse(callStack, todo, visited);
+
+    analysed = true;
+}
+
+void RetentionProfiler::traverse(
+    FrameTree & tree, std::vector<Item> & todo, boost::unordered_flat_set<const void *> & visited)
+{
+    auto pushValue = [&](const Value * v, uint32_t owner) {
+        if (v && visited.insert(v).second)
+            todo.push_back({.value = v, .env = nullptr, .owner = owner});
+    };
+
+    /* An environment reached through a closure or thunk is owned by a
+       new frame for it. */
+    auto pushEnv = [&](const Env * env, uint32_t owner, std::optional<CompactFrame> frame) {
+        if (!env || !visited.insert(env).second)
+            return;
+        if (frame && tree.nodes[owner].depth < maxDepth)
+            owner = tree.child(owner, *frame);
+        todo.push_back({.value = nullptr, .env = env, .owner = owner});
+    };
+
+    auto charge = [&](uint32_t owner, const void * p) {
+        if (p && visited.insert(p).second)
+            tree.nodes[owner].weight += objectSize(p);
+    };
+
+    while (!todo.empty()) {
+        auto [v, env, owner] = todo.back();
+        todo.pop_back();
+
+        if (env) {
+            auto size = objectSize(env);
+            tree.nodes[owner].weight += size;
+            /* Environments are cleared on allocation, so the slots
+               beyond the ones in use are null. */
+            auto nrSlots = size > sizeof(Env) ? (size - sizeof(Env)) / sizeof(Value *) : 0;
+            for (size_t i = 0; i < nrSlots; ++i)
+                pushValue(env->values[i], owner);
+            pushEnv(env->up, owner, std::nullopt);
+            continue;
+        }
+
+        tree.nodes[owner].weight += objectSize(v);
+
+        /* Values under construction by the active calls. */
+        if (!v->isValid())
+            continue;
+
+        if (v->isThunk()) {
+            auto thunk = v->thunk();
+            pushEnv(thunk.env, owner, CompactFrame{.kind = CompactFrame::Kind::generic, .callPos = thunk.expr->getPos()});
+        } else if (v->isApp()) {
+            pushValue(v->app().left, owner);
+            pushValue(v->app().right, owner);
+        } else if (v->isPrimOpApp()) {
+            pushValue(v->primOpApp().left, owner);
+            pushValue(v->primOpApp().right, owner);
+        } else if (v->isLambda()) {
+            auto lambda = v->lambda();
+            pushEnv(lambda.env, owner, CompactFrame{.kind = CompactFrame::Kind::lambda, .lambda = lambda.fun});
+        } else
+            switch (v->type()) {
+            case nAttrs:
+                /* Only the top layer; base layers are usually charged
+                   to the attrsets they came from. */
+                charge(owner, v->attrs());
+                for (auto & attr : *v->attrs())
+                    pushValue(attr.value, owner);
+                break;
+            case nList: {
+                auto list = v->listView();
+                charge(owner, list.data());
+                for (auto elem : list)
+                    pushValue(elem, owner);
+                break;
+            }
+            case nString:
+                charge(owner, GC_base((void *) v->c_str()));
+                break;
+            default:
+                break;
+            }
+    }
+}
+
+RetentionProfiler::~RetentionProfiler()
+{
+    /* Guard against cases when we are already unwinding the stack. */
+    try {
+        if (!analysed)
+            analyse();
+        imports.save(state, profileFd.get(), posCache, "«imports»");
+        callStack.save(state, profileFd.get(), posCache, "«call stack»");
+    } catch (...) {
+        ignoreExceptionInDestructor();
+    }
+}
+
+#endif
+
 } // namespace
 
 ref<EvalProfiler> makeSampleStackProfiler(EvalState & state, std::filesystem::path profileFile, uint64_t frequency)
@@ -352,4 +916,28 @@ ref<EvalProfiler> makeSampleStackProfiler(EvalState & state, std::filesystem::pa
     return make_ref<SampleStack>(state, profileFile, period);
 }
 
+ref<EvalProfiler>
+makeTimerSampleStackProfiler(EvalState & state, std::filesystem::path profileFile, uint64_t frequency)
+{
+    /* 0 is a special value for sampling stack after each call. */
+    std::chrono::nanoseconds period = frequency == 0
+                                          ? std::chrono::nanoseconds{0}
+                                          : std::chrono::nanoseconds{std::nano::den / frequency / std::nano::num};
+    return make_ref<TimerSampleStack>(state, profileFile, period);
+}
+
+ref<EvalProfiler> makeAllocationProfiler(EvalState & state, std::filesystem::path profileFile)
+{
+    return make_ref<AllocationProfiler>(state, profileFile);
+}
+
+ref<EvalProfiler> makeRetentionProfiler(EvalState & state, std::filesystem::path profileFile)
+{
+#if NIX_USE_BOEHMGC
+    return make_ref<RetentionProfiler>(state, profileFile);
+#else
+    throw Error("the 'retention' profiler requires Nix to be built with the Boehm garbage collector");
+#endif
+}
+
 } // namespace nix
@@ -1,9 +1,12 @@
+#include "nix/util/current-process.hh"
 #include "nix/util/users.hh"
 #include "nix/store/globals.hh"
 #include "nix/store/profiles.hh"
 #include "nix/expr/eval.hh"
 #include "nix/expr/eval-settings.hh"
 
+#include <thread>
+
 namespace nix {
 
 /* Very hacky way to parse $NIX_PATH, which is colon-separated, but
@@ -57,6 +60,17 @@ EvalSettings::EvalSettings(bool & readOnlyMode, EvalSettings::LookupPathHooks lo
         builtinsAbortOnWarn = true;
 }
 
+unsigned int EvalSettings::getEvalCores() const
+{
+    if (evalCores != 0)
+        return evalCores;
+
+    if (auto maxCPU = getMaxCPU(); maxCPU > 0)
+        return maxCPU;
+
+    return std::max(1U, std::thread::hardware_concurrency());
+}
+
 Strings EvalSettings::getDefaultNixPath()
 {
     Strings res;
@@ -1,4 +1,5 @@
 #include "nix/expr/eval.hh"
+#include "nix/expr/ast-cache.hh"
 #include "nix/expr/eval-settings.hh"
 #include "nix/expr/primops.hh"
 #include "nix/expr/print-options.hh"
@@ -24,7 +25,10 @@
 #include "nix/fetchers/fetch-to-store.hh"
 #include "nix/fetchers/tarball.hh"
 #include "nix/fetchers/input-cache.hh"
+#include "nix/fetchers/fetch-settings.hh"
 #include "nix/util/current-process.hh"
+#include "nix/util/users.hh"
+#include "nix/util/signals.hh"
 
 #include "parser-tab.hh"
 
@@ -44,6 +48,8 @@
 #include <nlohmann/json.hpp>
 #include <boost/container/small_vector.hpp>
 #include <boost/unordered/concurrent_flat_map.hpp>
+#include <boost/unordered/concurrent_flat_set.hpp>
+#include <boost/unordered/unordered_flat_set.hpp>
 
 #include "nix/util/strings-inline.hh"
 
@@ -81,9 +87,26 @@ static const char * makeImmutableString(std::string_view s)
     return t;
 }
 
+void * EvalMemory::allocBytesAtomic(size_t n)
+{
+    stats.nrBytes += n;
+#if NIX_USE_BOEHMGC
+    void * p = GC_MALLOC_ATOMIC(n);
+#else
+    void * p = malloc(n);
+#endif
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
 StringData & StringData::alloc(EvalMemory & mem, size_t size)
 {
-    void * t = mem.allocBytes(sizeof(StringData) + size + 1);
+    auto n = sizeof(StringData) + size + 1;
+    /* Small strings are served from the size class caches. Larger ones
+       (e.g. the result of `readFile`) contain no pointers, so there is
+       no point in having the collector scan them. */
+    void * t = n <= EvalMemory::nrSizeClasses * EvalMemory::granuleBytes ? mem.allocBytes(n) : mem.allocBytesAtomic(n);
     if (!t)
         throw std::bad_alloc();
     auto res = new (t) StringData(size);
@@ -225,13 +248,24 @@ static constexpr size_t BASE_ENV_SIZE = 128;
 
 EvalMemory::EvalMemory()
 #if NIX_USE_BOEHMGC
-    : valueAllocCache(std::allocate_shared<void *>(traceable_allocator<void *>(), nullptr))
-    , env1AllocCache(std::allocate_shared<void *>(traceable_allocator<void *>(), nullptr))
+    : allocCache(std::allocate_shared<std::array<void *, nrSizeClasses>>(
+          traceable_allocator<std::array<void *, nrSizeClasses>>()))
 #endif
 {
     assertGCInitialized();
 }
 
+#if NIX_USE_BOEHMGC
+void EvalMemory::refillAllocCache(size_t sizeClass)
+{
+    auto & list = (*allocCache)[sizeClass];
+    list = GC_malloc_many((sizeClass + 1) * granuleBytes);
+    if (!list)
+        throw std::bad_alloc();
+    stats.nrAllocCacheRefills++;
+}
+#endif
+
 EvalState::EvalState(
     const LookupPath & lookupPathFromArguments,
     ref<Store> store,
@@ -303,7 +337,13 @@ EvalState::EvalState(
     , srcToStore(make_ref<decltype(srcToStore)::element_type>())
     , importResolutionCache(make_ref<decltype(importResolutionCache)::element_type>())
     , fileEvalCache(make_ref<decltype(fileEvalCache)::element_type>())
+    , readDirCache(make_ref<decltype(readDirCache)::element_type>())
+    , fileParseCache(make_ref<decltype(fileParseCache)::element_type>())
+    , instantiatedDrvs(make_ref<decltype(instantiatedDrvs)::element_type>())
+    , fileStats(make_ref<decltype(fileStats)::element_type>())
+    , fetchTreeStats(make_ref<decltype(fetchTreeStats)::element_type>())
     , regexCache(makeRegexCache())
+    , pendingDerivations(makePendingDerivations())
 #if NIX_USE_BOEHMGC
     , baseEnvP(std::allocate_shared<Env *>(traceable_allocator<Env *>(), &mem.allocEnv(BASE_ENV_SIZE)))
     , baseEnv(**baseEnvP)
@@ -358,6 +398,16 @@ EvalState::EvalState(
         profiler.addProfiler(
             makeSampleStackProfiler(*this, settings.evalProfileFile.get(), settings.evalProfilerFrequency));
         break;
+    case EvalProfilerMode::sampling:
+        profiler.addProfiler(
+            makeTimerSampleStackProfiler(*this, settings.evalProfileFile.get(), settings.evalProfilerFrequency));
+        break;
+    case EvalProfilerMode::allocations:
+        profiler.addProfiler(makeAllocationProfiler(*this, settings.evalProfileFile.get()));
+        break;
+    case EvalProfilerMode::retention:
+        profiler.addProfiler(makeRetentionProfiler(*this, settings.evalProfileFile.get()));
+        break;
     case EvalProfilerMode::disabled:
         break;
     }
@@ -365,16 +415,24 @@ EvalState::EvalState(
 
 EvalState::~EvalState() {}
 
+void EvalState::allowPrefix(const CanonPath & path)
+{
+    auto rootFS2 = rootFS.dynamic_pointer_cast<AllowListSourceAccessor>();
+    if (!rootFS2)
+        return;
+    rootFS2->allowPrefix(path);
+    for (auto dir = path.parent(); dir; dir = dir->parent())
+        readDirCache->erase(SourcePath{rootFS, *dir});
+}
+
 void EvalState::allowPathLegacy(const Path & path)
 {
-    if (auto rootFS2 = rootFS.dynamic_pointer_cast<AllowListSourceAccessor>())
-        rootFS2->allowPrefix(CanonPath(path));
+    allowPrefix(CanonPath(path));
 }
 
 void EvalState::allowPath(const StorePath & storePath)
 {
-    if (auto rootFS2 = rootFS.dynamic_pointer_cast<AllowListSourceAccessor>())
-        rootFS2->allowPrefix(CanonPath(store->printStorePath(storePath)));
+    allowPrefix(CanonPath(store->printStorePath(storePath)));
 }
 
 void EvalState::allowClosure(const StorePath & storePath)
@@ -867,10 +925,50 @@ Value::StringWithContext::Context::fromBuilder(const NixStringContext & context,
 
     auto ctx = new (mem.allocBytes(sizeof(Context) + context.size() * sizeof(value_type))) Context(context.size());
     std::ranges::transform(
-        context, ctx->elems, [&](const NixStringContextElem & elt) { return &StringData::make(mem, elt.to_string()); });
+        context, ctx->elems, [&](const NixStringContextElem & elt) { return &mem.internContextElem(elt); });
     return ctx;
 }
 
+const Value::StringWithContext::Context *
+Value::StringWithContext::Context::merge(std::span<const Context * const> contexts, EvalMemory & mem)
+{
+    if (contexts.empty())
+        return nullptr;
+    if (contexts.size() == 1)
+        return contexts.front();
+
+    /* Equal elements are the same pointer, so only distinct elements
+       need to be compared. */
+    auto less = [](value_type a, value_type b) { return a != b && a->elem < b->elem; };
+
+    const Context * largest = contexts.front();
+    boost::container::small_vector<value_type, 16> res(largest->begin(), largest->end()), tmp;
+    for (auto ctx : contexts.subspan(1)) {
+        if (ctx->size() > largest->size())
+            largest = ctx;
+        tmp.clear();
+        std::ranges::set_union(res, *ctx, std::back_inserter(tmp), less);
+        std::swap(res, tmp);
+    }
+
+    if (res.size() == largest->size())
+        return largest;
+
+    auto ctx = new (mem.allocBytes(sizeof(Context) + res.size() * sizeof(value_type))) Context(res.size());
+    std::ranges::copy(res, ctx->elems);
+    return ctx;
+}
+
+const Value::StringWithContext::Context::Elem & EvalMemory::internContextElem(const NixStringContextElem & elem)
+{
+    auto s = elem.to_string();
+    if (auto i = contextElemIndex.find(std::string_view(s)); i != contextElemIndex.end())
+        return *i->second;
+    auto & res = contextElems.emplace_back(elem, StringData::make(contextElemStrings, s));
+    contextElemIndex.emplace(res.view(), &res);
+    return res;
+}
+
 void Value::mkString(std::string_view s, const NixStringContext & context, EvalMemory & mem)
 {
     mkStringNoCopy(StringData::make(mem, s), Value::StringWithContext::Context::fromBuilder(context, mem));
@@ -996,6 +1094,7 @@ std::string EvalState::mkSingleDerivedPathStringRaw(const SingleDerivedPath & p)
                 auto optStaticOutputPath = std::visit(
                     overloaded{
                         [&](const SingleDerivedPath::Opaque & o) {
+                            flushDerivations();
                             auto drv = store->readDerivation(o.path);
                             auto i = drv.outputs.find(b.output);
                             if (i == drv.outputs.end())
@@ -1114,11 +1213,27 @@ void EvalState::evalFile(const SourcePath & path, Value & v, bool mustBeTrivial)
     auto resolvedPath = getConcurrent(*importResolutionCache, path);
 
     if (!resolvedPath) {
+        nrImportResolutionCacheMisses++;
         resolvedPath = resolveExprPath(path);
         importResolutionCache->emplace(path, *resolvedPath);
+    } else
+        nrImportResolutionCacheHits++;
+
+    auto v2 = getConcurrent(*fileEvalCache, *resolvedPath);
+
+    if (Counter::enabled) {
+        (v2 ? nrFileEvalCacheHits : nrFileEvalCacheMisses)++;
+        fileStats->emplace_or_visit(
+            *resolvedPath,
+            FileStats{.nrImports = 1, .nrImportsCached = v2 ? 1u : 0u},
+            [&](auto & i) {
+                i.second.nrImports++;
+                if (v2)
+                    i.second.nrImportsCached++;
+            });
     }
 
-    if (auto v2 = getConcurrent(*fileEvalCache, *resolvedPath)) {
+    if (v2) {
         forceValue(**v2, noPos);
         v = **v2;
         return;
@@ -1146,12 +1261,36 @@ void EvalState::evalFile(const SourcePath & path, Value & v, bool mustBeTrivial)
     v = *vExpr;
 }
 
+void EvalState::visitImportedFiles(std::function<void(const Value & v)> f) const
+{
+    fileEvalCache->cvisit_all([&](auto & i) {
+        if (i.second)
+            f(*i.second);
+    });
+}
+
 void EvalState::resetFileCache()
 {
     importResolutionCache->clear();
     fileEvalCache->clear();
+    readDirCache->clear();
     inputCache->clear();
-    positions.clear();
+    if (!cacheParsedFiles) {
+        positions.clear();
+        return;
+    }
+
+    /* Cached parse results refer to their positions, so keep the
+       origins of the cached files. A file that was parsed more than
+       once has an origin for every parse, of which only the last one
+       belongs to the cached expression. Everything else (changed
+       files, strings, REPL input) is dropped. */
+    boost::unordered_flat_set<SourcePath> cached;
+    fileParseCache->cvisit_all([&](auto & i) { cached.insert(i.first); });
+    positions.retain([&](const PosTable::Origin & origin) {
+        auto path = std::get_if<SourcePath>(&origin.origin);
+        return path && cached.erase(*path);
+    });
 }
 
 void EvalState::eval(Expr * e, Value & v)
@@ -1394,13 +1533,42 @@ static std::string showAttrSelectionPath(EvalState & state, Env & env, std::span
     return out.str();
 }
 
+/**
+ * Look up `name` in `attrs`, trying the positions in `hints` first and
+ * updating them on a miss. See `ExprSelect::lookupHints`.
+ */
+static inline const Attr * lookupHinted(EvalState & state, const Bindings & attrs, Symbol name, uint32_t * hints)
+{
+    std::atomic_ref<uint32_t> mostRecent(hints[0]), previous(hints[1]);
+    auto hint = mostRecent.load(std::memory_order_relaxed);
+
+    for (auto h : {hint, previous.load(std::memory_order_relaxed)})
+        if (auto j = attrs.getHinted(name, h)) {
+            state.nrSelectCacheHits++;
+            return j;
+        }
+
+    state.nrSelectCacheMisses++;
+    auto j = attrs.get(name);
+    if (j)
+        if (auto newHint = attrs.hintFor(j)) {
+            previous.store(hint, std::memory_order_relaxed);
+            mostRecent.store(*newHint, std::memory_order_relaxed);
+        }
+    return j;
+}
+
 void ExprSelect::eval(EvalState & state, Env & env, Value & v)
 {
     Value vTmp;
     PosIdx pos2;
     Value * vAttrs = &vTmp;
 
-    e->eval(state, env, vTmp);
+    if (baseVar) {
+        vAttrs = state.lookupVar(&env, *baseVar, false);
+        state.forceValue(*vAttrs, baseVar->pos);
+    } else
+        e->eval(state, env, vTmp);
 
     try {
         auto dts = state.debugRepl ? makeDebugTraceStacker(
@@ -1412,19 +1580,20 @@ void ExprSelect::eval(EvalState & state, Env & env, Value & v)
                                          showAttrSelectionPath(state, env, getAttrPath()))
                                    : nullptr;
 
-        for (auto & i : getAttrPath()) {
+        for (const auto & [n, i] : enumerate(getAttrPath())) {
             state.nrLookups++;
             const Attr * j;
             auto name = getName(i, state, env);
+            auto hints = lookupHints + n * hintsPerAttr;
             if (def) {
                 state.forceValue(*vAttrs, pos);
-                if (vAttrs->type() != nAttrs || !(j = vAttrs->attrs()->get(name))) {
+                if (vAttrs->type() != nAttrs || !(j = lookupHinted(state, *vAttrs->attrs(), name, hints))) {
                     def->eval(state, env, v);
                     return;
                 }
             } else {
                 state.forceAttrs(*vAttrs, pos, "while selecting an attribute");
-                if (!(j = vAttrs->attrs()->get(name))) {
+                if (!(j = lookupHinted(state, *vAttrs->attrs(), name, hints))) {
                     StringSet allAttrNames;
                     for (auto & attr : *vAttrs->attrs())
                         allAttrNames.insert(std::string(state.symbols[attr.name]));
@@ -1505,6 +1674,10 @@ void EvalState::callFunction(Value & fun, std::span<Value *> args, Value & vRes,
 {
     auto _level = addCallDepth(pos);
 
+    /* Function calls are frequent enough to make evaluation
+       interruptible, but much rarer than forcing values. */
+    checkInterrupt();
+
     auto neededHooks = profiler.getNeededHooks();
     if (neededHooks.test(EvalProfiler::preFunctionCall)) [[unlikely]]
         profiler.preFunctionCallHook(*this, fun, args, pos);
@@ -1756,13 +1929,89 @@ void ExprCall::eval(EvalState & state, Env & env, Value & v)
     // 4: about 60
     // 5: under 10
     // This excluded attrset lambdas (`{...}:`). Contributions of mixed lambdas appears insignificant at ~150 total.
-    SmallValueVector<4> vArgs(args->size());
-    for (size_t i = 0; i < args->size(); ++i)
-        vArgs[i] = (*args)[i]->maybeThunk(state, env);
+    SmallValueVector<4> vArgs(args.size());
+    for (size_t i = 0; i < args.size(); ++i)
+        vArgs[i] = args[i]->maybeThunk(state, env);
 
     state.callFunction(vFun, vArgs, v, pos);
 }
 
+RepeatedCall::RepeatedCall(EvalState & state, Value & fun, size_t nrArgs, const PosIdx pos)
+    : state(state)
+    , fun(fun)
+    , pos(pos)
+{
+    state.forceValue(fun, pos);
+
+    /* The debugger holds on to the environments of the frames it
+       shows. */
+    if (state.debugRepl || nrArgs == 0 || nrArgs > maxArgs || !fun.isLambda())
+        return;
+
+    auto lambda = fun.lambda().fun;
+    for (size_t i = 0; i < nrArgs; ++i) {
+        if (!lambda || lambda->getFormals())
+            return;
+        lambdas[i] = lambda;
+        lambda = dynamic_cast<ExprLambda *>(lambda->body);
+    }
+
+    /* The bodies of the outer lambdas are the inner lambdas, which
+       capture the environment by design, but the resulting closures
+       are only used to make the next call. */
+    if (!lambdas[nrArgs - 1]->canReuseEnv())
+        return;
+
+    for (size_t i = 0; i < nrArgs; ++i) {
+        envs[i] = &state.mem.allocEnv(1);
+        envs[i]->up = i == 0 ? fun.lambda().env : envs[i - 1];
+    }
+
+    this->nrArgs = nrArgs;
+}
+
+void RepeatedCall::operator()(std::span<Value *> args, Value & vRes)
+{
+    if (args.size() != nrArgs) {
+        state.callFunction(fun, args, vRes, pos);
+        return;
+    }
+
+    auto _level = state.addCallDepth(pos);
+
+    auto neededHooks = state.profiler.getNeededHooks();
+    if (neededHooks.test(EvalProfiler::preFunctionCall)) [[unlikely]]
+        state.profiler.preFunctionCallHook(state, fun, args, pos);
+
+    Finally traceExit_{[&]() {
+        if (state.profiler.getNeededHooks().test(EvalProfiler::postFunctionCall)) [[unlikely]]
+            state.profiler.postFunctionCallHook(state, fun, args, pos);
+    }};
+
+    for (size_t i = 0; i < nrArgs; ++i) {
+        envs[i]->values[0] = args[i];
+        state.nrFunctionCalls++;
+        if (state.countCalls)
+            state.incrFunctionCall(lambdas[i]);
+    }
+
+    auto & lambda = *lambdas[nrArgs - 1];
+    try {
+        lambda.body->eval(state, *envs[nrArgs - 1], vRes);
+    } catch (Error & e) {
+        if (loggerSettings.showTrace.get()) {
+            state.addErrorTrace(
+                e,
+                lambda.pos,
+                "while calling %s",
+                lambda.name ? concatStrings("'", state.symbols[lambda.name], "'") : "anonymous lambda");
+            if (pos)
+                state.addErrorTrace(e, pos, "from call site");
+        }
+        throw;
+    }
+}
+
 // Lifted out of callFunction() because it creates a temporary that
 // prevents tail-call optimisation.
 void EvalState::incrFunctionCall(ExprLambda * fun)
@@ -1770,6 +2019,25 @@ void EvalState::incrFunctionCall(ExprLambda * fun)
     functionCalls[fun]++;
 }
 
+void EvalState::recordFetchTree(const fetchers::Input & input, std::chrono::microseconds time)
+{
+    if (!Counter::enabled)
+        return;
+    fetchTreeStats->emplace_or_visit(input.to_string(), FetchTreeStats{time, 1}, [&](auto & i) {
+        i.second.time += time;
+        i.second.count++;
+    });
+}
+
+void EvalState::recordDerivation(const StorePath & drvPath)
+{
+    if (!Counter::enabled)
+        return;
+    nrDerivations++;
+    if (!instantiatedDrvs->insert(drvPath))
+        nrDuplicateDerivations++;
+}
+
 void EvalState::autoCallFunction(const Bindings & args, Value & fun, Value & res)
 {
     auto pos = fun.determinePos(noPos);
@@ -2059,7 +2327,22 @@ void EvalState::concatLists(
 
 void ExprConcatStrings::eval(EvalState & state, Env & env, Value & v)
 {
+    /* A chain like `a + b + c` parses as `(a + b) + c`. Evaluating
+       each level separately would allocate every intermediate
+       result, making long chains quadratic, so walk down the chain
+       and evaluate all operands in one pass instead. */
+    boost::container::small_vector<ExprConcatStrings *, 4> levels{this};
+    size_t nParts = es.size();
+    while (auto e = levels.back()->nested) {
+        levels.push_back(e);
+        nParts += e->es.size() - 1;
+    }
+
     NixStringContext context;
+    /* Contexts of operands that were already strings. These are
+       merged without going through `context` unless other operands
+       had to be coerced. */
+    boost::container::small_vector<const Value::StringWithContext::Context *, 4> contexts;
     std::vector<BackedStringView> strings;
     size_t sSize = 0;
     NixInt n{0};
@@ -2069,10 +2352,10 @@ void ExprConcatStrings::eval(EvalState & state, Env & env, Value & v)
     ValueType firstType = nString;
 
     // List of returned strings. References to these Values must NOT be persisted.
-    SmallTemporaryValueVector<conservativeStackReservation> values(es.size());
+    SmallTemporaryValueVector<conservativeStackReservation> values(nParts);
     Value * vTmpP = values.data();
 
-    for (auto & [i_pos, i] : es) {
+    auto evalPart = [&](ExprConcatStrings & level, PosIdx i_pos, Expr * i) {
         Value & vTmp = *vTmpP++;
         i->eval(state, env, vTmp);
 
@@ -2102,7 +2385,7 @@ void ExprConcatStrings::eval(EvalState & state, Env & env, Value & v)
             } else
                 state.error<EvalError>("cannot add %1% to an integer", showType(vTmp))
                     .atPos(i_pos)
-                    .withFrame(env, *this)
+                    .withFrame(env, level)
                     .debugThrow();
         } else if (firstType == nFloat) {
             if (vTmp.type() == nInt) {
@@ -2112,39 +2395,70 @@ void ExprConcatStrings::eval(EvalState & state, Env & env, Value & v)
             } else
                 state.error<EvalError>("cannot add %1% to a float", showType(vTmp))
                     .atPos(i_pos)
-                    .withFrame(env, *this)
+                    .withFrame(env, level)
                     .debugThrow();
         } else {
             if (strings.empty())
-                strings.reserve(es.size());
-            /* skip canonization of first path, which would only be not
-            canonized in the first place if it's coming from a ./${foo} type
-            path */
-            auto part = state.coerceToString(
-                i_pos, vTmp, context, "while evaluating a path segment", false, firstType == nString, !first);
-            sSize += part->size();
-            strings.emplace_back(std::move(part));
+                strings.reserve(nParts);
+            if (vTmp.type() == nString) {
+                if (auto ctx = vTmp.context(); ctx && std::ranges::find(contexts, ctx) == contexts.end())
+                    contexts.push_back(ctx);
+                sSize += vTmp.string_view().size();
+                strings.emplace_back(vTmp.string_view());
+            } else {
+                /* skip canonization of first path, which would only be not
+                canonized in the first place if it's coming from a ./${foo} type
+                path */
+                auto part = state.coerceToString(
+                    i_pos, vTmp, context, "while evaluating a path segment", false, firstType == nString, !first);
+                sSize += part->size();
+                strings.emplace_back(std::move(part));
+            }
         }
 
         first = false;
-    }
+    };
 
-    if (firstType == nInt) {
-        v.mkInt(n);
-    } else if (firstType == nFloat) {
-        v.mkFloat(nf);
-    } else if (firstType == nPath) {
-        if (!context.empty())
+    auto checkPathContext = [&](ExprConcatStrings & level) {
+        if (!context.empty() || !contexts.empty())
             state.error<EvalError>("a string that refers to a store path cannot be appended to a path")
-                .atPos(pos)
-                .withFrame(env, *this)
+                .atPos(level.pos)
+                .withFrame(env, level)
                 .debugThrow();
+    };
+
+    auto concatStrings = [&]() {
         std::string resultStr;
         resultStr.reserve(sSize);
         for (const auto & part : strings) {
             resultStr += *part;
         }
-        v.mkPath(state.rootPath(CanonPath(resultStr)), state.mem);
+        return resultStr;
+    };
+
+    for (auto l = levels.rbegin(); l != levels.rend(); ++l) {
+        auto & level = **l;
+        for (auto & [i_pos, i] : level.nested ? level.es.subspan(1) : level.es)
+            evalPart(level, i_pos, i);
+
+        /* An intermediate path result is canonicalised before the
+           next operand is appended to it. */
+        if (&level != this && firstType == nPath) {
+            checkPathContext(level);
+            auto canon = CanonPath(concatStrings()).abs();
+            sSize = canon.size();
+            strings.clear();
+            strings.emplace_back(std::move(canon));
+        }
+    }
+
+    if (firstType == nInt) {
+        v.mkInt(n);
+    } else if (firstType == nFloat) {
+        v.mkFloat(nf);
+    } else if (firstType == nPath) {
+        checkPathContext(*this);
+        v.mkPath(state.rootPath(CanonPath(concatStrings())), state.mem);
     } else {
         auto & resultStr = StringData::alloc(state.mem, sSize);
         auto * tmp = resultStr.data();
@@ -2153,7 +2467,16 @@ void ExprConcatStrings::eval(EvalState & state, Env & env, Value & v)
             tmp += part->size();
         }
         *tmp = '\0';
-        v.mkStringMove(resultStr, context, state.mem);
+        /* Merge the contexts of the operands directly, which shares
+           the context of the only operand that had one. */
+        if (context.empty())
+            v.mkStringNoCopy(resultStr, Value::StringWithContext::Context::merge(contexts, state.mem));
+        else {
+            for (auto ctx : contexts)
+                for (auto * elem : *ctx)
+                    context.insert(elem->elem);
+            v.mkStringMove(resultStr, context, state.mem);
+        }
     }
 }
 
@@ -2190,48 +2513,87 @@ void EvalState::tryFixupBlackHolePos(Value & v, PosIdx pos)
 
 void EvalState::forceValueDeep(Value & v)
 {
-    std::set<const Value *> seen;
+    /* Walk the value graph with an explicit stack rather than by
+       recursion, so that deeply nested values cannot overflow the C
+       stack. Each frame records the next child to visit and the one
+       currently being forced, for error traces. */
+    struct Frame
+    {
+        Value * v;
+        Bindings::const_iterator attr;
+        const Attr * currentAttr = nullptr;
+        size_t next = 0;
+        /* Keeps the debugger's trace for the attribute that produced
+           this value alive while its children are being forced. */
+        std::unique_ptr<DebugTraceStacker> dts;
+    };
+
+    boost::unordered_flat_set<const Value *> seen;
+    std::vector<Frame> stack;
 
-    [&, &state(*this)](this const auto & recurse, Value & v) {
-        auto _level = state.addCallDepth(v.determinePos(noPos));
+    auto visit = [&](Value & v, std::unique_ptr<DebugTraceStacker> dts) {
+        /* Nesting still counts towards `max-call-depth`, so that
+           infinitely deep values fail rather than exhaust memory. */
+        if (callDepth + stack.size() > settings.maxCallDepth)
+            error<StackOverflowError>().atPos(v.determinePos(noPos)).debugThrow();
 
         if (!seen.insert(&v).second)
             return;
 
-        state.forceValue(v, v.determinePos(noPos));
+        forceValue(v, v.determinePos(noPos));
 
-        if (v.type() == nAttrs) {
-            for (auto & i : *v.attrs())
-                try {
-                    // If the value is a thunk, we're evaling. Otherwise no trace necessary.
-                    auto dts = state.debugRepl && i.value->isThunk() ? makeDebugTraceStacker(
-                                                                           state,
-                                                                           *i.value->thunk().expr,
-                                                                           *i.value->thunk().env,
-                                                                           i.pos,
-                                                                           "while evaluating the attribute '%1%'",
-                                                                           state.symbols[i.name])
-                                                                     : nullptr;
-
-                    recurse(*i.value);
-                } catch (Error & e) {
-                    state.addErrorTrace(e, i.pos, "while evaluating the attribute '%1%'", state.symbols[i.name]);
-                    throw;
+        if ((v.type() == nAttrs && !v.attrs()->empty()) || (v.isList() && v.listSize()))
+            stack.push_back(
+                {.v = &v,
+                 .attr = v.type() == nAttrs ? v.attrs()->begin() : Bindings::const_iterator(),
+                 .dts = std::move(dts)});
+    };
+
+    try {
+        visit(v, nullptr);
+
+        while (!stack.empty()) {
+            auto & frame = stack.back();
+
+            if (frame.v->type() == nAttrs) {
+                if (frame.attr == frame.v->attrs()->end()) {
+                    stack.pop_back();
+                    continue;
                 }
-        }
+                auto & i = *(frame.currentAttr = &*frame.attr++);
+                // If the value is a thunk, we're evaling. Otherwise no trace necessary.
+                auto dts = debugRepl && i.value->isThunk() ? makeDebugTraceStacker(
+                                                                 *this,
+                                                                 *i.value->thunk().expr,
+                                                                 *i.value->thunk().env,
+                                                                 i.pos,
+                                                                 "while evaluating the attribute '%1%'",
+                                                                 symbols[i.name])
+                                                           : nullptr;
+                visit(*i.value, std::move(dts));
+            }
 
-        else if (v.isList()) {
-            size_t index = 0;
-            for (auto v2 : v.listView())
-                try {
-                    recurse(*v2);
-                    index++;
-                } catch (Error & e) {
-                    state.addErrorTrace(e, "while evaluating list element at index %1%", index);
-                    throw;
+            else {
+                auto list = frame.v->listView();
+                if (frame.next == list.size()) {
+                    stack.pop_back();
+                    continue;
                 }
+                visit(*list[frame.next++], nullptr);
+            }
+        }
+    } catch (Error & e) {
+        /* Add the same traces, innermost first, as a recursive
+           traversal would have added while unwinding. */
+        for (auto & frame : std::views::reverse(stack)) {
+            if (frame.currentAttr)
+                addErrorTrace(
+                    e, frame.currentAttr->pos, "while evaluating the attribute '%1%'", symbols[frame.currentAttr->name]);
+            else
+                addErrorTrace(e, "while evaluating list element at index %1%", frame.next - 1);
         }
-    }(v);
+        throw;
+    }
 }
 
 NixInt EvalState::forceInt(Value & v, const PosIdx pos, std::string_view errorCtx)
@@ -2336,8 +2698,13 @@ std::string_view EvalState::forceString(Value & v, const PosIdx pos, std::string
 void copyContext(const Value & v, NixStringContext & context, const ExperimentalFeatureSettings & xpSettings)
 {
     if (auto * ctx = v.context())
-        for (auto * elem : *ctx)
-            context.insert(NixStringContextElem::parse(elem->view(), xpSettings));
+        for (auto * elem : *ctx) {
+            /* Elements are already parsed, but check the experimental
+               features that parsing them would. */
+            if (auto * built = std::get_if<NixStringContextElem::Built>(&elem->elem.raw))
+                drvRequireExperiment(*built->drvPath, xpSettings);
+            context.insert(elem->elem);
+        }
 }
 
 std::string_view EvalState::forceString(
@@ -2503,6 +2870,7 @@ StorePath EvalState::copyPathToStore(NixStringContext & context, const SourcePat
         error<EvalError>("file names are not allowed to end in '%1%'", drvExtension).debugThrow();
 
     auto dstPathCached = getConcurrent(*srcToStore, path);
+    (dstPathCached ? nrSrcToStoreHits : nrSrcToStoreMisses)++;
 
     auto dstPath = dstPathCached ? *dstPathCached : [&]() {
         auto dstPath = fetchToStore(
@@ -2941,11 +3309,13 @@ bool EvalState::fullGC()
 #endif
 }
 
-bool Counter::enabled = getEnv("NIX_SHOW_STATS").value_or("0") != "0";
+static bool showStats = getEnv("NIX_SHOW_STATS").value_or("0") != "0";
+
+bool Counter::enabled = showStats;
 
 void EvalState::maybePrintStats()
 {
-    if (Counter::enabled) {
+    if (showStats) {
         // Make the final heap size more deterministic.
 #if NIX_USE_BOEHMGC
         if (!fullGC()) {
@@ -2991,6 +3361,12 @@ void EvalState::printStatistics()
         {GC_is_incremental_mode() ? "gcNonIncrementalFraction" : "gcFraction", gcFullOnlyTime / cpuTime},
 #endif
     };
+    {
+        auto & startup = topObj["startup"];
+        startup = json::object();
+        for (auto & [phase, time] : getStartupTimes())
+            startup[phase] = std::chrono::duration_cast<std::chrono::duration<float>>(time).count();
+    }
     topObj["envs"] = {
         {"number", memstats.nrEnvs.load()},
         {"elements", memstats.nrValuesInEnvs.load()},
@@ -3023,11 +3399,70 @@ void EvalState::printStatistics()
     };
     topObj["nrOpUpdates"] = nrOpUpdates.load();
     topObj["nrOpUpdateValuesCopied"] = nrOpUpdateValuesCopied.load();
+    topObj["allocator"] = {
+        {"cachedAllocs", memstats.nrCachedAllocs.load()},
+        {"cacheRefills", memstats.nrAllocCacheRefills.load()},
+    };
     topObj["nrThunks"] = nrThunks.load();
     topObj["nrAvoided"] = nrAvoided.load();
     topObj["nrLookups"] = nrLookups.load();
+    topObj["nrSelectCacheHits"] = nrSelectCacheHits.load();
+    topObj["nrSelectCacheMisses"] = nrSelectCacheMisses.load();
     topObj["nrPrimOpCalls"] = nrPrimOpCalls.load();
     topObj["nrFunctionCalls"] = nrFunctionCalls.load();
+    topObj["nrDerivations"] = nrDerivations.load();
+    topObj["nrDuplicateDerivations"] = nrDuplicateDerivations.load();
+    topObj["importResolutionCache"] = {
+        {"hits", nrImportResolutionCacheHits.load()},
+        {"misses", nrImportResolutionCacheMisses.load()},
+    };
+    topObj["fileEvalCache"] = {
+        {"hits", nrFileEvalCacheHits.load()},
+        {"misses", nrFileEvalCacheMisses.load()},
+    };
+    topObj["readDirCache"] = {
+        {"hits", nrReadDirCacheHits.load()},
+        {"misses", nrReadDirCacheMisses.load()},
+    };
+    topObj["srcToStore"] = {
+        {"hits", nrSrcToStoreHits.load()},
+        {"misses", nrSrcToStoreMisses.load()},
+    };
+    {
+        auto & list = topObj["files"];
+        list = json::array();
+        fileStats->cvisit_all([&](auto & i) {
+            list.push_back({
+                {"file", i.first.to_string()},
+                {"parseTime", std::chrono::duration<double>(i.second.parseTime).count()},
+                {"parses", i.second.nrParses},
+                {"bytes", i.second.bytes},
+                {"exprs", i.second.nrExprs},
+                {"imports", i.second.nrImports},
+                {"importsCached", i.second.nrImportsCached},
+            });
+        });
+    }
+    {
+        auto & list = topObj["fetchTree"];
+        list = json::array();
+        fetchTreeStats->cvisit_all([&](auto & i) {
+            list.push_back({
+                {"input", i.first},
+                {"time", std::chrono::duration<double>(i.second.time).count()},
+                {"count", i.second.count},
+            });
+        });
+    }
+    {
+        auto fetcherStats = fetchSettings.getCache()->getStats();
+        topObj["fetcherCache"] = {
+            {"memoryHits", fetcherStats.memoryHits},
+            {"dbHits", fetcherStats.dbHits},
+            {"misses", fetcherStats.misses},
+            {"upserts", fetcherStats.upserts},
+        };
+    }
 #if NIX_USE_BOEHMGC
     topObj["gc"] = {
         {"heapSize", heapSize},
@@ -3117,10 +3552,50 @@ Expr * EvalState::parseExprFromFile(const SourcePath & path)
 
 Expr * EvalState::parseExprFromFile(const SourcePath & path, const std::shared_ptr<StaticEnv> & staticEnv)
 {
+    auto start = std::chrono::steady_clock::now();
+    auto nrExprsBefore = Expr::nrExprs.load();
+
     auto buffer = path.resolveSymlinks().readFile();
+
+    std::optional<Hash> hash;
+    if (cacheParsedFiles && staticEnv == staticBaseEnv) {
+        hash = hashString(HashAlgorithm::SHA256, buffer);
+        Expr * e = nullptr;
+        fileParseCache->cvisit(path, [&](auto & i) {
+            if (i.second.first == *hash)
+                e = i.second.second;
+        });
+        if (e)
+            return e;
+    }
+
     // readFile hopefully have left some extra space for terminators
     buffer.append("\0\0", 2);
-    return parse(buffer.data(), buffer.size(), Pos::Origin(path), path.parent(), staticEnv);
+    auto e = settings.useAstCache || sharedAstCache
+                 ? parseWithAstCache(buffer, path, staticEnv)
+                 : parse(buffer.data(), buffer.size(), Pos::Origin(path), path.parent(), staticEnv);
+
+    if (hash)
+        fileParseCache->insert_or_assign(path, std::pair{*hash, e});
+
+    if (Counter::enabled) {
+        /* Concurrent parses make the AST size approximate. */
+        FileStats stats{
+            .parseTime =
+                std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start),
+            .nrParses = 1,
+            .bytes = buffer.size() - 2,
+            .nrExprs = Expr::nrExprs.load() - nrExprsBefore,
+        };
+        fileStats->emplace_or_visit(path, stats, [&](auto & i) {
+            i.second.parseTime += stats.parseTime;
+            i.second.nrParses++;
+            i.second.bytes = stats.bytes;
+            i.second.nrExprs = stats.nrExprs;
+        });
+    }
+
+    return e;
 }
 
 Expr * EvalState::parseExprFromString(
@@ -3272,8 +3747,91 @@ Expr * EvalState::parse(
         docComments = &it->second;
     }
 
-    auto result =
-        parseExprFromBuf(text, length, origin, basePath, mem.exprs, symbols, settings, positions, *docComments, rootFS);
+    auto result = parseExprFromBuf(
+        text,
+        length,
+        positions.addOrigin(origin, length),
+        basePath,
+        mem.exprs,
+        symbols,
+        settings,
+        positions,
+        *docComments,
+        rootFS);
+
+    result->bindVars(*this, staticEnv);
+
+    return result;
+}
+
+Expr *
+EvalState::parseWithAstCache(std::string & buffer, const SourcePath & path, const std::shared_ptr<StaticEnv> & staticEnv)
+{
+    /* Besides the file itself, the key covers everything that can
+       change the result of a successful parse. */
+    HashSink hashSink(HashAlgorithm::SHA256);
+    hashSink(fmt(
+        "%s\n%s\n%d%d%d\n",
+        path.to_string(),
+        getHome().string(),
+        settings.pureEval.get(),
+        experimentalFeatureSettings.isEnabled(Xp::PipeOperators),
+        experimentalFeatureSettings.isEnabled(Xp::NoUrlLiterals)));
+    hashSink(buffer);
+    auto key = hashSink.finish().hash.to_string(HashFormat::Nix32, false);
+    auto cacheFile = getCacheDir() / "eval-ast-v1" / key;
+
+    auto origin = positions.addOrigin(path, buffer.size());
+    auto basePath = path.parent();
+    auto & docComments = positionToDocComment.try_emplace(path).first->second;
+
+    Expr * result = nullptr;
+
+    if (sharedAstCache) {
+        auto entries(sharedAstCache->entries.readLock());
+        if (auto i = entries->find(key); i != entries->end())
+            result = deserialiseExpr(
+                i->second, mem.exprs, symbols, positions, origin, rootFS, basePath.accessor, docComments);
+    }
+
+    if (!result && settings.useAstCache && pathExists(cacheFile)) {
+        try {
+            auto data = readFile(cacheFile);
+            result = deserialiseExpr(data, mem.exprs, symbols, positions, origin, rootFS, basePath.accessor, docComments);
+            if (sharedAstCache)
+                sharedAstCache->entries.lock()->try_emplace(key, std::move(data));
+        } catch (Error & e) {
+            debug("ignoring AST cache entry '%s': %s", cacheFile.string(), e.msg());
+        }
+    }
+
+    if (!result) {
+        result = parseExprFromBuf(
+            buffer.data(),
+            buffer.size(),
+            origin,
+            basePath,
+            mem.exprs,
+            symbols,
+            settings,
+            positions,
+            docComments,
+            rootFS);
+
+        if (auto data = serialiseExpr(*result, symbols, origin, *rootFS, docComments)) {
+            if (settings.useAstCache)
+                try {
+                    createDirs(cacheFile.parent_path());
+                    auto tmp = makeTempPath(cacheFile);
+                    writeFile(tmp.string(), *data);
+                    std::filesystem::rename(tmp, cacheFile);
+                } catch (std::exception & e) {
+                    debug("cannot write AST cache entry '%s': %s", cacheFile.string(), e.what());
+                }
+            if (sharedAstCache)
+                sharedAstCache->entries.lock()->try_emplace(key, std::move(*data));
+        }
+    }
 
     result->bindVars(*this, staticEnv);
 
@@ -1,8 +1,10 @@
 #include "nix/expr/get-drvs.hh"
 #include "nix/expr/eval-inline.hh"
+#include "nix/expr/eval-cache.hh"
 #include "nix/store/derivations.hh"
 #include "nix/store/store-api.hh"
 #include "nix/store/path-with-outputs.hh"
+#include "nix/util/environment-variables.hh"
 
 #include <cstring>
 #include <regex>
@@ -16,6 +18,13 @@ PackageInfo::PackageInfo(EvalState & state, std::string attrPath, const Bindings
 {
 }
 
+PackageInfo::PackageInfo(EvalState & state, std::string attrPath, ref<eval_cache::AttrCursor> cursor)
+    : state(&state)
+    , cursor(cursor.get_ptr())
+    , attrPath(std::move(attrPath))
+{
+}
+
 PackageInfo::PackageInfo(EvalState & state, ref<Store> store, const std::string & drvPathWithOutputs)
     : state(&state)
     , attrs(nullptr)
@@ -42,8 +51,35 @@ PackageInfo::PackageInfo(EvalState & state, ref<Store> store, const std::string
     outPath = {output.path(*store, drv.name, outputName)};
 }
 
+/**
+ * Run `f` on the cursor of a cached package. An evaluation failure
+ * recorded in the cache is evaluated again, so that callers see the
+ * original error, e.g. an `AssertionError`.
+ */
+template<typename F>
+static auto withCursor(eval_cache::AttrCursor & cursor, F && f) -> decltype(f(cursor))
+{
+    try {
+        return f(cursor);
+    } catch (eval_cache::CachedEvalError & e) {
+        e.force();
+    }
+}
+
+const Bindings * PackageInfo::getAttrs() const
+{
+    if (!attrs && cursor) {
+        auto & v = cursor->forceValue();
+        state->forceAttrs(v, noPos, "while evaluating a cached derivation");
+        attrs = v.attrs();
+    }
+    return attrs;
+}
+
 std::string PackageInfo::queryName() const
 {
+    if (name == "" && cursor)
+        name = withCursor(*cursor, [&](auto & c) { return c.getAttr(state->s.name)->getString(); });
     if (name == "" && attrs) {
         auto i = attrs->get(state->s.name);
         if (!i)
@@ -55,6 +91,11 @@ std::string PackageInfo::queryName() const
 
 std::string PackageInfo::querySystem() const
 {
+    if (system == "" && cursor)
+        system = withCursor(*cursor, [&](auto & c) {
+            auto a = c.maybeGetAttr(state->s.system);
+            return a ? a->getString() : "unknown";
+        });
     if (system == "" && attrs) {
         auto i = attrs->get(state->s.system);
         system =
@@ -66,6 +107,17 @@ std::string PackageInfo::querySystem() const
 
 std::optional<StorePath> PackageInfo::queryDrvPath() const
 {
+    if (!drvPath && cursor)
+        drvPath = withCursor(*cursor, [&](auto & c) -> std::optional<StorePath> {
+            /* Unlike getString(), this re-evaluates the attribute if
+               the cached derivation has been garbage-collected. */
+            auto a = c.maybeGetAttr(state->s.drvPath);
+            if (!a)
+                return std::nullopt;
+            auto found = state->store->parseStorePath(a->getStringWithContext().first);
+            found.requireDerivation();
+            return found;
+        });
     if (!drvPath && attrs) {
         if (auto i = attrs->get(state->s.drvPath)) {
             NixStringContext context;
@@ -93,6 +145,13 @@ StorePath PackageInfo::requireDrvPath() const
 
 StorePath PackageInfo::queryOutPath() const
 {
+    if (!outPath && cursor)
+        outPath = withCursor(*cursor, [&](auto & c) -> std::optional<StorePath> {
+            auto a = c.maybeGetAttr(state->s.outPath);
+            if (!a)
+                return std::nullopt;
+            return state->store->parseStorePath(a->getString());
+        });
     if (!outPath && attrs) {
         auto i = attrs->get(state->s.outPath);
         NixStringContext context;
@@ -107,10 +166,27 @@ StorePath PackageInfo::queryOutPath() const
 
 PackageInfo::Outputs PackageInfo::queryOutputs(bool withPaths, bool onlyOutputsToInstall)
 {
+    if (outputs.empty() && cursor && !attrs)
+        withCursor(*cursor, [&](auto & c) {
+            if (auto aOutputs = c.maybeGetAttr(state->s.outputs)) {
+                for (auto & output : aOutputs->getListOfStrings()) {
+                    if (!withPaths) {
+                        outputs.emplace(output, std::nullopt);
+                        continue;
+                    }
+                    auto out = c.maybeGetAttr(output);
+                    auto outPath = out ? out->maybeGetAttr(state->s.outPath) : nullptr;
+                    if (outPath)
+                        outputs.emplace(output, state->store->parseStorePath(outPath->getString()));
+                }
+            } else
+                outputs.emplace("out", withPaths ? std::optional{queryOutPath()} : std::nullopt);
+        });
+
     if (outputs.empty()) {
         /* Get the ‘outputs’ list. */
         const Attr * i;
-        if (attrs && (i = attrs->get(state->s.outputs))) {
+        if (getAttrs() && (i = attrs->get(state->s.outputs))) {
             state->forceList(*i->value, i->pos, "while evaluating the 'outputs' attribute of a derivation");
 
             /* For each output... */
@@ -141,7 +217,7 @@ PackageInfo::Outputs PackageInfo::queryOutputs(bool withPaths, bool onlyOutputsT
             outputs.emplace("out", withPaths ? std::optional{queryOutPath()} : std::nullopt);
     }
 
-    if (!onlyOutputsToInstall || !attrs)
+    if (!onlyOutputsToInstall || !getAttrs())
         return outputs;
 
     const Attr * i;
@@ -179,7 +255,7 @@ PackageInfo::Outputs PackageInfo::queryOutputs(bool withPaths, bool onlyOutputsT
 
 std::string PackageInfo::queryOutputName() const
 {
-    if (outputName == "" && attrs) {
+    if (outputName == "" && getAttrs()) {
         auto i = attrs->get(state->s.outputName);
         outputName =
             i ? state->forceStringNoCtx(*i->value, noPos, "while evaluating the output name of a derivation") : "";
@@ -191,7 +267,7 @@ const Bindings * PackageInfo::getMeta()
 {
     if (meta)
         return meta;
-    if (!attrs)
+    if (!getAttrs())
         return 0;
     auto a = attrs->get(state->s.meta);
     if (!a)
@@ -244,6 +320,19 @@ Value * PackageInfo::queryMeta(const std::string & name)
 
 std::string PackageInfo::queryMetaString(const std::string & name)
 {
+    if (cursor && !meta)
+        return withCursor(*cursor, [&](auto & c) -> std::string {
+            auto aMeta = c.maybeGetAttr(state->s.meta);
+            auto a = aMeta ? aMeta->maybeGetAttr(name) : nullptr;
+            if (!a)
+                return "";
+            try {
+                return a->getString();
+            } catch (TypeError &) {
+                return "";
+            }
+        });
+
     Value * v = queryMeta(name);
     if (!v || v->type() != nString)
         return "";
@@ -473,4 +562,48 @@ void getDerivations(
     getDerivations(state, v, pathPrefix, autoArgs, drvs, done, ignoreAssertionFailures);
 }
 
+void getDerivationsCached(
+    EvalState & state,
+    const Hash & fingerprint,
+    std::function<Value *()> loadRoot,
+    const std::string & pathPrefix,
+    Bindings & autoArgs,
+    PackageInfos & drvs)
+{
+    /* The root of the cache is an attribute set with the attribute
+       paths of all derivations found by getDerivations(), so that
+       its deduplication and traversal rules are applied when
+       evaluating, and the derivations themselves. */
+    auto cache = make_ref<eval_cache::EvalCache>(
+        std::cref(fingerprint), state, [&state, loadRoot, pathPrefix, autoArgs{&autoArgs}]() {
+            /* For testing whether the evaluation cache is
+               complete. */
+            if (getEnv("NIX_ALLOW_EVAL").value_or("1") == "0")
+                throw Error("not everything is cached, but evaluation is not allowed");
+
+            PackageInfos drvs;
+            getDerivations(state, *loadRoot(), pathPrefix, *autoArgs, drvs, true);
+
+            auto attrPaths = state.buildList(drvs.size());
+            auto packages = state.buildBindings(drvs.size());
+            for (auto [n, drv] : enumerate(drvs)) {
+                (attrPaths[n] = state.allocValue())->mkString(drv.attrPath, state.mem);
+                /* The attribute set isn't modified, it's just shared. */
+                packages.alloc(drv.attrPath).mkAttrs(const_cast<Bindings *>(drv.getAttrs()));
+            }
+
+            auto root = state.buildBindings(2);
+            root.alloc("attrPaths").mkList(attrPaths);
+            root.alloc("packages").mkAttrs(packages);
+            auto v = state.allocValue();
+            v->mkAttrs(root);
+            return v;
+        });
+
+    auto root = cache->getRoot();
+    auto packages = root->getAttr("packages");
+    for (auto & attrPath : root->getAttr("attrPaths")->getListOfStrings())
+        drvs.push_back(PackageInfo(state, attrPath, packages->getAttr(attrPath)));
+}
+
 } // namespace nix
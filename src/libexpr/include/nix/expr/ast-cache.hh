@@ -0,0 +1,60 @@
+#pragma once
+///@file
+
+#include "nix/expr/nixexpr.hh"
+#include "nix/util/pos-table.hh"
+#include "nix/util/sync.hh"
+
+#include <unordered_map>
+
+namespace nix {
+
+/**
+ * Serialise a freshly parsed expression (i.e. before `bindVars()`)
+ * into a self-contained binary blob. Symbols are stored by name and
+ * positions as offsets relative to `origin`, so the result can be
+ * loaded into a different `EvalState`.
+ *
+ * Doc comments recorded in `docComments` are included as well.
+ *
+ * @return `std::nullopt` if the expression contains nodes that cannot
+ * be serialised.
+ */
+std::optional<std::string> serialiseExpr(
+    Expr & e,
+    const SymbolTable & symbols,
+    const PosTable::Origin & origin,
+    const SourceAccessor & rootFS,
+    const DocCommentMap & docComments);
+
+/**
+ * Inverse of `serialiseExpr()`. `origin` must have been registered
+ * with the same size as the one used during serialisation. Path
+ * literals that were relative to the root filesystem are bound to
+ * `rootFS`, all others to `baseAccessor`.
+ *
+ * The caller is responsible for calling `bindVars()` on the result.
+ *
+ * @throws Error if `data` is malformed.
+ */
+Expr * deserialiseExpr(
+    std::string_view data,
+    Exprs & exprs,
+    SymbolTable & symbols,
+    PosTable & positions,
+    const PosTable::Origin & origin,
+    ref<SourceAccessor> rootFS,
+    ref<SourceAccessor> baseAccessor,
+    DocCommentMap & docComments);
+
+/**
+ * An in-memory cache of serialised expressions that several
+ * `EvalState`s can share, so that each file is parsed only once
+ * between them. Keyed like the on-disk AST cache.
+ */
+struct SharedAstCache
+{
+    SharedSync<std::unordered_map<std::string, std::string>> entries;
+};
+
+} // namespace nix
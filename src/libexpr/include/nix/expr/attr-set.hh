@@ -8,6 +8,7 @@
 #include <boost/iterator/function_output_iterator.hpp>
 
 #include <algorithm>
+#include <bit>
 #include <functional>
 #include <ranges>
 #include <optional>
@@ -58,6 +59,11 @@ static_assert(
  * this linked list until a matching attribute is found (thus overlays earlier in
  * the list take precedence). For iteration over the whole Bindings, an on-the-fly
  * k-way merge is performed by Bindings::iterator class.
+ *
+ * Large layers additionally carry an open-addressing hash index keyed on the
+ * symbol ID, stored directly after the used part of the attrs array, so that
+ * lookups don't need a binary search. The index does not affect iteration
+ * order.
  */
 class Bindings
 {
@@ -89,7 +95,12 @@ private:
     /**
      * Length of the layers list.
      */
-    uint32_t numLayers = 1;
+    uint16_t numLayers = 1;
+
+    /**
+     * Whether a hash index follows `attrs[numAttrs - 1]`.
+     */
+    bool indexed = false;
 
     /**
      * Bindings that this attrset is "layered" on top of.
@@ -116,6 +127,73 @@ private:
      */
     static constexpr unsigned maxLayers = 8;
 
+    /**
+     * Minimum number of attributes in a layer for it to get a hash
+     * index. Below this, binary search is just as fast.
+     */
+    static constexpr size_type indexThreshold = 32;
+
+    /**
+     * Number of slots in the hash index for a layer of `n`
+     * attributes. Always a power of two, with a load factor between
+     * 1/3 and 2/3.
+     */
+    static constexpr size_t indexSize(size_type n) noexcept
+    {
+        return std::bit_ceil(size_t(n) + n / 2 + 1);
+    }
+
+    /**
+     * Extra bytes to allocate for the hash index of a layer with room
+     * for `capacity` attributes.
+     */
+    static constexpr size_t indexBytes(size_t capacity) noexcept
+    {
+        return capacity >= indexThreshold ? indexSize(capacity) * sizeof(uint32_t) : 0;
+    }
+
+    /**
+     * Index slot to start probing at for `name`, using Fibonacci hashing
+     * since symbol IDs of related attributes tend to be close together.
+     */
+    static size_t indexSlot(Symbol name, size_t size) noexcept
+    {
+        return (uint64_t(name.getId()) * 0x9E3779B97F4A7C15ULL) >> (64 - std::countr_zero(size));
+    }
+
+    /**
+     * Slots of the hash index. Each slot contains the position of an
+     * attribute plus one, or zero if the slot is empty.
+     */
+    uint32_t * index() noexcept
+    {
+        return reinterpret_cast<uint32_t *>(attrs + numAttrs);
+    }
+
+    const uint32_t * index() const noexcept
+    {
+        return reinterpret_cast<const uint32_t *>(attrs + numAttrs);
+    }
+
+    /**
+     * Build the hash index. The allocation must have room for
+     * `indexBytes(numAttrs)` bytes after the attributes.
+     */
+    void buildIndex() noexcept;
+
+    const Attr * getIndexed(Symbol name) const noexcept
+    {
+        const auto size = indexSize(numAttrs);
+        const auto * slots = index();
+        for (auto i = indexSlot(name, size);; i = (i + 1) & (size - 1)) {
+            auto slot = slots[i];
+            if (!slot)
+                return nullptr;
+            if (attrs[slot - 1].name == name)
+                return &attrs[slot - 1];
+        }
+    }
+
 public:
     size_type size() const
     {
@@ -343,16 +421,41 @@ public:
 
     void push_back(const Attr & attr)
     {
+        /* This overwrites the start of the index. */
+        indexed = false;
         attrs[numAttrs++] = attr;
         numAttrsInChain = numAttrs;
     }
 
+    /**
+     * Build the hash index of a sorted layer that was filled in place
+     * with `push_back()`, if it is large enough to have one.
+     * `BindingsBuilder` does this by itself.
+     */
+    void finishIndex() noexcept
+    {
+        /* allocBindings() reserved room for the index if the capacity
+           is at least the threshold. */
+        if (numAttrs >= indexThreshold)
+            buildIndex();
+    }
+
+    /**
+     * Whether the top layer has a hash index.
+     */
+    bool isIndexed() const noexcept
+    {
+        return indexed;
+    }
+
     /**
      * Get attribute by name or nullptr if no such attribute exists.
      */
     const Attr * get(Symbol name) const noexcept
     {
         auto getInChunk = [key = Attr{name, nullptr}](const Bindings & chunk) -> const Attr * {
+            if (chunk.indexed)
+                return chunk.getIndexed(key.name);
             auto first = chunk.attrs;
             auto last = first + chunk.numAttrs;
             const Attr * i = std::lower_bound(first, last, key);
@@ -372,6 +475,29 @@ public:
         return nullptr;
     }
 
+    /**
+     * Get the attribute at position `hint` if it is called `name`, or
+     * nullptr otherwise. Only single-layer sets are supported. This is
+     * used to cache the result of `get()`, see `hintFor()`.
+     */
+    const Attr * getHinted(Symbol name, uint32_t hint) const noexcept
+    {
+        if (baseLayer || hint >= numAttrs || attrs[hint].name != name)
+            return nullptr;
+        return &attrs[hint];
+    }
+
+    /**
+     * The hint to pass to `getHinted()` to find `attr` again, or
+     * `std::nullopt` if `attr` is not part of this single-layer set.
+     */
+    std::optional<uint32_t> hintFor(const Attr * attr) const noexcept
+    {
+        if (baseLayer || attr < attrs || attr >= attrs + numAttrs)
+            return std::nullopt;
+        return attr - attrs;
+    }
+
     /**
      * Check if the layer chain is full.
      */
@@ -553,12 +679,12 @@ public:
     Bindings * finish()
     {
         bindings->sort();
-        finishSizeIfNecessary();
-        return bindings;
+        return alreadySorted();
     }
 
     Bindings * alreadySorted()
     {
+        bindings->finishIndex();
         finishSizeIfNecessary();
         return bindings;
     }
@@ -8,8 +8,9 @@ namespace nix {
 /**
  * An atomic counter aligned on a cache line to prevent false sharing.
  * The counter is only enabled when the `NIX_SHOW_STATS` environment
- * variable is set. This is to prevent contention on these counters
- * when multi-threaded evaluation is enabled.
+ * variable is set or the allocation profiler is active. This is to
+ * prevent contention on these counters when multi-threaded evaluation
+ * is enabled.
  */
 struct alignas(64) Counter
 {
@@ -47,6 +47,20 @@ void initGC();
  */
 void assertGCInitialized();
 
+/**
+ * Registers the calling thread with the garbage collector for the
+ * lifetime of this object. Threads other than the main thread must do
+ * this before they evaluate anything.
+ */
+struct GCThreadRegistration
+{
+    GCThreadRegistration();
+    ~GCThreadRegistration();
+
+private:
+    bool registered = false;
+};
+
 #if NIX_USE_BOEHMGC
 /**
  * The number of GC cycles since initGC().
@@ -8,6 +8,28 @@
 
 namespace nix {
 
+#if NIX_USE_BOEHMGC
+[[gnu::always_inline]]
+inline void * EvalMemory::allocSizeClass(size_t sizeClass)
+{
+    /* We use the boehm batch allocator to speed up allocations of small objects (of which there are many).
+       GC_malloc_many returns a linked list of objects of the given size, where the first word
+       of each object is also the pointer to the next object in the list. This also means that we
+       have to explicitly clear the first word of every object we take. */
+    auto & list = (*allocCache)[sizeClass];
+    if (!list) [[unlikely]]
+        refillAllocCache(sizeClass);
+
+    /* GC_NEXT is a convenience macro for accessing the first word of an object.
+       Take the first list item, advance the list to the next item, and clear the next pointer. */
+    void * p = list;
+    list = GC_NEXT(p);
+    GC_NEXT(p) = nullptr;
+    stats.nrCachedAllocs++;
+    return p;
+}
+#endif
+
 /**
  * Note: Various places expect the allocated memory to be zeroed.
  */
@@ -15,7 +37,11 @@ namespace nix {
 inline void * EvalMemory::allocBytes(size_t n)
 {
     void * p;
+    stats.nrBytes += n;
 #if NIX_USE_BOEHMGC
+    /* Note that for n == 0 this wraps around and takes the slow path. */
+    if (auto sizeClass = (n + granuleBytes - 1) / granuleBytes - 1; sizeClass < nrSizeClasses) [[likely]]
+        return allocSizeClass(sizeClass);
     p = GC_MALLOC(n);
 #else
     p = calloc(n, 1);
@@ -29,21 +55,9 @@ inline void * EvalMemory::allocBytes(size_t n)
 Value * EvalMemory::allocValue()
 {
 #if NIX_USE_BOEHMGC
-    /* We use the boehm batch allocator to speed up allocations of Values (of which there are many).
-       GC_malloc_many returns a linked list of objects of the given size, where the first word
-       of each object is also the pointer to the next object in the list. This also means that we
-       have to explicitly clear the first word of every object we take. */
-    if (!*valueAllocCache) {
-        *valueAllocCache = GC_malloc_many(sizeof(Value));
-        if (!*valueAllocCache)
-            throw std::bad_alloc();
-    }
-
-    /* GC_NEXT is a convenience macro for accessing the first word of an object.
-       Take the first list item, advance the list to the next item, and clear the next pointer. */
-    void * p = *valueAllocCache;
-    *valueAllocCache = GC_NEXT(p);
-    GC_NEXT(p) = nullptr;
+    static_assert(sizeof(Value) <= granuleBytes);
+    void * p = allocSizeClass(0);
+    stats.nrBytes += sizeof(Value);
 #else
     void * p = allocBytes(sizeof(Value));
 #endif
@@ -58,24 +72,7 @@ Env & EvalMemory::allocEnv(size_t size)
     stats.nrEnvs++;
     stats.nrValuesInEnvs += size;
 
-    Env * env;
-
-#if NIX_USE_BOEHMGC
-    if (size == 1) {
-        /* see allocValue for explanations. */
-        if (!*env1AllocCache) {
-            *env1AllocCache = GC_malloc_many(sizeof(Env) + sizeof(Value *));
-            if (!*env1AllocCache)
-                throw std::bad_alloc();
-        }
-
-        void * p = *env1AllocCache;
-        *env1AllocCache = GC_NEXT(p);
-        GC_NEXT(p) = nullptr;
-        env = (Env *) p;
-    } else
-#endif
-        env = (Env *) allocBytes(sizeof(Env) + size * sizeof(Value *));
+    Env * env = (Env *) allocBytes(sizeof(Env) + size * sizeof(Value *));
 
     /* We assume that env->values has been cleared by the allocator; maybeThunk() and lookupVar fromWith expect this. */
 
@@ -111,4 +111,29 @@ public:
 
 ref<EvalProfiler> makeSampleStackProfiler(EvalState & state, std::filesystem::path profileFile, uint64_t frequency);
 
+/**
+ * Like `makeSampleStackProfiler()`, but with much lower per-call
+ * overhead: samples are requested by a timer thread rather than by
+ * checking the clock on each call, and frames are only symbolized
+ * when the profile is written out.
+ */
+ref<EvalProfiler>
+makeTimerSampleStackProfiler(EvalState & state, std::filesystem::path profileFile, uint64_t frequency);
+
+/**
+ * Profiler that attributes the bytes allocated by the evaluator to the
+ * call stack that allocated them. The output uses the same folded
+ * format as the stack sampling profilers, weighted by bytes.
+ */
+ref<EvalProfiler> makeAllocationProfiler(EvalState & state, std::filesystem::path profileFile);
+
+/**
+ * Profiler that finds which closures and thunks keep the most memory
+ * alive. When the GC heap has grown, the values reachable from the
+ * imported files and the active calls are traversed, and every object
+ * is charged to the path of lambdas and thunks whose environments it
+ * was first reached through.
+ */
+ref<EvalProfiler> makeRetentionProfiler(EvalState & state, std::filesystem::path profileFile);
+
 } // namespace nix
@@ -231,6 +231,9 @@ struct EvalSettings : Config
           Enables evaluation profiling. The following modes are supported:
 
           * `flamegraph` stack sampling profiler. Outputs folded format, one line per stack (suitable for `flamegraph.pl` and compatible tools).
+          * `sampling` low-overhead variant of `flamegraph` with the same output format. Stack samples are requested by a timer rather than by checking the clock on every call, at the cost of not resolving derivation names.
+          * `allocations` attributes the memory allocated by the evaluator to the call stack that allocated it. Outputs the same folded format as `flamegraph`, but weighted by bytes rather than samples.
+          * `retention` attributes the heap retained by closures and thunks to the lambdas and expressions that created them, at the largest heap size reached. Outputs the same folded format as `allocations`, one line per retention path. Requires the Boehm garbage collector.
 
           Use [`eval-profile-file`](#conf-eval-profile-file) to specify where the profile is saved.
 
@@ -283,6 +286,40 @@ struct EvalSettings : Config
     Setting<unsigned int> maxCallDepth{
         this, 10000, "max-call-depth", "The maximum function call depth to allow before erroring."};
 
+    Setting<unsigned int> evalCores{
+        this,
+        1,
+        "eval-cores",
+        R"(
+          The number of threads used to evaluate independent attributes
+          concurrently in commands that support it, such as
+          [`nix search`](@docroot@/command-ref/new-cli/nix3-search.md) and
+          [`nix flake show`](@docroot@/command-ref/new-cli/nix3-flake-show.md).
+
+          A value of `0` means to use as many threads as there are CPU cores.
+          The default of `1` disables parallel evaluation.
+        )"};
+
+    /**
+     * The effective value of `eval-cores`, i.e. with `0` resolved to
+     * the number of available cores.
+     */
+    unsigned int getEvalCores() const;
+
+    Setting<bool> useAstCache{
+        this,
+        false,
+        "eval-ast-cache",
+        R"(
+          If set to `true`, the parsed form of each Nix file is stored in
+          `~/.cache/nix/eval-ast-v1`, keyed by the file's path and contents,
+          and reused by later evaluations instead of parsing the file again.
+
+          Warnings emitted by the parser, such as those enabled by
+          [`warn-short-path-literals`](#conf-warn-short-path-literals), are
+          only shown when a file is actually parsed.
+        )"};
+
     Setting<bool> builtinsTraceDebugger{
         this,
         false,
@@ -23,7 +23,11 @@
 
 #include <boost/unordered/unordered_flat_map.hpp>
 #include <boost/unordered/concurrent_flat_map_fwd.hpp>
+#include <boost/unordered/concurrent_flat_set_fwd.hpp>
 
+#include <array>
+#include <chrono>
+#include <deque>
 #include <map>
 #include <optional>
 #include <functional>
@@ -168,8 +172,6 @@ typedef std::
     map<std::string, Value *, std::less<std::string>, traceable_allocator<std::pair<const std::string, Value *>>>
         ValMap;
 
-typedef boost::unordered_flat_map<PosIdx, DocComment, std::hash<PosIdx>> DocCommentMap;
-
 struct Env
 {
     Env * up;
@@ -193,6 +195,11 @@ struct RegexCache;
 
 ref<RegexCache> makeRegexCache();
 
+struct PendingDerivations;
+struct SharedAstCache;
+
+ref<PendingDerivations> makePendingDerivations();
+
 struct DebugTrace
 {
     /* WARNING: Converting PosIdx -> Pos should be done with extra care. This is
@@ -305,16 +312,41 @@ struct StaticEvalSymbols
 
 class EvalMemory
 {
+public:
+    /**
+     * The allocation granularity of the garbage collector. All objects
+     * are rounded up to a multiple of this.
+     */
+    static constexpr size_t granuleBytes = 2 * sizeof(void *);
+
+    /**
+     * Objects of up to `nrSizeClasses * granuleBytes` bytes are served
+     * from per-size free lists that are refilled in batches. This
+     * covers all `Value`s, most `Env`s, small `Bindings` and list
+     * element arrays.
+     */
+    static constexpr size_t nrSizeClasses = 16;
+
+private:
 #if NIX_USE_BOEHMGC
     /**
-     * Allocation cache for GC'd Value objects.
+     * Allocation caches for GC'd objects, indexed by size class (the
+     * number of granules minus one). Each entry is a linked list
+     * returned by `GC_malloc_many()`.
+     *
+     * These are not `thread_local` because we tell the GC not to scan
+     * data segments, so it would not see the lists and free them.
      */
-    std::shared_ptr<void *> valueAllocCache;
+    std::shared_ptr<std::array<void *, nrSizeClasses>> allocCache;
 
     /**
-     * Allocation cache for size-1 Env objects.
+     * Take an object from the allocation cache for a size class,
+     * refilling it if necessary.
      */
-    std::shared_ptr<void *> env1AllocCache;
+    inline void * allocSizeClass(size_t sizeClass);
+
+    [[gnu::noinline]]
+    void refillAllocCache(size_t sizeClass);
 #endif
 
 public:
@@ -326,6 +358,21 @@ public:
         Counter nrAttrsets;
         Counter nrAttrsInAttrsets;
         Counter nrListElems;
+
+        /**
+         * Total number of bytes requested from the allocator.
+         */
+        Counter nrBytes;
+
+        /**
+         * Number of allocations served from the size class caches.
+         */
+        Counter nrCachedAllocs;
+
+        /**
+         * Number of times a size class cache had to be refilled.
+         */
+        Counter nrAllocCacheRefills;
     };
 
     EvalMemory();
@@ -336,6 +383,14 @@ public:
     EvalMemory & operator=(EvalMemory &&) = delete;
 
     inline void * allocBytes(size_t n);
+
+    /**
+     * Allocate memory that the garbage collector does not scan for
+     * pointers. The memory is not cleared. Only suitable for objects
+     * that never point into the GC heap, such as string contents.
+     */
+    void * allocBytesAtomic(size_t n);
+
     inline Value * allocValue();
     inline Env & allocEnv(size_t size);
 
@@ -357,6 +412,12 @@ public:
         return stats;
     }
 
+    /**
+     * Get the copy of a string context element that all contexts
+     * containing it share, creating it if necessary.
+     */
+    const Value::StringWithContext::Context::Elem & internContextElem(const NixStringContextElem & elem);
+
     /**
      * Storage for the AST nodes
      */
@@ -364,6 +425,16 @@ public:
 
 private:
     Statistics stats;
+
+    /**
+     * The interned string context elements. A deque, so that pointers
+     * to the elements stay valid as it grows. The keys of
+     * `contextElemIndex` point into their encodings, which live in
+     * `contextElemStrings`.
+     */
+    std::pmr::monotonic_buffer_resource contextElemStrings;
+    std::deque<Value::StringWithContext::Context::Elem> contextElems;
+    boost::unordered_flat_map<std::string_view, const Value::StringWithContext::Context::Elem *> contextElemIndex;
 };
 
 class EvalState : public std::enable_shared_from_this<EvalState>
@@ -469,6 +540,31 @@ public:
      */
     std::map<const Hash, ref<eval_cache::EvalCache>> evalCaches;
 
+    /**
+     * Whether files parsed in the base environment are remembered
+     * across `resetFileCache()`, so that a long-lived evaluator (such
+     * as the REPL) only has to re-parse files that changed.
+     */
+    bool cacheParsedFiles = false;
+
+    /**
+     * If set, parsed files are looked up in and added to this cache,
+     * which may be shared with other `EvalState`s, in addition to the
+     * on-disk AST cache.
+     */
+    std::shared_ptr<SharedAstCache> sharedAstCache;
+
+    /**
+     * Whether `derivationStrict` buffers the derivations it creates
+     * and writes them to the store in batches, rather than one at a
+     * time. This saves many round trips with remote stores. The
+     * evaluator flushes the buffer itself when it needs store access
+     * (e.g. for import-from-derivation); other users must call
+     * `flushDerivations()` before using the resulting derivation
+     * paths.
+     */
+    bool batchDerivations = false;
+
 private:
 
     /* Cache for calls to addToStore(); maps source paths to the store
@@ -492,6 +588,72 @@ private:
         traceable_allocator<std::pair<const SourcePath, Value *>>>>
         fileEvalCache;
 
+    /**
+     * A cache from directories to the attribute sets returned by
+     * `builtins.readDir`. Like `fileEvalCache`, this assumes that
+     * source trees don't change during evaluation.
+     */
+    const ref<boost::concurrent_flat_map<
+        SourcePath,
+        Value *,
+        std::hash<SourcePath>,
+        std::equal_to<SourcePath>,
+        traceable_allocator<std::pair<const SourcePath, Value *>>>>
+        readDirCache;
+
+    /**
+     * A cache from paths to the hash of their contents and the
+     * resulting expression. Only used if `cacheParsedFiles` is set.
+     */
+    const ref<boost::concurrent_flat_map<SourcePath, std::pair<Hash, Expr *>>> fileParseCache;
+
+    /**
+     * The derivations instantiated by `derivationStrict` so far. Only
+     * maintained if statistics are enabled, see `recordDerivation()`.
+     */
+    const ref<boost::concurrent_flat_set<StorePath, std::hash<StorePath>>> instantiatedDrvs;
+
+    struct FileStats
+    {
+        /**
+         * Time spent reading, lexing and parsing the file.
+         */
+        std::chrono::microseconds parseTime{0};
+
+        uint64_t nrParses = 0;
+        uint64_t bytes = 0;
+
+        /**
+         * The number of AST nodes of the last parse.
+         */
+        uint64_t nrExprs = 0;
+
+        /**
+         * The number of `evalFile()` calls for this file, and how many
+         * of them were served from `fileEvalCache`.
+         */
+        uint64_t nrImports = 0;
+        uint64_t nrImportsCached = 0;
+    };
+
+    /**
+     * Per-file parse and import statistics, keyed by resolved path.
+     * Only maintained if statistics are enabled.
+     */
+    const ref<boost::concurrent_flat_map<SourcePath, FileStats>> fileStats;
+
+    struct FetchTreeStats
+    {
+        std::chrono::microseconds time{0};
+        uint64_t count = 0;
+    };
+
+    /**
+     * Time spent in `fetchTree` per input. Only maintained if
+     * statistics are enabled.
+     */
+    const ref<boost::concurrent_flat_map<std::string, FetchTreeStats>> fetchTreeStats;
+
     /**
      * Associate source positions of certain AST nodes with their preceding doc comment, if they have one.
      * Grouped by file.
@@ -508,6 +670,11 @@ private:
      */
     const ref<RegexCache> regexCache;
 
+    /**
+     * Derivations not yet written to the store, see `batchDerivations`.
+     */
+    const ref<PendingDerivations> pendingDerivations;
+
 public:
 
     /**
@@ -578,6 +745,16 @@ public:
      */
     void allowClosure(const StorePath & storePath);
 
+private:
+
+    /**
+     * Allowing `path` changes the listings of its ancestors in
+     * `rootFS`, so drop those from `readDirCache`.
+     */
+    void allowPrefix(const CanonPath & path);
+
+public:
+
     /**
      * Allow access to a store path and return it as a string.
      */
@@ -590,6 +767,12 @@ public:
      */
     StorePath mountInput(fetchers::Input & input, const fetchers::Input & originalInput, ref<SourceAccessor> accessor);
 
+    /**
+     * Count the time spent fetching `input` for `fetchTree`. Only
+     * maintained if statistics are enabled.
+     */
+    void recordFetchTree(const fetchers::Input & input, std::chrono::microseconds time);
+
     /**
      * Parse a Nix expression from the specified file.
      */
@@ -612,8 +795,18 @@ public:
      */
     void evalFile(const SourcePath & path, Value & v, bool mustBeTrivial = false);
 
+    /**
+     * Forget all evaluated files, e.g. because they may have changed
+     * on disk. Parsed files and their positions are kept if
+     * `cacheParsedFiles` is set.
+     */
     void resetFileCache();
 
+    /**
+     * Call `f` on the value of every file evaluated so far.
+     */
+    void visitImportedFiles(std::function<void(const Value & v)> f) const;
+
     /**
      * Look up a file in the search path.
      */
@@ -867,6 +1060,13 @@ private:
         const SourcePath & basePath,
         const std::shared_ptr<StaticEnv> & staticEnv);
 
+    /**
+     * Like `parse()`, but consult and populate the on-disk AST cache
+     * (see the `eval-ast-cache` setting). `buffer` must contain the
+     * contents of `path` followed by two NUL bytes.
+     */
+    Expr * parseWithAstCache(std::string & buffer, const SourcePath & path, const std::shared_ptr<StaticEnv> & staticEnv);
+
     /**
      * Current Nix call stack depth, used with `max-call-depth` setting to throw stack overflow hopefully before we run
      * out of system stack.
@@ -1002,6 +1202,17 @@ public:
     [[nodiscard]] StringMap
     realiseContext(const NixStringContext & context, StorePathSet * maybePaths = nullptr, bool isIFD = true);
 
+    /**
+     * Write `drv` to the store, or buffer it if `batchDerivations` is
+     * set, and return its path.
+     */
+    StorePath writeDerivation(const Derivation & drv);
+
+    /**
+     * Write all buffered derivations to the store.
+     */
+    void flushDerivations();
+
     /**
      * Realise the given string with context, and return the string with outputs instead of downstream output
      * placeholders.
@@ -1036,12 +1247,24 @@ private:
     std::string mkSingleDerivedPathStringRaw(const SingleDerivedPath & p);
 
     Counter nrLookups;
+    Counter nrSelectCacheHits;
+    Counter nrSelectCacheMisses;
     Counter nrAvoided;
     Counter nrOpUpdates;
     Counter nrOpUpdateValuesCopied;
     Counter nrListConcats;
     Counter nrPrimOpCalls;
     Counter nrFunctionCalls;
+    Counter nrDerivations;
+    Counter nrDuplicateDerivations;
+    Counter nrImportResolutionCacheHits;
+    Counter nrImportResolutionCacheMisses;
+    Counter nrFileEvalCacheHits;
+    Counter nrFileEvalCacheMisses;
+    Counter nrReadDirCacheHits;
+    Counter nrReadDirCacheMisses;
+    Counter nrSrcToStoreHits;
+    Counter nrSrcToStoreMisses;
 
     bool countCalls;
 
@@ -1056,6 +1279,13 @@ private:
 
     void incrFunctionCall(ExprLambda * fun);
 
+    /**
+     * Count an instantiation of the derivation `drvPath`, and whether
+     * an identical derivation was already instantiated during this
+     * evaluation.
+     */
+    void recordDerivation(const StorePath & drvPath);
+
     typedef boost::unordered_flat_map<PosIdx, size_t, std::hash<PosIdx>> AttrSelects;
     AttrSelects attrSelects;
 
@@ -1073,6 +1303,46 @@ private:
 
     friend struct Value;
     friend class ListBuilder;
+    friend class RepeatedCall;
+};
+
+/**
+ * Calls the same function value many times, as primops like
+ * `builtins.filter` or `builtins.foldl'` do.
+ *
+ * If the function is a chain of plain lambdas (`x: y: ...`) taking
+ * all the arguments, and its body can't capture its environment (see
+ * `ExprLambda::canReuseEnv()`), the environments for the call are
+ * allocated once and reused for every call. Otherwise this is
+ * equivalent to calling `EvalState::callFunction()` each time.
+ */
+class RepeatedCall
+{
+public:
+    static constexpr size_t maxArgs = 2;
+
+    RepeatedCall(EvalState & state, Value & fun, size_t nrArgs, const PosIdx pos);
+
+    void operator()(std::span<Value *> args, Value & vRes);
+
+    void operator()(Value & arg, Value & vRes)
+    {
+        Value * args[] = {&arg};
+        (*this)(args, vRes);
+    }
+
+private:
+    EvalState & state;
+    Value & fun;
+    PosIdx pos;
+
+    /**
+     * Number of arguments handled by the fast path, or 0 if it
+     * doesn't apply.
+     */
+    size_t nrArgs = 0;
+    std::array<ExprLambda *, maxArgs> lambdas;
+    std::array<Env *, maxArgs> envs;
 };
 
 struct DebugTraceStacker
@@ -9,6 +9,10 @@
 
 namespace nix {
 
+namespace eval_cache {
+class AttrCursor;
+}
+
 /**
  * A "parsed" package attribute set.
  */
@@ -32,7 +36,24 @@ private:
      */
     bool failed = false;
 
-    const Bindings *attrs = nullptr, *meta = nullptr;
+    mutable const Bindings *attrs = nullptr, *meta = nullptr;
+
+    /**
+     * If set, the attributes are looked up in an evaluation cache,
+     * and `attrs` is only filled in by evaluating the package if a
+     * query can't be answered from the cache.
+     */
+    std::shared_ptr<eval_cache::AttrCursor> cursor;
+
+    const Bindings * getAttrs() const;
+
+    friend void getDerivationsCached(
+        EvalState & state,
+        const Hash & fingerprint,
+        std::function<Value *()> loadRoot,
+        const std::string & pathPrefix,
+        Bindings & autoArgs,
+        std::list<PackageInfo, traceable_allocator<PackageInfo>> & drvs);
 
     const Bindings * getMeta();
 
@@ -47,6 +68,7 @@ public:
     PackageInfo(EvalState & state)
         : state(&state) {};
     PackageInfo(EvalState & state, std::string attrPath, const Bindings * attrs);
+    PackageInfo(EvalState & state, std::string attrPath, ref<eval_cache::AttrCursor> cursor);
     PackageInfo(EvalState & state, ref<Store> store, const std::string & drvPathWithOutputs);
 
     std::string queryName() const;
@@ -116,4 +138,22 @@ void getDerivations(
     PackageInfos & drvs,
     bool ignoreAssertionFailures);
 
+/**
+ * Like `getDerivations()` on the value returned by `loadRoot`, but
+ * record the attribute paths of the derivations and the attributes
+ * that are queried later in the evaluation cache under `fingerprint`.
+ * On a later call with the same fingerprint, the derivations and
+ * their cached attributes are returned without evaluating anything.
+ *
+ * `loadRoot` may be called after this function returns, while the
+ * returned `PackageInfo`s are in use.
+ */
+void getDerivationsCached(
+    EvalState & state,
+    const Hash & fingerprint,
+    std::function<Value *()> loadRoot,
+    const std::string & pathPrefix,
+    Bindings & autoArgs,
+    PackageInfos & drvs);
+
 } // namespace nix
@@ -1,6 +1,7 @@
 #pragma once
 ///@file
 
+#include <bit>
 #include <map>
 #include <span>
 #include <memory>
@@ -18,6 +19,8 @@
 #include "nix/util/pos-table.hh"
 #include "nix/util/error.hh"
 
+#include <boost/unordered/unordered_flat_map.hpp>
+
 namespace nix {
 
 class EvalState;
@@ -72,6 +75,8 @@ struct DocComment
     std::string getInnerText(const PosTable & positions) const;
 };
 
+typedef boost::unordered_flat_map<PosIdx, DocComment, std::hash<PosIdx>> DocCommentMap;
+
 /**
  * An attribute path is a sequence of attribute names.
  */
@@ -285,6 +290,22 @@ struct ExprSelect : Expr
     Expr *e, *def;
     AttrName * attrPathStart;
 
+    /**
+     * `e` if it is a variable not bound by a `with`. Set by
+     * `bindVars()` so that `eval()` can select directly from the
+     * variable's value instead of evaluating `e` into a copy.
+     */
+    ExprVar * baseVar = nullptr;
+
+    /**
+     * Inline cache for the attribute lookups: for each element of the
+     * attribute path, the positions (see `Bindings::hintFor()`) at
+     * which it was most recently found, most recent first. Hints are
+     * validated on use, so they are accessed with relaxed atomics.
+     */
+    static constexpr size_t hintsPerAttr = 2;
+    uint32_t * lookupHints;
+
     ExprSelect(
         std::pmr::polymorphic_allocator<char> & alloc,
         const PosIdx & pos,
@@ -296,6 +317,7 @@ struct ExprSelect : Expr
         , e(e)
         , def(def)
         , attrPathStart(alloc.allocate_object<AttrName>(nAttrPath))
+        , lookupHints(allocLookupHints(alloc, nAttrPath))
     {
         std::ranges::copy(attrPath, attrPathStart);
     };
@@ -306,10 +328,18 @@ struct ExprSelect : Expr
         , e(e)
         , def(0)
         , attrPathStart((alloc.allocate_object<AttrName>()))
+        , lookupHints(allocLookupHints(alloc, 1))
     {
         *attrPathStart = AttrName(name);
     };
 
+    static uint32_t * allocLookupHints(std::pmr::polymorphic_allocator<char> & alloc, size_t nAttrPath)
+    {
+        auto hints = alloc.allocate_object<uint32_t>(nAttrPath * hintsPerAttr);
+        std::ranges::fill_n(hints, nAttrPath * hintsPerAttr, UINT32_MAX);
+        return hints;
+    }
+
     PosIdx getPos() const override
     {
         return pos;
@@ -520,10 +550,24 @@ struct ExprLambda : Expr
 private:
     bool hasFormals;
     bool ellipsis;
+    /**
+     * Whether evaluating `body` may store a reference to the lambda's
+     * `Env` (e.g. in a thunk or closure). Computed by `bindVars()`.
+     */
+    bool bodyMayCaptureEnv = true;
     uint16_t nFormals;
     Formal * formalsStart;
 public:
 
+    /**
+     * Whether the `Env` of a call to this lambda can safely be reused
+     * for another call once the body has been evaluated.
+     */
+    bool canReuseEnv() const
+    {
+        return !bodyMayCaptureEnv;
+    }
+
     std::optional<Formals> getFormals() const
     {
         if (hasFormals)
@@ -594,26 +638,26 @@ struct ExprCall : Expr
 {
     Expr * fun;
     /**
-     * args will never be null. See comment on ExprAttrs::AttrDefs below.
+     * The arguments, allocated in the `Exprs` arena. The storage has
+     * room for `std::bit_ceil(args.size())` elements, so `addArg()`
+     * only reallocates when the number of arguments doubles.
      */
-    std::optional<std::pmr::vector<Expr *>> args;
+    std::span<Expr *> args;
     PosIdx pos;
-    std::optional<PosIdx> cursedOrEndPos; // used during parsing to warn about https://github.com/NixOS/nix/issues/11118
-
-    ExprCall(const PosIdx & pos, Expr * fun, std::pmr::vector<Expr *> && args)
-        : fun(fun)
-        , args(args)
-        , pos(pos)
-        , cursedOrEndPos({})
-    {
-    }
+    PosIdx cursedOrEndPos; // used during parsing to warn about https://github.com/NixOS/nix/issues/11118
 
-    ExprCall(const PosIdx & pos, Expr * fun, std::pmr::vector<Expr *> && args, PosIdx && cursedOrEndPos)
+    ExprCall(
+        std::pmr::polymorphic_allocator<char> & alloc,
+        const PosIdx & pos,
+        Expr * fun,
+        std::span<Expr * const> args,
+        const PosIdx & cursedOrEndPos = noPos)
         : fun(fun)
-        , args(args)
+        , args({alloc.allocate_object<Expr *>(std::bit_ceil(args.size())), args.size()})
         , pos(pos)
         , cursedOrEndPos(cursedOrEndPos)
     {
+        std::ranges::copy(args, this->args.begin());
     }
 
     PosIdx getPos() const override
@@ -621,9 +665,14 @@ struct ExprCall : Expr
         return pos;
     }
 
+    /**
+     * Append an argument, as in `f a b` where the parser has already
+     * built the call `f a`.
+     */
+    void addArg(std::pmr::polymorphic_allocator<char> & alloc, Expr * arg);
+
     virtual void resetCursedOr() override;
     virtual void warnIfCursedOr(const SymbolTable & symbols, const PosTable & positions) override;
-    void moveDataToAllocator(std::pmr::polymorphic_allocator<char> & alloc);
     COMMON_METHODS
 };
 
@@ -765,6 +814,13 @@ struct ExprConcatStrings : Expr
     bool forceString;
     std::span<std::pair<PosIdx, Expr *>> es;
 
+    /**
+     * If the first operand is itself a `+` (as in `a + b + c`), that
+     * operand. Set by `bindVars()` so that `eval()` can evaluate the
+     * whole left-nested chain in one pass.
+     */
+    ExprConcatStrings * nested = nullptr;
+
     ExprConcatStrings(
         std::pmr::polymorphic_allocator<char> & alloc,
         const PosIdx & pos,
@@ -841,18 +897,10 @@ public:
     // we define some calls to add explicitly so that the argument can be passed in as initializer lists
     template<class C>
     [[gnu::always_inline]]
-    C * add(const PosIdx & pos, Expr * fun, std::pmr::vector<Expr *> && args)
-        requires(std::same_as<C, ExprCall>)
-    {
-        return alloc.new_object<C>(pos, fun, std::move(args));
-    }
-
-    template<class C>
-    [[gnu::always_inline]]
-    C * add(const PosIdx & pos, Expr * fun, std::pmr::vector<Expr *> && args, PosIdx && cursedOrEndPos)
+    C * add(const PosIdx & pos, Expr * fun, std::initializer_list<Expr *> args, const PosIdx & cursedOrEndPos = noPos)
         requires(std::same_as<C, ExprCall>)
     {
-        return alloc.new_object<C>(pos, fun, std::move(args), std::move(cursedOrEndPos));
+        return alloc.new_object<C>(alloc, pos, fun, std::span<Expr * const>(args), cursedOrEndPos);
     }
 
     template<class C>
@@ -1,6 +1,7 @@
 #pragma once
 ///@file
 
+#include <algorithm>
 #include <limits>
 
 #include "nix/expr/eval.hh"
@@ -365,17 +366,20 @@ ParserState::stripIndentation(const PosIdx pos, std::span<std::pair<PosIdx, std:
 
     /* Strip spaces from each line. */
     std::vector<std::pair<PosIdx, Expr *>> es2{};
+    es2.reserve(es.size());
     atStartOfLine = true;
     size_t curDropped = 0;
     size_t n = es.size();
     auto i = es.begin();
+    /* Reused for all string parts, which are copied into `exprs`. */
+    std::string s2;
     const auto trimExpr = [&](Expr * e) {
         atStartOfLine = false;
         curDropped = 0;
         es2.emplace_back(i->first, e);
     };
     const auto trimString = [&](const StringToken & t) {
-        std::string s2;
+        s2.clear();
         for (size_t j = 0; j < t.l; ++j) {
             if (atStartOfLine) {
                 if (t.p[j] == ' ') {
@@ -390,9 +394,14 @@ ParserState::stripIndentation(const PosIdx pos, std::span<std::pair<PosIdx, std:
                     s2 += t.p[j];
                 }
             } else {
-                s2 += t.p[j];
-                if (t.p[j] == '\n')
+                /* Copy the rest of the line at once. */
+                auto end = std::find(t.p + j, t.p + t.l, '\n');
+                if (end != t.p + t.l) {
+                    ++end;
                     atStartOfLine = true;
+                }
+                s2.append(t.p + j, end);
+                j = end - t.p - 1;
             }
         }
 
@@ -401,11 +410,11 @@ ParserState::stripIndentation(const PosIdx pos, std::span<std::pair<PosIdx, std:
         if (n == 1) {
             std::string::size_type p = s2.find_last_of('\n');
             if (p != std::string::npos && s2.find_first_not_of(' ', p + 1) == std::string::npos)
-                s2 = std::string(s2, 0, p + 1);
+                s2.resize(p + 1);
         }
 
         // Ignore empty strings for a minor optimisation and AST simplification
-        if (s2 != "") {
+        if (!s2.empty()) {
             es2.emplace_back(i->first, exprs.add<ExprString>(exprs.alloc, s2));
         }
     };
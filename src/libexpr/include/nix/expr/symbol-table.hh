@@ -2,13 +2,14 @@
 ///@file
 
 #include <memory_resource>
+#include <mutex>
 #include "nix/expr/value.hh"
 #include "nix/expr/static-string-data.hh"
 #include "nix/util/chunked-vector.hh"
 #include "nix/util/error.hh"
 
 #include <boost/version.hpp>
-#include <boost/unordered/unordered_flat_set.hpp>
+#include <boost/unordered/concurrent_flat_set.hpp>
 
 namespace nix {
 
@@ -97,12 +98,18 @@ class SymbolStr
         std::string_view s;
         std::size_t hash;
         std::pmr::memory_resource & resource;
+        std::mutex & storeLock;
 
-        Key(SymbolValueStore & store, std::string_view s, std::pmr::memory_resource & stringMemory)
+        Key(SymbolValueStore & store,
+            std::string_view s,
+            std::size_t hash,
+            std::pmr::memory_resource & stringMemory,
+            std::mutex & storeLock)
             : store(store)
             , s(s)
-            , hash(HashType{}(s))
+            , hash(hash)
             , resource(stringMemory)
+            , storeLock(storeLock)
         {
         }
     };
@@ -119,7 +126,9 @@ public:
         if (size >= std::numeric_limits<uint32_t>::max()) {
             throw Error("Size of symbol exceeds 4GiB and cannot be stored");
         }
-        // for multi-threaded implementations: lock store and allocator here
+        /* Distinct new symbols can be inserted concurrently, so the
+           store and the allocator need their own lock. */
+        std::lock_guard lock(key.storeLock);
         const auto & [v, idx] = key.store.add(SymbolValue{});
         if (size == 0) {
             v.mkStringNoCopy(""_sds, nullptr);
@@ -256,6 +265,8 @@ public:
 /**
  * Symbol table used by the parser and evaluator to represent and look
  * up identifiers and attributes efficiently.
+ *
+ * All operations are thread-safe.
  */
 class SymbolTable
 {
@@ -267,11 +278,16 @@ private:
     std::pmr::monotonic_buffer_resource buffer;
     SymbolStr::SymbolValueStore store{16};
 
+    /**
+     * Protects `buffer` and additions to `store`.
+     */
+    std::mutex storeLock;
+
     /**
      * Transparent lookup of string view for a pointer to a ChunkedVector entry -> return offset into the store.
      * ChunkedVector references are never invalidated.
      */
-    boost::unordered_flat_set<SymbolStr, SymbolStr::Hash, SymbolStr::Equal> symbols{SymbolStr::chunkSize};
+    boost::concurrent_flat_set<SymbolStr, SymbolStr::Hash, SymbolStr::Equal> symbols{SymbolStr::chunkSize};
 
 public:
     SymbolTable(const StaticSymbolTable & staticSymtab)
@@ -279,15 +295,39 @@ public:
         staticSymtab.copyIntoSymbolTable(*this);
     }
 
+    /**
+     * The hash of `s` as used by the table, for use with
+     * `create(std::string_view, std::size_t)`.
+     */
+    static std::size_t hash(std::string_view s) noexcept
+    {
+        return SymbolStr::Key::HashType{}(s);
+    }
+
     /**
      * Converts a string into a symbol.
      */
     Symbol create(std::string_view s)
+    {
+        return create(s, hash(s));
+    }
+
+    /**
+     * Like `create(std::string_view)`, but with the hash of `s`
+     * (see `hash()`) already computed, e.g. by a parser that interns
+     * the same keys repeatedly.
+     */
+    Symbol create(std::string_view s, std::size_t hash)
     {
         // Most symbols are looked up more than once, so we trade off insertion performance
-        // for lookup performance.
-        // FIXME: make this thread-safe.
-        return Symbol(*symbols.insert(SymbolStr::Key{store, s, buffer}).first);
+        // for lookup performance: looking up an existing symbol only
+        // takes a shared lock, so concurrent lookups don't contend.
+        SymbolStr::Key key{store, s, hash, buffer, storeLock};
+        Symbol res;
+        if (symbols.cvisit(key, [&](const SymbolStr & sym) { res = Symbol(sym); }))
+            return res;
+        symbols.insert_and_cvisit(key, [&](const SymbolStr & sym) { res = Symbol(sym); });
+        return res;
     }
 
     std::vector<SymbolStr> resolve(const std::span<const Symbol> & symbols) const
@@ -315,6 +355,10 @@ public:
 
     size_t totalSize() const;
 
+    /**
+     * Call `callback` on every symbol. Symbols that are created
+     * concurrently may or may not be visited.
+     */
     template<typename T>
     void dump(T callback) const
     {
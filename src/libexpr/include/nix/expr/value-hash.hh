@@ -0,0 +1,82 @@
+#pragma once
+///@file
+
+#include "nix/expr/value.hh"
+
+#include <optional>
+
+namespace nix {
+
+/**
+ * What a value that `ValueHash` can hash is compared as. Integers and
+ * floats are both numbers, since `builtins.lessThan` compares them
+ * with each other. Values of different kinds are incomparable.
+ */
+struct HashableValueKind
+{
+    enum Scalar : uint8_t {
+        /**
+         * Only for the elements of an empty list.
+         */
+        Any,
+        Number,
+        String,
+        Path,
+    };
+
+    Scalar scalar;
+
+    /**
+     * Whether the value is a list of `scalar`s.
+     */
+    bool list = false;
+
+    /**
+     * Whether values of both kinds can be compared with each other.
+     */
+    bool compatibleWith(const HashableValueKind & other) const
+    {
+        return list == other.list && (scalar == other.scalar || scalar == Any || other.scalar == Any);
+    }
+
+    /**
+     * Narrow an `Any` list kind to the kind of the elements of `other`.
+     */
+    void merge(const HashableValueKind & other)
+    {
+        if (scalar == Any)
+            scalar = other.scalar;
+    }
+};
+
+/**
+ * Get the kind of a forced value if `ValueHash` can hash it, that is,
+ * if it is a number other than NaN, a string, a path, or a list of
+ * already forced values of the same one of these kinds.
+ *
+ * Lists with unforced elements are not hashable, since hashing them
+ * would force elements that an ordered comparison may never look at.
+ */
+std::optional<HashableValueKind> getHashableValueKind(const Value & v);
+
+/**
+ * A structural hash over hashable values (see
+ * `getHashableValueKind()`), consistent with `ValueEqual`, for
+ * deduplicating values in hash tables instead of sorting them. String
+ * contexts and path accessors are ignored, as in `builtins.lessThan`.
+ */
+struct ValueHash
+{
+    size_t operator()(const Value * v) const noexcept;
+};
+
+/**
+ * Equality of hashable values of compatible kinds, which agrees with
+ * neither value being less than the other under `builtins.lessThan`.
+ */
+struct ValueEqual
+{
+    bool operator()(const Value * v1, const Value * v2) const noexcept;
+};
+
+} // namespace nix
@@ -10,9 +10,25 @@
 
 namespace nix {
 
+struct Sink;
+
 nlohmann::json printValueAsJSON(
     EvalState & state, bool strict, Value & v, const PosIdx pos, NixStringContext & context, bool copyToStore = true);
 
+/**
+ * Write `v` as JSON to `sink`, forcing it (if `strict`) as output
+ * proceeds rather than building the whole document in memory
+ * first. The output is the same as `printValueAsJSON(...).dump()`.
+ */
+void printValueAsJSON(
+    EvalState & state,
+    bool strict,
+    Value & v,
+    const PosIdx pos,
+    Sink & sink,
+    NixStringContext & context,
+    bool copyToStore = true);
+
 void printValueAsJSON(
     EvalState & state,
     bool strict,
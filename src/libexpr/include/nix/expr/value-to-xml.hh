@@ -3,6 +3,7 @@
 
 #include "nix/expr/nixexpr.hh"
 #include "nix/expr/eval.hh"
+#include "nix/util/serialise.hh"
 
 #include <string>
 #include <map>
@@ -18,4 +19,12 @@ void printValueAsXML(
     NixStringContext & context,
     const PosIdx pos);
 
+/**
+ * Like the above, but write the XML to `sink`. The XML is written while
+ * traversing `v`, forcing its elements as they are reached, so the
+ * output is never built up in memory.
+ */
+void printValueAsXML(
+    EvalState & state, bool strict, bool location, Value & v, Sink & sink, NixStringContext & context, const PosIdx pos);
+
 }
@@ -320,16 +320,36 @@ struct ValueBase
          * The type of the context itself.
          *
          * Currently, it is length-prefixed array of pointers to
-         * null-terminated strings. The strings are specially formatted
-         * to represent a flattening of the recursive sum type that is a
-         * context element.
+         * context elements, which are interned by `EvalMemory`, so
+         * that equal elements are the same pointer and contexts can
+         * be merged without parsing or allocating elements.
          *
          * @See NixStringContext for an more easily understood type,
          * that of the "builder" for this data structure.
          */
         struct Context
         {
-            using value_type = const StringData *;
+            /**
+             * A context element, shared by all contexts that contain
+             * it. Owned by `EvalMemory`.
+             */
+            struct Elem
+            {
+                NixStringContextElem elem;
+
+                /**
+                 * The null-terminated encoding of `elem`, as returned
+                 * by `NixStringContextElem::to_string()`.
+                 */
+                const StringData & encoded;
+
+                std::string_view view() const noexcept
+                {
+                    return encoded.view();
+                }
+            };
+
+            using value_type = const Elem *;
             using size_type = std::size_t;
             using iterator = const value_type *;
 
@@ -345,7 +365,7 @@ struct ValueBase
             size_type size_;
 
             /**
-             * @pre must be in sorted order
+             * @pre must be sorted by `Elem::elem`, without duplicates
              */
             value_type elems[];
 
@@ -369,6 +389,19 @@ struct ValueBase
              * @return null pointer when context.empty()
              */
             static Context * fromBuilder(const NixStringContext & context, EvalMemory & mem);
+
+            /**
+             * Compute the union of several contexts by merging them.
+             * Returns one of the inputs if it already contains all
+             * the others, which is the common case of a string
+             * combined with strings that have the same or no
+             * context, rather than allocating a new context.
+             *
+             * @param contexts Non-null contexts.
+             *
+             * @return null pointer when contexts.empty()
+             */
+            static const Context * merge(std::span<const Context * const> contexts, EvalMemory & mem);
         };
 
         /**
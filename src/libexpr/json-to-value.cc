@@ -2,6 +2,9 @@
 #include "nix/expr/value.hh"
 #include "nix/expr/eval.hh"
 
+#include <algorithm>
+#include <charconv>
+#include <cstring>
 #include <limits>
 #include <variant>
 #include <nlohmann/json.hpp>
@@ -201,8 +204,479 @@ public:
     }
 };
 
+namespace {
+
+/**
+ * A direct JSON parser that builds `Value`s without going through
+ * nlohmann's SAX interface and its per-token allocations.
+ *
+ * It only accepts a subset of what nlohmann accepts, and produces
+ * exactly the same values for it. When it hits anything else
+ * (including syntax errors) it throws `Fallback`, and the input is
+ * handed to `JSONSax` instead. Errors are thus reported by nlohmann
+ * exactly as before. Errors that don't come from nlohmann (null bytes,
+ * out-of-range unsigned numbers) are raised here at the same point in
+ * the input as `JSONSax` would raise them.
+ */
+class FastJSONParser
+{
+    struct Fallback
+    {};
+
+    EvalState & state;
+    const char * p;
+    const char * const end;
+
+    /**
+     * Values of the arrays and objects currently being parsed, as one
+     * stack. Each container remembers where its elements start.
+     */
+    ValueVector values;
+    std::vector<Symbol> keys;
+
+    /**
+     * Buffer for strings that contain escape sequences.
+     */
+    std::string unescaped;
+
+    static constexpr size_t maxDepth = 1024;
+    size_t depth = 0;
+
+    [[noreturn]] static void fallback()
+    {
+        throw Fallback();
+    }
+
+    void skipWhitespace()
+    {
+        while (p != end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t'))
+            ++p;
+    }
+
+    void expect(std::string_view lit)
+    {
+        if (size_t(end - p) < lit.size() || std::string_view(p, lit.size()) != lit)
+            fallback();
+        p += lit.size();
+    }
+
+    /**
+     * Whether any of the 8 bytes in `w` is `"`, `\`, a control
+     * character, or not ASCII. These are the ones that need a closer
+     * look inside a string.
+     */
+    static bool needsAttention(uint64_t w)
+    {
+        constexpr uint64_t ones = 0x0101010101010101ULL;
+        constexpr uint64_t highs = 0x8080808080808080ULL;
+        auto hasZero = [](uint64_t x) { return (x - ones) & ~x & highs; };
+        return (w & highs) || hasZero(w ^ (ones * '"')) || hasZero(w ^ (ones * '\\')) || ((w - ones * 0x20) & ~w & highs);
+    }
+
+    /**
+     * Check one UTF-8 encoded character starting at `p`, using the
+     * same ranges as nlohmann's lexer (RFC 3629).
+     */
+    void skipUTF8()
+    {
+        auto c = static_cast<unsigned char>(*p);
+        auto cont = [&](size_t n, unsigned char lo = 0x80, unsigned char hi = 0xbf) {
+            if (size_t(end - p) <= n)
+                fallback();
+            auto b = static_cast<unsigned char>(p[1]);
+            if (b < lo || b > hi)
+                fallback();
+            for (size_t i = 2; i <= n; ++i) {
+                b = static_cast<unsigned char>(p[i]);
+                if (b < 0x80 || b > 0xbf)
+                    fallback();
+            }
+            p += n + 1;
+        };
+        if (c >= 0xc2 && c <= 0xdf)
+            cont(1);
+        else if (c == 0xe0)
+            cont(2, 0xa0);
+        else if ((c >= 0xe1 && c <= 0xec) || c == 0xee || c == 0xef)
+            cont(2);
+        else if (c == 0xed)
+            cont(2, 0x80, 0x9f);
+        else if (c == 0xf0)
+            cont(3, 0x90);
+        else if (c >= 0xf1 && c <= 0xf3)
+            cont(3);
+        else if (c == 0xf4)
+            cont(3, 0x80, 0x8f);
+        else
+            fallback();
+    }
+
+    unsigned int hex4()
+    {
+        if (end - p < 4)
+            fallback();
+        unsigned int n = 0;
+        for (int i = 0; i < 4; ++i) {
+            char c = *p++;
+            n <<= 4;
+            if (c >= '0' && c <= '9')
+                n |= c - '0';
+            else if (c >= 'a' && c <= 'f')
+                n |= c - 'a' + 10;
+            else if (c >= 'A' && c <= 'F')
+                n |= c - 'A' + 10;
+            else
+                fallback();
+        }
+        return n;
+    }
+
+    void appendUTF8(unsigned int cp)
+    {
+        if (cp < 0x80)
+            unescaped.push_back(char(cp));
+        else if (cp < 0x800) {
+            unescaped.push_back(char(0xc0 | (cp >> 6)));
+            unescaped.push_back(char(0x80 | (cp & 0x3f)));
+        } else if (cp < 0x10000) {
+            unescaped.push_back(char(0xe0 | (cp >> 12)));
+            unescaped.push_back(char(0x80 | ((cp >> 6) & 0x3f)));
+            unescaped.push_back(char(0x80 | (cp & 0x3f)));
+        } else {
+            unescaped.push_back(char(0xf0 | (cp >> 18)));
+            unescaped.push_back(char(0x80 | ((cp >> 12) & 0x3f)));
+            unescaped.push_back(char(0x80 | ((cp >> 6) & 0x3f)));
+            unescaped.push_back(char(0x80 | (cp & 0x3f)));
+        }
+    }
+
+    /**
+     * Parse a string, with `p` just past the opening quote. The
+     * result points either into the input or into `unescaped`.
+     */
+    std::string_view string()
+    {
+        auto start = p;
+        bool escaped = false;
+
+        while (true) {
+            /* Skip over plain ASCII a word at a time. */
+            while (end - p >= 8) {
+                uint64_t w;
+                std::memcpy(&w, p, sizeof(w));
+                if (needsAttention(w))
+                    break;
+                p += 8;
+            }
+
+            if (p == end)
+                fallback();
+
+            auto c = static_cast<unsigned char>(*p);
+
+            if (c == '"') {
+                std::string_view s;
+                if (escaped) {
+                    unescaped.append(start, p);
+                    s = unescaped;
+                } else
+                    s = {start, size_t(p - start)};
+                ++p;
+                return s;
+            }
+
+            else if (c == '\\') {
+                if (!escaped) {
+                    unescaped.clear();
+                    escaped = true;
+                }
+                unescaped.append(start, p);
+                if (++p == end)
+                    fallback();
+                switch (*p++) {
+                case '"':
+                    unescaped.push_back('"');
+                    break;
+                case '\\':
+                    unescaped.push_back('\\');
+                    break;
+                case '/':
+                    unescaped.push_back('/');
+                    break;
+                case 'b':
+                    unescaped.push_back('\b');
+                    break;
+                case 'f':
+                    unescaped.push_back('\f');
+                    break;
+                case 'n':
+                    unescaped.push_back('\n');
+                    break;
+                case 'r':
+                    unescaped.push_back('\r');
+                    break;
+                case 't':
+                    unescaped.push_back('\t');
+                    break;
+                case 'u': {
+                    auto cp = hex4();
+                    if (cp >= 0xd800 && cp <= 0xdbff) {
+                        expect("\\u");
+                        auto lo = hex4();
+                        if (lo < 0xdc00 || lo > 0xdfff)
+                            fallback();
+                        cp = 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+                    } else if (cp >= 0xdc00 && cp <= 0xdfff)
+                        fallback();
+                    appendUTF8(cp);
+                    break;
+                }
+                default:
+                    fallback();
+                }
+                start = p;
+            }
+
+            else if (c < 0x20)
+                fallback();
+
+            else if (c >= 0x80)
+                skipUTF8();
+
+            else
+                ++p;
+        }
+    }
+
+    void number(Value & v)
+    {
+        auto start = p;
+        bool negative = false;
+        bool isFloat = false;
+
+        if (*p == '-') {
+            negative = true;
+            ++p;
+        }
+
+        auto digits = [&]() {
+            auto first = p;
+            while (p != end && *p >= '0' && *p <= '9')
+                ++p;
+            if (p == first)
+                fallback();
+        };
+
+        auto intStart = p;
+        if (p != end && *p == '0')
+            ++p;
+        else
+            digits();
+        auto intEnd = p;
+
+        if (p != end && *p == '.') {
+            ++p;
+            digits();
+            isFloat = true;
+        }
+
+        if (p != end && (*p == 'e' || *p == 'E')) {
+            ++p;
+            if (p != end && (*p == '+' || *p == '-'))
+                ++p;
+            digits();
+            isFloat = true;
+        }
+
+        if (!isFloat) {
+            uint64_t n = 0;
+            auto [ptr, ec] = std::from_chars(intStart, intEnd, n);
+            if (ec == std::errc() && ptr == intEnd) {
+                if (negative) {
+                    if (n <= uint64_t(std::numeric_limits<NixInt::Inner>::max()) + 1) {
+                        v.mkInt(NixInt::Inner(-n));
+                        return;
+                    }
+                } else {
+                    if (n > uint64_t(std::numeric_limits<NixInt::Inner>::max()))
+                        throw Error("unsigned json number %1% outside of Nix integer range", n);
+                    v.mkInt(NixInt::Inner(n));
+                    return;
+                }
+            }
+            /* Integers that don't fit 64 bits become floats, as in
+               nlohmann. */
+        }
+
+        NixFloat f;
+        auto [ptr, ec] = std::from_chars(start, p, f);
+        if (ec != std::errc() || ptr != p)
+            fallback();
+        v.mkFloat(f);
+    }
+
+    void value(Value & v)
+    {
+        skipWhitespace();
+        if (p == end)
+            fallback();
+
+        switch (*p) {
+
+        case '{': {
+            ++p;
+            if (++depth > maxDepth)
+                fallback();
+            auto base = values.size();
+            skipWhitespace();
+            if (p != end && *p == '}')
+                ++p;
+            else
+                while (true) {
+                    skipWhitespace();
+                    if (p == end || *p != '"')
+                        fallback();
+                    ++p;
+                    auto name = string();
+                    forceNoNullByte(name);
+                    keys.push_back(state.symbols.create(name));
+                    skipWhitespace();
+                    expect(":");
+                    auto v2 = state.allocValue();
+                    values.push_back(v2);
+                    value(*v2);
+                    skipWhitespace();
+                    if (p != end && *p == ',') {
+                        ++p;
+                        continue;
+                    }
+                    expect("}");
+                    break;
+                }
+            attrs(v, base);
+            --depth;
+            break;
+        }
+
+        case '[': {
+            ++p;
+            if (++depth > maxDepth)
+                fallback();
+            auto base = values.size();
+            skipWhitespace();
+            if (p != end && *p == ']')
+                ++p;
+            else
+                while (true) {
+                    auto v2 = state.allocValue();
+                    values.push_back(v2);
+                    value(*v2);
+                    skipWhitespace();
+                    if (p != end && *p == ',') {
+                        ++p;
+                        continue;
+                    }
+                    expect("]");
+                    break;
+                }
+            auto list = state.buildList(values.size() - base);
+            for (const auto & [n, v2] : enumerate(list))
+                v2 = values[base + n];
+            values.resize(base);
+            v.mkList(list);
+            --depth;
+            break;
+        }
+
+        case '"': {
+            ++p;
+            auto s = string();
+            forceNoNullByte(s);
+            v.mkString(s, state.mem);
+            break;
+        }
+
+        case 't':
+            expect("true");
+            v.mkBool(true);
+            break;
+
+        case 'f':
+            expect("false");
+            v.mkBool(false);
+            break;
+
+        case 'n':
+            expect("null");
+            v.mkNull();
+            break;
+
+        default:
+            number(v);
+        }
+    }
+
+    /**
+     * Turn the keys and values from `base` onwards into an attribute
+     * set. As with `JSONSax`, the last of several equal keys wins.
+     */
+    void attrs(Value & v, size_t base)
+    {
+        auto n = values.size() - base;
+        auto keyBase = keys.size() - n;
+
+        std::vector<uint32_t> order(n);
+        for (uint32_t i = 0; i < n; ++i)
+            order[i] = i;
+        std::stable_sort(
+            order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return keys[keyBase + a] < keys[keyBase + b]; });
+
+        size_t unique = 0;
+        for (size_t i = 0; i < n; ++i)
+            if (i + 1 == n || keys[keyBase + order[i]] != keys[keyBase + order[i + 1]])
+                ++unique;
+
+        auto bindings = state.buildBindings(unique);
+        for (size_t i = 0; i < n; ++i)
+            if (i + 1 == n || keys[keyBase + order[i]] != keys[keyBase + order[i + 1]])
+                bindings.insert(keys[keyBase + order[i]], values[base + order[i]]);
+        v.mkAttrs(bindings.alreadySorted());
+
+        values.resize(base);
+        keys.resize(keyBase);
+    }
+
+public:
+
+    FastJSONParser(EvalState & state, std::string_view s)
+        : state(state)
+        , p(s.data())
+        , end(s.data() + s.size())
+    {
+    }
+
+    /**
+     * @return false if the input must be parsed by `JSONSax` instead.
+     */
+    bool parse(Value & v)
+    {
+        try {
+            value(v);
+            skipWhitespace();
+            return p == end;
+        } catch (Fallback &) {
+            return false;
+        }
+    }
+};
+
+} // namespace
+
 void parseJSON(EvalState & state, const std::string_view & s_, Value & v)
 {
+    if (FastJSONParser(state, s_).parse(v))
+        return;
+
     JSONSax parser(state, v);
     bool res = json::sax_parse(s_, &parser);
     if (!res)
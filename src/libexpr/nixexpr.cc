@@ -191,7 +191,7 @@ void ExprCall::show(const SymbolTable & symbols, std::ostream & str) const
 {
     str << '(';
     fun->show(symbols, str);
-    for (auto e : *args) {
+    for (auto e : args) {
         str << ' ';
         e->show(symbols, str);
     }
@@ -360,6 +360,8 @@ void ExprSelect::bindVars(EvalState & es, const std::shared_ptr<const StaticEnv>
         es.exprEnvs.insert(std::make_pair(this, env));
 
     e->bindVars(es, env);
+    if (auto var = dynamic_cast<ExprVar *>(e); var && !var->fromWith)
+        baseVar = var;
     if (def)
         def->bindVars(es, env);
     for (auto & i : getAttrPath())
@@ -458,6 +460,73 @@ void ExprList::bindVars(EvalState & es, const std::shared_ptr<const StaticEnv> &
         i->bindVars(es, env);
 }
 
+/**
+ * Whether `maybeThunk()` on `e` returns an existing value rather than
+ * allocating a thunk that refers to the environment.
+ */
+static bool isTrivialThunk(Expr * e)
+{
+    if (auto var = dynamic_cast<ExprVar *>(e))
+        /* Variables from a `with` may not be evaluated yet. */
+        return !var->fromWith;
+    if (auto list = dynamic_cast<ExprList *>(e))
+        return list->elems.empty();
+    return dynamic_cast<ExprInt *>(e) || dynamic_cast<ExprFloat *>(e) || dynamic_cast<ExprString *>(e)
+           || dynamic_cast<ExprPath *>(e);
+}
+
+/**
+ * Conservatively determine whether evaluating `e` may store a
+ * reference to its environment, i.e. whether anything other than
+ * the result refers to the `Env` after evaluation.
+ */
+static bool mayCaptureEnv(Expr * e)
+{
+    auto attrPathMayCapture = [](auto attrPath) {
+        return std::ranges::any_of(attrPath, [](auto & i) { return i.expr && mayCaptureEnv(i.expr); });
+    };
+
+    if (isTrivialThunk(e) || dynamic_cast<ExprPos *>(e))
+        return false;
+    if (auto list = dynamic_cast<ExprList *>(e))
+        return !std::ranges::all_of(list->elems, isTrivialThunk);
+    if (auto select = dynamic_cast<ExprSelect *>(e))
+        return mayCaptureEnv(select->e) || (select->def && mayCaptureEnv(select->def))
+               || attrPathMayCapture(select->getAttrPath());
+    if (auto hasAttr = dynamic_cast<ExprOpHasAttr *>(e))
+        return mayCaptureEnv(hasAttr->e) || attrPathMayCapture(hasAttr->attrPath);
+    if (auto call = dynamic_cast<ExprCall *>(e))
+        return mayCaptureEnv(call->fun) || !std::ranges::all_of(call->args, isTrivialThunk);
+    if (auto if_ = dynamic_cast<ExprIf *>(e))
+        return mayCaptureEnv(if_->cond) || mayCaptureEnv(if_->then) || mayCaptureEnv(if_->else_);
+    if (auto assert_ = dynamic_cast<ExprAssert *>(e))
+        return mayCaptureEnv(assert_->cond) || mayCaptureEnv(assert_->body);
+    if (auto not_ = dynamic_cast<ExprOpNot *>(e))
+        return mayCaptureEnv(not_->e);
+    if (auto concat = dynamic_cast<ExprConcatStrings *>(e))
+        return std::ranges::any_of(concat->es, [](auto & i) { return mayCaptureEnv(i.second); });
+
+    auto binOp = [](auto * op) { return mayCaptureEnv(op->e1) || mayCaptureEnv(op->e2); };
+    if (auto op = dynamic_cast<ExprOpEq *>(e))
+        return binOp(op);
+    if (auto op = dynamic_cast<ExprOpNEq *>(e))
+        return binOp(op);
+    if (auto op = dynamic_cast<ExprOpAnd *>(e))
+        return binOp(op);
+    if (auto op = dynamic_cast<ExprOpOr *>(e))
+        return binOp(op);
+    if (auto op = dynamic_cast<ExprOpImpl *>(e))
+        return binOp(op);
+    if (auto op = dynamic_cast<ExprOpConcatLists *>(e))
+        return binOp(op);
+    if (auto op = dynamic_cast<ExprOpUpdate *>(e))
+        return binOp(op);
+
+    /* Lambdas, attribute sets, `let`, `with` etc. all create values
+       or environments that point to the current one. */
+    return true;
+}
+
 void ExprLambda::bindVars(EvalState & es, const std::shared_ptr<const StaticEnv> & env)
 {
     if (es.debugRepl)
@@ -483,22 +552,29 @@ void ExprLambda::bindVars(EvalState & es, const std::shared_ptr<const StaticEnv>
     }
 
     body->bindVars(es, newEnv);
+
+    bodyMayCaptureEnv = mayCaptureEnv(body);
 }
 
-void ExprCall::moveDataToAllocator(std::pmr::polymorphic_allocator<char> & alloc)
+void ExprCall::addArg(std::pmr::polymorphic_allocator<char> & alloc, Expr * arg)
 {
-    std::pmr::vector<Expr *> newArgs{std::move(*args), alloc};
-    args.emplace(std::move(newArgs), alloc);
+    auto n = args.size();
+    if (std::has_single_bit(n)) {
+        auto newArgs = alloc.allocate_object<Expr *>(2 * n);
+        std::ranges::copy(args, newArgs);
+        args = {newArgs, n + 1};
+    } else
+        args = {args.data(), n + 1};
+    args[n] = arg;
 }
 
 void ExprCall::bindVars(EvalState & es, const std::shared_ptr<const StaticEnv> & env)
 {
-    moveDataToAllocator(es.mem.exprs.alloc);
     if (es.debugRepl)
         es.exprEnvs.insert(std::make_pair(this, env));
 
     fun->bindVars(es, env);
-    for (auto e : *args)
+    for (auto e : args)
         e->bindVars(es, env);
 }
 
@@ -587,6 +663,10 @@ void ExprConcatStrings::bindVars(EvalState & es, const std::shared_ptr<const Sta
 
     for (auto & i : this->es)
         i.second->bindVars(es, env);
+
+    if (!forceString && !this->es.empty())
+        if (auto e = dynamic_cast<ExprConcatStrings *>(this->es.front().second); e && !e->forceString)
+            nested = e;
 }
 
 void ExprPos::bindVars(EvalState & es, const std::shared_ptr<const StaticEnv> & env)
@@ -666,19 +746,19 @@ std::string DocComment::getInnerText(const PosTable & positions) const
 
 void ExprCall::resetCursedOr()
 {
-    cursedOrEndPos.reset();
+    cursedOrEndPos = noPos;
 }
 
 void ExprCall::warnIfCursedOr(const SymbolTable & symbols, const PosTable & positions)
 {
-    if (cursedOrEndPos.has_value()) {
+    if (cursedOrEndPos) {
         std::ostringstream out;
         out << "at " << positions[pos]
             << ": "
                "This expression uses `or` as an identifier in a way that will change in a future Nix release.\n"
                "Wrap this entire expression in parentheses to preserve its current meaning:\n"
                "    ("
-            << positions[pos].getSnippetUpTo(positions[*cursedOrEndPos]).value_or("could not read expression")
+            << positions[pos].getSnippetUpTo(positions[cursedOrEndPos]).value_or("could not read expression")
             << ")\n"
                "Give feedback at https://github.com/NixOS/nix/pull/11121";
         warn(out.str());
@@ -14,13 +14,16 @@
 #include "nix/util/processes.hh"
 #include "nix/expr/value-to-json.hh"
 #include "nix/expr/value-to-xml.hh"
+#include "nix/expr/value-hash.hh"
 #include "nix/expr/primops.hh"
 #include "nix/fetchers/fetch-to-store.hh"
 #include "nix/util/sort.hh"
+#include "nix/util/sync.hh"
 
 #include <boost/container/small_vector.hpp>
 #include <boost/unordered/concurrent_flat_map.hpp>
 #include <boost/unordered/unordered_flat_map.hpp>
+#include <boost/unordered/unordered_flat_set.hpp>
 #include <nlohmann/json.hpp>
 
 #include <sys/types.h>
@@ -29,6 +32,7 @@
 
 #include <algorithm>
 #include <cstring>
+#include <numeric>
 #include <sstream>
 #include <regex>
 
@@ -66,8 +70,67 @@ std::string EvalState::realiseString(Value & s, StorePathSet * storePathsOutMayb
     return nix::rewriteStrings(rawStr, rewrites);
 }
 
+struct PendingDerivations
+{
+    /**
+     * Flush the buffer once it has this many derivations.
+     */
+    static constexpr size_t maxSize = 1000;
+
+    struct State
+    {
+        /**
+         * In instantiation order, so that every derivation comes
+         * after its dependencies.
+         */
+        std::vector<Derivation> drvs;
+        StorePathSet paths;
+    };
+
+    Sync<State> state_;
+};
+
+ref<PendingDerivations> makePendingDerivations()
+{
+    return make_ref<PendingDerivations>();
+}
+
+StorePath EvalState::writeDerivation(const Derivation & drv)
+{
+    if (!batchDerivations || settings.readOnlyMode || repair)
+        return nix::writeDerivation(*store, drv, repair);
+
+    auto drvPath = nix::writeDerivation(*store, drv, repair, true);
+
+    {
+        auto state(pendingDerivations->state_.lock());
+        if (state->paths.insert(drvPath).second)
+            state->drvs.push_back(drv);
+        if (state->drvs.size() < PendingDerivations::maxSize)
+            return drvPath;
+    }
+
+    flushDerivations();
+    return drvPath;
+}
+
+void EvalState::flushDerivations()
+{
+    /* Keep the lock while writing, so that no other thread can see a
+       derivation as written before it actually is. */
+    auto state(pendingDerivations->state_.lock());
+    if (state->drvs.empty())
+        return;
+    writeDerivations(*store, state->drvs, repair);
+    state->drvs.clear();
+    state->paths.clear();
+}
+
 StringMap EvalState::realiseContext(const NixStringContext & context, StorePathSet * maybePathsOut, bool isIFD)
 {
+    if (!context.empty())
+        flushDerivations();
+
     std::vector<DerivedPath::Built> drvs;
     StringMap res;
 
@@ -817,9 +880,37 @@ static void prim_genericClosure(EvalState & state, const PosIdx pos, Value ** ar
        `workSet', adding the result to `workSet', continuing until
        no new elements are found. */
     ValueList res;
+    /* Keys are deduplicated by hash as long as they are all hashable
+       and comparable with each other. After the first key that isn't,
+       the keys move to an ordered map, which also reports keys that
+       can't be compared. */
+    boost::unordered_flat_set<Value *, ValueHash, ValueEqual> hashedKeys;
+    std::optional<HashableValueKind> hashedKind;
+    bool hashing = true;
     // Track which element each key came from
     auto cmp = CompareValues(state, noPos, "");
     std::map<Value *, Value *, decltype(cmp)> keyToElem(cmp);
+
+    /* Try to insert the key into `hashedKeys', returning whether it
+       was new, or nothing if it has to go into the ordered map. */
+    auto insertHashed = [&](Value * keyValue) -> std::optional<bool> {
+        if (!hashing)
+            return std::nullopt;
+        auto kind = getHashableValueKind(*keyValue);
+        if (kind && (!hashedKind || hashedKind->compatibleWith(*kind))) {
+            if (hashedKind)
+                hashedKind->merge(*kind);
+            else
+                hashedKind = kind;
+            return hashedKeys.insert(keyValue).second;
+        }
+        hashing = false;
+        for (auto elem : res)
+            keyToElem.emplace(elem->attrs()->get(state.s.key)->value, elem);
+        hashedKeys.clear();
+        return std::nullopt;
+    };
+
     while (!workSet.empty()) {
         Value * e = *(workSet.begin());
         workSet.pop_front();
@@ -840,31 +931,37 @@ static void prim_genericClosure(EvalState & state, const PosIdx pos, Value ** ar
         }
         state.forceValue(*key->value, noPos);
 
-        try {
-            auto [it, inserted] = keyToElem.insert({key->value, e});
-            if (!inserted)
+        if (auto inserted = insertHashed(key->value)) {
+            if (!*inserted)
                 continue;
-        } catch (Error & err) {
-            // Try to find which element we're comparing against
-            Value * otherElem = nullptr;
-            for (auto & [otherKey, elem] : keyToElem) {
-                try {
-                    cmp(key->value, otherKey);
-                } catch (Error &) {
-                    // Found the element we're comparing against
-                    otherElem = elem;
-                    break;
+        } else {
+            try {
+                auto [it, inserted] = keyToElem.insert({key->value, e});
+                if (!inserted)
+                    continue;
+            } catch (Error & err) {
+                // Try to find which element we're comparing against
+                Value * otherElem = nullptr;
+                for (auto & [otherKey, elem] : keyToElem) {
+                    try {
+                        cmp(key->value, otherKey);
+                    } catch (Error &) {
+                        // Found the element we're comparing against
+                        otherElem = elem;
+                        break;
+                    }
                 }
+                if (otherElem) {
+                    // Traces are printed in reverse order; pre-swap them.
+                    err.addTrace(nullptr, "with element %s", ValuePrinter(state, *otherElem, errorPrintOptions));
+                    err.addTrace(nullptr, "while comparing element %s", ValuePrinter(state, *e, errorPrintOptions));
+                } else {
+                    // Couldn't find the specific element, just show current
+                    err.addTrace(
+                        nullptr, "while checking key of element %s", ValuePrinter(state, *e, errorPrintOptions));
+                }
+                throw;
             }
-            if (otherElem) {
-                // Traces are printed in reverse order; pre-swap them.
-                err.addTrace(nullptr, "with element %s", ValuePrinter(state, *otherElem, errorPrintOptions));
-                err.addTrace(nullptr, "while comparing element %s", ValuePrinter(state, *e, errorPrintOptions));
-            } else {
-                // Couldn't find the specific element, just show current
-                err.addTrace(nullptr, "while checking key of element %s", ValuePrinter(state, *e, errorPrintOptions));
-            }
-            throw;
         }
         res.push_back(e);
 
@@ -1715,6 +1812,7 @@ static void derivationStrictInternal(EvalState & state, std::string_view drvName
                    available when the builder runs. */
                 [&](const NixStringContextElem::DrvDeep & d) {
                     /* !!! This doesn't work if readOnlyMode is set. */
+                    state.flushDerivations();
                     StorePathSet refs;
                     state.store->computeFSClosure(d.drvPath, refs);
                     for (auto & j : refs) {
@@ -1819,18 +1917,20 @@ static void derivationStrictInternal(EvalState & state, std::string_view drvName
     }
 
     /* Write the resulting term into the Nix store directory. */
-    auto drvPath = writeDerivation(*state.store, drv, state.repair);
+    auto drvPath = state.writeDerivation(drv);
     auto drvPathS = state.store->printStorePath(drvPath);
 
     printMsg(lvlChatty, "instantiated '%1%' -> '%2%'", drvName, drvPathS);
 
+    state.recordDerivation(drvPath);
+
     /* Optimisation, but required in read-only mode! because in that
        case we don't actually write store derivations, so we can't
-       read them later. */
-    {
-        auto h = hashDerivationModulo(*state.store, drv, false);
-        drvHashes.insert_or_assign(drvPath, std::move(h));
-    }
+       read them later. The hash only depends on the contents of the
+       derivation, so if an identical derivation was instantiated
+       before, its hash can be reused. */
+    if (!drvHashes.contains(drvPath))
+        drvHashes.insert_or_assign(drvPath, hashDerivationModulo(*state.store, drv, false));
 
     auto result = state.buildBindings(1 + drv.outputs.size());
     result.alloc(state.s.drvPath)
@@ -1934,6 +2034,7 @@ static void prim_storePath(EvalState & state, const PosIdx pos, Value ** args, V
     if (!state.store->isInStore(path.abs()))
         state.error<EvalError>("path '%1%' is not in the Nix store", path).atPos(pos).debugThrow();
     auto path2 = state.store->toStorePath(path.abs()).first;
+    state.flushDerivations();
     if (!settings.readOnlyMode)
         state.store->ensurePath(path2);
     context.insert(NixStringContextElem::Opaque{.path = path2});
@@ -2076,10 +2177,46 @@ static RegisterPrimOp primop_dirOf({
 });
 
 /* Return the contents of a file as a string. */
+/**
+ * Read a file directly into a string on the evaluator heap, avoiding
+ * a temporary copy of the whole file.
+ */
+static const StringData & readFileToStringData(EvalState & state, const SourcePath & path)
+{
+    StringData * res = nullptr;
+    size_t filled = 0;
+    /* Only used if the accessor doesn't report the size up front, or
+       the file grew while we were reading it. */
+    std::string overflow;
+
+    LambdaSink sink([&](std::string_view data) {
+        if (res && overflow.empty()) {
+            auto n = std::min(data.size(), res->size() - filled);
+            std::memcpy(res->data() + filled, data.data(), n);
+            filled += n;
+            data.remove_prefix(n);
+        }
+        overflow.append(data);
+    });
+
+    path.readFile(sink, [&](uint64_t size) { res = &StringData::alloc(state.mem, size); });
+
+    if (!overflow.empty())
+        return StringData::make(state.mem, (res ? std::string(res->data(), filled) : std::string()) + overflow);
+
+    if (!res || filled == 0)
+        return ""_sds;
+
+    res->size_ = filled;
+    res->data()[filled] = '\0';
+    return *res;
+}
+
 static void prim_readFile(EvalState & state, const PosIdx pos, Value ** args, Value & v)
 {
     auto path = realisePath(state, pos, *args[0]);
-    auto s = path.readFile();
+    auto & str = readFileToStringData(state, path);
+    auto s = str.view();
     if (s.find((char) 0) != std::string::npos)
         state.error<EvalError>("the contents of the file '%1%' cannot be represented as a Nix string", path)
             .atPos(pos)
@@ -2102,7 +2239,7 @@ static void prim_readFile(EvalState & state, const PosIdx pos, Value ** args, Va
                 .path = std::move((StorePath &&) p),
             });
     }
-    v.mkString(s, context, state.mem);
+    v.mkStringMove(str, context, state.mem);
 }
 
 static RegisterPrimOp primop_readFile({
@@ -2385,6 +2522,16 @@ static void prim_readDir(EvalState & state, const PosIdx pos, Value ** args, Val
 {
     auto path = realisePath(state, pos, *args[0]);
 
+    /* Directories are often listed many times, e.g. by functions
+       that call `readDir ./.`. The resulting attribute sets are
+       immutable, so they can be shared. */
+    if (auto cached = getConcurrent(*state.readDirCache, path)) {
+        state.nrReadDirCacheHits++;
+        v = **cached;
+        return;
+    }
+    state.nrReadDirCacheMisses++;
+
     // Retrieve directory entries for all nodes in a directory.
     // This is similar to `getFileType` but is optimized to reduce system calls
     // on many systems.
@@ -2418,6 +2565,10 @@ static void prim_readDir(EvalState & state, const PosIdx pos, Value ** args, Val
     }
 
     v.mkAttrs(attrs);
+
+    auto vCached = state.allocValue();
+    *vCached = v;
+    state.readDirCache->emplace(path, vCached);
 }
 
 static RegisterPrimOp primop_readDir({
@@ -2495,10 +2646,10 @@ static RegisterPrimOp primop_outputOf({
    be sensibly or completely represented (e.g., functions). */
 static void prim_toXML(EvalState & state, const PosIdx pos, Value ** args, Value & v)
 {
-    std::ostringstream out;
+    StringSink sink;
     NixStringContext context;
-    printValueAsXML(state, true, false, *args[0], out, context, pos);
-    v.mkString(out.view(), context, state.mem);
+    printValueAsXML(state, true, false, *args[0], sink, context, pos);
+    v.mkString(sink.s, context, state.mem);
 }
 
 static RegisterPrimOp primop_toXML({
@@ -2603,10 +2754,10 @@ static RegisterPrimOp primop_toXML({
    represented (e.g., functions). */
 static void prim_toJSON(EvalState & state, const PosIdx pos, Value ** args, Value & v)
 {
-    std::ostringstream out;
+    StringSink out;
     NixStringContext context;
     printValueAsJSON(state, true, *args[0], pos, out, context);
-    v.mkString(out.view(), context, state.mem);
+    v.mkString(out.s, context, state.mem);
 }
 
 static RegisterPrimOp primop_toJSON({
@@ -2675,6 +2826,9 @@ static void prim_toFile(EvalState & state, const PosIdx pos, Value ** args, Valu
                 .debugThrow();
     }
 
+    if (!refs.empty())
+        state.flushDerivations();
+
     auto storePath = settings.readOnlyMode ? state.store->makeFixedOutputPathFromCA(
                                                  name,
                                                  TextInfo{
@@ -3307,6 +3461,8 @@ static void prim_listToAttrs(EvalState & state, const PosIdx pos, Value ** args,
     for (size_t n = bindings.size(); n < listSize; n++) {
         bindings[n] = Attr{};
     }
+    // This overwrites the start of the cleared part of the array.
+    bindings.finishIndex();
     v.mkAttrs(&bindings);
 }
 
@@ -3767,10 +3923,12 @@ static void prim_filter(EvalState & state, const PosIdx pos, Value ** args, Valu
     SmallValueVector<nonRecursiveStackReservation> vs(len);
     size_t k = 0;
 
+    RepeatedCall call(state, *args[0], 1, noPos);
+
     bool same = true;
     for (size_t n = 0; n < len; ++n) {
         Value res;
-        state.callFunction(*args[0], *args[1]->listView()[n], res, noPos);
+        call(*args[1]->listView()[n], res);
         if (state.forceBool(
                 res, pos, "while evaluating the return value of the filtering function passed to builtins.filter"))
             vs[k++] = args[1]->listView()[n];
@@ -3868,12 +4026,13 @@ static void prim_foldlStrict(EvalState & state, const PosIdx pos, Value ** args,
 
     if (args[2]->listSize()) {
         Value * vCur = args[1];
+        RepeatedCall call(state, *args[0], 2, pos);
 
         auto listView = args[2]->listView();
         for (auto [n, elem] : enumerate(listView)) {
             Value * vs[]{vCur, elem};
             vCur = n == args[2]->listSize() - 1 ? &v : state.allocValue();
-            state.callFunction(*args[0], vs, *vCur, pos);
+            call(vs, *vCur);
         }
         state.forceValue(v, pos);
     } else {
@@ -3912,9 +4071,11 @@ static void anyOrAll(bool any, EvalState & state, const PosIdx pos, Value ** arg
     std::string_view errorCtx = any ? "while evaluating the return value of the function passed to builtins.any"
                                     : "while evaluating the return value of the function passed to builtins.all";
 
+    RepeatedCall call(state, *args[0], 1, pos);
+
     Value vTmp;
     for (auto elem : args[1]->listView()) {
-        state.callFunction(*args[0], *elem, vTmp, pos);
+        call(*elem, vTmp);
         bool res = state.forceBool(vTmp, pos, errorCtx);
         if (res == any) {
             v.mkBool(any);
@@ -3995,6 +4156,106 @@ static RegisterPrimOp primop_genList({
 
 static void prim_lessThan(EvalState & state, const PosIdx pos, Value ** args, Value & v);
 
+/**
+ * A comparator passed to `builtins.sort` that compares a key of its
+ * arguments with `builtins.lessThan`: `builtins.lessThan` itself, or a
+ * lambda like `a: b: a.x < b.x` or `a: b: a.x > b.x`.
+ */
+struct SortKeyComparator
+{
+    /**
+     * The closure of the comparator.
+     */
+    Env * env = nullptr;
+
+    /**
+     * The key of the first argument, evaluated in the environment of
+     * the body of the comparator, or null if the key is the argument
+     * itself.
+     */
+    Expr * key = nullptr;
+
+    /**
+     * Whether the comparator compares the key of its second argument
+     * with the key of its first.
+     */
+    bool descending = false;
+};
+
+/**
+ * Recognise a comparator of the form `a: b: <key of a> < <key of b>`
+ * (or with `>`), where the key is `a` itself or an attribute path
+ * without default selected from `a`.
+ */
+static std::optional<SortKeyComparator> getSortKeyComparator(EvalState & state, const Value & comparator)
+{
+    auto isLessThan = [](const Value * v) {
+        if (!v || !v->isPrimOp())
+            return false;
+        auto ptr = v->primOp()->fun.target<decltype(&prim_lessThan)>();
+        return ptr && *ptr == prim_lessThan;
+    };
+
+    if (isLessThan(&comparator))
+        return SortKeyComparator{};
+
+    if (!comparator.isLambda())
+        return std::nullopt;
+    auto [env, outer] = comparator.lambda();
+    auto inner = dynamic_cast<ExprLambda *>(outer->body);
+    if (outer->getFormals() || !inner || inner->getFormals())
+        return std::nullopt;
+    auto call = dynamic_cast<ExprCall *>(inner->body);
+    if (!call || call->args.size() != 2)
+        return std::nullopt;
+
+    /* The function must be the `builtins.lessThan` primop, looked up
+       without forcing anything. Levels 0 and 1 are the environments
+       of the inner and outer lambda. */
+    auto fun = dynamic_cast<ExprVar *>(call->fun);
+    if (!fun || fun->fromWith || fun->level < 2)
+        return std::nullopt;
+    auto funEnv = env;
+    for (auto l = fun->level - 2; l; --l)
+        funEnv = funEnv->up;
+    if (!isLessThan(funEnv->values[fun->displ]))
+        return std::nullopt;
+
+    /* Whether `e` is the argument of the lambda at `level`. */
+    auto isArg = [](Expr * e, Level level) {
+        auto var = dynamic_cast<ExprVar *>(e);
+        return var && !var->fromWith && var->level == level && var->displ == 0;
+    };
+
+    /* Whether `e1` and `e2` are the same key of the arguments of the
+       outer and inner lambda respectively. */
+    auto isSameKey = [&](Expr * e1, Expr * e2) {
+        if (isArg(e1, 1) && isArg(e2, 0))
+            return true;
+        auto s1 = dynamic_cast<ExprSelect *>(e1);
+        auto s2 = dynamic_cast<ExprSelect *>(e2);
+        if (!s1 || !s2 || s1->def || s2->def || !isArg(s1->e, 1) || !isArg(s2->e, 0))
+            return false;
+        return std::ranges::equal(s1->getAttrPath(), s2->getAttrPath(), [](const AttrName & a, const AttrName & b) {
+            return !a.expr && !b.expr && a.symbol == b.symbol;
+        });
+    };
+
+    auto e1 = call->args[0];
+    auto e2 = call->args[1];
+    SortKeyComparator res{.env = env};
+    if (isSameKey(e1, e2))
+        res.key = e1;
+    else if (isSameKey(e2, e1)) {
+        res.key = e2;
+        res.descending = true;
+    } else
+        return std::nullopt;
+    if (isArg(res.key, 1))
+        res.key = nullptr;
+    return res;
+}
+
 static void prim_sort(EvalState & state, const PosIdx pos, Value ** args, Value & v)
 {
     state.forceList(*args[1], pos, "while evaluating the second argument passed to builtins.sort");
@@ -4011,19 +4272,65 @@ static void prim_sort(EvalState & state, const PosIdx pos, Value ** args, Value
     for (const auto & [n, v] : enumerate(list))
         state.forceValue(*(v = args[1]->listView()[n]), pos);
 
-    auto comparator = [&](Value * a, Value * b) {
-        /* Optimization: if the comparator is lessThan, bypass
-           callFunction. */
-        if (args[0]->isPrimOp()) {
-            auto ptr = args[0]->primOp()->fun.target<decltype(&prim_lessThan)>();
-            if (ptr && *ptr == prim_lessThan)
-                return CompareValues(state, noPos, "while evaluating the ordering function passed to builtins.sort")(
-                    a, b);
-        }
+    /* Optimization: if the comparator compares keys with lessThan,
+       compute the key of every element once and compare the keys
+       directly instead of calling the comparator. With fewer than two
+       elements the comparator is never called, so no keys may be
+       evaluated. */
+    if (auto keyComparator = len > 1 ? getSortKeyComparator(state, *args[0]) : std::nullopt) {
+        auto keys = state.buildList(len);
+        if (auto key = keyComparator->key) {
+            /* The environments of the outer and inner lambda, both
+               holding the element, since the key only refers to the
+               former. */
+            Env & outer = state.mem.allocEnv(1);
+            outer.up = keyComparator->env;
+            Env & inner = state.mem.allocEnv(1);
+            inner.up = &outer;
+            for (size_t n = 0; n < len; ++n) {
+                outer.values[0] = inner.values[0] = list[n];
+                keys[n] = state.allocValue();
+                key->eval(state, inner, *keys[n]);
+                state.forceValue(*keys[n], pos);
+            }
+        } else
+            std::ranges::copy(list, keys.begin());
+
+        std::vector<size_t> order(len);
+        std::iota(order.begin(), order.end(), 0);
+
+        auto sortBy = [&](auto less) {
+            if (keyComparator->descending)
+                peeksort(order.begin(), order.end(), [&](size_t a, size_t b) { return less(keys[b], keys[a]); });
+            else
+                peeksort(order.begin(), order.end(), [&](size_t a, size_t b) { return less(keys[a], keys[b]); });
+        };
+
+        auto allOfType = [&](ValueType type) {
+            return std::ranges::all_of(keys, [&](Value * key) { return key->type() == type; });
+        };
+
+        if (allOfType(nInt))
+            sortBy([](Value * a, Value * b) { return a->integer() < b->integer(); });
+        else if (allOfType(nString))
+            sortBy([](Value * a, Value * b) { return a->string_view() < b->string_view(); });
+        else
+            sortBy(CompareValues(state, noPos, "while evaluating the ordering function passed to builtins.sort"));
 
+        /* The elements are still reachable from the argument. */
+        std::vector<Value *> elems(list.begin(), list.end());
+        for (size_t n = 0; n < len; ++n)
+            list[n] = elems[order[n]];
+        v.mkList(list);
+        return;
+    }
+
+    RepeatedCall call(state, *args[0], 2, noPos);
+
+    auto comparator = [&](Value * a, Value * b) {
         Value * vs[] = {a, b};
         Value vBool;
-        state.callFunction(*args[0], vs, vBool, noPos);
+        call(vs, vBool);
         return state.forceBool(
             vBool, pos, "while evaluating the return value of the sorting function passed to builtins.sort");
     };
@@ -4111,12 +4418,13 @@ static void prim_partition(EvalState & state, const PosIdx pos, Value ** args, V
     auto len = args[1]->listSize();
 
     ValueVector right, wrong;
+    RepeatedCall call(state, *args[0], 1, pos);
 
     for (size_t n = 0; n < len; ++n) {
         auto vElem = args[1]->listView()[n];
         state.forceValue(*vElem, pos);
         Value res;
-        state.callFunction(*args[0], *vElem, res, pos);
+        call(*vElem, res);
         if (state.forceBool(
                 res, pos, "while evaluating the return value of the partition function passed to builtins.partition"))
             right.push_back(vElem);
@@ -4170,10 +4478,11 @@ static void prim_groupBy(EvalState & state, const PosIdx pos, Value ** args, Val
     state.forceList(*args[1], pos, "while evaluating the second argument passed to builtins.groupBy");
 
     ValueVectorMap attrs;
+    RepeatedCall call(state, *args[0], 1, pos);
 
     for (auto vElem : args[1]->listView()) {
         Value res;
-        state.callFunction(*args[0], *vElem, res, pos);
+        call(*vElem, res);
         auto name = state.forceStringNoCtx(
             res, pos, "while evaluating the return value of the grouping function passed to builtins.groupBy");
         auto sym = state.symbols.create(name);
@@ -4226,10 +4535,11 @@ static void prim_concatMap(EvalState & state, const PosIdx pos, Value ** args, V
     // List of returned lists before concatenation. References to these Values must NOT be persisted.
     SmallTemporaryValueVector<conservativeStackReservation> lists(nrLists);
     size_t len = 0;
+    RepeatedCall call(state, *args[0], 1, pos);
 
     for (size_t n = 0; n < nrLists; ++n) {
         Value * vElem = args[1]->listView()[n];
-        state.callFunction(*args[0], *vElem, lists[n], pos);
+        call(*vElem, lists[n]);
         state.forceList(
             lists[n],
             lists[n].determinePos(args[0]->determinePos(pos)),
@@ -4710,27 +5020,73 @@ static RegisterPrimOp primop_convertHash({
     .fun = prim_convertHash,
 });
 
+/**
+ * If the extended POSIX regular expression `re` only matches a fixed,
+ * non-empty string, return that string.
+ */
+static std::optional<std::string> parseLiteralRegex(std::string_view re)
+{
+    static constexpr std::string_view special = ".[]()*+?{}|^$\\";
+
+    if (re.empty())
+        return std::nullopt;
+
+    std::string res;
+    res.reserve(re.size());
+    for (size_t i = 0; i < re.size(); ++i) {
+        auto c = re[i];
+        if (c == '\\') {
+            /* Only escaped special characters are guaranteed to be
+               literals. */
+            if (++i == re.size() || special.find(re[i]) == special.npos)
+                return std::nullopt;
+            c = re[i];
+        } else if (special.find(c) != special.npos)
+            return std::nullopt;
+        res += c;
+    }
+    return res;
+}
+
 struct RegexCache
 {
+    struct Regex
+    {
+        /**
+         * Set if the regex matches only this fixed string, in which
+         * case it is matched with plain string comparison and `regex`
+         * is not compiled.
+         */
+        std::optional<std::string> literal;
+
+        std::optional<std::regex> regex;
+
+        Regex(std::string_view re)
+            : literal(parseLiteralRegex(re))
+        {
+            if (!literal)
+                regex.emplace(re.data(), re.size(), std::regex::extended);
+        }
+    };
+
     struct Entry
     {
-        ref<const std::regex> regex;
+        ref<const Regex> regex;
 
-        Entry(const char * s, size_t count)
-            : regex(make_ref<const std::regex>(s, count, std::regex::extended))
+        Entry(std::string_view re)
+            : regex(make_ref<const Regex>(re))
         {
         }
     };
 
     boost::concurrent_flat_map<std::string, Entry, StringViewHash, std::equal_to<>> cache;
 
-    ref<const std::regex> get(std::string_view re)
+    ref<const Regex> get(std::string_view re)
     {
-        std::optional<ref<const std::regex>> regex;
+        std::optional<ref<const Regex>> regex;
         cache.try_emplace_and_cvisit(
             re,
-            /*s=*/re.data(),
-            /*count=*/re.size(),
+            re,
             [&regex](const auto & kv) { regex = kv.second.regex; },
             [&regex](const auto & kv) { regex = kv.second.regex; });
         return *regex;
@@ -4754,8 +5110,16 @@ void prim_match(EvalState & state, const PosIdx pos, Value ** args, Value & v)
         const auto str =
             state.forceString(*args[1], context, pos, "while evaluating the second argument passed to builtins.match");
 
+        if (regex->literal) {
+            if (str == *regex->literal)
+                v.mkList(state.buildList(0));
+            else
+                v.mkNull();
+            return;
+        }
+
         std::cmatch match;
-        if (!std::regex_match(str.begin(), str.end(), match, *regex)) {
+        if (!std::regex_match(str.begin(), str.end(), match, *regex->regex)) {
             v.mkNull();
             return;
         }
@@ -4828,7 +5192,37 @@ void prim_split(EvalState & state, const PosIdx pos, Value ** args, Value & v)
         const auto str =
             state.forceString(*args[1], context, pos, "while evaluating the second argument passed to builtins.split");
 
-        auto begin = std::cregex_iterator(str.begin(), str.end(), *regex);
+        if (regex->literal) {
+            auto & sep = *regex->literal;
+            std::vector<std::string_view> parts;
+            for (size_t start = 0;;) {
+                auto i = str.find(sep, start);
+                if (i == str.npos) {
+                    parts.push_back(str.substr(start));
+                    break;
+                }
+                parts.push_back(str.substr(start, i - start));
+                start = i + sep.size();
+            }
+
+            if (parts.size() == 1) {
+                auto list = state.buildList(1);
+                list[0] = args[1];
+                v.mkList(list);
+                return;
+            }
+
+            auto list = state.buildList(2 * parts.size() - 1);
+            for (const auto & [n, part] : enumerate(parts)) {
+                (list[2 * n] = state.allocValue())->mkString(part, state.mem);
+                if (n + 1 < parts.size())
+                    list[2 * n + 1] = &Value::vEmptyList;
+            }
+            v.mkList(list);
+            return;
+        }
+
+        auto begin = std::cregex_iterator(str.begin(), str.end(), *regex->regex);
         auto end = std::cregex_iterator();
 
         // Any matches results are surrounded by non-matching results.
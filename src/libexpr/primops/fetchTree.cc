@@ -220,11 +220,16 @@ static void fetchTree(
             throw Error("input '%s' is not allowed to use the '__final' attribute", input.to_string());
     }
 
+    auto start = std::chrono::steady_clock::now();
+
     auto cachedInput =
         state.inputCache->getAccessor(state.fetchSettings, *state.store, input, fetchers::UseRegistries::No);
 
     auto storePath = state.mountInput(cachedInput.lockedInput, input, cachedInput.accessor);
 
+    state.recordFetchTree(
+        input, std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start));
+
     emitTreeAttrs(state, storePath, cachedInput.lockedInput, v, params.emptyRevFallback, false);
 }
 
@@ -135,12 +135,12 @@ std::ostream & printAttributeName(std::ostream & str, std::string_view name)
     return str;
 }
 
-bool isImportantAttrName(const std::string & attrName)
+bool isImportantAttrName(std::string_view attrName)
 {
     return attrName == "type" || attrName == "_type";
 }
 
-typedef std::pair<std::string, Value *> AttrPair;
+typedef std::pair<std::string_view, Value *> AttrPair;
 
 struct ImportantFirstAttrNameCmp
 {
@@ -154,7 +154,7 @@ struct ImportantFirstAttrNameCmp
 };
 
 typedef std::set<const void *> ValuesSeen;
-typedef std::vector<std::pair<std::string, Value *>> AttrVec;
+typedef std::vector<AttrPair> AttrVec;
 
 class Printer
 {
@@ -341,9 +341,12 @@ private:
             increaseIndent();
             output << "{";
 
+            /* The names point into the symbol table, so there's no need
+               to copy them. */
             AttrVec sorted;
+            sorted.reserve(v.attrs()->size());
             for (auto & i : *v.attrs())
-                sorted.emplace_back(std::pair(state.symbols[i.name], i.value));
+                sorted.emplace_back(std::string_view(state.symbols[i.name]), i.value);
 
             if (options.maxAttrs == std::numeric_limits<size_t>::max())
                 std::sort(sorted.begin(), sorted.end());
@@ -0,0 +1,110 @@
+#include "nix/expr/value-hash.hh"
+#include "nix/util/std-hash.hh"
+
+#include <cmath>
+
+namespace nix {
+
+static std::optional<HashableValueKind::Scalar> getScalarKind(const Value & v)
+{
+    switch (v.type()) {
+    case nInt:
+        return HashableValueKind::Number;
+    case nFloat:
+        if (std::isnan(v.fpoint()))
+            return std::nullopt;
+        return HashableValueKind::Number;
+    case nString:
+        return HashableValueKind::String;
+    case nPath:
+        return HashableValueKind::Path;
+    default:
+        return std::nullopt;
+    }
+}
+
+std::optional<HashableValueKind> getHashableValueKind(const Value & v)
+{
+    if (v.type() != nList) {
+        if (auto scalar = getScalarKind(v))
+            return HashableValueKind{.scalar = *scalar};
+        return std::nullopt;
+    }
+
+    HashableValueKind kind{.scalar = HashableValueKind::Any, .list = true};
+    for (auto elem : v.listView()) {
+        auto scalar = getScalarKind(*elem);
+        if (!scalar || (kind.scalar != HashableValueKind::Any && kind.scalar != *scalar))
+            return std::nullopt;
+        kind.scalar = *scalar;
+    }
+    return kind;
+}
+
+static size_t hashScalar(const Value & v) noexcept
+{
+    switch (v.type()) {
+    case nInt:
+    case nFloat: {
+        /* Hash integers as floats, since an integer is equal to the
+           float it converts to. */
+        double d = v.type() == nInt ? (double) v.integer().value : v.fpoint();
+        /* -0.0 == 0.0, but they don't hash the same. */
+        if (d == 0)
+            d = 0;
+        return std::hash<double>{}(d);
+    }
+    case nString:
+        return std::hash<std::string_view>{}(v.string_view());
+    case nPath:
+        return std::hash<std::string_view>{}(v.pathStrView());
+    default:
+        unreachable();
+    }
+}
+
+size_t ValueHash::operator()(const Value * v) const noexcept
+{
+    if (v->type() != nList)
+        return hashScalar(*v);
+    size_t seed = v->listSize();
+    for (auto elem : v->listView())
+        hash_combine(seed, hashScalar(*elem));
+    return seed;
+}
+
+static bool equalScalars(const Value & v1, const Value & v2) noexcept
+{
+    switch (v1.type()) {
+    case nInt:
+        if (v2.type() == nInt)
+            return v1.integer().value == v2.integer().value;
+        return (double) v1.integer().value == v2.fpoint();
+    case nFloat:
+        if (v2.type() == nInt)
+            return v1.fpoint() == (double) v2.integer().value;
+        return v1.fpoint() == v2.fpoint();
+    case nString:
+        return v1.string_view() == v2.string_view();
+    case nPath:
+        return v1.pathStrView() == v2.pathStrView();
+    default:
+        unreachable();
+    }
+}
+
+bool ValueEqual::operator()(const Value * v1, const Value * v2) const noexcept
+{
+    if (v1->type() != nList)
+        return equalScalars(*v1, *v2);
+    if (v1->listSize() != v2->listSize())
+        return false;
+    auto l1 = v1->listView();
+    auto l2 = v2->listView();
+    for (size_t i = 0; i < l1.size(); ++i)
+        if (!equalScalars(*l1[i], *l2[i]))
+            return false;
+    return true;
+}
+
+} // namespace nix
@@ -2,7 +2,10 @@
 #include "nix/expr/eval-inline.hh"
 #include "nix/store/store-api.hh"
 #include "nix/util/signals.hh"
+#include "nix/util/serialise.hh"
 
+#include <algorithm>
+#include <cstdio>
 #include <cstdlib>
 #include <iomanip>
 #include <nlohmann/json.hpp>
@@ -104,6 +107,186 @@ json printValueAsJSON(
     return out;
 }
 
+namespace {
+
+/**
+ * Writes the same bytes as `printValueAsJSON(...).dump()`, but without
+ * building the intermediate `nlohmann::json` tree, so that output can
+ * start before the whole value has been forced.
+ */
+struct JSONWriter
+{
+    EvalState & state;
+    bool strict;
+    NixStringContext & context;
+    bool copyToStore;
+    Sink & sink;
+
+    void writeString(std::string_view s)
+    {
+        /* Leave anything non-ASCII to nlohmann, which also rejects
+           invalid UTF-8. */
+        if (std::ranges::any_of(s, [](char c) { return static_cast<unsigned char>(c) >= 0x80; })) {
+            sink(json(s).dump());
+            return;
+        }
+
+        sink("\"");
+        size_t start = 0;
+        for (size_t i = 0; i < s.size(); ++i) {
+            unsigned char c = s[i];
+            if (c >= 0x20 && c != '"' && c != '\\')
+                continue;
+            sink(s.substr(start, i - start));
+            start = i + 1;
+            switch (c) {
+            case '"':
+                sink("\\\"");
+                break;
+            case '\\':
+                sink("\\\\");
+                break;
+            case '\b':
+                sink("\\b");
+                break;
+            case '\f':
+                sink("\\f");
+                break;
+            case '\n':
+                sink("\\n");
+                break;
+            case '\r':
+                sink("\\r");
+                break;
+            case '\t':
+                sink("\\t");
+                break;
+            default: {
+                char buf[7];
+                std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+                sink(std::string_view(buf, 6));
+            }
+            }
+        }
+        sink(s.substr(start));
+        sink("\"");
+    }
+
+    void write(Value & v, const PosIdx pos)
+    {
+        checkInterrupt();
+
+        auto _level = state.addCallDepth(pos);
+
+        if (strict)
+            state.forceValue(v, pos);
+
+        switch (v.type()) {
+
+        case nInt:
+            sink(std::to_string(v.integer().value));
+            break;
+
+        case nBool:
+            sink(v.boolean() ? "true" : "false");
+            break;
+
+        case nString:
+            copyContext(v, context);
+            writeString(v.string_view());
+            break;
+
+        case nPath:
+            if (copyToStore)
+                writeString(state.store->printStorePath(state.copyPathToStore(context, v.path())));
+            else
+                writeString(v.path().path.abs());
+            break;
+
+        case nNull:
+            sink("null");
+            break;
+
+        case nAttrs: {
+            auto maybeString = state.tryAttrsToString(pos, v, context, false, false);
+            if (maybeString) {
+                writeString(*maybeString);
+                break;
+            }
+            if (auto i = v.attrs()->get(state.s.outPath))
+                return write(*i->value, i->pos);
+            sink("{");
+            bool first = true;
+            for (auto & a : v.attrs()->lexicographicOrder(state.symbols)) {
+                if (!first)
+                    sink(",");
+                first = false;
+                writeString(state.symbols[a->name]);
+                sink(":");
+                try {
+                    write(*a->value, a->pos);
+                } catch (Error & e) {
+                    e.addTrace(
+                        state.positions[a->pos], HintFmt("while evaluating attribute '%1%'", state.symbols[a->name]));
+                    throw;
+                }
+            }
+            sink("}");
+            break;
+        }
+
+        case nList: {
+            sink("[");
+            int i = 0;
+            for (auto elem : v.listView()) {
+                if (i)
+                    sink(",");
+                try {
+                    write(*elem, pos);
+                } catch (Error & e) {
+                    e.addTrace(state.positions[pos], HintFmt("while evaluating list element at index %1%", i));
+                    throw;
+                }
+                i++;
+            }
+            sink("]");
+            break;
+        }
+
+        case nExternal:
+            sink(v.external()->printValueAsJSON(state, strict, context, copyToStore).dump());
+            break;
+
+        case nFloat:
+            sink(json(v.fpoint()).dump());
+            break;
+
+        case nThunk:
+        case nFunction:
+            state.error<TypeError>("cannot convert %1% to JSON", showType(v)).atPos(v.determinePos(pos)).debugThrow();
+        }
+    }
+};
+
+} // namespace
+
+void printValueAsJSON(
+    EvalState & state, bool strict, Value & v, const PosIdx pos, Sink & sink, NixStringContext & context, bool copyToStore)
+{
+    try {
+        JSONWriter{
+            .state = state,
+            .strict = strict,
+            .context = context,
+            .copyToStore = copyToStore,
+            .sink = sink,
+        }
+            .write(v, pos);
+    } catch (nlohmann::json::exception & e) {
+        throw JSONSerializationError("JSON serialization error: %s", e.what());
+    }
+}
+
 void printValueAsJSON(
     EvalState & state,
     bool strict,
@@ -113,11 +296,23 @@ void printValueAsJSON(
     NixStringContext & context,
     bool copyToStore)
 {
-    try {
-        str << printValueAsJSON(state, strict, v, pos, context, copyToStore);
-    } catch (nlohmann::json::exception & e) {
-        throw JSONSerializationError("JSON serialization error: %s", e.what());
-    }
+    struct OStreamSink : Sink
+    {
+        std::ostream & str;
+
+        OStreamSink(std::ostream & str)
+            : str(str)
+        {
+        }
+
+        void operator()(std::string_view data) override
+        {
+            str.write(data.data(), data.size());
+        }
+    };
+
+    OStreamSink sink(str);
+    printValueAsJSON(state, strict, v, pos, sink, context, copyToStore);
 }
 
 json ExternalValueBase::printValueAsJSON(
@@ -14,16 +14,6 @@ static XMLAttrs singletonAttrs(const std::string & name, std::string_view value)
     return attrs;
 }
 
-static void printValueAsXML(
-    EvalState & state,
-    bool strict,
-    bool location,
-    Value & v,
-    XMLWriter & doc,
-    NixStringContext & context,
-    PathSet & drvsSeen,
-    const PosIdx pos);
-
 static void posToXML(EvalState & state, XMLAttrs & xmlAttrs, const Pos & pos)
 {
     if (auto path = std::get_if<SourcePath>(&pos.origin))
@@ -32,42 +22,132 @@ static void posToXML(EvalState & state, XMLAttrs & xmlAttrs, const Pos & pos)
     xmlAttrs["column"] = fmt("%1%", pos.column);
 }
 
-static void showAttrs(
-    EvalState & state,
-    bool strict,
-    bool location,
-    const Bindings & attrs,
-    XMLWriter & doc,
-    NixStringContext & context,
-    PathSet & drvsSeen)
+namespace {
+
+/**
+ * Prints a value as XML without recursing on the C stack, so that
+ * deeply nested values can't overflow it. The lists and attribute sets
+ * whose elements are being printed are kept on an explicit stack
+ * instead, and every value is forced just before it is printed.
+ */
+class XMLPrinter
 {
-    StringSet names;
+    EvalState & state;
+    bool strict;
+    bool location;
+    XMLWriter & doc;
+    NixStringContext & context;
+    PathSet & drvsSeen;
+
+    /**
+     * A list or attribute set whose element is open in `doc` and
+     * whose children are being printed.
+     */
+    struct Frame
+    {
+        /**
+         * The elements of a list, or nothing for an attribute set.
+         */
+        std::optional<ListView> list;
+
+        /**
+         * The attributes of an attribute set, in lexicographic order.
+         */
+        std::vector<const Attr *> attrs;
+
+        /**
+         * The index of the next child to print.
+         */
+        size_t next = 0;
+
+        PosIdx pos;
+    };
+
+    std::vector<Frame> stack;
+
+    void push(Frame && frame)
+    {
+        if (stack.size() >= state.settings.maxCallDepth)
+            state.error<StackOverflowError>().atPos(frame.pos).debugThrow();
+        stack.push_back(std::move(frame));
+    }
 
-    for (auto & a : attrs.lexicographicOrder(state.symbols)) {
-        XMLAttrs xmlAttrs;
-        xmlAttrs["name"] = state.symbols[a->name];
-        if (location && a->pos)
-            posToXML(state, xmlAttrs, state.positions[a->pos]);
+    void pushAttrs(const Bindings & attrs, const PosIdx pos)
+    {
+        push({.attrs = attrs.lexicographicOrder(state.symbols), .pos = pos});
+    }
+
+    /**
+     * Print `v` if it's a scalar. Otherwise open its element, and push
+     * a frame for its children, if any.
+     */
+    void visit(Value & v, const PosIdx pos);
+
+public:
+
+    XMLPrinter(
+        EvalState & state,
+        bool strict,
+        bool location,
+        XMLWriter & doc,
+        NixStringContext & context,
+        PathSet & drvsSeen)
+        : state(state)
+        , strict(strict)
+        , location(location)
+        , doc(doc)
+        , context(context)
+        , drvsSeen(drvsSeen)
+    {
+    }
+
+    void print(Value & v, const PosIdx pos);
+};
+
+void XMLPrinter::print(Value & v, const PosIdx pos)
+{
+    visit(v, pos);
+
+    while (!stack.empty()) {
+        /* Note that `visit()` may push a frame, invalidating `frame`. */
+        auto & frame = stack.back();
+
+        if (frame.list) {
+            if (frame.next == frame.list->size()) {
+                doc.closeElement();
+                stack.pop_back();
+                continue;
+            }
+            auto v2 = (*frame.list)[frame.next++];
+            visit(*v2, frame.pos);
+        }
+
+        else {
+            /* Close the <attr> element of the previous attribute. */
+            if (frame.next > 0)
+                doc.closeElement();
+            if (frame.next == frame.attrs.size()) {
+                doc.closeElement();
+                stack.pop_back();
+                continue;
+            }
+            auto a = frame.attrs[frame.next++];
+
+            XMLAttrs xmlAttrs;
+            xmlAttrs["name"] = state.symbols[a->name];
+            if (location && a->pos)
+                posToXML(state, xmlAttrs, state.positions[a->pos]);
 
-        XMLOpenElement _(doc, "attr", xmlAttrs);
-        printValueAsXML(state, strict, location, *a->value, doc, context, drvsSeen, a->pos);
+            doc.openElement("attr", xmlAttrs);
+            visit(*a->value, a->pos);
+        }
     }
 }
 
-static void printValueAsXML(
-    EvalState & state,
-    bool strict,
-    bool location,
-    Value & v,
-    XMLWriter & doc,
-    NixStringContext & context,
-    PathSet & drvsSeen,
-    const PosIdx pos)
+void XMLPrinter::visit(Value & v, const PosIdx pos)
 {
     checkInterrupt();
 
-    auto _level = state.addCallDepth(pos);
-
     if (strict)
         state.forceValue(v, pos);
 
@@ -114,27 +194,27 @@ static void printValueAsXML(
                     xmlAttrs["outPath"] = a->value->string_view();
             }
 
-            XMLOpenElement _(doc, "derivation", xmlAttrs);
+            doc.openElement("derivation", xmlAttrs);
 
             if (drvPath != "" && drvsSeen.insert(drvPath).second)
-                showAttrs(state, strict, location, *v.attrs(), doc, context, drvsSeen);
-            else
+                pushAttrs(*v.attrs(), pos);
+            else {
                 doc.writeEmptyElement("repeated");
+                doc.closeElement();
+            }
         }
 
         else {
-            XMLOpenElement _(doc, "attrs");
-            showAttrs(state, strict, location, *v.attrs(), doc, context, drvsSeen);
+            doc.openElement("attrs");
+            pushAttrs(*v.attrs(), pos);
         }
 
         break;
 
-    case nList: {
-        XMLOpenElement _(doc, "list");
-        for (auto v2 : v.listView())
-            printValueAsXML(state, strict, location, *v2, doc, context, drvsSeen, pos);
+    case nList:
+        doc.openElement("list");
+        push({.list = v.listView(), .pos = pos});
         break;
-    }
 
     case nFunction: {
         if (!v.isLambda()) {
@@ -175,6 +255,8 @@ static void printValueAsXML(
     }
 }
 
+} // namespace
+
 void ExternalValueBase::printValueAsXML(
     EvalState & state,
     bool strict,
@@ -187,6 +269,14 @@ void ExternalValueBase::printValueAsXML(
     doc.writeEmptyElement("unevaluated");
 }
 
+static void printValueAsXML(
+    EvalState & state, bool strict, bool location, Value & v, XMLWriter & doc, NixStringContext & context, const PosIdx pos)
+{
+    XMLOpenElement root(doc, "expr");
+    PathSet drvsSeen;
+    XMLPrinter(state, strict, location, doc, context, drvsSeen).print(v, pos);
+}
+
 void printValueAsXML(
     EvalState & state,
     bool strict,
@@ -197,9 +287,14 @@ void printValueAsXML(
     const PosIdx pos)
 {
     XMLWriter doc(true, out);
-    XMLOpenElement root(doc, "expr");
-    PathSet drvsSeen;
-    printValueAsXML(state, strict, location, v, doc, context, drvsSeen, pos);
+    printValueAsXML(state, strict, location, v, doc, context, pos);
+}
+
+void printValueAsXML(
+    EvalState & state, bool strict, bool location, Value & v, Sink & sink, NixStringContext & context, const PosIdx pos)
+{
+    XMLWriter doc(true, sink);
+    printValueAsXML(state, strict, location, v, doc, context, pos);
 }
 
 } // namespace nix
@@ -0,0 +1,56 @@
+#include "nix/fetchers/cache.hh"
+#include "nix/fetchers/fetch-settings.hh"
+#include "nix/util/environment-variables.hh"
+#include "nix/util/file-system.hh"
+
+#include <gtest/gtest.h>
+
+namespace nix {
+
+class FetcherCacheTest : public ::testing::Test
+{
+protected:
+    std::filesystem::path tmpDir = createTempDir();
+    AutoDelete delTmpDir{tmpDir, true};
+
+    FetcherCacheTest()
+    {
+        setEnv("NIX_CACHE_HOME", tmpDir.string().c_str());
+    }
+
+    ~FetcherCacheTest()
+    {
+        unsetenv("NIX_CACHE_HOME");
+    }
+};
+
+TEST_F(FetcherCacheTest, lookupsAreServedFromMemory)
+{
+    fetchers::Cache::Key key{"test", {{"url", "https://example.org"}}};
+    fetchers::Attrs value{{"rev", "abc"}};
+
+    {
+        fetchers::Settings settings;
+        auto cache = settings.getCache();
+
+        ASSERT_FALSE(cache->lookup(key));
+        ASSERT_FALSE(cache->lookup(key));
+
+        cache->upsert(key, value);
+        ASSERT_EQ(cache->lookup(key), value);
+
+        auto stats = cache->getStats();
+        ASSERT_EQ(stats.misses, 1);
+        ASSERT_EQ(stats.memoryHits, 2);
+        ASSERT_EQ(stats.dbHits, 0);
+        ASSERT_EQ(stats.upserts, 1);
+    }
+
+    /* The pending write is flushed when the cache is destroyed. */
+    fetchers::Settings settings;
+    auto cache = settings.getCache();
+    ASSERT_EQ(cache->lookup(key), value);
+    ASSERT_EQ(cache->getStats().dbHits, 1);
+}
+
+} // namespace nix
@@ -5,6 +5,7 @@
 #include "nix/util/sync.hh"
 #include "nix/store/store-api.hh"
 #include "nix/store/globals.hh"
+#include "nix/util/lru-cache.hh"
 
 #include <nlohmann/json.hpp>
 
@@ -26,10 +27,39 @@ create table if not exists Cache (
 
 struct CacheImpl : Cache
 {
+    struct Entry
+    {
+        Attrs value;
+        time_t timestamp;
+    };
+
+    struct PendingWrite
+    {
+        std::string domain, key, value;
+        time_t timestamp;
+    };
+
+    /**
+     * Write pending entries to the database in a single transaction
+     * once there are this many.
+     */
+    static constexpr size_t maxPendingWrites = 128;
+
     struct State
     {
         SQLite db;
         SQLiteStmt upsert, lookup;
+
+        /**
+         * In-memory front of the database, keyed by domain and the
+         * JSON rendering of the key (which is canonical because
+         * `Attrs` is ordered). Negative lookups are cached too.
+         */
+        LRUCache<std::string, std::optional<Entry>> memory{4096};
+
+        std::vector<PendingWrite> pending;
+
+        Stats stats;
     };
 
     Sync<State> _state;
@@ -51,11 +81,65 @@ struct CacheImpl : Cache
         state->lookup.create(state->db, "select value, timestamp from Cache where domain = ? and key = ?");
     }
 
+    ~CacheImpl()
+    {
+        try {
+            flush(*_state.lock());
+        } catch (...) {
+            ignoreExceptionInDestructor();
+        }
+    }
+
+    static std::string memoryKey(Domain domain, std::string_view keyJSON)
+    {
+        std::string res;
+        res.reserve(domain.size() + 1 + keyJSON.size());
+        res.append(domain);
+        res.push_back(0);
+        res.append(keyJSON);
+        return res;
+    }
+
+    void flush(State & state)
+    {
+        if (state.pending.empty())
+            return;
+
+        SQLiteTxn txn(state.db);
+        for (auto & w : state.pending)
+            state.upsert.use()(w.domain)(w.key)(w.value)(w.timestamp).exec();
+        txn.commit();
+
+        state.pending.clear();
+    }
+
+    void flush() override
+    {
+        flush(*_state.lock());
+    }
+
+    Stats getStats() override
+    {
+        return _state.lock()->stats;
+    }
+
     void upsert(const Key & key, const Attrs & value) override
     {
-        _state.lock()
-            ->upsert.use()(key.first)(attrsToJSON(key.second).dump())(attrsToJSON(value).dump())(time(0))
-            .exec();
+        auto state(_state.lock());
+
+        auto keyJSON = attrsToJSON(key.second).dump();
+        auto now = time(0);
+
+        state->memory.upsert(memoryKey(key.first, keyJSON), Entry{.value = value, .timestamp = now});
+        state->pending.push_back(
+            {.domain = std::string(key.first),
+             .key = std::move(keyJSON),
+             .value = attrsToJSON(value).dump(),
+             .timestamp = now});
+        state->stats.upserts++;
+
+        if (state->pending.size() >= maxPendingWrites)
+            flush(*state);
     }
 
     std::optional<Attrs> lookup(const Key & key) override
@@ -80,10 +164,27 @@ struct CacheImpl : Cache
         auto state(_state.lock());
 
         auto keyJSON = attrsToJSON(key.second).dump();
+        auto memKey = memoryKey(key.first, keyJSON);
+
+        auto makeResult = [&](const Entry & entry) {
+            return Result{
+                .expired = settings.tarballTtl.get() == 0 || entry.timestamp + settings.tarballTtl < time(0),
+                .value = entry.value,
+            };
+        };
+
+        if (auto entry = state->memory.getOrNullptr(memKey)) {
+            state->stats.memoryHits++;
+            if (!*entry)
+                return {};
+            return makeResult(**entry);
+        }
 
         auto stmt(state->lookup.use()(key.first)(keyJSON));
         if (!stmt.next()) {
             debug("did not find cache entry for '%s:%s'", key.first, keyJSON);
+            state->stats.misses++;
+            state->memory.upsert(memKey, std::nullopt);
             return {};
         }
 
@@ -92,10 +193,11 @@ struct CacheImpl : Cache
 
         debug("using cache entry '%s:%s' -> '%s'", key.first, keyJSON, valueJSON);
 
-        return Result{
-            .expired = settings.tarballTtl.get() == 0 || timestamp + settings.tarballTtl < time(0),
-            .value = jsonToAttrs(nlohmann::json::parse(valueJSON)),
-        };
+        state->stats.dbHits++;
+        Entry entry{.value = jsonToAttrs(nlohmann::json::parse(valueJSON)), .timestamp = timestamp};
+        auto res = makeResult(entry);
+        state->memory.upsert(memKey, std::move(entry));
+        return res;
     }
 
     void upsert(Key key, Store & store, Attrs value, const StorePath & storePath) override
@@ -2,9 +2,49 @@
 #include "nix/fetchers/fetchers.hh"
 #include "nix/fetchers/fetch-settings.hh"
 #include "nix/util/environment-variables.hh"
+#include "nix/util/signals.hh"
 
 namespace nix {
 
+/**
+ * Call `filter` on every path below `root` that `dumpPath()` would call
+ * it on, and record the results.
+ */
+static std::unordered_map<Path, bool>
+filterTree(SourceAccessor & accessor, const CanonPath & root, PathFilter & filter)
+{
+    std::unordered_map<Path, bool> decisions;
+
+    [&](this const auto & walk, const CanonPath & path) -> void {
+        checkInterrupt();
+        if (accessor.lstat(path).type != SourceAccessor::tDirectory)
+            return;
+        for (auto & [name, _] : accessor.readDirectory(path)) {
+            auto child = path / name;
+            auto accept = filter(child.abs());
+            decisions.emplace(child.abs(), accept);
+            if (accept)
+                walk(child);
+        }
+    }(root);
+
+    return decisions;
+}
+
+static Hash hashFilterDecisions(const std::unordered_map<Path, bool> & decisions)
+{
+    std::vector<std::string_view> accepted;
+    for (auto & [p, accept] : decisions)
+        if (accept)
+            accepted.push_back(p);
+    std::sort(accepted.begin(), accepted.end());
+
+    HashSink sink(HashAlgorithm::SHA256);
+    for (auto & p : accepted)
+        sink << p;
+    return sink.finish().hash;
+}
+
 fetchers::Cache::Key makeFetchToStoreCacheKey(
     const std::string & name, const std::string & fingerprint, ContentAddressMethod method, const std::string & path)
 {
@@ -28,8 +68,25 @@ StorePath fetchToStore(
 
     std::optional<fetchers::Cache::Key> cacheKey;
 
-    auto [subpath, fingerprint] = filter ? std::pair<CanonPath, std::optional<std::string>>{path.path, std::nullopt}
-                                         : path.accessor->getFingerprint(path.path);
+    auto [subpath, fingerprint] = path.accessor->getFingerprint(path.path);
+
+    /* With a filter, the result depends on the filter's decisions as
+       well as on the tree contents. Evaluate the filter over the whole
+       tree up front (which is cheap compared to hashing the file
+       contents), and make the set of accepted paths part of the
+       fingerprint. This allows filtered imports to be cached even
+       across evaluations. */
+    std::optional<std::unordered_map<Path, bool>> decisions;
+    PathFilter filter2 = filter ? *filter : defaultPathFilter;
+
+    if (fingerprint && filter) {
+        decisions = filterTree(*path.accessor, path.path, *filter);
+        filter2 = [&](const Path & p) {
+            auto i = decisions->find(p);
+            return i != decisions->end() ? i->second : (*filter)(p);
+        };
+        fingerprint = *fingerprint + ";filter:" + hashFilterDecisions(*decisions).to_string(HashFormat::Nix32, false);
+    }
 
     if (fingerprint) {
         cacheKey = makeFetchToStoreCacheKey(std::string{name}, *fingerprint, method, subpath.abs());
@@ -51,8 +108,6 @@ StorePath fetchToStore(
         actUnknown,
         fmt(mode == FetchMode::DryRun ? "hashing '%s'" : "copying '%s' to the store", path));
 
-    auto filter2 = filter ? *filter : defaultPathFilter;
-
     auto storePath = mode == FetchMode::DryRun
                          ? store.computeStorePath(name, path, method, HashAlgorithm::SHA256, {}, filter2).first
                          : store.addToStore(name, path, method, HashAlgorithm::SHA256, {}, filter2, repair);
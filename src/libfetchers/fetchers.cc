@@ -1,5 +1,6 @@
 #include "nix/fetchers/fetchers.hh"
 #include "nix/store/store-api.hh"
+#include "nix/store/derived-path.hh"
 #include "nix/util/source-path.hh"
 #include "nix/fetchers/fetch-to-store.hh"
 #include "nix/util/json-utils.hh"
@@ -406,6 +407,42 @@ StorePath Input::computeStorePath(Store & store) const
         });
 }
 
+void substituteInputs(Store & store, const std::vector<Input> & inputs)
+{
+    std::vector<DerivedPath> targets;
+    StorePathSet seen;
+
+    for (auto & input : inputs) {
+        if (!input.isFinal() || !input.getNarHash())
+            continue;
+        auto storePath = input.computeStorePath(store);
+        if (seen.insert(storePath).second)
+            targets.push_back(DerivedPath::Opaque{storePath});
+    }
+
+    if (targets.empty())
+        return;
+
+    try {
+        /* queryMissing() skips valid paths and queries the
+           substituters for the remaining ones in parallel. */
+        auto missing = store.queryMissing(targets);
+
+        if (missing.willSubstitute.empty())
+            return;
+
+        debug("substituting %d of %d locked inputs", missing.willSubstitute.size(), targets.size());
+
+        std::vector<DerivedPath> toSubstitute;
+        for (auto & path : missing.willSubstitute)
+            toSubstitute.push_back(DerivedPath::Opaque{path});
+
+        store.buildPaths(toSubstitute, bmNormal);
+    } catch (Error & e) {
+        debug("substitution of locked inputs failed: %s", e.what());
+    }
+}
+
 std::string Input::getType() const
 {
     return getStrAttr(attrs, "type");
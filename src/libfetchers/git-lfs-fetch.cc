@@ -5,6 +5,7 @@
 #include "nix/util/url.hh"
 #include "nix/util/users.hh"
 #include "nix/util/hash.hh"
+#include "nix/util/file-system.hh"
 #include "nix/store/ssh.hh"
 
 #include <git2/attr.h>
@@ -16,6 +17,28 @@
 
 namespace nix::lfs {
 
+static void checkObject(const std::string & url, std::string_view data, std::string_view sha256Expected, size_t sizeExpected)
+{
+    auto sizeActual = data.size();
+    if (sizeExpected != sizeActual)
+        throw Error("size mismatch while fetching %s: expected %d but got %d", url, sizeExpected, sizeActual);
+
+    auto sha256Actual = hashString(HashAlgorithm::SHA256, data).to_string(HashFormat::Base16, false);
+    if (sha256Actual != sha256Expected)
+        throw Error(
+            "hash mismatch while fetching %s: expected sha256:%s but got sha256:%s", url, sha256Expected, sha256Actual);
+}
+
+static FileTransferRequest makeDownloadRequest(const std::string & url, const std::optional<std::string> & authHeader)
+{
+    FileTransferRequest request(parseURL(url));
+    Headers headers;
+    if (authHeader.has_value())
+        headers.push_back({"Authorization", *authHeader});
+    request.headers = headers;
+    return request;
+}
+
 static void downloadToSink(
     const std::string & url,
     const std::optional<std::string> & authHeader,
@@ -25,21 +48,27 @@ static void downloadToSink(
     std::string sha256Expected,
     size_t sizeExpected)
 {
-    FileTransferRequest request(parseURL(url));
-    Headers headers;
-    if (authHeader.has_value())
-        headers.push_back({"Authorization", *authHeader});
-    request.headers = headers;
-    getFileTransfer()->download(std::move(request), sink);
+    getFileTransfer()->download(makeDownloadRequest(url, authHeader), sink);
+    checkObject(url, sink.s, sha256Expected, sizeExpected);
+}
 
-    auto sizeActual = sink.s.length();
-    if (sizeExpected != sizeActual)
-        throw Error("size mismatch while fetching %s: expected %d but got %d", url, sizeExpected, sizeActual);
+/**
+ * Objects are cached by their SHA-256 hash, so files with the same
+ * contents share a cache entry, even across repositories.
+ */
+static std::filesystem::path objectCachePath(std::string_view oid)
+{
+    return getCacheDir() / "git-lfs" / "objects" / std::string(oid.substr(0, 2)) / std::string(oid);
+}
 
-    auto sha256Actual = hashString(HashAlgorithm::SHA256, sink.s).to_string(HashFormat::Base16, false);
-    if (sha256Actual != sha256Expected)
-        throw Error(
-            "hash mismatch while fetching %s: expected sha256:%s but got sha256:%s", url, sha256Expected, sha256Actual);
+static void writeObjectToCache(const std::filesystem::path & cachePath, std::string_view data)
+{
+    createDirs(cachePath.parent_path());
+    /* Write to a temporary file first so that concurrent readers never
+       see a partial object. */
+    auto tmpPath = makeTempPath(cachePath);
+    writeFile(tmpPath, data);
+    std::filesystem::rename(tmpPath, cachePath);
 }
 
 namespace {
@@ -245,6 +274,75 @@ std::vector<nlohmann::json> Fetch::fetchUrls(const std::vector<Pointer> & pointe
     }
 }
 
+/**
+ * The maximum number of objects in one batch API request. The git-lfs
+ * reference server rejects larger batches.
+ */
+static constexpr size_t maxBatchSize = 100;
+
+void Fetch::prefetch(const std::vector<std::pair<CanonPath, std::string>> & pointerFiles) const
+{
+    std::vector<Pointer> pointers;
+    {
+        std::set<std::string> seen;
+        auto downloads_(downloads->lock());
+        for (auto & [path, content] : pointerFiles) {
+            if (content.length() >= 1024)
+                continue;
+            auto pointer = parseLfsPointer(content, path.rel());
+            if (!pointer || downloads_->contains(pointer->oid) || !seen.insert(pointer->oid).second
+                || pathExists(objectCachePath(pointer->oid)))
+                continue;
+            pointers.push_back(std::move(*pointer));
+        }
+    }
+
+    debug("prefetching %d git-lfs objects", pointers.size());
+
+    for (size_t start = 0; start < pointers.size(); start += maxBatchSize) {
+        auto end = std::min(pointers.size(), start + maxBatchSize);
+        auto objects = fetchUrls({pointers.begin() + start, pointers.begin() + end});
+
+        for (auto & obj : objects) {
+            std::string sha256, ourl;
+            std::optional<std::string> authHeader;
+            uint64_t size;
+            try {
+                sha256 = obj.at("oid");
+                /* Objects that the server can't provide have an
+                   `error` instead of `actions`. Leave them to
+                   `fetch()`, which reports the error. */
+                if (!obj.contains("actions"))
+                    continue;
+                const auto & download = obj.at("actions").at("download");
+                ourl = download.at("href");
+                if (auto headerIt = download.find("header"); headerIt != download.end())
+                    if (auto authIt = headerIt->find("Authorization"); authIt != headerIt->end())
+                        authHeader = authIt->get<std::string>();
+                size = obj.at("size");
+            } catch (const nlohmann::json::exception & e) {
+                throw Error("bad json from /info/lfs/objects/batch: %s %s", obj, e.what());
+            }
+
+            auto promise = std::make_shared<std::promise<void>>();
+            downloads->lock()->insert_or_assign(sha256, promise->get_future().share());
+
+            getFileTransfer()->enqueueFileTransfer(
+                makeDownloadRequest(ourl, authHeader),
+                {[promise, ourl, sha256, size](std::future<FileTransferResult> fut) {
+                    try {
+                        auto result = fut.get();
+                        checkObject(ourl, result.data, sha256, size);
+                        writeObjectToCache(objectCachePath(sha256), result.data);
+                        promise->set_value();
+                    } catch (...) {
+                        promise->set_exception(std::current_exception());
+                    }
+                }});
+        }
+    }
+}
+
 void Fetch::fetch(
     const std::string & content,
     const CanonPath & pointerFilePath,
@@ -268,16 +366,33 @@ void Fetch::fetch(
         return;
     }
 
-    std::filesystem::path cacheDir = getCacheDir() / "git-lfs";
-    std::string key = hashString(HashAlgorithm::SHA256, pointerFilePath.rel()).to_string(HashFormat::Base16, false)
-                      + "/" + pointer->oid;
-    std::filesystem::path cachePath = cacheDir / key;
+    auto cachePath = objectCachePath(pointer->oid);
+
+    std::optional<std::shared_future<void>> download;
+    {
+        auto downloads_(downloads->lock());
+        if (auto i = downloads_->find(pointer->oid); i != downloads_->end())
+            download = i->second;
+    }
+    if (download) {
+        debug("waiting for prefetched git-lfs object %s", pointer->oid);
+        try {
+            download->get();
+        } catch (std::exception & e) {
+            /* Fall back to fetching it on its own below. */
+            debug("prefetching git-lfs object %s failed: %s", pointer->oid, e.what());
+            downloads->lock()->erase(pointer->oid);
+        }
+    }
+
     if (pathExists(cachePath)) {
-        debug("using cache entry %s -> %s", key, cachePath);
-        sink(readFile(cachePath));
+        debug("using cache entry %s", cachePath);
+        auto data = readFile(cachePath);
+        sizeCallback(data.size());
+        sink(data);
         return;
     }
-    debug("did not find cache entry for %s", key);
+    debug("did not find cache entry for %s", pointer->oid);
 
     std::vector<Pointer> pointers;
     pointers.push_back(pointer.value());
@@ -301,10 +416,8 @@ void Fetch::fetch(
         sizeCallback(size);
         downloadToSink(ourl, authHeader, sink, sha256, size);
 
-        debug("creating cache entry %s -> %s", key, cachePath);
-        if (!pathExists(cachePath.parent_path()))
-            createDirs(cachePath.parent_path());
-        writeFile(cachePath, sink.s);
+        debug("creating cache entry %s", cachePath);
+        writeObjectToCache(cachePath, sink.s);
 
         debug("%s fetched with git-lfs", pointerFilePath);
     } catch (const nlohmann::json::out_of_range & e) {
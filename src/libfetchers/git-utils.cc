@@ -361,6 +361,33 @@ struct GitRepoImpl : GitRepo, std::enable_shared_from_this<GitRepoImpl>
         checkInterrupt();
     }
 
+    /**
+     * Every flush adds a packfile, and object lookups have to search
+     * all of them. So once a repository has accumulated too many,
+     * consolidate them into one. This requires the `git` command; if
+     * it is not available, we just carry on with the existing packs.
+     */
+    void maybeRepack()
+    {
+        static constexpr size_t maxPacks = 64;
+
+        size_t nrPacks = 0;
+        for (auto & entry : std::filesystem::directory_iterator(path / "objects" / "pack"))
+            if (entry.path().extension() == ".pack")
+                nrPacks++;
+
+        if (nrPacks <= maxPacks)
+            return;
+
+        Activity act(*logger, lvlTalkative, actUnknown, fmt("repacking Git repository '%s'", path.string()));
+
+        try {
+            runProgram("git", true, {"-C", path.string(), "--git-dir", ".", "repack", "-a", "-d", "-q"});
+        } catch (Error & e) {
+            debug("cannot repack Git repository '%s': %s", path.string(), e.msg());
+        }
+    }
+
     /**
      * Return a connection pool for this repo. Useful for
      * multithreaded access.
@@ -543,8 +570,23 @@ struct GitRepoImpl : GitRepo, std::enable_shared_from_this<GitRepoImpl>
         git_status_options options = GIT_STATUS_OPTIONS_INIT;
         options.flags |= GIT_STATUS_OPT_INCLUDE_UNMODIFIED;
         options.flags |= GIT_STATUS_OPT_EXCLUDE_SUBMODULES;
-        if (git_status_foreach_ext(*this, &options, &statusCallbackTrampoline, &statusCallback))
-            throw Error("getting working directory status: %s", git_error_last()->message);
+        /* Like `git status`, write back the stat information of files
+           whose stat data changed but whose contents did not, so that
+           the next invocation (of Nix or Git) doesn't have to hash them
+           again. */
+        options.flags |= GIT_STATUS_OPT_UPDATE_INDEX;
+        if (git_status_foreach_ext(*this, &options, &statusCallbackTrampoline, &statusCallback)) {
+            /* Writing the index fails if the repository is not
+               writable by us. That's fine, just do a read-only scan. */
+            debug("cannot update Git index of '%s': %s", path, git_error_last()->message);
+            info.files.clear();
+            info.dirtyFiles.clear();
+            info.deletedFiles.clear();
+            info.isDirty = false;
+            options.flags &= ~GIT_STATUS_OPT_UPDATE_INDEX;
+            if (git_status_foreach_ext(*this, &options, &statusCallbackTrampoline, &statusCallback))
+                throw Error("getting working directory status: %s", git_error_last()->message);
+        }
 
         /* Get submodule info. */
         auto modulesFile = path / ".gitmodules";
@@ -751,11 +793,18 @@ struct GitSourceAccessor : SourceAccessor
         ref<GitRepoImpl> repo;
         Object root;
         std::optional<lfs::Fetch> lfsFetch = std::nullopt;
+        bool lfsPrefetched = false;
         GitAccessorOptions options;
     };
 
     Sync<State> state_;
 
+    /**
+     * Separate repository handles for reading blobs, so that blobs
+     * can be inflated concurrently without holding `state_`.
+     */
+    Pool<GitRepoImpl> repoPool;
+
     GitSourceAccessor(ref<GitRepoImpl> repo_, const Hash & rev, const GitAccessorOptions & options)
         : state_{State{
               .repo = repo_,
@@ -763,33 +812,103 @@ struct GitSourceAccessor : SourceAccessor
               .lfsFetch = options.smudgeLfs ? std::make_optional(lfs::Fetch(*repo_, hashToOID(rev))) : std::nullopt,
               .options = options,
           }}
+        , repoPool(repo_->getPool())
     {
     }
 
     std::string readBlob(const CanonPath & path, bool symlink)
     {
-        auto state(state_.lock());
+        /* Unless we need to smudge the file, only hold the lock for
+           the tree lookup, and read the blob from a pooled handle. */
+        std::optional<git_oid> oid;
+        {
+            auto state(state_.lock());
+            if (!state->lfsFetch || !state->lfsFetch->shouldFetch(path))
+                oid = getBlobId(*state, path, symlink);
+        }
 
-        const auto blob = getBlob(*state, path, symlink);
+        if (oid) {
+            auto repo(repoPool.get());
+            Blob blob;
+            if (git_blob_lookup(Setter(blob), *repo, &*oid))
+                throw Error("looking up file '%s': %s", showPath(path), git_error_last()->message);
+            return std::string((const char *) git_blob_rawcontent(blob.get()), git_blob_rawsize(blob.get()));
+        }
 
-        if (state->lfsFetch) {
-            if (state->lfsFetch->shouldFetch(path)) {
-                StringSink s;
-                try {
-                    // FIXME: do we need to hold the state lock while
-                    // doing this?
-                    auto contents =
-                        std::string((const char *) git_blob_rawcontent(blob.get()), git_blob_rawsize(blob.get()));
-                    state->lfsFetch->fetch(contents, path, s, [&s](uint64_t size) { s.s.reserve(size); });
-                } catch (Error & e) {
-                    e.addTrace({}, "while smudging git-lfs file '%s'", path);
-                    throw;
-                }
-                return s.s;
+        /* This is a git-lfs pointer file. Download all objects of
+           the tree in the background when the first one is needed,
+           and don't hold the lock while waiting for ours. */
+        std::optional<lfs::Fetch> lfsFetch;
+        std::string contents;
+        {
+            auto state(state_.lock());
+            const auto blob = getBlob(*state, path, symlink);
+            contents = std::string((const char *) git_blob_rawcontent(blob.get()), git_blob_rawsize(blob.get()));
+            if (!state->lfsPrefetched) {
+                state->lfsPrefetched = true;
+                prefetchLfs(*state);
             }
+            lfsFetch = state->lfsFetch;
         }
 
-        return std::string((const char *) git_blob_rawcontent(blob.get()), git_blob_rawsize(blob.get()));
+        StringSink s;
+        try {
+            lfsFetch->fetch(contents, path, s, [&s](uint64_t size) { s.s.reserve(size); });
+        } catch (Error & e) {
+            e.addTrace({}, "while smudging git-lfs file '%s'", path);
+            throw;
+        }
+        return s.s;
+    }
+
+    /**
+     * Collect the git-lfs pointer files in the tree and start
+     * downloading their objects.
+     */
+    void prefetchLfs(State & state)
+    {
+        if (git_object_type(state.root.get()) != GIT_OBJECT_TREE)
+            return;
+
+        struct Walk
+        {
+            State & state;
+            std::vector<std::pair<CanonPath, std::string>> pointerFiles;
+        } walk{state};
+
+        auto visit = [](const char * root, const git_tree_entry * entry, void * payload) -> int {
+            auto & walk = *(Walk *) payload;
+            if (git_tree_entry_type(entry) != GIT_OBJECT_BLOB)
+                return 0;
+            try {
+                auto path = CanonPath(std::string(root) + git_tree_entry_name(entry));
+                if (!walk.state.lfsFetch->shouldFetch(path))
+                    return 0;
+                Blob blob;
+                if (git_blob_lookup(Setter(blob), *walk.state.repo, git_tree_entry_id(entry)))
+                    return 0;
+                /* Larger files can't be pointers. */
+                if (git_blob_rawsize(blob.get()) < 1024)
+                    walk.pointerFiles.emplace_back(
+                        std::move(path),
+                        std::string((const char *) git_blob_rawcontent(blob.get()), git_blob_rawsize(blob.get())));
+                return 0;
+            } catch (std::exception & e) {
+                debug("not prefetching git-lfs objects: %s", e.what());
+                return -1;
+            }
+        };
+
+        if (git_tree_walk((const git_tree *) &*state.root, GIT_TREEWALK_PRE, visit, &walk) < 0)
+            return;
+
+        /* Prefetching is only an optimisation. Errors are reported
+           when the files are read. */
+        try {
+            state.lfsFetch->prefetch(walk.pointerFiles);
+        } catch (Error & e) {
+            debug("cannot prefetch git-lfs objects: %s", e.what());
+        }
     }
 
     std::string readFile(const CanonPath & path) override
@@ -864,6 +983,31 @@ struct GitSourceAccessor : SourceAccessor
         return readBlob(path, true);
     }
 
+    /**
+     * Git trees are content-addressed, so the hash of a directory's
+     * tree identifies its contents regardless of the commit it came
+     * from or where it is in the repository. Use it as the fingerprint
+     * so that unchanged subtrees of different commits share
+     * `fetchToStore()` cache entries.
+     */
+    std::pair<CanonPath, std::optional<std::string>> getFingerprint(const CanonPath & path) override
+    {
+        /* Only the outermost accessor of an input has a fingerprint. If
+           we're wrapped (e.g. to apply export-ignore or to mount
+           submodules), our contents are not what the user sees. */
+        if (!fingerprint)
+            return {path, std::nullopt};
+
+        auto state(state_.lock());
+
+        if (auto tree = lookupTree(*state, path))
+            return {
+                CanonPath::root,
+                "git-tree:" + toHash(*git_tree_id(tree->get())).gitRev() + (state->options.smudgeLfs ? ";l" : "")};
+
+        return {path, fingerprint};
+    }
+
     /**
      * If `path` exists and is a submodule, return its
      * revision. Otherwise return nothing.
@@ -981,9 +1125,20 @@ struct GitSourceAccessor : SourceAccessor
     }
 
     Blob getBlob(State & state, const CanonPath & path, bool expectSymlink)
+    {
+        auto oid = getBlobId(state, path, expectSymlink);
+
+        Blob blob;
+        if (git_blob_lookup(Setter(blob), *state.repo, &oid))
+            throw Error("looking up file '%s': %s", showPath(path), git_error_last()->message);
+
+        return blob;
+    }
+
+    git_oid getBlobId(State & state, const CanonPath & path, bool expectSymlink)
     {
         if (!expectSymlink && git_object_type(state.root.get()) == GIT_OBJECT_BLOB)
-            return dupObject<Blob>((git_blob *) &*state.root);
+            return *git_object_id(state.root.get());
 
         auto notExpected = [&]() {
             throw Error(expectSymlink ? "'%s' is not a symlink" : "'%s' is not a regular file", showPath(path));
@@ -1006,11 +1161,7 @@ struct GitSourceAccessor : SourceAccessor
                 notExpected();
         }
 
-        Blob blob;
-        if (git_tree_entry_to_object((git_object **) (git_blob **) Setter(blob), *state.repo, entry))
-            throw Error("looking up file '%s': %s", showPath(path), git_error_last()->message);
-
-        return blob;
+        return *git_tree_entry_id(entry);
     }
 };
 
@@ -1367,6 +1518,9 @@ struct GitFileSystemObjectSinkImpl : GitFileSystemObjectSink
 
         repo->flush();
 
+        if (this->repo->options.packfilesOnly)
+            this->repo->maybeRepack();
+
         return toHash(_state.lock()->root.oid.value());
     }
 };
@@ -76,6 +76,36 @@ struct Cache
      * has exceeded `settings.tarballTTL`.
      */
     virtual std::optional<ResultWithStorePath> lookupStorePathWithTTL(Key key, Store & store) = 0;
+
+    struct Stats
+    {
+        /**
+         * Lookups answered by the in-memory cache.
+         */
+        uint64_t memoryHits = 0;
+
+        /**
+         * Lookups that found an entry in the database.
+         */
+        uint64_t dbHits = 0;
+
+        /**
+         * Lookups that found nothing.
+         */
+        uint64_t misses = 0;
+
+        /**
+         * Number of entries written.
+         */
+        uint64_t upserts = 0;
+    };
+
+    virtual Stats getStats() = 0;
+
+    /**
+     * Write any pending entries to the database.
+     */
+    virtual void flush() = 0;
 };
 
 } // namespace nix::fetchers
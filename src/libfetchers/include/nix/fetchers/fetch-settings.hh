@@ -129,6 +129,22 @@ struct Settings : public Config
         true,
         Xp::Flakes};
 
+    Setting<bool> prefetchFlakeInputs{
+        this,
+        true,
+        "prefetch-flake-inputs",
+        R"(
+          Whether to start fetching all inputs in the lock file of a flake
+          in parallel, up to [`http-connections`](#conf-http-connections)
+          at a time, as soon as evaluation of the flake starts.
+          Evaluation then only waits for the inputs it needs that are still
+          being fetched. Disable this to fetch only the inputs that are
+          actually used, one at a time.
+        )",
+        {},
+        true,
+        Xp::Flakes};
+
     ref<Cache> getCache() const;
 
     ref<GitRepo> getTarballCache() const;
@@ -176,6 +176,16 @@ public:
     std::optional<std::string> getFingerprint(Store & store) const;
 };
 
+/**
+ * Substitute the store paths of all final inputs with a NAR hash
+ * that are not yet valid, in a single batch. Substituters are
+ * queried concurrently and the available paths are fetched in
+ * parallel, so that a later `Input::getAccessor()` on these inputs
+ * finds them in the store. Inputs that cannot be substituted are
+ * left to their fetcher. Failures are not fatal.
+ */
+void substituteInputs(Store & store, const std::vector<Input> & inputs);
+
 /**
  * The `InputScheme` represents a type of fetcher.  Each fetcher
  * registers with nix at startup time.  When processing an `Input`,
@@ -4,6 +4,10 @@
 #include "nix/util/canon-path.hh"
 #include "nix/util/serialise.hh"
 #include "nix/util/url.hh"
+#include "nix/util/sync.hh"
+
+#include <future>
+#include <map>
 
 #include <git2/repository.h>
 
@@ -35,12 +39,30 @@ struct Fetch
 
     Fetch(git_repository * repo, git_oid rev);
     bool shouldFetch(const CanonPath & path) const;
+
+    /**
+     * Resolve the pointers in `pointerFiles` (pairs of path and
+     * contents) through the batch API, and start downloading the
+     * objects that aren't in the local cache yet. A later `fetch()` of
+     * one of these files only waits for its own download.
+     */
+    void prefetch(const std::vector<std::pair<CanonPath, std::string>> & pointerFiles) const;
+
     void fetch(
         const std::string & content,
         const CanonPath & pointerFilePath,
         StringSink & sink,
         std::function<void(uint64_t)> sizeCallback) const;
     std::vector<nlohmann::json> fetchUrls(const std::vector<Pointer> & pointers) const;
+
+private:
+
+    /**
+     * Downloads started by `prefetch()`, indexed by object id. Shared
+     * between copies of this `Fetch`.
+     */
+    std::shared_ptr<Sync<std::map<std::string, std::shared_future<void>>>> downloads =
+        std::make_shared<Sync<std::map<std::string, std::shared_future<void>>>>();
 };
 
 } // namespace nix::lfs
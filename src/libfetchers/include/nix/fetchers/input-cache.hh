@@ -29,6 +29,15 @@ struct InputCache
 
     virtual void upsert(Input key, CachedInput cachedInput) = 0;
 
+    /**
+     * Start fetching `inputs` in the background, up to
+     * `http-connections` at a time. Looking up one of these inputs
+     * waits for it to be fetched, unless the background fetch failed,
+     * in which case `getAccessor()` fetches it again to report the
+     * error.
+     */
+    virtual void prefetch(const Settings & settings, ref<Store> store, std::vector<Input> inputs) = 0;
+
     virtual void clear() = 0;
 
     static ref<InputCache> create();
@@ -2,6 +2,11 @@
 #include "nix/fetchers/registry.hh"
 #include "nix/util/sync.hh"
 #include "nix/util/source-path.hh"
+#include "nix/util/signals.hh"
+#include "nix/util/thread-pool.hh"
+#include "nix/store/filetransfer.hh"
+
+#include <future>
 
 namespace nix::fetchers {
 
@@ -44,18 +49,40 @@ struct InputCacheImpl : InputCache
 {
     Sync<std::map<Input, CachedInput>> cache_;
 
+    /**
+     * Inputs that are being fetched by `prefetch()`. The result is
+     * `std::nullopt` if the fetch failed.
+     */
+    Sync<std::map<Input, std::shared_future<std::optional<CachedInput>>>> prefetches_;
+
+    std::vector<std::thread> prefetchers;
+
+    std::atomic<bool> quit{false};
+
+    ~InputCacheImpl()
+    {
+        /* Don't start any more fetches, but let the ones in progress
+           finish, since they still use the store. */
+        quit = true;
+        for (auto & thread : prefetchers)
+            thread.join();
+    }
+
     std::optional<CachedInput> lookup(const Input & originalInput) const override
     {
-        auto cache(cache_.readLock());
-        auto i = cache->find(originalInput);
-        if (i == cache->end())
-            return std::nullopt;
-        debug(
-            "mapping '%s' to previously seen input '%s' -> '%s",
-            originalInput.to_string(),
-            i->first.to_string(),
-            i->second.lockedInput.to_string());
-        return i->second;
+        {
+            auto cache(cache_.readLock());
+            auto i = cache->find(originalInput);
+            if (i != cache->end()) {
+                debug(
+                    "mapping '%s' to previously seen input '%s' -> '%s",
+                    originalInput.to_string(),
+                    i->first.to_string(),
+                    i->second.lockedInput.to_string());
+                return i->second;
+            }
+        }
+        return waitForPrefetch(originalInput);
     }
 
     void upsert(Input key, CachedInput cachedInput) override
@@ -63,9 +90,73 @@ struct InputCacheImpl : InputCache
         cache_.lock()->insert_or_assign(std::move(key), std::move(cachedInput));
     }
 
+    std::optional<CachedInput> waitForPrefetch(const Input & input) const
+    {
+        std::shared_future<std::optional<CachedInput>> result;
+        {
+            auto prefetches(prefetches_.readLock());
+            auto i = prefetches->find(input);
+            if (i == prefetches->end())
+                return std::nullopt;
+            result = i->second;
+        }
+
+        if (result.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            debug("waiting for input '%s' to be fetched", input.to_string());
+            while (result.wait_for(std::chrono::milliseconds(100)) != std::future_status::ready)
+                checkInterrupt();
+        }
+
+        return result.get();
+    }
+
+    void prefetch(const Settings & settings, ref<Store> store, std::vector<Input> inputs) override
+    {
+        std::vector<std::shared_ptr<std::promise<std::optional<CachedInput>>>> promises;
+
+        {
+            auto cache(cache_.readLock());
+            auto prefetches(prefetches_.lock());
+            std::erase_if(inputs, [&](auto & input) {
+                if (cache->contains(input) || prefetches->contains(input))
+                    return true;
+                auto & promise =
+                    promises.emplace_back(std::make_shared<std::promise<std::optional<CachedInput>>>());
+                prefetches->emplace(input, promise->get_future().share());
+                return false;
+            });
+        }
+
+        if (inputs.empty())
+            return;
+
+        /* The thread pool must be created by the thread that runs it. */
+        prefetchers.emplace_back([this, &settings, store, inputs{std::move(inputs)}, promises{std::move(promises)}]() {
+            ThreadPool pool{fileTransferSettings.httpConnections};
+
+            for (size_t n = 0; n < inputs.size(); ++n)
+                pool.enqueue([&, n]() {
+                    auto & input = inputs[n];
+                    std::optional<CachedInput> result;
+                    if (!quit)
+                        try {
+                            Activity act(*logger, lvlTalkative, actUnknown, fmt("prefetching '%s'", input.to_string()));
+                            auto [accessor, lockedInput] = input.getAccessor(settings, *store);
+                            result.emplace(CachedInput{.lockedInput = lockedInput, .accessor = accessor});
+                        } catch (std::exception & e) {
+                            debug("prefetching '%s' failed: %s", input.to_string(), e.what());
+                        }
+                    promises[n]->set_value(std::move(result));
+                });
+
+            pool.process();
+        });
+    }
+
     void clear() override
     {
         cache_.lock()->clear();
+        prefetches_.lock()->clear();
     }
 };
 
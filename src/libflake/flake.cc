@@ -18,6 +18,8 @@
 #include <variant>
 #include <vector>
 #include <format>
+#include <future>
+#include <semaphore>
 
 #include "nix/util/terminal.hh"
 #include "nix/util/ref.hh"
@@ -37,6 +39,8 @@
 #include "nix/fetchers/fetch-to-store.hh"
 #include "nix/util/memory-source-accessor.hh"
 #include "nix/fetchers/input-cache.hh"
+#include "nix/store/filetransfer.hh"
+#include "nix/util/sync.hh"
 #include "nix/expr/attr-set.hh"
 #include "nix/expr/eval-error.hh"
 #include "nix/expr/nixexpr.hh"
@@ -418,6 +422,59 @@ static LockFile readLockFile(const fetchers::Settings & fetchSettings, const Sou
 
 /* Compute an in-memory lock file for the specified top-level flake,
    and optionally write it to file, if the flake is writable. */
+/**
+ * Fetches flake inputs into the input cache in the background, so that
+ * independent inputs (and their own new inputs) are downloaded
+ * concurrently while `lockFlake()` processes the inputs in order.
+ * Errors are ignored here; they'll be reported when the input is
+ * fetched again by `lockFlake()`.
+ */
+struct InputPrefetcher
+{
+    EvalState & state;
+    std::counting_semaphore<> slots;
+    Sync<std::map<fetchers::Input, std::shared_future<void>>> inFlight_;
+
+    InputPrefetcher(EvalState & state)
+        : state(state)
+        , slots(std::max<ptrdiff_t>(fileTransferSettings.httpConnections, 1))
+    {
+    }
+
+    void start(const FlakeRef & ref)
+    {
+        auto inFlight(inFlight_.lock());
+        if (inFlight->contains(ref.input))
+            return;
+        auto future = std::async(std::launch::async, [this, ref]() {
+            slots.acquire();
+            Finally release([&]() { slots.release(); });
+            try {
+                state.inputCache->getAccessor(state.fetchSettings, *state.store, ref.input, fetchers::UseRegistries::No);
+            } catch (Error & e) {
+                debug("prefetching input '%s' failed: %s", ref, e.msg());
+            }
+        });
+        inFlight->emplace(ref.input, future.share());
+    }
+
+    /**
+     * Wait for a prefetch of `ref` to finish, if one was started.
+     */
+    void wait(const FlakeRef & ref)
+    {
+        std::shared_future<void> future;
+        {
+            auto inFlight(inFlight_.lock());
+            auto i = inFlight->find(ref.input);
+            if (i == inFlight->end())
+                return;
+            future = i->second;
+        }
+        future.wait();
+    }
+};
+
 LockedFlake
 lockFlake(const Settings & settings, EvalState & state, const FlakeRef & topRef, const LockFlags & lockFlags)
 {
@@ -444,6 +501,25 @@ lockFlake(const Settings & settings, EvalState & state, const FlakeRef & topRef,
 
         debug("old lock file: %s", oldLockFile);
 
+        /* Substitute all locked inputs that we're likely to need in
+           one batch, rather than checking the substituters one input
+           at a time while walking the lock file. */
+        if (!lockFlags.recreateLockFile) {
+            std::vector<fetchers::Input> lockedInputs;
+            for (auto & [inputAttrPath, edge] : oldLockFile.getAllInputs()) {
+                auto lockedNode = std::get_if<0>(&edge);
+                if (!lockedNode)
+                    continue;
+                if (std::ranges::any_of(lockFlags.inputUpdates, [&](auto & update) {
+                        return inputAttrPath.size() >= update.get().size()
+                               && std::equal(update.get().begin(), update.get().end(), inputAttrPath.begin());
+                    }))
+                    continue;
+                lockedInputs.push_back((*lockedNode)->lockedRef.input);
+            }
+            fetchers::substituteInputs(*state.store, lockedInputs);
+        }
+
         struct OverrideTarget
         {
             FlakeInput input;
@@ -475,6 +551,8 @@ lockFlake(const Settings & settings, EvalState & state, const FlakeRef & topRef,
 
         std::vector<FlakeRef> parents;
 
+        InputPrefetcher prefetcher(state);
+
         std::function<void(
             const FlakeInputs & flakeInputs,
             ref<Node> node,
@@ -541,6 +619,21 @@ lockFlake(const Settings & settings, EvalState & state, const FlakeRef & topRef,
                         follow);
             }
 
+            /* Start fetching the direct inputs that don't have a lock
+               yet. Inputs that are overridden, follow another input or
+               need a registry lookup are left to the loop below. */
+            for (auto & [id, input] : flakeInputs) {
+                auto inputAttrPath = NonEmptyInputAttrPath::append(inputAttrPathPrefix, id);
+                if (input.follows || !input.ref || overrides.contains(inputAttrPath) || !input.ref->input.isDirect()
+                    || input.ref->input.isRelative())
+                    continue;
+                if (oldNode && oldNode->inputs.contains(id) && !lockFlags.inputUpdates.contains(inputAttrPath))
+                    continue;
+                if (!lockFlags.allowUnlocked && !input.ref->input.isLocked(state.fetchSettings))
+                    continue;
+                prefetcher.start(*input.ref);
+            }
+
             /* Go over the flake inputs, resolve/fetch them if
                necessary (i.e. if they're new or the flakeref changed
                from what's in the lock file). */
@@ -586,6 +679,8 @@ lockFlake(const Settings & settings, EvalState & state, const FlakeRef & topRef,
                         input.ref =
                             FlakeRef::fromAttrs(state.fetchSettings, {{"type", "indirect"}, {"id", std::string(id)}});
 
+                    prefetcher.wait(*input.ref);
+
                     auto overriddenParentPath =
                         input.ref->input.isRelative()
                             ? std::optional<InputAttrPath>(
@@ -933,6 +1028,27 @@ void callFlake(EvalState & state, const LockedFlake & lockedFlake, Value & vRes)
 
     auto [lockFileStr, keyMap] = lockedFlake.lockFile.to_string();
 
+    /* Start fetching the inputs that `call-flake.nix` will pass to
+       `fetchFinalTree`, so that they are usually available by the time
+       evaluation needs them. */
+    if (state.fetchSettings.prefetchFlakeInputs && !state.settings.restrictEval) {
+        std::set<const Node *> overridden;
+        for (auto & [node, sourcePath] : lockedFlake.nodePaths)
+            overridden.insert(&*node);
+
+        std::vector<fetchers::Input> inputs;
+        for (auto & [node, key] : keyMap) {
+            auto lockedNode = node.dynamic_pointer_cast<const LockedNode>();
+            if (!lockedNode || overridden.contains(&*node) || lockedNode->lockedRef.input.isRelative())
+                continue;
+            auto input = lockedNode->lockedRef.input;
+            input.attrs.insert_or_assign("__final", Explicit<bool>(true));
+            inputs.push_back(std::move(input));
+        }
+
+        state.inputCache->prefetch(state.fetchSettings, state.store, std::move(inputs));
+    }
+
     auto overrides = state.buildBindings(lockedFlake.nodePaths.size());
 
     for (auto & [node, sourcePath] : lockedFlake.nodePaths) {
@@ -9,6 +9,7 @@ enum class LogFormat {
     raw,
     rawWithLogs,
     internalJSON,
+    internalCBOR,
     bar,
     barWithLogs,
 };
@@ -14,6 +14,8 @@ LogFormat parseLogFormat(const std::string & logFormatStr)
         return LogFormat::rawWithLogs;
     else if (logFormatStr == "internal-json")
         return LogFormat::internalJSON;
+    else if (logFormatStr == "internal-cbor")
+        return LogFormat::internalCBOR;
     else if (logFormatStr == "bar")
         return LogFormat::bar;
     else if (logFormatStr == "bar-with-logs")
@@ -29,7 +31,9 @@ std::unique_ptr<Logger> makeDefaultLogger()
     case LogFormat::rawWithLogs:
         return makeSimpleLogger(true);
     case LogFormat::internalJSON:
-        return makeJSONLogger(getStandardError());
+        return makeStructuredLogger(getStandardError(), StructuredLogFormat::JSON);
+    case LogFormat::internalCBOR:
+        return makeStructuredLogger(getStandardError(), StructuredLogFormat::CBOR, false);
     case LogFormat::bar:
         return makeProgressBar();
     case LogFormat::barWithLogs: {
@@ -7,6 +7,7 @@
 #include "nix/util/config-global.hh"
 #include "nix/util/signals.hh"
 #include "nix/util/file-system.hh"
+#include "nix/util/current-process.hh"
 
 namespace nix {
 
@@ -75,6 +76,7 @@ static GlobalConfig::Register rPluginSettings(&pluginSettings);
 void initPlugins()
 {
     assert(!pluginSettings.pluginFiles.pluginsLoaded);
+    StartupPhaseTimer timer("loadPlugins");
     for (const auto & pluginFile : pluginSettings.pluginFiles.get()) {
         std::vector<std::filesystem::path> pluginFiles;
         try {
@@ -72,6 +72,13 @@ private:
 
         uint64_t corruptedPaths = 0, untrustedPaths = 0;
 
+        /**
+         * When the current batch of copies started, and how many
+         * bytes had been copied before it. Used to show the copy
+         * throughput.
+         */
+        std::optional<std::pair<std::chrono::steady_clock::time_point, uint64_t>> copyStart;
+
         bool active = true;
         size_t suspensions = 0;
         bool haveUpdate = true;
@@ -465,6 +472,35 @@ public:
         return nextWakeup;
     }
 
+    /**
+     * Return the average number of bytes per second copied since the
+     * current `actCopyPaths` activities started, if they have been
+     * running long enough for this to be meaningful.
+     */
+    std::optional<uint64_t> getCopyRate(State & state)
+    {
+        if (state.activitiesByType[actCopyPaths].its.empty()) {
+            state.copyStart.reset();
+            return std::nullopt;
+        }
+
+        auto & act = state.activitiesByType[actCopyPath];
+        uint64_t done = act.done;
+        for (auto & j : act.its)
+            done += j.second->done;
+
+        auto now = std::chrono::steady_clock::now();
+
+        if (!state.copyStart)
+            state.copyStart = {now, done};
+
+        auto elapsed = std::chrono::duration<double>(now - state.copyStart->first).count();
+        if (elapsed < 1)
+            return std::nullopt;
+
+        return (done - state.copyStart->second) / elapsed;
+    }
+
     std::string getStatus(State & state)
     {
         std::string res;
@@ -602,6 +638,8 @@ public:
             if (!s2.empty()) {
                 res += " (";
                 res += s2;
+                if (auto rate = getCopyRate(state))
+                    res += fmt(", %s/s", renderSize(*rate));
                 res += ')';
             }
         }
@@ -621,6 +659,8 @@ public:
         // FIXME: don't show "done" paths in green.
         showActivity(actVerifyPaths, "%s paths verified");
 
+        maybeAppendToResult(renderSizeActivity(actCollectGarbage, "%s freed"));
+
         if (state.corruptedPaths) {
             if (!res.empty())
                 res += ", ";
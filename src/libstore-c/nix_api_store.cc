@@ -1,5 +1,9 @@
+#include <condition_variable>
 #include <cstring>
+#include <deque>
+#include <functional>
 #include <span>
+#include <thread>
 
 #include "nix_api_store.h"
 #include "nix_api_store_internal.h"
@@ -11,10 +15,155 @@
 #include "nix/store/store-open.hh"
 #include "nix/store/build-result.hh"
 #include "nix/store/local-fs-store.hh"
+#include "nix/store/local-store.hh"
 #include "nix/util/base-nix-32.hh"
+#include "nix/util/callback.hh"
+#include "nix/util/finally.hh"
+#include "nix/util/signals.hh"
+#include "nix/util/sync.hh"
 
 #include "nix/store/globals.hh"
 
+namespace {
+
+/**
+ * Runs the asynchronous operations of the C API. Threads are started
+ * on demand up to a limit and then kept for later operations, so that
+ * thousands of pending operations don't need a thread each. The limit
+ * is a multiple of the number of cores, since most operations wait for
+ * I/O or for builds.
+ */
+class AsyncExecutor
+{
+    struct State
+    {
+        std::deque<std::function<void()>> queue;
+        size_t threads = 0;
+        size_t idle = 0;
+    };
+
+    nix::Sync<State> state_;
+    std::condition_variable wakeup;
+    const size_t maxThreads = std::max(std::thread::hardware_concurrency(), 1U) * 4;
+
+    void work()
+    {
+        while (true) {
+            std::function<void()> task;
+            {
+                auto state(state_.lock());
+                state->idle++;
+                while (state->queue.empty())
+                    state.wait(wakeup);
+                state->idle--;
+                task = std::move(state->queue.front());
+                state->queue.pop_front();
+            }
+            task();
+        }
+    }
+
+public:
+
+    void enqueue(std::function<void()> task)
+    {
+        auto state(state_.lock());
+        state->queue.push_back(std::move(task));
+        if (state->queue.size() > state->idle && state->threads < maxThreads) {
+            state->threads++;
+            std::thread([this]() { work(); }).detach();
+        } else
+            wakeup.notify_one();
+    }
+};
+
+/**
+ * Never destroyed, since its threads are detached.
+ */
+AsyncExecutor & getExecutor()
+{
+    static auto executor = new AsyncExecutor;
+    return *executor;
+}
+
+/**
+ * Store the current exception in `context`, or a cancellation error if
+ * the operation was cancelled, since cancelling a running operation
+ * interrupts it.
+ */
+void setOperationError(nix_c_context & context, const std::atomic<bool> & cancelled)
+{
+    if (cancelled) {
+        try {
+            throw nix::Error("operation was cancelled");
+        } catch (...) {
+            nix_context_error(&context);
+        }
+    } else
+        nix_context_error(&context);
+}
+
+/**
+ * Run `body` on the executor, and call `fail` if it throws or if the
+ * operation is cancelled before it starts. While `body` runs,
+ * `checkInterrupt()` in its thread also checks the cancellation flag.
+ * `body` is responsible for reporting success.
+ */
+template<typename Body, typename Fail>
+nix_store_operation * startOperation(Body && body, Fail && fail)
+{
+    auto cancelled = std::make_shared<std::atomic<bool>>(false);
+    getExecutor().enqueue([cancelled, body(std::forward<Body>(body)), fail(std::forward<Fail>(fail))]() {
+        nix_c_context context;
+        try {
+            if (*cancelled)
+                throw nix::Error("operation was cancelled");
+#ifndef _WIN32
+            nix::unix::interruptCheck = [&]() { return cancelled->load(); };
+            Finally resetInterruptCheck([]() { nix::unix::interruptCheck = nullptr; });
+#endif
+            body(cancelled);
+        } catch (...) {
+            setOperationError(context, *cancelled);
+            fail(&context);
+        }
+    });
+    return new nix_store_operation{cancelled};
+}
+
+void realise(
+    nix::ref<nix::Store> store,
+    const nix::StorePath & path,
+    void * userdata,
+    void (*callback)(void * userdata, const char *, const StorePath *))
+{
+    const std::vector<nix::DerivedPath> paths{nix::DerivedPath::Built{
+        .drvPath = nix::makeConstantStorePathRef(path), .outputs = nix::OutputsSpec::All{}}};
+
+    auto results = store->buildPathsWithResults(paths, nix::bmNormal, store);
+
+    assert(results.size() == 1);
+
+    // Check if any builds failed
+    for (auto & result : results) {
+        if (auto * failureP = result.tryGetFailure())
+            failureP->rethrow();
+    }
+
+    if (callback) {
+        for (const auto & result : results) {
+            if (auto * success = result.tryGetSuccess()) {
+                for (const auto & [outputName, realisation] : success->builtOutputs) {
+                    StorePath p{realisation.outPath};
+                    callback(userdata, outputName.c_str(), &p);
+                }
+            }
+        }
+    }
+}
+
+} // namespace
+
 extern "C" {
 
 nix_err nix_libstore_init(nix_c_context * context)
@@ -98,6 +247,22 @@ nix_store_get_version(nix_c_context * context, Store * store, nix_get_string_cal
     NIXC_CATCH_ERRS
 }
 
+nix_err nix_store_get_build_stats(
+    nix_c_context * context, Store * store, const char * derivation, nix_get_string_callback callback, void * user_data)
+{
+    if (context)
+        context->last_err_code = NIX_OK;
+    try {
+        auto localStore = dynamic_cast<nix::LocalStore *>(&*store->ptr);
+        if (!localStore)
+            throw nix::Error(
+                "store '%s' does not record build statistics", store->ptr->config.getHumanReadableURI());
+        auto res = nlohmann::json(localStore->queryBuildStats(derivation)).dump();
+        return call_nix_get_string_callback(res, callback, user_data);
+    }
+    NIXC_CATCH_ERRS
+}
+
 bool nix_store_is_valid_path(nix_c_context * context, Store * store, const StorePath * path)
 {
     if (context)
@@ -172,31 +337,7 @@ nix_err nix_store_realise(
     if (context)
         context->last_err_code = NIX_OK;
     try {
-
-        const std::vector<nix::DerivedPath> paths{nix::DerivedPath::Built{
-            .drvPath = nix::makeConstantStorePathRef(path->path), .outputs = nix::OutputsSpec::All{}}};
-
-        const auto nixStore = store->ptr;
-        auto results = nixStore->buildPathsWithResults(paths, nix::bmNormal, nixStore);
-
-        assert(results.size() == 1);
-
-        // Check if any builds failed
-        for (auto & result : results) {
-            if (auto * failureP = result.tryGetFailure())
-                failureP->rethrow();
-        }
-
-        if (callback) {
-            for (const auto & result : results) {
-                if (auto * success = result.tryGetSuccess()) {
-                    for (const auto & [outputName, realisation] : success->builtOutputs) {
-                        StorePath p{realisation.outPath};
-                        callback(userdata, outputName.c_str(), &p);
-                    }
-                }
-            }
-        }
+        realise(store->ptr, path->path, userdata, callback);
     }
     NIXC_CATCH_ERRS
 }
@@ -328,6 +469,135 @@ nix_err nix_store_copy_closure(nix_c_context * context, Store * srcStore, Store
     NIXC_CATCH_ERRS
 }
 
+nix_store_operation * nix_store_query_path_info_async(
+    nix_c_context * context,
+    Store * store,
+    const StorePath * path,
+    void * userdata,
+    nix_store_path_info_callback callback)
+{
+    if (context)
+        context->last_err_code = NIX_OK;
+    try {
+        return startOperation(
+            [store{store->ptr}, path{path->path}, userdata, callback](auto cancelled) {
+                store->queryPathInfo(
+                    path,
+                    {[store, userdata, callback, cancelled](std::future<nix::ref<const nix::ValidPathInfo>> fut) {
+                        nix_c_context context;
+                        std::string json;
+                        try {
+                            auto info = fut.get();
+                            if (*cancelled)
+                                throw nix::Error("operation was cancelled");
+                            json = info->toJSON(&*store, true, nix::PathInfoJsonFormat::V1).dump();
+                        } catch (...) {
+                            setOperationError(context, *cancelled);
+                            callback(&context, userdata, nullptr, 0);
+                            return;
+                        }
+                        callback(&context, userdata, json.data(), json.size());
+                    }});
+            },
+            [userdata, callback](nix_c_context * context) { callback(context, userdata, nullptr, 0); });
+    }
+    NIXC_CATCH_ERRS_NULL
+}
+
+nix_store_operation * nix_store_is_valid_path_async(
+    nix_c_context * context,
+    Store * store,
+    const StorePath * path,
+    void * userdata,
+    nix_store_is_valid_callback callback)
+{
+    if (context)
+        context->last_err_code = NIX_OK;
+    try {
+        return startOperation(
+            [store{store->ptr}, path{path->path}, userdata, callback](auto cancelled) {
+                store->queryPathInfo(
+                    path, {[userdata, callback, cancelled](std::future<nix::ref<const nix::ValidPathInfo>> fut) {
+                        nix_c_context context;
+                        bool valid;
+                        try {
+                            try {
+                                fut.get();
+                                valid = true;
+                            } catch (nix::InvalidPath &) {
+                                valid = false;
+                            }
+                            if (*cancelled)
+                                throw nix::Error("operation was cancelled");
+                        } catch (...) {
+                            setOperationError(context, *cancelled);
+                            callback(&context, userdata, false);
+                            return;
+                        }
+                        callback(&context, userdata, valid);
+                    }});
+            },
+            [userdata, callback](nix_c_context * context) { callback(context, userdata, false); });
+    }
+    NIXC_CATCH_ERRS_NULL
+}
+
+nix_store_operation * nix_store_realise_async(
+    nix_c_context * context,
+    Store * store,
+    const StorePath * path,
+    void * userdata,
+    void (*output_callback)(void * userdata, const char * outname, const StorePath * out),
+    nix_store_done_callback callback)
+{
+    if (context)
+        context->last_err_code = NIX_OK;
+    try {
+        return startOperation(
+            [store{store->ptr}, path{path->path}, userdata, output_callback, callback](auto) {
+                realise(store, path, userdata, output_callback);
+                nix_c_context context;
+                callback(&context, userdata);
+            },
+            [userdata, callback](nix_c_context * context) { callback(context, userdata); });
+    }
+    NIXC_CATCH_ERRS_NULL
+}
+
+nix_store_operation * nix_store_copy_closure_async(
+    nix_c_context * context,
+    Store * srcStore,
+    Store * dstStore,
+    const StorePath * path,
+    void * userdata,
+    nix_store_done_callback callback)
+{
+    if (context)
+        context->last_err_code = NIX_OK;
+    try {
+        return startOperation(
+            [srcStore{srcStore->ptr}, dstStore{dstStore->ptr}, path{path->path}, userdata, callback](auto) {
+                nix::RealisedPath::Set paths;
+                paths.insert(path);
+                nix::copyClosure(*srcStore, *dstStore, paths);
+                nix_c_context context;
+                callback(&context, userdata);
+            },
+            [userdata, callback](nix_c_context * context) { callback(context, userdata); });
+    }
+    NIXC_CATCH_ERRS_NULL
+}
+
+void nix_store_operation_cancel(nix_store_operation * operation)
+{
+    *operation->cancelled = true;
+}
+
+void nix_store_operation_free(nix_store_operation * operation)
+{
+    delete operation;
+}
+
 nix_derivation * nix_store_drv_from_store_path(nix_c_context * context, Store * store, const StorePath * path)
 {
     if (context)
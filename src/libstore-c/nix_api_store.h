@@ -24,6 +24,13 @@ extern "C" {
 /** @brief Reference to a Nix store */
 typedef struct Store Store;
 
+/**
+ * @brief A store operation that runs in the background
+ *
+ * @see nix_store_operation_cancel
+ */
+typedef struct nix_store_operation nix_store_operation;
+
 /**
  * @brief Initializes the Nix store library
  *
@@ -185,6 +192,26 @@ nix_err nix_store_realise(
 nix_err
 nix_store_get_version(nix_c_context * context, Store * store, nix_get_string_callback callback, void * user_data);
 
+/**
+ * @brief get the recorded statistics of past builds of a derivation.
+ *
+ * Only local stores record build statistics.
+ *
+ * @param[out] context Optional, stores error information
+ * @param[in] store nix store reference
+ * @param[in] derivation The name or `hashDerivationModulo` of the derivation.
+ * @param[in] callback Called with a JSON array of builds, most recent first.
+ * @param[in] user_data optional, arbitrary data, passed to the callback when it's called.
+ * @see nix_get_string_callback
+ * @return error code, NIX_OK on success.
+ */
+nix_err nix_store_get_build_stats(
+    nix_c_context * context,
+    Store * store,
+    const char * derivation,
+    nix_get_string_callback callback,
+    void * user_data);
+
 /**
  * @brief Create a `nix_derivation` from a JSON representation of that derivation.
  *
@@ -259,6 +286,154 @@ nix_err nix_store_get_fs_closure(
  */
 nix_derivation * nix_store_drv_from_store_path(nix_c_context * context, Store * store, const StorePath * path);
 
+/** @defgroup store_async Asynchronous operations
+ * @ingroup libstore
+ * @brief Store operations that call a callback when they are done
+ *
+ * These functions start the operation and return immediately. The
+ * operation runs on a thread managed by Nix, or for stores that support
+ * it, such as binary caches, asynchronously without occupying a thread.
+ *
+ * The completion callback is called exactly once, from an arbitrary
+ * thread, and possibly before the function that started the operation
+ * returns. It borrows a context that holds the result, which is
+ * `NIX_OK` on success. The context and any other arguments are only
+ * valid for the duration of the call.
+ *
+ * Every started operation returns a handle, which can be used to cancel
+ * it and must be freed with nix_store_operation_free().
+ * @{
+ */
+
+/**
+ * @brief Called with the result of nix_store_query_path_info_async()
+ *
+ * @param[in] context The result of the operation
+ * @param[in] userdata The userdata passed when starting the operation
+ * @param[in] json The path info as JSON, in version 1 of the format of `nix path-info --json`, or NULL on error
+ * @param[in] n The length of `json`
+ */
+typedef void (*nix_store_path_info_callback)(nix_c_context * context, void * userdata, const char * json, size_t n);
+
+/**
+ * @brief Called with the result of nix_store_is_valid_path_async()
+ *
+ * @param[in] context The result of the operation
+ * @param[in] userdata The userdata passed when starting the operation
+ * @param[in] valid Whether the path is valid, false on error
+ */
+typedef void (*nix_store_is_valid_callback)(nix_c_context * context, void * userdata, bool valid);
+
+/**
+ * @brief Called when an operation without a result has finished
+ *
+ * @param[in] context The result of the operation
+ * @param[in] userdata The userdata passed when starting the operation
+ */
+typedef void (*nix_store_done_callback)(nix_c_context * context, void * userdata);
+
+/**
+ * @brief Start querying the metadata of a store path
+ *
+ * @param[out] context Optional, stores the error if the operation could not be started
+ * @param[in] store nix store reference
+ * @param[in] path The path to query. Copied, so it may be freed once this returns.
+ * @param[in] userdata Passed to the callback
+ * @param[in] callback Called with the path info. Fails if the path is not valid.
+ * @return A handle for the operation, or NULL if it could not be started, in which case the callback is not called.
+ */
+nix_store_operation * nix_store_query_path_info_async(
+    nix_c_context * context,
+    Store * store,
+    const StorePath * path,
+    void * userdata,
+    nix_store_path_info_callback callback);
+
+/**
+ * @brief Start checking whether a store path is valid
+ *
+ * @param[out] context Optional, stores the error if the operation could not be started
+ * @param[in] store nix store reference
+ * @param[in] path The path to check. Copied, so it may be freed once this returns.
+ * @param[in] userdata Passed to the callback
+ * @param[in] callback Called with the validity of the path
+ * @return A handle for the operation, or NULL if it could not be started, in which case the callback is not called.
+ */
+nix_store_operation * nix_store_is_valid_path_async(
+    nix_c_context * context,
+    Store * store,
+    const StorePath * path,
+    void * userdata,
+    nix_store_is_valid_callback callback);
+
+/**
+ * @brief Start realising a Nix store path
+ *
+ * Like nix_store_realise(), but returns immediately. The build log and
+ * progress messages go to the logger of the process, like for all
+ * other builds.
+ *
+ * @param[out] context Optional, stores the error if the operation could not be started
+ * @param[in] store Nix Store reference
+ * @param[in] path Path to build. Copied, so it may be freed once this returns.
+ * @param[in] userdata Passed to both callbacks
+ * @param[in] output_callback Optional, called for every realised output before `callback` is called with NIX_OK
+ * @param[in] callback Called when the build has finished or failed
+ * @return A handle for the operation, or NULL if it could not be started, in which case no callback is called.
+ */
+nix_store_operation * nix_store_realise_async(
+    nix_c_context * context,
+    Store * store,
+    const StorePath * path,
+    void * userdata,
+    void (*output_callback)(void * userdata, const char * outname, const StorePath * out),
+    nix_store_done_callback callback);
+
+/**
+ * @brief Start copying the closure of `path` from `srcStore` to `dstStore`.
+ *
+ * @param[out] context Optional, stores the error if the operation could not be started
+ * @param[in] srcStore nix source store reference
+ * @param[in] dstStore nix destination store reference
+ * @param[in] path Path to copy. Copied, so it may be freed once this returns.
+ * @param[in] userdata Passed to the callback
+ * @param[in] callback Called when the copy has finished or failed
+ * @return A handle for the operation, or NULL if it could not be started, in which case the callback is not called.
+ */
+nix_store_operation * nix_store_copy_closure_async(
+    nix_c_context * context,
+    Store * srcStore,
+    Store * dstStore,
+    const StorePath * path,
+    void * userdata,
+    nix_store_done_callback callback);
+
+/**
+ * @brief Cancel an operation
+ *
+ * An operation that hasn't started yet fails without doing anything. A
+ * running build or copy is interrupted at the next opportunity. A query
+ * that is waiting for a remote store completes when the reply arrives,
+ * but its result is discarded. In all cases the callback is still
+ * called, with an error unless the operation had already succeeded.
+ *
+ * Does not block, and has no effect if the operation has finished.
+ *
+ * @param[in] operation The operation to cancel
+ */
+void nix_store_operation_cancel(nix_store_operation * operation);
+
+/**
+ * @brief Free the handle of an operation
+ *
+ * Does not cancel the operation, whose callback is still called.
+ *
+ * @param[in] operation The operation handle to free
+ */
+void nix_store_operation_free(nix_store_operation * operation);
+
+/** @} */
+
 // cffi end
 #ifdef __cplusplus
 }
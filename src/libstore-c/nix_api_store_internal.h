@@ -3,6 +3,8 @@
 #include "nix/store/store-api.hh"
 #include "nix/store/derivations.hh"
 
+#include <atomic>
+
 extern "C" {
 
 struct Store
@@ -20,6 +22,14 @@ struct nix_derivation
     nix::Derivation drv;
 };
 
+struct nix_store_operation
+{
+    /**
+     * Shared with the running operation, which may outlive the handle.
+     */
+    std::shared_ptr<std::atomic<bool>> cancelled;
+};
+
 } // extern "C"
 
 #endif
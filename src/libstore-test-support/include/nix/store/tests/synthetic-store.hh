@@ -0,0 +1,88 @@
+#pragma once
+///@file
+
+#include "nix/store/dummy-store-impl.hh"
+
+namespace nix {
+
+/**
+ * Parameters of a synthetic store graph, see `makeSyntheticStore()`.
+ */
+struct SyntheticStoreParams
+{
+    /**
+     * The number of store paths.
+     */
+    size_t pathCount = 10000;
+
+    /**
+     * The average number of references of a store path. The actual
+     * numbers are geometrically distributed, so most paths have a few
+     * references and some have many.
+     */
+    double meanReferences = 6;
+
+    /**
+     * The probability that a reference goes to a recently created
+     * path rather than to one chosen in proportion to its number of
+     * referrers. The former produces long dependency chains, the
+     * latter a few paths (like glibc) that almost everything refers
+     * to.
+     */
+    double locality = 0.5;
+
+    /**
+     * How many of the most recently created paths count as recent
+     * for `locality`.
+     */
+    size_t localityWindow = 100;
+
+    /**
+     * Whether to also create a derivation for each path, whose input
+     * derivations are those of the path's references.
+     */
+    bool withDerivations = false;
+
+    /**
+     * The size of the single regular file that makes up each path.
+     */
+    size_t fileSize = 64;
+
+    uint32_t seed = 42;
+};
+
+/**
+ * A dummy store holding a synthetic graph of store paths.
+ */
+struct SyntheticStore
+{
+    ref<DummyStore> store;
+
+    /**
+     * The paths in the order they were created. Every path comes after
+     * its references, so this is a topological order.
+     */
+    std::vector<StorePath> paths;
+
+    /**
+     * The derivation that produces each path in `paths`, if
+     * `SyntheticStoreParams::withDerivations` is set.
+     */
+    std::vector<StorePath> drvPaths;
+
+    /**
+     * The `n` most recently created paths, whose closures cover most
+     * of the graph, like the top-level packages of a system.
+     */
+    StorePathSet roots(size_t n) const;
+};
+
+/**
+ * Create a writable dummy store with a store graph shaped like
+ * Nixpkgs: long dependency chains, a few paths with a very large
+ * number of referrers, and many with only a few. The graph only
+ * depends on the parameters, so it is the same in every run.
+ */
+SyntheticStore makeSyntheticStore(const SyntheticStoreParams & params);
+
+} // namespace nix
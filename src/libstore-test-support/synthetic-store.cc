@@ -0,0 +1,90 @@
+#include "nix/store/tests/synthetic-store.hh"
+#include "nix/util/memory-source-accessor.hh"
+#include "nix/util/file-content-address.hh"
+
+#include <random>
+
+namespace nix {
+
+StorePathSet SyntheticStore::roots(size_t n) const
+{
+    StorePathSet res;
+    for (auto i = paths.rbegin(); i != paths.rend() && res.size() < n; ++i)
+        res.insert(*i);
+    return res;
+}
+
+SyntheticStore makeSyntheticStore(const SyntheticStoreParams & params)
+{
+    auto cfg = make_ref<DummyStoreConfig>(StoreReference::Params{});
+    cfg->readOnly = false;
+    SyntheticStore res{.store = cfg->openDummyStore()};
+    auto & store = *res.store;
+
+    std::mt19937 rng(params.seed);
+    std::geometric_distribution<size_t> nrReferences(1.0 / (1.0 + params.meanReferences));
+    std::bernoulli_distribution local(params.locality);
+
+    /* Each path appears here once, plus once for every referrer, so
+       that picking a uniformly random element picks paths in
+       proportion to their number of referrers ("preferential
+       attachment"). This is what gives Nixpkgs-like graphs their
+       heavy-tailed fan-in. */
+    std::vector<uint32_t> attachment;
+
+    res.paths.reserve(params.pathCount);
+
+    for (size_t i = 0; i < params.pathCount; ++i) {
+        auto name = fmt("pkg%d-1.%d", i, i % 10);
+        /* Derive the hash part from the seed rather than using
+           `StorePath::random()`, so that the graph is the same in
+           every run. */
+        StorePath path(hashString(HashAlgorithm::SHA1, fmt("%d-%d", params.seed, i)), name);
+
+        std::set<size_t> refs;
+        if (i > 0) {
+            auto n = std::min(nrReferences(rng), i);
+            /* Bound the number of attempts, since the candidates may
+               be fewer than `n` after removing duplicates. */
+            for (size_t attempt = 0; refs.size() < n && attempt < 4 * n; ++attempt) {
+                auto window = std::min(params.localityWindow, i);
+                refs.insert(
+                    local(rng) && window ? i - 1 - rng() % window : attachment[rng() % attachment.size()]);
+            }
+        }
+
+        auto accessor = make_ref<MemorySourceAccessor>();
+        accessor->root = MemorySourceAccessor::File::Regular{
+            .contents = fmt("%s\n", name) + std::string(params.fileSize, 'x'),
+        };
+        auto narHash = hashPath({accessor, CanonPath::root}, FileSerialisationMethod::NixArchive, HashAlgorithm::SHA256);
+
+        UnkeyedValidPathInfo info{store, narHash.hash};
+        info.narSize = narHash.numBytesDigested;
+        for (auto ref : refs) {
+            info.references.insert(res.paths[ref]);
+            attachment.push_back(ref);
+        }
+        attachment.push_back(i);
+
+        if (params.withDerivations) {
+            Derivation drv;
+            drv.name = name;
+            drv.platform = "x86_64-linux";
+            drv.builder = "/bin/sh";
+            drv.outputs = {{"out", DerivationOutput{DerivationOutput::InputAddressed{.path = path}}}};
+            drv.env = {{"name", name}, {"out", store.printStorePath(path)}};
+            for (auto ref : refs)
+                drv.inputDrvs.map[res.drvPaths[ref]].value = {"out"};
+            res.drvPaths.push_back(store.writeDerivation(drv));
+            info.deriver = res.drvPaths.back();
+        }
+
+        store.contents.insert({path, {std::move(info), accessor}});
+        res.paths.push_back(std::move(path));
+    }
+
+    return res;
+}
+
+} // namespace nix
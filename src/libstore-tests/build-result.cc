@@ -103,6 +103,25 @@ INSTANTIATE_TEST_SUITE_P(
                 .cpuUser = std::chrono::microseconds(500s),
                 .cpuSystem = std::chrono::microseconds(604s),
             },
+        },
+        std::pair{
+            "success-resources",
+            BuildResult{
+                .inner{BuildResult::Success{
+                    .status = BuildResult::Success::Built,
+                }},
+                .timesBuilt = 1,
+                .startTime = 30,
+                .stopTime = 50,
+                .cpuUser = std::chrono::microseconds(500s),
+                .cpuSystem = std::chrono::microseconds(604s),
+                .peakMemory = 1 << 30,
+                .ioRead = 1 << 20,
+                .ioWrite = 1 << 24,
+                .cpuStall = std::chrono::microseconds(2s),
+                .memoryStall = std::chrono::microseconds(0s),
+                .ioStall = std::chrono::microseconds(7s),
+            },
         }));
 
 } // namespace nix
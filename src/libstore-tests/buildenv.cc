@@ -0,0 +1,147 @@
+#include <gtest/gtest.h>
+
+#include "nix/store/builtins/buildenv.hh"
+#include "nix/util/file-system.hh"
+
+namespace nix {
+
+#ifndef _WIN32
+
+class BuildEnvTest : public ::testing::Test
+{
+protected:
+    AutoDelete tmpDir{createTempDir()};
+
+    Path dir(const std::string & name)
+    {
+        return (tmpDir.path() / name).string();
+    }
+
+    Path makePackage(const std::string & name, const std::vector<std::string> & files)
+    {
+        auto pkg = dir(name);
+        for (auto & file : files) {
+            createDirs(std::filesystem::path(pkg + "/" + file).parent_path());
+            writeFile(pkg + "/" + file, name);
+        }
+        return pkg;
+    }
+};
+
+TEST_F(BuildEnvTest, linksUnsharedDirectoriesAsAWhole)
+{
+    auto a = makePackage("a", {"bin/a", "share/a/doc"});
+    auto b = makePackage("b", {"bin/b", "lib/libb.so"});
+    auto out = dir("out");
+    createDirs(out);
+
+    buildProfile(out, {{a, true, 5}, {b, true, 5}});
+
+    EXPECT_TRUE(std::filesystem::is_directory(std::filesystem::symlink_status(out + "/bin")));
+    EXPECT_EQ(readLink(out + "/bin/a"), a + "/bin/a");
+    EXPECT_EQ(readLink(out + "/bin/b"), b + "/bin/b");
+    EXPECT_EQ(readLink(out + "/share"), a + "/share");
+    EXPECT_EQ(readLink(out + "/lib"), b + "/lib");
+}
+
+TEST_F(BuildEnvTest, unfoldsLinkedDirectories)
+{
+    auto a = makePackage("a", {"share/a/doc"});
+    auto b = makePackage("b", {"share/b/doc"});
+    auto c = makePackage("c", {"share/a/extra"});
+    auto out = dir("out");
+    createDirs(out);
+
+    /* 'share/a' is first linked to 'a', then turned into a directory
+       when 'c' also provides it. */
+    buildProfile(out, {{a, true, 5}, {b, true, 5}, {c, true, 6}});
+
+    EXPECT_EQ(readLink(out + "/share/a/doc"), a + "/share/a/doc");
+    EXPECT_EQ(readLink(out + "/share/a/extra"), c + "/share/a/extra");
+    EXPECT_EQ(readLink(out + "/share/b"), b + "/share/b");
+}
+
+TEST_F(BuildEnvTest, priorities)
+{
+    auto a = makePackage("a", {"bin/foo"});
+    auto b = makePackage("b", {"bin/foo"});
+    auto out = dir("out");
+    createDirs(out);
+
+    buildProfile(out, {{a, true, 6}, {b, true, 5}});
+
+    EXPECT_EQ(readLink(out + "/bin/foo"), b + "/bin/foo");
+}
+
+TEST_F(BuildEnvTest, conflict)
+{
+    auto a = makePackage("a", {"bin/foo"});
+    auto b = makePackage("b", {"bin/foo"});
+    auto out = dir("out");
+    createDirs(out);
+
+    EXPECT_THROW(buildProfile(out, {{a, true, 5}, {b, true, 5}}), BuildEnvFileConflictError);
+}
+
+TEST_F(BuildEnvTest, inactivePackages)
+{
+    auto a = makePackage("a", {"bin/foo"});
+    auto b = makePackage("b", {"bin/foo"});
+    auto out = dir("out");
+    createDirs(out);
+
+    buildProfile(out, {{a, true, 5}, {b, false, 5}});
+
+    EXPECT_EQ(readLink(out + "/bin"), a + "/bin");
+}
+
+TEST_F(BuildEnvTest, incrementalAddition)
+{
+    auto a = makePackage("a", {"bin/a", "share/a/doc"});
+    auto b = makePackage("b", {"bin/b"});
+    auto c = makePackage("c", {"bin/c", "share/a/extra", "lib/libc.so"});
+    auto prev = dir("prev");
+    createDirs(prev);
+    buildProfile(prev, {{a, true, 5}, {b, true, 5}});
+
+    auto out = dir("out");
+    createDirs(out);
+    ASSERT_TRUE(
+        buildProfileIncremental(out, prev, {{a, true, 5}, {b, true, 5}}, {{a, true, 5}, {b, true, 5}, {c, true, 5}}));
+
+    EXPECT_EQ(readLink(out + "/bin/a"), a + "/bin/a");
+    EXPECT_EQ(readLink(out + "/bin/b"), b + "/bin/b");
+    EXPECT_EQ(readLink(out + "/bin/c"), c + "/bin/c");
+    EXPECT_EQ(readLink(out + "/share/a/doc"), a + "/share/a/doc");
+    EXPECT_EQ(readLink(out + "/share/a/extra"), c + "/share/a/extra");
+    EXPECT_EQ(readLink(out + "/lib"), c + "/lib");
+}
+
+TEST_F(BuildEnvTest, incrementalNeedsFullBuild)
+{
+    auto a = makePackage("a", {"bin/foo"});
+    auto b = makePackage("b", {"bin/bar"});
+    auto c = makePackage("c", {"bin/foo"});
+    auto prev = dir("prev");
+    createDirs(prev);
+    buildProfile(prev, {{a, true, 5}, {b, true, 5}});
+
+    auto out = dir("out");
+    createDirs(out);
+
+    /* Removals aren't supported. */
+    EXPECT_FALSE(buildProfileIncremental(out, prev, {{a, true, 5}, {b, true, 5}}, {{a, true, 5}}));
+
+    /* Neither are changes in priority. */
+    EXPECT_FALSE(buildProfileIncremental(out, prev, {{a, true, 5}, {b, true, 5}}, {{a, true, 4}, {b, true, 5}}));
+
+    /* Conflicts are left to the full build, which reports them. */
+    EXPECT_FALSE(
+        buildProfileIncremental(out, prev, {{a, true, 5}, {b, true, 5}}, {{a, true, 5}, {b, true, 5}, {c, true, 5}}));
+
+    EXPECT_TRUE(std::filesystem::is_empty(out));
+}
+
+#endif
+
+} // namespace nix
@@ -0,0 +1,152 @@
+#include <benchmark/benchmark.h>
+
+#include "nix/store/tests/synthetic-store.hh"
+#include "nix/store/globals.hh"
+
+using namespace nix;
+
+/**
+ * Return a synthetic store with `pathCount` paths. Google Benchmark
+ * calls the benchmark functions several times, so keep the stores
+ * around instead of generating them again each time.
+ */
+static const SyntheticStore & getStore(size_t pathCount, bool withDerivations = false)
+{
+    static std::map<std::pair<size_t, bool>, SyntheticStore> stores;
+    auto i = stores.find({pathCount, withDerivations});
+    if (i == stores.end())
+        i = stores
+                .emplace(
+                    std::pair{pathCount, withDerivations},
+                    makeSyntheticStore({.pathCount = pathCount, .withDerivations = withDerivations}))
+                .first;
+    return i->second;
+}
+
+static void BM_ComputeFSClosure(benchmark::State & state)
+{
+    auto & graph = getStore(state.range(0));
+
+    /* Start from the last paths, whose closures cover most of the
+       graph. */
+    auto roots = graph.roots(10);
+
+    for (auto _ : state) {
+        StorePathSet closure;
+        graph.store->computeFSClosure(roots, closure);
+        benchmark::DoNotOptimize(closure);
+    }
+
+    state.SetItemsProcessed(state.iterations() * graph.paths.size());
+}
+
+BENCHMARK(BM_ComputeFSClosure)->Arg(10000)->Arg(100000)->Arg(1000000)->Unit(benchmark::kMillisecond);
+
+static void BM_TopoSortPaths(benchmark::State & state)
+{
+    auto & graph = getStore(state.range(0));
+    StorePathSet paths(graph.paths.begin(), graph.paths.end());
+
+    for (auto _ : state) {
+        auto sorted = graph.store->topoSortPaths(paths);
+        benchmark::DoNotOptimize(sorted);
+    }
+
+    state.SetItemsProcessed(state.iterations() * paths.size());
+}
+
+BENCHMARK(BM_TopoSortPaths)->Arg(10000)->Arg(100000)->Unit(benchmark::kMillisecond);
+
+/**
+ * The marking phase of the garbage collector: compute the closure of a
+ * set of roots scattered over the graph (like profiles and `result`
+ * links of various ages), and everything outside it. LocalStore's
+ * collector is tied to its database and file system, so this runs
+ * the same traversal on the dummy store.
+ */
+static void BM_GCMark(benchmark::State & state)
+{
+    auto & graph = getStore(state.range(0));
+
+    StorePathSet roots;
+    for (size_t i = 0; i < graph.paths.size(); i += 100)
+        roots.insert(graph.paths[i]);
+
+    for (auto _ : state) {
+        StorePathSet alive;
+        graph.store->computeFSClosure(roots, alive);
+        StorePathSet dead;
+        for (auto & path : graph.paths)
+            if (!alive.contains(path))
+                dead.insert(path);
+        benchmark::DoNotOptimize(dead);
+    }
+
+    state.SetItemsProcessed(state.iterations() * graph.paths.size());
+}
+
+BENCHMARK(BM_GCMark)->Arg(10000)->Arg(100000)->Unit(benchmark::kMillisecond);
+
+/**
+ * Ask what needs to be built for the top-level derivations when the
+ * outputs of the most recent `state.range(1)` percent of the
+ * derivations are missing, as after a Nixpkgs update.
+ */
+static void BM_QueryMissing(benchmark::State & state)
+{
+    auto & graph = getStore(state.range(0), true);
+
+    auto nrMissing = graph.paths.size() * state.range(1) / 100;
+    std::vector<std::pair<StorePath, DummyStore::PathInfoAndContents>> removed;
+    for (size_t i = graph.paths.size() - nrMissing; i < graph.paths.size(); ++i)
+        graph.store->contents.erase_if(graph.paths[i], [&](auto & kv) {
+            removed.emplace_back(kv.first, kv.second);
+            return true;
+        });
+    graph.store->clearPathInfoCache();
+
+    std::vector<DerivedPath> targets;
+    for (size_t i = graph.drvPaths.size() - 10; i < graph.drvPaths.size(); ++i)
+        targets.push_back(DerivedPath::Built{
+            .drvPath = makeConstantStorePathRef(graph.drvPaths[i]),
+            .outputs = OutputsSpec::All{},
+        });
+
+    auto useSubstitutes = settings.useSubstitutes.get();
+    settings.useSubstitutes = false;
+
+    for (auto _ : state) {
+        auto missing = graph.store->queryMissing(targets);
+        benchmark::DoNotOptimize(missing);
+    }
+
+    settings.useSubstitutes = useSubstitutes;
+    for (auto & [path, contents] : removed)
+        graph.store->contents.insert({path, contents});
+    graph.store->clearPathInfoCache();
+
+    state.SetItemsProcessed(state.iterations() * nrMissing);
+}
+
+BENCHMARK(BM_QueryMissing)->Args({10000, 10})->Args({100000, 10})->Unit(benchmark::kMillisecond);
+
+static void BM_CopyPaths(benchmark::State & state)
+{
+    auto & graph = getStore(state.range(0));
+    StorePathSet paths(graph.paths.begin(), graph.paths.end());
+
+    auto cfg = make_ref<DummyStoreConfig>(StoreReference::Params{});
+    cfg->readOnly = false;
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        auto dstStore = cfg->openDummyStore();
+        state.ResumeTiming();
+
+        copyPaths(*graph.store, *dstStore, paths, NoRepair, NoCheckSigs);
+    }
+
+    state.SetItemsProcessed(state.iterations() * paths.size());
+}
+
+BENCHMARK(BM_CopyPaths)->Arg(10000)->Arg(100000)->Unit(benchmark::kMillisecond);
@@ -0,0 +1,213 @@
+#include <benchmark/benchmark.h>
+
+#include "nix/store/daemon.hh"
+#include "nix/store/store-open.hh"
+#include "nix/util/archive.hh"
+#include "nix/util/file-system.hh"
+#include "nix/util/hash.hh"
+#include "nix/util/logging.hh"
+#include "nix/util/unix-domain-socket.hh"
+
+#ifndef _WIN32
+
+#  include <atomic>
+#  include <map>
+#  include <thread>
+
+#  include <sys/socket.h>
+
+using namespace nix;
+
+namespace {
+
+/**
+ * A local store in a temporary directory, served over a Unix domain
+ * socket by an in-process daemon, the same way recursive Nix serves
+ * the store to builders. Each connection is handled by
+ * `daemon::processConnection()` in its own thread, so clients see the
+ * same protocol costs as with `nix-daemon`, minus the fork.
+ *
+ * Shared by all benchmarks and deliberately never destroyed, since the
+ * connection threads run until the process exits.
+ */
+struct BenchDaemon
+{
+    AutoDelete tmpDir;
+    ref<Store> localStore;
+    AutoCloseFD socket;
+    ref<Store> client;
+
+    /**
+     * Small paths for the query benchmarks.
+     */
+    std::vector<StorePath> smallPaths;
+
+    /**
+     * A path for each payload size, for `NarFromPath`.
+     */
+    std::map<uint64_t, StorePath> payloadPaths;
+
+    BenchDaemon()
+        : tmpDir(createTempDir())
+        , localStore(openStore(fmt("local?root=%s", tmpDir.path().string())))
+        , socket(createUnixDomainSocket(tmpDir.path() / "socket", 0600))
+        /* No path info cache, so that every query is a round trip, and
+           enough connections for the largest thread count. */
+        , client(openStore(
+              fmt("unix://%s?max-connections=64&path-info-cache-size=0", (tmpDir.path() / "socket").string())))
+    {
+        std::thread([this]() {
+            while (true) {
+                AutoCloseFD remote = accept(socket.get(), nullptr, nullptr);
+                if (!remote) {
+                    if (errno == EINTR || errno == EAGAIN)
+                        continue;
+                    throw SysError("accepting connection");
+                }
+                std::thread([store{localStore}, remote{std::move(remote)}]() {
+                    try {
+                        daemon::processConnection(
+                            store, FdSource(remote.get()), FdSink(remote.get()), Trusted, daemon::Recursive);
+                    } catch (...) {
+                        ignoreExceptionExceptInterrupt();
+                    }
+                }).detach();
+            }
+        }).detach();
+
+        auto nar = makeNar(64);
+        for (int i = 0; i < 1000; ++i)
+            smallPaths.push_back(add(*localStore, nar));
+
+        for (uint64_t size : {1ULL << 10, 1ULL << 20, 16ULL << 20})
+            payloadPaths.emplace(size, add(*localStore, makeNar(size)));
+    }
+
+    static std::string makeNar(uint64_t size)
+    {
+        StringSink sink;
+        dumpString(std::string(size, 'x'), sink);
+        return std::move(sink.s);
+    }
+
+    /**
+     * Make the metadata of a new input-addressed path with `nar` as
+     * its contents. Paths are random, so identical NARs can be added
+     * as often as needed.
+     */
+    static ValidPathInfo makeInfo(Store & store, std::string_view nar)
+    {
+        ValidPathInfo info{
+            StorePath::random("daemon-bench"), UnkeyedValidPathInfo(store, hashString(HashAlgorithm::SHA256, nar))};
+        info.narSize = nar.size();
+        return info;
+    }
+
+    static StorePath add(Store & store, std::string_view nar)
+    {
+        auto info = makeInfo(store, nar);
+        StringSource source(nar);
+        store.addToStore(info, source, NoRepair, NoCheckSigs);
+        return info.path;
+    }
+};
+
+BenchDaemon & getDaemon()
+{
+    static auto daemon = new BenchDaemon;
+    return *daemon;
+}
+
+} // namespace
+
+static void BM_DaemonIsValidPath(benchmark::State & state)
+{
+    auto & daemon = getDaemon();
+    size_t i = state.thread_index();
+
+    for (auto _ : state)
+        benchmark::DoNotOptimize(daemon.client->isValidPath(daemon.smallPaths[i++ % daemon.smallPaths.size()]));
+
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(BM_DaemonIsValidPath)->ThreadRange(1, 16)->UseRealTime();
+
+static void BM_DaemonQueryPathInfo(benchmark::State & state)
+{
+    auto & daemon = getDaemon();
+    size_t i = state.thread_index();
+
+    for (auto _ : state)
+        benchmark::DoNotOptimize(daemon.client->queryPathInfo(daemon.smallPaths[i++ % daemon.smallPaths.size()]));
+
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(BM_DaemonQueryPathInfo)->ThreadRange(1, 16)->UseRealTime();
+
+static void BM_DaemonAddToStoreNar(benchmark::State & state)
+{
+    auto & daemon = getDaemon();
+    auto nar = BenchDaemon::makeNar(state.range(0));
+
+    for (auto _ : state)
+        BenchDaemon::add(*daemon.client, nar);
+
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(state.iterations() * nar.size());
+}
+
+/* Every iteration adds a path, so keep payloads small enough that the
+   temporary store doesn't grow to gigabytes. */
+BENCHMARK(BM_DaemonAddToStoreNar)
+    ->ArgsProduct({{1 << 10, 64 << 10, 1 << 20}})
+    ->ThreadRange(1, 8)
+    ->UseRealTime()
+    ->Unit(benchmark::kMicrosecond);
+
+static void BM_DaemonAddMultipleToStore(benchmark::State & state)
+{
+    auto & daemon = getDaemon();
+    const int batchSize = state.range(0);
+    auto nar = BenchDaemon::makeNar(state.range(1));
+
+    for (auto _ : state) {
+        Store::PathsSource paths;
+        for (int i = 0; i < batchSize; ++i)
+            paths.emplace_back(BenchDaemon::makeInfo(*daemon.client, nar), std::make_unique<StringSource>(nar));
+        Activity act(*logger, actUnknown);
+        daemon.client->addMultipleToStore(std::move(paths), act, NoRepair, NoCheckSigs);
+    }
+
+    state.SetItemsProcessed(state.iterations() * batchSize);
+    state.SetBytesProcessed(state.iterations() * batchSize * nar.size());
+}
+
+BENCHMARK(BM_DaemonAddMultipleToStore)
+    ->ArgsProduct({{10, 100, 1000}, {1 << 10, 64 << 10}})
+    ->UseRealTime()
+    ->Unit(benchmark::kMillisecond);
+
+static void BM_DaemonNarFromPath(benchmark::State & state)
+{
+    auto & daemon = getDaemon();
+    auto & path = daemon.payloadPaths.at(state.range(0));
+    auto narSize = daemon.localStore->queryPathInfo(path)->narSize;
+
+    for (auto _ : state) {
+        NullSink sink;
+        daemon.client->narFromPath(path, sink);
+    }
+
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(state.iterations() * narSize);
+}
+
+BENCHMARK(BM_DaemonNarFromPath)
+    ->ArgsProduct({{1 << 10, 1 << 20, 16 << 20}})
+    ->ThreadRange(1, 8)
+    ->UseRealTime()
+    ->Unit(benchmark::kMicrosecond);
+
+#endif
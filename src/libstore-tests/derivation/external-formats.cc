@@ -23,6 +23,33 @@ TEST_F(DynDerivationTest, BadATerm_oldVersionDynDeps)
         FormatError);
 }
 
+TEST_F(DerivationTest, BadATerm_unterminatedString)
+{
+    for (auto aterm : {"Derive([(\"out", "Derive([(\"out\\", "Derive([(\"out\\\""})
+        ASSERT_THROW(parseDerivation(*store, aterm, "whatever", mockXpSettings), FormatError) << aterm;
+}
+
+TEST_F(DerivationTest, ATerm_escapes)
+{
+    Derivation drv;
+    drv.name = "escapes";
+    drv.platform = "x86_64-linux";
+    drv.builder = "/bin/sh";
+    /* Put the escapes at every offset relative to the parser's 16-byte
+       blocks. */
+    for (size_t i = 0; i < 40; ++i) {
+        auto padding = std::string(i, 'x');
+        drv.env[fmt("var%02d", i)] = padding + "\"quoted\\\" \n\t\r" + padding;
+        drv.args.push_back(padding + "\\");
+    }
+
+    auto aterm = drv.unparse(*store, false);
+    auto parsed = parseDerivation(*store, std::string(aterm), drv.name, mockXpSettings);
+    ASSERT_EQ(parsed.env, drv.env);
+    ASSERT_EQ(parsed.args, drv.args);
+    ASSERT_EQ(parsed.unparse(*store, false), aterm);
+}
+
 #define MAKE_OUTPUT_JSON_TEST_P(FIXTURE)                                \
     TEST_P(FIXTURE, from_json)                                          \
     {                                                                   \
@@ -56,6 +56,86 @@ TEST(DummyStore, realisation_read)
     EXPECT_EQ(*value2, value);
 }
 
+TEST(DummyStore, queryRealisations)
+{
+    initLibStore(/*loadConfig=*/false);
+
+    auto store = [] {
+        auto cfg = make_ref<DummyStoreConfig>(StoreReference::Params{});
+        cfg->readOnly = false;
+        return cfg->openDummyStore();
+    }();
+
+    auto drvHash = Hash::parseExplicitFormatUnprefixed(
+        "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad", HashAlgorithm::SHA256, HashFormat::Base16);
+
+    UnkeyedRealisation out{
+        .outPath = StorePath{"g1w7hy3qg1w7hy3qg1w7hy3qg1w7hy3q-foo"},
+    };
+    UnkeyedRealisation dev{
+        .outPath = StorePath{"g1w7hy3qg1w7hy3qg1w7hy3qg1w7hy3q-foo-dev"},
+    };
+
+    store->buildTrace.insert({drvHash, {{"out", out}, {"dev", dev}}});
+
+    auto realisations = store->queryRealisations({{drvHash, "out"}, {drvHash, "dev"}, {drvHash, "doc"}});
+
+    EXPECT_EQ(realisations.size(), 2u);
+    EXPECT_EQ(*realisations.at({drvHash, "out"}), out);
+    EXPECT_EQ(*realisations.at({drvHash, "dev"}), dev);
+    EXPECT_FALSE(realisations.contains({drvHash, "doc"}));
+
+    EXPECT_TRUE(store->queryRealisations({}).empty());
+}
+
+TEST(DummyStore, queryMultiplePathInfos)
+{
+    initLibStore(/*loadConfig=*/false);
+
+    auto store = [] {
+        auto cfg = make_ref<DummyStoreConfig>(StoreReference::Params{});
+        cfg->readOnly = false;
+        return cfg->openDummyStore();
+    }();
+
+    auto addText = [&](std::string_view name, std::string contents, const StorePathSet & references) {
+        StringSource source{contents};
+        return store->addToStoreFromDump(
+            source,
+            name,
+            FileSerialisationMethod::Flat,
+            ContentAddressMethod::Raw::Text,
+            HashAlgorithm::SHA256,
+            references);
+    };
+
+    auto a = addText("a", "a", {});
+    auto b = addText("b", store->printStorePath(a), {a});
+    StorePath missing{"g1w7hy3qg1w7hy3qg1w7hy3qg1w7hy3q-missing"};
+
+    auto infos = store->queryMultiplePathInfos({a, b, missing});
+
+    EXPECT_EQ(infos.size(), 2u);
+    EXPECT_EQ(infos.at(b)->references, StorePathSet{a});
+    EXPECT_FALSE(infos.contains(missing));
+
+    /* The results, including the negative one, are cached. */
+    EXPECT_FALSE(store->isValidPath(missing));
+
+    StorePathSet closure;
+    store->computeFSClosure(b, closure);
+    EXPECT_EQ(closure, (StorePathSet{a, b}));
+
+    EXPECT_THROW(store->computeFSClosure(missing, closure), InvalidPath);
+
+    StorePathSet closure2;
+    auto size = store->queryClosureSize({b}, &closure2);
+    EXPECT_EQ(closure2, (StorePathSet{a, b}));
+    EXPECT_EQ(size.narSize, infos.at(a)->narSize + infos.at(b)->narSize);
+    /* Dummy store objects don't have a `.narinfo`. */
+    EXPECT_EQ(size.downloadSize, std::nullopt);
+}
+
 /* ----------------------------------------------------------------------------
  * JSON
  * --------------------------------------------------------------------------*/
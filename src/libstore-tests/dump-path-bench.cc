@@ -0,0 +1,44 @@
+#include <benchmark/benchmark.h>
+
+#include "nix/util/file-system.hh"
+#include "nix/util/hash.hh"
+#include "nix/util/posix-source-accessor.hh"
+#include "nix/util/source-path.hh"
+
+#include <filesystem>
+
+using namespace nix;
+
+/**
+ * Hash the NAR serialisation of a directory of small files, as done
+ * when importing a source tree into the store. Trees with fewer than 16
+ * files are serialised without read-ahead, so the `8` case measures the
+ * sequential per-file cost.
+ */
+static void BM_HashPathManyFiles(benchmark::State & state)
+{
+    const size_t fileCount = state.range(0);
+    const size_t fileSize = state.range(1);
+
+    auto tmpDir = createTempDir();
+    AutoDelete delTmpDir(tmpDir, true);
+
+    for (size_t i = 0; i < fileCount; ++i) {
+        auto dir = tmpDir / fmt("d%d", i / 64);
+        std::filesystem::create_directories(dir);
+        writeFile((dir / fmt("f%d", i)).string(), std::string(fileSize, 'a' + i % 26));
+    }
+
+    auto path = PosixSourceAccessor::createAtRoot(tmpDir);
+
+    for (auto _ : state) {
+        HashSink sink(HashAlgorithm::SHA256);
+        path.dumpPath(sink);
+        benchmark::DoNotOptimize(sink.finish());
+    }
+
+    state.SetItemsProcessed(state.iterations() * fileCount);
+    state.SetBytesProcessed(state.iterations() * fileCount * fileSize);
+}
+
+BENCHMARK(BM_HashPathManyFiles)->Args({8, 4096})->Args({4096, 4096})->Args({1024, 256 * 1024});
@@ -33,6 +33,13 @@ TEST(LocalStore, constructConfig_rootPath)
     EXPECT_EQ(config.rootDir.get(), std::optional{"/foo/bar"});
 }
 
+TEST(LocalStore, constructConfig_maxReadConnections)
+{
+    LocalStoreConfig config{"local", "", {{"max-read-connections", "0"}}};
+
+    EXPECT_EQ(config.maxReadConnections.get(), 0);
+}
+
 TEST(LocalStore, constructConfig_to_string)
 {
     LocalStoreConfig config{"local", "", {}};
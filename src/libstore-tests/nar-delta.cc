@@ -0,0 +1,71 @@
+#include <gtest/gtest.h>
+
+#include <random>
+
+#include "nix/store/dummy-store-impl.hh"
+#include "nix/store/globals.hh"
+#include "nix/store/nar-delta.hh"
+#include "nix/util/archive.hh"
+
+namespace nix {
+
+static std::string randomBytes(size_t size, unsigned int seed)
+{
+    std::mt19937 gen(seed);
+    std::string s(size, '\0');
+    for (auto & c : s)
+        c = gen();
+    return s;
+}
+
+TEST(NarDelta, roundTrip)
+{
+    initLibStore(/*loadConfig=*/false);
+
+    auto store = [] {
+        auto cfg = make_ref<DummyStoreConfig>(StoreReference::Params{});
+        cfg->readOnly = false;
+        return cfg->openDummyStore();
+    }();
+
+    auto oldContents = randomBytes(2 * 1024 * 1024, 1);
+    StringSource oldSource{oldContents};
+    auto base = store->addToStoreFromDump(
+        oldSource, "blob-1.0", FileSerialisationMethod::Flat, ContentAddressMethod::Raw::Flat, HashAlgorithm::SHA256);
+
+    /* A new version with a change in the middle and data appended. */
+    auto newContents = oldContents;
+    newContents.replace(1024 * 1024, 100, randomBytes(50, 2));
+    newContents += randomBytes(100 * 1024, 3);
+
+    StringSink nar;
+    dumpString(newContents, nar);
+
+    auto baseChunks = getNarChunkHashes(*store, base);
+    EXPECT_FALSE(baseChunks.empty());
+
+    StringSource narSource{nar.s};
+    StringSink delta;
+    auto bytesSaved = writeNarDelta(narSource, baseChunks, delta);
+    EXPECT_GT(bytesSaved, nar.s.size() / 2);
+    EXPECT_LT(delta.s.size(), nar.s.size() / 2);
+
+    StringSource deltaSource{delta.s};
+    StringSink reconstructed;
+    readNarDelta(*store, base, deltaSource, reconstructed);
+    EXPECT_EQ(reconstructed.s, nar.s);
+
+    /* Without a usable base, everything is sent literally. */
+    StringSource narSource2{nar.s};
+    StringSink delta2;
+    EXPECT_EQ(writeNarDelta(narSource2, {}, delta2), 0u);
+    StringSource deltaSource2{delta2.s};
+    StringSink reconstructed2;
+    readNarDelta(*store, base, deltaSource2, reconstructed2);
+    EXPECT_EQ(reconstructed2.s, nar.s);
+
+    /* Only local stores can look for a base. */
+    EXPECT_EQ(findDeltaBase(*store, base, nar.s.size()), std::nullopt);
+}
+
+} // namespace nix
@@ -0,0 +1,83 @@
+#include <benchmark/benchmark.h>
+
+#include "nix/store/nar-info.hh"
+#include "nix/store/store-api.hh"
+#include "nix/store/store-open.hh"
+
+using namespace nix;
+
+/**
+ * A NAR info with `nrRefs` references, shaped like one from
+ * cache.nixos.org.
+ */
+static NarInfo makeNarInfo(const Store & store, size_t nrRefs)
+{
+    auto narHash = hashString(HashAlgorithm::SHA256, "nar");
+    NarInfo info(store, StorePath{"g1w7hy3qg1w7hy3qg1w7hy3qg1w7hy3q-hello-2.12.1"}, narHash);
+    info.narSize = 226560;
+    info.url = "nar/" + narHash.to_string(HashFormat::Nix32, false) + ".nar.xz";
+    info.compression = "xz";
+    info.fileHash = hashString(HashAlgorithm::SHA256, "file");
+    info.fileSize = 50088;
+    info.deriver = StorePath{"g1w7hy3qg1w7hy3qg1w7hy3qg1w7hy3q-hello-2.12.1.drv"};
+    info.sigs.insert(
+        "cache.nixos.org-1:7guDbfaF2Q29HY0c5axhtuacfxN6uxuEqeUfncDiSvMSAWvfHVMppB89ILqV8FE58pEQ04tSbMnRhR3FGPV0AA==");
+    for (size_t i = 0; i < nrRefs; ++i) {
+        info.references.insert(StorePath(hashString(HashAlgorithm::SHA1, std::to_string(i)), fmt("ref-%d", i)));
+    }
+    return info;
+}
+
+static void BM_NarInfoParse(benchmark::State & state)
+{
+    auto store = openStore("dummy://");
+    auto text = makeNarInfo(*store, state.range(0)).to_string(*store);
+
+    for (auto _ : state) {
+        NarInfo info(*store, text, "bench");
+        benchmark::DoNotOptimize(info);
+    }
+    state.SetBytesProcessed(state.iterations() * text.size());
+}
+
+BENCHMARK(BM_NarInfoParse)->Arg(0)->Arg(10)->Arg(100);
+
+static void BM_NarInfoUnparse(benchmark::State & state)
+{
+    auto store = openStore("dummy://");
+    auto info = makeNarInfo(*store, state.range(0));
+
+    for (auto _ : state) {
+        auto text = info.to_string(*store);
+        benchmark::DoNotOptimize(text);
+    }
+}
+
+BENCHMARK(BM_NarInfoUnparse)->Arg(0)->Arg(10)->Arg(100);
+
+static void BM_NarInfoFromBinary(benchmark::State & state)
+{
+    auto store = openStore("dummy://");
+    auto data = makeNarInfo(*store, state.range(0)).toBinary();
+
+    for (auto _ : state) {
+        auto info = NarInfo::fromBinary(store->storeDir, data);
+        benchmark::DoNotOptimize(info);
+    }
+    state.SetBytesProcessed(state.iterations() * data.size());
+}
+
+BENCHMARK(BM_NarInfoFromBinary)->Arg(0)->Arg(10)->Arg(100);
+
+static void BM_NarInfoToBinary(benchmark::State & state)
+{
+    auto store = openStore("dummy://");
+    auto info = makeNarInfo(*store, state.range(0));
+
+    for (auto _ : state) {
+        auto data = info.toBinary();
+        benchmark::DoNotOptimize(data);
+    }
+}
+
+BENCHMARK(BM_NarInfoToBinary)->Arg(0)->Arg(10)->Arg(100);
@@ -121,4 +121,46 @@ TEST(NarInfoDiskCacheImpl, create_and_read)
     }
 }
 
+TEST(NarInfoDiskCacheImpl, upserts_are_written_back)
+{
+    auto tmpDir = createTempDir();
+    AutoDelete delTmpDir(tmpDir);
+    auto dbPath(tmpDir / "test-narinfo-disk-cache.sqlite");
+
+    StorePath path{"g1w7hy3qg1w7hy3qg1w7hy3qg1w7hy3q-foo"};
+    auto narHash = Hash::parseAnyPrefixed("sha256-FePFYIlMuycIXPZbWi7LGEiMmZSX9FMbaQenWBzm1Sc=");
+
+    {
+        auto cache = getTestNarInfoDiskCache(dbPath.string());
+        cache->createCache("http://foo", "/nix/store", true, 40);
+
+        auto info = std::make_shared<NarInfo>("/nix/store", path, narHash);
+        info->url = "nar/foo.nar.xz";
+        info->narSize = 1234;
+        cache->upsertNarInfo("http://foo", std::string(path.hashPart()), info);
+        cache->upsertNarInfo("http://foo", "00000000000000000000000000000000", nullptr);
+
+        // Answered before anything has been written to the database.
+        auto [outcome, res] = cache->lookupNarInfo("http://foo", std::string(path.hashPart()));
+        ASSERT_EQ(outcome, NarInfoDiskCache::oValid);
+        ASSERT_EQ(res->url, "nar/foo.nar.xz");
+        ASSERT_EQ(
+            cache->lookupNarInfo("http://foo", "00000000000000000000000000000000").first, NarInfoDiskCache::oInvalid);
+    }
+
+    // The pending upserts are written when the cache is destroyed.
+    auto cache2 = getTestNarInfoDiskCache(dbPath.string());
+    cache2->createCache("http://foo", "/nix/store", true, 40);
+
+    auto [outcome, res] = cache2->lookupNarInfo("http://foo", std::string(path.hashPart()));
+    ASSERT_EQ(outcome, NarInfoDiskCache::oValid);
+    ASSERT_EQ(res->path, path);
+    ASSERT_EQ(res->narHash, narHash);
+    ASSERT_EQ(res->narSize, 1234u);
+    ASSERT_EQ(res->url, "nar/foo.nar.xz");
+    ASSERT_EQ(
+        cache2->lookupNarInfo("http://foo", "00000000000000000000000000000000").first, NarInfoDiskCache::oInvalid);
+    ASSERT_EQ(cache2->lookupNarInfo("http://foo", "11111111111111111111111111111111").first, NarInfoDiskCache::oUnknown);
+}
+
 } // namespace nix
@@ -128,4 +128,64 @@ JSON_READ_TEST_V1(pure_noversion, false)
 JSON_TEST_V2(pure, false)
 JSON_TEST_V2(impure, true)
 
+class NarInfoTest : public LibStoreTest
+{};
+
+static NarInfo makeCachedNarInfo(const Store & store)
+{
+    auto info = makeNarInfo(store, true);
+    /* Not part of a `.narinfo` file. */
+    info.registrationTime = 0;
+    info.ultimate = false;
+    return info;
+}
+
+TEST_F(NarInfoTest, text_round_trip)
+{
+    auto info = makeCachedNarInfo(*store);
+    auto text = info.to_string(*store);
+    ASSERT_EQ(NarInfo(*store, text, "test"), info);
+    ASSERT_EQ(NarInfo(*store, text, "test").to_string(*store), text);
+}
+
+TEST_F(NarInfoTest, text_no_references)
+{
+    auto info = makeCachedNarInfo(*store);
+    info.ca.reset();
+    info.references.clear();
+    auto text = info.to_string(*store);
+    ASSERT_NE(text.find("\nReferences: \n"), text.npos);
+    ASSERT_EQ(NarInfo(*store, text, "test"), info);
+}
+
+TEST_F(NarInfoTest, text_corrupt)
+{
+    ASSERT_THROW(NarInfo(*store, "StorePath: /nix/store/g1w7hy3qg1w7hy3qg1w7hy3qg1w7hy3q-foo\n", "test"), Error);
+    ASSERT_THROW(NarInfo(*store, "StorePath /nix/store/g1w7hy3qg1w7hy3qg1w7hy3qg1w7hy3q-foo\n", "test"), Error);
+}
+
+TEST_F(NarInfoTest, binary_round_trip)
+{
+    auto info = makeCachedNarInfo(*store);
+    auto data = info.toBinary();
+    ASSERT_LT(data.size(), info.to_string(*store).size());
+    ASSERT_EQ(NarInfo::fromBinary(store->storeDir, data), info);
+
+    info.ca.reset();
+    info.deriver.reset();
+    info.fileHash.reset();
+    info.sigs.clear();
+    ASSERT_EQ(NarInfo::fromBinary(store->storeDir, info.toBinary()), info);
+}
+
+TEST_F(NarInfoTest, binary_corrupt)
+{
+    auto data = makeCachedNarInfo(*store).toBinary();
+    ASSERT_THROW(NarInfo::fromBinary(store->storeDir, ""), Error);
+    ASSERT_THROW(NarInfo::fromBinary(store->storeDir, data.substr(0, data.size() - 1)), Error);
+    ASSERT_THROW(NarInfo::fromBinary(store->storeDir, data + "x"), Error);
+    data[0] = 0;
+    ASSERT_THROW(NarInfo::fromBinary(store->storeDir, data), Error);
+}
+
 } // namespace nix
@@ -1,4 +1,5 @@
 #include <fstream>
+#include <future>
 
 #include <nlohmann/json.hpp>
 
@@ -7,6 +8,7 @@
 
 #include "nix/store/tests/nix_api_store.hh"
 #include "nix/store/globals.hh"
+#include "nix/store/local-store.hh"
 #include "nix/util/tests/string_callback.hh"
 #include "nix/util/tests/test-data.hh"
 #include "nix/util/url.hh"
@@ -167,6 +169,43 @@ TEST_F(nix_api_store_test, get_version)
     ASSERT_STREQ(PACKAGE_VERSION, str.c_str());
 }
 
+TEST_F(nix_api_store_test, get_build_stats)
+{
+    auto & localStore = dynamic_cast<LocalStore &>(*store->ptr);
+    localStore.recordBuildStats({
+        .drvName = "hello",
+        .drvHash = "sha256:abcd",
+        .startTime = 100,
+        .stopTime = 130,
+        .peakMemory = 1 << 20,
+        .outputSize = 4096,
+    });
+
+    std::string str;
+    auto ret = nix_store_get_build_stats(ctx, store, "hello", OBSERVE_STRING(str));
+    assert_ctx_ok();
+    ASSERT_EQ(NIX_OK, ret);
+
+    auto builds = nlohmann::json::parse(str);
+    ASSERT_EQ(builds.size(), 1u);
+    ASSERT_EQ(
+        builds[0].get<BuildStats>(),
+        (BuildStats{
+            .drvName = "hello",
+            .drvHash = "sha256:abcd",
+            .startTime = 100,
+            .stopTime = 130,
+            .peakMemory = 1 << 20,
+            .outputSize = 4096,
+        }));
+
+    ASSERT_EQ(localStore.queryBuildDuration("hello"), std::chrono::seconds(30));
+
+    str.clear();
+    nix_store_get_build_stats(ctx, store, "sha256:abcd", OBSERVE_STRING(str));
+    ASSERT_EQ(nlohmann::json::parse(str).size(), 1u);
+}
+
 TEST_F(nix_api_util_context, nix_store_open_dummy)
 {
     nix_libstore_init(ctx);
@@ -878,6 +917,74 @@ static std::string load_json_from_test_data(const char * filename)
     return buffer.str();
 }
 
+TEST_F(NixApiStoreTestWithRealisedPath, nix_store_query_path_info_async)
+{
+    std::promise<std::string> result;
+    auto * op = nix_store_query_path_info_async(
+        ctx, store, outPath, &result, [](nix_c_context * context, void * userdata, const char * json, size_t n) {
+            auto & result = *static_cast<std::promise<std::string> *>(userdata);
+            if (nix_err_code(context) == NIX_OK)
+                result.set_value(std::string(json, n));
+            else
+                result.set_exception(
+                    std::make_exception_ptr(std::runtime_error(nix_err_msg(nullptr, context, nullptr))));
+        });
+    assert_ctx_ok();
+    ASSERT_NE(op, nullptr);
+
+    auto json = nlohmann::json::parse(result.get_future().get());
+    nix_store_operation_free(op);
+
+    ASSERT_TRUE(json.contains("narHash"));
+    ASSERT_GT(json["narSize"].get<uint64_t>(), 0);
+}
+
+TEST_F(NixApiStoreTestWithRealisedPath, nix_store_is_valid_path_async)
+{
+    auto * invalidPath = nix_store_parse_path(ctx, store, (nixStoreDir + PATH_SUFFIX).c_str());
+    assert_ctx_ok();
+
+    for (auto [path, expected] : {std::pair{outPath, true}, std::pair{invalidPath, false}}) {
+        std::promise<bool> result;
+        auto * op = nix_store_is_valid_path_async(
+            ctx, store, path, &result, [](nix_c_context * context, void * userdata, bool valid) {
+                ASSERT_EQ(nix_err_code(context), NIX_OK);
+                static_cast<std::promise<bool> *>(userdata)->set_value(valid);
+            });
+        assert_ctx_ok();
+        ASSERT_EQ(result.get_future().get(), expected);
+        nix_store_operation_free(op);
+    }
+
+    nix_store_path_free(invalidPath);
+}
+
+TEST_F(NixApiStoreTestWithRealisedPath, nix_store_realise_async)
+{
+    struct Result
+    {
+        std::vector<std::string> outputs;
+        std::promise<nix_err> done;
+    } result;
+
+    auto * op = nix_store_realise_async(
+        ctx,
+        store,
+        drvPath,
+        &result,
+        [](void * userdata, const char * outname, const StorePath * out) {
+            static_cast<Result *>(userdata)->outputs.push_back(outname);
+        },
+        [](nix_c_context * context, void * userdata) {
+            static_cast<Result *>(userdata)->done.set_value(nix_err_code(context));
+        });
+    assert_ctx_ok();
+
+    ASSERT_EQ(result.done.get_future().get(), NIX_OK);
+    nix_store_operation_free(op);
+    ASSERT_EQ(result.outputs, std::vector<std::string>{"out"});
+}
+
 TEST_F(nix_api_store_test, nix_derivation_to_json_roundtrip)
 {
     // Load JSON from test data
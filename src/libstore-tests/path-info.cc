@@ -2,6 +2,7 @@
 #include <gtest/gtest.h>
 
 #include "nix/store/path-info.hh"
+#include "nix/util/signature/signer.hh"
 
 #include "nix/util/tests/characterization.hh"
 #include "nix/store/tests/libstore.hh"
@@ -149,4 +150,28 @@ TEST_F(PathInfoTestV2, PathInfo_full_shortRefs)
     ASSERT_EQ(*++refs.begin(), "n5wkd9frr45pa74if5gpz9j7mifg27fh-foo");
 }
 
+TEST_F(PathInfoTestV2, checkSignaturesBatch)
+{
+    auto secretKey = SecretKey::generate("test-1");
+    PublicKeys publicKeys;
+    publicKeys.emplace("test-1", secretKey.toPublicKey());
+    LocalSigner signer(std::move(secretKey));
+
+    ValidPathInfo signed_{StorePath{"g1w7hy3qg1w7hy3qg1w7hy3qg1w7hy3q-foo"}, makeEmpty()};
+    signed_.sign(*store, signer);
+
+    ValidPathInfo unsigned_{StorePath{"g1w7hy3qg1w7hy3qg1w7hy3qg1w7hy3q-bar"}, makeEmpty()};
+
+    /* A signature over different metadata. */
+    auto tampered = signed_;
+    tampered.narSize = 1;
+
+    std::vector<const ValidPathInfo *> infos{&signed_, &unsigned_, &tampered};
+    ASSERT_EQ(checkSignatures(*store, infos, publicKeys), (std::vector<size_t>{1, 0, 0}));
+
+    /* The second time, the good signature is found in the cache. */
+    ASSERT_EQ(checkSignatures(*store, infos, publicKeys), (std::vector<size_t>{1, 0, 0}));
+    ASSERT_EQ(signed_.checkSignatures(*store, publicKeys), 1u);
+}
+
 } // namespace nix
@@ -4,6 +4,7 @@
 #include <gtest/gtest.h>
 #include <rapidcheck/gtest.h>
 
+#include "nix/store/path-interner.hh"
 #include "nix/store/path-regex.hh"
 #include "nix/store/store-api.hh"
 
@@ -143,6 +144,35 @@ RC_GTEST_FIXTURE_PROP(StorePathTest, prop_check_regex_eq_parse, ())
 
 #endif
 
+TEST(StorePathInterner, insertAndFind)
+{
+    StorePathInterner ids;
+    StorePath foo{HASH_PART "-foo"}, bar{HASH_PART "-bar"};
+
+    ASSERT_EQ(ids.insert(foo), std::pair(StorePathId(0), true));
+    ASSERT_EQ(ids.insert(bar), std::pair(StorePathId(1), true));
+    /* Paths with the same hash part are still distinct. */
+    ASSERT_EQ(ids.insert(StorePath{foo}), std::pair(StorePathId(0), false));
+    ASSERT_EQ(ids.find(bar), StorePathId(1));
+    ASSERT_EQ(ids.find(StorePath{HASH_PART "-baz"}), std::nullopt);
+    ASSERT_EQ(ids[0], foo);
+    ASSERT_EQ(ids.size(), 2u);
+}
+
+TEST(StorePathInterner, manyPaths)
+{
+    StorePathInterner ids;
+    std::vector<StorePath> paths;
+    for (int i = 0; i < 10000; ++i)
+        paths.push_back(StorePath::random("p"));
+    for (auto & path : paths)
+        ids.insert(path);
+    for (size_t i = 0; i < paths.size(); ++i) {
+        ASSERT_EQ(ids.find(paths[i]), StorePathId(i));
+        ASSERT_EQ(ids[i], paths[i]);
+    }
+}
+
 /* ----------------------------------------------------------------------------
  * JSON
  * --------------------------------------------------------------------------*/
@@ -91,3 +91,81 @@ static void BM_RefScanSinkRandom(benchmark::State & state)
 }
 
 BENCHMARK(BM_RefScanSinkRandom)->Arg(10'000)->Arg(100'000)->Arg(1'000'000)->Arg(5'000'000)->Arg(10'000'000);
+
+// Benchmark reference scanning of text that consists mostly of base-32
+// characters, so that there are many candidates that aren't references
+static void BM_RefScanSinkText(benchmark::State & state)
+{
+    auto size = state.range();
+
+    std::mt19937 urng(0);
+    StringSet hashes;
+    std::string bytes;
+    bytes.reserve(size);
+    auto dist = std::uniform_int_distribution<std::size_t>(0, BaseNix32::characters.size() - 1);
+    while (bytes.size() < size) {
+        if (bytes.size() % 4096 == 0) {
+            std::string ref;
+            randomReference(urng, std::back_inserter(ref));
+            hashes.insert(ref);
+            bytes += ref;
+        }
+        bytes.push_back(BaseNix32::characters[dist(urng)]);
+    }
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        RefScanSink Sink{StringSet(hashes)};
+        state.ResumeTiming();
+
+        Sink(bytes);
+
+        benchmark::DoNotOptimize(Sink.getResult());
+    }
+
+    state.SetBytesProcessed(state.iterations() * size);
+}
+
+BENCHMARK(BM_RefScanSinkText)->Arg(100'000)->Arg(1'000'000)->Arg(10'000'000);
+
+// Benchmark rewriting the hash parts of many store paths at once, as
+// done when rewriting the outputs of content-addressed derivations
+static void BM_RewritingSink(benchmark::State & state)
+{
+    auto size = 10'000'000;
+    size_t nrRewrites = state.range();
+    auto chunkSize = 4199;
+
+    std::mt19937 urng(0);
+    StringSet hashes;
+    auto bytes = randomBytesWithReferences(urng, size, /*charWeight=*/100.0, hashes);
+
+    StringMap rewrites;
+    for (auto & hash : hashes) {
+        if (rewrites.size() == nrRewrites)
+            break;
+        std::string to;
+        randomReference(urng, std::back_inserter(to));
+        rewrites.emplace(hash, to);
+    }
+
+    for (auto _ : state) {
+        StringSink out;
+        out.s.reserve(size);
+        RewritingSink sink(rewrites, out);
+
+        auto data = std::string_view(bytes);
+        while (!data.empty()) {
+            auto chunk = data.substr(0, std::min<std::string_view::size_type>(chunkSize, data.size()));
+            data = data.substr(chunk.size());
+            sink(chunk);
+        }
+        sink.flush();
+
+        benchmark::DoNotOptimize(out.s);
+    }
+
+    state.SetBytesProcessed(state.iterations() * size);
+}
+
+BENCHMARK(BM_RewritingSink)->Arg(1)->Arg(10)->Arg(100)->Arg(1000);
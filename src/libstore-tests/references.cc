@@ -1,5 +1,6 @@
 #include "nix/store/references.hh"
 #include "nix/store/path-references.hh"
+#include "nix/util/file-system.hh"
 #include "nix/util/memory-source-accessor.hh"
 
 #include <gtest/gtest.h>
@@ -41,7 +42,66 @@ INSTANTIATE_TEST_CASE_P(
     ::testing::Values(
         RewriteParams{"foooo", "baroo", {{"foo", "bar"}, {"bar", "baz"}}},
         RewriteParams{"foooo", "bazoo", {{"fou", "bar"}, {"foo", "baz"}}},
-        RewriteParams{"foooo", "foooo", {}}));
+        RewriteParams{"foooo", "foooo", {}},
+        RewriteParams{"abcabc", "bcabca", {{"abc", "bca"}, {"bca", "cab"}}},
+        RewriteParams{"foobar", "xyzzy!", {{"foo", "xyz"}, {"foobar", "xyzzy!"}}},
+        RewriteParams{"aaa", "bba", {{"aa", "bb"}}}));
+
+TEST(references, rewriteAcrossFragments)
+{
+    std::string hash1 = "dc04vv14dak1c1r48qa0m23vr9jy8sm0";
+    std::string hash2 = "zc842j0rz61mjsp3h3wp5ly71ak6qgdn";
+    std::string hash3 = "a5cn2i4b83gnsm60d38l3kgb8qfplm11";
+
+    for (StringMap rewrites : {
+             StringMap{{hash1, hash2}, {hash2, hash3}},
+             StringMap{{hash1, hash2}, {"x-", "y+"}},
+         }) {
+        std::string s = "x-" + hash1 + hash2 + "0123" + hash1.substr(0, 20) + "x-" + hash1 + "e" + hash2;
+
+        /* None of the keys overlap in `s`. */
+        std::string expected;
+        for (size_t i = 0; i < s.size();) {
+            auto match = std::find_if(rewrites.begin(), rewrites.end(), [&](auto & r) {
+                return s.compare(i, r.first.size(), r.first) == 0;
+            });
+            if (match != rewrites.end()) {
+                expected += match->second;
+                i += match->first.size();
+            } else
+                expected += s[i++];
+        }
+
+        for (size_t chunkSize = 1; chunkSize <= s.size(); ++chunkSize) {
+            StringSink rewritten;
+            RewritingSink rewriter(rewrites, rewritten);
+            for (size_t i = 0; i < s.size(); i += chunkSize)
+                rewriter(std::string_view(s).substr(i, chunkSize));
+            rewriter.flush();
+            ASSERT_EQ(rewritten.s, expected) << "chunk size " << chunkSize;
+            ASSERT_EQ(rewriter.pos, s.size());
+        }
+    }
+}
+
+TEST(references, hashModuloIsIndependentOfFragments)
+{
+    std::string modulus = "dc04vv14dak1c1r48qa0m23vr9jy8sm0";
+    auto s = "foo" + modulus + "bar" + modulus + modulus.substr(0, 31);
+
+    HashSink hashSink(HashAlgorithm::SHA256);
+    hashSink(rewriteStrings(s, {{modulus, std::string(modulus.size(), 0)}}));
+    auto expected = hashSink.finish().hash;
+
+    for (size_t chunkSize = 1; chunkSize <= s.size(); ++chunkSize) {
+        HashModuloSink sink(HashAlgorithm::SHA256, modulus);
+        for (size_t i = 0; i < s.size(); i += chunkSize)
+            sink(std::string_view(s).substr(i, chunkSize));
+        auto res = sink.finish();
+        ASSERT_EQ(res.hash, expected) << "chunk size " << chunkSize;
+        ASSERT_EQ(res.numBytesDigested, s.size());
+    }
+}
 
 TEST(references, scan)
 {
@@ -81,6 +141,33 @@ TEST(references, scan)
     }
 }
 
+TEST(references, scanAtEveryOffset)
+{
+    std::string hash1 = "dc04vv14dak1c1r48qa0m23vr9jy8sm0";
+    std::string hash2 = "zc842j0rz61mjsp3h3wp5ly71ak6qgdn";
+
+    /* Place the references around the 64-byte block boundaries of the
+       scanner, surrounded by base-32 characters that aren't part of a
+       reference. */
+    for (size_t offset = 0; offset < 200; ++offset) {
+        std::string s(offset, '-');
+        for (size_t i = 0; i < offset; i += 3)
+            s[i] = 'x';
+        s += hash1 + "0" + hash2 + "e";
+
+        RefScanSink scanner(StringSet{hash1, hash2, "tooshort"});
+        scanner(s);
+        ASSERT_EQ(scanner.getResult(), StringSet({hash1, hash2})) << "offset " << offset;
+    }
+
+    {
+        RefScanSink scanner(StringSet{hash1});
+        auto s = std::string(100, '0') + hash1.substr(1) + "e";
+        scanner(s);
+        ASSERT_EQ(scanner.getResult(), StringSet{});
+    }
+}
+
 TEST(references, scanForReferencesDeep)
 {
     using File = MemorySourceAccessor::File;
@@ -222,4 +309,27 @@ TEST(references, scanForReferencesDeep)
     }
 }
 
+TEST(references, scanForReferencesWithoutNar)
+{
+    StorePath path1{"dc04vv14dak1c1r48qa0m23vr9jy8sm0-foo"};
+    StorePath path2{"zc842j0rz61mjsp3h3wp5ly71ak6qgdn-bar"};
+    StorePath path3{"a5cn2i4b83gnsm60d38l3kgb8qfplm11-baz"};
+    StorePath path4{"n7znd6v6pkd1vvcpbrs89v91d7q2rbsb-qux"};
+    StorePathSet refs{path1, path2, path3, path4};
+
+    auto tmpDir = createTempDir();
+    AutoDelete delTmpDir(tmpDir, true);
+
+    createDirs(tmpDir / "subdir");
+    writeFile(tmpDir / "file1", "foo " + std::string(path1.hashPart()) + " bar");
+    writeFile(tmpDir / "file2", "no references");
+    writeFile(tmpDir / "subdir" / "file3", std::string(100000, 'x') + std::string(path2.hashPart()));
+    writeFile(tmpDir / "subdir" / std::string(path3.hashPart()), "");
+
+    NullSink blank;
+    auto viaNar = scanForReferences(blank, tmpDir.string(), refs);
+    ASSERT_EQ(viaNar, StorePathSet({path1, path2, path3}));
+    ASSERT_EQ(scanForReferences(tmpDir.string(), refs), viaNar);
+}
+
 } // namespace nix
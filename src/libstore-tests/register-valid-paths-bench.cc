@@ -17,6 +17,8 @@ using namespace nix;
 static void BM_RegisterValidPathsDerivations(benchmark::State & state)
 {
     const int derivationCount = state.range(0);
+    /* Each derivation refers to this many of the ones created before it. */
+    const int referenceCount = state.range(1);
 
     for (auto _ : state) {
         state.PauseTiming();
@@ -31,6 +33,7 @@ static void BM_RegisterValidPathsDerivations(benchmark::State & state)
             throw Error("expected local store");
 
         ValidPathInfos infos;
+        std::vector<StorePath> drvPaths;
         for (int i = 0; i < derivationCount; ++i) {
             std::string drvName = fmt("register-valid-paths-bench-%d", i);
             auto drvPath = StorePath::random(drvName + ".drv");
@@ -56,6 +59,10 @@ static void BM_RegisterValidPathsDerivations(benchmark::State & state)
 
             ValidPathInfo info{drvPath, UnkeyedValidPathInfo(*localStore, Hash::dummy)};
             info.narSize = drvContents.size();
+            for (int j = std::max(0, i - referenceCount); j < i; ++j)
+                info.references.insert(drvPaths[j]);
+
+            drvPaths.push_back(drvPath);
 
             infos.emplace(drvPath, std::move(info));
         }
@@ -74,6 +81,6 @@ static void BM_RegisterValidPathsDerivations(benchmark::State & state)
     state.SetItemsProcessed(state.iterations() * derivationCount);
 }
 
-BENCHMARK(BM_RegisterValidPathsDerivations)->Arg(10);
+BENCHMARK(BM_RegisterValidPathsDerivations)->Args({10, 0})->Args({1000, 0})->Args({1000, 10})->Args({10000, 10});
 
 #endif
@@ -0,0 +1,59 @@
+#include <benchmark/benchmark.h>
+
+#include "nix/store/globals.hh"
+#include "nix/store/store-open.hh"
+#include "nix/util/file-system.hh"
+
+#include <filesystem>
+
+using namespace nix;
+
+/* Every `nix` invocation constructs the global settings, so this is
+   a lower bound on startup time. */
+static void BM_ConstructSettings(benchmark::State & state)
+{
+    for (auto _ : state) {
+        Settings settings;
+        benchmark::DoNotOptimize(settings);
+    }
+}
+
+BENCHMARK(BM_ConstructSettings);
+
+static void BM_ApplyConfig(benchmark::State & state)
+{
+    std::string contents;
+    for (int i = 0; i < state.range(0); ++i)
+        contents += fmt("extra-substituters = https://cache-%d.example.org\n", i);
+
+    for (auto _ : state) {
+        Settings settings;
+        settings.applyConfig(contents, "bench");
+    }
+}
+
+BENCHMARK(BM_ApplyConfig)->Arg(10)->Arg(100);
+
+#ifndef _WIN32
+
+/* Opening an existing local store, as commands that need the store do
+   right after startup. */
+static void BM_OpenLocalStore(benchmark::State & state)
+{
+    auto tmpRoot = createTempDir();
+    AutoDelete delTmpRoot(tmpRoot, true);
+    std::filesystem::create_directories(tmpRoot / "nix/store");
+    auto storeUri = fmt("local?root=%s", tmpRoot.string());
+
+    /* Create the database outside of the timed loop. */
+    openStore(storeUri);
+
+    for (auto _ : state) {
+        auto store = openStore(storeUri);
+        benchmark::DoNotOptimize(store);
+    }
+}
+
+BENCHMARK(BM_OpenLocalStore);
+
+#endif
@@ -0,0 +1,84 @@
+#include <gtest/gtest.h>
+
+#include "nix/store/store-metrics.hh"
+#include "nix/util/strings.hh"
+
+namespace nix {
+
+using namespace std::chrono_literals;
+
+TEST(LatencyHistogram, observe)
+{
+    LatencyHistogram histogram;
+    histogram.observe(100us);
+    histogram.observe(500us);
+    histogram.observe(501us);
+    histogram.observe(1h);
+    ASSERT_EQ(histogram.buckets[0], 2u);
+    ASSERT_EQ(histogram.buckets[1], 1u);
+    ASSERT_EQ(histogram.buckets.back(), 1u);
+    ASSERT_EQ(histogram.count(), 4u);
+    ASSERT_EQ(histogram.sumUs, 1101u + 3600000000u);
+}
+
+TEST(StoreMetrics, renderOpenMetrics)
+{
+    auto metrics = std::make_unique<StoreMetrics>();
+    metrics->connections = 3;
+    metrics->opLatency[26].observe(2ms);
+    metrics->opLatency[26].observe(2s);
+    metrics->opErrors[26]++;
+    metrics->storeStats.narInfoRead = 7;
+
+    auto text = renderOpenMetrics(*metrics);
+
+    ASSERT_TRUE(hasSuffix(text, "# EOF\n"));
+    ASSERT_NE(text.find("# TYPE nix_daemon_connections counter\n"), text.npos);
+    ASSERT_NE(text.find("\nnix_daemon_connections_total 3\n"), text.npos);
+    ASSERT_NE(text.find("\nnix_daemon_op_duration_seconds_bucket{op=\"26\",le=\"0.001\"} 0\n"), text.npos);
+    ASSERT_NE(text.find("\nnix_daemon_op_duration_seconds_bucket{op=\"26\",le=\"0.0025\"} 1\n"), text.npos);
+    ASSERT_NE(text.find("\nnix_daemon_op_duration_seconds_bucket{op=\"26\",le=\"+Inf\"} 2\n"), text.npos);
+    ASSERT_NE(text.find("\nnix_daemon_op_duration_seconds_sum{op=\"26\"} 2.002000\n"), text.npos);
+    ASSERT_NE(text.find("\nnix_daemon_op_duration_seconds_count{op=\"26\"} 2\n"), text.npos);
+    ASSERT_NE(text.find("\nnix_daemon_op_errors_total{op=\"26\"} 1\n"), text.npos);
+    ASSERT_NE(text.find("\nnix_store_narinfo_read_total 7\n"), text.npos);
+
+    /* Ops that weren't performed are left out. */
+    ASSERT_EQ(text.find("op=\"1\""), text.npos);
+}
+
+TEST(StoreMetrics, renderPathLocks)
+{
+    auto metrics = std::make_unique<StoreMetrics>();
+    metrics->pathLocksAcquired = 5;
+    metrics->pathLocksContended = 1;
+    metrics->pathLockWait.observe(3s);
+
+    auto text = renderOpenMetrics(*metrics);
+
+    ASSERT_NE(text.find("\nnix_path_locks_acquired_total 5\n"), text.npos);
+    ASSERT_NE(text.find("\nnix_path_locks_contended_total 1\n"), text.npos);
+    ASSERT_NE(text.find("\nnix_path_lock_wait_seconds_bucket{le=\"1\"} 0\n"), text.npos);
+    ASSERT_NE(text.find("\nnix_path_lock_wait_seconds_bucket{le=\"5\"} 1\n"), text.npos);
+    ASSERT_NE(text.find("\nnix_path_lock_wait_seconds_sum 3.000000\n"), text.npos);
+    ASSERT_NE(text.find("\nnix_path_lock_wait_seconds_count 1\n"), text.npos);
+}
+
+TEST(StoreMetrics, renderSQLite)
+{
+    auto metrics = std::make_unique<StoreMetrics>();
+    metrics->sqliteBusy = 2;
+    metrics->sqliteBusyWaits = 4;
+    metrics->sqliteBusyWaitUs = 1500000;
+    metrics->sqliteCheckpoint.observe(20ms);
+
+    auto text = renderOpenMetrics(*metrics);
+
+    ASSERT_NE(text.find("\nnix_sqlite_busy_total 2\n"), text.npos);
+    ASSERT_NE(text.find("\nnix_sqlite_busy_waits_total 4\n"), text.npos);
+    ASSERT_NE(text.find("\nnix_sqlite_busy_wait_seconds_total 1.500000\n"), text.npos);
+    ASSERT_NE(text.find("\nnix_sqlite_checkpoint_seconds_bucket{le=\"0.025\"} 1\n"), text.npos);
+    ASSERT_NE(text.find("\nnix_sqlite_checkpoint_seconds_count 1\n"), text.npos);
+}
+
+} // namespace nix
@@ -1,6 +1,7 @@
 #include "nix/util/archive.hh"
 #include "nix/store/binary-cache-store.hh"
 #include "nix/util/compression.hh"
+#include "nix/util/content-defined-chunking.hh"
 #include "nix/store/derivations.hh"
 #include "nix/util/source-accessor.hh"
 #include "nix/store/globals.hh"
@@ -13,9 +14,11 @@
 #include "nix/util/callback.hh"
 #include "nix/util/signals.hh"
 #include "nix/util/archive.hh"
+#include "nix/util/users.hh"
 
 #include <chrono>
 #include <future>
+#include <list>
 #include <regex>
 #include <fstream>
 #include <sstream>
@@ -47,8 +50,14 @@ void BinaryCacheStore::init()
 {
     auto cacheInfo = getNixCacheInfo();
     if (!cacheInfo) {
-        upsertFile(cacheInfoFile, "StoreDir: " + storeDir + "\n", "text/x-nix-cache-info");
+        upsertFile(
+            cacheInfoFile,
+            "StoreDir: " + storeDir + "\n" + (config.pathIndex ? "PathIndex: 1\n" : "")
+                + (config.bloomFilter ? "BloomFilter: 1\n" : "")
+                + (config.shardedLayout ? "ShardedLayout: 1\n" : ""),
+            "text/x-nix-cache-info");
     } else {
+        bool sharded = false;
         for (auto & line : tokenizeString<Strings>(*cacheInfo, "\n")) {
             size_t colon = line.find(':');
             if (colon == std::string::npos)
@@ -66,8 +75,22 @@ void BinaryCacheStore::init()
                 config.wantMassQuery.setDefault(value == "1");
             } else if (name == "Priority") {
                 config.priority.setDefault(std::stoi(value));
+            } else if (name == "PathIndex") {
+                config.pathIndex.setDefault(value == "1");
+            } else if (name == "BloomFilter") {
+                config.bloomFilter.setDefault(value == "1");
+            } else if (name == "ShardedLayout") {
+                sharded = value == "1";
+                config.shardedLayout.setDefault(sharded);
             }
         }
+        /* The layout can't be changed after the fact, since readers
+           would look for files in the wrong place. */
+        if (config.shardedLayout.get() != sharded)
+            throw Error(
+                "binary cache '%s' %s the sharded layout, contrary to the 'sharded-layout' setting",
+                config.getHumanReadableURI(),
+                sharded ? "uses" : "doesn't use");
     }
 }
 
@@ -116,9 +139,30 @@ std::optional<std::string> BinaryCacheStore::getFile(const std::string & path)
     return std::move(sink.s);
 }
 
+std::string BinaryCacheStore::getFileRange(const std::string & path, uint64_t offset, uint64_t length)
+{
+    auto data = getFile(path);
+    if (!data)
+        throw NoSuchBinaryCacheFile("file '%s' does not exist in binary cache", path);
+    if (offset + length > data->size())
+        throw Error("file '%s' in binary cache is shorter than expected", path);
+    return data->substr(offset, length);
+}
+
+std::string BinaryCacheStore::fileForHashPart(std::string_view hashPart, std::string_view extension)
+{
+    auto name = std::string(hashPart) + std::string(extension);
+    return config.shardedLayout ? std::string(hashPart.substr(0, 2)) + "/" + name : name;
+}
+
 std::string BinaryCacheStore::narInfoFileFor(const StorePath & storePath)
 {
-    return std::string(storePath.hashPart()) + ".narinfo";
+    return fileForHashPart(storePath.hashPart(), ".narinfo");
+}
+
+std::string BinaryCacheStore::narFileFor(const Hash & fileHash, std::string_view extension)
+{
+    return "nar/" + fileForHashPart(fileHash.to_string(HashFormat::Nix32, false), extension);
 }
 
 void BinaryCacheStore::writeNarInfo(ref<NarInfo> narInfo)
@@ -127,7 +171,13 @@ void BinaryCacheStore::writeNarInfo(ref<NarInfo> narInfo)
 
     upsertFile(narInfoFile, narInfo->to_string(*this), "text/x-nix-narinfo");
 
-    pathInfoCache->lock()->upsert(narInfo->path, PathInfoCacheValue{.value = std::shared_ptr<NarInfo>(narInfo)});
+    cachePathInfo(narInfo->path, std::shared_ptr<NarInfo>(narInfo));
+
+    if (config.pathIndex)
+        addToPathIndex(narInfo->path);
+
+    if (config.bloomFilter)
+        addToBloomFilter(narInfo->path);
 
     if (diskCache)
         diskCache->upsertNarInfo(
@@ -136,6 +186,411 @@ void BinaryCacheStore::writeNarInfo(ref<NarInfo> narInfo)
             std::shared_ptr<NarInfo>(narInfo));
 }
 
+std::string BinaryCacheStore::pathIndexShardFor(std::string_view hashPart)
+{
+    return std::string(hashPart.substr(0, 2));
+}
+
+std::optional<std::filesystem::path> BinaryCacheStore::pathIndexCacheDir()
+{
+    if (!diskCache)
+        return std::nullopt;
+    auto uri = config.getReference().render(/*FIXME withParams=*/false);
+    return getCacheDir() / "binary-cache-index" / hashString(HashAlgorithm::SHA256, uri).to_string(HashFormat::Nix32, false);
+}
+
+static std::set<std::string> parsePathIndexShard(std::string_view data)
+{
+    return tokenizeString<std::set<std::string>>(decompress("xz", data), "\n");
+}
+
+void BinaryCacheStore::fetchIndexFiles(
+    const std::string & prefix,
+    const StringSet & names,
+    std::function<void(const std::string & name, std::optional<std::string> data, bool fetched)> process)
+{
+    auto cacheDir = pathIndexCacheDir();
+    if (cacheDir)
+        *cacheDir /= prefix;
+    auto now = time(0);
+
+    Sync<size_t> left_(names.size());
+    std::condition_variable wakeup;
+
+    for (auto & name : names) {
+        auto done = [&, name](std::optional<std::string> data, bool fetched) {
+            process(name, std::move(data), fetched);
+            auto left(left_.lock());
+            if (!--*left)
+                wakeup.notify_one();
+        };
+
+        /* Use the copy from an earlier invocation if it's recent
+           enough. For the path index, an old copy can't hurt, it just
+           means that recently added paths are looked up the slow way.
+           A Bloom filter can miss recently added paths, which is the
+           same staleness that the negative narinfo cache accepts. */
+        if (cacheDir) {
+            auto cached = *cacheDir / name;
+            auto st = maybeLstat(cached);
+            if (st && st->st_mtime > now - (time_t) settings.ttlNegativeNarInfoCache) {
+                done(readFile(cached), true);
+                continue;
+            }
+        }
+
+        getFile(
+            prefix + "/" + name,
+            {[&, name, cacheDir, done](std::future<std::optional<std::string>> fut) {
+                std::optional<std::string> data;
+                bool fetched = false;
+                try {
+                    data = fut.get();
+                    fetched = true;
+                    if (data && cacheDir) {
+                        createDirs(*cacheDir);
+                        writeFile(*cacheDir / name, *data);
+                    }
+                } catch (std::exception & e) {
+                    /* The index is just an optimisation, so carry on
+                       without it. */
+                    debug("cannot fetch '%s/%s' of '%s': %s", prefix, name, config.getHumanReadableURI(), e.what());
+                }
+                done(std::move(data), fetched);
+            }});
+    }
+
+    auto left(left_.lock());
+    while (*left)
+        left.wait(wakeup);
+}
+
+void BinaryCacheStore::loadPathIndexShards(const StringSet & shards)
+{
+    StringSet missing;
+    {
+        auto pathIndexShards_(pathIndexShards.lock());
+        for (auto & shard : shards)
+            if (!pathIndexShards_->contains(shard))
+                missing.insert(shard);
+    }
+    if (missing.empty())
+        return;
+
+    fetchIndexFiles(pathIndexPrefix, missing, [&](const std::string & shard, std::optional<std::string> data, bool) {
+        std::optional<std::set<std::string>> hashParts;
+        if (data) {
+            try {
+                hashParts = parsePathIndexShard(*data);
+            } catch (Error & e) {
+                warn("ignoring corrupt path index shard '%s' of '%s'", shard, config.getHumanReadableURI());
+            }
+        }
+        pathIndexShards.lock()->insert_or_assign(shard, std::move(hashParts));
+    });
+}
+
+bool BinaryCacheStore::isInPathIndex(const StorePath & path)
+{
+    if (!config.pathIndex)
+        return false;
+    auto shard = pathIndexShardFor(path.hashPart());
+    loadPathIndexShards({shard});
+    auto pathIndexShards_(pathIndexShards.lock());
+    auto & hashParts = pathIndexShards_->at(shard);
+    return hashParts && hashParts->contains(std::string(path.hashPart()));
+}
+
+void BinaryCacheStore::addToPathIndex(const StorePath & path)
+{
+    auto shard = pathIndexShardFor(path.hashPart());
+    auto shardFile = pathIndexPrefix + "/" + shard;
+
+    /* Concurrent writers in different processes can still lose each
+       other's updates. That only makes readers fall back to fetching
+       the .narinfo of the affected paths. */
+    std::lock_guard lock(pathIndexWriteLock);
+
+    std::set<std::string> hashParts;
+    if (auto data = getFile(shardFile))
+        hashParts = parsePathIndexShard(*data);
+
+    if (!hashParts.insert(std::string(path.hashPart())).second)
+        return;
+
+    upsertFile(shardFile, compress("xz", concatStringsSep("\n", hashParts) + "\n"), "text/plain");
+
+    pathIndexShards.lock()->insert_or_assign(shard, std::move(hashParts));
+}
+
+/**
+ * A Bloom filter over the hash parts of store paths. It's serialised
+ * as a header line `nix-bloom-1 <bits> <hashes>` followed by the bit
+ * array, least significant bit first.
+ */
+struct BloomFilter
+{
+    /**
+     * About optimal for 10 bits per path.
+     */
+    static constexpr unsigned int defaultHashes = 7;
+
+    uint64_t nrBits;
+    unsigned int nrHashes;
+    std::string bits;
+
+    BloomFilter(uint64_t nrBits, unsigned int nrHashes)
+        : nrBits(nrBits)
+        , nrHashes(nrHashes)
+        , bits((nrBits + 7) / 8, 0)
+    {
+    }
+
+    static BloomFilter parse(std::string_view data)
+    {
+        auto eol = data.find('\n');
+        if (eol == data.npos)
+            throw Error("Bloom filter lacks a header");
+        auto fields = tokenizeString<std::vector<std::string>>(data.substr(0, eol), " ");
+        std::optional<uint64_t> nrBits;
+        std::optional<unsigned int> nrHashes;
+        if (fields.size() == 3 && fields[0] == "nix-bloom-1") {
+            nrBits = string2Int<uint64_t>(fields[1]);
+            nrHashes = string2Int<unsigned int>(fields[2]);
+        }
+        if (!nrBits || !*nrBits || !nrHashes || !*nrHashes)
+            throw Error("Bloom filter has an invalid header");
+        BloomFilter filter(*nrBits, *nrHashes);
+        if (data.size() - eol - 1 != filter.bits.size())
+            throw Error("Bloom filter has the wrong size");
+        filter.bits = data.substr(eol + 1);
+        return filter;
+    }
+
+    std::string to_string() const
+    {
+        return fmt("nix-bloom-1 %d %d\n", nrBits, nrHashes) + bits;
+    }
+
+    /**
+     * Call `f` on the index of every bit for `hashPart`, using double
+     * hashing on a SHA-256 hash so that the positions don't depend on
+     * the platform.
+     */
+    void forEachBit(std::string_view hashPart, auto && f) const
+    {
+        auto h = hashString(HashAlgorithm::SHA256, hashPart);
+        uint64_t h1 = 0, h2 = 0;
+        for (int i = 0; i < 8; ++i) {
+            h1 |= (uint64_t) h.hash[i] << (8 * i);
+            h2 |= (uint64_t) h.hash[8 + i] << (8 * i);
+        }
+        for (unsigned int i = 0; i < nrHashes; ++i)
+            f((h1 + i * h2) % nrBits);
+    }
+
+    bool mayContain(std::string_view hashPart) const
+    {
+        bool res = true;
+        forEachBit(hashPart, [&](uint64_t bit) {
+            if (!(bits[bit / 8] & (1 << (bit % 8))))
+                res = false;
+        });
+        return res;
+    }
+
+    /**
+     * @return Whether the filter changed.
+     */
+    bool insert(std::string_view hashPart)
+    {
+        bool changed = false;
+        forEachBit(hashPart, [&](uint64_t bit) {
+            auto mask = (char) (1 << (bit % 8));
+            if (!(bits[bit / 8] & mask)) {
+                bits[bit / 8] |= mask;
+                changed = true;
+            }
+        });
+        return changed;
+    }
+};
+
+void BinaryCacheStore::loadBloomFilterShards(const StringSet & shards)
+{
+    StringSet missing;
+    {
+        auto bloomFilterShards_(bloomFilterShards.lock());
+        for (auto & shard : shards)
+            if (!bloomFilterShards_->contains(shard))
+                missing.insert(shard);
+    }
+    if (missing.empty())
+        return;
+
+    fetchIndexFiles(
+        bloomFilterPrefix, missing, [&](const std::string & shard, std::optional<std::string> data, bool fetched) {
+            std::shared_ptr<const BloomFilter> filter;
+            if (data) {
+                try {
+                    filter = std::make_shared<const BloomFilter>(BloomFilter::parse(decompress("xz", *data)));
+                } catch (Error & e) {
+                    warn("ignoring corrupt Bloom filter shard '%s' of '%s'", shard, config.getHumanReadableURI());
+                }
+            } else if (fetched)
+                /* No path in the cache belongs to this shard. */
+                filter = std::make_shared<const BloomFilter>(1, 1);
+            bloomFilterShards.lock()->insert_or_assign(shard, std::move(filter));
+        });
+}
+
+bool BinaryCacheStore::isKnownMissing(const StorePath & path)
+{
+    if (!config.bloomFilter)
+        return false;
+    auto shard = pathIndexShardFor(path.hashPart());
+    loadBloomFilterShards({shard});
+    auto bloomFilterShards_(bloomFilterShards.lock());
+    auto & filter = bloomFilterShards_->at(shard);
+    return filter && !filter->mayContain(path.hashPart());
+}
+
+void BinaryCacheStore::addToBloomFilter(const StorePath & path)
+{
+    auto shard = pathIndexShardFor(path.hashPart());
+    auto shardFile = bloomFilterPrefix + "/" + shard;
+
+    /* As with the path index, concurrent writers in different
+       processes can lose each other's updates. Unlike there, this
+       makes the affected paths look missing to readers. */
+    std::lock_guard lock(bloomFilterWriteLock);
+
+    auto filter = std::make_shared<BloomFilter>(config.bloomFilterBits, BloomFilter::defaultHashes);
+    if (auto data = getFile(shardFile))
+        *filter = BloomFilter::parse(decompress("xz", *data));
+
+    if (filter->insert(path.hashPart()))
+        upsertFile(shardFile, compress("xz", filter->to_string()), "application/octet-stream");
+
+    bloomFilterShards.lock()->insert_or_assign(shard, std::move(filter));
+}
+
+static std::string compressionExtension(const std::string & method)
+{
+    return method == "xz"      ? ".xz"
+           : method == "bzip2" ? ".bz2"
+           : method == "zstd"  ? ".zst"
+           : method == "lzip"  ? ".lzip"
+           : method == "lz4"   ? ".lz4"
+           : method == "br"    ? ".br"
+                               : "";
+}
+
+/**
+ * `xz-seekable` produces ordinary xz files, so it only makes a
+ * difference when writing.
+ */
+static std::string narCompression(const std::string & method)
+{
+    return method == "xz-seekable" ? "xz" : method;
+}
+
+/**
+ * The amount of uncompressed data in each block of a seekable NAR.
+ * Smaller blocks make random access cheaper but compress worse.
+ */
+static constexpr uint64_t seekableBlockSize = 1024 * 1024;
+
+std::string BinaryCacheStore::chunkFileFor(std::string_view hash, const std::string & compression)
+{
+    return chunksPrefix + "/" + fileForHashPart(hash, compressionExtension(compression));
+}
+
+std::string BinaryCacheStore::writeChunk(std::string_view chunk, RepairFlag repair, uint64_t & compressedSize)
+{
+    auto hash = hashString(HashAlgorithm::SHA256, chunk).to_string(HashFormat::Nix32, false);
+    auto compression = narCompression(config.compression);
+    auto file = chunkFileFor(hash, compression);
+
+    auto compressed = compress(compression, chunk, false, config.compressionLevel);
+    compressedSize += compressed.size();
+
+    if (repair || !fileExists(file))
+        upsertFile(file, std::move(compressed), "application/octet-stream");
+
+    return hash;
+}
+
+void BinaryCacheStore::narFromChunks(const NarInfo & info, Sink & sink)
+{
+    auto chunkList = getFile(info.url);
+    if (!chunkList)
+        throw SubstituteGone("chunk list '%s' of '%s' does not exist", info.url, printStorePath(info.path));
+    if (!info.fileHash || hashString(HashAlgorithm::SHA256, *chunkList) != *info.fileHash)
+        throw Error("chunk list '%s' of '%s' has the wrong hash", info.url, printStorePath(info.path));
+
+    auto manifest = nlohmann::json::parse(*chunkList);
+    if (manifest.at("version").get<int>() != 1)
+        throw Error("chunk list '%s' has an unsupported version", info.url);
+    auto compression = manifest.at("compression").get<std::string>();
+    auto chunks = manifest.at("chunks").get<Strings>();
+
+    std::optional<std::filesystem::path> cacheDir;
+    if (config.localChunkCache != "") {
+        cacheDir = std::filesystem::path(config.localChunkCache.get());
+        createDirs(*cacheDir);
+    }
+
+    /* Fetch chunks concurrently, but only a bounded number ahead of
+       the one being written, to bound memory use. */
+    std::list<std::pair<std::string, std::future<std::optional<std::string>>>> pending;
+    auto next = chunks.begin();
+
+    auto fetchMore = [&]() {
+        for (; next != chunks.end() && pending.size() < 8; ++next) {
+            auto promise = std::make_shared<std::promise<std::optional<std::string>>>();
+            pending.emplace_back(*next, promise->get_future());
+            if (cacheDir && pathExists(*cacheDir / *next)) {
+                promise->set_value(readFile(*cacheDir / *next));
+                continue;
+            }
+            getFile(
+                chunkFileFor(*next, compression),
+                {[promise, compression](std::future<std::optional<std::string>> fut) {
+                    try {
+                        auto data = fut.get();
+                        promise->set_value(data ? std::optional(decompress(compression, *data)) : std::nullopt);
+                    } catch (...) {
+                        promise->set_exception(std::current_exception());
+                    }
+                }});
+        }
+    };
+
+    fetchMore();
+
+    while (!pending.empty()) {
+        checkInterrupt();
+        auto [hash, fut] = std::move(pending.front());
+        pending.pop_front();
+
+        auto chunk = fut.get();
+        if (!chunk)
+            throw SubstituteGone("chunk '%s' of '%s' does not exist", hash, printStorePath(info.path));
+        if (hashString(HashAlgorithm::SHA256, *chunk).to_string(HashFormat::Nix32, false) != hash)
+            throw Error("chunk '%s' of '%s' has the wrong hash", hash, printStorePath(info.path));
+
+        if (cacheDir && !pathExists(*cacheDir / hash)) {
+            auto tmp = *cacheDir / (hash + ".tmp");
+            writeFile(tmp, *chunk);
+            std::filesystem::rename(tmp, *cacheDir / hash);
+        }
+
+        fetchMore();
+        sink(*chunk);
+    }
+}
+
 ref<const ValidPathInfo> BinaryCacheStore::addToStoreCommon(
     Source & narSource, RepairFlag repair, CheckSigsFlag checkSigs, std::function<ValidPathInfo(HashResult)> mkInfo)
 {
@@ -149,15 +604,29 @@ ref<const ValidPathInfo> BinaryCacheStore::addToStoreCommon(
     HashSink fileHashSink{HashAlgorithm::SHA256};
     std::shared_ptr<SourceAccessor> narAccessor;
     HashSink narHashSink{HashAlgorithm::SHA256};
+    /* If chunking, the chunks are uploaded as they're produced instead
+       of writing a compressed NAR. */
+    Strings chunks;
+    uint64_t chunksSize = 0;
     {
         FdSink fileSink(fdTemp.get());
         TeeSink teeSinkCompressed{fileSink, fileHashSink};
-        auto compressionSink = makeCompressionSink(
-            config.compression, teeSinkCompressed, config.parallelCompression, config.compressionLevel);
-        TeeSink teeSinkUncompressed{*compressionSink, narHashSink};
+        std::shared_ptr<FinishSink> contentSink;
+        if (config.chunkNars)
+            contentSink = std::make_shared<ChunkingSink>(
+                [&](std::string_view chunk) { chunks.push_back(writeChunk(chunk, repair, chunksSize)); });
+        else if (config.compression == "xz-seekable")
+            contentSink = makeSeekableXzCompressionSink(
+                              teeSinkCompressed, seekableBlockSize, config.parallelCompression, config.compressionLevel)
+                              .get_ptr();
+        else
+            contentSink = makeCompressionSink(
+                config.compression, teeSinkCompressed, config.parallelCompression, config.compressionLevel)
+                              .get_ptr();
+        TeeSink teeSinkUncompressed{*contentSink, narHashSink};
         TeeSource teeSource{narSource, teeSinkUncompressed};
         narAccessor = makeNarAccessor(teeSource);
-        compressionSink->finish();
+        contentSink->finish();
         fileSink.flush();
     }
 
@@ -165,18 +634,30 @@ ref<const ValidPathInfo> BinaryCacheStore::addToStoreCommon(
 
     auto info = mkInfo(narHashSink.finish());
     auto narInfo = make_ref<NarInfo>(info);
-    narInfo->compression = config.compression;
     auto [fileHash, fileSize] = fileHashSink.finish();
-    narInfo->fileHash = fileHash;
-    narInfo->fileSize = fileSize;
-    narInfo->url = "nar/" + narInfo->fileHash->to_string(HashFormat::Nix32, false) + ".nar"
-                   + (config.compression == "xz"      ? ".xz"
-                      : config.compression == "bzip2" ? ".bz2"
-                      : config.compression == "zstd"  ? ".zst"
-                      : config.compression == "lzip"  ? ".lzip"
-                      : config.compression == "lz4"   ? ".lz4"
-                      : config.compression == "br"    ? ".br"
-                                                      : "");
+    if (config.chunkNars)
+        fileSize = chunksSize;
+    auto compression = narCompression(config.compression);
+    std::string chunkList;
+    if (config.chunkNars) {
+        /* The NAR is described by a JSON list of its chunks, which the
+           .narinfo points to. */
+        nlohmann::json manifest = {
+            {"version", 1},
+            {"compression", compression},
+            {"chunks", chunks},
+        };
+        chunkList = manifest.dump();
+        narInfo->compression = "chunked";
+        narInfo->fileHash = hashString(HashAlgorithm::SHA256, chunkList);
+        narInfo->fileSize = fileSize;
+        narInfo->url = narFileFor(narInfo->narHash, ".chunks");
+    } else {
+        narInfo->compression = compression;
+        narInfo->fileHash = fileHash;
+        narInfo->fileSize = fileSize;
+        narInfo->url = narFileFor(*narInfo->fileHash, ".nar" + compressionExtension(compression));
+    }
 
     auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(now2 - now1).count();
     printMsg(
@@ -200,21 +681,29 @@ ref<const ValidPathInfo> BinaryCacheStore::addToStoreCommon(
                 printStorePath(ref));
         }
 
-    /* Optionally write a JSON file containing a listing of the
-       contents of the NAR. */
+    /* Optionally write a listing of the contents of the NAR, both as
+       JSON and in binary form. The NAR accessor was built while
+       streaming the NAR above, so this doesn't need another pass. */
     if (config.writeNARListing) {
+        auto listing = listNarDeep(*narAccessor, CanonPath::root);
+
         nlohmann::json j = {
             {"version", 1},
-            {"root", listNarDeep(*narAccessor, CanonPath::root)},
+            {"root", listing},
         };
 
-        upsertFile(std::string(info.path.hashPart()) + ".ls", j.dump(), "application/json");
+        upsertFile(fileForHashPart(info.path.hashPart(), ".ls"), j.dump(), "application/json");
+
+        StringSink binaryListing;
+        writeNarListingBinary(listing, binaryListing);
+        upsertFile(
+            fileForHashPart(info.path.hashPart(), ".lsb"), std::move(binaryListing.s), "application/octet-stream");
     }
 
     /* Optionally maintain an index of DWARF debug info files
        consisting of JSON files named 'debuginfo/<build-id>' that
        specify the NAR file and member containing the debug info. */
-    if (config.writeDebugInfo) {
+    if (config.writeDebugInfo && !config.chunkNars) {
 
         CanonPath buildIdDir("lib/debug/.build-id");
 
@@ -268,7 +757,10 @@ ref<const ValidPathInfo> BinaryCacheStore::addToStoreCommon(
     }
 
     /* Atomically write the NAR file. */
-    if (repair || !fileExists(narInfo->url)) {
+    if (config.chunkNars) {
+        stats.narWrite++;
+        upsertFile(narInfo->url, std::move(chunkList), "application/json");
+    } else if (repair || !fileExists(narInfo->url)) {
         FdSource source{fdTemp.get()};
         source.restart(); /* Seek back to the start of the file. */
         stats.narWrite++;
@@ -294,8 +786,9 @@ void BinaryCacheStore::addToStore(
     const ValidPathInfo & info, Source & narSource, RepairFlag repair, CheckSigsFlag checkSigs)
 {
     if (!repair && isValidPath(info.path)) {
-        // FIXME: copyNAR -> null sink
-        narSource.drain();
+        /* Skip the NAR without accumulating it in memory. */
+        NullSink sink;
+        narSource.drainInto(sink);
         return;
     }
 
@@ -318,7 +811,9 @@ StorePath BinaryCacheStore::addToStoreFromDump(
     RepairFlag repair)
 {
     std::optional<Hash> caHash;
-    std::string nar;
+
+    /* The NAR to upload, if it's not `dump` itself. */
+    std::unique_ptr<Source> narDump;
 
     // Calculating Git hash from NAR stream not yet implemented. May not
     // be possible to implement in single-pass if the NAR is in an
@@ -337,27 +832,21 @@ StorePath BinaryCacheStore::addToStoreFromDump(
         switch (dumpMethod) {
         case FileSerialisationMethod::NixArchive:
             // The dump is already NAR in this case, just use it.
-            nar = dump2.s;
             break;
-        case FileSerialisationMethod::Flat: {
+        case FileSerialisationMethod::Flat:
             // The dump is Flat, so we need to convert it to NAR with a
-            // single file.
-            StringSink s;
-            dumpString(dump2.s, s);
-            nar = std::move(s.s);
+            // single file. Do that while uploading rather than making
+            // another copy of the contents.
+            narDump = sinkToSource([&](Sink & sink) { dumpString(dump2.s, sink); });
             break;
         }
-        }
     } else {
         // Otherwise, we have to do th same hashing as NAR so our single
         // hash will suffice for both purposes.
         if (dumpMethod != FileSerialisationMethod::NixArchive || hashAlgo != HashAlgorithm::SHA256)
             unsupported("addToStoreFromDump");
     }
-    StringSource narDump{nar};
-
-    // Use `narDump` if we wrote to `nar`.
-    Source & narDump2 = nar.size() > 0 ? static_cast<Source &>(narDump) : dump;
+    Source & narDump2 = narDump ? *narDump : dump;
 
     return addToStoreCommon(
                narDump2,
@@ -385,12 +874,57 @@ StorePath BinaryCacheStore::addToStoreFromDump(
 
 bool BinaryCacheStore::isValidPathUncached(const StorePath & storePath)
 {
+    if (isInPathIndex(storePath))
+        return true;
+
+    if (isKnownMissing(storePath)) {
+        stats.narInfoReadAverted++;
+        return false;
+    }
+
     // FIXME: this only checks whether a .narinfo with a matching hash
     // part exists. So ‘f4kb...-foo’ matches ‘f4kb...-bar’, even
     // though they shouldn't. Not easily fixed.
     return fileExists(narInfoFileFor(storePath));
 }
 
+StorePathSet BinaryCacheStore::queryValidPaths(const StorePathSet & paths, SubstituteFlag maybeSubstitute)
+{
+    if (!config.pathIndex && !config.bloomFilter)
+        return Store::queryValidPaths(paths, maybeSubstitute);
+
+    StringSet shards;
+    for (auto & path : paths)
+        shards.insert(pathIndexShardFor(path.hashPart()));
+    if (config.pathIndex)
+        loadPathIndexShards(shards);
+    if (config.bloomFilter)
+        loadBloomFilterShards(shards);
+
+    StorePathSet valid, unknown;
+    size_t nrMissing = 0;
+    for (auto & path : paths) {
+        if (isInPathIndex(path))
+            valid.insert(path);
+        else if (isKnownMissing(path))
+            nrMissing++;
+        else
+            unknown.insert(path);
+    }
+
+    debug(
+        "indexes of '%s' know %d of %d paths and rule out %d",
+        config.getHumanReadableURI(),
+        valid.size(),
+        paths.size(),
+        nrMissing);
+
+    if (!unknown.empty())
+        valid.merge(Store::queryValidPaths(unknown, maybeSubstitute));
+
+    return valid;
+}
+
 std::optional<StorePath> BinaryCacheStore::queryPathFromHashPart(const std::string & hashPart)
 {
     auto pseudoPath = StorePath(hashPart + "-" + MissingName);
@@ -419,6 +953,11 @@ void BinaryCacheStore::narFromPath(const StorePath & storePath, Sink & sink)
             stats.narReadBytes += narSize;
         }};
 
+    if (info->compression == "chunked") {
+        narFromChunks(*info, uncompressedSink);
+        return;
+    }
+
     auto decompressor = makeDecompressionSink(info->compression, uncompressedSink);
 
     try {
@@ -445,6 +984,15 @@ void BinaryCacheStore::queryPathInfoUncached(
         Logger::Fields{storePathS, uri});
     PushActivity pact(act->id);
 
+    try {
+        if (isKnownMissing(storePath)) {
+            stats.narInfoReadAverted++;
+            return callback({});
+        }
+    } catch (...) {
+        return callback.rethrow();
+    }
+
     auto narInfoFile = narInfoFileFor(storePath);
 
     auto callbackPtr = std::make_shared<decltype(callback)>(std::move(callback));
@@ -96,6 +96,24 @@ void adl_serializer<BuildResult>::to_json(json & res, const BuildResult & br)
     if (br.cpuSystem.has_value()) {
         res["cpuSystem"] = br.cpuSystem->count();
     }
+    if (br.peakMemory.has_value()) {
+        res["peakMemory"] = *br.peakMemory;
+    }
+    if (br.ioRead.has_value()) {
+        res["ioRead"] = *br.ioRead;
+    }
+    if (br.ioWrite.has_value()) {
+        res["ioWrite"] = *br.ioWrite;
+    }
+    if (br.cpuStall.has_value()) {
+        res["cpuStall"] = br.cpuStall->count();
+    }
+    if (br.memoryStall.has_value()) {
+        res["memoryStall"] = br.memoryStall->count();
+    }
+    if (br.ioStall.has_value()) {
+        res["ioStall"] = br.ioStall->count();
+    }
 
     // Handle success or failure variant
     std::visit(
@@ -132,6 +150,24 @@ BuildResult adl_serializer<BuildResult>::from_json(const json & _json)
     if (auto cpuSystem = optionalValueAt(json, "cpuSystem")) {
         br.cpuSystem = std::chrono::microseconds(getUnsigned(*cpuSystem));
     }
+    if (auto peakMemory = optionalValueAt(json, "peakMemory")) {
+        br.peakMemory = getUnsigned(*peakMemory);
+    }
+    if (auto ioRead = optionalValueAt(json, "ioRead")) {
+        br.ioRead = getUnsigned(*ioRead);
+    }
+    if (auto ioWrite = optionalValueAt(json, "ioWrite")) {
+        br.ioWrite = getUnsigned(*ioWrite);
+    }
+    if (auto cpuStall = optionalValueAt(json, "cpuStall")) {
+        br.cpuStall = std::chrono::microseconds(getUnsigned(*cpuStall));
+    }
+    if (auto memoryStall = optionalValueAt(json, "memoryStall")) {
+        br.memoryStall = std::chrono::microseconds(getUnsigned(*memoryStall));
+    }
+    if (auto ioStall = optionalValueAt(json, "ioStall")) {
+        br.ioStall = std::chrono::microseconds(getUnsigned(*ioStall));
+    }
 
     // Determine success or failure based on success field
     bool success = getBoolean(valueAt(json, "success"));
@@ -0,0 +1,45 @@
+#include "nix/store/build-stats.hh"
+#include "nix/util/json-utils.hh"
+
+namespace nlohmann {
+
+using namespace nix;
+
+void adl_serializer<BuildStats>::to_json(json & res, const BuildStats & stats)
+{
+    res = json::object();
+    res["drvName"] = stats.drvName;
+    res["drvHash"] = stats.drvHash;
+    res["machine"] = stats.machine;
+    res["startTime"] = stats.startTime;
+    res["stopTime"] = stats.stopTime;
+    if (stats.cpuUser)
+        res["cpuUser"] = stats.cpuUser->count();
+    if (stats.cpuSystem)
+        res["cpuSystem"] = stats.cpuSystem->count();
+    if (stats.peakMemory)
+        res["peakMemory"] = *stats.peakMemory;
+    res["outputSize"] = stats.outputSize;
+}
+
+BuildStats adl_serializer<BuildStats>::from_json(const json & _json)
+{
+    auto & json = getObject(_json);
+
+    BuildStats stats;
+    stats.drvName = getString(valueAt(json, "drvName"));
+    stats.drvHash = getString(valueAt(json, "drvHash"));
+    stats.machine = getString(valueAt(json, "machine"));
+    stats.startTime = getUnsigned(valueAt(json, "startTime"));
+    stats.stopTime = getUnsigned(valueAt(json, "stopTime"));
+    if (auto cpuUser = optionalValueAt(json, "cpuUser"))
+        stats.cpuUser = std::chrono::microseconds(getUnsigned(*cpuUser));
+    if (auto cpuSystem = optionalValueAt(json, "cpuSystem"))
+        stats.cpuSystem = std::chrono::microseconds(getUnsigned(*cpuSystem));
+    if (auto peakMemory = optionalValueAt(json, "peakMemory"))
+        stats.peakMemory = getUnsigned(*peakMemory);
+    stats.outputSize = getUnsigned(valueAt(json, "outputSize"));
+    return stats;
+}
+
+} // namespace nlohmann
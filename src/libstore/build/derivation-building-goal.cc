@@ -1,18 +1,24 @@
 #include "nix/store/build/derivation-building-goal.hh"
+#include "nix/store/store-metrics.hh"
 #include "nix/store/build/derivation-env-desugar.hh"
 #ifndef _WIN32 // TODO enable build hook on Windows
 #  include "nix/store/build/hook-instance.hh"
 #  include "nix/store/build/derivation-builder.hh"
+#  include "nix/store/build/jobserver.hh"
+#  include "nix/store/build/remote-builders.hh"
 #endif
 #include "nix/util/processes.hh"
 #include "nix/util/config-global.hh"
 #include "nix/store/build/worker.hh"
 #include "nix/util/util.hh"
 #include "nix/util/compression.hh"
+#include "nix/util/background-sink.hh"
+#include "nix/util/finally.hh"
 #include "nix/store/common-protocol.hh"
 #include "nix/store/common-protocol-impl.hh"
 #include "nix/store/local-store.hh" // TODO remove, along with remaining downcasts
 #include "nix/store/globals.hh"
+#include "nix/store/store-open.hh"
 
 #include <fstream>
 #include <sys/types.h>
@@ -29,7 +35,7 @@ DerivationBuildingGoal::DerivationBuildingGoal(
     const StorePath & drvPath, const Derivation & drv, Worker & worker, BuildMode buildMode, bool storeDerivation)
     : Goal(worker, gaveUpOnSubstitution(storeDerivation))
     , drvPath(drvPath)
-    , drv{std::make_unique<Derivation>(drv)}
+    , drv{worker.shareDerivation(drvPath, drv)}
     , buildMode(buildMode)
 {
     name = fmt("building derivation '%s'", worker.store.printStorePath(drvPath));
@@ -64,6 +70,9 @@ void DerivationBuildingGoal::killChild()
 {
 #ifndef _WIN32 // TODO enable build hook on Windows
     hook.reset();
+    /* There is no way to cancel a remote build, so this waits for it
+       to finish. */
+    remoteBuild.reset();
 #endif
 #ifndef _WIN32 // TODO enable `DerivationBuilder` on Windows
     if (builder && builder->killChild())
@@ -255,10 +264,8 @@ Goal::Co DerivationBuildingGoal::tryToBuild()
                 : buildMode == bmCheck ? "checking outputs of '%s'"
                                        : "building '%s'",
                 worker.store.printStorePath(drvPath));
-#ifndef _WIN32 // TODO enable build hook on Windows
-        if (hook)
-            msg += fmt(" on '%s'", hook->machineName);
-#endif
+        if (auto machine = machineName(); !machine.empty())
+            msg += fmt(" on '%s'", machine);
         act = std::make_unique<Activity>(
             *logger,
             lvlInfo,
@@ -266,10 +273,7 @@ Goal::Co DerivationBuildingGoal::tryToBuild()
             msg,
             Logger::Fields{
                 worker.store.printStorePath(drvPath),
-#ifndef _WIN32 // TODO enable build hook on Windows
-                hook ? hook->machineName :
-#endif
-                     "",
+                machineName(),
                 1,
                 1});
         mcRunningBuilds = std::make_unique<MaintainCount<uint64_t>>(worker.runningBuilds);
@@ -322,11 +326,19 @@ Goal::Co DerivationBuildingGoal::tryToBuild()
             Activity act(
                 *logger, lvlWarn, actBuildWaiting, fmt("waiting for lock on %s", Magenta(showPaths(lockFiles))));
 
+            auto start = std::chrono::steady_clock::now();
+
             /* Wait then try locking again, repeat until success (returned
                boolean is true). */
             do {
-                co_await waitForAWhile();
+                co_await waitForLocks(lockFiles);
             } while (!outputLocks.lockPaths(lockFiles, "", false));
+
+            if (auto metrics = getStoreMetrics()) {
+                metrics->pathLocksContended++;
+                metrics->pathLockWait.observe(
+                    std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start));
+            }
         }
 
         /* Now check again whether the outputs are valid.  This is because
@@ -451,7 +463,7 @@ Goal::Co DerivationBuildingGoal::tryToBuild()
         }
 
 #ifndef _WIN32
-        assert(hook);
+        assert(hook || remoteBuild);
 #endif
 
         trace("hook build done");
@@ -462,9 +474,23 @@ Goal::Co DerivationBuildingGoal::tryToBuild()
            kill it. */
         int status =
 #ifndef _WIN32 // TODO enable build hook on Windows
-            hook->pid.kill();
-#else
-            0;
+            hook ? hook->pid.kill() :
+#endif
+                 0;
+
+        std::optional<BuildError> remoteError;
+#ifndef _WIN32 // TODO enable build hook on Windows
+        if (remoteBuild) {
+            try {
+                /* Make the log of the remote build available to `nix
+                   log`. */
+                if (auto log = remoteBuild->wait(); log && logSink)
+                    (*logSink)(*log);
+            } catch (Error & e) {
+                remoteError = BuildError(BuildResult::Failure::MiscFailure, e.msg());
+            }
+            remoteBuild.reset();
+        }
 #endif
 
         debug("build hook for '%s' finished", worker.store.printStorePath(drvPath));
@@ -477,13 +503,20 @@ Goal::Co DerivationBuildingGoal::tryToBuild()
 
         /* Close the read side of the logger pipe. */
 #ifndef _WIN32 // TODO enable build hook on Windows
-        hook->builderOut.readSide.close();
-        hook->fromHook.readSide.close();
+        if (hook) {
+            hook->builderOut.readSide.close();
+            hook->fromHook.readSide.close();
+        }
 #endif
 
         /* Close the log file. */
         closeLogFile();
 
+        if (remoteError) {
+            outputLocks.unlock();
+            co_return doneFailure(std::move(*remoteError));
+        }
+
         /* Check the exit status. */
         if (!statusOk(status)) {
             auto e = fixupBuilderFailureErrorMessage({BuildResult::Failure::MiscFailure, status, ""});
@@ -519,6 +552,7 @@ Goal::Co DerivationBuildingGoal::tryToBuild()
         for (auto & [_, output] : builtOutputs)
             outputPaths.insert(output.outPath);
         runPostBuildHook(worker.store, *logger, drvPath, outputPaths);
+        uploadOutputs(builtOutputs);
 
         /* It is now safe to delete the lock files, since all future
            lockers will see that the output paths are valid; they will
@@ -553,7 +587,13 @@ Goal::Co DerivationBuildingGoal::tryToBuild()
     while (true) {
 
         unsigned int curBuilds = worker.getNrLocalBuilds();
-        if (curBuilds >= settings.maxBuildJobs) {
+        if (curBuilds >= settings.maxBuildJobs || !worker.admitBuild(*this)) {
+            if (curBuilds < settings.maxBuildJobs && !actLock)
+                actLock = std::make_unique<Activity>(
+                    *logger,
+                    lvlInfo,
+                    actBuildWaiting,
+                    fmt("waiting for memory to build '%s'", Magenta(worker.store.printStorePath(drvPath))));
             outputLocks.unlock();
             co_await waitForBuildSlot();
             co_return tryToBuild();
@@ -636,6 +676,11 @@ Goal::Co DerivationBuildingGoal::tryToBuild()
                 .desugaredEnv = std::move(desugaredEnv),
             };
 
+            if (auto jobserver = worker.getJobserver()) {
+                params.jobserverFifo = jobserver->getFifo();
+                params.jobserverMakeFlags = jobserver->makeFlags();
+            }
+
             /* If we have to wait and retry (see below), then `builder` will
                already be created, so we don't need to create it again. */
             builder = externalBuilder ? makeExternalDerivationBuilder(
@@ -687,6 +732,10 @@ Goal::Co DerivationBuildingGoal::tryToBuild()
 
     trace("build done");
 
+    /* The resource usage is known once the sandbox has been torn
+       down by unprepareBuild(), whether or not the build succeeded. */
+    Finally reportResources([&]() { reportBuildResources(); });
+
     SingleDrvOutputs builtOutputs;
     try {
         builtOutputs = builder->unprepareBuild();
@@ -736,6 +785,7 @@ Goal::Co DerivationBuildingGoal::tryToBuild()
             outputPaths.insert(output.outPath);
         }
         runPostBuildHook(worker.store, *logger, drvPath, outputPaths);
+        uploadOutputs(builtOutputs);
 
         /* It is now safe to delete the lock files, since all future
            lockers will see that the output paths are valid; they will
@@ -748,6 +798,33 @@ Goal::Co DerivationBuildingGoal::tryToBuild()
 #endif
 }
 
+void DerivationBuildingGoal::uploadOutputs(const SingleDrvOutputs & builtOutputs)
+{
+    if (settings.uploadOutputsTo.get().empty())
+        return;
+
+    if (!worker.uploadStore)
+        worker.uploadStore = openStore(settings.uploadOutputsTo.get()).get_ptr();
+
+    StorePathSet outputPaths;
+    for (auto & [_, output] : builtOutputs)
+        outputPaths.insert(output.outPath);
+
+    Activity act(
+        *logger,
+        lvlTalkative,
+        actUnknown,
+        fmt("copying outputs of '%s' to '%s'",
+            worker.store.printStorePath(drvPath),
+            worker.uploadStore->config.getHumanReadableURI()));
+
+    copyClosure(worker.store, *worker.uploadStore, outputPaths);
+
+    if (experimentalFeatureSettings.isEnabled(Xp::CaDerivations) && !drv->type().hasKnownOutputPaths())
+        for (auto & [_, realisation] : builtOutputs)
+            worker.uploadStore->registerDrvOutput(realisation);
+}
+
 static void runPostBuildHook(
     const StoreDirConfig & store, Logger & logger, const StorePath & drvPath, const StorePathSet & outputPaths)
 {
@@ -846,6 +923,21 @@ BuildError DerivationBuildingGoal::fixupBuilderFailureErrorMessage(BuilderFailur
     return BuildError{e.status, msg};
 }
 
+/**
+ * The outputs that a remote build has to copy back.
+ */
+static StringSet getMissingOutputs(BuildMode buildMode, const std::map<std::string, InitialOutput> & initialOutputs)
+{
+    StringSet missingOutputs;
+    for (auto & [outputName, status] : initialOutputs) {
+        // XXX: Does this include known CA outputs?
+        if (buildMode != bmCheck && status.known && status.known->isValid())
+            continue;
+        missingOutputs.insert(outputName);
+    }
+    return missingOutputs;
+}
+
 HookReply DerivationBuildingGoal::tryBuildHook(
     const std::map<std::string, InitialOutput> & initialOutputs, const DerivationOptions<StorePath> & drvOptions)
 {
@@ -854,7 +946,13 @@ HookReply DerivationBuildingGoal::tryBuildHook(
 #else
     /* This should use `worker.evalStore`, but per #13179 the build hook
        doesn't work with eval store anyways. */
-    if (settings.buildHook.get().empty() || !worker.tryBuildHook || !worker.store.isValidPath(drvPath))
+    if (!worker.tryBuildHook || !worker.store.isValidPath(drvPath))
+        return rpDecline;
+
+    if (settings.inProcessBuilders)
+        return tryRemoteBuilders(initialOutputs, drvOptions);
+
+    if (settings.buildHook.get().empty())
         return rpDecline;
 
     if (!worker.hook)
@@ -929,16 +1027,7 @@ HookReply DerivationBuildingGoal::tryBuildHook(
 
     /* Tell the hooks the missing outputs that have to be copied back
        from the remote system. */
-    {
-        StringSet missingOutputs;
-        for (auto & [outputName, status] : initialOutputs) {
-            // XXX: Does this include known CA outputs?
-            if (buildMode != bmCheck && status.known && status.known->isValid())
-                continue;
-            missingOutputs.insert(outputName);
-        }
-        CommonProto::write(worker.store, conn, missingOutputs);
-    }
+    CommonProto::write(worker.store, conn, getMissingOutputs(buildMode, initialOutputs));
 
     hook->sink = FdSink();
     hook->toHook.writeSide.close();
@@ -955,6 +1044,60 @@ HookReply DerivationBuildingGoal::tryBuildHook(
 #endif
 }
 
+HookReply DerivationBuildingGoal::tryRemoteBuilders(
+    const std::map<std::string, InitialOutput> & initialOutputs, const DerivationOptions<StorePath> & drvOptions)
+{
+#ifdef _WIN32 // TODO enable build hook on Windows
+    return rpDecline;
+#else
+    if (!worker.remoteBuilders)
+        worker.remoteBuilders = std::make_unique<RemoteBuilders>();
+
+    /* It would be possible to build locally after some builds clear
+       out, so don't complain about the missing machines now. */
+    bool couldBuildLocally = settings.maxBuildJobs > 0 && drvOptions.canBuildLocally(worker.store, *drv);
+
+    switch (worker.remoteBuilders->tryAcquire(
+        worker.store,
+        drv->platform,
+        drvOptions.getRequiredSystemFeatures(*drv),
+        couldBuildLocally && worker.getNrLocalBuilds() < settings.maxBuildJobs,
+        couldBuildLocally,
+        drvPath,
+        inputPaths,
+        remoteBuild)) {
+    case RemoteBuilders::Reply::Accept:
+        break;
+    case RemoteBuilders::Reply::Postpone:
+        return rpPostpone;
+    case RemoteBuilders::Reply::Decline:
+        return rpDecline;
+    case RemoteBuilders::Reply::DeclinePermanently:
+        worker.tryBuildHook = false;
+        return rpDecline;
+    }
+
+    remoteBuild->start(worker.store, drvPath, drv, inputPaths, getMissingOutputs(buildMode, initialOutputs));
+
+    [[maybe_unused]] Path logFile = openLogFile();
+
+    worker.childStarted(shared_from_this(), {remoteBuild->done.readSide.get()}, false, false);
+
+    return rpAccept;
+#endif
+}
+
+std::string DerivationBuildingGoal::machineName()
+{
+#ifndef _WIN32 // TODO enable build hook on Windows
+    if (hook)
+        return hook->machineName;
+    if (remoteBuild)
+        return remoteBuild->machineName;
+#endif
+    return "";
+}
+
 Path DerivationBuildingGoal::openLogFile()
 {
     logSize = 0;
@@ -973,7 +1116,18 @@ Path DerivationBuildingGoal::openLogFile()
     Path dir = fmt("%s/%s/%s/", logDir, LocalFSStore::drvsLogDir, baseName.substr(0, 2));
     createDirs(dir);
 
-    Path logFileName = fmt("%s/%s%s", dir, baseName.substr(2), settings.compressLog ? ".bz2" : "");
+    std::string logCompression = settings.compressLog ? settings.logCompression.get() : "none";
+    const char * extension;
+    if (logCompression == "none")
+        extension = "";
+    else if (logCompression == "bzip2")
+        extension = ".bz2";
+    else if (logCompression == "zstd")
+        extension = ".zst";
+    else
+        throw UsageError("unsupported build log compression method '%s'", logCompression);
+
+    Path logFileName = fmt("%s/%s%s", dir, baseName.substr(2), extension);
 
     fdLogFile = toDescriptor(open(
         logFileName.c_str(),
@@ -988,22 +1142,31 @@ Path DerivationBuildingGoal::openLogFile()
 
     logFileSink = std::make_shared<FdSink>(fdLogFile.get());
 
-    if (settings.compressLog)
-        logSink = std::shared_ptr<CompressionSink>(makeCompressionSink(CompressionAlgo::bzip2, *logFileSink));
-    else
-        logSink = logFileSink;
+    if (logCompression != "none")
+        logCompressionSink = makeCompressionSink(logCompression, *logFileSink).get_ptr();
+
+    logSink = std::make_shared<BackgroundSink>(
+        logCompressionSink ? static_cast<Sink &>(*logCompressionSink) : static_cast<Sink &>(*logFileSink));
 
     return logFileName;
 }
 
 void DerivationBuildingGoal::closeLogFile()
 {
-    auto logSink2 = std::dynamic_pointer_cast<CompressionSink>(logSink);
-    if (logSink2)
-        logSink2->finish();
+    if (logLinesDropped && act) {
+        act->result(resBuildLogLine, fmt("(%d lines of build output not shown)", logLinesDropped));
+        logLinesDropped = 0;
+    }
+
+    if (logSink)
+        logSink->finish();
+    if (logCompressionSink)
+        logCompressionSink->finish();
     if (logFileSink)
         logFileSink->flush();
-    logSink = logFileSink = 0;
+    logSink = nullptr;
+    logCompressionSink = nullptr;
+    logFileSink = nullptr;
     fdLogFile.close();
 }
 
@@ -1031,16 +1194,21 @@ Goal::Co DerivationBuildingGoal::processChildOutput(Descriptor fd, std::string_v
                 settings.maxLogSize));
         }
 
-        for (auto c : data)
-            if (c == '\r')
+        /* Copy the text between line breaks in chunks rather than
+           character by character. */
+        for (auto rest = data; !rest.empty();) {
+            auto end = rest.find_first_of("\r\n");
+            auto chunk = rest.substr(0, end);
+            currentLogLine.replace(currentLogLinePos, chunk.size(), chunk);
+            currentLogLinePos += chunk.size();
+            if (end == rest.npos)
+                break;
+            if (rest[end] == '\r')
                 currentLogLinePos = 0;
-            else if (c == '\n')
+            else
                 flushLine();
-            else {
-                if (currentLogLinePos >= currentLogLine.size())
-                    currentLogLine.resize(currentLogLinePos + 1);
-                currentLogLine[currentLogLinePos++] = c;
-            }
+            rest = rest.substr(end + 1);
+        }
 
         if (logSink)
             (*logSink)(data);
@@ -1094,7 +1262,21 @@ void DerivationBuildingGoal::flushLine()
         if (logTail.size() > settings.logLines)
             logTail.pop_front();
 
-        act->result(resBuildLogLine, currentLogLine);
+        if (auto limit = settings.logLinesPerSecond.get()) {
+            auto now = std::chrono::steady_clock::now();
+            if (now - logLinesSecond >= std::chrono::seconds(1)) {
+                if (logLinesDropped)
+                    act->result(resBuildLogLine, fmt("(%d lines of build output not shown)", logLinesDropped));
+                logLinesSecond = now;
+                logLinesInSecond = 0;
+                logLinesDropped = 0;
+            }
+            if (logLinesInSecond++ < limit)
+                act->result(resBuildLogLine, currentLogLine);
+            else
+                logLinesDropped++;
+        } else
+            act->result(resBuildLogLine, currentLogLine);
     }
 
     currentLogLine = "";
@@ -1193,14 +1375,109 @@ Goal::Done DerivationBuildingGoal::doneSuccess(BuildResult::Success::Status stat
 
     mcRunningBuilds.reset();
 
-    if (status == BuildResult::Success::Built)
+    if (status == BuildResult::Success::Built) {
         worker.doneBuilds++;
+        recordBuildStats();
+    }
 
     worker.updateProgress();
 
     return amDone(ecSuccess, std::nullopt);
 }
 
+void DerivationBuildingGoal::recordBuildStats()
+{
+    auto localStore = dynamic_cast<LocalStore *>(&worker.store);
+    if (!localStore || !buildResult.startTime || buildResult.stopTime < buildResult.startTime)
+        return;
+
+    try {
+        auto success = buildResult.tryGetSuccess();
+        assert(success);
+
+        BuildStats stats{
+            .drvName = drv->name,
+            .startTime = buildResult.startTime,
+            .stopTime = buildResult.stopTime,
+            .cpuUser = buildResult.cpuUser,
+            .cpuSystem = buildResult.cpuSystem,
+            .peakMemory = buildResult.peakMemory,
+        };
+
+        auto drvHash = hashDerivationModulo(worker.evalStore, *drv, true);
+        if (!drvHash.hashes.empty())
+            stats.drvHash = drvHash.hashes.begin()->second.to_string(HashFormat::Base16, true);
+
+        stats.machine = machineName();
+
+        for (auto & [_, output] : success->builtOutputs)
+            stats.outputSize += worker.store.queryPathInfo(output.outPath)->narSize;
+
+        localStore->recordBuildStats(stats);
+    } catch (...) {
+        ignoreExceptionExceptInterrupt();
+    }
+}
+
+void DerivationBuildingGoal::reportBuildResources()
+{
+    if (!act)
+        return;
+
+    try {
+        nlohmann::json result = buildResult;
+        auto resources = nlohmann::json::object();
+        for (auto key : {"cpuUser", "cpuSystem", "peakMemory", "ioRead", "ioWrite", "cpuStall", "memoryStall", "ioStall"})
+            if (auto i = result.find(key); i != result.end())
+                resources[key] = *i;
+        if (!resources.empty())
+            act->result(resBuildResources, resources.dump());
+    } catch (...) {
+        ignoreExceptionExceptInterrupt();
+    }
+}
+
+uint64_t DerivationBuildingGoal::expectedMemory()
+{
+    if (!pastPeakMemory) {
+        pastPeakMemory = 0;
+        if (auto localStore = dynamic_cast<LocalStore *>(&worker.store)) {
+            try {
+                pastPeakMemory = localStore->queryPeakMemory(drv->name).value_or(0);
+            } catch (...) {
+                ignoreExceptionExceptInterrupt();
+            }
+        }
+    }
+
+    uint64_t current = 0;
+#ifndef _WIN32 // TODO enable `DerivationBuilder` on Windows
+    if (builder)
+        current = builder->getMemoryUsage().value_or(0);
+#endif
+
+    return std::max(*pastPeakMemory, current);
+}
+
+std::chrono::seconds DerivationBuildingGoal::expectedDuration()
+{
+    if (!expectedDuration_) {
+        /* Derivations that were never built before count for a
+           second, so that the scheduler still favours long chains
+           of them. */
+        expectedDuration_ = std::chrono::seconds(1);
+        if (auto localStore = dynamic_cast<LocalStore *>(&worker.store)) {
+            try {
+                if (auto d = localStore->queryBuildDuration(drv->name))
+                    expectedDuration_ = std::max(*d, std::chrono::seconds(1));
+            } catch (...) {
+                ignoreExceptionExceptInterrupt();
+            }
+        }
+    }
+    return *expectedDuration_;
+}
+
 Goal::Done DerivationBuildingGoal::doneFailure(BuildError ex)
 {
     buildResult.inner = BuildResult::Failure{
@@ -14,6 +14,8 @@
 #include "nix/store/common-protocol.hh"
 #include "nix/store/common-protocol-impl.hh" // Don't remove is actually needed
 #include "nix/store/globals.hh"
+#include "nix/store/local-store.hh"
+#include "nix/store/nar-info.hh"
 
 #include <fstream>
 #include <sys/types.h>
@@ -36,7 +38,7 @@ DerivationGoal::DerivationGoal(
     : Goal(worker, haveDerivation(storeDerivation))
     , drvPath(drvPath)
     , wantedOutput(wantedOutput)
-    , drv{std::make_unique<Derivation>(drv)}
+    , drv{worker.shareDerivation(drvPath, drv)}
     , outputHash{[&] {
         auto outputHashes = staticOutputHashes(worker.evalStore, drv);
         if (auto * mOutputHash = get(outputHashes, wantedOutput))
@@ -78,9 +80,13 @@ Goal::Co DerivationGoal::haveDerivation(bool storeDerivation)
     if (!drv->type().hasKnownOutputPaths())
         experimentalFeatureSettings.require(Xp::CaDerivations);
 
-    for (auto & i : drv->outputsAndOptPaths(worker.store))
-        if (i.second.second)
-            worker.store.addTempRoot(*i.second.second);
+    {
+        StorePathSet outputPaths;
+        for (auto & i : drv->outputsAndOptPaths(worker.store))
+            if (i.second.second)
+                outputPaths.insert(*i.second.second);
+        worker.store.addTempRoots(outputPaths);
+    }
 
     /* We don't yet have any safe way to cache an impure derivation at
        this step. */
@@ -118,7 +124,7 @@ Goal::Co DerivationGoal::haveDerivation(bool storeDerivation)
                     else
                         debug("The output path of the derivation output '%s' could not be substituted", id.to_string());
                 }
-            } else {
+            } else if (!buildIsFaster(checkResult->first.outPath)) {
                 auto * cap = getDerivationCA(*drv);
                 waitees.insert(upcast_goal(worker.makePathSubstitutionGoal(
                     checkResult->first.outPath,
@@ -172,79 +178,105 @@ Goal::Co DerivationGoal::haveDerivation(bool storeDerivation)
     if (resolutionGoal->resolvedDrv) {
         auto & [pathResolved, drvResolved] = *resolutionGoal->resolvedDrv;
 
-        auto resolvedDrvGoal =
-            worker.makeDerivationGoal(pathResolved, drvResolved, wantedOutput, buildMode, /*storeDerivation=*/true);
-        {
-            Goals waitees{resolvedDrvGoal};
-            co_await await(std::move(waitees));
+        auto outputHashes = staticOutputHashes(worker.evalStore, *drv);
+        auto resolvedHashes = staticOutputHashes(worker.store, drvResolved);
+
+        auto outputHash = get(outputHashes, wantedOutput);
+        auto resolvedHash = get(resolvedHashes, wantedOutput);
+        if ((!outputHash) || (!resolvedHash))
+            throw Error(
+                "derivation '%s' doesn't have expected output '%s' (derivation-goal.cc/resolve)",
+                worker.store.printStorePath(drvPath),
+                wantedOutput);
+
+        DrvOutput resolvedOutput{
+            .drvHash = *resolvedHash,
+            .outputName = wantedOutput,
+        };
+
+        std::optional<UnkeyedRealisation> realisation;
+        auto status = BuildResult::Success::ResolvesToAlreadyValid;
+
+        /* Early cutoff: if the inputs were rebuilt but came out the
+           same as before, the resolved derivation has been built
+           already, and so have the derivations depending on us if they
+           resolve to the same thing. Look this up directly rather than
+           going through a goal for the resolved derivation. */
+        if (buildMode == bmNormal && !drv->type().isImpure()) {
+            for (auto * drvStore : {&worker.evalStore, &worker.store}) {
+                if (auto real = drvStore->queryRealisation(resolvedOutput);
+                    real && worker.store.isValidPath(real->outPath)) {
+                    realisation = *real;
+                    break;
+                }
+            }
         }
 
-        trace("resolved derivation finished");
-
-        auto resolvedResult = resolvedDrvGoal->buildResult;
-
-        // No `std::visit` for coroutines yet
-        if (auto * successP = resolvedResult.tryGetSuccess()) {
-            auto & success = *successP;
-            auto outputHashes = staticOutputHashes(worker.evalStore, *drv);
-            auto resolvedHashes = staticOutputHashes(worker.store, drvResolved);
-
-            auto outputHash = get(outputHashes, wantedOutput);
-            auto resolvedHash = get(resolvedHashes, wantedOutput);
-            if ((!outputHash) || (!resolvedHash))
-                throw Error(
-                    "derivation '%s' doesn't have expected output '%s' (derivation-goal.cc/resolve)",
-                    worker.store.printStorePath(drvPath),
-                    wantedOutput);
-
-            auto realisation = [&] {
-                auto take1 = get(success.builtOutputs, wantedOutput);
-                if (take1)
-                    return static_cast<UnkeyedRealisation>(*take1);
-
-                /* The above `get` should work. But stateful tracking of
-                   outputs in resolvedResult, this can get out of sync with the
-                   store, which is our actual source of truth. For now we just
-                   check the store directly if it fails. */
-                auto take2 = worker.evalStore.queryRealisation(
-                    DrvOutput{
-                        .drvHash = *resolvedHash,
-                        .outputName = wantedOutput,
-                    });
-                if (take2)
-                    return *take2;
+        if (!realisation) {
+            auto resolvedDrvGoal = worker.makeDerivationGoal(
+                pathResolved, drvResolved, wantedOutput, buildMode, /*storeDerivation=*/true);
+            {
+                Goals waitees{resolvedDrvGoal};
+                co_await await(std::move(waitees));
+            }
 
-                throw Error(
-                    "derivation '%s' doesn't have expected output '%s' (derivation-goal.cc/realisation)",
+            trace("resolved derivation finished");
+
+            auto resolvedResult = resolvedDrvGoal->buildResult;
+
+            // No `std::visit` for coroutines yet
+            if (auto * successP = resolvedResult.tryGetSuccess()) {
+                auto & success = *successP;
+
+                realisation = [&] {
+                    auto take1 = get(success.builtOutputs, wantedOutput);
+                    if (take1)
+                        return static_cast<UnkeyedRealisation>(*take1);
+
+                    /* The above `get` should work. But stateful tracking of
+                       outputs in resolvedResult, this can get out of sync with the
+                       store, which is our actual source of truth. For now we just
+                       check the store directly if it fails. */
+                    auto take2 = worker.evalStore.queryRealisation(resolvedOutput);
+                    if (take2)
+                        return *take2;
+
+                    throw Error(
+                        "derivation '%s' doesn't have expected output '%s' (derivation-goal.cc/realisation)",
+                        worker.store.printStorePath(pathResolved),
+                        wantedOutput);
+                }();
+
+                if (success.status != BuildResult::Success::AlreadyValid)
+                    status = success.status;
+            } else if (resolvedResult.tryGetFailure()) {
+                co_return doneFailure({
+                    BuildResult::Failure::DependencyFailed,
+                    "build of resolved derivation '%s' failed",
                     worker.store.printStorePath(pathResolved),
-                    wantedOutput);
-            }();
+                });
+            } else
+                assert(false);
+        }
 
-            if (!drv->type().isImpure()) {
-                Realisation newRealisation{
-                    realisation,
-                    {
-                        .drvHash = *outputHash,
-                        .outputName = wantedOutput,
-                    }};
-                newRealisation.signatures.clear();
-                worker.store.signRealisation(newRealisation);
-                worker.store.registerDrvOutput(newRealisation);
-            }
+        if (!drv->type().isImpure()) {
+            Realisation newRealisation{
+                *realisation,
+                {
+                    .drvHash = *outputHash,
+                    .outputName = wantedOutput,
+                }};
+            newRealisation.signatures.clear();
+            worker.store.signRealisation(newRealisation);
+            worker.store.registerDrvOutput(newRealisation);
+        }
+
+        if (status == BuildResult::Success::ResolvesToAlreadyValid) {
+            debug("'%s' skipped by early cutoff", worker.store.printStorePath(drvPath));
+            worker.skippedByEarlyCutoff++;
+        }
 
-            auto status = success.status;
-            if (status == BuildResult::Success::AlreadyValid)
-                status = BuildResult::Success::ResolvesToAlreadyValid;
-
-            co_return doneSuccess(status, std::move(realisation));
-        } else if (resolvedResult.tryGetFailure()) {
-            co_return doneFailure({
-                BuildResult::Failure::DependencyFailed,
-                "build of resolved derivation '%s' failed",
-                worker.store.printStorePath(pathResolved),
-            });
-        } else
-            assert(false);
+        co_return doneSuccess(status, std::move(*realisation));
     }
 
     /* Give up on substitution for the output we want, actually build this derivation */
@@ -315,6 +347,66 @@ Goal::Co DerivationGoal::haveDerivation(bool storeDerivation)
     co_return amDone(g->exitCode, g->ex);
 }
 
+bool DerivationGoal::buildIsFaster(const StorePath & outPath)
+{
+    if (!settings.costBasedSubstitution || buildMode != bmNormal || worker.substitutionBandwidth <= 0)
+        return false;
+
+    auto localStore = dynamic_cast<LocalStore *>(&worker.store);
+    if (!localStore)
+        return false;
+
+    auto buildTime = localStore->queryBuildDuration(drv->name);
+    if (!buildTime)
+        return false;
+
+    /* Building only pays off if we don't have to fetch the inputs
+       first. */
+    for (auto & i : drv->inputSrcs)
+        if (!worker.store.isValidPath(i))
+            return false;
+
+    for (auto & [inputDrv, inputNode] : drv->inputDrvs.map) {
+        if (!inputNode.childMap.empty())
+            return false;
+        auto outputs = worker.store.queryPartialDerivationOutputMap(inputDrv, &worker.evalStore);
+        for (auto & outputName : inputNode.value) {
+            auto i = outputs.find(outputName);
+            if (i == outputs.end() || !i->second || !worker.store.isValidPath(*i->second))
+                return false;
+        }
+    }
+
+    /* Substitution uses the first substituter that has the path. The
+       path info has usually been fetched already by queryMissing(). */
+    std::optional<uint64_t> downloadSize;
+    for (auto & sub : worker.getSubstituters()) {
+        if (sub->storeDir != worker.store.storeDir)
+            continue;
+        try {
+            auto info = sub->queryPathInfo(outPath);
+            auto narInfo = std::dynamic_pointer_cast<const NarInfo>(info.get_ptr());
+            downloadSize = narInfo && narInfo->fileSize ? narInfo->fileSize : info->narSize;
+            break;
+        } catch (Error &) {
+            continue;
+        }
+    }
+    if (!downloadSize)
+        return false;
+
+    auto downloadTime = std::chrono::seconds((uint64_t) (*downloadSize / worker.substitutionBandwidth));
+    if (downloadTime <= *buildTime)
+        return false;
+
+    printInfo(
+        "building '%s' instead of substituting it (expected build time %ds, download time %ds)",
+        worker.store.printStorePath(drvPath),
+        buildTime->count(),
+        downloadTime.count());
+    return true;
+}
+
 Goal::Co DerivationGoal::repairClosure()
 {
     assert(!drv->type().isImpure());
@@ -10,7 +10,7 @@ DerivationResolutionGoal::DerivationResolutionGoal(
     const StorePath & drvPath, const Derivation & drv, Worker & worker, BuildMode buildMode)
     : Goal(worker, resolveDerivation())
     , drvPath(drvPath)
-    , drv{std::make_unique<Derivation>(drv)}
+    , drv{worker.shareDerivation(drvPath, drv)}
     , buildMode{buildMode}
 {
     name = fmt("resolving derivation '%s'", worker.store.printStorePath(drvPath));
@@ -173,9 +173,9 @@ Co Goal::await(Goals new_waitees)
 {
     assert(waitees.empty());
     if (!new_waitees.empty()) {
-        waitees = std::move(new_waitees);
-        for (auto waitee : waitees) {
-            addToWeakGoals(waitee->waiters, shared_from_this());
+        waitees.insert(boost::container::ordered_unique_range, new_waitees.begin(), new_waitees.end());
+        for (auto & waitee : waitees) {
+            waitee->waiters.push_back(shared_from_this());
         }
         co_await Suspend{};
         assert(waitees.empty());
@@ -219,7 +219,9 @@ Goal::Done Goal::amDone(ExitCode result, std::optional<Error> ex)
                 /* If we failed and keepGoing is not set, we remove all
                    remaining waitees. */
                 for (auto & g : goal->waitees) {
-                    g->waiters.extract(goal);
+                    std::erase_if(g->waiters, [&](const WeakGoalPtr & w) {
+                        return !w.owner_before(goal) && !goal.owner_before(w);
+                    });
                 }
                 goal->waitees.clear();
 
@@ -291,6 +293,13 @@ Goal::Co Goal::waitForAWhile()
     co_return Return{};
 }
 
+Goal::Co Goal::waitForLocks(const std::set<std::filesystem::path> & paths)
+{
+    worker.waitForLocks(shared_from_this(), paths);
+    co_await Suspend{};
+    co_return Return{};
+}
+
 Goal::Co Goal::waitForBuildSlot()
 {
     worker.waitForBuildSlot(shared_from_this());
@@ -1,6 +1,7 @@
 #include "nix/store/build/worker.hh"
 #include "nix/store/build/substitution-goal.hh"
 #include "nix/store/nar-info.hh"
+#include "nix/util/callback.hh"
 #include "nix/util/finally.hh"
 #include "nix/util/signals.hh"
 #include "nix/store/globals.hh"
@@ -89,9 +90,62 @@ Goal::Co PathSubstitutionGoal::init()
             continue;
         }
 
+        /* Fetch the path info without blocking the worker loop. Like
+           the substitution itself, this takes up a substitution slot,
+           which bounds the number of lookups in flight. */
+        while (worker.getNrSubstitutions() >= std::max(1U, (unsigned int) settings.maxSubstitutionJobs)) {
+            co_await waitForBuildSlot();
+        }
+
+        /* The callback can outlive `this`, so it must not touch
+           `this`. */
+        auto infoPipe = std::make_shared<MuxablePipe>();
+#ifndef _WIN32
+        infoPipe->create();
+#else
+        infoPipe->createAsyncPipe(worker.ioport.get());
+#endif
+
+        auto infoPromise = std::make_shared<std::promise<ref<const ValidPathInfo>>>();
+
+        sub->queryPathInfo(
+            subPath ? *subPath : storePath,
+            {[infoPipe(infoPipe), infoPromise(infoPromise)](std::future<ref<const ValidPathInfo>> res) {
+                try {
+                    Finally updateStats([&]() { infoPipe->writeSide.close(); });
+                    infoPromise->set_value(res.get());
+                } catch (...) {
+                    infoPromise->set_exception(std::current_exception());
+                }
+            }});
+
+        worker.childStarted(
+            shared_from_this(),
+            {
+#ifndef _WIN32
+                infoPipe->readSide.get()
+#else
+                &*infoPipe
+#endif
+            },
+            true,
+            false);
+
+        while (true) {
+            auto event = co_await WaitForChildEvent{};
+            if (std::get_if<ChildOutput>(&event)) {
+                // Doesn't process child output
+            } else if (std::get_if<ChildEOF>(&event)) {
+                break;
+            } else if (std::get_if<TimedOut>(&event)) {
+                unreachable();
+            }
+        }
+
+        worker.childTerminated(this);
+
         try {
-            // FIXME: make async
-            info = sub->queryPathInfo(subPath ? *subPath : storePath);
+            info = infoPromise->get_future().get();
         } catch (InvalidPath & e) {
             continue;
         } catch (SubstituterDisabled & e) {
@@ -223,6 +277,7 @@ Goal::Co PathSubstitutionGoal::tryToRun(
 #endif
 
     auto promise = std::promise<void>();
+    auto startTime = std::chrono::steady_clock::now();
 
     thr = std::thread([this, &promise, &subPath, &sub]() {
         try {
@@ -307,6 +362,14 @@ Goal::Co PathSubstitutionGoal::tryToRun(
         auto fileSize = maintainExpectedDownload->delta;
         maintainExpectedDownload.reset();
         worker.doneDownloadSize += fileSize;
+
+        auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+        if (fileSize && elapsed > 0) {
+            auto bandwidth = fileSize / elapsed;
+            worker.substitutionBandwidth = worker.substitutionBandwidth == 0
+                                               ? bandwidth
+                                               : 0.7 * worker.substitutionBandwidth + 0.3 * bandwidth;
+        }
     }
 
     assert(maintainExpectedNar);
@@ -10,9 +10,17 @@
 #include "nix/store/build/derivation-trampoline-goal.hh"
 #ifndef _WIN32 // TODO Enable building on Windows
 #  include "nix/store/build/hook-instance.hh"
+#  include "nix/store/build/jobserver.hh"
+#  include "nix/store/build/remote-builders.hh"
 #endif
 #include "nix/util/signals.hh"
 #include "nix/store/globals.hh"
+#include "nix/store/store-metrics.hh"
+
+#ifdef __linux__
+#  include <sys/epoll.h>
+#  include <sys/inotify.h>
+#endif
 
 namespace nix {
 
@@ -31,6 +39,20 @@ Worker::Worker(Store & store, Store & evalStore)
     timedOut = false;
     hashMismatch = false;
     checkMismatch = false;
+
+#ifdef __linux__
+    epollFd = AutoCloseFD(epoll_create1(EPOLL_CLOEXEC));
+    if (!epollFd)
+        throw SysError("creating epoll instance");
+
+    /* Not being able to watch lock files isn't fatal (e.g. if we've run
+       out of inotify instances); we'll just poll them. */
+    lockWatchFd = AutoCloseFD(inotify_init1(IN_NONBLOCK | IN_CLOEXEC));
+    if (lockWatchFd)
+        watchChannel(lockWatchFd.get());
+    else
+        debug("cannot watch lock files: %s", strerror(errno));
+#endif
 }
 
 Worker::~Worker()
@@ -41,6 +63,8 @@ Worker::~Worker()
        their destructors). */
     topGoals.clear();
 
+    reportMetrics(true);
+
     assert(expectedSubstitutions == 0);
     assert(expectedDownloadSize == 0);
     assert(expectedNarSize == 0);
@@ -77,6 +101,16 @@ std::shared_ptr<DerivationTrampolineGoal> Worker::makeDerivationTrampolineGoal(
         buildMode);
 }
 
+std::shared_ptr<const Derivation> Worker::shareDerivation(const StorePath & drvPath, const Derivation & drv)
+{
+    auto & weak = derivations[drvPath];
+    if (auto shared = weak.lock())
+        return shared;
+    auto shared = std::make_shared<const Derivation>(drv);
+    weak = shared;
+    return shared;
+}
+
 std::shared_ptr<DerivationGoal> Worker::makeDerivationGoal(
     const StorePath & drvPath,
     const Derivation & drv,
@@ -216,6 +250,22 @@ size_t Worker::getNrSubstitutions()
     return nrSubstitutions;
 }
 
+void Worker::reportMetrics(bool finished)
+{
+    auto metrics = getStoreMetrics();
+    if (!metrics)
+        return;
+
+    auto update = [&](std::atomic<int64_t> & gauge, int64_t & reported, size_t current) {
+        int64_t value = finished ? 0 : current;
+        gauge += value - reported;
+        reported = value;
+    };
+    update(metrics->buildsRunning, reportedMetrics.builds, nrLocalBuilds);
+    update(metrics->substitutionsRunning, reportedMetrics.substitutions, nrSubstitutions);
+    update(metrics->goalsWaiting, reportedMetrics.waiting, wantingToBuild.size());
+}
+
 void Worker::childStarted(
     GoalPtr goal, const std::set<MuxablePipePollState::CommChannel> & channels, bool inBuildSlot, bool respectTimeouts)
 {
@@ -227,6 +277,10 @@ void Worker::childStarted(
     child.inBuildSlot = inBuildSlot;
     child.respectTimeouts = respectTimeouts;
     children.emplace_back(child);
+#ifdef __linux__
+    for (auto & fd : channels)
+        watchChannel(fd);
+#endif
     if (inBuildSlot) {
         switch (goal->jobCategory()) {
         case JobCategory::Substitution:
@@ -268,6 +322,11 @@ void Worker::childTerminated(Goal * goal, bool wakeSleepers)
         }
     }
 
+#ifdef __linux__
+    for (auto & fd : i->channels)
+        unwatchChannel(fd);
+#endif
+
     children.erase(i);
 
     if (wakeSleepers) {
@@ -287,13 +346,67 @@ void Worker::waitForBuildSlot(GoalPtr goal)
 {
     goal->trace("wait for build slot");
     bool isSubstitutionGoal = goal->jobCategory() == JobCategory::Substitution;
-    if ((!isSubstitutionGoal && getNrLocalBuilds() < settings.maxBuildJobs)
+    if ((!isSubstitutionGoal && getNrLocalBuilds() < settings.maxBuildJobs && admitBuild(*goal))
         || (isSubstitutionGoal && getNrSubstitutions() < settings.maxSubstitutionJobs))
         wakeUp(goal); /* we can do it right away */
     else
         addToWeakGoals(wantingToBuild, goal);
 }
 
+bool Worker::admitBuild(Goal & goal)
+{
+    if (!settings.buildMemoryBudget)
+        return true;
+
+    bool othersRunning = false;
+    uint64_t projected = goal.expectedMemory();
+    for (auto & child : children)
+        if (child.inBuildSlot && child.goal2 != &goal && child.goal2->jobCategory() == JobCategory::Build) {
+            othersRunning = true;
+            projected += child.goal2->expectedMemory();
+        }
+
+    /* Never hold back the only build, it would wait forever. */
+    if (!othersRunning || projected <= settings.buildMemoryBudget)
+        return true;
+
+    debug(
+        "delaying build '%s': projected memory use %s exceeds budget %s",
+        goal.getName(),
+        renderSize(projected),
+        renderSize(settings.buildMemoryBudget));
+    buildsDelayedForMemory++;
+    return false;
+}
+
+std::chrono::seconds Worker::criticalPath(Goal & goal, std::map<Goal *, std::chrono::seconds> & memo)
+{
+    auto [i, inserted] = memo.try_emplace(&goal, 0);
+    if (!inserted)
+        return i->second;
+
+    std::chrono::seconds longest{0};
+    for (auto & j : goal.waiters)
+        if (auto waiter = j.lock())
+            longest = std::max(longest, criticalPath(*waiter, memo));
+
+    return i->second = goal.expectedDuration() + longest;
+}
+
+#ifndef _WIN32
+Jobserver * Worker::getJobserver()
+{
+    if (!settings.buildJobserver)
+        return nullptr;
+    if (!jobserver) {
+        auto cores = settings.buildCores ? settings.buildCores : settings.getDefaultCores();
+        /* Every build has an implicit token. */
+        jobserver = std::make_unique<Jobserver>(cores > 1 ? cores - 1 : 0);
+    }
+    return jobserver.get();
+}
+#endif
+
 void Worker::waitForAnyGoal(GoalPtr goal)
 {
     debug("wait for any goal");
@@ -306,6 +419,89 @@ void Worker::waitForAWhile(GoalPtr goal)
     addToWeakGoals(waitingForAWhile, goal);
 }
 
+void Worker::waitForLocks(GoalPtr goal, const std::set<std::filesystem::path> & paths)
+{
+    waitForAWhile(goal);
+
+#ifdef __linux__
+    if (!lockWatchFd)
+        return;
+
+    /* A build that succeeds deletes its output locks before releasing
+       them, which we notice as a change in the lock file's link count.
+       Otherwise, the holder touches the lock file when releasing it.
+       We can't watch for the lock simply being closed, since that
+       would also wake us up whenever some other waiter retries. A
+       holder that dies without releasing its locks is still noticed
+       after `poll-interval` seconds. */
+    for (auto & path : paths) {
+        auto lockPath = path.string() + ".lock";
+        int wd = inotify_add_watch(lockWatchFd.get(), lockPath.c_str(), IN_ATTRIB | IN_MODIFY | IN_DELETE_SELF);
+        if (wd == -1) {
+            debug("cannot watch lock file '%s': %s", lockPath, strerror(errno));
+            continue;
+        }
+        addToWeakGoals(lockWatches[wd], goal);
+    }
+#endif
+}
+
+#ifdef __linux__
+
+void Worker::watchChannel(MuxablePipePollState::CommChannel fd)
+{
+    struct epoll_event event{.events = EPOLLIN, .data = {.fd = fd}};
+    if (epoll_ctl(epollFd.get(), EPOLL_CTL_ADD, fd, &event) == -1)
+        throw SysError("adding file descriptor %d to epoll instance", fd);
+}
+
+void Worker::unwatchChannel(MuxablePipePollState::CommChannel fd)
+{
+    /* The descriptor may already have been closed by the goal, which
+       removes it from the epoll instance as well. */
+    if (epoll_ctl(epollFd.get(), EPOLL_CTL_DEL, fd, nullptr) == -1 && errno != EBADF && errno != ENOENT)
+        throw SysError("removing file descriptor %d from epoll instance", fd);
+}
+
+void Worker::processLockWatches()
+{
+    alignas(struct inotify_event) char buffer[4096];
+
+    while (true) {
+        auto rd = ::read(lockWatchFd.get(), buffer, sizeof(buffer));
+        if (rd == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN)
+                break;
+            throw SysError("reading lock file events");
+        }
+
+        for (char * p = buffer; p < buffer + rd;) {
+            auto event = reinterpret_cast<struct inotify_event *>(p);
+            p += sizeof(struct inotify_event) + event->len;
+
+            auto i = lockWatches.find(event->wd);
+            if (i == lockWatches.end())
+                continue;
+
+            /* Only wake up goals that are still waiting; a goal that
+               has since moved on shouldn't be resumed spuriously. */
+            for (auto & j : i->second) {
+                GoalPtr goal = j.lock();
+                if (goal && waitingForAWhile.erase(goal))
+                    wakeUp(goal);
+            }
+
+            lockWatches.erase(i);
+            if (!(event->mask & IN_IGNORED))
+                inotify_rm_watch(lockWatchFd.get(), event->wd);
+        }
+    }
+}
+
+#endif
+
 void Worker::run(const Goals & _topGoals)
 {
     std::vector<nix::DerivedPath> topPaths;
@@ -336,16 +532,28 @@ void Worker::run(const Goals & _topGoals)
         if (auto localStore = dynamic_cast<LocalStore *>(&store))
             localStore->autoGC(false);
 
-        /* Call every wake goal (in the ordering established by
-           CompareGoalPtrs). */
+        /* Call every wake goal. Goals on the longest remaining path
+           to a top-level goal go first, so that they get the free
+           build slots; ties are broken by the ordering established
+           by CompareGoalPtrs. */
         while (!awake.empty() && !topGoals.empty()) {
-            Goals awake2;
+            Goals awake_;
             for (auto & i : awake) {
                 GoalPtr goal = i.lock();
                 if (goal)
-                    awake2.insert(goal);
+                    awake_.insert(goal);
             }
             awake.clear();
+            std::vector<GoalPtr> awake2(awake_.begin(), awake_.end());
+            if (awake2.size() > 1) {
+                std::map<Goal *, std::chrono::seconds> memo;
+                std::vector<std::pair<std::chrono::seconds, GoalPtr>> weighted;
+                for (auto & goal : awake2)
+                    weighted.emplace_back(criticalPath(*goal, memo), goal);
+                std::ranges::stable_sort(weighted, [](auto & a, auto & b) { return a.first > b.first; });
+                for (size_t i = 0; i < weighted.size(); ++i)
+                    awake2[i] = std::move(weighted[i].second);
+            }
             for (auto & goal : awake2) {
                 checkInterrupt();
                 goal->work();
@@ -357,6 +565,8 @@ void Worker::run(const Goals & _topGoals)
         if (topGoals.empty())
             break;
 
+        reportMetrics();
+
         /* Wait for input. */
         if (!children.empty() || !waitingForAWhile.empty())
             waitForInput();
@@ -381,6 +591,11 @@ void Worker::run(const Goals & _topGoals)
     assert(!settings.keepGoing || awake.empty());
     assert(!settings.keepGoing || wantingToBuild.empty());
     assert(!settings.keepGoing || children.empty());
+
+    if (skippedByEarlyCutoff)
+        printInfo(
+            "%d derivation(s) skipped by early cutoff, since their inputs were rebuilt with unchanged outputs",
+            skippedByEarlyCutoff);
 }
 
 void Worker::waitForInput()
@@ -434,9 +649,29 @@ void Worker::waitForInput()
     if (useTimeout)
         vomit("sleeping %d seconds", timeout);
 
+#ifdef __linux__
+    /* Wait for any of the channels registered in `childStarted()` to
+       become readable (which includes EOF), or for a lock that a goal
+       is waiting on to be released. */
+    std::vector<struct epoll_event> events(std::max<size_t>(children.size() + 1, 16));
+    int nrEvents = epoll_wait(epollFd.get(), events.data(), events.size(), useTimeout ? timeout * 1000 : -1);
+    if (nrEvents == -1) {
+        if (errno != EINTR)
+            throw SysError("waiting for input");
+        nrEvents = 0;
+    }
+
+    std::set<Descriptor> ready;
+    for (int n = 0; n < nrEvents; ++n) {
+        if (lockWatchFd && events[n].data.fd == lockWatchFd.get())
+            processLockWatches();
+        else
+            ready.insert(events[n].data.fd);
+    }
+#else
     MuxablePipePollState state;
 
-#ifndef _WIN32
+#  ifndef _WIN32
     /* Use select() to wait for the input side of any logger pipe to
        become `available'.  Note that `available' (i.e., non-blocking)
        includes EOF. */
@@ -446,18 +681,18 @@ void Worker::waitForInput()
             state.fdToPollStatus[j] = state.pollStatus.size() - 1;
         }
     }
-#endif
+#  endif
 
     state.poll(
-#ifdef _WIN32
+#  ifdef _WIN32
         ioport.get(),
-#endif
+#  endif
         useTimeout ? (std::optional{timeout * 1000}) : std::nullopt);
+#endif
 
     auto after = steady_time_point::clock::now();
 
-    /* Process all available file descriptors. FIXME: this is
-       O(children * fds). */
+    /* Process all available file descriptors. */
     decltype(children)::iterator i;
     for (auto j = children.begin(); j != children.end(); j = i) {
         i = std::next(j);
@@ -467,6 +702,17 @@ void Worker::waitForInput()
         GoalPtr goal = j->goal.lock();
         assert(goal);
 
+#ifdef __linux__
+        /* Only pass the descriptors that epoll reported as readable to
+           iterate(). */
+        MuxablePipePollState state;
+        for (auto & k : j->channels) {
+            state.pollStatus.push_back(
+                (struct pollfd) {.fd = k, .events = POLLIN, .revents = short(ready.count(k) ? POLLIN : 0)});
+            state.fdToPollStatus[k] = state.pollStatus.size() - 1;
+        }
+#endif
+
         state.iterate(
             j->channels,
             [&](Descriptor k, std::string_view data) {
@@ -476,6 +722,9 @@ void Worker::waitForInput()
             },
             [&](Descriptor k) {
                 debug("%1%: got EOF", goal->getName());
+#ifdef __linux__
+                unwatchChannel(k);
+#endif
                 goal->handleEOF(k);
             });
 
@@ -2,6 +2,7 @@
 #include "nix/store/builtins.hh"
 #include "nix/store/derivations.hh"
 #include "nix/util/signals.hh"
+#include "nix/util/thread-pool.hh"
 
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -16,50 +17,209 @@ RegisterBuiltinBuilder::BuiltinBuilders & RegisterBuiltinBuilder::builtinBuilder
     return builders;
 }
 
+StringSet & RegisterBuiltinBuilder::unsandboxedBuiltinBuilders()
+{
+    static StringSet builders;
+    return builders;
+}
+
 namespace {
 
-struct State
+/**
+ * An entry of a directory of a package, with its type as seen through
+ * `stat()`. Entries starting with a dot are omitted.
+ */
+struct SrcEntry
 {
-    std::map<Path, int> priorities;
-    unsigned long symlinks = 0;
+    enum Type { File, Directory, Dangling };
+
+    std::string name;
+    Type type;
 };
 
-} // namespace
+/**
+ * The entries of a directory of a package, or `std::nullopt` if it
+ * isn't a directory.
+ */
+typedef std::optional<std::vector<SrcEntry>> Listing;
 
-/* For each activated package, create symlinks */
-static void createLinks(State & state, const Path & srcDir, const Path & dstDir, int priority)
+static Listing readListing(const Path & srcDir)
 {
     DirectoryIterator srcFiles;
 
     try {
         srcFiles = DirectoryIterator{srcDir};
     } catch (SysError & e) {
-        if (e.errNo == ENOTDIR) {
-            warn("not including '%s' in the user environment because it's not a directory", srcDir);
-            return;
-        }
+        if (e.errNo == ENOTDIR)
+            return std::nullopt;
         throw;
     }
 
+    std::vector<SrcEntry> entries;
+
     for (const auto & ent : srcFiles) {
         checkInterrupt();
-        auto name = ent.path().filename();
-        if (name.string()[0] == '.')
+        auto name = ent.path().filename().string();
+        if (name[0] == '.')
             /* not matched by glob */
             continue;
-        auto srcFile = (std::filesystem::path{srcDir} / name).string();
-        auto dstFile = (std::filesystem::path{dstDir} / name).string();
+        auto srcFile = srcDir + "/" + name;
 
         struct stat srcSt;
-        try {
-            if (stat(srcFile.c_str(), &srcSt) == -1)
-                throw SysError("getting status of '%1%'", srcFile);
-        } catch (SysError & e) {
-            if (e.errNo == ENOENT || e.errNo == ENOTDIR) {
-                warn("skipping dangling symlink '%s'", dstFile);
+        if (stat(srcFile.c_str(), &srcSt) == -1) {
+            if (errno == ENOENT || errno == ENOTDIR) {
+                entries.push_back({std::move(name), SrcEntry::Dangling});
                 continue;
             }
-            throw;
+            throw SysError("getting status of '%1%'", srcFile);
+        }
+
+        entries.push_back({std::move(name), S_ISDIR(srcSt.st_mode) ? SrcEntry::Directory : SrcEntry::File});
+    }
+
+    return entries;
+}
+
+/**
+ * Reads the directories of the packages that `createLinks()` will
+ * have to descend into, in parallel. A directory only needs to be
+ * read if at least two packages have a directory at the same
+ * relative path; otherwise it's linked as a whole.
+ */
+struct Prefetcher
+{
+    const std::vector<Path> & pkgDirs;
+
+    struct State
+    {
+        /**
+         * The listing of each package, by path relative to the package
+         * (empty or starting with a slash).
+         */
+        std::vector<std::map<std::string, Listing>> listings;
+
+        /**
+         * The packages found to have a directory at each relative
+         * path.
+         */
+        std::map<std::string, std::vector<size_t>> dirPkgs;
+    };
+
+    Sync<State> state_;
+
+    ThreadPool pool;
+
+    Prefetcher(const std::vector<Path> & pkgDirs)
+        : pkgDirs(pkgDirs)
+    {
+        state_.lock()->listings.resize(pkgDirs.size());
+    }
+
+    std::vector<std::map<std::string, Listing>> run()
+    {
+        for (size_t pkg = 0; pkg < pkgDirs.size(); ++pkg)
+            pool.enqueue([this, pkg]() { read(pkg, ""); });
+        pool.process();
+        return std::move(state_.lock()->listings);
+    }
+
+    void read(size_t pkg, const std::string & relPath)
+    {
+        auto listing = readListing(pkgDirs[pkg] + relPath);
+
+        std::vector<std::pair<size_t, std::string>> more;
+
+        {
+            auto state(state_.lock());
+            if (listing)
+                for (auto & entry : *listing) {
+                    if (entry.type != SrcEntry::Directory)
+                        continue;
+                    auto childPath = relPath + "/" + entry.name;
+                    auto & pkgs = state->dirPkgs[childPath];
+                    pkgs.push_back(pkg);
+                    if (pkgs.size() == 2)
+                        more.emplace_back(pkgs[0], childPath);
+                    if (pkgs.size() >= 2)
+                        more.emplace_back(pkg, childPath);
+                }
+            state->listings[pkg].emplace(relPath, std::move(listing));
+        }
+
+        for (auto & [pkg2, childPath] : more)
+            pool.enqueue([this, pkg2, childPath]() { read(pkg2, childPath); });
+    }
+};
+
+/**
+ * A file in the user environment being built, either a symlink into
+ * a package or a directory.
+ */
+struct DstNode
+{
+    /**
+     * The target of the symlink, or `std::nullopt` for a directory.
+     */
+    std::optional<Path> target;
+
+    bool targetIsDir = false;
+
+    /**
+     * The package providing the symlink, and its priority.
+     */
+    size_t pkg = 0;
+    int priority = 0;
+
+    std::map<std::string, DstNode> entries;
+};
+
+struct State
+{
+    const Path & out;
+    std::vector<std::map<std::string, Listing>> listings;
+    const std::vector<Path> & pkgDirs;
+    DstNode root;
+    unsigned long symlinks = 0;
+
+    /**
+     * Whether packages are being added to an existing profile, in
+     * which case collisions whose outcome depends on the order of the
+     * packages are refused.
+     */
+    bool incremental = false;
+
+    const Listing & getListing(size_t pkg, const std::string & relPath)
+    {
+        auto & listings2 = listings[pkg];
+        auto i = listings2.find(relPath);
+        if (i == listings2.end())
+            i = listings2.emplace(relPath, readListing(pkgDirs[pkg] + relPath)).first;
+        return i->second;
+    }
+};
+
+} // namespace
+
+/* For each activated package, create symlinks. This only decides what
+   to create; the result is written by `writeTree()`. */
+static void createLinks(
+    State & state, DstNode & dst, const Path & srcDir, size_t pkg, const std::string & relPath, int priority)
+{
+    auto & listing = state.getListing(pkg, relPath);
+
+    if (!listing) {
+        warn("not including '%s' in the user environment because it's not a directory", srcDir);
+        return;
+    }
+
+    for (const auto & ent : *listing) {
+        checkInterrupt();
+        auto srcFile = srcDir + "/" + ent.name;
+        auto childPath = relPath + "/" + ent.name;
+
+        if (ent.type == SrcEntry::Dangling) {
+            warn("skipping dangling symlink '%s'", state.out + childPath);
+            continue;
         }
 
         /* The files below are special-cased to that they don't show
@@ -73,68 +233,94 @@ static void createLinks(State & state, const Path & srcDir, const Path & dstDir,
             || hasSuffix(srcFile, "/manifest.nix") || hasSuffix(srcFile, "/manifest.json"))
             continue;
 
-        else if (S_ISDIR(srcSt.st_mode)) {
-            auto dstStOpt = maybeLstat(dstFile.c_str());
-            if (dstStOpt) {
-                auto & dstSt = *dstStOpt;
-                if (S_ISDIR(dstSt.st_mode)) {
-                    createLinks(state, srcFile, dstFile, priority);
+        auto existing = dst.entries.find(ent.name);
+
+        if (ent.type == SrcEntry::Directory) {
+            if (existing != dst.entries.end()) {
+                auto & dstNode = existing->second;
+                if (!dstNode.target) {
+                    createLinks(state, dstNode, srcFile, pkg, childPath, priority);
                     continue;
-                } else if (S_ISLNK(dstSt.st_mode)) {
-                    auto target = canonPath(dstFile, true);
-                    if (!S_ISDIR(lstat(target).st_mode))
+                } else {
+                    auto target = canonPath(*dstNode.target, true);
+                    if (!dstNode.targetIsDir)
                         throw Error("collision between '%1%' and non-directory '%2%'", srcFile, target);
-                    if (unlink(dstFile.c_str()) == -1)
-                        throw SysError("unlinking '%1%'", dstFile);
-                    if (mkdir(
-                            dstFile.c_str()
-#ifndef _WIN32 // TODO abstract mkdir perms for Windows
-                                ,
-                            0755
-#endif
-                            )
-                        == -1)
-                        throw SysError("creating directory '%1%'", dstFile);
-                    createLinks(state, target, dstFile, state.priorities[dstFile]);
-                    createLinks(state, srcFile, dstFile, priority);
+                    auto prev = std::move(dstNode);
+                    dstNode = DstNode{};
+                    createLinks(state, dstNode, target, prev.pkg, childPath, prev.priority);
+                    createLinks(state, dstNode, srcFile, pkg, childPath, priority);
                     continue;
                 }
             }
         }
 
         else {
-            auto dstStOpt = maybeLstat(dstFile.c_str());
-            if (dstStOpt) {
-                auto & dstSt = *dstStOpt;
-                if (S_ISLNK(dstSt.st_mode)) {
-                    auto prevPriority = state.priorities[dstFile];
+            if (existing != dst.entries.end()) {
+                auto & dstNode = existing->second;
+                if (dstNode.target) {
+                    if (state.incremental && dstNode.targetIsDir)
+                        throw Error("file '%s' replaces a directory", srcFile);
+                    auto prevPriority = dstNode.priority;
                     if (prevPriority == priority)
-                        throw BuildEnvFileConflictError(readLink(dstFile), srcFile, priority);
+                        throw BuildEnvFileConflictError(*dstNode.target, srcFile, priority);
                     if (prevPriority < priority)
                         continue;
-                    if (unlink(dstFile.c_str()) == -1)
-                        throw SysError("unlinking '%1%'", dstFile);
-                } else if (S_ISDIR(dstSt.st_mode))
-                    throw Error("collision between non-directory '%1%' and directory '%2%'", srcFile, dstFile);
+                } else
+                    throw Error(
+                        "collision between non-directory '%1%' and directory '%2%'", srcFile, state.out + childPath);
             }
         }
 
-        createSymlink(srcFile, dstFile);
-        state.priorities[dstFile] = priority;
+        dst.entries.insert_or_assign(
+            ent.name,
+            DstNode{
+                .target = srcFile,
+                .targetIsDir = ent.type == SrcEntry::Directory,
+                .pkg = pkg,
+                .priority = priority,
+            });
         state.symlinks++;
     }
 }
 
-void buildProfile(const Path & out, Packages && pkgs)
+static void writeTree(const DstNode & dir, const Path & dstDir)
 {
-    State state;
+    for (auto & [name, node] : dir.entries) {
+        checkInterrupt();
+        auto dstFile = dstDir + "/" + name;
+        if (node.target)
+            createSymlink(*node.target, dstFile);
+        else {
+            if (mkdir(
+                    dstFile.c_str()
+#ifndef _WIN32 // TODO abstract mkdir perms for Windows
+                        ,
+                    0755
+#endif
+                    )
+                == -1)
+                throw SysError("creating directory '%1%'", dstFile);
+            writeTree(node, dstFile);
+        }
+    }
+}
+
+/**
+ * Return the package directories to link, in the order in which they
+ * take part in `createLinks()`, with their priorities.
+ */
+static std::pair<std::vector<Path>, std::vector<int>> orderPackages(Packages && pkgs)
+{
+    std::vector<Path> pkgDirs;
+    std::vector<int> priorities;
 
     PathSet done, postponed;
 
     auto addPkg = [&](const Path & pkgDir, int priority) {
         if (!done.insert(pkgDir).second)
             return;
-        createLinks(state, pkgDir, out, priority);
+        pkgDirs.push_back(pkgDir);
+        priorities.push_back(priority);
 
         try {
             for (const auto & p : tokenizeString<std::vector<std::string>>(
@@ -165,15 +351,134 @@ void buildProfile(const Path & out, Packages && pkgs)
      */
     auto priorityCounter = 1000;
     while (!postponed.empty()) {
-        PathSet pkgDirs;
-        postponed.swap(pkgDirs);
-        for (const auto & pkgDir : pkgDirs)
+        PathSet pkgDirs2;
+        postponed.swap(pkgDirs2);
+        for (const auto & pkgDir : pkgDirs2)
             addPkg(pkgDir, priorityCounter++);
     }
 
+    return {std::move(pkgDirs), std::move(priorities)};
+}
+
+void buildProfile(const Path & out, Packages && pkgs)
+{
+    auto [pkgDirs, priorities] = orderPackages(std::move(pkgs));
+
+    /* The package directories are immutable, so they can be read
+       concurrently before deciding on the links. */
+    State state{
+        .out = out,
+        .listings = Prefetcher(pkgDirs).run(),
+        .pkgDirs = pkgDirs,
+    };
+
+    for (size_t pkg = 0; pkg < pkgDirs.size(); ++pkg)
+        createLinks(state, state.root, pkgDirs[pkg], pkg, "", priorities[pkg]);
+
+    writeTree(state.root, out);
+
     debug("created %d symlinks in user environment", state.symlinks);
 }
 
+/**
+ * Read the symlink tree of a previously built profile into `dir`,
+ * attributing every symlink to the package it points into.
+ */
+static void readTree(
+    DstNode & dir,
+    const Path & srcDir,
+    const std::map<Path, size_t> & pkgIndices,
+    const std::vector<int> & priorities,
+    bool root)
+{
+    for (const auto & ent : DirectoryIterator{srcDir}) {
+        checkInterrupt();
+        auto name = ent.path().filename().string();
+        if (root && (name == "manifest.nix" || name == "manifest.json"))
+            continue;
+        auto srcFile = srcDir + "/" + name;
+        auto st = lstat(srcFile);
+
+        if (S_ISDIR(st.st_mode)) {
+            readTree(dir.entries[name], srcFile, pkgIndices, priorities, false);
+            continue;
+        }
+
+        if (!S_ISLNK(st.st_mode))
+            throw Error("'%s' is not a symlink", srcFile);
+
+        auto target = readLink(srcFile);
+
+        /* Find the package that the target is in. */
+        std::optional<size_t> pkg;
+        for (auto slash = target.find('/', 1); !pkg; slash = target.find('/', slash + 1)) {
+            if (auto i = pkgIndices.find(target.substr(0, slash)); i != pkgIndices.end())
+                pkg = i->second;
+            if (slash == target.npos)
+                break;
+        }
+        if (!pkg)
+            throw Error("symlink '%s' doesn't point into an installed package", srcFile);
+
+        dir.entries.insert_or_assign(
+            name,
+            DstNode{
+                .target = target,
+                .targetIsDir = std::filesystem::is_directory(target),
+                .pkg = *pkg,
+                .priority = priorities[*pkg],
+            });
+    }
+}
+
+bool buildProfileIncremental(const Path & out, const Path & prev, Packages && prevPkgs, Packages && pkgs)
+{
+    auto [prevPkgDirs, prevPriorities] = orderPackages(std::move(prevPkgs));
+    auto [pkgDirs, priorities] = orderPackages(std::move(pkgs));
+
+    std::map<Path, size_t> pkgIndices;
+    for (size_t pkg = 0; pkg < pkgDirs.size(); ++pkg)
+        pkgIndices.emplace(pkgDirs[pkg], pkg);
+
+    /* Packages must only have been added. */
+    std::vector<bool> added(pkgDirs.size(), true);
+    for (size_t pkg = 0; pkg < prevPkgDirs.size(); ++pkg) {
+        auto i = pkgIndices.find(prevPkgDirs[pkg]);
+        if (i == pkgIndices.end() || priorities[i->second] != prevPriorities[pkg]) {
+            debug(
+                "cannot update profile '%s' incrementally: package '%s' was removed or changed",
+                prev,
+                prevPkgDirs[pkg]);
+            return false;
+        }
+        added[i->second] = false;
+    }
+
+    State state{
+        .out = out,
+        .listings = std::vector<std::map<std::string, Listing>>(pkgDirs.size()),
+        .pkgDirs = pkgDirs,
+        .incremental = true,
+    };
+
+    try {
+        readTree(state.root, prev, pkgIndices, priorities, true);
+
+        for (size_t pkg = 0; pkg < pkgDirs.size(); ++pkg)
+            if (added[pkg])
+                createLinks(state, state.root, pkgDirs[pkg], pkg, "", priorities[pkg]);
+    } catch (Error & e) {
+        debug("cannot update profile '%s' incrementally: %s", prev, e.msg());
+        return false;
+    }
+
+    writeTree(state.root, out);
+
+    debug("added %d symlinks to user environment", state.symlinks);
+
+    return true;
+}
+
 static void builtinBuildenv(const BuiltinBuilderContext & ctx)
 {
     auto getAttr = [&](const std::string & name) {
@@ -0,0 +1,50 @@
+#include "nix/store/builtins.hh"
+#include "nix/util/signals.hh"
+
+namespace nix {
+
+static void mergeInto(const std::filesystem::path & src, const std::filesystem::path & dst)
+{
+    checkInterrupt();
+
+    auto srcSt = lstat(src);
+    auto dstSt = maybeLstat(dst);
+
+    if (S_ISDIR(srcSt.st_mode) && (!dstSt || S_ISDIR(dstSt->st_mode))) {
+        createDirs(dst);
+        for (auto & entry : DirectoryIterator(src))
+            mergeInto(entry.path(), dst / entry.path().filename());
+    } else if (dstSt)
+        throw Error("collision between '%s' and an existing file at '%s'", src, dst);
+    else
+        copyFile(src, dst, false);
+}
+
+/**
+ * Copy the contents of the store paths in the whitespace-separated
+ * attribute `paths` into the output, merging directories, like
+ * `symlinkJoin` in Nixpkgs but with copies rather than symlinks. The
+ * paths must be inputs of the derivation, since this builder doesn't
+ * run in a sandbox.
+ */
+static void builtinCopyStorePaths(const BuiltinBuilderContext & ctx)
+{
+    auto i = ctx.drv.env.find("paths");
+    if (i == ctx.drv.env.end())
+        throw Error("attribute 'paths' missing");
+
+    std::filesystem::path out{ctx.outputs.at("out")};
+
+    for (auto & path : tokenizeString<Strings>(i->second)) {
+        if (canonPath(path) != path)
+            throw Error("path '%s' is not canonical", path);
+        auto storePath = path.substr(0, path.find('/', ctx.storeDir.size() + 1));
+        if (!isInDir(path, ctx.storeDir) || !ctx.inputPaths.count(storePath))
+            throw Error("path '%s' is not an input of the derivation", path);
+        mergeInto(path, out);
+    }
+}
+
+static RegisterBuiltinBuilder registerCopyStorePaths("copy-store-paths", builtinCopyStorePaths, false);
+
+} // namespace nix
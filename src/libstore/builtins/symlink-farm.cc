@@ -0,0 +1,39 @@
+#include "nix/store/builtins.hh"
+#include "nix/util/canon-path.hh"
+
+#include <nlohmann/json.hpp>
+
+namespace nix {
+
+/**
+ * Create a directory containing the symlinks in the attribute
+ * `entries`, a JSON object that maps relative paths in the output to
+ * symlink targets, like `linkFarm` in Nixpkgs.
+ */
+static void builtinSymlinkFarm(const BuiltinBuilderContext & ctx)
+{
+    auto i = ctx.drv.env.find("entries");
+    if (i == ctx.drv.env.end())
+        throw Error("attribute 'entries' missing");
+
+    auto entries = nlohmann::json::parse(i->second);
+    if (!entries.is_object())
+        throw Error("attribute 'entries' must be a JSON object");
+
+    std::filesystem::path out{ctx.outputs.at("out")};
+    createDirs(out);
+
+    for (auto & [name, target] : entries.items()) {
+        if (CanonPath(name).rel() != name)
+            throw Error("symlink name '%s' is not a normalised relative path", name);
+        if (!target.is_string())
+            throw Error("target of symlink '%s' must be a string", name);
+        auto link = out / name;
+        createDirs(link.parent_path());
+        createSymlink(target.get<std::string>(), link.string());
+    }
+}
+
+static RegisterBuiltinBuilder registerSymlinkFarm("symlink-farm", builtinSymlinkFarm, false);
+
+} // namespace nix
@@ -0,0 +1,45 @@
+#include "nix/store/builtins.hh"
+#include "nix/util/canon-path.hh"
+
+#include <sys/stat.h>
+
+namespace nix {
+
+/**
+ * Write the attribute `text` to the output, or to the file
+ * `destination` in the output if it is set, like `writeTextFile` in
+ * Nixpkgs. If `executable` is `1`, the file is made executable.
+ */
+static void builtinWriteText(const BuiltinBuilderContext & ctx)
+{
+    auto getAttr = [&](const std::string & name) -> const std::string & {
+        auto i = ctx.drv.env.find(name);
+        if (i == ctx.drv.env.end())
+            throw Error("attribute '%s' missing", name);
+        return i->second;
+    };
+
+    auto getOptionalAttr = [&](const std::string & name) -> std::string {
+        auto i = ctx.drv.env.find(name);
+        return i == ctx.drv.env.end() ? "" : i->second;
+    };
+
+    std::filesystem::path file{ctx.outputs.at("out")};
+
+    if (auto destination = getOptionalAttr("destination"); !destination.empty()) {
+        if (CanonPath(destination).rel() != destination)
+            throw Error("destination '%s' is not a normalised relative path", destination);
+        file /= destination;
+        createDirs(file.parent_path());
+    }
+
+    writeFile(file, getAttr("text"));
+
+    if (getOptionalAttr("executable") == "1")
+        if (chmod(file.c_str(), 0755) == -1)
+            throw SysError("making '%s' executable", file);
+}
+
+static RegisterBuiltinBuilder registerWriteText("write-text", builtinWriteText, false);
+
+} // namespace nix
@@ -13,10 +13,14 @@
 #include "nix/store/path-with-outputs.hh"
 #include "nix/util/finally.hh"
 #include "nix/util/archive.hh"
+#include "nix/util/compression.hh"
+#include "nix/store/nar-delta.hh"
+#include "nix/store/store-metrics.hh"
 #include "nix/store/derivations.hh"
 #include "nix/util/args.hh"
 #include "nix/util/git.hh"
 #include "nix/util/logging.hh"
+#include "nix/util/tracing.hh"
 #include "nix/store/globals.hh"
 
 #ifndef _WIN32 // TODO need graceful async exit support on Windows?
@@ -281,6 +285,9 @@ struct ClientSettings
                     warn(
                         "Ignoring the client-specified plugin-files.\n"
                         "The client specifying plugins to the daemon never made sense, and was removed in Nix >=2.14.");
+                } else if (name == loggerSettings.traceParent.name) {
+                    /* Only affects the spans this process writes. */
+                    loggerSettings.traceParent = value;
                 } else if (
                     trusted || name == settings.buildTimeout.name || name == settings.maxSilentTime.name
                     || name == settings.pollInterval.name || name == "connect-timeout"
@@ -299,6 +306,50 @@ struct ClientSettings
     }
 };
 
+/**
+ * Call `fun` with a source of the NAR data in `framed`, decompressing
+ * it if `WorkerProto::featureZstdNar` was negotiated.
+ */
+static void
+withNarSource(WorkerProto::BasicServerConnection & conn, Source & framed, std::function<void(Source &)> fun)
+{
+    if (!conn.features.contains(WorkerProto::featureZstdNar))
+        return fun(framed);
+
+    auto source = sinkToSource([&](Sink & sink) {
+        auto decompressor = makeDecompressionSink("zstd", sink);
+        framed.drainInto(*decompressor);
+        decompressor->finish();
+    });
+    fun(*source);
+}
+
+/**
+ * Read the path info and flags sent with `Op::AddToStoreNar` and
+ * `Op::AddToStoreNarDelta`.
+ */
+static std::tuple<ValidPathInfo, RepairFlag, CheckSigsFlag>
+readAddToStoreNarRequest(Store & store, TrustedFlag trusted, WorkerProto::BasicServerConnection & conn)
+{
+    WorkerProto::ReadConn rconn(conn);
+    bool repair, dontCheckSigs;
+    auto path = WorkerProto::Serialise<StorePath>::read(store, rconn);
+    auto deriver = WorkerProto::Serialise<std::optional<StorePath>>::read(store, rconn);
+    auto narHash = Hash::parseAny(readString(conn.from), HashAlgorithm::SHA256);
+    ValidPathInfo info{path, {store, narHash}};
+    info.deriver = std::move(deriver);
+    info.references = WorkerProto::Serialise<StorePathSet>::read(store, rconn);
+    conn.from >> info.registrationTime >> info.narSize >> info.ultimate;
+    info.sigs = readStrings<StringSet>(conn.from);
+    info.ca = ContentAddress::parseOpt(readString(conn.from));
+    conn.from >> repair >> dontCheckSigs;
+    if (!trusted && dontCheckSigs)
+        dontCheckSigs = false;
+    if (!trusted)
+        info.ultimate = false;
+    return {std::move(info), (RepairFlag) repair, dontCheckSigs ? NoCheckSigs : CheckSigs};
+}
+
 static void performOp(
     TunnelLogger * logger,
     ref<Store> store,
@@ -519,8 +570,10 @@ static void performOp(
 
         logger->startWork();
         {
-            FramedSource source(conn.from);
-            store->addMultipleToStore(source, RepairFlag{repair}, dontCheckSigs ? NoCheckSigs : CheckSigs);
+            FramedSource framed(conn.from);
+            withNarSource(conn, framed, [&](Source & source) {
+                store->addMultipleToStore(source, RepairFlag{repair}, dontCheckSigs ? NoCheckSigs : CheckSigs);
+            });
         }
         logger->stopWork();
         break;
@@ -686,6 +739,15 @@ static void performOp(
         break;
     }
 
+    case WorkerProto::Op::AddTempRoots: {
+        auto paths = WorkerProto::Serialise<StorePathSet>::read(*store, rconn);
+        logger->startWork();
+        store->addTempRoots(paths);
+        logger->stopWork();
+        conn.to << 1;
+        break;
+    }
+
     case WorkerProto::Op::AddPermRoot: {
         if (!trusted)
             throw Error(
@@ -864,6 +926,47 @@ static void performOp(
         break;
     }
 
+    case WorkerProto::Op::QueryMultiplePathInfos: {
+        auto paths = WorkerProto::Serialise<StorePathSet>::read(*store, rconn);
+        logger->startWork();
+        std::map<StorePath, UnkeyedValidPathInfo> infos;
+        for (auto & [path, info] : store->queryMultiplePathInfos(paths))
+            infos.insert_or_assign(path, static_cast<const UnkeyedValidPathInfo &>(*info));
+        logger->stopWork();
+        WorkerProto::write(*store, wconn, infos);
+        break;
+    }
+
+    case WorkerProto::Op::QueryClosure: {
+        auto paths = WorkerProto::Serialise<StorePathSet>::read(*store, rconn);
+        bool flipDirection, includeOutputs, includeDerivers;
+        conn.from >> flipDirection >> includeOutputs >> includeDerivers;
+        logger->startWork();
+        StorePathSet closure;
+        store->computeFSClosure(paths, closure, flipDirection, includeOutputs, includeDerivers);
+        std::map<StorePath, UnkeyedValidPathInfo> infos;
+        for (auto & [path, info] : store->queryMultiplePathInfos(closure))
+            infos.insert_or_assign(path, static_cast<const UnkeyedValidPathInfo &>(*info));
+        logger->stopWork();
+        WorkerProto::write(*store, wconn, infos);
+        break;
+    }
+
+    case WorkerProto::Op::QueryDerivationHashesModulo: {
+        auto drvPaths = WorkerProto::Serialise<StorePathSet>::read(*store, rconn);
+        logger->startWork();
+        auto drvHashes = store->queryDerivationHashesModulo(drvPaths);
+        logger->stopWork();
+        conn.to << drvHashes.size();
+        for (auto & [drvPath, drvHash] : drvHashes) {
+            WorkerProto::write(*store, wconn, drvPath);
+            conn.to << (drvHash.kind == DrvHash::Kind::Deferred) << drvHash.hashes.size();
+            for (auto & [outputName, hash] : drvHash.hashes)
+                conn.to << outputName << hash.to_string(HashFormat::SRI, true);
+        }
+        break;
+    }
+
     case WorkerProto::Op::OptimiseStore:
         logger->startWork();
         store->optimiseStore();
@@ -897,32 +1000,25 @@ static void performOp(
         auto path = WorkerProto::Serialise<StorePath>::read(*store, rconn);
         logger->startWork();
         logger->stopWork();
-        store->narFromPath(path, conn.to);
+        if (conn.features.contains(WorkerProto::featureZstdNar)) {
+            FramedSink framed(conn.to, []() {});
+            auto compressor = makeCompressionSink("zstd", framed);
+            store->narFromPath(path, *compressor);
+            compressor->finish();
+        } else
+            store->narFromPath(path, conn.to);
         break;
     }
 
     case WorkerProto::Op::AddToStoreNar: {
-        bool repair, dontCheckSigs;
-        auto path = WorkerProto::Serialise<StorePath>::read(*store, rconn);
-        auto deriver = WorkerProto::Serialise<std::optional<StorePath>>::read(*store, rconn);
-        auto narHash = Hash::parseAny(readString(conn.from), HashAlgorithm::SHA256);
-        ValidPathInfo info{path, {*store, narHash}};
-        info.deriver = std::move(deriver);
-        info.references = WorkerProto::Serialise<StorePathSet>::read(*store, rconn);
-        conn.from >> info.registrationTime >> info.narSize >> info.ultimate;
-        info.sigs = readStrings<StringSet>(conn.from);
-        info.ca = ContentAddress::parseOpt(readString(conn.from));
-        conn.from >> repair >> dontCheckSigs;
-        if (!trusted && dontCheckSigs)
-            dontCheckSigs = false;
-        if (!trusted)
-            info.ultimate = false;
+        auto [info, repair, checkSigs] = readAddToStoreNarRequest(*store, trusted, conn);
 
         if (GET_PROTOCOL_MINOR(conn.protoVersion) >= 23) {
             logger->startWork();
             {
-                FramedSource source(conn.from);
-                store->addToStore(info, source, (RepairFlag) repair, dontCheckSigs ? NoCheckSigs : CheckSigs);
+                FramedSource framed(conn.from);
+                withNarSource(
+                    conn, framed, [&](Source & source) { store->addToStore(info, source, repair, checkSigs); });
             }
             logger->stopWork();
         }
@@ -942,7 +1038,7 @@ static void performOp(
             logger->startWork();
 
             // FIXME: race if addToStore doesn't read source?
-            store->addToStore(info, *source, (RepairFlag) repair, dontCheckSigs ? NoCheckSigs : CheckSigs);
+            store->addToStore(info, *source, repair, checkSigs);
 
             logger->stopWork();
         }
@@ -950,6 +1046,37 @@ static void performOp(
         break;
     }
 
+    case WorkerProto::Op::QueryDeltaBase: {
+        auto path = WorkerProto::Serialise<StorePath>::read(*store, rconn);
+        auto narSize = readNum<uint64_t>(conn.from);
+        logger->startWork();
+        auto base = findDeltaBase(*store, path, narSize);
+        StringSet chunks;
+        if (base)
+            chunks = getNarChunkHashes(*store, *base);
+        logger->stopWork();
+        WorkerProto::write(*store, wconn, base);
+        conn.to << chunks;
+        break;
+    }
+
+    case WorkerProto::Op::AddToStoreNarDelta: {
+        auto [info, repair, checkSigs] = readAddToStoreNarRequest(*store, trusted, conn);
+        auto base = WorkerProto::Serialise<StorePath>::read(*store, rconn);
+        logger->startWork();
+        {
+            FramedSource framed(conn.from);
+            withNarSource(conn, framed, [&](Source & delta) {
+                /* addToStore() checks the hash of the reconstructed
+                   NAR. */
+                auto nar = sinkToSource([&](Sink & sink) { readNarDelta(*store, base, delta, sink); });
+                store->addToStore(info, *nar, repair, checkSigs);
+            });
+        }
+        logger->stopWork();
+        break;
+    }
+
     case WorkerProto::Op::QueryMissing: {
         auto targets = WorkerProto::Serialise<DerivedPaths>::read(*store, rconn);
         logger->startWork();
@@ -995,6 +1122,17 @@ static void performOp(
         break;
     }
 
+    case WorkerProto::Op::QueryRealisations: {
+        auto outputs = WorkerProto::Serialise<std::set<DrvOutput>>::read(*store, rconn);
+        logger->startWork();
+        std::set<Realisation> realisations;
+        for (auto & [id, info] : store->queryRealisations(outputs))
+            realisations.insert({*info, id});
+        logger->stopWork();
+        WorkerProto::write(*store, wconn, realisations);
+        break;
+    }
+
     case WorkerProto::Op::AddBuildLog: {
         StorePath path{readString(conn.from)};
         logger->startWork();
@@ -1061,13 +1199,27 @@ void processConnection(ref<Store> store, FdSource && from, FdSink && to, Trusted
         prevLogger_ = std::move(logger);
         logger = std::move(tunnelLogger_);
         applyJSONLogger();
+        applyTracingLogger();
     }
 
     unsigned int opCount = 0;
 
+    /* Recursive Nix shares the store of the enclosing connection, whose
+       stats are already being reported. */
+    auto metrics = recursive ? nullptr : getStoreMetrics();
+    StoreStatsReporter statsReporter;
+    if (metrics) {
+        metrics->connections++;
+        metrics->connectionsActive++;
+    }
+
     Finally finally([&]() {
         setInterrupted(false);
         printMsgUsing(prevLogger, lvlDebug, "%d operations", opCount);
+        if (metrics) {
+            statsReporter.report(*store);
+            metrics->connectionsActive--;
+        }
     });
 
     conn.postHandshake(
@@ -1104,6 +1256,20 @@ void processConnection(ref<Store> store, FdSource && from, FdSink && to, Trusted
 
             debug("performing daemon worker op: %d", op);
 
+            auto opStart = std::chrono::steady_clock::now();
+            auto opIndex = (size_t) op;
+            bool opFailed = false;
+
+            Finally recordOp([&]() {
+                if (!metrics || opIndex >= StoreMetrics::maxOps)
+                    return;
+                metrics->opLatency[opIndex].observe(std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - opStart));
+                if (opFailed || std::uncaught_exceptions())
+                    metrics->opErrors[opIndex]++;
+                statsReporter.report(*store);
+            });
+
             try {
                 performOp(tunnelLogger, store, trusted, recursive, conn, op);
             } catch (Error & e) {
@@ -1112,6 +1278,7 @@ void processConnection(ref<Store> store, FdSource && from, FdSink && to, Trusted
                    client.  This can happen especially if I/O errors occur
                    during addTextToStore() / importPath().  If that
                    happens, just send the error message and exit. */
+                opFailed = true;
                 bool errorAllowed = tunnelLogger->state_.lock()->canSendStderr;
                 tunnelLogger->stopWork(&e);
                 if (!errorAllowed)
@@ -9,11 +9,19 @@
 #include "nix/store/common-protocol-impl.hh"
 #include "nix/util/strings-inline.hh"
 #include "nix/util/json-utils.hh"
+#include "nix/util/archive.hh"
 
 #include <boost/container/small_vector.hpp>
 #include <boost/unordered/concurrent_flat_map.hpp>
 #include <nlohmann/json.hpp>
 #include <optional>
+#include <bit>
+
+#if defined(__x86_64__)
+#  include <emmintrin.h>
+#elif defined(__aarch64__)
+#  include <arm_neon.h>
+#endif
 
 namespace nix {
 
@@ -118,11 +126,12 @@ static auto infoForDerivation(Store & store, const Derivation & drv)
     auto contents = drv.unparse(store, false);
     auto hash = hashString(HashAlgorithm::SHA256, contents);
     auto ca = TextInfo{.hash = hash, .references = references};
+    auto path = store.makeFixedOutputPathFromCA(suffix, ca);
     return std::tuple{
         suffix,
         contents,
-        references,
-        store.makeFixedOutputPathFromCA(suffix, ca),
+        ca,
+        path,
     };
 }
 
@@ -137,7 +146,7 @@ StorePath writeDerivation(Store & store, const Derivation & drv, RepairFlag repa
 
 StorePath Store::writeDerivation(const Derivation & drv, RepairFlag repair)
 {
-    auto [suffix, contents, references, path] = infoForDerivation(*this, drv);
+    auto [suffix, contents, ca, path] = infoForDerivation(*this, drv);
 
     if (isValidPath(path) && !repair)
         return path;
@@ -149,13 +158,52 @@ StorePath Store::writeDerivation(const Derivation & drv, RepairFlag repair)
         FileSerialisationMethod::Flat,
         ContentAddressMethod::Raw::Text,
         HashAlgorithm::SHA256,
-        references,
+        ca.references,
         repair);
     assert(path2 == path);
 
     return path;
 }
 
+void writeDerivations(Store & store, const std::vector<Derivation> & drvs, RepairFlag repair)
+{
+    std::vector<std::tuple<std::string, std::string, TextInfo, StorePath>> infos;
+    StorePathSet paths;
+    for (auto & drv : drvs) {
+        auto & info = infos.emplace_back(infoForDerivation(store, drv));
+        paths.insert(std::get<3>(info));
+    }
+
+    /* Register the temporary roots in one go rather than one by one
+       while adding the paths. This also protects the derivations that
+       are already valid. */
+    store.addTempRoots(paths);
+
+    auto valid = repair ? StorePathSet{} : store.queryValidPaths(paths);
+
+    /* The sources only refer to the NARs, so keep those alive until
+       the paths have been added. */
+    std::list<std::string> nars;
+    Store::PathsSource pathsToAdd;
+    StorePathSet added;
+    for (auto & [suffix, contents, ca, path] : infos) {
+        if (valid.count(path) || !added.insert(path).second)
+            continue;
+        StringSink nar;
+        dumpString(contents, nar);
+        auto info = ValidPathInfo::makeFromCA(store, suffix, std::move(ca), hashString(HashAlgorithm::SHA256, nar.s));
+        assert(info.path == path);
+        info.narSize = nar.s.size();
+        pathsToAdd.emplace_back(std::move(info), std::make_unique<StringSource>(nars.emplace_back(std::move(nar.s))));
+    }
+
+    if (pathsToAdd.empty())
+        return;
+
+    Activity act(*logger, lvlDebug, actUnknown, fmt("writing %d derivations", pathsToAdd.size()));
+    store.addMultipleToStore(std::move(pathsToAdd), act, repair);
+}
+
 namespace {
 /**
  * This mimics std::istream to some extent. We use this much smaller implementation
@@ -215,53 +263,69 @@ static void expect(StringViewStream & str, char c)
     str.remaining.remove_prefix(1);
 }
 
+/**
+ * @return The position of the first `"` or `\\` in `s` at or after
+ * `start`, or `s.size()` if there is none.
+ */
+static size_t findQuoteOrBackslash(std::string_view s, size_t start)
+{
+    auto i = start;
+#if defined(__x86_64__)
+    auto quote = _mm_set1_epi8('"');
+    auto backslash = _mm_set1_epi8('\\');
+    for (; i + 16 <= s.size(); i += 16) {
+        auto x = _mm_loadu_si128((const __m128i *) (s.data() + i));
+        auto m = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(x, quote), _mm_cmpeq_epi8(x, backslash)));
+        if (m)
+            return i + std::countr_zero(unsigned(m));
+    }
+#elif defined(__aarch64__)
+    auto quote = vdupq_n_u8('"');
+    auto backslash = vdupq_n_u8('\\');
+    for (; i + 16 <= s.size(); i += 16) {
+        auto x = vld1q_u8((const uint8_t *) (s.data() + i));
+        auto m = vorrq_u8(vceqq_u8(x, quote), vceqq_u8(x, backslash));
+        /* Narrow each byte of the mask to 4 bits. */
+        auto bits = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0);
+        if (bits)
+            return i + std::countr_zero(bits) / 4;
+    }
+#endif
+    for (; i < s.size(); ++i)
+        if (s[i] == '"' || s[i] == '\\')
+            return i;
+    return s.size();
+}
+
 /* Read a C-style string from stream `str'. */
 static BackedStringView parseString(StringViewStream & str)
 {
     expect(str, '"');
-    size_t start = 0;
-    size_t end = str.remaining.size();
-    const auto data = str.remaining.data();
-    while (start < end) {
-        auto idx = str.remaining.find('"', start);
-        if (idx == std::string_view::npos) {
-            break;
-        }
-        size_t pos = idx;
-        for (; pos > 0 && data[pos - 1] == '\\'; pos--)
-            ;
-        if ((idx - pos) % 2 == 0) { // even number of backslashes
-            end = idx;
-            break;
-        }
-        start = idx + 1;
-    }
-
-    start = 0;
-    const auto content = str.remaining.substr(start, end);
-    str.remaining.remove_prefix(end + 1);
-
-    auto nextBackslash = content.find('\\', start);
-    if (nextBackslash == std::string_view::npos) {
-        return content;
+    const auto s = str.remaining;
+
+    /* Most strings contain no escapes, so return a view into the
+       input unless we run into a backslash. */
+    auto i = findQuoteOrBackslash(s, 0);
+    if (i < s.size() && s[i] == '"') {
+        str.remaining.remove_prefix(i + 1);
+        return s.substr(0, i);
     }
 
     std::string res;
-    res.reserve(end);
-    do {
-        if (nextBackslash == end - 1) {
+    size_t start = 0;
+    while (true) {
+        if (i == s.size())
             throw FormatError("unterminated string in derivation");
-        }
-        if (nextBackslash > start) {
-            res.append(&data[start], nextBackslash - start);
-        }
-        res.push_back(escapes[data[nextBackslash + 1]]);
-        start = nextBackslash + 2;
-        nextBackslash = content.find('\\', start);
-    } while (nextBackslash != std::string_view::npos);
-    if (end > start) {
-        res.append(&data[start], end - start);
+        res.append(s.substr(start, i - start));
+        if (s[i] == '"')
+            break;
+        if (i + 1 == s.size())
+            throw FormatError("unterminated string in derivation");
+        res.push_back(escapes[s[i + 1]]);
+        start = i + 2;
+        i = findQuoteOrBackslash(s, start);
     }
+    str.remaining.remove_prefix(i + 1);
     return res;
 }
 
@@ -291,12 +355,23 @@ static bool endOfList(StringViewStream & str)
     return false;
 }
 
+/* The lists and maps in a derivation are written in sorted order, so
+   inserting at the end is constant time. */
 static StringSet parseStrings(StringViewStream & str, bool arePaths)
 {
     StringSet res;
     expect(str, '[');
     while (!endOfList(str))
-        res.insert((arePaths ? parsePath(str) : parseString(str)).toOwned());
+        res.insert(res.end(), (arePaths ? parsePath(str) : parseString(str)).toOwned());
+    return res;
+}
+
+static StorePathSet parsePaths(const StoreDirConfig & store, StringViewStream & str)
+{
+    StorePathSet res;
+    expect(str, '[');
+    while (!endOfList(str))
+        res.insert(res.end(), store.parseStorePath(*parsePath(str)));
     return res;
 }
 
@@ -467,7 +542,7 @@ Derivation parseDerivation(
         expect(str, '(');
         std::string id = parseString(str).toOwned();
         auto output = parseDerivationOutput(store, str, xpSettings);
-        drv.outputs.emplace(std::move(id), std::move(output));
+        drv.outputs.emplace_hint(drv.outputs.end(), std::move(id), std::move(output));
     }
 
     /* Parse the list of input derivations. */
@@ -477,12 +552,12 @@ Derivation parseDerivation(
         auto drvPath = parsePath(str);
         expect(str, ',');
         drv.inputDrvs.map.insert_or_assign(
-            store.parseStorePath(*drvPath), parseDerivedPathMapNode(store, str, version));
+            drv.inputDrvs.map.end(), store.parseStorePath(*drvPath), parseDerivedPathMapNode(store, str, version));
         expect(str, ')');
     }
 
     expect(str, ',');
-    drv.inputSrcs = store.parseStorePathSet(parseStrings(str, true));
+    drv.inputSrcs = parsePaths(store, str);
     expect(str, ',');
     drv.platform = parseString(str).toOwned();
     expect(str, ',');
@@ -503,7 +578,7 @@ Derivation parseDerivation(
         if (name == StructuredAttrs::envVarName) {
             drv.structuredAttrs = StructuredAttrs::parse(*std::move(value));
         } else {
-            drv.env.insert_or_assign(std::move(name), std::move(value).toOwned());
+            drv.env.insert_or_assign(drv.env.end(), std::move(name), std::move(value).toOwned());
         }
         expect(str, ')');
     }
@@ -921,6 +996,17 @@ DrvHash hashDerivationModulo(Store & store, const Derivation & drv, bool maskOut
             [](const DerivationType::Impure &) -> DrvHash::Kind { return DrvHash::Kind::Deferred; }},
         drv.type().raw);
 
+    /* Get the hashes of the input derivations that we haven't seen
+       yet from the store in one go, if it keeps them, rather than
+       reading and hashing every one of them. */
+    StorePathSet unknownInputs;
+    for (auto & [drvPath, _] : drv.inputDrvs.map)
+        if (!drvHashes.contains(drvPath))
+            unknownInputs.insert(drvPath);
+    if (!unknownInputs.empty())
+        for (auto & [drvPath, h] : store.queryDerivationHashesModulo(unknownInputs))
+            drvHashes.insert_or_assign(drvPath, std::move(h));
+
     DerivedPathMap<StringSet>::ChildNode::Map inputs2;
     for (auto & [drvPath, node] : drv.inputDrvs.map) {
         const auto & res = pathDerivationModulo(store, drvPath);
@@ -4,8 +4,13 @@
 #include "nix/util/archive.hh"
 #include "nix/store/common-protocol.hh"
 #include "nix/store/common-protocol-impl.hh"
+#include "nix/store/globals.hh"
+#include "nix/util/compression.hh"
+#include "nix/util/sync.hh"
+#include "nix/util/thread-pool.hh"
 
 #include <algorithm>
+#include <condition_variable>
 
 namespace nix {
 
@@ -34,11 +39,83 @@ static void exportPath(Store & store, const StorePath & path, Sink & sink)
     teeSink << (info->deriver ? store.printStorePath(*info->deriver) : "") << 0;
 }
 
-void exportPaths(Store & store, const StorePathSet & paths, Sink & sink)
+/**
+ * Like `FramedSink`, but for any sink. The terminating empty frame is
+ * written by the caller.
+ */
+struct NarFrameSink : BufferedSink
+{
+    Sink & to;
+
+    NarFrameSink(Sink & to)
+        : BufferedSink(64 * 1024)
+        , to(to)
+    {
+    }
+
+    void writeUnbuffered(std::string_view data) override
+    {
+        to << data.size();
+        to(data);
+    }
+};
+
+static void exportPathsV2(Store & store, const StorePaths & sorted, Sink & sink, const std::string & compression)
+{
+    std::vector<ref<const ValidPathInfo>> infos;
+    infos.reserve(sorted.size());
+    for (auto & path : sorted)
+        infos.push_back(store.queryPathInfo(path));
+
+    /* Write all metadata up front, so that the importer can check
+       the references and plan the import before reading any NAR. */
+    sink << 2 << compression << infos.size();
+    for (auto & info : infos) {
+        sink << store.printStorePath(info->path);
+        CommonProto::write(store, CommonProto::WriteConn{.to = sink}, info->references);
+        sink << (info->deriver ? store.printStorePath(*info->deriver) : "")
+             << info->narHash.to_string(HashFormat::Nix32, true) << info->narSize << renderContentAddress(info->ca)
+             << info->sigs;
+    }
+
+    for (auto & info : infos) {
+        NarFrameSink framed(sink);
+        auto compressor = makeCompressionSink(compression, framed);
+
+        HashSink hashSink(info->narHash.algo);
+        TeeSink teeSink(*compressor, hashSink);
+
+        store.narFromPath(info->path, teeSink);
+        compressor->finish();
+        framed.flush();
+        sink << 0;
+
+        Hash hash = hashSink.currentHash().hash;
+        if (hash != info->narHash && info->narHash != Hash(info->narHash.algo))
+            throw Error(
+                "hash of path '%s' has changed from '%s' to '%s'!",
+                store.printStorePath(info->path),
+                info->narHash.to_string(HashFormat::Nix32, true),
+                hash.to_string(HashFormat::Nix32, true));
+    }
+}
+
+void exportPaths(Store & store, const StorePathSet & paths, Sink & sink, unsigned int version, const std::string & compression)
 {
     auto sorted = store.topoSortPaths(paths);
     std::reverse(sorted.begin(), sorted.end());
 
+    if (version == 2) {
+        exportPathsV2(store, sorted, sink, compression);
+        return;
+    }
+
+    if (version != 1)
+        throw Error("unsupported export format version %d", version);
+
+    if (compression != "none")
+        throw Error("export format version 1 does not support compression");
+
     for (auto & path : sorted) {
         sink << 1;
         exportPath(store, path, sink);
@@ -47,11 +124,168 @@ void exportPaths(Store & store, const StorePathSet & paths, Sink & sink)
     sink << 0;
 }
 
+static StorePaths importPathsV2(Store & store, Source & source, CheckSigsFlag checkSigs)
+{
+    auto compression = readString(source);
+    auto n = readNum<size_t>(source);
+
+    std::vector<ValidPathInfo> infos;
+    infos.reserve(n);
+    std::map<StorePath, size_t> index;
+
+    for (size_t i = 0; i < n; ++i) {
+        auto path = store.parseStorePath(readString(source));
+        auto references = CommonProto::Serialise<StorePathSet>::read(store, CommonProto::ReadConn{.from = source});
+        auto deriver = readString(source);
+        auto narHash = Hash::parseAnyPrefixed(readString(source));
+        ValidPathInfo info{path, {store, narHash}};
+        info.references = std::move(references);
+        if (deriver != "")
+            info.deriver = store.parseStorePath(deriver);
+        info.narSize = readNum<uint64_t>(source);
+        info.ca = ContentAddress::parseOpt(readString(source));
+        info.sigs = readStrings<StringSet>(source);
+        index.emplace(info.path, i);
+        infos.push_back(std::move(info));
+    }
+
+    /* Refuse to import anything if a reference is neither in the
+       stream nor already in the store, rather than failing halfway
+       through. */
+    StorePathSet external;
+    for (auto & info : infos)
+        for (auto & ref : info.references)
+            if (!index.contains(ref))
+                external.insert(ref);
+    auto valid = store.queryValidPaths(external);
+    for (auto & info : infos)
+        for (auto & ref : info.references)
+            if (!index.contains(ref) && !valid.contains(ref))
+                throw Error(
+                    "cannot import path '%s' because it refers to '%s', which is not in the store",
+                    store.printStorePath(info.path),
+                    store.printStorePath(ref));
+
+    struct Item
+    {
+        size_t pendingDeps = 0;
+        std::vector<size_t> dependents;
+        bool arrived = false;
+        std::string data;
+    };
+
+    struct State
+    {
+        std::vector<Item> items;
+        uint64_t bytesInFlight = 0;
+        bool failed = false;
+    };
+
+    Sync<State> state_;
+    std::condition_variable wakeup;
+
+    {
+        auto state(state_.lock());
+        state->items.resize(n);
+        for (size_t i = 0; i < n; ++i)
+            for (auto & ref : infos[i].references)
+                if (auto j = index.find(ref); j != index.end() && j->second != i) {
+                    state->items[i].pendingDeps++;
+                    state->items[j->second].dependents.push_back(i);
+                }
+    }
+
+    /* The NARs are read sequentially on this thread, and each one is
+       added to the store by the pool as soon as it and all of its
+       dependencies in the stream have arrived. Since the stream is
+       topologically sorted, everything that has arrived eventually
+       becomes ready, so waiting for memory can't deadlock. */
+    uint64_t maxBytesInFlight = settings.copyMaxBytesInFlight;
+    ThreadPool pool;
+
+    std::function<void(State &, size_t)> schedule;
+
+    auto importItem = [&](size_t i) {
+        try {
+            auto size = std::max<uint64_t>(infos[i].narSize, 1);
+            std::string nar;
+            {
+                auto state(state_.lock());
+                nar = std::move(state->items[i].data);
+            }
+            if (compression != "none")
+                nar = decompress(compression, nar);
+
+            auto & info = infos[i];
+            auto hash = hashString(info.narHash.algo, nar);
+            /* As with the old format, a zero (unknown) hash in the
+               header is replaced by the actual one. */
+            if (info.narHash == Hash(info.narHash.algo)) {
+                info.narHash = hash;
+                info.narSize = nar.size();
+            } else if (nar.size() != info.narSize || hash != info.narHash)
+                throw Error(
+                    "NAR of path '%s' in the import stream is corrupt: expected hash '%s', got '%s'",
+                    store.printStorePath(info.path),
+                    info.narHash.to_string(HashFormat::Nix32, true),
+                    hash.to_string(HashFormat::Nix32, true));
+
+            StringSource narSource(nar);
+            store.addToStore(info, narSource, NoRepair, checkSigs);
+
+            auto state(state_.lock());
+            state->bytesInFlight -= size;
+            for (auto j : state->items[i].dependents)
+                if (--state->items[j].pendingDeps == 0 && state->items[j].arrived)
+                    schedule(*state, j);
+            wakeup.notify_all();
+        } catch (...) {
+            state_.lock()->failed = true;
+            wakeup.notify_all();
+            throw;
+        }
+    };
+
+    schedule = [&](State & state, size_t i) {
+        if (!state.failed)
+            pool.enqueue([&importItem, i]() { importItem(i); });
+    };
+
+    for (size_t i = 0; i < n; ++i) {
+        FramedSource framed(source);
+        auto data = framed.drain();
+
+        auto size = std::max<uint64_t>(infos[i].narSize, 1);
+        auto state(state_.lock());
+        while (state->bytesInFlight > 0 && state->bytesInFlight + size > maxBytesInFlight && !state->failed)
+            state.wait(wakeup);
+        if (state->failed)
+            break;
+        state->bytesInFlight += size;
+        auto & item = state->items[i];
+        item.data = std::move(data);
+        item.arrived = true;
+        if (item.pendingDeps == 0)
+            schedule(*state, i);
+    }
+
+    pool.process();
+
+    StorePaths res;
+    for (auto & info : infos)
+        res.push_back(info.path);
+    return res;
+}
+
 StorePaths importPaths(Store & store, Source & source, CheckSigsFlag checkSigs)
 {
     StorePaths res;
+    bool first = true;
     while (true) {
         auto n = readNum<uint64_t>(source);
+        if (n == 2 && first)
+            return importPathsV2(store, source, checkSigs);
+        first = false;
         if (n == 0)
             break;
         if (n != 1)
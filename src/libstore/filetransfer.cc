@@ -23,8 +23,10 @@
 
 #include <curl/curl.h>
 
+#include <atomic>
 #include <cmath>
 #include <cstring>
+#include <mutex>
 #include <queue>
 #include <random>
 #include <thread>
@@ -59,10 +61,9 @@ struct curlMultiError : Error
 
 struct curlFileTransfer : public FileTransfer
 {
-    curlMulti curlm;
-
     std::random_device rd;
-    std::mt19937 mt19937;
+
+    struct TransferThread;
 
     struct TransferItem : public std::enable_shared_from_this<TransferItem>, public FileTransfer::Item
     {
@@ -78,6 +79,7 @@ struct curlFileTransfer : public FileTransfer
         bool active = false;   // whether the handle has been added to the multi object
         bool paused = false;   // whether the request has been paused previously
         bool enqueued = false; // whether the request has been added the incoming queue
+        TransferThread * thread = nullptr; // the thread whose queue the request was last added to
         std::string statusMsg;
 
         unsigned int attempt = 0;
@@ -171,7 +173,7 @@ struct curlFileTransfer : public FileTransfer
         {
             if (req) {
                 if (active)
-                    curl_multi_remove_handle(fileTransfer.curlm.get(), req);
+                    curl_multi_remove_handle(thread->curlm.get(), req);
                 curl_easy_cleanup(req);
             }
             try {
@@ -266,6 +268,7 @@ struct curlFileTransfer : public FileTransfer
                 result.etag = "";
                 result.data.clear();
                 result.bodySize = 0;
+                result.totalSize.reset();
                 statusMsg = trim(match.str(1));
                 acceptRanges = false;
                 encoding = "";
@@ -297,6 +300,14 @@ struct curlFileTransfer : public FileTransfer
                     else if (name == "accept-ranges" && toLower(trim(line.substr(i + 1))) == "bytes")
                         acceptRanges = true;
 
+                    else if (name == "content-range") {
+                        auto value = trim(line.substr(i + 1));
+                        static std::regex contentRangeRegex(
+                            "bytes [0-9]+-[0-9]+/([0-9]+)", std::regex::extended | std::regex::icase);
+                        if (std::smatch match; std::regex_match(value, match, contentRangeRegex))
+                            result.totalSize = string2Int<uint64_t>(match.str(1));
+                    }
+
                     else if (name == "link" || name == "x-amz-meta-link") {
                         auto value = trim(line.substr(i + 1));
                         static std::regex linkRegex(
@@ -426,6 +437,7 @@ struct curlFileTransfer : public FileTransfer
             }
 
             curl_easy_setopt(req, CURLOPT_URL, request.uri.to_string().c_str());
+            curl_easy_setopt(req, CURLOPT_SHARE, fileTransfer.share);
             curl_easy_setopt(req, CURLOPT_FOLLOWLOCATION, 1L);
             curl_easy_setopt(req, CURLOPT_MAXREDIRS, 10);
             curl_easy_setopt(req, CURLOPT_NOSIGNAL, 1);
@@ -659,7 +671,7 @@ struct curlFileTransfer : public FileTransfer
                     && (!this->request.dataCallback || writtenToSink == 0 || (acceptRanges && encoding.empty()))) {
                     int ms = retryTimeMs
                              * std::pow(
-                                 2.0f, attempt - 1 + std::uniform_real_distribution<>(0.0, 0.5)(fileTransfer.mt19937));
+                                 2.0f, attempt - 1 + std::uniform_real_distribution<>(0.0, 0.5)(thread->mt19937));
                     if (writtenToSink)
                         warn("%s; retrying from offset %d in %d ms", exc.what(), writtenToSink, ms);
                     else
@@ -711,168 +723,275 @@ struct curlFileTransfer : public FileTransfer
         }
     };
 
-    Sync<State> state_;
+    /**
+     * A thread that runs transfers on its own `curl_multi` handle.
+     * Transfers are spread over several of these, so that TLS,
+     * decompression and data callbacks don't all run on one core.
+     */
+    struct TransferThread
+    {
+        curlFileTransfer & fileTransfer;
 
-    std::thread workerThread;
+        curlMulti curlm;
 
-    curlFileTransfer()
-        : mt19937(rd())
-    {
-        static std::once_flag globalInit;
-        std::call_once(globalInit, curl_global_init, CURL_GLOBAL_ALL);
+        std::mt19937 mt19937;
 
-        curlm = curlMulti(curl_multi_init());
+        Sync<State> state_;
 
-        curl_multi_setopt(curlm.get(), CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
-        curl_multi_setopt(curlm.get(), CURLMOPT_MAX_TOTAL_CONNECTIONS, fileTransferSettings.httpConnections.get());
+        /**
+         * The number of transfers that are queued or running on this
+         * thread.
+         */
+        std::atomic<size_t> load{0};
 
-        workerThread = std::thread([&]() { workerThreadEntry(); });
-    }
+        std::thread thread;
 
-    ~curlFileTransfer()
-    {
-        try {
-            stopWorkerThread();
-        } catch (...) {
-            ignoreExceptionInDestructor();
+        TransferThread(curlFileTransfer & fileTransfer, size_t maxConnections)
+            : fileTransfer(fileTransfer)
+            , mt19937(fileTransfer.rd())
+        {
+            curlm = curlMulti(curl_multi_init());
+
+            curl_multi_setopt(curlm.get(), CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+            curl_multi_setopt(curlm.get(), CURLMOPT_MAX_TOTAL_CONNECTIONS, maxConnections);
+
+            thread = std::thread([&]() { workerThreadEntry(); });
         }
-        workerThread.join();
-    }
 
-    void stopWorkerThread()
-    {
-        /* Signal the worker thread to exit. */
-        state_.lock()->quit();
-        wakeupMulti();
-    }
+        void stop()
+        {
+            state_.lock()->quit();
+            wakeupMulti();
+        }
 
-    void wakeupMulti()
-    {
-        if (auto ec = ::curl_multi_wakeup(curlm.get()))
-            throw curlMultiError(ec);
-    }
+        void wakeupMulti()
+        {
+            if (auto ec = ::curl_multi_wakeup(curlm.get()))
+                throw curlMultiError(ec);
+        }
 
-    void workerThreadMain()
-    {
+        void workerThreadMain()
+        {
 /* Cause this thread to be notified on SIGINT. */
 #ifndef _WIN32 // TODO need graceful async exit support on Windows?
-        auto callback = createInterruptCallback([&]() { stopWorkerThread(); });
+            auto callback = createInterruptCallback([&]() { fileTransfer.stopWorkerThreads(); });
 #endif
 
 #ifdef __linux__
-        try {
-            tryUnshareFilesystem();
-        } catch (nix::Error & e) {
-            e.addTrace({}, "in download thread");
-            throw;
-        }
+            try {
+                tryUnshareFilesystem();
+            } catch (nix::Error & e) {
+                e.addTrace({}, "in download thread");
+                throw;
+            }
 #endif
 
-        std::map<CURL *, std::shared_ptr<TransferItem>> items;
+            std::map<CURL *, std::shared_ptr<TransferItem>> items;
+
+            bool quit = false;
+
+            std::chrono::steady_clock::time_point nextWakeup;
+
+            while (!quit) {
+                checkInterrupt();
+
+                /* Let curl do its thing. */
+                int running;
+                CURLMcode mc = curl_multi_perform(curlm.get(), &running);
+                if (mc != CURLM_OK)
+                    throw nix::Error("unexpected error from curl_multi_perform(): %s", curl_multi_strerror(mc));
+
+                /* Set the promises of any finished requests. */
+                CURLMsg * msg;
+                int left;
+                while ((msg = curl_multi_info_read(curlm.get(), &left))) {
+                    if (msg->msg == CURLMSG_DONE) {
+                        auto i = items.find(msg->easy_handle);
+                        assert(i != items.end());
+                        i->second->finish(msg->data.result);
+                        curl_multi_remove_handle(curlm.get(), i->second->req);
+                        i->second->active = false;
+                        items.erase(i);
+                        load--;
+                    }
+                }
 
-        bool quit = false;
+                /* Wait for activity, including wakeup events. */
+                long maxSleepTimeMs = items.empty() ? 10000 : 100;
+                auto sleepTimeMs = nextWakeup != std::chrono::steady_clock::time_point()
+                                       ? std::max(
+                                             0,
+                                             (int) std::chrono::duration_cast<std::chrono::milliseconds>(
+                                                 nextWakeup - std::chrono::steady_clock::now())
+                                                 .count())
+                                       : maxSleepTimeMs;
+
+                int numfds = 0;
+                mc = curl_multi_poll(curlm.get(), nullptr, 0, sleepTimeMs, &numfds);
+                if (mc != CURLM_OK)
+                    throw curlMultiError(mc);
+
+                nextWakeup = std::chrono::steady_clock::time_point();
+
+                std::vector<std::shared_ptr<TransferItem>> incoming;
+                auto now = std::chrono::steady_clock::now();
+
+                {
+                    auto state(state_.lock());
+                    while (!state->incoming.empty()) {
+                        auto item = state->incoming.top();
+                        if (item->embargo <= now) {
+                            incoming.push_back(item);
+                            state->incoming.pop();
+                        } else {
+                            if (nextWakeup == std::chrono::steady_clock::time_point() || item->embargo < nextWakeup)
+                                nextWakeup = item->embargo;
+                            break;
+                        }
+                    }
+                    quit = state->isQuitting();
+                }
 
-        std::chrono::steady_clock::time_point nextWakeup;
-
-        while (!quit) {
-            checkInterrupt();
-
-            /* Let curl do its thing. */
-            int running;
-            CURLMcode mc = curl_multi_perform(curlm.get(), &running);
-            if (mc != CURLM_OK)
-                throw nix::Error("unexpected error from curl_multi_perform(): %s", curl_multi_strerror(mc));
-
-            /* Set the promises of any finished requests. */
-            CURLMsg * msg;
-            int left;
-            while ((msg = curl_multi_info_read(curlm.get(), &left))) {
-                if (msg->msg == CURLMSG_DONE) {
-                    auto i = items.find(msg->easy_handle);
-                    assert(i != items.end());
-                    i->second->finish(msg->data.result);
-                    curl_multi_remove_handle(curlm.get(), i->second->req);
-                    i->second->active = false;
-                    items.erase(i);
+                for (auto & item : incoming) {
+                    debug("starting %s of %s", item->request.noun(), item->request.uri);
+                    item->init();
+                    curl_multi_add_handle(curlm.get(), item->req);
+                    item->active = true;
+                    items[item->req] = item;
                 }
-            }
 
-            /* Wait for activity, including wakeup events. */
-            long maxSleepTimeMs = items.empty() ? 10000 : 100;
-            auto sleepTimeMs = nextWakeup != std::chrono::steady_clock::time_point()
-                                   ? std::max(
-                                         0,
-                                         (int) std::chrono::duration_cast<std::chrono::milliseconds>(
-                                             nextWakeup - std::chrono::steady_clock::now())
-                                             .count())
-                                   : maxSleepTimeMs;
+                /* NOTE: Unpausing may invoke callbacks to flush all buffers. */
+                auto unpause = [&]() {
+                    auto state(state_.lock());
+                    auto res = state->unpause;
+                    state->unpause.clear();
+                    return res;
+                }();
 
-            int numfds = 0;
-            mc = curl_multi_poll(curlm.get(), nullptr, 0, sleepTimeMs, &numfds);
-            if (mc != CURLM_OK)
-                throw curlMultiError(mc);
+                for (auto & item : unpause)
+                    item->unpause();
+            }
 
-            nextWakeup = std::chrono::steady_clock::time_point();
+            debug("download thread shutting down");
+        }
 
-            std::vector<std::shared_ptr<TransferItem>> incoming;
-            auto now = std::chrono::steady_clock::now();
+        void workerThreadEntry()
+        {
+            // Unwinding or because someone called `quit`.
+            bool normalExit = true;
+            try {
+                workerThreadMain();
+            } catch (nix::Interrupted & e) {
+                normalExit = false;
+            } catch (std::exception & e) {
+                printError("unexpected error in download thread: %s", e.what());
+                normalExit = false;
+            }
 
-            {
+            if (!normalExit) {
                 auto state(state_.lock());
-                while (!state->incoming.empty()) {
-                    auto item = state->incoming.top();
-                    if (item->embargo <= now) {
-                        incoming.push_back(item);
-                        state->incoming.pop();
-                    } else {
-                        if (nextWakeup == std::chrono::steady_clock::time_point() || item->embargo < nextWakeup)
-                            nextWakeup = item->embargo;
-                        break;
-                    }
-                }
-                quit = state->isQuitting();
+                state->quit();
             }
+        }
+    };
 
-            for (auto & item : incoming) {
-                debug("starting %s of %s", item->request.noun(), item->request.uri);
-                item->init();
-                curl_multi_add_handle(curlm.get(), item->req);
-                item->active = true;
-                items[item->req] = item;
-            }
+    std::vector<std::unique_ptr<TransferThread>> threads;
 
-            /* NOTE: Unpausing may invoke callbacks to flush all buffers. */
-            auto unpause = [&]() {
-                auto state(state_.lock());
-                auto res = state->unpause;
-                state->unpause.clear();
-                return res;
-            }();
+    /**
+     * The DNS and TLS session caches, shared between the threads.
+     * Connections themselves can't be shared between threads, so
+     * requests for the same host are preferably placed on the same
+     * thread.
+     */
+    CURLSH * share = nullptr;
+
+    std::mutex shareLocks[CURL_LOCK_DATA_LAST];
+
+    static void lockShare(CURL *, curl_lock_data data, curl_lock_access, void * userptr)
+    {
+        ((curlFileTransfer *) userptr)->shareLocks[data].lock();
+    }
 
-            for (auto & item : unpause)
-                item->unpause();
+    static void unlockShare(CURL *, curl_lock_data data, void * userptr)
+    {
+        ((curlFileTransfer *) userptr)->shareLocks[data].unlock();
+    }
+
+    curlFileTransfer()
+    {
+        static std::once_flag globalInit;
+        std::call_once(globalInit, curl_global_init, CURL_GLOBAL_ALL);
+
+        share = curl_share_init();
+        curl_share_setopt(share, CURLSHOPT_LOCKFUNC, lockShare);
+        curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, unlockShare);
+        curl_share_setopt(share, CURLSHOPT_USERDATA, this);
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+
+        /* Split the connection limit between the threads, so that it
+           holds for all of them together. */
+        size_t nrThreads = std::max<size_t>(1, fileTransferSettings.httpThreads);
+        size_t maxConnections = fileTransferSettings.httpConnections;
+        if (maxConnections) {
+            nrThreads = std::min(nrThreads, maxConnections);
+            maxConnections /= nrThreads;
         }
 
-        debug("download thread shutting down");
+        for (size_t i = 0; i < nrThreads; ++i)
+            threads.push_back(std::make_unique<TransferThread>(*this, maxConnections));
     }
 
-    void workerThreadEntry()
+    ~curlFileTransfer()
     {
-        // Unwinding or because someone called `quit`.
-        bool normalExit = true;
         try {
-            workerThreadMain();
-        } catch (nix::Interrupted & e) {
-            normalExit = false;
-        } catch (std::exception & e) {
-            printError("unexpected error in download thread: %s", e.what());
-            normalExit = false;
+            stopWorkerThreads();
+        } catch (...) {
+            ignoreExceptionInDestructor();
         }
+        for (auto & thread : threads)
+            thread->thread.join();
+        /* This fails if transfer items outlive us, in which case the
+           share is leaked. */
+        curl_share_cleanup(share);
+    }
 
-        if (!normalExit) {
-            auto state(state_.lock());
-            state->quit();
+    void stopWorkerThreads()
+    {
+        /* Signal the worker threads to exit. */
+        for (auto & thread : threads)
+            thread->stop();
+    }
+
+    bool isQuitting()
+    {
+        for (auto & thread : threads)
+            if (thread->state_.lock()->isQuitting())
+                return true;
+        return false;
+    }
+
+    /**
+     * Pick the least busy thread, preferring the one that other
+     * requests for the same host went to, so that they can reuse its
+     * connections.
+     */
+    TransferThread & pickThread(const FileTransferRequest & request)
+    {
+        size_t start = 0;
+        try {
+            if (auto authority = request.uri.parsed().authority)
+                start = std::hash<std::string>{}(authority->host) % threads.size();
+        } catch (BadURL &) {
+        }
+
+        auto best = &*threads[start];
+        for (size_t i = 1; i < threads.size(); ++i) {
+            auto & thread = *threads[(start + i) % threads.size()];
+            if (thread.load < best->load)
+                best = &thread;
         }
+        return *best;
     }
 
     ItemHandle enqueueItem(ref<TransferItem> item)
@@ -881,15 +1000,19 @@ struct curlFileTransfer : public FileTransfer
             && item->request.uri.scheme() != "s3")
             throw nix::Error("uploading to '%s' is not supported", item->request.uri.to_string());
 
+        auto & thread = pickThread(item->request);
+
         {
-            auto state(state_.lock());
+            auto state(thread.state_.lock());
             if (state->isQuitting())
                 throw nix::Error("cannot enqueue download request because the download thread is shutting down");
             state->incoming.push(item);
+            item->thread = &thread;
+            thread.load++;
             item->enqueued = true; /* Now any exceptions should be reported via the callback. */
         }
 
-        wakeupMulti();
+        thread.wakeupMulti();
         return ItemHandle(static_cast<Item &>(*item));
     }
 
@@ -907,9 +1030,10 @@ struct curlFileTransfer : public FileTransfer
 
     void unpauseTransfer(ref<TransferItem> item)
     {
-        auto state(state_.lock());
+        auto & thread = *item->thread;
+        auto state(thread.state_.lock());
         state->unpause.push_back(std::move(item));
-        wakeupMulti();
+        thread.wakeupMulti();
     }
 
     void unpauseTransfer(ItemHandle handle) override
@@ -926,8 +1050,18 @@ ref<curlFileTransfer> makeCurlFileTransfer()
 ref<FileTransfer> getFileTransfer()
 {
     static ref<curlFileTransfer> fileTransfer = makeCurlFileTransfer();
+    static auto owner = getpid();
+
+    /* The transfer threads don't survive fork(), so a child process
+       needs a FileTransfer of its own. Leak the parent's, since
+       destroying it would join threads that don't exist here. */
+    if (owner != getpid()) {
+        new ref<curlFileTransfer>(fileTransfer);
+        fileTransfer = makeCurlFileTransfer();
+        owner = getpid();
+    }
 
-    if (fileTransfer->state_.lock()->isQuitting())
+    if (fileTransfer->isQuitting())
         fileTransfer = makeCurlFileTransfer();
 
     return fileTransfer;
@@ -2,11 +2,13 @@
 #include "nix/store/globals.hh"
 #include "nix/store/local-store.hh"
 #include "nix/store/path.hh"
+#include "nix/store/store-metrics.hh"
 #include "nix/util/finally.hh"
 #include "nix/util/unix-domain-socket.hh"
 #include "nix/util/signals.hh"
 #include "nix/util/serialise.hh"
 #include "nix/util/util.hh"
+#include "nix/util/thread-pool.hh"
 #include "nix/store/posix-fs-canonicalise.hh"
 
 #include "store-config-private.hh"
@@ -19,6 +21,8 @@
 #include <boost/unordered/unordered_flat_map.hpp>
 #include <boost/unordered/unordered_flat_set.hpp>
 #include <boost/regex.hpp>
+#include <nlohmann/json.hpp>
+#include <algorithm>
 #include <queue>
 #include <thread>
 #include <errno.h>
@@ -82,6 +86,22 @@ void LocalStore::createTempRootsFile()
 
 void LocalStore::addTempRoot(const StorePath & path)
 {
+    addTempRoots({path});
+}
+
+void LocalStore::addTempRoots(const StorePathSet & paths_)
+{
+    StorePathSet paths;
+    {
+        auto added(tempRootsAdded.readLock());
+        for (auto & path : paths_)
+            if (!added->contains(path))
+                paths.insert(path);
+    }
+
+    if (paths.empty())
+        return;
+
     if (config->readOnly) {
         debug(
             "Read-only store doesn't support creating lock files for temp roots, but nothing can be deleted anyways.");
@@ -97,6 +117,12 @@ void LocalStore::addTempRoot(const StorePath & path)
             *fdGCLock = openGCLock();
     }
 
+    /* The number of roots to send to the garbage collector before
+       waiting for its acknowledgements. This must be small enough that
+       neither side's socket buffer fills up while the other is still
+       writing. */
+    constexpr size_t sendBatchSize = 1024;
+
 restart:
     /* Try to acquire a shared global GC lock (non-blocking). This
        only succeeds if the garbage collector is not currently
@@ -106,7 +132,7 @@ restart:
     if (!gcLock.acquired) {
         /* We couldn't get a shared global GC lock, so the garbage
            collector is running. So we have to connect to the garbage
-           collector and inform it about our root. */
+           collector and inform it about our roots. */
         auto fdRootsSocket(_fdRootsSocket.lock());
 
         if (!*fdRootsSocket) {
@@ -129,12 +155,22 @@ restart:
         }
 
         try {
-            debug("sending GC root '%s'", printStorePath(path));
-            writeFull(fdRootsSocket->get(), printStorePath(path) + "\n", false);
-            char c;
-            readFull(fdRootsSocket->get(), &c, 1);
-            assert(c == '1');
-            debug("got ack for GC root '%s'", printStorePath(path));
+            /* Send the roots in batches, and then wait for the
+               acknowledgement of each root in the batch, so that there
+               is only one round trip per batch. */
+            for (auto i = paths.begin(); i != paths.end();) {
+                std::string batch;
+                size_t n = 0;
+                for (; i != paths.end() && n < sendBatchSize; ++i, ++n) {
+                    debug("sending GC root '%s'", printStorePath(*i));
+                    batch += printStorePath(*i) + "\n";
+                }
+                writeFull(fdRootsSocket->get(), batch, false);
+                std::string acks(n, 0);
+                readFull(fdRootsSocket->get(), acks.data(), n);
+                assert(acks == std::string(n, '1'));
+            }
+            debug("got ack for %d GC roots", paths.size());
         } catch (SysError & e) {
             /* The garbage collector may have exited, so we need to
                restart. */
@@ -151,10 +187,18 @@ restart:
         }
     }
 
-    /* Record the store path in the temporary roots file so it will be
-       seen by a future run of the garbage collector. */
-    auto s = printStorePath(path) + '\0';
+    /* Record the store paths in the temporary roots file so they will
+       be seen by a future run of the garbage collector. */
+    std::string s;
+    for (auto & path : paths)
+        s += printStorePath(path) + '\0';
     writeFull(_fdTempRoots.lock()->get(), s);
+
+    /* Only remember the roots once they are registered, so that other
+       threads don't rely on roots that aren't registered yet. */
+    auto added(tempRootsAdded.lock());
+    for (auto & path : paths)
+        added->insert(path);
 }
 
 static std::string censored = "{censored}";
@@ -289,7 +333,7 @@ void LocalStore::findRoots(const Path & path, std::filesystem::file_type type, R
     }
 }
 
-void LocalStore::findRootsNoTemp(Roots & roots, bool censor)
+void LocalStore::findRootsNoTemp(Roots & roots, bool censor, bool allowCached)
 {
     /* Process direct roots in {gcroots,profiles}. */
     findRoots(config->stateDir + "/" + gcRootsDir, std::filesystem::file_type::unknown, roots);
@@ -298,13 +342,13 @@ void LocalStore::findRootsNoTemp(Roots & roots, bool censor)
     /* Add additional roots returned by different platforms-specific
        heuristics.  This is typically used to add running programs to
        the set of roots (to prevent them from being garbage collected). */
-    findRuntimeRoots(roots, censor);
+    findRuntimeRoots(roots, censor, allowCached);
 }
 
 Roots LocalStore::findRoots(bool censor)
 {
     Roots roots;
-    findRootsNoTemp(roots, censor);
+    findRootsNoTemp(roots, censor, true);
 
     findTempRoots(roots, censor);
 
@@ -321,7 +365,12 @@ typedef boost::unordered_flat_map<
     std::equal_to<>>
     UncheckedRoots;
 
-static void readProcLink(const std::filesystem::path & file, UncheckedRoots & roots)
+/**
+ * Add the target of the symlink `file` to `roots`.
+ *
+ * @return Whether the link could be read.
+ */
+static bool readProcLink(const std::filesystem::path & file, UncheckedRoots & roots)
 {
     std::filesystem::path buf;
     try {
@@ -329,17 +378,36 @@ static void readProcLink(const std::filesystem::path & file, UncheckedRoots & ro
     } catch (std::filesystem::filesystem_error & e) {
         if (e.code() == std::errc::no_such_file_or_directory || e.code() == std::errc::permission_denied
             || e.code() == std::errc::no_such_process)
-            return;
+            return false;
         throw;
     }
     if (buf.is_absolute())
         roots[buf.string()].emplace(file.string());
+    return true;
 }
 
-static std::string quoteRegexChars(const std::string & raw)
+/**
+ * Add every store path that occurs in `s` to `roots`, with `source`
+ * as the place where it was found. `prefix` is the store directory
+ * followed by a slash. This is a plain substring search, which is
+ * much cheaper than a regex over large `maps` and `environ` files.
+ */
+static void scanForStorePaths(std::string_view s, std::string_view prefix, const Path & source, UncheckedRoots & roots)
 {
-    static auto specialRegex = boost::regex(R"([.^$\\*+?()\[\]{}|])");
-    return boost::regex_replace(raw, specialRegex, R"(\$&)");
+    auto isNameChar = [](char c) {
+        return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '+' || c == '-'
+               || c == '.' || c == '_' || c == '?' || c == '=';
+    };
+
+    for (auto pos = s.find(prefix); pos != s.npos; pos = s.find(prefix, pos)) {
+        auto end = pos + prefix.size();
+        if (end < s.size() && ((s[end] >= '0' && s[end] <= '9') || (s[end] >= 'a' && s[end] <= 'z'))) {
+            while (end < s.size() && isNameChar(s[end]))
+                ++end;
+            roots[std::string(s.substr(pos, end - pos))].emplace(source);
+        }
+        pos = end;
+    }
 }
 
 #ifdef __linux__
@@ -354,68 +422,83 @@ static void readFileRoots(const std::filesystem::path & path, UncheckedRoots & r
 }
 #endif
 
-void LocalStore::findRuntimeRoots(Roots & roots, bool censor)
+/**
+ * Find the files that process `pid` has open, mapped or mentioned in
+ * its environment.
+ */
+static void scanProcess(const std::string & pid, std::string_view prefix, UncheckedRoots & unchecked)
 {
-    UncheckedRoots unchecked;
+    try {
+        /* Kernel threads and zombies have no executable, and neither
+           do processes we're not allowed to inspect. */
+        if (!readProcLink(fmt("/proc/%s/exe", pid), unchecked))
+            return;
+        readProcLink(fmt("/proc/%s/cwd", pid), unchecked);
+
+        auto fdStr = fmt("/proc/%s/fd", pid);
+        auto fdDir = AutoCloseDir(opendir(fdStr.c_str()));
+        if (!fdDir) {
+            if (errno == ENOENT || errno == EACCES)
+                return;
+            throw SysError("opening %1%", fdStr);
+        }
+        struct dirent * fd_ent;
+        while (errno = 0, fd_ent = readdir(fdDir.get())) {
+            if (fd_ent->d_name[0] != '.')
+                readProcLink(fmt("%s/%s", fdStr, fd_ent->d_name), unchecked);
+        }
+        if (errno) {
+            if (errno == ESRCH)
+                return;
+            throw SysError("iterating /proc/%1%/fd", pid);
+        }
+        fdDir.reset();
+
+        auto mapFile = fmt("/proc/%s/maps", pid);
+        scanForStorePaths(readFile(mapFile), prefix, mapFile, unchecked);
+
+        auto envFile = fmt("/proc/%s/environ", pid);
+        scanForStorePaths(readFile(envFile), prefix, envFile, unchecked);
+    } catch (SystemError & e) {
+        if (errno == ENOENT || errno == EACCES || errno == ESRCH)
+            return;
+        throw;
+    }
+}
+
+static UncheckedRoots scanRuntimeRoots(const std::string & storeDir)
+{
+    Sync<UncheckedRoots> unchecked_;
 
     auto procDir = AutoCloseDir{opendir("/proc")};
     if (procDir) {
+        auto prefix = storeDir + "/";
+
+        /* Processes are independent, so scan them in parallel. */
+        ThreadPool pool;
+
         struct dirent * ent;
-        static const auto digitsRegex = boost::regex(R"(^\d+$)");
-        static const auto mapRegex = boost::regex(R"(^\s*\S+\s+\S+\s+\S+\s+\S+\s+\S+\s+(/\S+)\s*$)");
-        auto storePathRegex = boost::regex(quoteRegexChars(storeDir) + R"(/[0-9a-z]+[0-9a-zA-Z\+\-\._\?=]*)");
         while (errno = 0, ent = readdir(procDir.get())) {
             checkInterrupt();
-            if (boost::regex_match(ent->d_name, digitsRegex)) {
-                try {
-                    readProcLink(fmt("/proc/%s/exe", ent->d_name), unchecked);
-                    readProcLink(fmt("/proc/%s/cwd", ent->d_name), unchecked);
-
-                    auto fdStr = fmt("/proc/%s/fd", ent->d_name);
-                    auto fdDir = AutoCloseDir(opendir(fdStr.c_str()));
-                    if (!fdDir) {
-                        if (errno == ENOENT || errno == EACCES)
-                            continue;
-                        throw SysError("opening %1%", fdStr);
-                    }
-                    struct dirent * fd_ent;
-                    while (errno = 0, fd_ent = readdir(fdDir.get())) {
-                        if (fd_ent->d_name[0] != '.')
-                            readProcLink(fmt("%s/%s", fdStr, fd_ent->d_name), unchecked);
-                    }
-                    if (errno) {
-                        if (errno == ESRCH)
-                            continue;
-                        throw SysError("iterating /proc/%1%/fd", ent->d_name);
-                    }
-                    fdDir.reset();
-
-                    std::filesystem::path mapFile = fmt("/proc/%s/maps", ent->d_name);
-                    auto mapLines = tokenizeString<std::vector<std::string>>(readFile(mapFile.string()), "\n");
-                    for (const auto & line : mapLines) {
-                        auto match = boost::smatch{};
-                        if (boost::regex_match(line, match, mapRegex))
-                            unchecked[match[1]].emplace(mapFile.string());
-                    }
-
-                    auto envFile = fmt("/proc/%s/environ", ent->d_name);
-                    auto envString = readFile(envFile);
-                    auto env_end = boost::sregex_iterator{};
-                    for (auto i = boost::sregex_iterator{envString.begin(), envString.end(), storePathRegex};
-                         i != env_end;
-                         ++i)
-                        unchecked[i->str()].emplace(envFile);
-                } catch (SystemError & e) {
-                    if (errno == ENOENT || errno == EACCES || errno == ESRCH)
-                        continue;
-                    throw;
-                }
-            }
+            std::string_view name = ent->d_name;
+            if (name.empty() || !std::all_of(name.begin(), name.end(), [](char c) { return c >= '0' && c <= '9'; }))
+                continue;
+            pool.enqueue([&, pid{std::string(name)}]() {
+                UncheckedRoots found;
+                scanProcess(pid, prefix, found);
+                auto unchecked(unchecked_.lock());
+                for (auto & [target, links] : found)
+                    (*unchecked)[target].insert(links.begin(), links.end());
+            });
         }
         if (errno)
             throw SysError("iterating /proc");
+
+        pool.process();
     }
 
+    auto unchecked = std::move(*unchecked_.lock());
+
 #if !defined(__linux__)
     // lsof is really slow on OS X. This actually causes the gc-concurrent.sh test to fail.
     // See: https://github.com/NixOS/nix/issues/3011
@@ -442,6 +525,48 @@ void LocalStore::findRuntimeRoots(Roots & roots, bool censor)
     readFileRoots("/proc/sys/kernel/poweroff_cmd", unchecked);
 #endif
 
+    return unchecked;
+}
+
+void LocalStore::findRuntimeRoots(Roots & roots, bool censor, bool allowCached)
+{
+    UncheckedRoots unchecked;
+
+    /* Reuse the result of a recent scan, if allowed. */
+    auto cachePath = config->stateDir.get() + "/runtime-roots.json";
+    bool cached = false;
+    if (allowCached && settings.gcRuntimeRootsTTL) {
+        try {
+            auto st = maybeLstat(cachePath);
+            if (st && time(nullptr) - st->st_mtime < (time_t) settings.gcRuntimeRootsTTL.get()) {
+                for (auto & [target, links] : nlohmann::json::parse(readFile(cachePath)).items())
+                    for (auto & link : links)
+                        unchecked[target].emplace(link.get<std::string>());
+                cached = true;
+            }
+        } catch (std::exception & e) {
+            debug("ignoring runtime roots cache '%s': %s", cachePath, e.what());
+            unchecked.clear();
+        }
+    }
+
+    if (!cached) {
+        unchecked = scanRuntimeRoots(storeDir);
+
+        if (settings.gcRuntimeRootsTTL) {
+            try {
+                auto json = nlohmann::json::object();
+                for (auto & [target, links] : unchecked)
+                    json[target] = std::vector<std::string>(links.begin(), links.end());
+                auto tmpPath = makeTempPath(config->stateDir.get(), ".runtime-roots").string();
+                writeFile(tmpPath, json.dump(), 0600);
+                std::filesystem::rename(tmpPath, cachePath);
+            } catch (std::exception & e) {
+                debug("cannot write runtime roots cache '%s': %s", cachePath, e.what());
+            }
+        }
+    }
+
     for (auto & [target, links] : unchecked) {
         if (!isInStore(target))
             continue;
@@ -479,6 +604,20 @@ void LocalStore::collectGarbage(const GCOptions & options, GCResults & results)
         // Hash part of the store path currently being deleted, if
         // any.
         std::optional<std::string> pending;
+
+        // Hash parts of the store paths that have been invalidated
+        // and are being deleted in the background.
+        boost::unordered_flat_set<std::string, StringViewHash, std::equal_to<>> deleting;
+
+        // The number of background deletions that haven't finished.
+        size_t inFlight = 0;
+
+        // Bytes freed so far.
+        uint64_t bytesFreed = 0;
+
+        // The first error from a background deletion, which aborts
+        // the GC.
+        std::exception_ptr deleteError;
     };
 
     Sync<Shared> _shared;
@@ -595,7 +734,7 @@ void LocalStore::collectGarbage(const GCOptions & options, GCResults & results)
                                    done. FIXME: ideally we would use a
                                    FD for this so we don't block the
                                    poll loop. */
-                                while (shared->pending == hashPart) {
+                                while (shared->pending == hashPart || shared->deleting.contains(hashPart)) {
                                     debug("synchronising with deletion of path '%s'", path);
                                     shared.wait(wakeup);
                                 }
@@ -646,9 +785,111 @@ void LocalStore::collectGarbage(const GCOptions & options, GCResults & results)
     if (auto p = getEnv("_NIX_TEST_GC_SYNC_2"))
         readFile(*p);
 
+    /* Pause after deleting a path if we're ahead of the maximum
+       deletion rate. */
+    auto startTime = std::chrono::steady_clock::now();
+    Sync<uint64_t> bytesDeleted_{0};
+    auto throttle = [&](uint64_t bytesFreed) {
+        uint64_t maxRate = settings.gcMaxDeleteRate;
+        if (!maxRate)
+            return;
+        std::chrono::steady_clock::time_point due;
+        {
+            auto bytesDeleted(bytesDeleted_.lock());
+            *bytesDeleted += bytesFreed;
+            due = startTime
+                  + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                      std::chrono::duration<double>((double) *bytesDeleted / maxRate));
+        }
+        for (auto now = std::chrono::steady_clock::now(); now < due; now = std::chrono::steady_clock::now()) {
+            checkInterrupt();
+            std::this_thread::sleep_for(
+                std::min<std::chrono::steady_clock::duration>(due - now, std::chrono::milliseconds(100)));
+        }
+    };
+
+    Activity act(*logger, actCollectGarbage);
+
+    auto metrics = getStoreMetrics();
+    if (metrics) {
+        metrics->gcRuns++;
+        metrics->gcRunning++;
+    }
+    Finally finishMetrics([&]() {
+        if (metrics)
+            metrics->gcRunning--;
+    });
+
+    /* Record that `bytesFreed` more bytes have been deleted. */
+    auto addFreed = [&](uint64_t bytesFreed) {
+        if (metrics)
+            metrics->gcBytesFreed += bytesFreed;
+        uint64_t total;
+        {
+            auto shared(_shared.lock());
+            shared->bytesFreed += bytesFreed;
+            total = shared->bytesFreed;
+        }
+        act.progress(total, 0);
+    };
+
+    /* Threads that remove invalidated paths from disk, if enabled. The
+       pool counts the thread that calls process() as one of its
+       threads, but we only call that at the very end, so ask for one
+       more to get `deleteJobs` worker threads. */
+    std::optional<ThreadPool> deletePool;
+    unsigned int deleteJobs = settings.gcDeleteJobs;
+    if (shouldDelete && deleteJobs)
+        deletePool.emplace(deleteJobs + 1);
+
+    /* Run `doDelete` on `deletePool`. If `hashPart` is set, GC clients
+       that add a temporary root for that store path wait until the
+       deletion is finished. */
+    auto deleteInBackground = [&](std::function<void(uint64_t &)> doDelete, std::optional<std::string> hashPart) {
+        {
+            /* Don't get too far ahead of the deletion threads, both
+               to bound memory use and so that we don't overshoot
+               `maxFreed` by much. */
+            auto shared(_shared.lock());
+            while (shared->inFlight >= 2 * deleteJobs) {
+                shared.wait_for(wakeup, std::chrono::milliseconds(100));
+                checkInterrupt();
+            }
+            shared->inFlight++;
+            if (hashPart)
+                shared->deleting.insert(*hashPart);
+        }
+
+        deletePool->enqueue([&, doDelete, hashPart]() {
+            uint64_t bytesFreed = 0;
+            std::exception_ptr error;
+            try {
+                doDelete(bytesFreed);
+            } catch (...) {
+                error = std::current_exception();
+            }
+            {
+                /* Wake up any GC client waiting for this deletion to
+                   finish. */
+                auto shared(_shared.lock());
+                shared->inFlight--;
+                if (hashPart)
+                    shared->deleting.erase(*hashPart);
+                if (error && !shared->deleteError)
+                    shared->deleteError = error;
+                wakeup.notify_all();
+            }
+            addFreed(bytesFreed);
+            if (!error)
+                throttle(bytesFreed);
+        });
+    };
+
     /* Helper function that deletes a path from the store and throws
-       GCLimitReached if we've deleted enough garbage. */
-    auto deleteFromStore = [&](std::string_view baseName) {
+       GCLimitReached if we've deleted enough garbage. If `background`
+       is set, `baseName` must be a store path that has already been
+       invalidated; it is then deleted by `deletePool`. */
+    auto deleteFromStore = [&](std::string_view baseName, bool background) {
         Path path = storeDir + "/" + std::string(baseName);
         Path realPath = config->realStoreDir + "/" + std::string(baseName);
 
@@ -666,13 +907,36 @@ void LocalStore::collectGarbage(const GCOptions & options, GCResults & results)
         printInfo("deleting '%1%'", path);
 
         results.paths.insert(path);
+        if (metrics)
+            metrics->gcPathsDeleted++;
+
+        if (background && deletePool) {
+            /* Moving the path into the trash frees its name straight
+               away, so nobody has to wait for the deletion. */
+            if (auto trashPath = trashStorePath(realPath))
+                deleteInBackground(
+                    [trashPath{*trashPath}](uint64_t & bytesFreed) { deletePath(trashPath, bytesFreed); },
+                    std::nullopt);
+            else
+                deleteInBackground(
+                    [this, realPath](uint64_t & bytesFreed) { deleteStorePath(realPath, bytesFreed); },
+                    std::string(baseName.substr(0, StorePath::HashLen)));
+        } else {
+            uint64_t bytesFreed;
+            deleteStorePath(realPath, bytesFreed);
+            addFreed(bytesFreed);
+            throttle(bytesFreed);
+        }
 
         uint64_t bytesFreed;
-        deleteStorePath(realPath, bytesFreed);
-
-        results.bytesFreed += bytesFreed;
+        {
+            auto shared(_shared.lock());
+            if (shared->deleteError)
+                std::rethrow_exception(shared->deleteError);
+            bytesFreed = shared->bytesFreed;
+        }
 
-        if (results.bytesFreed > options.maxFreed) {
+        if (bytesFreed > options.maxFreed) {
             printInfo("deleted more than %d bytes; stopping", options.maxFreed);
             throw GCLimitReached();
         }
@@ -790,7 +1054,7 @@ void LocalStore::collectGarbage(const GCOptions & options, GCResults & results)
             if (shouldDelete) {
                 try {
                     invalidatePathChecked(path);
-                    deleteFromStore(path.to_string());
+                    deleteFromStore(path.to_string(), true);
                     referrersCache.erase(path);
                 } catch (PathInUse & e) {
                     // If we end up here, it's likely a new occurrence
@@ -823,6 +1087,22 @@ void LocalStore::collectGarbage(const GCOptions & options, GCResults & results)
             printInfo("determining live/dead paths...");
 
         try {
+            /* Delete anything left in the trash by an interrupted
+               garbage collection. */
+            if (shouldDelete && pathExists(trashDir))
+                for (auto & entry : DirectoryIterator{trashDir}) {
+                    checkInterrupt();
+                    auto trashPath = entry.path().string();
+                    auto doDelete = [trashPath](uint64_t & bytesFreed) { deletePath(trashPath, bytesFreed); };
+                    if (deletePool)
+                        deleteInBackground(doDelete, std::nullopt);
+                    else {
+                        uint64_t bytesFreed;
+                        doDelete(bytesFreed);
+                        addFreed(bytesFreed);
+                    }
+                }
+
             AutoCloseDir dir(opendir(config->realStoreDir.get().c_str()));
             if (!dir)
                 throw SysError("opening directory '%1%'", config->realStoreDir);
@@ -831,22 +1111,33 @@ void LocalStore::collectGarbage(const GCOptions & options, GCResults & results)
                unreachable. We don't use readDirectory() here so that
                GCing can start faster. */
             auto linksName = baseNameOf(linksDir);
+            auto trashName = baseNameOf(trashDir);
             struct dirent * dirent;
             while (errno = 0, dirent = readdir(dir.get())) {
                 checkInterrupt();
                 std::string name = dirent->d_name;
-                if (name == "." || name == ".." || name == linksName)
+                if (name == "." || name == ".." || name == linksName || name == trashName)
                     continue;
 
                 if (auto storePath = maybeParseStorePath(storeDir + "/" + name))
                     deleteReferrersClosure(*storePath);
                 else
-                    deleteFromStore(name);
+                    deleteFromStore(name, false);
             }
         } catch (GCLimitReached & e) {
         }
     }
 
+    if (deletePool) {
+        deletePool->process();
+        auto shared(_shared.lock());
+        if (shared->deleteError)
+            std::rethrow_exception(shared->deleteError);
+        rmdir(trashDir.c_str());
+    }
+
+    results.bytesFreed = _shared.lock()->bytesFreed;
+
     if (options.action == GCOptions::gcReturnLive) {
         for (auto & i : alive)
             results.paths.insert(printStorePath(i));
@@ -1,4 +1,5 @@
 #include "nix/store/globals.hh"
+#include "nix/store/sqlite-file-hash-cache.hh"
 #include "nix/util/config-global.hh"
 #include "nix/util/current-process.hh"
 #include "nix/util/archive.hh"
@@ -476,11 +477,16 @@ void initLibStore(bool loadConfig)
 
     initLibUtil();
 
-    if (loadConfig)
+    if (loadConfig) {
+        StartupPhaseTimer timer("loadConfig");
         loadConfFile(globalConfig);
+    }
 
     preloadNSS();
 
+    openFileHashCache = openSQLiteFileHashCache;
+
+#ifdef __APPLE__
     /* Because of an objc quirk[1], calling curl_global_init for the first time
        after fork() will always result in a crash.
        Up until now the solution has been to set OBJC_DISABLE_INITIALIZE_FORK_SAFETY
@@ -489,10 +495,15 @@ void initLibStore(bool loadConfig)
        by calling curl_global_init here, which should mean curl will already
        have been initialized by the time we try to do so in a forked process.
 
+       Elsewhere, curl is initialised by the first FileTransfer, which
+       keeps it off the startup path of commands that don't use the
+       network.
+
        [1]
        https://github.com/apple-oss-distributions/objc4/blob/01edf1705fbc3ff78a423cd21e03dfc21eb4d780/runtime/objc-initialize.mm#L614-L636
     */
     curl_global_init(CURL_GLOBAL_ALL);
+#endif
 #ifdef __APPLE__
     /* On macOS, don't use the per-session TMPDIR (as set e.g. by
        sshd). This breaks build users because they don't have access
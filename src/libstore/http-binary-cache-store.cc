@@ -68,13 +68,15 @@ void HttpBinaryCacheStore::init()
     if (auto cacheInfo = diskCache->upToDateCacheExists(cacheKey)) {
         config->wantMassQuery.setDefault(cacheInfo->wantMassQuery);
         config->priority.setDefault(cacheInfo->priority);
+        config->shardedLayout.setDefault(cacheInfo->shardedLayout);
     } else {
         try {
             BinaryCacheStore::init();
         } catch (UploadToHTTP &) {
             throw Error("'%s' does not appear to be a binary cache", config->cacheUri.to_string());
         }
-        diskCache->createCache(cacheKey, config->storeDir, config->wantMassQuery, config->priority);
+        diskCache->createCache(
+            cacheKey, config->storeDir, config->wantMassQuery, config->priority, config->shardedLayout);
     }
 }
 
@@ -240,6 +242,41 @@ void HttpBinaryCacheStore::getFile(const std::string & path, Callback<std::optio
     }
 }
 
+std::string HttpBinaryCacheStore::getFileRange(const std::string & path, uint64_t offset, uint64_t length)
+{
+    if (length == 0)
+        return "";
+
+    checkEnabled();
+    auto request(makeRequest(path));
+    request.headers.emplace_back("Range", fmt("bytes=%d-%d", offset, offset + length - 1));
+
+    std::string data;
+    try {
+        data = getFileTransfer()->download(std::move(request)).data;
+    } catch (FileTransferError & e) {
+        if (e.error == FileTransfer::NotFound || e.error == FileTransfer::Forbidden)
+            throw NoSuchBinaryCacheFile(
+                "file '%s' does not exist in binary cache '%s'", path, config->getHumanReadableURI());
+        maybeDisable();
+        throw;
+    }
+
+    if (data.size() == length)
+        return data;
+
+    /* The server ignored the range and sent the whole file. */
+    if (data.size() >= offset + length)
+        return data.substr(offset, length);
+
+    throw Error(
+        "range request for '%s' in binary cache '%s' returned %d bytes instead of %d",
+        path,
+        config->getHumanReadableURI(),
+        data.size(),
+        length);
+}
+
 std::optional<std::string> HttpBinaryCacheStore::getNixCacheInfo()
 {
     try {
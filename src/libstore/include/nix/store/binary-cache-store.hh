@@ -12,6 +12,7 @@
 namespace nix {
 
 struct NarInfo;
+struct BloomFilter;
 class RemoteFSAccessor;
 
 struct BinaryCacheStoreConfig : virtual StoreConfig
@@ -19,10 +20,29 @@ struct BinaryCacheStoreConfig : virtual StoreConfig
     using StoreConfig::StoreConfig;
 
     const Setting<std::string> compression{
-        this, "xz", "compression", "NAR compression method (`xz`, `bzip2`, `gzip`, `zstd`, or `none`)."};
+        this,
+        "xz",
+        "compression",
+        R"(
+          NAR compression method (`xz`, `xz-seekable`, `bzip2`, `gzip`, `zstd`, or `none`).
+
+          `xz-seekable` writes xz files made of independently
+          compressed 1 MiB blocks. Together with a NAR listing (see
+          `write-nar-listing`), this lets Nix read individual files
+          from the NAR without downloading all of it, at the cost of a
+          slightly worse compression ratio. Such files are ordinary xz
+          files, so any version of Nix can substitute them.
+        )"};
 
     const Setting<bool> writeNARListing{
-        this, false, "write-nar-listing", "Whether to write a JSON file that lists the files in each NAR."};
+        this,
+        false,
+        "write-nar-listing",
+        R"(
+          Whether to write a file that lists the files in each NAR. The
+          listing is written both as JSON (`<hash>.ls`) and in a compact
+          binary form (`<hash>.lsb`).
+        )"};
 
     const Setting<bool> writeDebugInfo{
         this,
@@ -33,6 +53,103 @@ struct BinaryCacheStoreConfig : virtual StoreConfig
           fetch debug info on demand
         )"};
 
+    Setting<bool> pathIndex{
+        this,
+        false,
+        "path-index",
+        R"(
+          Whether the binary cache has an index of the store paths it
+          contains, sharded by the first two characters of their hash
+          parts. When writing to the cache, Nix adds each path to the
+          index. When reading from it, Nix fetches the index shards and
+          uses them to learn that paths exist without fetching their
+          `.narinfo` files, which makes checking the validity of large
+          closures much faster. Paths missing from the index are
+          looked up as usual.
+
+          This is enabled automatically if the cache's `nix-cache-info`
+          contains `PathIndex: 1`.
+        )"};
+
+    Setting<bool> bloomFilter{
+        this,
+        false,
+        "bloom-filter",
+        R"(
+          Whether the binary cache has Bloom filters of the store paths
+          it contains, sharded like the path index (see `path-index`).
+          When writing to the cache, Nix adds each path to its filter.
+          When reading from it, paths that the filter rules out are
+          treated as missing without fetching their `.narinfo` files,
+          which saves a round-trip for every miss.
+
+          Readers trust the filters to cover every path in the cache,
+          so only enable this for a new cache, or if every path in the
+          cache has been written with this setting enabled.
+
+          This is enabled automatically if the cache's `nix-cache-info`
+          contains `BloomFilter: 1`, which Nix writes when it creates a
+          cache with this setting.
+        )"};
+
+    const Setting<uint64_t> bloomFilterBits{
+        this,
+        1 << 16,
+        "bloom-filter-bits",
+        R"(
+          The size in bits of each of the 1024 shards of a new Bloom
+          filter (see `bloom-filter`). With the default, the filters
+          have a false positive rate of about 1% for 6 million paths.
+          Existing shards keep their size.
+        )"};
+
+    Setting<bool> shardedLayout{
+        this,
+        false,
+        "sharded-layout",
+        R"(
+          Whether the binary cache stores its files in subdirectories
+          named after the first two characters of their hashes, i.e.
+          `ab/abcd….narinfo` and `nar/ab/abcd….nar.xz` instead of
+          `abcd….narinfo` and `nar/abcd….nar.xz`, and likewise for NAR
+          listings and chunks. This keeps directories small in caches
+          with millions of paths.
+
+          Since readers need to know where to look, this can only be
+          chosen when creating a cache. Nix then records it in the
+          cache's `nix-cache-info` as `ShardedLayout: 1`, which makes
+          readers (including those accessing the cache over HTTP)
+          enable this setting automatically.
+        )"};
+
+    const Setting<bool> chunkNars{
+        this,
+        false,
+        "chunk-nars",
+        R"(
+          Whether to split NARs into content-defined chunks when
+          writing them to the cache. Each chunk is compressed with the
+          `compression` method and stored once under `chunks/`, so
+          paths that share most of their contents (such as successive
+          versions of a package) share most of their storage. The
+          `.narinfo` then refers to a list of the chunks, with
+          compression method `chunked`.
+
+          Versions of Nix that don't support chunked NARs can't
+          substitute them.
+        )"};
+
+    const Setting<Path> localChunkCache{
+        this,
+        "",
+        "local-chunk-cache",
+        R"(
+          Path to a local cache of the chunks fetched from this binary
+          cache (see `chunk-nars`). Chunks that are already in this
+          cache aren't downloaded again. Since chunks are stored by
+          hash, the same directory can be shared by several caches.
+        )"};
+
     const Setting<Path> secretKeyFile{this, "", "secret-key", "Path to the secret key used to sign the binary cache."};
 
     const Setting<std::string> secretKeyFiles{
@@ -46,9 +163,14 @@ struct BinaryCacheStoreConfig : virtual StoreConfig
 
     const Setting<bool> parallelCompression{
         this,
-        false,
+        true,
         "parallel-compression",
-        "Enable multi-threaded compression of NARs. This is currently only available for `xz` and `zstd`."};
+        R"(
+          Enable multi-threaded compression of NARs. This is currently only available for `xz` and `zstd`.
+
+          For `xz`, this also splits NARs into independent blocks, which
+          lets clients decompress them on multiple threads.
+        )"};
 
     const Setting<int> compressionLevel{
         this,
@@ -89,6 +211,27 @@ protected:
 
     constexpr const static std::string cacheInfoFile = "nix-cache-info";
 
+    /**
+     * The directory containing the shards of the path index (see the
+     * `path-index` setting). Each shard is an xz-compressed, sorted
+     * list of hash parts, one per line.
+     */
+    constexpr const static std::string pathIndexPrefix = "nix-cache-index";
+
+    /**
+     * The directory containing the shards of the Bloom filter (see the
+     * `bloom-filter` setting), named like the path index shards. Each
+     * shard is an xz-compressed serialised `BloomFilter`.
+     */
+    constexpr const static std::string bloomFilterPrefix = "nix-cache-bloom";
+
+    /**
+     * The directory containing the chunks of chunked NARs (see the
+     * `chunk-nars` setting), named by the SHA-256 hash of their
+     * uncompressed contents.
+     */
+    constexpr const static std::string chunksPrefix = "chunks";
+
     BinaryCacheStore(Config &);
 
     /**
@@ -100,6 +243,13 @@ protected:
 
 public:
 
+    /**
+     * The file that holds information about the store path with the
+     * given hash part, e.g. `${hashPart}.narinfo` or, with the
+     * `sharded-layout` setting, `${hashPart:0:2}/${hashPart}.narinfo`.
+     */
+    std::string fileForHashPart(std::string_view hashPart, std::string_view extension);
+
     virtual bool fileExists(const std::string & path) = 0;
 
     virtual void upsertFile(
@@ -141,6 +291,12 @@ public:
 
     std::optional<std::string> getFile(const std::string & path);
 
+    /**
+     * Fetch `length` bytes of the specified file, starting at
+     * `offset`. The default implementation fetches the whole file.
+     */
+    virtual std::string getFileRange(const std::string & path, uint64_t offset, uint64_t length);
+
 public:
 
     virtual void init() override;
@@ -151,8 +307,95 @@ private:
 
     std::string narInfoFileFor(const StorePath & storePath);
 
+    /**
+     * Where to store a NAR with the given file hash, relative to the
+     * root of the cache.
+     */
+    std::string narFileFor(const Hash & fileHash, std::string_view extension);
+
     void writeNarInfo(ref<NarInfo> narInfo);
 
+    /**
+     * The loaded shards of the path index, indexed by shard name.
+     * `std::nullopt` means that the shard doesn't exist.
+     */
+    Sync<std::map<std::string, std::optional<std::set<std::string>>>> pathIndexShards;
+
+    /**
+     * Serialises updates to the path index by this process.
+     */
+    std::mutex pathIndexWriteLock;
+
+    static std::string pathIndexShardFor(std::string_view hashPart);
+
+    /**
+     * Where to keep downloaded index shards between invocations, if
+     * this store uses the disk cache.
+     */
+    std::optional<std::filesystem::path> pathIndexCacheDir();
+
+    /**
+     * Fetch the given files under `prefix` concurrently, or take them
+     * from `pathIndexCacheDir()` if they're recent enough, and pass
+     * each to `process`. `data` is `std::nullopt` if the file doesn't
+     * exist, or if `fetched` is false, because it couldn't be fetched.
+     */
+    void fetchIndexFiles(
+        const std::string & prefix,
+        const StringSet & names,
+        std::function<void(const std::string & name, std::optional<std::string> data, bool fetched)> process);
+
+    /**
+     * Make sure that the given shards are in `pathIndexShards`,
+     * fetching the missing ones concurrently.
+     */
+    void loadPathIndexShards(const StringSet & shards);
+
+    /**
+     * Whether the path index says that `path` exists in the cache.
+     * `false` means that we don't know.
+     */
+    bool isInPathIndex(const StorePath & path);
+
+    void addToPathIndex(const StorePath & path);
+
+    /**
+     * The loaded shards of the Bloom filter, indexed by shard name. A
+     * shard that doesn't exist is represented as an empty filter.
+     * `nullptr` means that the shard couldn't be fetched, so nothing
+     * can be ruled out.
+     */
+    Sync<std::map<std::string, std::shared_ptr<const BloomFilter>>> bloomFilterShards;
+
+    std::mutex bloomFilterWriteLock;
+
+    void loadBloomFilterShards(const StringSet & shards);
+
+    /**
+     * Whether the Bloom filter says that `path` is definitely not in
+     * the cache.
+     */
+    bool isKnownMissing(const StorePath & path);
+
+    void addToBloomFilter(const StorePath & path);
+
+    static std::string chunkFileFor(std::string_view hash, const std::string & compression);
+
+    /**
+     * Upload a chunk of a NAR if it's not in the cache yet.
+     *
+     * @param compressedSize Incremented by the compressed size of the
+     * chunk.
+     *
+     * @return The hash of the chunk.
+     */
+    std::string writeChunk(std::string_view chunk, RepairFlag repair, uint64_t & compressedSize);
+
+    /**
+     * Write a NAR stored as a list of chunks to `sink`.
+     */
+    void narFromChunks(const NarInfo & info, Sink & sink);
+
     ref<const ValidPathInfo> addToStoreCommon(
         Source & narSource,
         RepairFlag repair,
@@ -168,6 +411,8 @@ public:
 
     bool isValidPathUncached(const StorePath & path) override;
 
+    StorePathSet queryValidPaths(const StorePathSet & paths, SubstituteFlag maybeSubstitute = NoSubstitute) override;
+
     void queryPathInfoUncached(
         const StorePath & path, Callback<std::shared_ptr<const ValidPathInfo>> callback) noexcept override;
 
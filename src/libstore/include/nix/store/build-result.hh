@@ -139,6 +139,23 @@ struct BuildResult
      */
     std::optional<std::chrono::microseconds> cpuUser, cpuSystem;
 
+    /**
+     * Peak memory usage of the build in bytes.
+     */
+    std::optional<uint64_t> peakMemory;
+
+    /**
+     * Bytes the build read from and wrote to block devices.
+     */
+    std::optional<uint64_t> ioRead, ioWrite;
+
+    /**
+     * Time during which some of the build's processes were stalled
+     * waiting for CPU, memory or I/O, according to the kernel's
+     * pressure stall information.
+     */
+    std::optional<std::chrono::microseconds> cpuStall, memoryStall, ioStall;
+
     bool operator==(const BuildResult &) const noexcept;
     std::strong_ordering operator<=>(const BuildResult &) const noexcept;
 };
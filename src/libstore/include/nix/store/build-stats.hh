@@ -0,0 +1,53 @@
+#pragma once
+///@file
+
+#include <chrono>
+#include <optional>
+#include <string>
+
+#include "nix/util/json-impls.hh"
+
+namespace nix {
+
+/**
+ * Statistics about one build of a derivation, as recorded by the
+ * local store.
+ */
+struct BuildStats
+{
+    /**
+     * The name of the derivation.
+     */
+    std::string drvName;
+
+    /**
+     * The derivation's `hashDerivationModulo()`, which doesn't change
+     * when only fixed-output dependencies change.
+     */
+    std::string drvHash;
+
+    /**
+     * The machine that did the build, empty for local builds.
+     */
+    std::string machine;
+
+    time_t startTime = 0, stopTime = 0;
+
+    std::optional<std::chrono::microseconds> cpuUser, cpuSystem;
+
+    /**
+     * Peak memory usage of the build in bytes.
+     */
+    std::optional<uint64_t> peakMemory;
+
+    /**
+     * Total NAR size of the outputs.
+     */
+    uint64_t outputSize = 0;
+
+    bool operator==(const BuildStats &) const = default;
+};
+
+} // namespace nix
+
+JSON_IMPL(nix::BuildStats)
@@ -99,6 +99,13 @@ struct DerivationBuilderParams
     StringSet systemFeatures;
 
     DesugaredEnv desugaredEnv;
+
+    /**
+     * The FIFO of the jobserver shared by concurrent builds, if any,
+     * and the `MAKEFLAGS` that point builders at it.
+     */
+    std::optional<std::filesystem::path> jobserverFifo;
+    std::string jobserverMakeFlags;
 };
 
 /**
@@ -181,6 +188,14 @@ struct DerivationBuilder : RestrictionContext
      * killed.
      */
     virtual bool killChild() = 0;
+
+    /**
+     * How much memory the build is using right now, if known.
+     */
+    virtual std::optional<uint64_t> getMemoryUsage()
+    {
+        return std::nullopt;
+    }
 };
 
 struct ExternalBuilder
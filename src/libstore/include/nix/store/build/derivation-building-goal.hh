@@ -15,8 +15,11 @@ namespace nix {
 using std::map;
 
 struct BuilderFailureError;
+struct CompressionSink;
+struct BackgroundSink;
 #ifndef _WIN32 // TODO enable build hook on Windows
 struct HookInstance;
+struct RemoteBuild;
 struct DerivationBuilder;
 #endif
 
@@ -50,7 +53,18 @@ private:
     /**
      * The derivation stored at drvPath.
      */
-    std::unique_ptr<Derivation> drv;
+    std::shared_ptr<const Derivation> drv;
+
+    /**
+     * Cache for `expectedDuration()`.
+     */
+    std::optional<std::chrono::seconds> expectedDuration_;
+
+    /**
+     * The peak memory usage of earlier builds, cache for
+     * `expectedMemory()`.
+     */
+    std::optional<uint64_t> pastPeakMemory;
 
     /**
      * The remainder is state held during the build.
@@ -66,7 +80,14 @@ private:
      * File descriptor for the log file.
      */
     AutoCloseFD fdLogFile;
-    std::shared_ptr<BufferedSink> logFileSink, logSink;
+    std::shared_ptr<BufferedSink> logFileSink;
+    std::shared_ptr<CompressionSink> logCompressionSink;
+
+    /**
+     * Writes to `logCompressionSink` or `logFileSink` from a separate
+     * thread.
+     */
+    std::shared_ptr<BackgroundSink> logSink;
 
     /**
      * Number of bytes received from the builder's stdout/stderr.
@@ -81,6 +102,15 @@ private:
     std::string currentLogLine;
     size_t currentLogLinePos = 0; // to handle carriage return
 
+    /**
+     * For `build-log-lines-per-second`: the second in which the last
+     * log line was forwarded, the number of lines forwarded in it, and
+     * the number of lines dropped since.
+     */
+    std::chrono::steady_clock::time_point logLinesSecond;
+    unsigned int logLinesInSecond = 0;
+    uint64_t logLinesDropped = 0;
+
     std::string currentHookLine;
 
 #ifndef _WIN32 // TODO enable build hook on Windows
@@ -89,6 +119,12 @@ private:
      */
     std::unique_ptr<HookInstance> hook;
 
+    /**
+     * The remote build, if the build was dispatched by
+     * `Worker::remoteBuilders` rather than the build hook.
+     */
+    std::unique_ptr<RemoteBuild> remoteBuild;
+
     std::unique_ptr<DerivationBuilder> builder;
 #endif
 
@@ -114,6 +150,23 @@ private:
     HookReply tryBuildHook(
         const std::map<std::string, InitialOutput> & initialOutputs, const DerivationOptions<StorePath> & drvOptions);
 
+    /**
+     * Like `tryBuildHook()`, but for `in-process-builders`.
+     */
+    HookReply tryRemoteBuilders(
+        const std::map<std::string, InitialOutput> & initialOutputs, const DerivationOptions<StorePath> & drvOptions);
+
+    /**
+     * Copy the outputs to the `upload-outputs-to` store, if set.
+     */
+    void uploadOutputs(const SingleDrvOutputs & builtOutputs);
+
+    /**
+     * The name of the remote machine that performs the build, or the
+     * empty string for local builds.
+     */
+    std::string machineName();
+
     /**
      * Open a log file and a pipe to it.
      */
@@ -163,6 +216,24 @@ private:
     {
         return JobCategory::Build;
     };
+
+    std::chrono::seconds expectedDuration() override;
+
+    uint64_t expectedMemory() override;
+
+private:
+
+    /**
+     * Remember how long the build took and which resources it used,
+     * if the store is a local store.
+     */
+    void recordBuildStats();
+
+    /**
+     * Report the resources that the build used, as far as they are
+     * known, as a `resBuildResources` result of the build activity.
+     */
+    void reportBuildResources();
 };
 
 } // namespace nix
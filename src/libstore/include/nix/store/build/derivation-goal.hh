@@ -64,7 +64,7 @@ private:
     /**
      * The derivation stored at drvPath.
      */
-    std::unique_ptr<Derivation> drv;
+    std::shared_ptr<const Derivation> drv;
 
     const Hash outputHash;
 
@@ -96,6 +96,13 @@ private:
      */
     UnkeyedRealisation assertPathValidity();
 
+    /**
+     * Whether, according to `cost-based-substitution`, building the
+     * derivation locally is expected to be faster than substituting
+     * `outPath`.
+     */
+    bool buildIsFaster(const StorePath & outPath);
+
     Co repairClosure();
 
     Done doneSuccess(BuildResult::Success::Status status, UnkeyedRealisation builtOutput);
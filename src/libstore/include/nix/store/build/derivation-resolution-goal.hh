@@ -53,7 +53,7 @@ private:
     /**
      * The derivation stored at drvPath.
      */
-    std::unique_ptr<Derivation> drv;
+    std::shared_ptr<const Derivation> drv;
 
     /**
      * The remainder is state held during the build.
@@ -4,6 +4,8 @@
 #include "nix/store/store-api.hh"
 #include "nix/store/build-result.hh"
 
+#include <boost/container/flat_set.hpp>
+
 #include <coroutine>
 #include <queue>
 #include <variant>
@@ -76,9 +78,11 @@ struct Goal : public std::enable_shared_from_this<Goal>
 {
 private:
     /**
-     * Goals that this goal is waiting for.
+     * Goals that this goal is waiting for. This is a sorted vector
+     * rather than a `Goals`, since there are a lot of goals and this
+     * is only ever filled in one go by `await()`.
      */
-    Goals waitees;
+    boost::container::flat_set<GoalPtr, CompareGoalPtrs> waitees;
 
 public:
     typedef enum { ecBusy, ecSuccess, ecFailed, ecNoSubstituters } ExitCode;
@@ -90,9 +94,10 @@ public:
 
     /**
      * Goals waiting for this one to finish.  Must use weak pointers
-     * here to prevent cycles.
+     * here to prevent cycles.  `await()` ensures that a goal appears
+     * here at most once.
      */
-    WeakGoals waiters;
+    std::vector<WeakGoalPtr> waiters;
 
     /**
      * Number of goals we are/were waiting for that have failed.
@@ -584,10 +589,29 @@ public:
      */
     virtual JobCategory jobCategory() const = 0;
 
+    /**
+     * @brief Hint for the scheduler, how long this goal itself is
+     * expected to keep a job slot busy.
+     */
+    virtual std::chrono::seconds expectedDuration()
+    {
+        return std::chrono::seconds(0);
+    }
+
+    /**
+     * @brief Hint for the scheduler, how much memory this goal is
+     * expected to use (at most) while it runs, in bytes.
+     */
+    virtual uint64_t expectedMemory()
+    {
+        return 0;
+    }
+
 protected:
     Co await(Goals waitees);
 
     Co waitForAWhile();
+    Co waitForLocks(const std::set<std::filesystem::path> & paths);
     Co waitForBuildSlot();
     Co yield();
 };
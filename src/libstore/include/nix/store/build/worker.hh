@@ -62,6 +62,8 @@ struct Child
 #ifndef _WIN32 // TODO Enable building on Windows
 /* Forward definition. */
 struct HookInstance;
+struct RemoteBuilders;
+struct Jobserver;
 #endif
 
 /**
@@ -105,6 +107,21 @@ private:
      */
     size_t nrSubstitutions;
 
+    /**
+     * The values last added to the shared `StoreMetrics` gauges, so
+     * that several workers can contribute to them.
+     */
+    struct
+    {
+        int64_t builds = 0, substitutions = 0, waiting = 0;
+    } reportedMetrics;
+
+    /**
+     * Update the shared `StoreMetrics`, if enabled, with the slots in
+     * use. `finished` withdraws this worker's contribution.
+     */
+    void reportMetrics(bool finished = false);
+
     /**
      * Maps used to prevent multiple instantiations of a goal for the
      * same derivation / path.
@@ -115,6 +132,13 @@ private:
     std::map<StorePath, std::map<OutputName, std::weak_ptr<DerivationGoal>>> derivationGoals;
     std::map<StorePath, std::weak_ptr<DerivationResolutionGoal>> derivationResolutionGoals;
     std::map<StorePath, std::weak_ptr<DerivationBuildingGoal>> derivationBuildingGoals;
+
+    /**
+     * The derivations held by the goals above. All goals for a
+     * derivation share a single copy of it, which is freed once the
+     * last of them is gone.
+     */
+    std::map<StorePath, std::weak_ptr<const Derivation>> derivations;
     std::map<StorePath, std::weak_ptr<PathSubstitutionGoal>> substitutionGoals;
     std::map<DrvOutput, std::weak_ptr<DrvOutputSubstitutionGoal>> drvOutputSubstitutionGoals;
 
@@ -138,6 +162,13 @@ private:
      */
     std::map<StorePath, bool> pathContentsGoodCache;
 
+    /**
+     * The expected time from starting `goal` until the top-level goal
+     * that needs it can finish, i.e. the length of the longest chain
+     * of waiters above it, weighted by `Goal::expectedDuration()`.
+     */
+    std::chrono::seconds criticalPath(Goal & goal, std::map<Goal *, std::chrono::seconds> & memo);
+
 public:
 
     const Activity act;
@@ -169,6 +200,37 @@ public:
     AutoCloseFD ioport;
 #endif
 
+#ifdef __linux__
+    /**
+     * The epoll instance that `waitForInput()` waits on. The
+     * channels of every child are registered with it in
+     * `childStarted()` and removed again on EOF or in
+     * `childTerminated()`, so we don't need to rebuild the set of
+     * descriptors to wait for on every iteration.
+     */
+    AutoCloseFD epollFd;
+
+    /**
+     * An inotify instance watching the lock files of goals in
+     * `waitForLocks()`, so that they can be retried as soon as the
+     * process holding the lock closes it.
+     */
+    AutoCloseFD lockWatchFd;
+
+    /**
+     * The goals waiting on each inotify watch descriptor.
+     */
+    std::map<int, WeakGoals> lockWatches;
+
+    void watchChannel(MuxablePipePollState::CommChannel fd);
+    void unwatchChannel(MuxablePipePollState::CommChannel fd);
+
+    /**
+     * Wake up the goals waiting on lock files that have changed.
+     */
+    void processLockWatches();
+#endif
+
     Store & store;
     Store & evalStore;
 
@@ -182,6 +244,22 @@ public:
 
 #ifndef _WIN32 // TODO Enable building on Windows
     std::unique_ptr<HookInstance> hook;
+
+    /**
+     * The in-process dispatcher of remote builds, used instead of
+     * `hook` if `in-process-builders` is set. Created on first use.
+     */
+    std::unique_ptr<RemoteBuilders> remoteBuilders;
+
+private:
+    std::unique_ptr<Jobserver> jobserver;
+
+public:
+    /**
+     * The jobserver shared by the local builds of this worker, created
+     * on first use. Null if `build-jobserver` is disabled.
+     */
+    Jobserver * getJobserver();
 #endif
 
     uint64_t expectedBuilds = 0;
@@ -189,6 +267,13 @@ public:
     uint64_t failedBuilds = 0;
     uint64_t runningBuilds = 0;
 
+    /**
+     * Number of content-addressing derivations that didn't need to be
+     * built because they resolved to a derivation that was built
+     * before ("early cutoff").
+     */
+    uint64_t skippedByEarlyCutoff = 0;
+
     uint64_t expectedSubstitutions = 0;
     uint64_t doneSubstitutions = 0;
     uint64_t failedSubstitutions = 0;
@@ -198,6 +283,18 @@ public:
     uint64_t expectedNarSize = 0;
     uint64_t doneNarSize = 0;
 
+    /**
+     * Moving average of the download bandwidth of completed
+     * substitutions, in bytes per second, or 0 if we haven't
+     * downloaded anything yet. Used by `cost-based-substitution`.
+     */
+    double substitutionBandwidth = 0;
+
+    /**
+     * The store designated by `upload-outputs-to`, opened on first use.
+     */
+    std::shared_ptr<Store> uploadStore;
+
     /**
      * Whether to ask the build hook if it can build a derivation. If
      * it answers with "decline-permanently", we don't try again.
@@ -225,6 +322,12 @@ public:
     std::shared_ptr<DerivationTrampolineGoal> makeDerivationTrampolineGoal(
         const StorePath & drvPath, const OutputsSpec & wantedOutputs, const Derivation & drv, BuildMode buildMode);
 
+    /**
+     * Get the shared copy of the derivation `drvPath`, making one from
+     * `drv` if no goal holds it yet.
+     */
+    std::shared_ptr<const Derivation> shareDerivation(const StorePath & drvPath, const Derivation & drv);
+
     std::shared_ptr<DerivationGoal> makeDerivationGoal(
         const StorePath & drvPath,
         const Derivation & drv,
@@ -304,6 +407,18 @@ public:
      */
     void waitForBuildSlot(GoalPtr goal);
 
+    /**
+     * Whether starting the local build `goal` now keeps the expected
+     * memory usage of all local builds within `build-memory-budget`.
+     */
+    bool admitBuild(Goal & goal);
+
+    /**
+     * Number of times a build had to wait because of
+     * `build-memory-budget`.
+     */
+    uint64_t buildsDelayedForMemory = 0;
+
     /**
      * Wait for any goal to finish.  Pretty indiscriminate way to
      * wait for some resource that some other goal is holding.
@@ -318,6 +433,14 @@ public:
      */
     void waitForAWhile(GoalPtr goal);
 
+    /**
+     * Like `waitForAWhile()`, but for a goal waiting on the locks of
+     * the given paths. Where supported, the goal is woken up as soon
+     * as one of the lock files is closed or deleted by its holder,
+     * rather than at the next poll interval.
+     */
+    void waitForLocks(GoalPtr goal, const std::set<std::filesystem::path> & paths);
+
     /**
      * Loop until the specified top-level goals have finished.
      */
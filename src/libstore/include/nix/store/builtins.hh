@@ -17,6 +17,12 @@ struct BuiltinBuilderContext
     std::string netrcData;
     std::string caFileData;
     Path tmpDirInSandbox;
+    Path storeDir;
+
+    /**
+     * The closure of the inputs of the derivation.
+     */
+    StringSet inputPaths;
 
 #if NIX_WITH_AWS_AUTH
     /**
@@ -35,9 +41,18 @@ struct RegisterBuiltinBuilder
 
     static BuiltinBuilders & builtinBuilders();
 
-    RegisterBuiltinBuilder(const std::string & name, BuiltinBuilder && fun)
+    /**
+     * The builtin builders that only create their outputs from the
+     * attributes and inputs of the derivation, so they are run without
+     * a sandbox to save its setup.
+     */
+    static StringSet & unsandboxedBuiltinBuilders();
+
+    RegisterBuiltinBuilder(const std::string & name, BuiltinBuilder && fun, bool needsSandbox = true)
     {
         builtinBuilders().insert_or_assign(name, std::move(fun));
+        if (!needsSandbox)
+            unsandboxedBuiltinBuilders().insert(name);
     }
 };
 
@@ -48,4 +48,17 @@ typedef std::vector<Package> Packages;
 
 void buildProfile(const Path & out, Packages && pkgs);
 
+/**
+ * Build the profile for `pkgs` in `out` by adding the packages that
+ * are not in `prevPkgs` to `prev`, the profile built earlier for
+ * `prevPkgs`. Only the directories of the added packages, and those of
+ * existing packages that they share a directory with, are read.
+ *
+ * @return false, without writing to `out`, if this isn't possible:
+ * if packages were removed or changed priority, or if an added package
+ * collides with an existing one in a way that depends on the order in
+ * which they are linked. The caller should then use `buildProfile()`.
+ */
+bool buildProfileIncremental(const Path & out, const Path & prev, Packages && prevPkgs, Packages && pkgs);
+
 } // namespace nix
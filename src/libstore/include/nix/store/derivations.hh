@@ -457,6 +457,17 @@ class Store;
  */
 StorePath writeDerivation(Store & store, const Derivation & drv, RepairFlag repair = NoRepair, bool readOnly = false);
 
+/**
+ * Write several derivations to the Nix store at once. Derivations
+ * that are already valid are skipped; the others are added with a
+ * single `Store::addMultipleToStore()` call, which is much cheaper
+ * than one `writeDerivation()` per derivation for remote stores.
+ *
+ * `drvs` must be ordered such that every derivation comes after the
+ * derivations in `drvs` that it depends on.
+ */
+void writeDerivations(Store & store, const std::vector<Derivation> & drvs, RepairFlag repair = NoRepair);
+
 /**
  * Read a derivation from a file.
  */
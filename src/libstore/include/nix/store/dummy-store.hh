@@ -17,6 +17,7 @@ struct DummyStoreConfig : public std::enable_shared_from_this<DummyStoreConfig>,
     {
         // Disable caching since this a temporary in-memory store.
         pathInfoCacheSize = 0;
+        pathInfoNegativeCacheSize = 0;
     }
 
     DummyStoreConfig(std::string_view scheme, std::string_view authority, const Params & params)
@@ -12,12 +12,23 @@ const uint32_t exportMagic = 0x4558494e;
 /**
  * Export multiple paths in the format expected by `nix-store
  * --import`. The paths will be sorted topologically.
+ *
+ * @param version The format version. Version 1 interleaves every NAR
+ * with its metadata. Version 2 writes the metadata of all paths
+ * first, followed by the NARs as length-prefixed frames, optionally
+ * compressed with `compression`, so that the importer can validate
+ * the whole set up front and add paths to the store in parallel.
  */
-void exportPaths(Store & store, const StorePathSet & paths, Sink & sink);
+void exportPaths(
+    Store & store,
+    const StorePathSet & paths,
+    Sink & sink,
+    unsigned int version = 1,
+    const std::string & compression = "none");
 
 /**
  * Import a sequence of NAR dumps created by `exportPaths()` into the
- * Nix store.
+ * Nix store. The format version is detected automatically.
  */
 StorePaths importPaths(Store & store, Source & source, CheckSigsFlag checkSigs = CheckSigs);
 
@@ -37,6 +37,18 @@ struct FileTransferSettings : Config
         )",
         {"binary-caches-parallel-connections"}};
 
+    Setting<unsigned int> httpThreads{
+        this,
+        4,
+        "http-threads",
+        R"(
+          The number of threads that perform downloads and uploads.
+          Each has its own share of the `http-connections` limit.
+          Requests for the same host go to the same thread when it
+          isn't busier than the others, so that they can reuse its
+          connections.
+        )"};
+
     /* Do not set this too low. On glibc, getaddrinfo() contains fallback code
        paths that deal with ill-behaved DNS servers. Setting this too low
        prevents some fallbacks from occurring.
@@ -240,6 +252,12 @@ struct FileTransferResult
 
     uint64_t bodySize = 0;
 
+    /**
+     * The size of the complete resource, as returned by the
+     * `Content-Range` header of a partial (range) response.
+     */
+    std::optional<uint64_t> totalSize;
+
     /**
      * An "immutable" URL for this resource (i.e. one whose contents
      * will never change), as returned by the `Link: <url>;
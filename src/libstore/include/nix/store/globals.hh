@@ -141,6 +141,24 @@ public:
         )",
         {"build-fallback"}};
 
+    Setting<bool> costBasedSubstitution{
+        this,
+        false,
+        "cost-based-substitution",
+        R"(
+          If set to `true`, Nix builds a derivation locally instead of
+          substituting its output if it expects the build to finish
+          sooner than the download. The download time is estimated from
+          the compressed size of the substitute and the bandwidth of the
+          substitutions done so far by the same Nix invocation, and the
+          build time from previous local builds of derivations with the
+          same name.
+
+          This is only done if all inputs of the derivation are already
+          valid, so that building doesn't require fetching anything
+          else.
+        )"};
+
     /**
      * Whether to show build log output in real time.
      */
@@ -207,6 +225,28 @@ public:
         )",
         {"build-cores"}};
 
+    Setting<bool> buildJobserver{
+        this,
+        false,
+        "build-jobserver",
+        R"(
+          If set to `true`, Nix runs a GNU make compatible jobserver with
+          [`cores`](#conf-cores) tokens that is shared by all concurrent
+          local builds, and points builders at it through the `MAKEFLAGS`
+          and `CARGO_MAKEFLAGS` environment variables. Tools that support
+          the jobserver protocol (such as GNU make 4.4 and later, ninja
+          1.13 and later, and cargo) then share those cores, so that
+          running several builds at the same time doesn't oversubscribe
+          the machine, while a single remaining build can use all of it.
+
+          The jobserver FIFO is made available inside the sandbox.
+
+          > **Note**
+          >
+          > A make invoked with an explicit `-j` flag, such as
+          > `-j${NIX_BUILD_CORES}`, ignores the jobserver.
+        )"};
+
     /**
      * Read-only mode.  Don't copy stuff to the store, don't change
      * the database.
@@ -431,6 +471,18 @@ public:
           This can drastically reduce build times if the network connection between the local machine and the remote build host is slow.
         )"};
 
+    Setting<bool> inProcessBuilders{
+        this,
+        false,
+        "in-process-builders",
+        R"(
+          If set to `true`, Nix dispatches builds to the [remote build machines](#conf-builders) itself instead of running the [`build-hook`](#conf-build-hook) for every build.
+          Connections to the machines are kept open and reused for later builds, and paths that have been uploaded over a connection are not checked again.
+
+          The build slots of the machines are only accounted for within a single Nix process, so concurrent Nix processes using the same machines may exceed their `maxJobs`.
+          Only `ssh-ng://` machines are supported; other machines are ignored.
+        )"};
+
     Setting<off_t> reservedSize{
         this, 8 * 1024 * 1024, "gc-reserved-space", "Amount of reserved disk space for the garbage collector."};
 
@@ -457,6 +509,27 @@ public:
 
     Setting<bool> useSQLiteWAL{this, !isWSL1(), "use-sqlite-wal", "Whether SQLite should use WAL mode."};
 
+    Setting<uint64_t> cacheDbMmapSize{
+        this,
+        256 * 1024 * 1024,
+        "cache-db-mmap-size",
+        R"(
+          The maximum number of bytes of each cache database (such as the binary cache, fetcher and evaluation caches in `~/.cache/nix`) that SQLite reads through memory-mapped I/O rather than `read()` calls.
+
+          Set to `0` to disable memory-mapped I/O for these databases.
+          See [`db-mmap-size`](@docroot@/store/types/local-store.md#store-local-store-db-mmap-size) for the Nix database itself.
+        )"};
+
+    Setting<uint64_t> cacheDbPageCacheSize{
+        this,
+        0,
+        "cache-db-page-cache-size",
+        R"(
+          The size in KiB of SQLite's page cache for each connection to a cache database.
+
+          The default, `0`, uses SQLite's default of 2 MiB.
+        )"};
+
 #ifndef _WIN32
     // FIXME: remove this option, `fsync-store-paths` is faster.
     Setting<bool> syncBeforeRegistering{
@@ -587,11 +660,38 @@ public:
         "compress-build-log",
         R"(
           If set to `true` (the default), build logs written to
-          `/nix/var/log/nix/drvs` are compressed on the fly using bzip2.
+          `/nix/var/log/nix/drvs` are compressed on the fly using the method
+          in [`build-log-compression`](#conf-build-log-compression).
           Otherwise, they are not compressed.
         )",
         {"build-compress-log"}};
 
+    Setting<std::string> logCompression{
+        this,
+        "bzip2",
+        "build-log-compression",
+        R"(
+          The compression method for build logs if
+          [`compress-build-log`](#conf-compress-build-log) is enabled. It can
+          be `bzip2` (the default) or `zstd`, which is much faster for builds
+          that produce a lot of output. The log is compressed and written by
+          a separate thread, so it doesn't slow down the handling of other
+          builds.
+        )"};
+
+    Setting<unsigned int> logLinesPerSecond{
+        this,
+        0,
+        "build-log-lines-per-second",
+        R"(
+          The maximum number of build log lines per second that a build
+          forwards to the progress bar and to clients of the daemon. Further
+          lines in that second are dropped, but are still written to the build
+          log in `/nix/var/log/nix/drvs` and kept for the log tail that is
+          shown if the build fails (see [`log-lines`](#conf-log-lines)). A
+          value of `0` (the default) means that there is no limit.
+        )"};
+
     Setting<unsigned long> maxLogSize{
         this,
         0,
@@ -641,6 +741,44 @@ public:
         )",
         {"gc-keep-derivations"}};
 
+    Setting<unsigned int> gcRuntimeRootsTTL{
+        this,
+        0,
+        "gc-runtime-roots-ttl",
+        R"(
+          The number of seconds for which the runtime roots found by scanning
+          `/proc` are reused by later queries for roots, such as
+          `nix-store --gc --print-roots` and `nix-store --query --roots`.
+          This avoids repeated scans on hosts with many processes, at the
+          risk of missing store paths that processes started using since
+          the last scan. The garbage collector itself always scans `/proc`,
+          so that it can't delete such paths. The default, `0`, scans every
+          time.
+        )"};
+
+    Setting<unsigned int> gcDeleteJobs{
+        this,
+        0,
+        "gc-delete-jobs",
+        R"(
+          The number of threads that the garbage collector uses to delete
+          dead store paths from disk. Paths are still found and invalidated
+          one at a time, but are removed from disk in the background, so the
+          collector can move on to the next path straight away. The default,
+          `0`, deletes each path before moving on.
+        )"};
+
+    Setting<uint64_t> gcMaxDeleteRate{
+        this,
+        0,
+        "gc-max-delete-rate",
+        R"(
+          The maximum average rate, in bytes per second, at which the garbage
+          collector deletes store paths. This keeps a long garbage collection
+          from monopolising the disk while builds are running. The default,
+          `0`, means no limit.
+        )"};
+
     Setting<bool> autoOptimiseStore{
         this,
         false,
@@ -651,6 +789,32 @@ public:
           a single copy. This saves disk space. If set to `false` (the
           default), you can still run `nix-store --optimise` to get rid of
           duplicate files.
+
+          New store paths are optimised in the background after they
+          have been added to the store (see `auto-optimise-store-jobs`),
+          so that builds that depend on them don't have to wait.
+        )"};
+
+    Setting<unsigned int> autoOptimiseStoreJobs{
+        this,
+        4,
+        "auto-optimise-store-jobs",
+        R"(
+          The maximum number of threads that optimise new store paths
+          in the background if `auto-optimise-store` is enabled.
+        )"};
+
+    Setting<bool> optimiseStoreReflinks{
+        this,
+        false,
+        "optimise-store-reflinks",
+        R"(
+          If set to `true`, optimising the store makes files with identical
+          contents share their data on disk, rather than replacing them with
+          hard links. The files remain separate, so their link counts don't
+          change. This requires Linux and a file system that supports
+          `FIDEDUPERANGE`, such as Btrfs or XFS. On other file systems, files
+          are left as they are.
         )"};
 
     Setting<bool> envKeepDerivations{
@@ -760,6 +924,38 @@ public:
 #endif
 
 #ifdef __linux__
+    Setting<bool> sandboxStoreOverlay{
+        this,
+        false,
+        "sandbox-store-overlay",
+        R"(
+            *Linux only*
+
+            If set to `true`, the Nix store in the sandbox is an overlay whose lower layer is a `tmpfs` holding the mount points of the inputs, and whose upper layer receives the outputs.
+            This avoids creating and deleting a directory on the store's file system for every input of a build, which speeds up the setup of sandboxes with large input closures.
+
+            If the kernel or the file system of the store doesn't support overlays in the sandbox, Nix silently uses plain directories instead.
+        )"};
+
+    Setting<std::string> sandboxBuildDirTmpfsSize{
+        this,
+        "",
+        "sandbox-build-dir-tmpfs-size",
+        R"(
+            *Linux only*
+
+            If set, the build directory in the sandbox (see [`sandbox-build-dir`](#conf-sandbox-build-dir)) is a `tmpfs` of at most this size instead of a directory on disk.
+            This avoids disk I/O for the temporary files of builds.
+            For the format, see the description of the `size` option of `tmpfs` in mount(8), for instance `4G` or `25%`.
+
+            The `tmpfs` is charged to the memory of the build's cgroup, so [`build-memory-budget`](#conf-build-memory-budget) accounts for it.
+            Under memory pressure, its pages can be swapped out.
+            If the `tmpfs` is full, writes to the build directory fail.
+
+            This is not used for builds that require the `recursive-nix` feature, or when [`keep-failed`](#conf-keep-failed) is set.
+            The amount of data left in the `tmpfs` at the end of a build is logged at the `talkative` level.
+        )"};
+
     Setting<std::string> sandboxShmSize{
         this,
         "50%",
@@ -1132,6 +1328,22 @@ public:
               /nix/store/xfghy8ixrhz3kyy6p724iv3cxji088dx-bash-4.4-p23`.
         )"};
 
+    Setting<std::string> uploadOutputsTo{
+        this,
+        "",
+        "upload-outputs-to",
+        R"(
+          Optional. The URL of a store, typically a binary cache, to which Nix copies the closure of the outputs of each build, along with their realisations for floating content-addressed derivations.
+
+          This option is only settable in the global `nix.conf`, or on the
+          command line by trusted users.
+
+          Set on a build machine, together with [`substituters`](#conf-substituters) that share the same cache, this lets clients build with `--store ssh-ng://machine --eval-store auto`:
+          the client only sends the derivations and input sources, the machine substitutes the other inputs itself, and the outputs go straight to the cache rather than back to the client.
+
+          If copying fails, the build succeeds but no further builds execute, like with [`post-build-hook`](#conf-post-build-hook).
+        )"};
+
     Setting<unsigned int> downloadSpeed{
         this,
         0,
@@ -1256,6 +1468,23 @@ public:
           first. If it is not available there, it tries the original URI.
         )"};
 
+    Setting<uint64_t> buildMemoryBudget{
+        this,
+        0,
+        "build-memory-budget",
+        R"(
+          The amount of memory in bytes that concurrent local builds may use
+          together. Before starting a build, Nix adds up the memory that the
+          running builds use and the peak memory that earlier builds of each
+          of them, and of the new build, needed. If the total exceeds the
+          budget, the new build waits until another build finishes. A build
+          is always started if no other build is running.
+
+          Memory usage is only known for builds that ran in a cgroup (see
+          [`use-cgroups`](#conf-use-cgroups)). A value of `0` (the default)
+          disables this feature.
+        )"};
+
     Setting<uint64_t> minFree{
         this,
         0,
@@ -1285,6 +1514,40 @@ public:
     Setting<size_t> narBufferSize{
         this, 32 * 1024 * 1024, "nar-buffer-size", "Maximum size of NARs before spilling them to disk."};
 
+    Setting<unsigned int> copyPathJobs{
+        this,
+        0,
+        "copy-path-jobs",
+        R"(
+          The maximum number of store paths that are copied between stores in
+          parallel, e.g. by [`nix copy`](@docroot@/command-ref/new-cli/nix3-copy.md).
+          This also bounds the number of concurrent path info queries to the
+          source store. The default, `0`, uses the number of CPU cores.
+        )"};
+
+    Setting<uint64_t> copyMaxBytesInFlight{
+        this,
+        0,
+        "copy-max-bytes-in-flight",
+        R"(
+          The maximum combined NAR size, in bytes, of the store paths that are
+          being copied between stores at the same time. Once this limit is
+          reached, further copies wait for running ones to finish. This bounds
+          memory use when the destination buffers NARs, as binary caches do.
+          A path larger than the limit is still copied, but on its own. The
+          default, `0`, means no limit.
+        )"};
+
+    Setting<unsigned int> verifyJobs{
+        this,
+        0,
+        "verify-jobs",
+        R"(
+          The number of store paths whose contents `nix-store --verify
+          --check-contents` hashes at the same time. The default, `0`, uses
+          the number of CPU cores.
+        )"};
+
     Setting<bool> allowSymlinkedStore{
         this,
         false,
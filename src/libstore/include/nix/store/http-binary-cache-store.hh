@@ -109,6 +109,11 @@ protected:
 
     void getFile(const std::string & path, Callback<std::optional<std::string>> callback) noexcept override;
 
+    /**
+     * Uses an HTTP range request.
+     */
+    std::string getFileRange(const std::string & path, uint64_t offset, uint64_t length) override;
+
     std::optional<std::string> getNixCacheInfo() override;
 
     std::optional<TrustedFlag> isTrustedClient() override;
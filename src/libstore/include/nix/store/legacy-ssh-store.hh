@@ -78,6 +78,9 @@ struct LegacySSHStore : public virtual Store
 
     std::map<StorePath, UnkeyedValidPathInfo> queryPathInfosUncached(const StorePathSet & paths);
 
+    std::map<StorePath, std::shared_ptr<const ValidPathInfo>>
+    queryMultiplePathInfosUncached(const StorePathSet & paths) override;
+
     void addToStore(const ValidPathInfo & info, Source & source, RepairFlag repair, CheckSigsFlag checkSigs) override;
 
     void narFromPath(const StorePath & path, Sink & sink) override;
@@ -16,6 +16,31 @@ struct LocalBinaryCacheStoreConfig : std::enable_shared_from_this<LocalBinaryCac
 
     Path binaryCacheDir;
 
+    const Setting<bool> fsyncFiles{
+        this,
+        false,
+        "fsync",
+        R"(
+          Whether to `fsync()` the files written to the cache, so that
+          they survive a system crash. A file is synced before it
+          becomes visible in the cache, so that readers never see
+          truncated files.
+
+          When copying many paths at once (e.g. `nix copy --to
+          file://…`), Nix makes the written files visible and syncs
+          them in batches of `fsync-batch-size` paths instead, so that
+          the cost of a sync is shared by the whole batch.
+        )"};
+
+    const Setting<uint64_t> fsyncBatchSize{
+        this,
+        1000,
+        "fsync-batch-size",
+        R"(
+          The number of paths to sync at once when copying many paths
+          to the cache with `fsync` enabled.
+        )"};
+
     static const std::string name()
     {
         return "Local Binary Cache Store";
@@ -69,6 +69,19 @@ struct LocalOverlayStoreConfig : virtual LocalStoreConfig
           The store directory is passed as an argument to the invoked executable.
         )"};
 
+    Setting<bool> lowerStoreSnapshot{
+        (StoreConfig *) this,
+        true,
+        "lower-store-snapshot",
+        R"(
+          Answer validity and referrer queries for the lower store from an in-memory
+          snapshot of its database, rather than querying the lower store every time.
+          The snapshot is loaded on first use and reloaded when the lower store's
+          database changes.
+          This only applies if the lower store is a local store; other lower stores
+          are always queried directly.
+        )"};
+
     static const std::string name()
     {
         return "Experimental Local Overlay Store";
@@ -128,6 +141,23 @@ private:
      */
     ref<LocalFSStore> lowerStore;
 
+    struct LowerSnapshot;
+
+    Sync<std::shared_ptr<const LowerSnapshot>> lowerSnapshot_;
+
+    /**
+     * @return A snapshot of the lower store's valid paths and
+     * references that is up to date with its database, or `nullptr`
+     * if the lower store has to be queried directly.
+     */
+    std::shared_ptr<const LowerSnapshot> getLowerSnapshot();
+
+    /**
+     * Whether `path` is valid in the lower store, from the snapshot if
+     * possible.
+     */
+    bool isValidInLower(const StorePath & path);
+
     /**
      * First copy up any lower store realisation with the same key, so we
      * merge rather than mask it.
@@ -153,6 +183,17 @@ private:
      */
     void queryReferrers(const StorePath & path, StorePathSet & referrers) override;
 
+    /**
+     * The closure may extend into the lower store, so this can't use
+     * `LocalStore`'s query on the upper DB.
+     */
+    void computeFSClosure(
+        const StorePathSet & paths,
+        StorePathSet & out,
+        bool flipDirection = false,
+        bool includeOutputs = false,
+        bool includeDerivers = false) override;
+
     /**
      * Check the lower store and upper DB.
      */
@@ -175,6 +216,12 @@ private:
     void queryRealisationUncached(
         const DrvOutput &, Callback<std::shared_ptr<const UnkeyedRealisation>> callback) noexcept override;
 
+    /**
+     * Check lower store for the outputs that the upper DB does not have.
+     */
+    std::map<DrvOutput, std::shared_ptr<const UnkeyedRealisation>>
+    queryRealisationsUncached(const std::set<DrvOutput> & outputs) override;
+
     /**
      * Call `remountIfNecessary` after collecting garbage normally.
      */
@@ -186,6 +233,15 @@ private:
      */
     void deleteStorePath(const Path & path, uint64_t & bytesFreed) override;
 
+    /**
+     * Paths must be deleted through `deleteStorePath` so that
+     * whiteouts are avoided.
+     */
+    std::optional<Path> trashStorePath(const Path & path) override
+    {
+        return std::nullopt;
+    }
+
     /**
      * Deduplicate by removing store objects from the upper layer that
      * are now in the lower layer.
@@ -4,11 +4,15 @@
 #include "nix/store/sqlite.hh"
 
 #include "nix/store/pathlocks.hh"
+#include "nix/store/build-stats.hh"
 #include "nix/store/store-api.hh"
 #include "nix/store/indirect-root-store.hh"
+#include "nix/store/path-interner.hh"
 #include "nix/util/sync.hh"
+#include "nix/util/pool.hh"
 
 #include <chrono>
+#include <deque>
 #include <future>
 #include <string>
 #include <boost/unordered/unordered_flat_set.hpp>
@@ -110,6 +114,63 @@ public:
           > While the filesystem the database resides on might appear to be read-only, consider whether another user or system might have write access to it.
         )"};
 
+    Setting<size_t> maxReadConnections{
+        this,
+        4,
+        "max-read-connections",
+        R"(
+          The maximum number of additional read-only connections to the [database](@docroot@/glossary.md#gloss-nix-database) used for queries.
+
+          These let queries from different threads run concurrently with each other, and with transactions that register or delete paths.
+          They are only used if [`use-sqlite-wal`](@docroot@/command-ref/conf-file.md#conf-use-sqlite-wal) is enabled.
+          Set to `0` to run all queries on the main connection.
+        )"};
+
+    Setting<uint64_t> dbMmapSize{
+        this,
+        0,
+        "db-mmap-size",
+        R"(
+          The maximum number of bytes of the [database](@docroot@/glossary.md#gloss-nix-database) that SQLite reads through memory-mapped I/O rather than `read()` calls.
+
+          Memory-mapping lets queries use pages from the operating system's page cache directly, avoiding a copy into SQLite's own cache.
+          This speeds up queries on large stores, at the cost of the process crashing rather than reporting an error on an I/O error.
+
+          The default, `0`, disables memory-mapped I/O.
+        )"};
+
+    Setting<uint64_t> dbPageCacheSize{
+        this,
+        0,
+        "db-page-cache-size",
+        R"(
+          The size in KiB of SQLite's page cache for each connection to the [database](@docroot@/glossary.md#gloss-nix-database).
+
+          The default, `0`, uses SQLite's default of 2 MiB.
+        )"};
+
+    Setting<unsigned int> dbWalAutoCheckpoint{
+        this,
+        40000,
+        "db-wal-autocheckpoint",
+        R"(
+          The number of pages the write-ahead log of the [database](@docroot@/glossary.md#gloss-nix-database) may grow to before SQLite copies it back into the database.
+
+          The default is large enough that instantiating a NixOS system needs only one checkpoint.
+          This only has an effect if [`use-sqlite-wal`](@docroot@/command-ref/conf-file.md#conf-use-sqlite-wal) is enabled.
+        )"};
+
+    Setting<bool> dbBackgroundCheckpoint{
+        this,
+        false,
+        "db-background-checkpoint",
+        R"(
+          Whether to checkpoint the write-ahead log of the [database](@docroot@/glossary.md#gloss-nix-database) from a background thread, once it has grown past [`db-wal-autocheckpoint`](#store-local-store-db-wal-autocheckpoint) pages.
+
+          Normally, the transaction that makes the log cross that size does the checkpoint before it returns, which can take seconds on a busy store.
+          This only has an effect if [`use-sqlite-wal`](@docroot@/command-ref/conf-file.md#conf-use-sqlite-wal) is enabled.
+        )"};
+
     static const std::string name()
     {
         return "Local Store";
@@ -182,10 +243,45 @@ private:
      */
     ref<Sync<State>> _state;
 
+    /**
+     * A read-only connection to the database, with its own prepared
+     * statements. Only the statements needed for queries are
+     * prepared.
+     */
+    struct ReadConnection
+    {
+        SQLite db;
+        std::unique_ptr<State::Stmts> stmts;
+    };
+
+    /**
+     * Connections used by queries, so that they don't have to wait
+     * for `_state`. Empty if the main connection isn't in WAL mode,
+     * since readers and writers then exclude each other anyway.
+     */
+    Pool<ReadConnection> readConnections;
+
+    /**
+     * Run `f` on the statements of a read-only connection if
+     * available, and otherwise on those of the main connection.
+     * Retries on `SQLITE_BUSY`.
+     */
+    template<typename T, typename F>
+    T withReadStmts(F && f);
+
+    ref<ReadConnection> openReadConnection();
+
+    /**
+     * Prepare the statements used by queries, on either the main
+     * connection or a read-only one.
+     */
+    void prepareQueryStmts(SQLite & db, State::Stmts & stmts);
+
 public:
 
     const Path dbDir;
     const Path linksDir;
+    const Path trashDir;
     const Path reservedPath;
     const Path schemaPath;
     const Path tempRootsDir;
@@ -198,9 +294,11 @@ private:
 public:
 
     /**
-     * Hack for build-remote.cc.
+     * Output paths whose locks are held by a build that copies them
+     * back from a remote builder, either in the `build-remote` process
+     * or in a thread of a `RemoteBuilders`.
      */
-    PathSet locksHeld;
+    Sync<PathSet> locksHeld;
 
     /**
      * Initialise the local store, upgrading the schema if
@@ -225,8 +323,60 @@ public:
 
     void queryReferrers(const StorePath & path, StorePathSet & referrers) override;
 
+    /**
+     * Computes plain reference closures with a single recursive SQL
+     * query.
+     */
+    void computeFSClosure(
+        const StorePathSet & paths,
+        StorePathSet & out,
+        bool flipDirection = false,
+        bool includeOutputs = false,
+        bool includeDerivers = false) override;
+
+    /**
+     * Sums the NAR sizes in the same recursive SQL query. The closure
+     * size of a single path is recorded in the database, so it is only
+     * computed once.
+     */
+    ClosureSize queryClosureSize(const StorePathSet & paths, StorePathSet * closure = nullptr) override;
+
+    std::map<StorePath, std::shared_ptr<const ValidPathInfo>>
+    queryMultiplePathInfosUncached(const StorePathSet & paths) override;
+
+    /**
+     * The valid paths in the database and their references.
+     */
+    struct ReferenceGraph
+    {
+        StorePathInterner paths;
+
+        /**
+         * The references of every path, indexed by its id in `paths`.
+         */
+        std::vector<std::vector<StorePathId>> references;
+    };
+
+    /**
+     * Read the whole reference graph with two table scans, for callers
+     * that need to answer many queries without a database round-trip
+     * each.
+     */
+    ReferenceGraph queryReferenceGraph();
+
+    /**
+     * The valid paths whose name starts with `prefix`.
+     */
+    StorePathSet queryPathsWithName(std::string_view prefix);
+
     StorePathSet queryValidDerivers(const StorePath & path) override;
 
+    /**
+     * Returns the hashes recorded in the database, and computes and
+     * records the missing ones.
+     */
+    std::map<StorePath, DrvHash> queryDerivationHashesModulo(const StorePathSet & drvPaths) override;
+
     std::map<std::string, std::optional<StorePath>>
     queryStaticPartialDerivationOutputMap(const StorePath & path) override;
 
@@ -234,11 +384,27 @@ public:
 
     StorePathSet querySubstitutablePaths(const StorePathSet & paths) override;
 
+    /**
+     * Verifies the signatures on a thread pool. Successful
+     * verifications are cached, so `pathInfoIsUntrusted()` doesn't
+     * repeat them.
+     */
+    void precheckSignatures(const std::vector<const ValidPathInfo *> & infos) override;
+
     bool pathInfoIsUntrusted(const ValidPathInfo &) override;
     bool realisationIsUntrusted(const Realisation &) override;
 
     void addToStore(const ValidPathInfo & info, Source & source, RepairFlag repair, CheckSigsFlag checkSigs) override;
 
+    using Store::addMultipleToStore;
+
+    /**
+     * Adds the paths in batches, restoring every path of a batch
+     * before syncing them to disk and registering them together in a
+     * single transaction.
+     */
+    void addMultipleToStore(Source & source, RepairFlag repair, CheckSigsFlag checkSigs) override;
+
     StorePath addToStoreFromDump(
         Source & dump,
         std::string_view name,
@@ -250,8 +416,18 @@ public:
 
     void addTempRoot(const StorePath & path) override;
 
+    void addTempRoots(const StorePathSet & paths) override;
+
 private:
 
+    /**
+     * Restore `info.path` at `realPath` from the NAR in `source`,
+     * checking its NAR hash, size and content address, and canonicalise
+     * and optimise it. Doesn't register it.
+     */
+    void
+    restorePathFromNar(const ValidPathInfo & info, Source & source, const Path & realPath, RepairFlag repair, bool fsync);
+
     void createTempRootsFile();
 
     /**
@@ -259,6 +435,12 @@ private:
      */
     Sync<AutoCloseFD> _fdTempRoots;
 
+    /**
+     * The temporary roots we have registered already. They last as
+     * long as this process, so registering them again is redundant.
+     */
+    Sync<boost::unordered_flat_set<StorePath, std::hash<StorePath>>> tempRootsAdded;
+
     /**
      * The global GC lock.
      */
@@ -310,6 +492,16 @@ public:
      */
     virtual void deleteStorePath(const Path & path, uint64_t & bytesFreed);
 
+    /**
+     * Called by `collectGarbage` to move an invalidated path into
+     * `trashDir`, so that it can be deleted in the background without
+     * holding up anything that wants to re-create it.
+     *
+     * @return The new location of the path, or `std::nullopt` if it
+     * must be deleted in place with `deleteStorePath`.
+     */
+    virtual std::optional<Path> trashStorePath(const Path & path);
+
     /**
      * Optimise the disk space usage of the Nix store by hard-linking
      * files with the same contents.
@@ -324,6 +516,16 @@ public:
      */
     void optimisePath(const Path & path, RepairFlag repair);
 
+    /**
+     * Optimise a store path that has just been registered, if
+     * `auto-optimise-store` is enabled. This happens in background
+     * threads, so that it doesn't delay the users of the path, who
+     * can use it in the meantime since optimising only replaces files
+     * with identical ones. With `repair`, the path is optimised right
+     * away instead, checking the encountered links for corruption.
+     */
+    void optimisePathLater(const StorePath & path, RepairFlag repair = NoRepair);
+
     bool verifyStore(bool checkContents, RepairFlag repair) override;
 
 protected:
@@ -378,6 +580,30 @@ public:
      */
     void autoGC(bool sync = true);
 
+    /**
+     * How long building a derivation named `drvName` took in the
+     * past. This is a moving average over the recorded builds.
+     */
+    std::optional<std::chrono::seconds> queryBuildDuration(std::string_view drvName);
+
+    /**
+     * Record the statistics of a successful build. This also updates
+     * the average returned by `queryBuildDuration()`.
+     */
+    void recordBuildStats(const BuildStats & stats);
+
+    /**
+     * The recorded builds of the derivations with the given name or
+     * `hashDerivationModulo()`, most recent first.
+     */
+    std::vector<BuildStats> queryBuildStats(std::string_view drvNameOrHash, size_t limit = 100);
+
+    /**
+     * The highest peak memory usage of the recent builds of
+     * derivations named `drvName`.
+     */
+    std::optional<uint64_t> queryPeakMemory(std::string_view drvName);
+
     /**
      * Register the store path 'output' as the output named 'outputName' of
      * derivation 'deriver'.
@@ -391,6 +617,8 @@ public:
     std::optional<std::pair<int64_t, UnkeyedRealisation>> queryRealisationCore_(State & state, const DrvOutput & id);
     void queryRealisationUncached(
         const DrvOutput &, Callback<std::shared_ptr<const UnkeyedRealisation>> callback) noexcept override;
+    std::map<DrvOutput, std::shared_ptr<const UnkeyedRealisation>>
+    queryRealisationsUncached(const std::set<DrvOutput> & outputs) override;
 
     std::optional<std::string> getVersion() override;
 
@@ -418,10 +646,22 @@ private:
 
     void makeStoreWritable();
 
-    uint64_t queryValidPathId(State & state, const StorePath & path);
+    uint64_t queryValidPathId(State::Stmts & stmts, const StorePath & path);
 
     uint64_t addValidPath(State & state, const ValidPathInfo & info);
 
+    /**
+     * Look up the IDs of the valid paths among `paths` in a single
+     * query. Invalid paths are omitted from the result.
+     */
+    std::map<StorePath, uint64_t> queryValidPathIds(State & state, const StorePathSet & paths);
+
+    /**
+     * Add (referrer, reference) rows to the `Refs` table, many at a
+     * time.
+     */
+    void addReferences(State & state, const std::vector<std::pair<uint64_t, uint64_t>> & refs);
+
     void invalidatePath(State & state, const StorePath & path);
 
     /**
@@ -429,7 +669,7 @@ private:
      */
     void invalidatePathChecked(const StorePath & path);
 
-    std::shared_ptr<const ValidPathInfo> queryPathInfoInternal(State & state, const StorePath & path);
+    std::shared_ptr<const ValidPathInfo> queryPathInfoInternal(State::Stmts & stmts, const StorePath & path);
 
     void updatePathInfo(State & state, const ValidPathInfo & info);
 
@@ -438,22 +678,74 @@ private:
 
     void findRoots(const Path & path, std::filesystem::file_type type, Roots & roots);
 
-    void findRootsNoTemp(Roots & roots, bool censor);
+    /**
+     * @param allowCached Whether the runtime roots may come from a
+     * recent scan, see `gc-runtime-roots-ttl`. The garbage collector
+     * itself never uses them, since it could then delete paths that
+     * processes started using since that scan.
+     */
+    void findRootsNoTemp(Roots & roots, bool censor, bool allowCached = false);
 
-    void findRuntimeRoots(Roots & roots, bool censor);
+    void findRuntimeRoots(Roots & roots, bool censor, bool allowCached);
 
     std::pair<std::filesystem::path, AutoCloseFD> createTempDirInStore();
 
     typedef boost::unordered_flat_set<ino_t> InodeHash;
 
     InodeHash loadInodeHash();
-    Strings readDirectoryIgnoringInodes(const Path & path, const InodeHash & inodeHash);
-    void
-    optimisePath_(Activity * act, OptimiseStats & stats, const Path & path, InodeHash & inodeHash, RepairFlag repair);
+    Strings readDirectoryIgnoringInodes(const Path & path, SharedSync<InodeHash> & inodeHash);
+    void optimisePath_(
+        Activity * act, OptimiseStats & stats, const Path & path, SharedSync<InodeHash> & inodeHash, RepairFlag repair);
+
+    struct OptimiseQueue
+    {
+        /**
+         * Registered paths waiting to be optimised by
+         * `optimisePathLater()`.
+         */
+        std::deque<StorePath> paths;
+
+        /**
+         * The number of background threads working on `paths`. They
+         * exit once `paths` is empty.
+         */
+        size_t workers = 0;
+    };
+
+    Sync<OptimiseQueue> _optimiseQueue;
+
+    /**
+     * Signalled when a background optimisation thread exits.
+     */
+    std::condition_variable optimiseWorkerExited;
+
+    /**
+     * The main loop of a background optimisation thread.
+     */
+    void optimiseQueuedPaths();
+
+    /**
+     * The valid paths that `optimiseStore()` has already processed.
+     * Since store paths are immutable, they don't need to be
+     * processed again.
+     */
+    StorePathSet queryOptimisedPaths();
+
+    void markOptimised(const StorePath & path);
+
+    /**
+     * The paths whose contents `verifyStore()` has checked in an
+     * unfinished run.
+     */
+    StorePathSet queryVerifiedPaths();
+
+    void markVerified(const StorePath & path);
+
+    void clearVerifiedPaths();
 
     // Internal versions that are not wrapped in retry_sqlite.
-    bool isValidPath_(State & state, const StorePath & path);
-    void queryReferrers(State & state, const StorePath & path, StorePathSet & referrers);
+    bool isValidPath_(State::Stmts & stmts, const StorePath & path);
+    void queryReferrers(State::Stmts & stmts, const StorePath & path, StorePathSet & referrers);
 
     void addBuildLog(const StorePath & drvPath, std::string_view log) override;
 
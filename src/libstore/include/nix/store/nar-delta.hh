@@ -0,0 +1,45 @@
+#pragma once
+///@file
+
+#include "nix/store/store-api.hh"
+
+namespace nix {
+
+/**
+ * NARs smaller than this are always sent in full, since looking for a
+ * base and chunking it costs more than the transfer.
+ */
+constexpr uint64_t narDeltaMinSize = 4 * 1024 * 1024;
+
+/**
+ * Find a valid path in `store` that `path`, with a NAR of `narSize`
+ * bytes, can be sent as a delta against. This is the newest version
+ * of a path with the same package name (per `DrvName`) and a NAR of
+ * comparable size.
+ *
+ * Only supported for local stores; returns `std::nullopt` otherwise.
+ */
+std::optional<StorePath> findDeltaBase(Store & store, const StorePath & path, uint64_t narSize);
+
+/**
+ * The hashes of the content-defined chunks of the NAR of `path`.
+ */
+StringSet getNarChunkHashes(Store & store, const StorePath & path);
+
+/**
+ * Write the NAR read from `nar` to `delta` as a sequence of chunks,
+ * each of which is either sent literally or, if its hash is in
+ * `baseChunks`, as a reference to a chunk of the base.
+ *
+ * @return The number of bytes that didn't have to be sent.
+ */
+uint64_t writeNarDelta(Source & nar, const StringSet & baseChunks, Sink & delta);
+
+/**
+ * Reconstruct the NAR written by `writeNarDelta()` from `delta` and
+ * the NAR of `base`, and write it to `nar`. The caller must verify the
+ * result, e.g. by passing it to `Store::addToStore()`.
+ */
+void readNarDelta(Store & store, const StorePath & base, Source & delta, Sink & nar);
+
+} // namespace nix
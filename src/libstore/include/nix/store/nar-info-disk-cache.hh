@@ -14,13 +14,19 @@ public:
 
     virtual ~NarInfoDiskCache() {}
 
-    virtual int createCache(const std::string & uri, const Path & storeDir, bool wantMassQuery, int priority) = 0;
+    virtual int createCache(
+        const std::string & uri,
+        const Path & storeDir,
+        bool wantMassQuery,
+        int priority,
+        bool shardedLayout = false) = 0;
 
     struct CacheInfo
     {
         int id;
         bool wantMassQuery;
         int priority;
+        bool shardedLayout = false;
     };
 
     virtual std::optional<CacheInfo> upToDateCacheExists(const std::string & uri) = 0;
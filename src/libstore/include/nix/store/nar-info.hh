@@ -65,11 +65,25 @@ struct NarInfo : ValidPathInfo, UnkeyedNarInfo
         return ValidPathInfo::makeFromCA(store, std::move(name), std::move(ca), narHash);
     }
 
-    NarInfo(const StoreDirConfig & store, const std::string & s, const std::string & whence);
+    NarInfo(const StoreDirConfig & store, std::string_view s, std::string_view whence);
 
     bool operator==(const NarInfo &) const = default;
 
     std::string to_string(const StoreDirConfig & store) const;
+
+    /**
+     * Encode the fields of a `.narinfo` file in a compact binary
+     * format that is cheaper to decode than the text format. This is
+     * meant for caches only; it may change between Nix versions.
+     */
+    std::string toBinary() const;
+
+    /**
+     * Decode the output of `toBinary()`.
+     *
+     * @throws Error if `data` is not a valid encoding.
+     */
+    static NarInfo fromBinary(std::string storeDir, std::string_view data);
 };
 
 } // namespace nix
@@ -229,6 +229,15 @@ static_assert(std::is_move_constructible_v<ValidPathInfo>);
 
 using ValidPathInfos = std::map<StorePath, ValidPathInfo>;
 
+/**
+ * Like `ValidPathInfo::checkSignatures()`, but checks the signatures
+ * of several path infos in parallel.
+ *
+ * @return The number of good signatures of each path info.
+ */
+std::vector<size_t> checkSignatures(
+    const StoreDirConfig & store, const std::vector<const ValidPathInfo *> & infos, const PublicKeys & publicKeys);
+
 } // namespace nix
 
 JSON_IMPL(nix::PathInfoJsonFormat)
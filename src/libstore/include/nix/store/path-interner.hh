@@ -0,0 +1,94 @@
+#pragma once
+///@file
+
+#include "nix/store/path.hh"
+
+#include <cstring>
+#include <deque>
+#include <optional>
+
+#include <boost/unordered/unordered_flat_map.hpp>
+
+namespace nix {
+
+/**
+ * A dense index of a store path in a `StorePathInterner`.
+ */
+typedef uint32_t StorePathId;
+
+/**
+ * Assigns consecutive `StorePathId`s to store paths, so that
+ * algorithms over large closures can use integer keys, flat hash maps
+ * and bit vectors internally instead of `StorePathSet`, and convert
+ * back to `StorePath` only at the API boundary.
+ *
+ * Lookups hash only the first bytes of the hash part, which are
+ * already uniformly distributed, and don't allocate.
+ */
+class StorePathInterner
+{
+    struct HashPartHash
+    {
+        size_t operator()(std::string_view baseName) const noexcept
+        {
+            size_t h;
+            std::memcpy(&h, baseName.data(), sizeof(h));
+            return h;
+        }
+    };
+
+    /**
+     * A deque, so that the keys of `ids` stay valid as it grows.
+     */
+    std::deque<StorePath> paths;
+
+    boost::unordered_flat_map<std::string_view, StorePathId, HashPartHash> ids;
+
+public:
+
+    /**
+     * Return the id of `path`, assigning it the next id if it doesn't
+     * have one yet.
+     *
+     * @return The id and whether it was newly assigned.
+     */
+    std::pair<StorePathId, bool> insert(const StorePath & path)
+    {
+        if (auto i = ids.find(path.to_string()); i != ids.end())
+            return {i->second, false};
+        /* The key points into our own copy of the path. */
+        StorePathId id = paths.size();
+        ids.emplace(paths.emplace_back(path).to_string(), id);
+        return {id, true};
+    }
+
+    std::optional<StorePathId> find(const StorePath & path) const
+    {
+        auto i = ids.find(path.to_string());
+        if (i == ids.end())
+            return std::nullopt;
+        return i->second;
+    }
+
+    bool contains(const StorePath & path) const
+    {
+        return ids.contains(path.to_string());
+    }
+
+    const StorePath & operator[](StorePathId id) const
+    {
+        return paths[id];
+    }
+
+    size_t size() const
+    {
+        return paths.size();
+    }
+
+    void reserve(size_t n)
+    {
+        ids.reserve(n);
+    }
+};
+
+} // namespace nix
@@ -12,6 +12,13 @@ namespace nix {
 
 StorePathSet scanForReferences(Sink & toTee, const Path & path, const StorePathSet & refs);
 
+/**
+ * Like the above, but without producing a NAR serialisation. This
+ * allows the files of `path` to be scanned in parallel, each with its
+ * own sink. File names and symlink targets are scanned as well.
+ */
+StorePathSet scanForReferences(const Path & path, const StorePathSet & refs);
+
 class PathRefScanSink : public RefScanSink
 {
     std::map<std::string, StorePath> backMap;
@@ -41,9 +48,11 @@ struct FileRefScanResult
  * Useful for cycle detection and detailed dependency analysis like `nix why-depends --precise`.
  *
  * The function walks the tree using the provided accessor and streams each file's
- * contents through a RefScanSink to detect hash references. For each file that
- * contains at least one reference, a callback is invoked with the file path and
- * the set of references found.
+ * contents through a RefScanSink to detect hash references. Files are scanned in
+ * parallel, so the accessor must be thread-safe. For each file that contains at
+ * least one reference, a callback is invoked with the file path and the set of
+ * references found. The callback is called from the calling thread, once the walk
+ * has finished, in the order of the walk.
  *
  * Note: This function only searches for the hash part of store paths (e.g.,
  * "dc04vv14dak1c1r48qa0m23vr9jy8sm0"), not the name part. A store path like
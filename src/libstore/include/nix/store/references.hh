@@ -2,22 +2,39 @@
 ///@file
 
 #include "nix/util/hash.hh"
+#include "nix/store/path.hh"
 
 namespace nix {
 
 class RefScanSink : public Sink
 {
-    StringSet hashes;
+    static constexpr size_t refLength = StorePath::HashLen;
+
+    /**
+     * The hashes to look for, with an open-addressing table of indices
+     * into it keyed by their first bytes, so that looking up a
+     * candidate doesn't allocate.
+     */
+    std::vector<std::array<char, refLength>> hashes;
+    std::vector<bool> found;
+    std::vector<uint32_t> table;
+    int tableShift;
+
     StringSet seen;
 
     std::string tail;
 
+    /**
+     * Scratch space for the bitmap of which bytes are base-32
+     * characters.
+     */
+    std::vector<uint64_t> bitmap;
+
+    void search(std::string_view s);
+
 public:
 
-    RefScanSink(StringSet && hashes)
-        : hashes(hashes)
-    {
-    }
+    RefScanSink(StringSet && hashes);
 
     StringSet & getResult()
     {
@@ -27,6 +44,12 @@ public:
     void operator()(std::string_view data) override;
 };
 
+/**
+ * A sink that replaces occurrences of the keys of `rewrites` by their
+ * values, which must have the same length. All rewrites are applied in
+ * a single pass: the longest key that occurs at a position wins, and
+ * the replacement isn't searched again.
+ */
 struct RewritingSink : Sink
 {
     const StringMap rewrites;
@@ -43,6 +66,53 @@ struct RewritingSink : Sink
     void operator()(std::string_view data) override;
 
     void flush();
+
+private:
+
+    /**
+     * The non-trivial rewrites, with an open-addressing table of
+     * indices into it keyed by the first (up to) 8 bytes of the keys,
+     * as selected by `keyMask`.
+     */
+    std::vector<std::pair<std::string, std::string>> patterns;
+
+    struct Slot
+    {
+        uint64_t key;
+        uint32_t index;
+    };
+
+    std::vector<Slot> table;
+    int tableShift;
+
+    /**
+     * A bitmap of the hashes of the first 4 bytes of the keys, to
+     * reject most candidate positions before touching `table`.
+     */
+    std::vector<uint64_t> prefixFilter;
+
+    size_t minRewriteSize;
+    uint64_t keyMask;
+
+    /**
+     * Whether all keys are base-32 strings (such as the hash parts of
+     * store paths), in which case runs of base-32 characters are found
+     * with the same bitmap as `RefScanSink` before consulting
+     * `prefixFilter`.
+     */
+    bool nix32Patterns;
+
+    std::vector<uint64_t> bitmap;
+    std::string junction;
+
+    /**
+     * Pass `s[start, end)` to `nextSink`, rewriting the occurrences of
+     * keys that start in that range and lie in `s`.
+     *
+     * @return The offset in `s` up to which it was consumed, which may
+     * be past `end` if an occurrence starts before it.
+     */
+    size_t rewrite(std::string_view s, size_t start, size_t end);
 };
 
 struct HashModuloSink : AbstractHashSink
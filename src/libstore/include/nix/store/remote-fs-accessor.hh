@@ -25,6 +25,20 @@ class RemoteFSAccessor : public SourceAccessor
 
     ref<SourceAccessor> addToCache(std::string_view hashPart, std::string && nar);
 
+    /**
+     * Write the listing of a NAR to the cache, so that the NAR can
+     * later be accessed without indexing it again.
+     */
+    void writeListing(std::string_view hashPart, SourceAccessor & narAccessor);
+
+    /**
+     * If `store` is a binary cache that stores the NAR of `storePath`
+     * uncompressed or seekable (see `xz-seekable`) and has a listing
+     * of it (see `write-nar-listing`), return an accessor that fetches
+     * only the parts of the NAR that are read.
+     */
+    std::shared_ptr<SourceAccessor> accessRemotely(const StorePath & storePath);
+
 public:
 
     /**
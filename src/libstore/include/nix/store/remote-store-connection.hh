@@ -60,6 +60,12 @@ struct RemoteStore::ConnectionHandle
     void processStderr(Sink * sink = 0, Source * source = 0, bool flush = true, bool block = true);
 
     void withFramedSink(std::function<void(Sink & sink)> fun);
+
+    /**
+     * Like `withFramedSink()`, but compresses the data written to the
+     * sink if `WorkerProto::featureZstdNar` was negotiated.
+     */
+    void withFramedNarSink(std::function<void(Sink & sink)> fun);
 };
 
 } // namespace nix
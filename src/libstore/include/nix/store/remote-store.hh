@@ -10,6 +10,7 @@
 #include "nix/util/file-descriptor.hh"
 #include "nix/store/gc-store.hh"
 #include "nix/store/log-store.hh"
+#include "nix/store/worker-protocol.hh"
 
 namespace nix {
 
@@ -58,12 +59,24 @@ struct RemoteStore : public virtual Store, public virtual GcStore, public virtua
     void queryPathInfoUncached(
         const StorePath & path, Callback<std::shared_ptr<const ValidPathInfo>> callback) noexcept override;
 
+    std::map<StorePath, std::shared_ptr<const ValidPathInfo>>
+    queryMultiplePathInfosUncached(const StorePathSet & paths) override;
+
+    void computeFSClosure(
+        const StorePathSet & paths,
+        StorePathSet & out,
+        bool flipDirection = false,
+        bool includeOutputs = false,
+        bool includeDerivers = false) override;
+
     void queryReferrers(const StorePath & path, StorePathSet & referrers) override;
 
     StorePathSet queryValidDerivers(const StorePath & path) override;
 
     StorePathSet queryDerivationOutputs(const StorePath & path) override;
 
+    std::map<StorePath, DrvHash> queryDerivationHashesModulo(const StorePathSet & drvPaths) override;
+
     std::map<std::string, std::optional<StorePath>>
     queryPartialDerivationOutputMap(const StorePath & path, Store * evalStore = nullptr) override;
     std::optional<StorePath> queryPathFromHashPart(const std::string & hashPart) override;
@@ -107,6 +120,9 @@ struct RemoteStore : public virtual Store, public virtual GcStore, public virtua
     void queryRealisationUncached(
         const DrvOutput &, Callback<std::shared_ptr<const UnkeyedRealisation>> callback) noexcept override;
 
+    std::map<DrvOutput, std::shared_ptr<const UnkeyedRealisation>>
+    queryRealisationsUncached(const std::set<DrvOutput> & outputs) override;
+
     void
     buildPaths(const std::vector<DerivedPath> & paths, BuildMode buildMode, std::shared_ptr<Store> evalStore) override;
 
@@ -119,6 +135,8 @@ struct RemoteStore : public virtual Store, public virtual GcStore, public virtua
 
     void addTempRoot(const StorePath & path) override;
 
+    void addTempRoots(const StorePathSet & paths) override;
+
     Roots findRoots(bool censor) override;
 
     void collectGarbage(const GCOptions & options, GCResults & results) override;
@@ -156,6 +174,8 @@ struct RemoteStore : public virtual Store, public virtual GcStore, public virtua
 
     void flushBadConnections();
 
+    bool prepareForFork() override;
+
     /**
      * Shutdown all connections (both idle and in-use) to break any blocking I/O.
      * This is called on interrupt to allow graceful termination when the client
@@ -173,6 +193,14 @@ protected:
 
     void initConnection(Connection & conn);
 
+    /**
+     * The protocol features to offer to the daemon. By default, this
+     * is everything except `WorkerProto::featureZstdNar` and
+     * `WorkerProto::featureNarDelta`, since they don't pay off over a
+     * local socket.
+     */
+    virtual WorkerProto::FeatureSet getSupportedFeatures();
+
     ref<Pool<Connection>> connections;
 
     virtual void setOptions(Connection & conn);
@@ -93,6 +93,38 @@ struct S3BinaryCacheStoreConfig : HttpBinaryCacheStoreConfig
           Default is 100 MiB. Only takes effect when multipart-upload is enabled.
         )"};
 
+    const Setting<unsigned int> multipartUploadConcurrency{
+        this,
+        4,
+        "multipart-upload-concurrency",
+        R"(
+          The number of parts of a multipart upload that are uploaded at
+          the same time. Each part in flight is buffered in memory, so
+          this uses up to this many times `multipart-chunk-size` bytes.
+          A part that fails is retried on its own, without restarting
+          the upload.
+        )"};
+
+    const Setting<uint64_t> downloadPartSize{
+        this,
+        64 * 1024 * 1024,
+        "download-part-size",
+        R"(
+          The size (in bytes) of the ranges in which NARs larger than
+          this are downloaded. The ranges are fetched concurrently and
+          written out in order, and a range that fails is retried on its
+          own. Set to 0 to download NARs with a single request.
+        )"};
+
+    const Setting<unsigned int> downloadConcurrency{
+        this,
+        4,
+        "download-concurrency",
+        R"(
+          The number of ranges of a NAR that are downloaded at the same
+          time. See `download-part-size`.
+        )"};
+
     const Setting<std::optional<std::string>> storageClass{
         this,
         std::nullopt,
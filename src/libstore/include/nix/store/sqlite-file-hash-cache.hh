@@ -0,0 +1,13 @@
+#pragma once
+///@file
+
+#include "nix/util/file-hash-cache.hh"
+
+namespace nix {
+
+/**
+ * Open the file hash cache in `~/.cache/nix`.
+ */
+ref<FileHashCache> openSQLiteFileHashCache();
+
+} // namespace nix
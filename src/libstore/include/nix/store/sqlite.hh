@@ -3,6 +3,7 @@
 
 #include <filesystem>
 #include <functional>
+#include <memory>
 #include <string>
 
 #include "nix/util/error.hh"
@@ -33,6 +34,39 @@ enum class SQLiteOpenMode {
     Immutable,
 };
 
+/**
+ * Performance settings for a database connection. Fields left at their
+ * defaults keep SQLite's own defaults.
+ */
+struct SQLiteTuning
+{
+    /**
+     * The maximum number of bytes to access through memory-mapped I/O
+     * (`pragma mmap_size`).
+     */
+    uint64_t mmapSize = 0;
+
+    /**
+     * The size of the page cache in KiB (`pragma cache_size`).
+     */
+    uint64_t cacheSize = 0;
+
+    /**
+     * The number of pages the WAL may grow to before it is
+     * checkpointed (`pragma wal_autocheckpoint`).
+     */
+    unsigned int walAutoCheckpoint = 0;
+
+    /**
+     * Do the checkpoints from a background thread with its own
+     * connection, rather than in the commit that makes the WAL cross
+     * `walAutoCheckpoint`.
+     */
+    bool backgroundCheckpoint = false;
+};
+
+struct SQLiteCheckpointer;
+
 /**
  * RAII wrapper to close a SQLite database automatically.
  */
@@ -46,13 +80,7 @@ struct SQLite
     SQLite(const SQLite & from) = delete;
     SQLite & operator=(const SQLite & from) = delete;
 
-    // NOTE: This is noexcept since we are only copying and assigning raw pointers.
-    SQLite & operator=(SQLite && from) noexcept
-    {
-        db = from.db;
-        from.db = 0;
-        return *this;
-    }
+    SQLite & operator=(SQLite && from) noexcept;
 
     ~SQLite();
 
@@ -66,9 +94,18 @@ struct SQLite
      */
     void isCache();
 
+    /**
+     * Apply `tuning` to this connection.
+     */
+    void tune(const SQLiteTuning & tuning);
+
     void exec(const std::string & stmt);
 
     uint64_t getLastInsertedRowId();
+
+private:
+
+    std::unique_ptr<SQLiteCheckpointer> checkpointer;
 };
 
 /**
@@ -132,6 +169,13 @@ struct SQLiteStmt
         bool next();
 
         std::string getStr(int col);
+
+        /**
+         * The contents of a blob column. Only valid until the next
+         * call to `next()`.
+         */
+        std::string_view getBlob(int col);
+
         int64_t getInt(int col);
         bool isNull(int col);
     };
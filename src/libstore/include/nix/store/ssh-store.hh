@@ -20,6 +20,30 @@ struct SSHStoreConfig : std::enable_shared_from_this<SSHStoreConfig>,
     const Setting<Strings> remoteProgram{
         this, {"nix-daemon"}, "remote-program", "Path to the `nix-daemon` executable on the remote machine."};
 
+    const Setting<bool> compressNars{
+        this,
+        false,
+        "compress-nars",
+        R"(
+          Compress NARs sent to and received from the remote machine with zstd, if its
+          Nix daemon supports this. Unlike `compress`, this
+          only compresses the NARs and not the rest of the protocol.
+        )"};
+
+    const Setting<bool> deltaTransfer{
+        this,
+        false,
+        "delta-transfer",
+        R"(
+          When copying a large store object to the remote machine, send it as a delta
+          against a previous version of the same package that the remote
+          machine already has, if its Nix daemon supports this. The
+          previous version is chosen by package name and version. Only
+          the content-defined chunks of the NAR that the previous version
+          doesn't have are sent, and the remote machine verifies the
+          reconstructed NAR against its hash.
+        )"};
+
     static const std::string name()
     {
         return "Experimental SSH Store";
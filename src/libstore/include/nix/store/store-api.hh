@@ -6,7 +6,7 @@
 #include "nix/util/hash.hh"
 #include "nix/store/content-address.hh"
 #include "nix/util/serialise.hh"
-#include "nix/util/lru-cache.hh"
+#include "nix/util/sharded-cache.hh"
 #include "nix/util/sync.hh"
 #include "nix/util/configuration.hh"
 #include "nix/store/path-info.hh"
@@ -38,6 +38,7 @@ struct DrvOutput;
 
 struct BasicDerivation;
 struct Derivation;
+struct DrvHash;
 
 struct SourceAccessor;
 class NarInfoDiskCache;
@@ -177,6 +178,26 @@ struct StoreConfig : public StoreConfigBase, public StoreDirConfig
     Setting<int> pathInfoCacheSize{
         this, 65536, "path-info-cache-size", "Size of the in-memory store path metadata cache."};
 
+    Setting<int> pathInfoNegativeCacheSize{
+        this,
+        65536,
+        "path-info-negative-cache-size",
+        R"(
+          Size of the in-memory cache of store paths that were found not to
+          exist in this store. Entries expire after
+          [`narinfo-cache-negative-ttl`](@docroot@/command-ref/conf-file.md#conf-narinfo-cache-negative-ttl)
+          seconds.
+        )"};
+
+    Setting<int> derivationCacheSize{
+        this,
+        8192,
+        "derivation-cache-size",
+        R"(
+          Number of parsed store derivations to keep in memory, so that reading
+          the same `.drv` file again doesn't require reading and parsing it.
+        )"};
+
     Setting<bool> isTrusted{
         this,
         false,
@@ -308,9 +329,36 @@ protected:
 
     void invalidatePathInfoCacheFor(const StorePath & path);
 
-    // Note: this is a `ref` to avoid false sharing with immutable
+    /**
+     * Record the result of a path info lookup in the in-memory
+     * caches. A null `info` means that the path doesn't exist.
+     */
+    void cachePathInfo(const StorePath & path, std::shared_ptr<const ValidPathInfo> info);
+
+    /**
+     * Look up `path` in the in-memory caches, counting the hit.
+     *
+     * @returns std::nullopt if the path isn't cached or the entry has
+     * expired.
+     */
+    std::optional<PathInfoCacheValue> lookupPathInfoCache(const StorePath & path);
+
+    // Note: these are `ref`s to avoid false sharing with immutable
     // bits of `Store`.
-    ref<SharedSync<LRUCache<StorePath, PathInfoCacheValue>>> pathInfoCache;
+    ref<ShardedCache<StorePath, PathInfoCacheValue>> pathInfoCache;
+
+    /**
+     * Paths that don't exist. Kept separately so that a burst of
+     * failed lookups (e.g. when querying substituters) doesn't evict
+     * the positive entries.
+     */
+    ref<ShardedCache<StorePath, PathInfoCacheValue>> negativePathInfoCache;
+
+    /**
+     * Parsed store derivations. The contents of a store derivation are
+     * determined by its path, so entries never become stale.
+     */
+    ref<ShardedCache<StorePath, std::shared_ptr<const Derivation>>> derivationCache;
 
     std::shared_ptr<NarInfoDiskCache> diskCache;
 
@@ -386,6 +434,14 @@ public:
      */
     void queryPathInfo(const StorePath & path, Callback<ref<const ValidPathInfo>> callback) noexcept;
 
+    /**
+     * Query information about several paths at once. Paths that are
+     * not valid are omitted from the result. This goes through the
+     * same caches as queryPathInfo(), but lets stores answer all
+     * uncached paths with a single request.
+     */
+    std::map<StorePath, ref<const ValidPathInfo>> queryMultiplePathInfos(const StorePathSet & paths);
+
     /**
      * Version of queryPathInfo() that only queries the local narinfo cache and not
      * the actual store.
@@ -406,6 +462,15 @@ public:
      */
     void queryRealisation(const DrvOutput &, Callback<std::shared_ptr<const UnkeyedRealisation>> callback) noexcept;
 
+    /**
+     * Query several realisations at once. Outputs that have no
+     * realisation are omitted from the result. Like
+     * queryMultiplePathInfos(), this goes through the disk cache and
+     * lets stores answer all uncached outputs with a single request.
+     */
+    std::map<DrvOutput, std::shared_ptr<const UnkeyedRealisation>>
+    queryRealisations(const std::set<DrvOutput> & outputs);
+
     /**
      * Check whether the given valid path info is sufficiently attested, by
      * either being signed by a trusted public key or content-addressed, in
@@ -417,6 +482,14 @@ public:
      * we don't really want to add the dependencies listed in a nar info we
      * don't trust anyyways.
      */
+    /**
+     * Check the signatures of paths that are about to be added with
+     * `CheckSigs`, so that the checks of the individual paths are
+     * cheap. This is only an optimisation, so the default does
+     * nothing.
+     */
+    virtual void precheckSignatures(const std::vector<const ValidPathInfo *> & infos) {}
+
     virtual bool pathInfoIsUntrusted(const ValidPathInfo &)
     {
         return true;
@@ -431,9 +504,28 @@ protected:
 
     virtual void
     queryPathInfoUncached(const StorePath & path, Callback<std::shared_ptr<const ValidPathInfo>> callback) noexcept = 0;
+
+    /**
+     * Batched version of queryPathInfoUncached(). Paths that are not
+     * valid may be omitted or mapped to `nullptr`. The default
+     * implementation issues all queryPathInfoUncached() calls at once
+     * and waits for them to finish.
+     */
+    virtual std::map<StorePath, std::shared_ptr<const ValidPathInfo>>
+    queryMultiplePathInfosUncached(const StorePathSet & paths);
+
     virtual void queryRealisationUncached(
         const DrvOutput &, Callback<std::shared_ptr<const UnkeyedRealisation>> callback) noexcept = 0;
 
+    /**
+     * Batched version of queryRealisationUncached(). Outputs without
+     * a realisation may be omitted or mapped to `nullptr`. The default
+     * implementation issues all queryRealisationUncached() calls at
+     * once and waits for them to finish.
+     */
+    virtual std::map<DrvOutput, std::shared_ptr<const UnkeyedRealisation>>
+    queryRealisationsUncached(const std::set<DrvOutput> & outputs);
+
 public:
 
     /**
@@ -590,6 +682,37 @@ public:
         const StorePathSet & references = StorePathSet(),
         RepairFlag repair = NoRepair) = 0;
 
+    /**
+     * A dump to add with `addMultipleToStoreFromDump()`. The fields
+     * are the arguments of `addToStoreFromDump()`.
+     */
+    struct DumpToAdd
+    {
+        std::string name;
+        std::string dump;
+        FileSerialisationMethod dumpMethod = FileSerialisationMethod::NixArchive;
+        ContentAddressMethod hashMethod = ContentAddressMethod::Raw::NixArchive;
+        HashAlgorithm hashAlgo = HashAlgorithm::SHA256;
+        StorePathSet references;
+    };
+
+    /**
+     * Like `addToStoreFromDump()` for many small dumps held in memory.
+     * The store paths are computed locally and the dumps are added
+     * with a single `addMultipleToStore()` call, i.e. a single daemon
+     * operation, which local stores register in batches, with one
+     * transaction and one file system sync per batch.
+     *
+     * Dumps whose `dumpMethod` doesn't match their `hashMethod` need
+     * to be restored to be hashed, and are added one at a time with
+     * `addToStoreFromDump()` after the others.
+     *
+     * Dumps may refer to the paths of earlier dumps.
+     *
+     * @return The resulting paths, in the order of `dumps`.
+     */
+    std::vector<StorePath> addMultipleToStoreFromDump(std::vector<DumpToAdd> && dumps, RepairFlag repair = NoRepair);
+
     /**
      * Add a mapping indicating that `deriver!outputName` maps to the output path
      * `output`.
@@ -691,6 +814,17 @@ public:
         debug("not creating temporary root, store doesn't support GC");
     }
 
+    /**
+     * Add several temporary roots at once. Stores override this to
+     * register them with fewer round trips than calling
+     * `addTempRoot()` for each path.
+     */
+    virtual void addTempRoots(const StorePathSet & paths)
+    {
+        for (auto & path : paths)
+            addTempRoot(path);
+    }
+
     /**
      * @return a string representing information about the path that
      * can be loaded into the database using `nix-store --load-db` or
@@ -793,6 +927,24 @@ public:
      */
     virtual Derivation readInvalidDerivation(const StorePath & drvPath);
 
+    /**
+     * Return the hashes modulo (see `hashDerivationModulo()`) of those
+     * of the given valid derivations for which this store can provide
+     * them without the caller reading the derivations. Derivations
+     * that the store knows nothing about are omitted.
+     */
+    virtual std::map<StorePath, DrvHash> queryDerivationHashesModulo(const StorePathSet & drvPaths);
+
+private:
+
+    /**
+     * Read and parse a derivation, or return it from
+     * `derivationCache`.
+     */
+    Derivation readDerivationCommon(const StorePath & drvPath, bool requireValidPath);
+
+public:
+
     /**
      * @param [out] out Place in here the set of all store paths in the
      * file system closure of `storePath`; that is, all paths than can
@@ -817,6 +969,30 @@ public:
         bool includeOutputs = false,
         bool includeDerivers = false);
 
+    struct ClosureSize
+    {
+        /**
+         * The sum of the NAR sizes of the store objects.
+         */
+        uint64_t narSize = 0;
+
+        /**
+         * The sum of the compressed NAR sizes (`NarInfo::fileSize`),
+         * if every store object has a `.narinfo`.
+         */
+        std::optional<uint64_t> downloadSize;
+    };
+
+    /**
+     * Compute the total size of the closure of `paths`. The default
+     * implementation computes the closure with `computeFSClosure()`
+     * and then queries the path infos of the closure in one batch,
+     * which are usually cached by then.
+     *
+     * @param [out] closure If not null, the closure is added to it.
+     */
+    virtual ClosureSize queryClosureSize(const StorePathSet & paths, StorePathSet * closure = nullptr);
+
     /**
      * Given a set of paths that are to be built, return the set of
      * derivations that will be built, and the set of output paths that
@@ -837,6 +1013,9 @@ public:
         std::atomic<uint64_t> narInfoMissing{0};
         std::atomic<uint64_t> narInfoWrite{0};
         std::atomic<uint64_t> pathInfoCacheSize{0};
+        std::atomic<uint64_t> pathInfoCacheHits{0};
+        std::atomic<uint64_t> pathInfoNegativeCacheSize{0};
+        std::atomic<uint64_t> pathInfoNegativeCacheHits{0};
         std::atomic<uint64_t> narRead{0};
         std::atomic<uint64_t> narReadBytes{0};
         std::atomic<uint64_t> narReadCompressedBytes{0};
@@ -868,7 +1047,8 @@ public:
      */
     void clearPathInfoCache()
     {
-        pathInfoCache->lock()->clear();
+        pathInfoCache->clear();
+        negativePathInfoCache->clear();
     }
 
     /**
@@ -877,6 +1057,20 @@ public:
      */
     virtual void connect() {};
 
+    /**
+     * Prepare for a `fork()` after which both the parent and the child
+     * process use this store, e.g. by closing idle connections that
+     * would otherwise be shared by the two processes.
+     *
+     * @return Whether the child may use this store. Stores that hold
+     * state that can't be shared, such as an open SQLite database,
+     * return false.
+     */
+    virtual bool prepareForFork()
+    {
+        return false;
+    }
+
     /**
      * Get the protocol version of this store or it's connection.
      */
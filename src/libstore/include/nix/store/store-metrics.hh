@@ -0,0 +1,153 @@
+#pragma once
+///@file
+
+#include "nix/store/store-api.hh"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+
+namespace nix {
+
+/**
+ * A latency histogram with fixed buckets, which can live in memory
+ * shared between processes.
+ */
+struct LatencyHistogram
+{
+    /**
+     * The upper bounds of the buckets, in microseconds. There is an
+     * additional bucket for larger values.
+     */
+    static constexpr std::array<uint64_t, 14> bounds{
+        500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000, 5000000, 30000000, 300000000};
+
+    /**
+     * The number of observations in each bucket (not cumulative).
+     */
+    std::array<std::atomic<uint64_t>, bounds.size() + 1> buckets{};
+
+    std::atomic<uint64_t> sumUs{0};
+
+    void observe(std::chrono::microseconds duration);
+
+    uint64_t count() const;
+};
+
+/**
+ * Metrics about the operation of the daemon and the stores and build
+ * workers it runs. Daemon workers are separate processes, so this
+ * struct consists of atomics only, placed in memory that is shared
+ * with every process forked after `enableStoreMetrics()`.
+ */
+struct StoreMetrics
+{
+    /**
+     * One more than the highest `WorkerProto::Op` we keep latencies
+     * for.
+     */
+    static constexpr size_t maxOps = 64;
+
+    std::atomic<uint64_t> connections{0};
+    std::atomic<int64_t> connectionsActive{0};
+
+    /**
+     * The latency of each worker protocol operation, indexed by op
+     * code.
+     */
+    std::array<LatencyHistogram, maxOps> opLatency{};
+
+    std::array<std::atomic<uint64_t>, maxOps> opErrors{};
+
+    /**
+     * The number of times a SQLite transaction found the database
+     * busy and had to be retried.
+     */
+    std::atomic<uint64_t> sqliteBusy{0};
+
+    /**
+     * The number of SQLite statements that had to wait for a lock,
+     * and the total time spent waiting, including the sleeps between
+     * retries of busy transactions.
+     */
+    std::atomic<uint64_t> sqliteBusyWaits{0};
+    std::atomic<uint64_t> sqliteBusyWaitUs{0};
+
+    /**
+     * How long background WAL checkpoints took.
+     */
+    LatencyHistogram sqliteCheckpoint;
+
+    /**
+     * The number of output and store path locks acquired, and how
+     * many of them were held by someone else at first.
+     */
+    std::atomic<uint64_t> pathLocksAcquired{0};
+    std::atomic<uint64_t> pathLocksContended{0};
+
+    /**
+     * How long contended path locks took to acquire.
+     */
+    LatencyHistogram pathLockWait;
+
+    std::atomic<int64_t> gcRunning{0};
+    std::atomic<uint64_t> gcRuns{0};
+    std::atomic<uint64_t> gcPathsDeleted{0};
+    std::atomic<uint64_t> gcBytesFreed{0};
+
+    /**
+     * Store paths queued for optimisation by `auto-optimise-store`,
+     * how many of them are still waiting or being optimised, and what
+     * optimising them achieved.
+     */
+    std::atomic<uint64_t> optimiseQueued{0};
+    std::atomic<int64_t> optimiseBacklog{0};
+    std::atomic<uint64_t> optimiseFilesLinked{0};
+    std::atomic<uint64_t> optimiseBytesFreed{0};
+
+    std::atomic<int64_t> buildsRunning{0};
+    std::atomic<int64_t> substitutionsRunning{0};
+
+    /**
+     * The number of goals waiting for a free build slot.
+     */
+    std::atomic<int64_t> goalsWaiting{0};
+
+    /**
+     * The sum of the `Store::Stats` of all daemon workers' stores.
+     */
+    Store::Stats storeStats;
+};
+
+/**
+ * @return The metrics of this process, or nullptr if
+ * `enableStoreMetrics()` hasn't been called.
+ */
+StoreMetrics * getStoreMetrics();
+
+/**
+ * Start collecting metrics. The metrics are shared with child
+ * processes forked after this call, so that a daemon can report the
+ * metrics of all its workers.
+ */
+void enableStoreMetrics();
+
+/**
+ * Adds the changes in the `Store::Stats` of a store since the last
+ * call to the metrics.
+ */
+struct StoreStatsReporter
+{
+    void report(Store & store);
+
+private:
+    std::vector<uint64_t> reported;
+};
+
+/**
+ * Render `metrics` in the OpenMetrics text format, which Prometheus
+ * can scrape.
+ */
+std::string renderOpenMetrics(const StoreMetrics & metrics);
+
+} // namespace nix
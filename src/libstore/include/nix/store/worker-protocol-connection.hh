@@ -103,6 +103,11 @@ struct WorkerProto::BasicClientConnection : WorkerProto::BasicConnection
 
     void addTempRoot(const StoreDirConfig & remoteStore, bool * daemonException, const StorePath & path);
 
+    /**
+     * Requires `WorkerProto::featureAddTempRoots`.
+     */
+    void addTempRoots(const StoreDirConfig & remoteStore, bool * daemonException, const StorePathSet & paths);
+
     StorePathSet queryValidPaths(
         const StoreDirConfig & remoteStore,
         bool * daemonException,
@@ -112,6 +117,60 @@ struct WorkerProto::BasicClientConnection : WorkerProto::BasicConnection
     std::optional<UnkeyedValidPathInfo>
     queryPathInfo(const StoreDirConfig & store, bool * daemonException, const StorePath & path);
 
+    /**
+     * Query the path infos of `paths` by pipelining `QueryPathInfo`
+     * requests, i.e. sending several of them before reading the
+     * responses. This works with any daemon version. Paths that are
+     * not valid are omitted from the result.
+     */
+    std::map<StorePath, UnkeyedValidPathInfo>
+    queryPathInfos(const StoreDirConfig & store, bool * daemonException, const StorePathSet & paths);
+
+    /**
+     * Read the response to a `QueryPathInfo` request.
+     */
+    std::optional<UnkeyedValidPathInfo> readPathInfoResponse(const StoreDirConfig & store, bool * daemonException);
+
+    /**
+     * Query the path infos of `paths` in a single request. Paths that
+     * are not valid are omitted from the result. Requires
+     * `WorkerProto::featureQueryMultiplePathInfos`.
+     */
+    std::map<StorePath, UnkeyedValidPathInfo>
+    queryMultiplePathInfos(const StoreDirConfig & store, bool * daemonException, const StorePathSet & paths);
+
+    /**
+     * Query the realisations of `outputs` in a single request. Outputs
+     * without a realisation are omitted from the result. Requires
+     * `WorkerProto::featureQueryRealisations`.
+     */
+    std::set<Realisation>
+    queryRealisations(const StoreDirConfig & store, bool * daemonException, const std::set<DrvOutput> & outputs);
+
+    /**
+     * Let the daemon compute the closure of `paths` (see
+     * `Store::computeFSClosure()`) and return the path infos of all
+     * paths in it. Requires `WorkerProto::featureQueryClosure`.
+     */
+    std::map<StorePath, UnkeyedValidPathInfo> queryClosure(
+        const StoreDirConfig & store,
+        bool * daemonException,
+        const StorePathSet & paths,
+        bool flipDirection,
+        bool includeOutputs,
+        bool includeDerivers);
+
+    std::map<StorePath, DrvHash> queryDerivationHashesModulo(
+        const StoreDirConfig & store, bool * daemonException, const StorePathSet & drvPaths);
+
+    /**
+     * Ask the daemon for a path that `path` can be sent as a delta
+     * against, and the hashes of its chunks (see `findDeltaBase()` and
+     * `getNarChunkHashes()`). Requires `WorkerProto::featureNarDelta`.
+     */
+    std::optional<std::pair<StorePath, StringSet>>
+    queryDeltaBase(const StoreDirConfig & store, bool * daemonException, const StorePath & path, uint64_t narSize);
+
     void putBuildDerivationRequest(
         const StoreDirConfig & store,
         bool * daemonException,
@@ -138,6 +138,45 @@ struct WorkerProto
     using FeatureSet = std::set<Feature, std::less<>>;
 
     static const FeatureSet allFeatures;
+
+    /**
+     * The daemon supports `Op::QueryMultiplePathInfos`.
+     */
+    static constexpr std::string_view featureQueryMultiplePathInfos = "query-multiple-path-infos";
+
+    /**
+     * The daemon supports `Op::QueryClosure`.
+     */
+    static constexpr std::string_view featureQueryClosure = "query-closure";
+
+    /**
+     * The daemon supports `Op::QueryDerivationHashesModulo`.
+     */
+    static constexpr std::string_view featureQueryDerivationHashesModulo = "query-derivation-hashes-modulo";
+
+    /**
+     * The NARs sent by `Op::NarFromPath`, `Op::AddToStoreNar` and
+     * `Op::AddMultipleToStore` are compressed with zstd and sent in
+     * frames. Clients only ask for this on slow connections.
+     */
+    static constexpr std::string_view featureZstdNar = "zstd-nar";
+
+    /**
+     * The daemon supports `Op::QueryDeltaBase` and
+     * `Op::AddToStoreNarDelta`. Clients only ask for this on slow
+     * connections.
+     */
+    static constexpr std::string_view featureNarDelta = "nar-delta";
+
+    /**
+     * The daemon supports `Op::AddTempRoots`.
+     */
+    static constexpr std::string_view featureAddTempRoots = "add-temp-roots";
+
+    /**
+     * The daemon supports `Op::QueryRealisations`.
+     */
+    static constexpr std::string_view featureQueryRealisations = "query-realisations";
 };
 
 enum struct WorkerProto::Op : uint64_t {
@@ -185,6 +224,13 @@ enum struct WorkerProto::Op : uint64_t {
     AddBuildLog = 45,
     BuildPathsWithResults = 46,
     AddPermRoot = 47,
+    QueryMultiplePathInfos = 48,
+    QueryClosure = 49,
+    QueryDerivationHashesModulo = 50,
+    QueryDeltaBase = 51,
+    AddToStoreNarDelta = 52,
+    AddTempRoots = 53,
+    QueryRealisations = 54,
 };
 
 struct WorkerProto::ClientHandshakeInfo
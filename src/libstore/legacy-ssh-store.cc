@@ -120,6 +120,15 @@ std::map<StorePath, UnkeyedValidPathInfo> LegacySSHStore::queryPathInfosUncached
     return infos;
 }
 
+std::map<StorePath, std::shared_ptr<const ValidPathInfo>>
+LegacySSHStore::queryMultiplePathInfosUncached(const StorePathSet & paths)
+{
+    std::map<StorePath, std::shared_ptr<const ValidPathInfo>> res;
+    for (auto & [path, info] : queryPathInfosUncached(paths))
+        res.insert_or_assign(path, std::make_shared<ValidPathInfo>(StorePath{path}, std::move(info)));
+    return res;
+}
+
 void LegacySSHStore::queryPathInfoUncached(
     const StorePath & path, Callback<std::shared_ptr<const ValidPathInfo>> callback) noexcept
 {
@@ -2,9 +2,18 @@
 #include "nix/store/globals.hh"
 #include "nix/store/nar-info-disk-cache.hh"
 #include "nix/util/signals.hh"
+#include "nix/util/nar-accessor.hh"
 #include "nix/store/store-registration.hh"
+#include "nix/util/sync.hh"
 
 #include <atomic>
+#include <mutex>
+
+#include <fcntl.h>
+
+#ifdef __linux__
+#  include <unistd.h>
+#endif
 
 namespace nix {
 
@@ -49,8 +58,82 @@ struct LocalBinaryCacheStore : virtual BinaryCacheStore
 
     void init() override;
 
+    using Store::addMultipleToStore;
+
+    void addMultipleToStore(
+        PathsSource && pathsToCopy, Activity & act, RepairFlag repair, CheckSigsFlag checkSigs) override;
+
 protected:
 
+    struct State
+    {
+        /**
+         * The number of `addMultipleToStore()` calls in progress.
+         */
+        unsigned int bulkUploads = 0;
+
+        /**
+         * Files written during bulk uploads that haven't been synced
+         * yet, as pairs of their path in the cache and the temporary
+         * file holding their contents, in the order they were
+         * written. Renaming them in this order makes a `.narinfo`
+         * visible only after its NAR and the `.narinfo` files of its
+         * references.
+         */
+        std::vector<std::pair<std::string, std::filesystem::path>> pending;
+
+        /**
+         * The latest temporary file for each path in `pending`, so
+         * that we can read our own writes.
+         */
+        std::map<std::string, std::filesystem::path> pendingByPath;
+
+        /**
+         * The number of `.narinfo` files in `pending`.
+         */
+        uint64_t pendingNarInfos = 0;
+    };
+
+    Sync<State> _state;
+
+    /**
+     * Serialises `flushPending()`.
+     */
+    std::mutex flushLock;
+
+    /**
+     * Sync the pending files and move them into place.
+     */
+    void flushPending();
+
+    std::optional<std::filesystem::path> pendingFile(const std::string & path)
+    {
+        auto state(_state.lock());
+        if (auto i = state->pendingByPath.find(path); i != state->pendingByPath.end())
+            return i->second;
+        return std::nullopt;
+    }
+
+    /**
+     * Call `f` on the file holding the current contents of `path`,
+     * which may be a pending temporary file. Since a flush may move
+     * that file into place in the meantime, `f` is retried on the
+     * final path if the temporary file has disappeared.
+     */
+    template<typename F>
+    auto withFile(const std::string & path, F && f)
+    {
+        if (auto tmp = pendingFile(path)) {
+            try {
+                return f(*tmp);
+            } catch (SysError & e) {
+                if (e.errNo != ENOENT)
+                    throw;
+            }
+        }
+        return f(std::filesystem::path{config->binaryCacheDir} / path);
+    }
+
     bool fileExists(const std::string & path) override;
 
     void upsertFile(
@@ -63,14 +146,57 @@ protected:
         tmp += fmt(".tmp.%d.%d", getpid(), ++counter);
         AutoDelete del(tmp, false);
         writeFile(tmp, source);
+
+        if (config->fsyncFiles) {
+            bool deferred = false, flush = false;
+            {
+                auto state(_state.lock());
+                if (state->bulkUploads) {
+                    /* Defer the sync and the rename to the next
+                       batch. */
+                    state->pending.emplace_back(path, tmp);
+                    state->pendingByPath.insert_or_assign(path, tmp);
+                    if (hasSuffix(path, ".narinfo"))
+                        flush = ++state->pendingNarInfos >= config->fsyncBatchSize.get();
+                    deferred = true;
+                }
+            }
+            if (deferred) {
+                del.cancel();
+                if (flush)
+                    flushPending();
+                return;
+            }
+            AutoCloseFD fd = toDescriptor(open(tmp.string().c_str(), O_RDONLY));
+            if (!fd)
+                throw SysError("opening file '%s'", tmp);
+            fd.fsync();
+        }
+
         std::filesystem::rename(tmp, path2);
         del.cancel();
+
+        if (config->fsyncFiles)
+            syncParent(path2.string());
     }
 
     void getFile(const std::string & path, Sink & sink) override
     {
         try {
-            readFile(config->binaryCacheDir + "/" + path, sink);
+            withFile(path, [&](const std::filesystem::path & file) { readFile(file.string(), sink); });
+        } catch (SysError & e) {
+            if (e.errNo == ENOENT)
+                throw NoSuchBinaryCacheFile("file '%s' does not exist in binary cache", path);
+            throw;
+        }
+    }
+
+    std::string getFileRange(const std::string & path, uint64_t offset, uint64_t length) override
+    {
+        try {
+            return withFile(path, [&](const std::filesystem::path & file) {
+                return seekableGetNarBytes(file.string())(offset, length);
+            });
         } catch (SysError & e) {
             if (e.errNo == ENOENT)
                 throw NoSuchBinaryCacheFile("file '%s' does not exist in binary cache", path);
@@ -82,13 +208,22 @@ protected:
     {
         StorePathSet paths;
 
-        for (auto & entry : DirectoryIterator{config->binaryCacheDir}) {
-            checkInterrupt();
-            auto name = entry.path().filename().string();
-            if (name.size() != 40 || !hasSuffix(name, ".narinfo"))
-                continue;
-            paths.insert(parseStorePath(storeDir + "/" + name.substr(0, name.size() - 8) + "-" + MissingName));
-        }
+        auto scan = [&](const std::filesystem::path & dir) {
+            for (auto & entry : DirectoryIterator{dir}) {
+                checkInterrupt();
+                auto name = entry.path().filename().string();
+                if (name.size() != 40 || !hasSuffix(name, ".narinfo"))
+                    continue;
+                paths.insert(parseStorePath(storeDir + "/" + name.substr(0, name.size() - 8) + "-" + MissingName));
+            }
+        };
+
+        if (config->shardedLayout) {
+            for (auto & entry : DirectoryIterator{config->binaryCacheDir})
+                if (entry.path().filename().string().size() == 2 && entry.is_directory())
+                    scan(entry.path());
+        } else
+            scan(config->binaryCacheDir);
 
         return paths;
     }
@@ -111,7 +246,82 @@ void LocalBinaryCacheStore::init()
 
 bool LocalBinaryCacheStore::fileExists(const std::string & path)
 {
-    return pathExists(config->binaryCacheDir + "/" + path);
+    auto tmp = pendingFile(path);
+    return (tmp && pathExists(tmp->string())) || pathExists(config->binaryCacheDir + "/" + path);
+}
+
+void LocalBinaryCacheStore::addMultipleToStore(
+    PathsSource && pathsToCopy, Activity & act, RepairFlag repair, CheckSigsFlag checkSigs)
+{
+    _state.lock()->bulkUploads++;
+
+    auto done = [&]() {
+        _state.lock()->bulkUploads--;
+        flushPending();
+    };
+
+    try {
+        Store::addMultipleToStore(std::move(pathsToCopy), act, repair, checkSigs);
+    } catch (...) {
+        /* Don't lose the paths that were added successfully. */
+        done();
+        throw;
+    }
+
+    done();
+}
+
+void LocalBinaryCacheStore::flushPending()
+{
+    std::lock_guard lock(flushLock);
+
+    /* Files may be added while we're syncing; they'll be picked up by
+       the next flush. */
+    auto files = _state.lock()->pending;
+    if (files.empty())
+        return;
+
+    debug("syncing %d files in binary cache '%s'", files.size(), config->binaryCacheDir);
+
+#ifdef __linux__
+    /* One sync of the file system holding the cache instead of one per
+       file. */
+    {
+        AutoCloseFD fd = openDirectory(config->binaryCacheDir);
+        if (!fd || syncfs(fd.get()) == -1)
+            throw SysError("syncing the file system of '%s'", config->binaryCacheDir);
+    }
+#else
+    for (auto & [_, tmp] : files) {
+        AutoCloseFD fd = toDescriptor(open(tmp.string().c_str(), O_RDONLY));
+        if (!fd)
+            throw SysError("opening file '%s'", tmp);
+        fd.fsync();
+    }
+#endif
+
+    std::set<std::filesystem::path> dirs;
+    for (auto & [path, tmp] : files) {
+        auto path2 = std::filesystem::path{config->binaryCacheDir} / path;
+        std::filesystem::rename(tmp, path2);
+        dirs.insert(path2.parent_path());
+    }
+
+    for (auto & dir : dirs) {
+        AutoCloseFD fd = openDirectory(dir);
+        if (!fd)
+            throw SysError("opening directory '%s'", dir);
+        fd.fsync();
+    }
+
+    auto state(_state.lock());
+    for (auto & [path, tmp] : files) {
+        if (auto i = state->pendingByPath.find(path); i != state->pendingByPath.end() && i->second == tmp)
+            state->pendingByPath.erase(i);
+        if (hasSuffix(path, ".narinfo"))
+            state->pendingNarInfos--;
+    }
+    state->pending.erase(state->pending.begin(), state->pending.begin() + files.size());
 }
 
 StringSet LocalBinaryCacheStoreConfig::uriSchemes()
@@ -7,6 +7,7 @@
 #include "nix/util/url.hh"
 #include "nix/store/store-open.hh"
 #include "nix/store/store-registration.hh"
+#include "nix/util/file-system.hh"
 
 namespace nix {
 
@@ -72,6 +73,86 @@ LocalOverlayStore::LocalOverlayStore(ref<const Config> config)
     }
 }
 
+struct LocalOverlayStore::LowerSnapshot
+{
+    /**
+     * The metadata of the lower store's database files when the
+     * snapshot was taken.
+     */
+    std::string stamp;
+
+    LocalStore::ReferenceGraph graph;
+
+    std::vector<std::vector<StorePathId>> referrers;
+};
+
+/**
+ * Describe the metadata of the database files of `store` that changes
+ * whenever the database does. With WAL, commits only touch the WAL
+ * file, and checkpoints touch both. Returns `std::nullopt` if a file
+ * was changed so recently that a further change might not be visible.
+ */
+static std::optional<std::string> describeDatabase(const LocalStore & store)
+{
+    StringSink sink;
+    auto now = time(nullptr);
+    for (auto suffix : {"", "-wal"}) {
+        auto st = maybeLstat(store.dbDir + "/db.sqlite" + suffix);
+        if (!st) {
+            sink << 0;
+            continue;
+        }
+        if (st->st_mtime >= now - 1 || st->st_ctime >= now - 1)
+            return std::nullopt;
+        sink << 1 << (uint64_t) st->st_dev << (uint64_t) st->st_ino << (uint64_t) st->st_size
+             << (uint64_t) st->st_mtime << (uint64_t) st->st_ctime;
+    }
+    return std::move(sink.s);
+}
+
+std::shared_ptr<const LocalOverlayStore::LowerSnapshot> LocalOverlayStore::getLowerSnapshot()
+{
+    if (!config->lowerStoreSnapshot)
+        return nullptr;
+
+    auto lower = dynamic_cast<LocalStore *>(&*lowerStore);
+    if (!lower)
+        return nullptr;
+
+    auto stamp = describeDatabase(*lower);
+    if (!stamp)
+        return nullptr;
+
+    auto lowerSnapshot(lowerSnapshot_.lock());
+    if (*lowerSnapshot && (*lowerSnapshot)->stamp == *stamp)
+        return *lowerSnapshot;
+
+    debug("loading a snapshot of the lower store '%s'", lowerStore->config.getHumanReadableURI());
+
+    auto snapshot = std::make_shared<LowerSnapshot>();
+    snapshot->stamp = std::move(*stamp);
+    snapshot->graph = lower->queryReferenceGraph();
+    snapshot->referrers.resize(snapshot->graph.paths.size());
+    for (StorePathId id = 0; id < snapshot->graph.references.size(); ++id)
+        for (auto ref : snapshot->graph.references[id])
+            snapshot->referrers[ref].push_back(id);
+
+    /* If the database changed while we were reading it, the snapshot
+       may be inconsistent with the new stamp, so don't keep it. */
+    if (describeDatabase(*lower) != snapshot->stamp)
+        return nullptr;
+
+    *lowerSnapshot = snapshot;
+    return snapshot;
+}
+
+bool LocalOverlayStore::isValidInLower(const StorePath & path)
+{
+    if (auto snapshot = getLowerSnapshot())
+        return snapshot->graph.paths.contains(path);
+    return lowerStore->isValidPath(path);
+}
+
 void LocalOverlayStore::registerDrvOutput(const Realisation & info)
 {
     // First do queryRealisation on lower layer to populate DB
@@ -97,6 +178,12 @@ void LocalOverlayStore::queryPathInfoUncached(
                 return callbackPtr->rethrow();
             }
             // If we don't have it, check lower store
+            try {
+                if (auto snapshot = getLowerSnapshot(); snapshot && !snapshot->graph.paths.contains(path))
+                    return (*callbackPtr)(nullptr);
+            } catch (...) {
+                return callbackPtr->rethrow();
+            }
             lowerStore->queryPathInfo(path, {[path, callbackPtr](std::future<ref<const ValidPathInfo>> fut) {
                                           try {
                                               (*callbackPtr)(fut.get().get_ptr());
@@ -133,12 +220,29 @@ void LocalOverlayStore::queryRealisationUncached(
         }});
 }
 
+std::map<DrvOutput, std::shared_ptr<const UnkeyedRealisation>>
+LocalOverlayStore::queryRealisationsUncached(const std::set<DrvOutput> & outputs)
+{
+    auto res = LocalStore::queryRealisationsUncached(outputs);
+
+    std::set<DrvOutput> missing;
+    for (auto & id : outputs)
+        if (!res.contains(id))
+            missing.insert(id);
+
+    if (!missing.empty())
+        for (auto & [id, info] : lowerStore->queryRealisations(missing))
+            res.insert_or_assign(id, std::move(info));
+
+    return res;
+}
+
 bool LocalOverlayStore::isValidPathUncached(const StorePath & path)
 {
     auto res = LocalStore::isValidPathUncached(path);
     if (res)
         return res;
-    res = lowerStore->isValidPath(path);
+    res = isValidInLower(path);
     if (res) {
         // Get path info from lower store so upper DB genuinely has it.
         auto p = lowerStore->queryPathInfo(path);
@@ -154,7 +258,18 @@ bool LocalOverlayStore::isValidPathUncached(const StorePath & path)
 void LocalOverlayStore::queryReferrers(const StorePath & path, StorePathSet & referrers)
 {
     LocalStore::queryReferrers(path, referrers);
-    lowerStore->queryReferrers(path, referrers);
+    if (auto snapshot = getLowerSnapshot()) {
+        if (auto id = snapshot->graph.paths.find(path))
+            for (auto referrer : snapshot->referrers[*id])
+                referrers.insert(snapshot->graph.paths[referrer]);
+    } else
+        lowerStore->queryReferrers(path, referrers);
+}
+
+void LocalOverlayStore::computeFSClosure(
+    const StorePathSet & paths, StorePathSet & out, bool flipDirection, bool includeOutputs, bool includeDerivers)
+{
+    Store::computeFSClosure(paths, out, flipDirection, includeOutputs, includeDerivers);
 }
 
 void LocalOverlayStore::queryGCReferrers(const StorePath & path, StorePathSet & referrers)
@@ -217,7 +332,7 @@ void LocalOverlayStore::deleteStorePath(const Path & path, uint64_t & bytesFreed
 
     if (pathExists(upperPath)) {
         debug("upper exists: %s", path);
-        if (lowerStore->isValidPath(storePath)) {
+        if (isValidInLower(storePath)) {
             debug("lower exists: %s", storePath.to_string());
             // Path also exists in lower store.
             // We must delete via upper layer to avoid creating a whiteout.
@@ -243,7 +358,7 @@ void LocalOverlayStore::optimiseStore()
     uint64_t done = 0;
 
     for (auto & path : paths) {
-        if (lowerStore->isValidPath(path)) {
+        if (isValidInLower(path)) {
             uint64_t bytesFreed = 0;
             // Deduplicate store path
             deleteStorePath(toRealPath(path), bytesFreed);
@@ -10,6 +10,7 @@
 #include "nix/store/references.hh"
 #include "nix/util/callback.hh"
 #include "nix/util/topo-sort.hh"
+#include "nix/util/thread-pool.hh"
 #include "nix/util/finally.hh"
 #include "nix/util/compression.hh"
 #include "nix/util/signals.hh"
@@ -26,6 +27,7 @@
 #include <cstring>
 
 #include <memory>
+#include <ranges>
 #include <new>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -110,15 +112,45 @@ struct LocalStore::State::Stmts
     SQLiteStmt QueryAllRealisedOutputs;
     SQLiteStmt QueryPathFromHashPart;
     SQLiteStmt QueryValidPaths;
+    SQLiteStmt QueryValidPathIds;
+    SQLiteStmt QueryPathsWithName;
+    SQLiteStmt QueryAllReferences;
+    SQLiteStmt QueryClosure;
+    SQLiteStmt AddReferences;
+    SQLiteStmt AddPathToResolve;
+    SQLiteStmt QueryResolvedPaths;
+    SQLiteStmt ClearPathsToResolve;
+    SQLiteStmt QueryOptimisedPaths;
+    SQLiteStmt MarkOptimised;
+    SQLiteStmt QueryVerifiedPaths;
+    SQLiteStmt MarkVerified;
+    SQLiteStmt ClearVerifiedPaths;
+    SQLiteStmt QueryBuildDuration;
+    SQLiteStmt RecordBuildDuration;
+    SQLiteStmt AddBuildStats;
+    SQLiteStmt QueryBuildStats;
+    SQLiteStmt QueryPeakMemory;
+    SQLiteStmt QueryDerivationHashes;
+    SQLiteStmt AddDerivationHashes;
+    SQLiteStmt QueryClosureSize;
+    SQLiteStmt AddClosureSize;
 };
 
+/**
+ * The number of rows added by a single execution of the
+ * `AddReferences` statement.
+ */
+static constexpr size_t addReferencesBatchSize = 100;
+
 LocalStore::LocalStore(ref<const Config> config)
     : Store{*config}
     , LocalFSStore{*config}
     , config{config}
     , _state(make_ref<Sync<State>>())
+    , readConnections(config->maxReadConnections, [this]() { return openReadConnection(); })
     , dbDir(config->stateDir + "/db")
     , linksDir(config->realStoreDir + "/.links")
+    , trashDir(config->realStoreDir + "/.gc-trash")
     , reservedPath(dbDir + "/reserved")
     , schemaPath(dbDir + "/schema")
     , tempRootsDir(config->stateDir + "/temproots")
@@ -336,24 +368,66 @@ LocalStore::LocalStore(ref<const Config> config)
     state->stmts->UpdatePathInfo.create(
         state->db, "update ValidPaths set narSize = ?, hash = ?, ultimate = ?, sigs = ?, ca = ? where path = ?;");
     state->stmts->AddReference.create(state->db, "insert or replace into Refs (referrer, reference) values (?, ?);");
-    state->stmts->QueryPathInfo.create(
-        state->db,
-        "select id, hash, registrationTime, deriver, narSize, ultimate, sigs, ca from ValidPaths where path = ?;");
-    state->stmts->QueryReferences.create(
-        state->db, "select path from Refs join ValidPaths on reference = id where referrer = ?;");
-    state->stmts->QueryReferrers.create(
-        state->db,
-        "select path from Refs join ValidPaths on referrer = id where reference = (select id from ValidPaths where path = ?);");
     state->stmts->InvalidatePath.create(state->db, "delete from ValidPaths where path = ?;");
     state->stmts->AddDerivationOutput.create(
         state->db, "insert or replace into DerivationOutputs (drv, id, path) values (?, ?, ?);");
-    state->stmts->QueryValidDerivers.create(
-        state->db, "select v.id, v.path from DerivationOutputs d join ValidPaths v on d.drv = v.id where d.path = ?;");
-    state->stmts->QueryDerivationOutputs.create(state->db, "select id, path from DerivationOutputs where drv = ?;");
-    // Use "path >= ?" with limit 1 rather than "path like '?%'" to
-    // ensure efficient lookup.
-    state->stmts->QueryPathFromHashPart.create(state->db, "select path from ValidPaths where path >= ? limit 1;");
-    state->stmts->QueryValidPaths.create(state->db, "select path from ValidPaths");
+    prepareQueryStmts(state->db, *state->stmts);
+    {
+        std::string sql = "insert or replace into Refs (referrer, reference) values (?, ?)";
+        for (size_t i = 1; i < addReferencesBatchSize; ++i)
+            sql += ", (?, ?)";
+        state->stmts->AddReferences.create(state->db, sql + ";");
+    }
+    /* A scratch table for looking up the IDs of many paths with a
+       single join. It's private to this connection. */
+    state->db.exec("create temp table if not exists PathsToResolve (path text primary key not null);");
+    state->stmts->AddPathToResolve.create(state->db, "insert or ignore into temp.PathsToResolve (path) values (?);");
+    state->stmts->QueryResolvedPaths.create(
+        state->db, "select ValidPaths.path, id from temp.PathsToResolve join ValidPaths using (path);");
+    state->stmts->ClearPathsToResolve.create(state->db, "delete from temp.PathsToResolve;");
+    if (!config->readOnly) {
+        state->stmts->QueryOptimisedPaths.create(
+            state->db, "select path from ValidPaths join OptimisedPaths on ValidPaths.id = OptimisedPaths.id;");
+        state->stmts->MarkOptimised.create(
+            state->db, "insert or ignore into OptimisedPaths (id) select id from ValidPaths where path = ?;");
+        state->stmts->QueryVerifiedPaths.create(
+            state->db, "select path from ValidPaths join VerifiedPaths on ValidPaths.id = VerifiedPaths.id;");
+        state->stmts->MarkVerified.create(
+            state->db, "insert or ignore into VerifiedPaths (id) select id from ValidPaths where path = ?;");
+        state->stmts->ClearVerifiedPaths.create(state->db, "delete from VerifiedPaths;");
+        state->stmts->QueryBuildDuration.create(state->db, "select duration from BuildDurations where name = ?;");
+        state->stmts->RecordBuildDuration.create(
+            state->db,
+            "insert into BuildDurations (name, duration) values (?, ?) "
+            "on conflict (name) do update set duration = (duration + excluded.duration) / 2;");
+        state->stmts->AddBuildStats.create(
+            state->db,
+            "insert into BuildStats (drvName, drvHash, machine, startTime, stopTime, cpuUser, cpuSystem, peakMemory, "
+            "outputSize) values (?, ?, ?, ?, ?, ?, ?, ?, ?);");
+        state->stmts->QueryBuildStats.create(
+            state->db,
+            "select drvName, drvHash, machine, startTime, stopTime, cpuUser, cpuSystem, peakMemory, outputSize "
+            "from BuildStats where drvName = ?1 or drvHash = ?1 order by id desc limit ?2;");
+        state->stmts->QueryPeakMemory.create(
+            state->db,
+            "select max(peakMemory) from "
+            "(select peakMemory from BuildStats where drvName = ? order by id desc limit 5);");
+        state->stmts->QueryDerivationHashes.create(
+            state->db,
+            "select kind, hashes from ValidPaths join DerivationHashes on ValidPaths.id = DerivationHashes.id "
+            "where path = ?;");
+        state->stmts->AddDerivationHashes.create(
+            state->db,
+            "insert or replace into DerivationHashes (id, kind, hashes) "
+            "select id, ?, ? from ValidPaths where path = ?;");
+        state->stmts->QueryClosureSize.create(
+            state->db,
+            "select closureSize from ValidPaths join ClosureSizes on ValidPaths.id = ClosureSizes.id "
+            "where path = ?;");
+        state->stmts->AddClosureSize.create(
+            state->db,
+            "insert or replace into ClosureSizes (id, closureSize) select id, ? from ValidPaths where path = ?;");
+    }
     if (experimentalFeatureSettings.isEnabled(Xp::CaDerivations)) {
         state->stmts->RegisterRealisedOutput.create(
             state->db,
@@ -391,6 +465,65 @@ LocalStore::LocalStore(ref<const Config> config)
     }
 }
 
+void LocalStore::prepareQueryStmts(SQLite & db, State::Stmts & stmts)
+{
+    stmts.QueryPathInfo.create(
+        db, "select id, hash, registrationTime, deriver, narSize, ultimate, sigs, ca from ValidPaths where path = ?;");
+    stmts.QueryReferences.create(db, "select path from Refs join ValidPaths on reference = id where referrer = ?;");
+    stmts.QueryReferrers.create(
+        db,
+        "select path from Refs join ValidPaths on referrer = id where reference = (select id from ValidPaths where path = ?);");
+    stmts.QueryValidDerivers.create(
+        db, "select v.id, v.path from DerivationOutputs d join ValidPaths v on d.drv = v.id where d.path = ?;");
+    stmts.QueryDerivationOutputs.create(db, "select id, path from DerivationOutputs where drv = ?;");
+    // Use "path >= ?" with limit 1 rather than "path like '?%'" to
+    // ensure efficient lookup.
+    stmts.QueryPathFromHashPart.create(db, "select path from ValidPaths where path >= ? limit 1;");
+    stmts.QueryValidPaths.create(db, "select path from ValidPaths");
+    stmts.QueryValidPathIds.create(db, "select id, path from ValidPaths");
+    stmts.QueryPathsWithName.create(db, "select path from ValidPaths where path glob ?");
+    stmts.QueryAllReferences.create(db, "select referrer, reference from Refs");
+    stmts.QueryClosure.create(
+        db,
+        R"(
+            with recursive closure(id) as (
+                select id from ValidPaths where path = ?
+                union
+                select reference from Refs join closure on referrer = closure.id
+            )
+            select path, narSize from ValidPaths join closure on ValidPaths.id = closure.id;
+        )");
+}
+
+ref<LocalStore::ReadConnection> LocalStore::openReadConnection()
+{
+    auto conn = make_ref<ReadConnection>();
+    conn->db = SQLite(
+        std::filesystem::path(dbDir) / "db.sqlite",
+        config->readOnly ? SQLiteOpenMode::Immutable : SQLiteOpenMode::NoCreate);
+    conn->db.exec("pragma query_only = 1");
+    conn->db.tune({
+        .mmapSize = config->dbMmapSize,
+        .cacheSize = config->dbPageCacheSize,
+    });
+    conn->stmts = std::make_unique<State::Stmts>();
+    prepareQueryStmts(conn->db, *conn->stmts);
+    return conn;
+}
+
+template<typename T, typename F>
+T LocalStore::withReadStmts(F && f)
+{
+    return retrySQLite<T>([&]() -> T {
+        /* Without WAL, readers block writers and vice versa, so
+           there's no point in having more connections. */
+        if (!settings.useSQLiteWAL || config->maxReadConnections == 0)
+            return f(*_state->lock()->stmts);
+        auto conn(readConnections.get());
+        return f(*conn->stmts);
+    });
+}
+
 AutoCloseFD LocalStore::openGCLock()
 {
     Path fnGCLock = config->stateDir + "/gc.lock";
@@ -412,6 +545,19 @@ void LocalStore::deleteStorePath(const Path & path, uint64_t & bytesFreed)
     deletePath(path, bytesFreed);
 }
 
+std::optional<Path> LocalStore::trashStorePath(const Path & path)
+{
+    createDirs(trashDir);
+    auto trashPath = trashDir + "/" + std::string(baseNameOf(path));
+    std::error_code ec;
+    std::filesystem::rename(path, trashPath, ec);
+    if (ec) {
+        debug("cannot move '%s' to the trash: %s", path, ec.message());
+        return std::nullopt;
+    }
+    return trashPath;
+}
+
 LocalStore::~LocalStore()
 {
     std::shared_future<void> future;
@@ -427,6 +573,14 @@ LocalStore::~LocalStore()
         future.get();
     }
 
+    {
+        auto queue(_optimiseQueue.lock());
+        if (!queue->paths.empty())
+            printInfo("waiting for %d store paths to be optimised on exit...", queue->paths.size());
+        while (queue->workers)
+            queue.wait(optimiseWorkerExited);
+    }
+
     try {
         auto fdTempRoots(_fdTempRoots.lock());
         if (*fdTempRoots) {
@@ -531,11 +685,15 @@ void LocalStore::openDB(State & state, bool create)
         }
     }
 
-    /* Increase the auto-checkpoint interval to 40000 pages.  This
-       seems enough to ensure that instantiating the NixOS system
-       derivation is done in a single fsync(). */
-    if (mode == "wal" && sqlite3_exec(db, "pragma wal_autocheckpoint = 40000;", 0, 0, 0) != SQLITE_OK)
-        SQLiteError::throw_(db, "setting autocheckpoint interval");
+    /* By default, increase the auto-checkpoint interval to 40000
+       pages.  This seems enough to ensure that instantiating the
+       NixOS system derivation is done in a single fsync(). */
+    db.tune({
+        .mmapSize = config->dbMmapSize,
+        .cacheSize = config->dbPageCacheSize,
+        .walAutoCheckpoint = mode == "wal" ? config->dbWalAutoCheckpoint.get() : 0,
+        .backgroundCheckpoint = mode == "wal" && config->dbBackgroundCheckpoint && !config->readOnly,
+    });
 
     /* Initialise the database schema, if necessary. */
     if (create) {
@@ -573,6 +731,95 @@ void LocalStore::upgradeDBSchema(State & state)
         schemaMigrations.insert(migrationName);
     };
 
+    /* Replace the index on `Refs(referrer)`, which duplicates the
+       primary key, and make the one on `Refs(reference)` cover
+       referrer queries. Older versions of Nix can use the resulting
+       indexes just as well. */
+    if (!config->readOnly)
+        doUpgrade(
+            "20261014-refs-indexes",
+            "create index if not exists IndexReferenceReferrer on Refs(reference, referrer);\n"
+            "drop index if exists IndexReference;\n"
+            "drop index if exists IndexReferrer");
+
+    /* Record of the paths that `optimiseStore()` has processed. */
+    if (!config->readOnly)
+        doUpgrade(
+            "20261014-optimised-paths",
+            "create table if not exists OptimisedPaths (\n"
+            "    id integer primary key not null,\n"
+            "    foreign key (id) references ValidPaths(id) on delete cascade\n"
+            ")");
+
+    /* Progress of `verifyStore()`, so that it can resume after an
+       interruption. */
+    if (!config->readOnly)
+        doUpgrade(
+            "20261014-verified-paths",
+            "create table if not exists VerifiedPaths (\n"
+            "    id integer primary key not null,\n"
+            "    foreign key (id) references ValidPaths(id) on delete cascade\n"
+            ")");
+
+    /* How long derivations took to build, by name, for the build
+       scheduler. */
+    if (!config->readOnly)
+        doUpgrade(
+            "20261014-build-durations",
+            "create table if not exists BuildDurations (\n"
+            "    name text primary key not null,\n"
+            "    duration integer not null\n"
+            ")");
+
+    /* Per-build statistics. */
+    if (!config->readOnly)
+        doUpgrade(
+            "20261014-build-stats",
+            "create table if not exists BuildStats (\n"
+            "    id integer primary key autoincrement not null,\n"
+            "    drvName text not null,\n"
+            "    drvHash text not null,\n"
+            "    machine text not null,\n"
+            "    startTime integer not null,\n"
+            "    stopTime integer not null,\n"
+            "    cpuUser integer,\n"
+            "    cpuSystem integer,\n"
+            "    peakMemory integer,\n"
+            "    outputSize integer not null\n"
+            ");\n"
+            "create index if not exists IndexBuildStatsName on BuildStats(drvName);\n"
+            "create index if not exists IndexBuildStatsHash on BuildStats(drvHash)");
+
+    /* The results of `hashDerivationModulo()`, which are a function
+       of the derivation only. */
+    if (!config->readOnly)
+        doUpgrade(
+            "20261014-derivation-hashes",
+            "create table if not exists DerivationHashes (\n"
+            "    id integer primary key not null,\n"
+            "    kind integer not null,\n"
+            "    hashes text not null,\n"
+            "    foreign key (id) references ValidPaths(id) on delete cascade\n"
+            ")");
+
+    /* The NAR size of the closure of each path, as far as it has been
+       queried. The closure of a valid path can't change, since its
+       references must stay valid, so an entry only goes away with its
+       path, except when a NAR size is corrected. */
+    if (!config->readOnly)
+        doUpgrade(
+            "20261014-closure-sizes",
+            "create table if not exists ClosureSizes (\n"
+            "    id integer primary key not null,\n"
+            "    closureSize integer not null,\n"
+            "    foreign key (id) references ValidPaths(id) on delete cascade\n"
+            ");\n"
+            "create trigger if not exists InvalidateClosureSizes after update of narSize on ValidPaths\n"
+            "  when old.narSize is not new.narSize\n"
+            "  begin\n"
+            "    delete from ClosureSizes;\n"
+            "  end");
+
     if (experimentalFeatureSettings.isEnabled(Xp::CaDerivations))
         doUpgrade(
             "20220326-ca-derivations",
@@ -685,7 +932,7 @@ uint64_t LocalStore::addValidPath(State & state, const ValidPathInfo & info)
         }
     }
 
-    pathInfoCache->lock()->upsert(info.path, PathInfoCacheValue{.value = std::make_shared<const ValidPathInfo>(info)});
+    cachePathInfo(info.path, std::make_shared<const ValidPathInfo>(info));
 
     return id;
 }
@@ -694,19 +941,32 @@ void LocalStore::queryPathInfoUncached(
     const StorePath & path, Callback<std::shared_ptr<const ValidPathInfo>> callback) noexcept
 {
     try {
-        callback(retrySQLite<std::shared_ptr<const ValidPathInfo>>([&]() {
-            return queryPathInfoInternal(*_state->lock(), path);
-        }));
+        callback(withReadStmts<std::shared_ptr<const ValidPathInfo>>(
+            [&](State::Stmts & stmts) { return queryPathInfoInternal(stmts, path); }));
 
     } catch (...) {
         callback.rethrow();
     }
 }
 
-std::shared_ptr<const ValidPathInfo> LocalStore::queryPathInfoInternal(State & state, const StorePath & path)
+std::map<StorePath, std::shared_ptr<const ValidPathInfo>>
+LocalStore::queryMultiplePathInfosUncached(const StorePathSet & paths)
+{
+    /* Do all lookups on one connection, rather than acquiring one per
+       path. */
+    return withReadStmts<std::map<StorePath, std::shared_ptr<const ValidPathInfo>>>([&](State::Stmts & stmts) {
+        std::map<StorePath, std::shared_ptr<const ValidPathInfo>> infos;
+        for (auto & path : paths)
+            if (auto info = queryPathInfoInternal(stmts, path))
+                infos.insert_or_assign(path, std::move(info));
+        return infos;
+    });
+}
+
+std::shared_ptr<const ValidPathInfo> LocalStore::queryPathInfoInternal(State::Stmts & stmts, const StorePath & path)
 {
     /* Get the path info. */
-    auto useQueryPathInfo(state.stmts->QueryPathInfo.use()(printStorePath(path)));
+    auto useQueryPathInfo(stmts.QueryPathInfo.use()(printStorePath(path)));
 
     if (!useQueryPathInfo.next())
         return std::shared_ptr<ValidPathInfo>();
@@ -726,7 +986,7 @@ std::shared_ptr<const ValidPathInfo> LocalStore::queryPathInfoInternal(State & s
 
     info->registrationTime = useQueryPathInfo.getInt(2);
 
-    auto s = (const char *) sqlite3_column_text(state.stmts->QueryPathInfo, 3);
+    auto s = (const char *) sqlite3_column_text(stmts.QueryPathInfo, 3);
     if (s)
         info->deriver = parseStorePath(s);
 
@@ -735,16 +995,16 @@ std::shared_ptr<const ValidPathInfo> LocalStore::queryPathInfoInternal(State & s
 
     info->ultimate = useQueryPathInfo.getInt(5) == 1;
 
-    s = (const char *) sqlite3_column_text(state.stmts->QueryPathInfo, 6);
+    s = (const char *) sqlite3_column_text(stmts.QueryPathInfo, 6);
     if (s)
         info->sigs = tokenizeString<StringSet>(s, " ");
 
-    s = (const char *) sqlite3_column_text(state.stmts->QueryPathInfo, 7);
+    s = (const char *) sqlite3_column_text(stmts.QueryPathInfo, 7);
     if (s)
         info->ca = ContentAddress::parseOpt(s);
 
     /* Get the references. */
-    auto useQueryReferences(state.stmts->QueryReferences.use()(info->id));
+    auto useQueryReferences(stmts.QueryReferences.use()(info->id));
 
     while (useQueryReferences.next())
         info->references.insert(parseStorePath(useQueryReferences.getStr(0)));
@@ -762,22 +1022,22 @@ void LocalStore::updatePathInfo(State & state, const ValidPathInfo & info)
         .exec();
 }
 
-uint64_t LocalStore::queryValidPathId(State & state, const StorePath & path)
+uint64_t LocalStore::queryValidPathId(State::Stmts & stmts, const StorePath & path)
 {
-    auto use(state.stmts->QueryPathInfo.use()(printStorePath(path)));
+    auto use(stmts.QueryPathInfo.use()(printStorePath(path)));
     if (!use.next())
         throw InvalidPath("path '%s' is not valid", printStorePath(path));
     return use.getInt(0);
 }
 
-bool LocalStore::isValidPath_(State & state, const StorePath & path)
+bool LocalStore::isValidPath_(State::Stmts & stmts, const StorePath & path)
 {
-    return state.stmts->QueryPathInfo.use()(printStorePath(path)).next();
+    return stmts.QueryPathInfo.use()(printStorePath(path)).next();
 }
 
 bool LocalStore::isValidPathUncached(const StorePath & path)
 {
-    return retrySQLite<bool>([&]() { return isValidPath_(*_state->lock(), path); });
+    return withReadStmts<bool>([&](State::Stmts & stmts) { return isValidPath_(stmts, path); });
 }
 
 StorePathSet LocalStore::queryValidPaths(const StorePathSet & paths, SubstituteFlag maybeSubstitute)
@@ -789,11 +1049,13 @@ StorePathSet LocalStore::queryValidPaths(const StorePathSet & paths, SubstituteF
     return res;
 }
 
-StorePathSet LocalStore::queryAllValidPaths()
+StorePathSet LocalStore::queryOptimisedPaths()
 {
+    if (config->readOnly)
+        return {};
     return retrySQLite<StorePathSet>([&]() {
         auto state(_state->lock());
-        auto use(state->stmts->QueryValidPaths.use());
+        auto use(state->stmts->QueryOptimisedPaths.use());
         StorePathSet res;
         while (use.next())
             res.insert(parseStorePath(use.getStr(0)));
@@ -801,9 +1063,208 @@ StorePathSet LocalStore::queryAllValidPaths()
     });
 }
 
-void LocalStore::queryReferrers(State & state, const StorePath & path, StorePathSet & referrers)
+std::map<StorePath, DrvHash> LocalStore::queryDerivationHashesModulo(const StorePathSet & drvPaths)
 {
-    auto useQueryReferrers(state.stmts->QueryReferrers.use()(printStorePath(path)));
+    if (config->readOnly)
+        return {};
+
+    std::map<StorePath, DrvHash> res;
+
+    /* The hashes are stored as a list of output names and SRI hashes,
+       separated by spaces, which can't occur in either. */
+    for (auto & drvPath : drvPaths) {
+        if (!drvPath.isDerivation())
+            continue;
+        auto cached = retrySQLite<std::optional<DrvHash>>([&]() -> std::optional<DrvHash> {
+            auto state(_state->lock());
+            auto use(state->stmts->QueryDerivationHashes.use()(printStorePath(drvPath)));
+            if (!use.next())
+                return std::nullopt;
+            DrvHash h{.kind = use.getInt(0) ? DrvHash::Kind::Deferred : DrvHash::Kind::Regular};
+            auto tokens = tokenizeString<Strings>(use.getStr(1), " ");
+            for (auto i = tokens.begin(); i != tokens.end() && std::next(i) != tokens.end(); std::advance(i, 2))
+                h.hashes.insert_or_assign(*i, Hash::parseSRI(*std::next(i)));
+            return h;
+        });
+        if (cached) {
+            res.insert_or_assign(drvPath, std::move(*cached));
+            continue;
+        }
+
+        if (!isValidPath(drvPath))
+            continue;
+
+        /* Leave derivations that we can't read (e.g. because they use
+           an experimental feature that isn't enabled here) to the
+           caller. */
+        DrvHash h;
+        try {
+            h = hashDerivationModulo(*this, readDerivation(drvPath), false);
+        } catch (Error & e) {
+            debug("not recording the hash of '%s': %s", printStorePath(drvPath), e.msg());
+            continue;
+        }
+
+        Strings hashes;
+        for (auto & [outputName, hash] : h.hashes) {
+            hashes.push_back(outputName);
+            hashes.push_back(hash.to_string(HashFormat::SRI, true));
+        }
+        retrySQLite<void>([&]() {
+            _state->lock()
+                ->stmts->AddDerivationHashes.use()((int64_t) (h.kind == DrvHash::Kind::Deferred))(
+                    concatStringsSep(" ", hashes))(printStorePath(drvPath))
+                .exec();
+        });
+
+        res.insert_or_assign(drvPath, std::move(h));
+    }
+
+    return res;
+}
+
+void LocalStore::markOptimised(const StorePath & path)
+{
+    if (config->readOnly)
+        return;
+    retrySQLite<void>([&]() { _state->lock()->stmts->MarkOptimised.use()(printStorePath(path)).exec(); });
+}
+
+std::optional<std::chrono::seconds> LocalStore::queryBuildDuration(std::string_view drvName)
+{
+    if (config->readOnly)
+        return std::nullopt;
+    return retrySQLite<std::optional<std::chrono::seconds>>([&]() -> std::optional<std::chrono::seconds> {
+        auto state(_state->lock());
+        auto use(state->stmts->QueryBuildDuration.use()(drvName));
+        if (!use.next())
+            return std::nullopt;
+        return std::chrono::seconds(use.getInt(0));
+    });
+}
+
+void LocalStore::recordBuildStats(const BuildStats & stats)
+{
+    if (config->readOnly)
+        return;
+    retrySQLite<void>([&]() {
+        auto state(_state->lock());
+        SQLiteTxn txn(state->db);
+        state->stmts->AddBuildStats
+            .use()(stats.drvName)(stats.drvHash)(stats.machine)((int64_t) stats.startTime)((int64_t) stats.stopTime)(
+                stats.cpuUser ? stats.cpuUser->count() : 0, (bool) stats.cpuUser)(
+                stats.cpuSystem ? stats.cpuSystem->count() : 0, (bool) stats.cpuSystem)(
+                stats.peakMemory.value_or(0), (bool) stats.peakMemory)(stats.outputSize)
+            .exec();
+        state->stmts->RecordBuildDuration.use()(stats.drvName)((int64_t) (stats.stopTime - stats.startTime)).exec();
+        txn.commit();
+    });
+}
+
+std::optional<uint64_t> LocalStore::queryPeakMemory(std::string_view drvName)
+{
+    if (config->readOnly)
+        return std::nullopt;
+    return retrySQLite<std::optional<uint64_t>>([&]() -> std::optional<uint64_t> {
+        auto state(_state->lock());
+        auto use(state->stmts->QueryPeakMemory.use()(drvName));
+        if (!use.next() || use.isNull(0))
+            return std::nullopt;
+        return use.getInt(0);
+    });
+}
+
+std::vector<BuildStats> LocalStore::queryBuildStats(std::string_view drvNameOrHash, size_t limit)
+{
+    if (config->readOnly)
+        return {};
+    return retrySQLite<std::vector<BuildStats>>([&]() {
+        auto state(_state->lock());
+        auto use(state->stmts->QueryBuildStats.use()(drvNameOrHash)(limit));
+        std::vector<BuildStats> res;
+        while (use.next()) {
+            BuildStats stats{
+                .drvName = use.getStr(0),
+                .drvHash = use.getStr(1),
+                .machine = use.getStr(2),
+                .startTime = (time_t) use.getInt(3),
+                .stopTime = (time_t) use.getInt(4),
+                .outputSize = (uint64_t) use.getInt(8),
+            };
+            if (!use.isNull(5))
+                stats.cpuUser = std::chrono::microseconds(use.getInt(5));
+            if (!use.isNull(6))
+                stats.cpuSystem = std::chrono::microseconds(use.getInt(6));
+            if (!use.isNull(7))
+                stats.peakMemory = use.getInt(7);
+            res.push_back(std::move(stats));
+        }
+        return res;
+    });
+}
+
+StorePathSet LocalStore::queryAllValidPaths()
+{
+    return withReadStmts<StorePathSet>([&](State::Stmts & stmts) {
+        auto use(stmts.QueryValidPaths.use());
+        StorePathSet res;
+        while (use.next())
+            res.insert(parseStorePath(use.getStr(0)));
+        return res;
+    });
+}
+
+LocalStore::ReferenceGraph LocalStore::queryReferenceGraph()
+{
+    return withReadStmts<ReferenceGraph>([&](State::Stmts & stmts) {
+        ReferenceGraph graph;
+        boost::unordered_flat_map<int64_t, StorePathId> ids;
+
+        {
+            auto use(stmts.QueryValidPathIds.use());
+            while (use.next())
+                ids.emplace(use.getInt(0), graph.paths.insert(parseStorePath(use.getStr(1))).first);
+        }
+
+        graph.references.resize(graph.paths.size());
+
+        {
+            auto use(stmts.QueryAllReferences.use());
+            while (use.next()) {
+                /* Skip references of paths registered since the first
+                   query. */
+                auto referrer = ids.find(use.getInt(0));
+                auto reference = ids.find(use.getInt(1));
+                if (referrer != ids.end() && reference != ids.end())
+                    graph.references[referrer->second].push_back(reference->second);
+            }
+        }
+
+        return graph;
+    });
+}
+
+StorePathSet LocalStore::queryPathsWithName(std::string_view prefix)
+{
+    /* '?' is the only glob metacharacter allowed in store path
+       names. */
+    auto pattern = storeDir + "/" + std::string(StorePath::HashLen, '?') + "-";
+    for (auto c : prefix)
+        pattern += c == '?' ? "[?]" : std::string(1, c);
+    pattern += "*";
+
+    return withReadStmts<StorePathSet>([&](State::Stmts & stmts) {
+        auto use(stmts.QueryPathsWithName.use()(pattern));
+        StorePathSet res;
+        while (use.next())
+            res.insert(parseStorePath(use.getStr(0)));
+        return res;
+    });
+}
+
+void LocalStore::queryReferrers(State::Stmts & stmts, const StorePath & path, StorePathSet & referrers)
+{
+    auto useQueryReferrers(stmts.QueryReferrers.use()(printStorePath(path)));
 
     while (useQueryReferrers.next())
         referrers.insert(parseStorePath(useQueryReferrers.getStr(0)));
@@ -811,15 +1272,92 @@ void LocalStore::queryReferrers(State & state, const StorePath & path, StorePath
 
 void LocalStore::queryReferrers(const StorePath & path, StorePathSet & referrers)
 {
-    return retrySQLite<void>([&]() { queryReferrers(*_state->lock(), path, referrers); });
+    return withReadStmts<void>([&](State::Stmts & stmts) { queryReferrers(stmts, path, referrers); });
 }
 
-StorePathSet LocalStore::queryValidDerivers(const StorePath & path)
+void LocalStore::computeFSClosure(
+    const StorePathSet & paths, StorePathSet & out, bool flipDirection, bool includeOutputs, bool includeDerivers)
 {
-    return retrySQLite<StorePathSet>([&]() {
-        auto state(_state->lock());
+    if (flipDirection || includeOutputs || includeDerivers)
+        return Store::computeFSClosure(paths, out, flipDirection, includeOutputs, includeDerivers);
+
+    /* Let SQLite follow the references, rather than fetching the
+       path info of every path in the closure. */
+    auto closure = withReadStmts<StorePathSet>([&](State::Stmts & stmts) {
+        StorePathSet res;
+        for (auto & path : paths) {
+            if (out.contains(path) || res.contains(path))
+                continue;
+            auto use(stmts.QueryClosure.use()(printStorePath(path)));
+            bool found = false;
+            while (use.next()) {
+                res.insert(parseStorePath(use.getStr(0)));
+                found = true;
+            }
+            if (!found)
+                throw InvalidPath("path '%s' is not valid", printStorePath(path));
+        }
+        return res;
+    });
+
+    out.insert(closure.begin(), closure.end());
+}
+
+Store::ClosureSize LocalStore::queryClosureSize(const StorePathSet & paths, StorePathSet * closure_)
+{
+    /* Only the sizes of single paths are worth recording. */
+    bool useCache = !config->readOnly && !closure_ && paths.size() == 1;
+
+    if (useCache) {
+        auto cached = retrySQLite<std::optional<uint64_t>>([&]() -> std::optional<uint64_t> {
+            auto state(_state->lock());
+            auto use(state->stmts->QueryClosureSize.use()(printStorePath(*paths.begin())));
+            if (!use.next())
+                return std::nullopt;
+            return use.getInt(0);
+        });
+        if (cached)
+            return {.narSize = *cached};
+    }
+
+    StorePathSet closure;
+
+    auto size = withReadStmts<ClosureSize>([&](State::Stmts & stmts) {
+        ClosureSize size;
+        closure.clear();
+        for (auto & path : paths) {
+            if (closure.contains(path))
+                continue;
+            auto use(stmts.QueryClosure.use()(printStorePath(path)));
+            bool found = false;
+            while (use.next()) {
+                if (closure.insert(parseStorePath(use.getStr(0))).second)
+                    size.narSize += use.getInt(1);
+                found = true;
+            }
+            if (!found)
+                throw InvalidPath("path '%s' is not valid", printStorePath(path));
+        }
+        return size;
+    });
+
+    if (closure_)
+        closure_->insert(closure.begin(), closure.end());
 
-        auto useQueryValidDerivers(state->stmts->QueryValidDerivers.use()(printStorePath(path)));
+    if (useCache)
+        retrySQLite<void>([&]() {
+            _state->lock()
+                ->stmts->AddClosureSize.use()((int64_t) size.narSize)(printStorePath(*paths.begin()))
+                .exec();
+        });
+
+    return size;
+}
+
+StorePathSet LocalStore::queryValidDerivers(const StorePath & path)
+{
+    return withReadStmts<StorePathSet>([&](State::Stmts & stmts) {
+        auto useQueryValidDerivers(stmts.QueryValidDerivers.use()(printStorePath(path)));
 
         StorePathSet derivers;
         while (useQueryValidDerivers.next())
@@ -832,12 +1370,11 @@ StorePathSet LocalStore::queryValidDerivers(const StorePath & path)
 std::map<std::string, std::optional<StorePath>>
 LocalStore::queryStaticPartialDerivationOutputMap(const StorePath & path)
 {
-    return retrySQLite<std::map<std::string, std::optional<StorePath>>>([&]() {
-        auto state(_state->lock());
+    return withReadStmts<std::map<std::string, std::optional<StorePath>>>([&](State::Stmts & stmts) {
         std::map<std::string, std::optional<StorePath>> outputs;
         uint64_t drvId;
-        drvId = queryValidPathId(*state, path);
-        auto use(state->stmts->QueryDerivationOutputs.use()(drvId));
+        drvId = queryValidPathId(stmts, path);
+        auto use(stmts.QueryDerivationOutputs.use()(drvId));
         while (use.next())
             outputs.insert_or_assign(use.getStr(0), parseStorePath(use.getStr(1)));
 
@@ -852,15 +1389,13 @@ std::optional<StorePath> LocalStore::queryPathFromHashPart(const std::string & h
 
     Path prefix = storeDir + "/" + hashPart;
 
-    return retrySQLite<std::optional<StorePath>>([&]() -> std::optional<StorePath> {
-        auto state(_state->lock());
-
-        auto useQueryPathFromHashPart(state->stmts->QueryPathFromHashPart.use()(prefix));
+    return withReadStmts<std::optional<StorePath>>([&](State::Stmts & stmts) -> std::optional<StorePath> {
+        auto useQueryPathFromHashPart(stmts.QueryPathFromHashPart.use()(prefix));
 
         if (!useQueryPathFromHashPart.next())
             return {};
 
-        const char * s = (const char *) sqlite3_column_text(state->stmts->QueryPathFromHashPart, 0);
+        const char * s = (const char *) sqlite3_column_text(stmts.QueryPathFromHashPart, 0);
         if (s && prefix.compare(0, prefix.size(), s, prefix.size()) == 0)
             return parseStorePath(s);
         return {};
@@ -917,52 +1452,96 @@ void LocalStore::registerValidPaths(const ValidPathInfos & infos)
         sync();
 #endif
 
+    /* Do a topological sort of the paths.  This will throw an
+       error if a cycle is detected.  Cycles can only occur when a
+       derivation has multiple outputs.  Registering the paths in
+       reverse order means that the IDs of references within `infos`
+       are known by the time we get to their referrers. */
+    StorePathSet paths;
+    for (auto & [path, _] : infos)
+        paths.insert(path);
+
+    auto sorted = std::visit(
+        overloaded{
+            [&](const Cycle<StorePath> & cycle) -> std::vector<StorePath> {
+                throw BuildError(
+                    BuildResult::Failure::OutputRejected,
+                    "cycle detected in the references of '%s' from '%s'",
+                    printStorePath(cycle.path),
+                    printStorePath(cycle.parent));
+            },
+            [](std::vector<StorePath> & sorted) { return std::move(sorted); }},
+        topoSort(paths, [&](const StorePath & path) {
+            auto i = infos.find(path);
+            return i == infos.end() ? StorePathSet() : i->second.references;
+        }));
+
+    StorePathSet toResolve = paths;
+    for (auto & [_, i] : infos)
+        toResolve.insert(i.references.begin(), i.references.end());
+
     return retrySQLite<void>([&]() {
         auto state(_state->lock());
 
         SQLiteTxn txn(state->db);
-        StorePathSet paths;
 
-        for (auto & [_, i] : infos) {
+        auto ids = queryValidPathIds(*state, toResolve);
+
+        std::vector<std::pair<uint64_t, uint64_t>> refs;
+
+        for (auto & path : std::views::reverse(sorted)) {
+            auto & i = infos.at(path);
             assert(i.narHash.algo == HashAlgorithm::SHA256);
-            if (isValidPath_(*state, i.path))
+            uint64_t referrer;
+            if (auto id = get(ids, path)) {
                 updatePathInfo(*state, i);
-            else
-                addValidPath(*state, i);
-            paths.insert(i.path);
-        }
-
-        for (auto & [_, i] : infos) {
-            auto referrer = queryValidPathId(*state, i.path);
-            for (auto & j : i.references)
-                state->stmts->AddReference.use()(referrer)(queryValidPathId(*state, j)).exec();
+                referrer = *id;
+            } else
+                referrer = ids.emplace(path, addValidPath(*state, i)).first->second;
+            for (auto & j : i.references) {
+                auto reference = get(ids, j);
+                if (!reference)
+                    throw InvalidPath("path '%s' is not valid", printStorePath(j));
+                refs.emplace_back(referrer, *reference);
+            }
         }
 
-        /* Do a topological sort of the paths.  This will throw an
-           error if a cycle is detected and roll back the
-           transaction.  Cycles can only occur when a derivation
-           has multiple outputs. */
-        auto topoSortResult = topoSort(paths, [&](const StorePath & path) {
-            auto i = infos.find(path);
-            return i == infos.end() ? StorePathSet() : i->second.references;
-        });
-
-        std::visit(
-            overloaded{
-                [&](const Cycle<StorePath> & cycle) {
-                    throw BuildError(
-                        BuildResult::Failure::OutputRejected,
-                        "cycle detected in the references of '%s' from '%s'",
-                        printStorePath(cycle.path),
-                        printStorePath(cycle.parent));
-                },
-                [](auto &) { /* Success, continue */ }},
-            topoSortResult);
+        addReferences(*state, refs);
 
         txn.commit();
     });
 }
 
+std::map<StorePath, uint64_t> LocalStore::queryValidPathIds(State & state, const StorePathSet & paths)
+{
+    for (auto & path : paths)
+        state.stmts->AddPathToResolve.use()(printStorePath(path)).exec();
+
+    std::map<StorePath, uint64_t> ids;
+    auto use(state.stmts->QueryResolvedPaths.use());
+    while (use.next())
+        ids.emplace(parseStorePath(use.getStr(0)), use.getInt(1));
+
+    state.stmts->ClearPathsToResolve.use().exec();
+
+    return ids;
+}
+
+void LocalStore::addReferences(State & state, const std::vector<std::pair<uint64_t, uint64_t>> & refs)
+{
+    size_t n = 0;
+
+    for (; n + addReferencesBatchSize <= refs.size(); n += addReferencesBatchSize) {
+        auto use(state.stmts->AddReferences.use());
+        for (size_t i = n; i < n + addReferencesBatchSize; ++i)
+            use(refs[i].first)(refs[i].second);
+        use.exec();
+    }
+
+    for (; n < refs.size(); ++n)
+        state.stmts->AddReference.use()(refs[n].first)(refs[n].second).exec();
+}
+
 /* Invalidate a path.  The caller is responsible for checking that
    there are no referrers. */
 void LocalStore::invalidatePath(State & state, const StorePath & path)
@@ -974,7 +1553,7 @@ void LocalStore::invalidatePath(State & state, const StorePath & path)
     /* Note that the foreign key constraints on the Refs table take
        care of deleting the references entries for `path'. */
 
-    pathInfoCache->lock()->erase(path);
+    invalidatePathInfoCacheFor(path);
 }
 
 const PublicKeys & LocalStore::getPublicKeys()
@@ -985,6 +1564,12 @@ const PublicKeys & LocalStore::getPublicKeys()
     return *state->publicKeys;
 }
 
+void LocalStore::precheckSignatures(const std::vector<const ValidPathInfo *> & infos)
+{
+    if (config->requireSigs)
+        checkSignatures(*this, infos, getPublicKeys());
+}
+
 bool LocalStore::pathInfoIsUntrusted(const ValidPathInfo & info)
 {
     return config->requireSigs && !info.checkSignatures(*this, getPublicKeys());
@@ -995,6 +1580,74 @@ bool LocalStore::realisationIsUntrusted(const Realisation & realisation)
     return config->requireSigs && !realisation.checkSignatures(realisation.id, getPublicKeys());
 }
 
+void LocalStore::restorePathFromNar(
+    const ValidPathInfo & info, Source & source, const Path & realPath, RepairFlag repair, bool fsync)
+{
+    /* While restoring the path from the NAR, compute the hash
+       of the NAR. */
+    HashSink hashSink(HashAlgorithm::SHA256);
+
+    TeeSource wrapperSource{source, hashSink};
+
+    restorePath(realPath, wrapperSource, fsync);
+
+    auto hashResult = hashSink.finish();
+
+    if (hashResult.hash != info.narHash)
+        throw Error(
+            "hash mismatch importing path '%s';\n  specified: %s\n  got:       %s",
+            printStorePath(info.path),
+            info.narHash.to_string(HashFormat::Nix32, true),
+            hashResult.hash.to_string(HashFormat::Nix32, true));
+
+    if (hashResult.numBytesDigested != info.narSize)
+        throw Error(
+            "size mismatch importing path '%s';\n  specified: %s\n  got:       %s",
+            printStorePath(info.path),
+            info.narSize,
+            hashResult.numBytesDigested);
+
+    if (info.ca) {
+        auto & specified = *info.ca;
+        auto actualHash = ({
+            auto accessor = getFSAccessor(false);
+            CanonPath path{info.path.to_string()};
+            Hash h{HashAlgorithm::SHA256}; // throwaway def to appease C++
+            auto fim = specified.method.getFileIngestionMethod();
+            switch (fim) {
+            case FileIngestionMethod::Flat:
+            case FileIngestionMethod::NixArchive: {
+                HashModuloSink caSink{
+                    specified.hash.algo,
+                    std::string{info.path.hashPart()},
+                };
+                dumpPath({accessor, path}, caSink, (FileSerialisationMethod) fim);
+                h = caSink.finish().hash;
+                break;
+            }
+            case FileIngestionMethod::Git:
+                h = git::dumpHash(specified.hash.algo, {accessor, path}).hash;
+                break;
+            }
+            ContentAddress{
+                .method = specified.method,
+                .hash = std::move(h),
+            };
+        });
+        if (specified.hash != actualHash.hash) {
+            throw Error(
+                "ca hash mismatch importing path '%s';\n  specified: %s\n  got:       %s",
+                printStorePath(info.path),
+                specified.hash.to_string(HashFormat::Nix32, true),
+                actualHash.hash.to_string(HashFormat::Nix32, true));
+        }
+    }
+
+    autoGC();
+
+    canonicalisePathMetaData(realPath);
+}
+
 void LocalStore::addToStore(const ValidPathInfo & info, Source & source, RepairFlag repair, CheckSigsFlag checkSigs)
 {
     if (checkSigs && pathInfoIsUntrusted(info))
@@ -1024,79 +1677,15 @@ void LocalStore::addToStore(const ValidPathInfo & info, Source & source, RepairF
             /* Lock the output path.  But don't lock if we're being called
             from a build hook (whose parent process already acquired a
             lock on this path). */
-            if (!locksHeld.count(printStorePath(info.path)))
+            if (!locksHeld.lock()->count(printStorePath(info.path)))
                 outputLock.lockPaths({realPath});
 
             if (repair || !isValidPath(info.path)) {
 
                 deletePath(realPath);
 
-                /* While restoring the path from the NAR, compute the hash
-                of the NAR. */
-                HashSink hashSink(HashAlgorithm::SHA256);
-
-                TeeSource wrapperSource{source, hashSink};
-
                 narRead = true;
-                restorePath(realPath, wrapperSource, settings.fsyncStorePaths);
-
-                auto hashResult = hashSink.finish();
-
-                if (hashResult.hash != info.narHash)
-                    throw Error(
-                        "hash mismatch importing path '%s';\n  specified: %s\n  got:       %s",
-                        printStorePath(info.path),
-                        info.narHash.to_string(HashFormat::Nix32, true),
-                        hashResult.hash.to_string(HashFormat::Nix32, true));
-
-                if (hashResult.numBytesDigested != info.narSize)
-                    throw Error(
-                        "size mismatch importing path '%s';\n  specified: %s\n  got:       %s",
-                        printStorePath(info.path),
-                        info.narSize,
-                        hashResult.numBytesDigested);
-
-                if (info.ca) {
-                    auto & specified = *info.ca;
-                    auto actualHash = ({
-                        auto accessor = getFSAccessor(false);
-                        CanonPath path{info.path.to_string()};
-                        Hash h{HashAlgorithm::SHA256}; // throwaway def to appease C++
-                        auto fim = specified.method.getFileIngestionMethod();
-                        switch (fim) {
-                        case FileIngestionMethod::Flat:
-                        case FileIngestionMethod::NixArchive: {
-                            HashModuloSink caSink{
-                                specified.hash.algo,
-                                std::string{info.path.hashPart()},
-                            };
-                            dumpPath({accessor, path}, caSink, (FileSerialisationMethod) fim);
-                            h = caSink.finish().hash;
-                            break;
-                        }
-                        case FileIngestionMethod::Git:
-                            h = git::dumpHash(specified.hash.algo, {accessor, path}).hash;
-                            break;
-                        }
-                        ContentAddress{
-                            .method = specified.method,
-                            .hash = std::move(h),
-                        };
-                    });
-                    if (specified.hash != actualHash.hash) {
-                        throw Error(
-                            "ca hash mismatch importing path '%s';\n  specified: %s\n  got:       %s",
-                            printStorePath(info.path),
-                            specified.hash.to_string(HashFormat::Nix32, true),
-                            actualHash.hash.to_string(HashFormat::Nix32, true));
-                    }
-                }
-
-                autoGC();
-
-                canonicalisePathMetaData(realPath);
-
-                optimisePath(realPath, repair); // FIXME: combine with hashPath()
+                restorePathFromNar(info, source, realPath, repair, settings.fsyncStorePaths);
 
                 if (settings.fsyncStorePaths) {
                     recursiveSync(realPath);
@@ -1104,6 +1693,8 @@ void LocalStore::addToStore(const ValidPathInfo & info, Source & source, RepairF
                 }
 
                 registerValidPath(info);
+
+                optimisePathLater(info.path, repair);
             }
 
             outputLock.setDeletion(true);
@@ -1114,6 +1705,94 @@ void LocalStore::addToStore(const ValidPathInfo & info, Source & source, RepairF
     checkInterrupt();
 }
 
+void LocalStore::addMultipleToStore(Source & source, RepairFlag repair, CheckSigsFlag checkSigs)
+{
+    /* We hold a lock per path until its batch is registered, so keep
+       batches small enough not to run out of file descriptors. */
+    constexpr size_t maxBatchSize = 256;
+
+    ValidPathInfos batch;
+    std::vector<PathLocks> locks;
+
+    auto flush = [&]() {
+        if (batch.empty())
+            return;
+
+        if (settings.fsyncStorePaths) {
+#ifdef __linux__
+            /* One sync of the file system holding the store instead of
+               one per file. */
+            auto fd = openDirectory(config->realStoreDir.get());
+            if (!fd || syncfs(fd.get()) == -1)
+                throw SysError("syncing the file system of '%s'", config->realStoreDir.get());
+#else
+            for (auto & [path, _] : batch)
+                recursiveSync(toRealPath(path));
+            syncParent(toRealPath(batch.begin()->first));
+#endif
+        }
+
+        registerValidPaths(batch);
+
+        for (auto & [path, _] : batch)
+            optimisePathLater(path, repair);
+
+        for (auto & lock : locks)
+            lock.setDeletion(true);
+
+        batch.clear();
+        locks.clear();
+    };
+
+    auto expected = readNum<uint64_t>(source);
+    for (uint64_t i = 0; i < expected; ++i) {
+        auto info = WorkerProto::Serialise<ValidPathInfo>::read(
+            *this,
+            WorkerProto::ReadConn{
+                .from = source,
+                .version = 16,
+            });
+        info.ultimate = false;
+
+        if (checkSigs && pathInfoIsUntrusted(info))
+            throw Error(
+                "cannot add path '%s' because it lacks a signature by a trusted key", printStorePath(info.path));
+
+        addTempRoot(info.path);
+
+        auto isDone = [&]() { return batch.contains(info.path) || (!repair && isValidPath(info.path)); };
+
+        if (isDone()) {
+            source.skip(info.narSize);
+            continue;
+        }
+
+        auto realPath = toRealPath(info.path);
+
+        /* Don't lock if we're being called from a build hook whose
+           parent process already holds the lock. */
+        auto & lock = locks.emplace_back();
+        if (!locksHeld.lock()->count(printStorePath(info.path)))
+            lock.lockPaths({realPath});
+
+        if (isDone()) {
+            source.skip(info.narSize);
+            continue;
+        }
+
+        deletePath(realPath);
+
+        restorePathFromNar(info, source, realPath, repair, false);
+
+        batch.insert_or_assign(info.path, std::move(info));
+
+        if (batch.size() >= maxBatchSize)
+            flush();
+    }
+
+    flush();
+}
+
 StorePath LocalStore::addToStoreFromDump(
     Source & source0,
     std::string_view name,
@@ -1256,8 +1935,6 @@ StorePath LocalStore::addToStoreFromDump(
 
             canonicalisePathMetaData(realPath); // FIXME: merge into restorePath
 
-            optimisePath(realPath, repair);
-
             if (settings.fsyncStorePaths) {
                 recursiveSync(realPath);
                 syncParent(realPath);
@@ -1266,6 +1943,8 @@ StorePath LocalStore::addToStoreFromDump(
             auto info = ValidPathInfo::makeFromCA(*this, name, std::move(desc), narHash.hash);
             info.narSize = narHash.numBytesDigested;
             registerValidPath(info);
+
+            optimisePathLater(dstPath, repair);
         }
 
         outputLock.setDeletion(true);
@@ -1302,9 +1981,9 @@ void LocalStore::invalidatePathChecked(const StorePath & path)
 
         SQLiteTxn txn(state->db);
 
-        if (isValidPath_(*state, path)) {
+        if (isValidPath_(*state->stmts, path)) {
             StorePathSet referrers;
-            queryReferrers(*state, path, referrers);
+            queryReferrers(*state->stmts, path, referrers);
             referrers.erase(path); /* ignore self-references */
             if (!referrers.empty())
                 throw PathInUse(
@@ -1316,6 +1995,58 @@ void LocalStore::invalidatePathChecked(const StorePath & path)
     });
 }
 
+/**
+ * Tell the OS that we won't read the files in `path` again soon, so
+ * that verifying a large store doesn't push everything else out of
+ * the page cache.
+ */
+static void dropFromPageCache(const std::filesystem::path & path)
+{
+#if HAVE_POSIX_FADVISE
+    auto drop = [](const std::filesystem::path & file) {
+        AutoCloseFD fd = toDescriptor(open(file.string().c_str(), O_RDONLY | O_CLOEXEC));
+        if (fd)
+            posix_fadvise(fd.get(), 0, 0, POSIX_FADV_DONTNEED);
+    };
+
+    std::error_code ec;
+    if (std::filesystem::is_regular_file(std::filesystem::symlink_status(path, ec)))
+        drop(path);
+    else if (std::filesystem::is_directory(std::filesystem::symlink_status(path, ec)))
+        for (auto & entry : std::filesystem::recursive_directory_iterator(path, ec))
+            if (entry.is_regular_file(ec) && !entry.is_symlink(ec))
+                drop(entry.path());
+#endif
+}
+
+StorePathSet LocalStore::queryVerifiedPaths()
+{
+    if (config->readOnly)
+        return {};
+    return retrySQLite<StorePathSet>([&]() {
+        auto state(_state->lock());
+        auto use(state->stmts->QueryVerifiedPaths.use());
+        StorePathSet res;
+        while (use.next())
+            res.insert(parseStorePath(use.getStr(0)));
+        return res;
+    });
+}
+
+void LocalStore::markVerified(const StorePath & path)
+{
+    if (config->readOnly)
+        return;
+    retrySQLite<void>([&]() { _state->lock()->stmts->MarkVerified.use()(printStorePath(path)).exec(); });
+}
+
+void LocalStore::clearVerifiedPaths()
+{
+    if (config->readOnly)
+        return;
+    retrySQLite<void>([&]() { _state->lock()->stmts->ClearVerifiedPaths.use().exec(); });
+}
+
 bool LocalStore::verifyStore(bool checkContents, RepairFlag repair)
 {
     printInfo("reading the Nix store...");
@@ -1330,85 +2061,134 @@ bool LocalStore::verifyStore(bool checkContents, RepairFlag repair)
     /* Optionally, check the content hashes (slow). */
     if (checkContents) {
 
+        std::atomic<bool> errors_{errors};
+
+        /* Paths whose contents were checked by a previous,
+           interrupted run. The links aren't recorded, so they're
+           always checked. */
+        auto verified = queryVerifiedPaths();
+
         printInfo("checking link hashes...");
 
-        for (auto & link : DirectoryIterator{linksDir}) {
-            checkInterrupt();
-            auto name = link.path().filename();
-            printMsg(lvlTalkative, "checking contents of %s", name);
-            std::string hash =
-                hashPath(makeFSSourceAccessor(link.path()), FileIngestionMethod::NixArchive, HashAlgorithm::SHA256)
-                    .first.to_string(HashFormat::Nix32, false);
-            if (hash != name.string()) {
-                printError("link %s was modified! expected hash %s, got '%s'", link.path(), name, hash);
-                if (repair) {
-                    std::filesystem::remove(link.path());
-                    printInfo("removed link %s", link.path());
-                } else {
-                    errors = true;
-                }
+        {
+            ThreadPool pool(settings.verifyJobs);
+
+            for (auto & link : DirectoryIterator{linksDir}) {
+                checkInterrupt();
+                pool.enqueue([&, path{link.path()}]() {
+                    auto name = path.filename();
+                    printMsg(lvlTalkative, "checking contents of %s", name);
+                    std::string hash =
+                        hashPath(makeFSSourceAccessor(path), FileIngestionMethod::NixArchive, HashAlgorithm::SHA256)
+                            .first.to_string(HashFormat::Nix32, false);
+                    dropFromPageCache(path);
+                    if (hash != name.string()) {
+                        printError("link %s was modified! expected hash %s, got '%s'", path, name, hash);
+                        if (repair) {
+                            std::filesystem::remove(path);
+                            printInfo("removed link %s", path);
+                        } else {
+                            errors_ = true;
+                        }
+                    }
+                });
             }
+
+            pool.process();
         }
 
         printInfo("checking store hashes...");
 
+        if (!verified.empty())
+            printInfo("resuming interrupted verification, skipping %d checked paths...", verified.size());
+
+        ThreadPool pool(settings.verifyJobs);
+
         Hash nullHash(HashAlgorithm::SHA256);
 
+        /* Repairs substitute paths, so do them one at a time
+           afterwards. */
+        Sync<StorePathSet> toRepair_;
+
+        Activity act(*logger, actVerifyPaths);
+        std::atomic<size_t> done{0};
+        size_t expected = std::ranges::count_if(validPaths, [&](auto & i) { return !verified.contains(i); });
+
         for (auto & i : validPaths) {
-            try {
-                auto info =
-                    std::const_pointer_cast<ValidPathInfo>(std::shared_ptr<const ValidPathInfo>(queryPathInfo(i)));
-
-                /* Check the content hash (optionally - slow). */
-                printMsg(lvlTalkative, "checking contents of '%s'", printStorePath(i));
-
-                auto hashSink = HashSink(info->narHash.algo);
-
-                dumpPath(toRealPath(i), hashSink);
-                auto current = hashSink.finish();
-
-                if (info->narHash != nullHash && info->narHash != current.hash) {
-                    printError(
-                        "path '%s' was modified! expected hash '%s', got '%s'",
-                        printStorePath(i),
-                        info->narHash.to_string(HashFormat::Nix32, true),
-                        current.hash.to_string(HashFormat::Nix32, true));
-                    if (repair)
-                        repairPath(i);
-                    else
-                        errors = true;
-                } else {
+            if (verified.contains(i))
+                continue;
+            pool.enqueue([&, i]() {
+                try {
+                    auto info =
+                        std::const_pointer_cast<ValidPathInfo>(std::shared_ptr<const ValidPathInfo>(queryPathInfo(i)));
+
+                    /* Check the content hash (optionally - slow). */
+                    printMsg(lvlTalkative, "checking contents of '%s'", printStorePath(i));
+
+                    auto hashSink = HashSink(info->narHash.algo);
+
+                    dumpPath(toRealPath(i), hashSink);
+                    auto current = hashSink.finish();
+
+                    dropFromPageCache(toRealPath(i));
+
+                    if (info->narHash != nullHash && info->narHash != current.hash) {
+                        printError(
+                            "path '%s' was modified! expected hash '%s', got '%s'",
+                            printStorePath(i),
+                            info->narHash.to_string(HashFormat::Nix32, true),
+                            current.hash.to_string(HashFormat::Nix32, true));
+                        if (repair)
+                            toRepair_.lock()->insert(i);
+                        else
+                            errors_ = true;
+                    } else {
+
+                        bool update = false;
+
+                        /* Fill in missing hashes. */
+                        if (info->narHash == nullHash) {
+                            printInfo("fixing missing hash on '%s'", printStorePath(i));
+                            info->narHash = current.hash;
+                            update = true;
+                        }
 
-                    bool update = false;
+                        /* Fill in missing narSize fields (from old stores). */
+                        if (info->narSize == 0) {
+                            printInfo(
+                                "updating size field on '%s' to %s", printStorePath(i), current.numBytesDigested);
+                            info->narSize = current.numBytesDigested;
+                            update = true;
+                        }
 
-                    /* Fill in missing hashes. */
-                    if (info->narHash == nullHash) {
-                        printInfo("fixing missing hash on '%s'", printStorePath(i));
-                        info->narHash = current.hash;
-                        update = true;
-                    }
+                        if (update)
+                            updatePathInfo(*_state->lock(), *info);
 
-                    /* Fill in missing narSize fields (from old stores). */
-                    if (info->narSize == 0) {
-                        printInfo("updating size field on '%s' to %s", printStorePath(i), current.numBytesDigested);
-                        info->narSize = current.numBytesDigested;
-                        update = true;
+                        markVerified(i);
                     }
 
-                    if (update)
-                        updatePathInfo(*_state->lock(), *info);
+                } catch (Error & e) {
+                    /* It's possible that the path got GC'ed, so ignore
+                       errors on invalid paths. */
+                    if (isValidPath(i))
+                        logError(e.info());
+                    else
+                        warn(e.msg());
+                    errors_ = true;
                 }
-
-            } catch (Error & e) {
-                /* It's possible that the path got GC'ed, so ignore
-                   errors on invalid paths. */
-                if (isValidPath(i))
-                    logError(e.info());
-                else
-                    warn(e.msg());
-                errors = true;
-            }
+                act.progress(++done, expected);
+            });
         }
+
+        pool.process();
+
+        for (auto & i : *toRepair_.lock())
+            repairPath(i);
+
+        /* We got to the end, so the next run starts from scratch. */
+        clearVerifiedPaths();
+
+        errors = errors_;
     }
 
     return errors;
@@ -1525,7 +2305,7 @@ void LocalStore::addSignatures(const StorePath & storePath, const StringSet & si
 
         SQLiteTxn txn(state->db);
 
-        auto info = std::const_pointer_cast<ValidPathInfo>(queryPathInfoInternal(*state, storePath));
+        auto info = std::const_pointer_cast<ValidPathInfo>(queryPathInfoInternal(*state->stmts, storePath));
 
         info->sigs.insert(sigs.begin(), sigs.end());
 
@@ -1583,6 +2363,23 @@ void LocalStore::queryRealisationUncached(
     }
 }
 
+std::map<DrvOutput, std::shared_ptr<const UnkeyedRealisation>>
+LocalStore::queryRealisationsUncached(const std::set<DrvOutput> & outputs)
+{
+    if (!experimentalFeatureSettings.isEnabled(Xp::CaDerivations))
+        return {};
+
+    /* Take the database lock once for all outputs. */
+    return retrySQLite<std::map<DrvOutput, std::shared_ptr<const UnkeyedRealisation>>>([&]() {
+        auto state(_state->lock());
+        std::map<DrvOutput, std::shared_ptr<const UnkeyedRealisation>> res;
+        for (auto & id : outputs)
+            if (auto realisation = queryRealisation_(*state, id))
+                res.insert_or_assign(id, std::make_shared<const UnkeyedRealisation>(*realisation));
+        return res;
+    });
+}
+
 void LocalStore::addBuildLog(const StorePath & drvPath, std::string_view log)
 {
     assert(drvPath.isDerivation());
@@ -1,77 +1,110 @@
 #include "nix/store/make-content-addressed.hh"
 #include "nix/store/references.hh"
+#include "nix/store/globals.hh"
+#include "nix/util/signals.hh"
+#include "nix/util/thread-pool.hh"
 
 namespace nix {
 
+/**
+ * NARs up to this size are read from the source store once and kept in
+ * memory while they're rewritten; larger ones are read again for every
+ * pass, so that memory use stays bounded by the number of jobs.
+ */
+static constexpr uint64_t maxBufferedNarSize = 32 * 1024 * 1024;
+
 std::map<StorePath, StorePath> makeContentAddressed(Store & srcStore, Store & dstStore, const StorePathSet & storePaths)
 {
     StorePathSet closure;
     srcStore.computeFSClosure(storePaths, closure);
 
-    auto paths = srcStore.topoSortPaths(closure);
-
-    std::reverse(paths.begin(), paths.end());
-
-    std::map<StorePath, StorePath> remappings;
-
-    for (auto & path : paths) {
-        auto pathS = srcStore.printStorePath(path);
-        auto oldInfo = srcStore.queryPathInfo(path);
-        std::string oldHashPart(path.hashPart());
-
-        StringSink sink;
-        srcStore.narFromPath(path, sink);
-
-        StringMap rewrites;
-
-        StoreReferences refs;
-        for (auto & ref : oldInfo->references) {
-            if (ref == path)
-                refs.self = true;
-            else {
-                auto i = remappings.find(ref);
-                auto replacement = i != remappings.end() ? i->second : ref;
-                // FIXME: warn about unremapped paths?
-                if (replacement != ref)
-                    rewrites.insert_or_assign(srcStore.printStorePath(ref), srcStore.printStorePath(replacement));
-                refs.others.insert(std::move(replacement));
+    Sync<std::map<StorePath, StorePath>> remappings_;
+
+    /* Rewrite every path once all of its references have been
+       rewritten, so that independent paths are processed in
+       parallel. */
+    processGraph<StorePath>(
+        closure,
+        [&](const StorePath & path) { return srcStore.queryPathInfo(path)->references; },
+        [&](const StorePath & path) {
+            checkInterrupt();
+
+            auto pathS = srcStore.printStorePath(path);
+            auto oldInfo = srcStore.queryPathInfo(path);
+            std::string oldHashPart(path.hashPart());
+
+            StringMap rewrites;
+
+            StoreReferences refs;
+            {
+                auto remappings(remappings_.lock());
+                for (auto & ref : oldInfo->references) {
+                    if (ref == path)
+                        refs.self = true;
+                    else {
+                        auto i = remappings->find(ref);
+                        auto replacement = i != remappings->end() ? i->second : ref;
+                        // FIXME: warn about unremapped paths?
+                        if (replacement != ref)
+                            rewrites.insert_or_assign(
+                                srcStore.printStorePath(ref), srcStore.printStorePath(replacement));
+                        refs.others.insert(std::move(replacement));
+                    }
+                }
             }
-        }
-
-        sink.s = rewriteStrings(sink.s, rewrites);
 
-        HashModuloSink hashModuloSink(HashAlgorithm::SHA256, oldHashPart);
-        hashModuloSink(sink.s);
-
-        auto narModuloHash = hashModuloSink.finish().hash;
-
-        auto info = ValidPathInfo::makeFromCA(
-            dstStore,
-            path.name(),
-            FixedOutputInfo{
-                .method = FileIngestionMethod::NixArchive,
-                .hash = narModuloHash,
-                .references = std::move(refs),
-            },
-            Hash::dummy);
-
-        printInfo("rewriting '%s' to '%s'", pathS, dstStore.printStorePath(info.path));
-
-        StringSink sink2;
-        RewritingSink rsink2(oldHashPart, std::string(info.path.hashPart()), sink2);
-        rsink2(sink.s);
-        rsink2.flush();
-
-        info.narHash = hashString(HashAlgorithm::SHA256, sink2.s);
-        info.narSize = sink.s.size();
-
-        StringSource source(sink2.s);
-        dstStore.addToStore(info, source);
-
-        remappings.insert_or_assign(std::move(path), std::move(info.path));
-    }
+            std::optional<StringSink> buffered;
+            if (oldInfo->narSize <= maxBufferedNarSize) {
+                buffered.emplace();
+                srcStore.narFromPath(path, *buffered);
+            }
 
-    return remappings;
+            /* Push the NAR with its references rewritten, and with the
+               given additional rewrites, through `sink`. */
+            auto rewriteNar = [&](const StringMap & extraRewrites, Sink & sink) {
+                auto allRewrites = rewrites;
+                allRewrites.insert(extraRewrites.begin(), extraRewrites.end());
+                RewritingSink rsink(allRewrites, sink);
+                if (buffered)
+                    rsink(buffered->s);
+                else
+                    srcStore.narFromPath(path, rsink);
+                rsink.flush();
+            };
+
+            HashModuloSink hashModuloSink(HashAlgorithm::SHA256, oldHashPart);
+            rewriteNar({}, hashModuloSink);
+
+            auto narModuloHash = hashModuloSink.finish().hash;
+
+            auto info = ValidPathInfo::makeFromCA(
+                dstStore,
+                path.name(),
+                FixedOutputInfo{
+                    .method = FileIngestionMethod::NixArchive,
+                    .hash = narModuloHash,
+                    .references = std::move(refs),
+                },
+                Hash::dummy);
+
+            printInfo("rewriting '%s' to '%s'", pathS, dstStore.printStorePath(info.path));
+
+            StringMap selfRewrite{{oldHashPart, std::string(info.path.hashPart())}};
+
+            HashSink narHashSink(HashAlgorithm::SHA256);
+            rewriteNar(selfRewrite, narHashSink);
+            auto narHash = narHashSink.finish();
+            info.narHash = narHash.hash;
+            info.narSize = narHash.numBytesDigested;
+
+            auto source = sinkToSource([&](Sink & sink) { rewriteNar(selfRewrite, sink); });
+            dstStore.addToStore(info, *source);
+
+            remappings_.lock()->insert_or_assign(path, std::move(info.path));
+        },
+        settings.copyPathJobs);
+
+    return std::move(*remappings_.lock());
 }
 
 StorePath makeContentAddressed(Store & srcStore, Store & dstStore, const StorePath & fromPath)
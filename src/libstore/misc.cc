@@ -2,9 +2,11 @@
 #include "nix/store/parsed-derivations.hh"
 #include "nix/store/derivation-options.hh"
 #include "nix/store/globals.hh"
+#include "nix/store/nar-info.hh"
 #include "nix/store/store-open.hh"
 #include "nix/util/thread-pool.hh"
 #include "nix/store/realisation.hh"
+#include "nix/store/path-interner.hh"
 #include "nix/util/topo-sort.hh"
 #include "nix/util/callback.hh"
 #include "nix/util/closure.hh"
@@ -23,58 +25,81 @@ void Store::computeFSClosure(
     bool includeOutputs,
     bool includeDerivers)
 {
-    std::function<std::set<StorePath>(const StorePath & path, std::future<ref<const ValidPathInfo>> &)> queryDeps;
-    if (flipDirection)
-        queryDeps = [&](const StorePath & path, std::future<ref<const ValidPathInfo>> & fut) {
-            StorePathSet res;
-            StorePathSet referrers;
-            queryReferrers(path, referrers);
-            for (auto & ref : referrers)
-                if (ref != path)
-                    res.insert(ref);
-
-            if (includeOutputs)
-                for (auto & i : queryValidDerivers(path))
-                    res.insert(i);
-
-            if (includeDerivers && path.isDerivation())
-                for (auto & [_, maybeOutPath] : queryPartialDerivationOutputMap(path))
-                    if (maybeOutPath && isValidPath(*maybeOutPath))
-                        res.insert(*maybeOutPath);
-            return res;
-        };
-    else
-        queryDeps = [&](const StorePath & path, std::future<ref<const ValidPathInfo>> & fut) {
-            StorePathSet res;
-            auto info = fut.get();
-            for (auto & ref : info->references)
-                if (ref != path)
-                    res.insert(ref);
-
-            if (includeOutputs && path.isDerivation())
-                for (auto & [_, maybeOutPath] : queryPartialDerivationOutputMap(path))
-                    if (maybeOutPath && isValidPath(*maybeOutPath))
-                        res.insert(*maybeOutPath);
-
-            if (includeDerivers && info->deriver && isValidPath(*info->deriver))
-                res.insert(*info->deriver);
-            return res;
+    if (!flipDirection) {
+        /* Walk the closure breadth-first, querying the path infos of
+           each layer in one batch. For remote stores this turns one
+           round trip per path into one per layer. References are
+           checked against `seen`, which is much cheaper than
+           `paths_`, so that only the first occurrence of each path
+           costs a set insertion. */
+        StorePathInterner seen;
+        StorePathSet layer;
+        auto add = [&](const StorePath & path, StorePathSet & next) {
+            if (seen.insert(path).second && paths_.insert(path).second)
+                next.insert(path);
         };
 
+        for (auto & path : startPaths)
+            add(path, layer);
+
+        while (!layer.empty()) {
+            auto infos = queryMultiplePathInfos(layer);
+
+            StorePathSet next;
+
+            for (auto & path : layer) {
+                auto i = infos.find(path);
+                if (i == infos.end())
+                    throw InvalidPath("path '%s' is not valid", printStorePath(path));
+                auto & info = i->second;
+
+                for (auto & ref : info->references)
+                    add(ref, next);
+
+                if (includeOutputs && path.isDerivation())
+                    for (auto & [_, maybeOutPath] : queryPartialDerivationOutputMap(path))
+                        if (maybeOutPath && isValidPath(*maybeOutPath))
+                            add(*maybeOutPath, next);
+
+                if (includeDerivers && info->deriver && isValidPath(*info->deriver))
+                    add(*info->deriver, next);
+            }
+
+            layer = std::move(next);
+        }
+
+        return;
+    }
+
+    auto queryDeps = [&](const StorePath & path) {
+        StorePathSet res;
+        StorePathSet referrers;
+        queryReferrers(path, referrers);
+        for (auto & ref : referrers)
+            if (ref != path)
+                res.insert(ref);
+
+        if (includeOutputs)
+            for (auto & i : queryValidDerivers(path))
+                res.insert(i);
+
+        if (includeDerivers && path.isDerivation())
+            for (auto & [_, maybeOutPath] : queryPartialDerivationOutputMap(path))
+                if (maybeOutPath && isValidPath(*maybeOutPath))
+                    res.insert(*maybeOutPath);
+        return res;
+    };
+
     computeClosure<StorePath>(
         startPaths,
         paths_,
         [&](const StorePath & path, std::function<void(std::promise<std::set<StorePath>> &)> processEdges) {
             std::promise<std::set<StorePath>> promise;
-            std::function<void(std::future<ref<const ValidPathInfo>>)> getDependencies =
-                [&](std::future<ref<const ValidPathInfo>> fut) {
-                    try {
-                        promise.set_value(queryDeps(path, fut));
-                    } catch (...) {
-                        promise.set_exception(std::current_exception());
-                    }
-                };
-            queryPathInfo(path, getDependencies);
+            try {
+                promise.set_value(queryDeps(path));
+            } catch (...) {
+                promise.set_exception(std::current_exception());
+            }
             processEdges(promise);
         });
 }
@@ -87,6 +112,26 @@ void Store::computeFSClosure(
     computeFSClosure(paths, paths_, flipDirection, includeOutputs, includeDerivers);
 }
 
+Store::ClosureSize Store::queryClosureSize(const StorePathSet & paths, StorePathSet * closure_)
+{
+    StorePathSet closure;
+    computeFSClosure(paths, closure);
+
+    ClosureSize size{.downloadSize = 0};
+    for (auto & [path, info] : queryMultiplePathInfos(closure)) {
+        size.narSize += info->narSize;
+        if (auto narInfo = dynamic_cast<const NarInfo *>(&*info); narInfo && size.downloadSize)
+            *size.downloadSize += narInfo->fileSize;
+        else
+            size.downloadSize.reset();
+    }
+
+    if (closure_)
+        closure_->insert(closure.begin(), closure.end());
+
+    return size;
+}
+
 const ContentAddress * getDerivationCA(const BasicDerivation & drv)
 {
     auto out = drv.outputs.find("out");
@@ -241,29 +286,25 @@ MissingPaths Store::queryMissing(const std::vector<DerivedPath> & targets)
 
                         // If there are unknown output paths, attempt to find if the
                         // paths are known to substituters through a realisation.
-                        auto outputHashes = staticOutputHashes(*this, *drv);
-                        knownOutputPaths = true;
-
-                        for (auto [outputName, hash] : outputHashes) {
-                            if (!bfd.outputs.contains(outputName))
-                                continue;
-
-                            bool found = false;
-                            for (auto & sub : getDefaultSubstituters()) {
-                                auto realisation = sub->queryRealisation({hash, outputName});
-                                if (!realisation)
-                                    continue;
-                                found = true;
+                        std::set<DrvOutput> missing;
+                        for (auto & [outputName, hash] : staticOutputHashes(*this, *drv))
+                            if (bfd.outputs.contains(outputName))
+                                missing.insert({hash, outputName});
+
+                        // Ask each substituter for all the outputs that the
+                        // previous ones didn't have in one go.
+                        for (auto & sub : getDefaultSubstituters()) {
+                            if (missing.empty())
+                                break;
+                            for (auto & [id, realisation] : sub->queryRealisations(missing)) {
+                                missing.erase(id);
                                 if (!isValidPath(realisation->outPath))
                                     invalid.insert(realisation->outPath);
-                                break;
-                            }
-                            if (!found) {
-                                // Some paths did not have a realisation, this must be built.
-                                knownOutputPaths = false;
-                                break;
                             }
                         }
+
+                        // Some paths did not have a realisation, this must be built.
+                        knownOutputPaths = missing.empty();
                     }
 
                     if (knownOutputPaths && settings.useSubstitutes && drvOptions.substitutesAllowed()) {
@@ -303,6 +344,25 @@ MissingPaths Store::queryMissing(const std::vector<DerivedPath> & targets)
             req.raw());
     };
 
+    /* Fetch the path infos of the top-level paths in one batch, so
+       that the validity checks in doPath() are answered from the
+       path info cache. */
+    {
+        StorePathSet topLevel;
+        for (auto & path : targets)
+            std::visit(
+                overloaded{
+                    [&](const DerivedPath::Opaque & bo) { topLevel.insert(bo.path); },
+                    [&](const DerivedPath::Built & bfd) {
+                        if (auto drvPathP = std::get_if<DerivedPath::Opaque>(&*bfd.drvPath))
+                            topLevel.insert(drvPathP->path);
+                    },
+                },
+                path.raw());
+        if (topLevel.size() > 1)
+            queryMultiplePathInfos(topLevel);
+    }
+
     for (auto & path : targets)
         pool.enqueue(std::bind(doPath, path));
 
@@ -313,25 +373,40 @@ MissingPaths Store::queryMissing(const std::vector<DerivedPath> & targets)
 
 StorePaths Store::topoSortPaths(const StorePathSet & paths)
 {
-    auto result = topoSort(paths, [&](const StorePath & path) {
+    /* Number the paths in their order in `paths`, and sort the graph
+       of ids. This gives the same result as `topoSort()` on `paths`. */
+    StorePathInterner ids;
+    ids.reserve(paths.size());
+    for (auto & path : paths)
+        ids.insert(path);
+
+    std::vector<std::vector<StorePathId>> edges(paths.size());
+    for (StorePathId id = 0; id < ids.size(); ++id) {
         try {
-            return queryPathInfo(path)->references;
+            for (auto & ref : queryPathInfo(ids[id])->references)
+                if (auto refId = ids.find(ref))
+                    edges[id].push_back(*refId);
         } catch (InvalidPath &) {
-            return StorePathSet();
         }
-    });
+    }
 
     return std::visit(
         overloaded{
-            [&](const Cycle<StorePath> & cycle) -> StorePaths {
+            [&](const Cycle<StorePathId> & cycle) -> StorePaths {
                 throw BuildError(
                     BuildResult::Failure::OutputRejected,
                     "cycle detected in the references of '%s' from '%s'",
-                    printStorePath(cycle.path),
-                    printStorePath(cycle.parent));
+                    printStorePath(ids[cycle.path]),
+                    printStorePath(ids[cycle.parent]));
             },
-            [](const auto & sorted) { return sorted; }},
-        result);
+            [&](const std::vector<StorePathId> & sorted) {
+                StorePaths res;
+                res.reserve(sorted.size());
+                for (auto id : sorted)
+                    res.push_back(ids[id]);
+                return res;
+            }},
+        topoSortDense(edges));
 }
 
 OutputPathMap resolveDerivedPath(Store & store, const DerivedPath::Built & bfd, Store * evalStore_)
@@ -0,0 +1,112 @@
+#include "nix/store/nar-delta.hh"
+#include "nix/store/local-store.hh"
+#include "nix/store/names.hh"
+#include "nix/util/content-defined-chunking.hh"
+
+#include <algorithm>
+#include <ranges>
+
+namespace nix {
+
+/**
+ * Both sides must chunk with the same parameters. The chunks are
+ * smaller than those of binary caches, since a rebuilt package
+ * typically differs in many small places.
+ */
+static ChunkingSink makeChunker(ChunkingSink::ChunkCallback onChunk)
+{
+    return ChunkingSink(std::move(onChunk), 16 * 1024, 64 * 1024, 256 * 1024);
+}
+
+static std::string chunkHash(std::string_view chunk)
+{
+    return hashString(HashAlgorithm::SHA256, chunk).to_string(HashFormat::Nix32, false);
+}
+
+/**
+ * Bases with a larger NAR are never used, since the receiver keeps the
+ * NAR of the base in memory while reconstructing.
+ */
+static constexpr uint64_t maxBaseSize = 1024 * 1024 * 1024;
+
+std::optional<StorePath> findDeltaBase(Store & store, const StorePath & path, uint64_t narSize)
+{
+    auto localStore = dynamic_cast<LocalStore *>(&store);
+    if (!localStore)
+        return std::nullopt;
+
+    DrvName name(path.name());
+
+    std::vector<std::pair<std::string, StorePath>> candidates;
+    for (auto & candidate : localStore->queryPathsWithName(name.name))
+        if (candidate != path)
+            if (DrvName candidateName(candidate.name()); candidateName.name == name.name)
+                candidates.emplace_back(candidateName.version, candidate);
+
+    /* Prefer the newest version, since it's likely the most similar. */
+    std::sort(candidates.begin(), candidates.end(), [](auto & a, auto & b) {
+        return compareVersions(a.first, b.first) > 0;
+    });
+
+    /* Only look at a few candidates, to bound the cost for common
+       names like 'source'. */
+    for (auto & [_, candidate] : candidates | std::views::take(16)) {
+        auto info = store.queryPathInfo(candidate);
+        if (info->narSize <= maxBaseSize && info->narSize >= narSize / 4 && info->narSize <= narSize * 4)
+            return candidate;
+    }
+
+    return std::nullopt;
+}
+
+StringSet getNarChunkHashes(Store & store, const StorePath & path)
+{
+    StringSet hashes;
+    auto chunker = makeChunker([&](std::string_view chunk) { hashes.insert(chunkHash(chunk)); });
+    store.narFromPath(path, chunker);
+    chunker.finish();
+    return hashes;
+}
+
+uint64_t writeNarDelta(Source & nar, const StringSet & baseChunks, Sink & delta)
+{
+    uint64_t bytesSaved = 0;
+    auto chunker = makeChunker([&](std::string_view chunk) {
+        auto hash = chunkHash(chunk);
+        if (baseChunks.contains(hash)) {
+            delta << 2 << hash;
+            bytesSaved += chunk.size();
+        } else
+            delta << 1 << chunk;
+    });
+    nar.drainInto(chunker);
+    chunker.finish();
+    delta << 0;
+    return bytesSaved;
+}
+
+void readNarDelta(Store & store, const StorePath & base, Source & delta, Sink & nar)
+{
+    std::map<std::string, std::string> baseChunks;
+    auto chunker = makeChunker([&](std::string_view chunk) { baseChunks.emplace(chunkHash(chunk), chunk); });
+    store.narFromPath(base, chunker);
+    chunker.finish();
+
+    while (true) {
+        auto tag = readNum<uint64_t>(delta);
+        if (tag == 0)
+            break;
+        else if (tag == 1)
+            nar(readString(delta));
+        else if (tag == 2) {
+            auto hash = readString(delta);
+            auto chunk = baseChunks.find(hash);
+            if (chunk == baseChunks.end())
+                throw Error("NAR delta refers to chunk '%s', which is not in '%s'", hash, store.printStorePath(base));
+            nar(chunk->second);
+        } else
+            throw SerialisationError("invalid NAR delta instruction %d", tag);
+    }
+}
+
+} // namespace nix
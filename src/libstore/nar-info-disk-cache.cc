@@ -1,6 +1,7 @@
 #include "nix/store/nar-info-disk-cache.hh"
 #include "nix/util/users.hh"
 #include "nix/util/sync.hh"
+#include "nix/util/sharded-cache.hh"
 #include "nix/store/sqlite.hh"
 #include "nix/store/globals.hh"
 
@@ -19,23 +20,14 @@ create table if not exists BinaryCaches (
     timestamp integer not null,
     storeDir  text not null,
     wantMassQuery integer not null,
-    priority  integer not null
+    priority  integer not null,
+    shardedLayout integer not null default 0
 );
 
 create table if not exists NARs (
     cache            integer not null,
     hashPart         text not null,
-    namePart         text,
-    url              text,
-    compression      text,
-    fileHash         text,
-    fileSize         integer,
-    narHash          text,
-    narSize          integer,
-    refs             text,
-    deriver          text,
-    sigs             text,
-    ca               text,
+    info             blob, -- NarInfo::toBinary(), or null if the path is absent
     timestamp        integer not null,
     present          integer not null,
     primary key (cache, hashPart),
@@ -74,6 +66,7 @@ public:
         Path storeDir;
         bool wantMassQuery;
         int priority;
+        bool shardedLayout;
     };
 
     struct State
@@ -86,7 +79,80 @@ public:
 
     Sync<State> _state;
 
-    NarInfoDiskCacheImpl(Path dbPath = (getCacheDir() / "binary-cache-v7.sqlite").string())
+    /**
+     * Maximum number of NAR info and realisation upserts to hold back
+     * before writing them to the database in a single transaction.
+     */
+    const size_t maxPendingNarInfos = 1024;
+
+    /**
+     * Maximum number of seconds to hold back upserts.
+     */
+    const time_t maxPendingAge = 5;
+
+    struct CachedNarInfo
+    {
+        /**
+         * Null if the path doesn't exist in the binary cache.
+         */
+        std::shared_ptr<const NarInfo> narInfo;
+
+        time_t timestamp;
+    };
+
+    /**
+     * In-memory cache of NAR info lookups and upserts, keyed on the
+     * binary cache URI and hash part, so that hits don't need to take
+     * the database lock.
+     */
+    ShardedCache<std::string, CachedNarInfo> narInfoCache{64 * 1024};
+
+    struct CachedRealisation
+    {
+        /**
+         * Null if the realisation doesn't exist in the binary cache.
+         */
+        std::shared_ptr<const Realisation> realisation;
+
+        time_t timestamp;
+    };
+
+    /**
+     * Like `narInfoCache`, for realisations, keyed on the binary cache
+     * URI and the `DrvOutput`.
+     */
+    ShardedCache<std::string, CachedRealisation> realisationCache{64 * 1024};
+
+    struct PendingNarInfo
+    {
+        std::string uri;
+        std::string hashPart;
+        std::shared_ptr<const ValidPathInfo> info;
+        time_t timestamp;
+    };
+
+    struct PendingRealisation
+    {
+        std::string uri;
+        DrvOutput id;
+        std::shared_ptr<const Realisation> realisation;
+        time_t timestamp;
+    };
+
+    struct Pending
+    {
+        std::vector<PendingNarInfo> narInfos;
+        std::vector<PendingRealisation> realisations;
+        time_t oldest = 0;
+    };
+
+    /**
+     * NAR info and realisation upserts that haven't been written to
+     * the database yet. Lock order: `_state` before `_pending`.
+     */
+    Sync<Pending> _pending;
+
+    NarInfoDiskCacheImpl(Path dbPath = (getCacheDir() / "binary-cache-v9.sqlite").string())
     {
         auto state(_state.lock());
 
@@ -100,23 +166,22 @@ public:
 
         state->insertCache.create(
             state->db,
-            "insert into BinaryCaches(url, timestamp, storeDir, wantMassQuery, priority) values (?1, ?2, ?3, ?4, ?5) on conflict (url) do update set timestamp = ?2, storeDir = ?3, wantMassQuery = ?4, priority = ?5 returning id;");
+            "insert into BinaryCaches(url, timestamp, storeDir, wantMassQuery, priority, shardedLayout) values (?1, ?2, ?3, ?4, ?5, ?6) on conflict (url) do update set timestamp = ?2, storeDir = ?3, wantMassQuery = ?4, priority = ?5, shardedLayout = ?6 returning id;");
 
         state->queryCache.create(
             state->db,
-            "select id, storeDir, wantMassQuery, priority from BinaryCaches where url = ? and timestamp > ?");
+            "select id, storeDir, wantMassQuery, priority, shardedLayout from BinaryCaches where url = ? and timestamp > ?");
 
         state->insertNAR.create(
             state->db,
-            "insert or replace into NARs(cache, hashPart, namePart, url, compression, fileHash, fileSize, narHash, "
-            "narSize, refs, deriver, sigs, ca, timestamp, present) values (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, 1)");
+            "insert or replace into NARs(cache, hashPart, info, timestamp, present) values (?, ?, ?, ?, 1)");
 
         state->insertMissingNAR.create(
             state->db, "insert or replace into NARs(cache, hashPart, timestamp, present) values (?, ?, ?, 0)");
 
         state->queryNAR.create(
             state->db,
-            "select present, namePart, url, compression, fileHash, fileSize, narHash, narSize, refs, deriver, sigs, ca from NARs where cache = ? and hashPart = ? and ((present = 0 and timestamp > ?) or (present = 1 and timestamp > ?))");
+            "select present, info, timestamp from NARs where cache = ? and hashPart = ? and ((present = 0 and timestamp > ?) or (present = 1 and timestamp > ?))");
 
         state->insertRealisation.create(
             state->db,
@@ -135,7 +200,7 @@ public:
         state->queryRealisation.create(
             state->db,
             R"(
-                select content from Realisations
+                select content, timestamp from Realisations
                     where cache = ? and outputId = ?  and
                         ((content is null and timestamp > ?) or
                          (content is not null and timestamp > ?))
@@ -168,6 +233,15 @@ public:
         });
     }
 
+    ~NarInfoDiskCacheImpl()
+    {
+        try {
+            flush();
+        } catch (...) {
+            ignoreExceptionInDestructor();
+        }
+    }
+
     Cache & getCache(State & state, const std::string & uri)
     {
         auto i = state.caches.find(uri);
@@ -178,6 +252,110 @@ public:
 
 private:
 
+    static std::string narInfoKey(const std::string & uri, const std::string & hashPart)
+    {
+        return uri + " " + hashPart;
+    }
+
+    static std::string realisationKey(const std::string & uri, const DrvOutput & id)
+    {
+        return uri + " " + id.to_string();
+    }
+
+    /**
+     * Write the pending upserts to the database in one transaction.
+     */
+    void flush()
+    {
+        retrySQLite<void>([&]() {
+            auto state(_state.lock());
+
+            auto [narInfos, realisations] = [&]() {
+                auto pending(_pending.lock());
+                pending->oldest = 0;
+                return std::pair{std::move(pending->narInfos), std::move(pending->realisations)};
+            }();
+
+            if (narInfos.empty() && realisations.empty())
+                return;
+
+            try {
+                SQLiteTxn txn(state->db);
+                for (auto & i : narInfos)
+                    writeNarInfo(*state, i);
+                for (auto & i : realisations)
+                    writeRealisation(*state, i);
+                txn.commit();
+            } catch (...) {
+                /* Put them back so that a retry or a later flush still
+                   writes them. */
+                auto pending(_pending.lock());
+                pending->narInfos.insert(
+                    pending->narInfos.begin(),
+                    std::make_move_iterator(narInfos.begin()),
+                    std::make_move_iterator(narInfos.end()));
+                pending->realisations.insert(
+                    pending->realisations.begin(),
+                    std::make_move_iterator(realisations.begin()),
+                    std::make_move_iterator(realisations.end()));
+                pending->oldest = time(0);
+                throw;
+            }
+
+            debug("wrote %d entries to the NAR info disk cache", narInfos.size() + realisations.size());
+        });
+    }
+
+    /**
+     * Queue an upsert, and flush the queue if it has grown too big or
+     * too old.
+     */
+    template<typename F>
+    void schedule(time_t now, F && add)
+    {
+        bool mustFlush;
+        {
+            auto pending(_pending.lock());
+            add(*pending);
+            if (!pending->oldest)
+                pending->oldest = now;
+            mustFlush = pending->narInfos.size() + pending->realisations.size() >= maxPendingNarInfos
+                        || pending->oldest <= now - maxPendingAge;
+        }
+
+        if (mustFlush)
+            flush();
+    }
+
+    void writeNarInfo(State & state, const PendingNarInfo & pending)
+    {
+        auto & cache(getCache(state, pending.uri));
+        auto & info = pending.info;
+
+        if (info) {
+            auto narInfo = std::dynamic_pointer_cast<const NarInfo>(info);
+            auto data = narInfo ? narInfo->toBinary() : NarInfo(*info).toBinary();
+            state.insertNAR.use()(cache.id)(pending.hashPart)((const unsigned char *) data.data(), data.size())(
+                    pending.timestamp)
+                .exec();
+        } else {
+            state.insertMissingNAR.use()(cache.id)(pending.hashPart) (pending.timestamp).exec();
+        }
+    }
+
+    void writeRealisation(State & state, const PendingRealisation & pending)
+    {
+        auto & cache(getCache(state, pending.uri));
+
+        if (pending.realisation)
+            state.insertRealisation
+                .use()(cache.id)(pending.id.to_string())(static_cast<nlohmann::json>(*pending.realisation).dump())(
+                    pending.timestamp)
+                .exec();
+        else
+            state.insertMissingRealisation.use()(cache.id)(pending.id.to_string())(pending.timestamp).exec();
+    }
+
     std::optional<Cache> queryCacheRaw(State & state, const std::string & uri)
     {
         auto i = state.caches.find(uri);
@@ -190,6 +368,7 @@ private:
                 .storeDir = queryCache.getStr(1),
                 .wantMassQuery = queryCache.getInt(2) != 0,
                 .priority = (int) queryCache.getInt(3),
+                .shardedLayout = queryCache.getInt(4) != 0,
             };
             state.caches.emplace(uri, cache);
         }
@@ -197,7 +376,8 @@ private:
     }
 
 public:
-    int createCache(const std::string & uri, const Path & storeDir, bool wantMassQuery, int priority) override
+    int createCache(
+        const std::string & uri, const Path & storeDir, bool wantMassQuery, int priority, bool shardedLayout) override
     {
         return retrySQLite<int>([&]() {
             auto state(_state.lock());
@@ -215,10 +395,11 @@ public:
                 .storeDir = storeDir,
                 .wantMassQuery = wantMassQuery,
                 .priority = priority,
+                .shardedLayout = shardedLayout,
             };
 
             {
-                auto r(state->insertCache.use()(uri)(time(0))(storeDir) (wantMassQuery) (priority));
+                auto r(state->insertCache.use()(uri)(time(0))(storeDir) (wantMassQuery) (priority) (shardedLayout));
                 if (!r.next()) {
                     unreachable();
                 }
@@ -239,13 +420,28 @@ public:
             auto cache(queryCacheRaw(*state, uri));
             if (!cache)
                 return std::nullopt;
-            return CacheInfo{.id = cache->id, .wantMassQuery = cache->wantMassQuery, .priority = cache->priority};
+            return CacheInfo{
+                .id = cache->id,
+                .wantMassQuery = cache->wantMassQuery,
+                .priority = cache->priority,
+                .shardedLayout = cache->shardedLayout,
+            };
         });
     }
 
     std::pair<Outcome, std::shared_ptr<NarInfo>>
     lookupNarInfo(const std::string & uri, const std::string & hashPart) override
     {
+        auto key = narInfoKey(uri, hashPart);
+
+        if (auto cached = narInfoCache.get(key)) {
+            auto now = time(0);
+            if (!cached->narInfo && cached->timestamp > now - (time_t) settings.ttlNegativeNarInfoCache)
+                return {oInvalid, 0};
+            if (cached->narInfo && cached->timestamp > now - (time_t) settings.ttlPositiveNarInfoCache)
+                return {oValid, std::make_shared<NarInfo>(*cached->narInfo)};
+        }
+
         return retrySQLite<std::pair<Outcome, std::shared_ptr<NarInfo>>>(
             [&]() -> std::pair<Outcome, std::shared_ptr<NarInfo>> {
                 auto state(_state.lock());
@@ -260,25 +456,23 @@ public:
                 if (!queryNAR.next())
                     return {oUnknown, 0};
 
-                if (!queryNAR.getInt(0))
+                if (!queryNAR.getInt(0)) {
+                    narInfoCache.upsert(key, {.narInfo = nullptr, .timestamp = queryNAR.getInt(2)});
                     return {oInvalid, 0};
+                }
+
+                std::shared_ptr<NarInfo> narInfo;
+                try {
+                    narInfo = std::make_shared<NarInfo>(NarInfo::fromBinary(cache.storeDir, queryNAR.getBlob(1)));
+                } catch (Error & e) {
+                    /* Treat undecodable entries as missing from the
+                       cache, so that they get fetched again. */
+                    debug("ignoring NAR info disk cache entry for '%s': %s", hashPart, e.msg());
+                    return {oUnknown, 0};
+                }
 
-                auto namePart = queryNAR.getStr(1);
-                auto narInfo = make_ref<NarInfo>(
-                    cache.storeDir, StorePath(hashPart + "-" + namePart), Hash::parseAnyPrefixed(queryNAR.getStr(6)));
-                narInfo->url = queryNAR.getStr(2);
-                narInfo->compression = queryNAR.getStr(3);
-                if (!queryNAR.isNull(4))
-                    narInfo->fileHash = Hash::parseAnyPrefixed(queryNAR.getStr(4));
-                narInfo->fileSize = queryNAR.getInt(5);
-                narInfo->narSize = queryNAR.getInt(7);
-                for (auto & r : tokenizeString<Strings>(queryNAR.getStr(8), " "))
-                    narInfo->references.insert(StorePath(r));
-                if (!queryNAR.isNull(9))
-                    narInfo->deriver = StorePath(queryNAR.getStr(9));
-                for (auto & sig : tokenizeString<Strings>(queryNAR.getStr(10), " "))
-                    narInfo->sigs.insert(sig);
-                narInfo->ca = ContentAddress::parseOpt(queryNAR.getStr(11));
+                narInfoCache.upsert(
+                    key, {.narInfo = std::make_shared<const NarInfo>(*narInfo), .timestamp = queryNAR.getInt(2)});
 
                 return {oValid, narInfo};
             });
@@ -287,6 +481,16 @@ public:
     std::pair<Outcome, std::shared_ptr<Realisation>>
     lookupRealisation(const std::string & uri, const DrvOutput & id) override
     {
+        auto key = realisationKey(uri, id);
+
+        if (auto cached = realisationCache.get(key)) {
+            auto now = time(0);
+            if (!cached->realisation && cached->timestamp > now - (time_t) settings.ttlNegativeNarInfoCache)
+                return {oInvalid, 0};
+            if (cached->realisation && cached->timestamp > now - (time_t) settings.ttlPositiveNarInfoCache)
+                return {oValid, std::make_shared<Realisation>(*cached->realisation)};
+        }
+
         return retrySQLite<std::pair<Outcome, std::shared_ptr<Realisation>>>(
             [&]() -> std::pair<Outcome, std::shared_ptr<Realisation>> {
                 auto state(_state.lock());
@@ -301,14 +505,19 @@ public:
                 if (!queryRealisation.next())
                     return {oUnknown, 0};
 
-                if (queryRealisation.isNull(0))
+                if (queryRealisation.isNull(0)) {
+                    realisationCache.upsert(key, {.realisation = nullptr, .timestamp = queryRealisation.getInt(1)});
                     return {oInvalid, 0};
+                }
 
                 try {
-                    return {
-                        oValid,
-                        std::make_shared<Realisation>(nlohmann::json::parse(queryRealisation.getStr(0))),
-                    };
+                    auto realisation =
+                        std::make_shared<Realisation>(nlohmann::json::parse(queryRealisation.getStr(0)));
+                    realisationCache.upsert(
+                        key,
+                        {.realisation = std::make_shared<const Realisation>(*realisation),
+                         .timestamp = queryRealisation.getInt(1)});
+                    return {oValid, realisation};
                 } catch (Error & e) {
                     e.addTrace({}, "while parsing the local disk cache");
                     throw;
@@ -319,54 +528,40 @@ public:
     void upsertNarInfo(
         const std::string & uri, const std::string & hashPart, std::shared_ptr<const ValidPathInfo> info) override
     {
-        retrySQLite<void>([&]() {
-            auto state(_state.lock());
-
-            auto & cache(getCache(*state, uri));
-
-            if (info) {
-
-                auto narInfo = std::dynamic_pointer_cast<const NarInfo>(info);
-
-                // assert(hashPart == storePathToHash(info->path));
+        auto now = time(0);
 
-                state->insertNAR
-                    .use()(cache.id)(hashPart) (std::string(info->path.name()))(
-                        narInfo ? narInfo->url : "", narInfo != 0)(narInfo ? narInfo->compression : "", narInfo != 0)(
-                        narInfo && narInfo->fileHash ? narInfo->fileHash->to_string(HashFormat::Nix32, true) : "",
-                        narInfo && narInfo->fileHash)(
-                        narInfo ? narInfo->fileSize : 0, narInfo != 0 && narInfo->fileSize)(info->narHash.to_string(
-                        HashFormat::Nix32, true))(info->narSize)(concatStringsSep(" ", info->shortRefs()))(
-                        info->deriver ? std::string(info->deriver->to_string()) : "", (bool) info->deriver)(
-                        concatStringsSep(" ", info->sigs))(renderContentAddress(info->ca))(time(0))
-                    .exec();
+        std::shared_ptr<const NarInfo> narInfo;
+        if (info) {
+            narInfo = std::dynamic_pointer_cast<const NarInfo>(info);
+            if (!narInfo)
+                narInfo = std::make_shared<const NarInfo>(*info);
+        }
+        narInfoCache.upsert(narInfoKey(uri, hashPart), {.narInfo = narInfo, .timestamp = now});
 
-            } else {
-                state->insertMissingNAR.use()(cache.id)(hashPart) (time(0)).exec();
-            }
+        /* Writing an entry per miss during a big queryMissing() run
+           would cost a commit each, so hold them back and write them
+           in batches. */
+        schedule(now, [&](Pending & pending) {
+            pending.narInfos.push_back({.uri = uri, .hashPart = hashPart, .info = info, .timestamp = now});
         });
     }
 
     void upsertRealisation(const std::string & uri, const Realisation & realisation) override
     {
-        retrySQLite<void>([&]() {
-            auto state(_state.lock());
-
-            auto & cache(getCache(*state, uri));
-
-            state->insertRealisation
-                .use()(cache.id)(realisation.id.to_string())(static_cast<nlohmann::json>(realisation).dump())(time(0))
-                .exec();
+        auto now = time(0);
+        auto r = std::make_shared<const Realisation>(realisation);
+        realisationCache.upsert(realisationKey(uri, realisation.id), {.realisation = r, .timestamp = now});
+        schedule(now, [&](Pending & pending) {
+            pending.realisations.push_back({.uri = uri, .id = realisation.id, .realisation = r, .timestamp = now});
         });
     }
 
     virtual void upsertAbsentRealisation(const std::string & uri, const DrvOutput & id) override
     {
-        retrySQLite<void>([&]() {
-            auto state(_state.lock());
-
-            auto & cache(getCache(*state, uri));
-            state->insertMissingRealisation.use()(cache.id)(id.to_string())(time(0)).exec();
+        auto now = time(0);
+        realisationCache.upsert(realisationKey(uri, id), {.realisation = nullptr, .timestamp = now});
+        schedule(now, [&](Pending & pending) {
+            pending.realisations.push_back({.uri = uri, .id = id, .realisation = nullptr, .timestamp = now});
         });
     }
 };
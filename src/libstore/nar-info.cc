@@ -4,9 +4,11 @@
 #include "nix/util/strings.hh"
 #include "nix/util/json-utils.hh"
 
+#include <cstring>
+
 namespace nix {
 
-NarInfo::NarInfo(const StoreDirConfig & store, const std::string & s, const std::string & whence)
+NarInfo::NarInfo(const StoreDirConfig & store, std::string_view s, std::string_view whence)
     : UnkeyedValidPathInfo(store, Hash::dummy)                                          // FIXME: hack
     , ValidPathInfo(StorePath::dummy, static_cast<const UnkeyedValidPathInfo &>(*this)) // FIXME: hack
     , UnkeyedNarInfo(static_cast<const UnkeyedValidPathInfo &>(*this))
@@ -20,7 +22,7 @@ NarInfo::NarInfo(const StoreDirConfig & store, const std::string & s, const std:
             std::string(reason) + (line > 0 ? " at line " + std::to_string(line) : ""));
     };
 
-    auto parseHashField = [&](const std::string & s) {
+    auto parseHashField = [&](std::string_view s) {
         try {
             return Hash::parseAnyPrefixed(s);
         } catch (BadHash &) {
@@ -31,6 +33,8 @@ NarInfo::NarInfo(const StoreDirConfig & store, const std::string & s, const std:
     bool havePath = false;
     bool haveNarHash = false;
 
+    /* Fields are parsed in place; only the values that are kept are
+       copied. */
     size_t pos = 0;
     while (pos < s.size()) {
 
@@ -38,13 +42,13 @@ NarInfo::NarInfo(const StoreDirConfig & store, const std::string & s, const std:
         if (colon == s.npos)
             throw corrupt("expecting ':'");
 
-        std::string name(s, pos, colon - pos);
+        auto name = s.substr(pos, colon - pos);
 
         size_t eol = s.find('\n', colon + 2);
         if (eol == s.npos)
             throw corrupt("expecting '\\n'");
 
-        std::string value(s, colon + 2, eol - colon - 2);
+        auto value = s.substr(colon + 2, eol - colon - 2);
 
         if (name == "StorePath") {
             path = store.parseStorePath(value);
@@ -69,16 +73,20 @@ NarInfo::NarInfo(const StoreDirConfig & store, const std::string & s, const std:
                 throw corrupt("invalid NarSize");
             narSize = *n;
         } else if (name == "References") {
-            auto refs = tokenizeString<Strings>(value, " ");
             if (!references.empty())
                 throw corrupt("extra References");
-            for (auto & r : refs)
-                references.insert(StorePath(r));
+            while (!value.empty()) {
+                auto space = value.find(' ');
+                auto ref = value.substr(0, space);
+                if (!ref.empty())
+                    references.insert(StorePath(ref));
+                value.remove_prefix(space == value.npos ? value.size() : space + 1);
+            }
         } else if (name == "Deriver") {
             if (value != "unknown-deriver")
                 deriver = StorePath(value);
         } else if (name == "Sig")
-            sigs.insert(value);
+            sigs.emplace(value);
         else if (name == "CA") {
             if (ca)
                 throw corrupt("extra CA");
@@ -107,31 +115,190 @@ NarInfo::NarInfo(const StoreDirConfig & store, const std::string & s, const std:
 std::string NarInfo::to_string(const StoreDirConfig & store) const
 {
     std::string res;
-    res += "StorePath: " + store.printStorePath(path) + "\n";
-    res += "URL: " + url + "\n";
+    res.reserve(512 + references.size() * 80 + sigs.size() * 120);
+
+    auto field = [&](std::string_view name, std::string_view value) {
+        res += name;
+        res += ": ";
+        res += value;
+        res += '\n';
+    };
+
+    field("StorePath", store.printStorePath(path));
+    field("URL", url);
     assert(compression != "");
-    res += "Compression: " + compression + "\n";
+    field("Compression", compression);
     assert(fileHash && fileHash->algo == HashAlgorithm::SHA256);
-    res += "FileHash: " + fileHash->to_string(HashFormat::Nix32, true) + "\n";
-    res += "FileSize: " + std::to_string(fileSize) + "\n";
+    field("FileHash", fileHash->to_string(HashFormat::Nix32, true));
+    field("FileSize", std::to_string(fileSize));
     assert(narHash.algo == HashAlgorithm::SHA256);
-    res += "NarHash: " + narHash.to_string(HashFormat::Nix32, true) + "\n";
-    res += "NarSize: " + std::to_string(narSize) + "\n";
+    field("NarHash", narHash.to_string(HashFormat::Nix32, true));
+    field("NarSize", std::to_string(narSize));
 
-    res += "References: " + concatStringsSep(" ", shortRefs()) + "\n";
+    res += "References:";
+    for (auto & ref : references) {
+        res += ' ';
+        res += ref.to_string();
+    }
+    if (references.empty())
+        res += ' ';
+    res += '\n';
 
     if (deriver)
-        res += "Deriver: " + std::string(deriver->to_string()) + "\n";
+        field("Deriver", deriver->to_string());
 
     for (const auto & sig : sigs)
-        res += "Sig: " + sig + "\n";
+        field("Sig", sig);
 
     if (ca)
-        res += "CA: " + renderContentAddress(*ca) + "\n";
+        field("CA", renderContentAddress(*ca));
+
+    return res;
+}
+
+namespace {
+
+/**
+ * Version of the binary encoding, so that the disk cache can reject
+ * entries written by another version of Nix.
+ */
+constexpr uint8_t binaryVersion = 1;
+
+struct BinaryWriter
+{
+    std::string & out;
+
+    void num(uint64_t n)
+    {
+        /* LEB128, so that sizes and counts mostly take one byte. */
+        do {
+            uint8_t byte = n & 0x7f;
+            n >>= 7;
+            out += (char) (byte | (n ? 0x80 : 0));
+        } while (n);
+    }
+
+    void str(std::string_view s)
+    {
+        num(s.size());
+        out += s;
+    }
+
+    void hash(const std::optional<Hash> & h)
+    {
+        out += h ? (char) h->algo : '\0';
+        if (h)
+            out.append((const char *) h->hash, h->hashSize);
+    }
+};
 
+struct BinaryReader
+{
+    std::string_view in;
+
+    [[noreturn]] void corrupt()
+    {
+        throw Error("binary NAR info is corrupt");
+    }
+
+    uint64_t num()
+    {
+        uint64_t n = 0;
+        for (unsigned int shift = 0; shift < 64; shift += 7) {
+            if (in.empty())
+                corrupt();
+            uint8_t byte = in[0];
+            in.remove_prefix(1);
+            n |= (uint64_t) (byte & 0x7f) << shift;
+            if (!(byte & 0x80))
+                return n;
+        }
+        corrupt();
+    }
+
+    std::string_view str()
+    {
+        auto size = num();
+        if (size > in.size())
+            corrupt();
+        auto s = in.substr(0, size);
+        in.remove_prefix(size);
+        return s;
+    }
+
+    std::optional<Hash> hash()
+    {
+        if (in.empty())
+            corrupt();
+        auto algo = (HashAlgorithm) in[0];
+        in.remove_prefix(1);
+        if (algo == (HashAlgorithm) 0)
+            return std::nullopt;
+        if (algo < HashAlgorithm::MD5 || algo > HashAlgorithm::BLAKE3)
+            corrupt();
+        Hash h(algo);
+        if (h.hashSize > in.size())
+            corrupt();
+        memcpy(h.hash, in.data(), h.hashSize);
+        in.remove_prefix(h.hashSize);
+        return h;
+    }
+};
+
+} // namespace
+
+std::string NarInfo::toBinary() const
+{
+    std::string res;
+    res.reserve(256 + references.size() * 64);
+    BinaryWriter w{res};
+    res += (char) binaryVersion;
+    w.str(path.to_string());
+    w.hash(narHash);
+    w.num(narSize);
+    w.num(references.size());
+    for (auto & ref : references)
+        w.str(ref.to_string());
+    w.str(deriver ? deriver->to_string() : "");
+    w.num(sigs.size());
+    for (auto & sig : sigs)
+        w.str(sig);
+    w.str(ca ? renderContentAddress(*ca) : "");
+    w.str(url);
+    w.str(compression);
+    w.hash(fileHash);
+    w.num(fileSize);
     return res;
 }
 
+NarInfo NarInfo::fromBinary(std::string storeDir, std::string_view data)
+{
+    BinaryReader r{data};
+    if (data.empty() || (uint8_t) data[0] != binaryVersion)
+        r.corrupt();
+    r.in.remove_prefix(1);
+    auto path = StorePath(r.str());
+    auto narHash = r.hash();
+    if (!narHash)
+        r.corrupt();
+    NarInfo info(std::move(storeDir), std::move(path), *narHash);
+    info.narSize = r.num();
+    for (auto n = r.num(); n; --n)
+        info.references.insert(StorePath(r.str()));
+    if (auto deriver = r.str(); !deriver.empty())
+        info.deriver = StorePath(deriver);
+    for (auto n = r.num(); n; --n)
+        info.sigs.emplace(r.str());
+    info.ca = ContentAddress::parseOpt(r.str());
+    info.url = r.str();
+    info.compression = r.str();
+    info.fileHash = r.hash();
+    info.fileSize = r.num();
+    if (!r.in.empty())
+        r.corrupt();
+    return info;
+}
+
 nlohmann::json
 UnkeyedNarInfo::toJSON(const StoreDirConfig * store, bool includeImpureInfo, PathInfoJsonFormat format) const
 {
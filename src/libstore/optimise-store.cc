@@ -3,9 +3,12 @@
 #include "nix/util/signals.hh"
 #include "nix/store/posix-fs-canonicalise.hh"
 #include "nix/util/posix-source-accessor.hh"
+#include "nix/util/thread-pool.hh"
+#include "nix/store/store-metrics.hh"
 
 #include <cstdlib>
 #include <cstring>
+#include <thread>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -13,6 +16,12 @@
 #include <stdio.h>
 #include <regex>
 
+#ifdef __linux__
+#  include <fcntl.h>
+#  include <linux/fs.h>
+#  include <sys/ioctl.h>
+#endif
+
 #include "store-config-private.hh"
 
 namespace nix {
@@ -45,6 +54,54 @@ struct MakeReadOnly
     }
 };
 
+#ifdef FIDEDUPERANGE
+/**
+ * Make `dst` share the data of `src`, which has the same
+ * contents. The kernel compares the contents before sharing them.
+ *
+ * @return Whether this is supported for these files.
+ */
+static bool dedupeFile(const Path & src, const Path & dst, off_t size)
+{
+    AutoCloseFD srcFd = open(src.c_str(), O_RDONLY | O_CLOEXEC);
+    if (!srcFd)
+        throw SysError("opening '%s'", src);
+    AutoCloseFD dstFd = open(dst.c_str(), O_RDONLY | O_CLOEXEC);
+    if (!dstFd)
+        throw SysError("opening '%s'", dst);
+
+    std::vector<char> buf(sizeof(struct file_dedupe_range) + sizeof(struct file_dedupe_range_info));
+    auto range = reinterpret_cast<struct file_dedupe_range *>(buf.data());
+
+    /* The kernel may dedupe less than requested, so loop. */
+    for (off_t offset = 0; offset < size;) {
+        std::fill(buf.begin(), buf.end(), 0);
+        range->src_offset = offset;
+        range->src_length = size - offset;
+        range->dest_count = 1;
+        range->info[0].dest_fd = dstFd.get();
+        range->info[0].dest_offset = offset;
+
+        if (ioctl(srcFd.get(), FIDEDUPERANGE, range) == -1) {
+            if (errno == EOPNOTSUPP || errno == ENOTTY || errno == EINVAL || errno == EXDEV || errno == EPERM)
+                return false;
+            throw SysError("deduplicating '%s' with '%s'", dst, src);
+        }
+
+        if (range->info[0].status != FILE_DEDUPE_RANGE_SAME) {
+            debug("cannot deduplicate '%s' with '%s': status %d", dst, src, range->info[0].status);
+            return false;
+        }
+
+        if (range->info[0].bytes_deduped == 0)
+            break;
+        offset += range->info[0].bytes_deduped;
+    }
+
+    return true;
+}
+#endif
+
 LocalStore::InodeHash LocalStore::loadInodeHash()
 {
     debug("loading hash inodes in memory");
@@ -68,7 +125,7 @@ LocalStore::InodeHash LocalStore::loadInodeHash()
     return inodeHash;
 }
 
-Strings LocalStore::readDirectoryIgnoringInodes(const Path & path, const InodeHash & inodeHash)
+Strings LocalStore::readDirectoryIgnoringInodes(const Path & path, SharedSync<InodeHash> & inodeHash)
 {
     Strings names;
 
@@ -80,7 +137,7 @@ Strings LocalStore::readDirectoryIgnoringInodes(const Path & path, const InodeHa
     while (errno = 0, dirent = readdir(dir.get())) { /* sic */
         checkInterrupt();
 
-        if (inodeHash.count(dirent->d_ino)) {
+        if (inodeHash.readLock()->count(dirent->d_ino)) {
             debug("'%1%' is already linked", dirent->d_name);
             continue;
         }
@@ -97,7 +154,7 @@ Strings LocalStore::readDirectoryIgnoringInodes(const Path & path, const InodeHa
 }
 
 void LocalStore::optimisePath_(
-    Activity * act, OptimiseStats & stats, const Path & path, InodeHash & inodeHash, RepairFlag repair)
+    Activity * act, OptimiseStats & stats, const Path & path, SharedSync<InodeHash> & inodeHash, RepairFlag repair)
 {
     checkInterrupt();
 
@@ -141,7 +198,7 @@ void LocalStore::optimisePath_(
     }
 
     /* This can still happen on top-level files. */
-    if (st.st_nlink > 1 && inodeHash.count(st.st_ino)) {
+    if (st.st_nlink > 1 && inodeHash.readLock()->count(st.st_ino)) {
         debug("'%s' is already linked, with %d other file(s)", path, st.st_nlink - 2);
         return;
     }
@@ -190,7 +247,7 @@ void LocalStore::optimisePath_(
         /* Nope, create a hard link in the links directory. */
         try {
             std::filesystem::create_hard_link(path, linkPath);
-            inodeHash.insert(st.st_ino);
+            inodeHash.lock()->insert(st.st_ino);
         } catch (std::filesystem::filesystem_error & e) {
             if (e.code() == std::errc::file_exists) {
                 /* Fall through if another process created ‘linkPath’ before
@@ -220,6 +277,30 @@ void LocalStore::optimisePath_(
         return;
     }
 
+    if (settings.optimiseStoreReflinks) {
+#ifdef FIDEDUPERANGE
+        /* Share the data of the file rather than the file itself.
+           The link in the links directory is still a hard link to
+           the first copy, which serves as the source for later ones. */
+        if (!S_ISREG(st.st_mode) || st.st_size == 0)
+            return;
+
+        printMsg(lvlTalkative, "deduplicating '%1%' with %2%", path, linkPath);
+
+        if (!dedupeFile(linkPath.string(), path, st.st_size))
+            return;
+
+        inodeHash.lock()->insert(st.st_ino);
+
+        stats.filesLinked++;
+        stats.bytesFreed += st.st_size;
+
+        if (act)
+            act->result(resFileLinked, st.st_size, st.st_blocks);
+#endif
+        return;
+    }
+
     printMsg(lvlTalkative, "linking '%1%' to %2%", path, linkPath);
 
     /* Make the containing directory writable, but only if it's not
@@ -238,7 +319,7 @@ void LocalStore::optimisePath_(
 
     try {
         std::filesystem::create_hard_link(linkPath, tempLink);
-        inodeHash.insert(st.st_ino);
+        inodeHash.lock()->insert(st.st_ino);
     } catch (std::filesystem::filesystem_error & e) {
         if (e.code() == std::errc::too_many_links) {
             /* Too many links to the same file (>= 32000 on most file
@@ -291,23 +372,50 @@ void LocalStore::optimiseStore(OptimiseStats & stats)
     Activity act(*logger, actOptimiseStore);
 
     auto paths = queryAllValidPaths();
-    InodeHash inodeHash = loadInodeHash();
+    auto optimised = queryOptimisedPaths();
+
+    act.progress(optimised.size(), paths.size());
 
-    act.progress(0, paths.size());
+    /* Reading the links directory can take a long time, so don't
+       bother if there's nothing to do. */
+    SharedSync<InodeHash> inodeHash;
+    if (optimised.size() < paths.size())
+        *inodeHash.lock() = loadInodeHash();
 
-    uint64_t done = 0;
+    Sync<std::pair<OptimiseStats, uint64_t>> progress_{{stats, optimised.size()}};
+
+    /* Optimise paths in parallel. Races on the links directory are
+       handled in the same way as those with other processes. */
+    ThreadPool pool;
 
     for (auto & i : paths) {
-        addTempRoot(i);
-        if (!isValidPath(i))
-            continue; /* path was GC'ed, probably */
-        {
-            Activity act(*logger, lvlTalkative, actUnknown, fmt("optimising path '%s'", printStorePath(i)));
-            optimisePath_(&act, stats, config->realStoreDir + "/" + std::string(i.to_string()), inodeHash, NoRepair);
-        }
-        done++;
-        act.progress(done, paths.size());
+        if (optimised.contains(i))
+            continue;
+        pool.enqueue([&, i]() {
+            OptimiseStats pathStats;
+            addTempRoot(i);
+            if (isValidPath(i)) { /* otherwise the path was GC'ed, probably */
+                {
+                    Activity act(*logger, lvlTalkative, actUnknown, fmt("optimising path '%s'", printStorePath(i)));
+                    optimisePath_(
+                        &act, pathStats, config->realStoreDir + "/" + std::string(i.to_string()), inodeHash, NoRepair);
+                }
+                markOptimised(i);
+            }
+            uint64_t done;
+            {
+                auto progress(progress_.lock());
+                progress->first.filesLinked += pathStats.filesLinked;
+                progress->first.bytesFreed += pathStats.bytesFreed;
+                done = ++progress->second;
+            }
+            act.progress(done, paths.size());
+        });
     }
+
+    pool.process();
+
+    stats = progress_.lock()->first;
 }
 
 void LocalStore::optimiseStore()
@@ -322,10 +430,79 @@ void LocalStore::optimiseStore()
 void LocalStore::optimisePath(const Path & path, RepairFlag repair)
 {
     OptimiseStats stats;
-    InodeHash inodeHash;
+    SharedSync<InodeHash> inodeHash;
 
     if (settings.autoOptimiseStore)
         optimisePath_(nullptr, stats, path, inodeHash, repair);
 }
 
+void LocalStore::optimisePathLater(const StorePath & path, RepairFlag repair)
+{
+    if (!settings.autoOptimiseStore)
+        return;
+
+    if (repair) {
+        optimisePath(toRealPath(path), repair);
+        markOptimised(path);
+        return;
+    }
+
+    if (auto metrics = getStoreMetrics()) {
+        metrics->optimiseQueued++;
+        metrics->optimiseBacklog++;
+    }
+
+    auto queue(_optimiseQueue.lock());
+    queue->paths.push_back(path);
+    if (queue->workers < std::max(settings.autoOptimiseStoreJobs.get(), 1U)) {
+        queue->workers++;
+        std::thread([this]() { optimiseQueuedPaths(); }).detach();
+    }
+}
+
+void LocalStore::optimiseQueuedPaths()
+{
+    while (true) {
+        std::optional<StorePath> path;
+        {
+            auto queue(_optimiseQueue.lock());
+            if (queue->paths.empty()) {
+                queue->workers--;
+                /* Notify while holding the lock, so that the destructor
+                   can't destroy the condition variable under us. */
+                optimiseWorkerExited.notify_all();
+                return;
+            }
+            path = std::move(queue->paths.front());
+            queue->paths.pop_front();
+        }
+
+        /* ~LocalStore() waits for us, so avoid virtual calls, which
+           could end up in a subclass that has already been destroyed. */
+        OptimiseStats stats;
+        try {
+            /* Keep the garbage collector from deleting the path while
+               we're linking its files, and skip it if it has been
+               deleted already. */
+            LocalStore::addTempRoot(*path);
+            if (LocalStore::isValidPathUncached(*path)) {
+                SharedSync<InodeHash> inodeHash;
+                optimisePath_(
+                    nullptr, stats, config->realStoreDir + "/" + std::string(path->to_string()), inodeHash, NoRepair);
+                markOptimised(*path);
+            }
+        } catch (Interrupted &) {
+            /* Leave the remaining paths to `nix-store --optimise`. */
+        } catch (std::exception & e) {
+            warn("cannot optimise '%s': %s", printStorePath(*path), e.what());
+        }
+
+        if (auto metrics = getStoreMetrics()) {
+            metrics->optimiseBacklog--;
+            metrics->optimiseFilesLinked += stats.filesLinked;
+            metrics->optimiseBytesFreed += stats.bytesFreed;
+        }
+    }
+}
+
 } // namespace nix
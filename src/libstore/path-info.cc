@@ -5,6 +5,7 @@
 #include "nix/util/json-utils.hh"
 #include "nix/util/comparator.hh"
 #include "nix/util/strings.hh"
+#include "nix/util/thread-pool.hh"
 
 namespace nix {
 
@@ -134,6 +135,24 @@ bool ValidPathInfo::checkSignature(
     return verifyDetached(fingerprint(store), sig, publicKeys);
 }
 
+std::vector<size_t> checkSignatures(
+    const StoreDirConfig & store, const std::vector<const ValidPathInfo *> & infos, const PublicKeys & publicKeys)
+{
+    std::vector<size_t> res(infos.size(), 0);
+
+    if (infos.size() == 1) {
+        res[0] = infos[0]->checkSignatures(store, publicKeys);
+        return res;
+    }
+
+    ThreadPool pool;
+    for (size_t i = 0; i < infos.size(); ++i)
+        pool.enqueue([&, i]() { res[i] = infos[i]->checkSignatures(store, publicKeys); });
+    pool.process();
+
+    return res;
+}
+
 Strings ValidPathInfo::shortRefs() const
 {
     Strings refs;
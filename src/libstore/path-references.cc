@@ -4,12 +4,15 @@
 #include "nix/util/source-accessor.hh"
 #include "nix/util/canon-path.hh"
 #include "nix/util/logging.hh"
+#include "nix/util/sync.hh"
+#include "nix/util/thread-pool.hh"
 
 #include <map>
 #include <cstdlib>
 #include <mutex>
 #include <algorithm>
 #include <functional>
+#include <optional>
 
 namespace nix {
 
@@ -58,36 +61,115 @@ StorePathSet scanForReferences(Sink & toTee, const Path & path, const StorePathS
     return refsSink.getResultPaths();
 }
 
+StorePathSet scanForReferences(const Path & path, const StorePathSet & refs)
+{
+    auto accessor = makeFSSourceAccessor(path);
+
+    if (refs.empty())
+        return {};
+
+    Sync<StorePathSet> found;
+
+    /* Once every reference has been found, there is no point in
+       scanning the remaining files. */
+    auto allFound = [&]() { return found.lock()->size() == refs.size(); };
+
+    auto scan = [&](std::string_view s) {
+        auto sink = PathRefScanSink::fromPaths(refs);
+        sink(s);
+        auto res = sink.getResultPaths();
+        if (!res.empty())
+            found.lock()->insert(res.begin(), res.end());
+    };
+
+    ThreadPool pool;
+
+    auto walk = [&](this auto & self, const CanonPath & subpath) -> void {
+        if (allFound())
+            return;
+
+        auto stat = accessor->lstat(subpath);
+
+        switch (stat.type) {
+        case SourceAccessor::tRegular:
+            pool.enqueue([&, subpath]() {
+                if (allFound())
+                    return;
+                auto sink = PathRefScanSink::fromPaths(refs);
+                accessor->readFile(subpath, sink);
+                auto res = sink.getResultPaths();
+                if (!res.empty())
+                    found.lock()->insert(res.begin(), res.end());
+            });
+            break;
+
+        case SourceAccessor::tDirectory:
+            for (const auto & [name, entryType] : accessor->readDirectory(subpath)) {
+                scan(name);
+                self(subpath / name);
+            }
+            break;
+
+        case SourceAccessor::tSymlink:
+            scan(accessor->readLink(subpath));
+            break;
+
+        default:
+            throw Error("file '%s' has an unsupported type", accessor->showPath(subpath));
+        }
+    };
+
+    walk(CanonPath::root);
+
+    pool.process();
+
+    return std::move(*found.lock());
+}
+
 void scanForReferencesDeep(
     SourceAccessor & accessor,
     const CanonPath & rootPath,
     const StorePathSet & refs,
     std::function<void(FileRefScanResult)> callback)
 {
+    /* Files are scanned in parallel, but `callback` is called from
+       this thread, in the order in which the walk found the files. */
+    Sync<std::vector<std::optional<FileRefScanResult>>> results_;
+
+    ThreadPool pool;
+
+    auto report = [&](size_t slot, const CanonPath & path, StorePathSet && foundRefs) {
+        if (foundRefs.empty())
+            return;
+        debug("scanForReferencesDeep: found %d references in %s", foundRefs.size(), path.abs());
+        (*results_.lock())[slot] = FileRefScanResult{.filePath = path, .foundRefs = std::move(foundRefs)};
+    };
+
+    auto newSlot = [&]() {
+        auto results(results_.lock());
+        results->emplace_back();
+        return results->size() - 1;
+    };
+
     // Recursive tree walker
     auto walk = [&](this auto & self, const CanonPath & path) -> void {
         auto stat = accessor.lstat(path);
 
         switch (stat.type) {
         case SourceAccessor::tRegular: {
-            // Create a fresh sink for each file to independently detect references.
-            // RefScanSink accumulates found hashes globally - once a hash is found,
-            // it remains in the result set. If we reused the same sink across files,
-            // we couldn't distinguish which files contain which references, as a hash
-            // found in an earlier file wouldn't be reported when found in later files.
-            PathRefScanSink sink = PathRefScanSink::fromPaths(refs);
-
-            // Scan this file by streaming its contents through the sink
-            accessor.readFile(path, sink);
-
-            // Get the references found in this file
-            auto foundRefs = sink.getResultPaths();
-
-            // Report if we found anything in this file
-            if (!foundRefs.empty()) {
-                debug("scanForReferencesDeep: found %d references in %s", foundRefs.size(), path.abs());
-                callback(FileRefScanResult{.filePath = path, .foundRefs = std::move(foundRefs)});
-            }
+            pool.enqueue([&, path, slot{newSlot()}]() {
+                // Create a fresh sink for each file to independently detect references.
+                // RefScanSink accumulates found hashes globally - once a hash is found,
+                // it remains in the result set. If we reused the same sink across files,
+                // we couldn't distinguish which files contain which references, as a hash
+                // found in an earlier file wouldn't be reported when found in later files.
+                PathRefScanSink sink = PathRefScanSink::fromPaths(refs);
+
+                // Scan this file by streaming its contents through the sink
+                accessor.readFile(path, sink);
+
+                report(slot, path, sink.getResultPaths());
+            });
             break;
         }
 
@@ -108,13 +190,7 @@ void scanForReferencesDeep(
             auto target = accessor.readLink(path);
             sink(std::string_view(target));
 
-            // Get the references found in this symlink target
-            auto foundRefs = sink.getResultPaths();
-
-            if (!foundRefs.empty()) {
-                debug("scanForReferencesDeep: found %d references in symlink %s", foundRefs.size(), path.abs());
-                callback(FileRefScanResult{.filePath = path, .foundRefs = std::move(foundRefs)});
-            }
+            report(newSlot(), path, sink.getResultPaths());
             break;
         }
 
@@ -130,6 +206,12 @@ void scanForReferencesDeep(
 
     // Start the recursive walk from the root
     walk(rootPath);
+
+    pool.process();
+
+    for (auto & result : *results_.lock())
+        if (result)
+            callback(std::move(*result));
 }
 
 std::map<CanonPath, StorePathSet>
@@ -4,31 +4,217 @@
 #include "nix/util/base-nix-32.hh"
 
 #include <map>
+#include <bit>
 #include <cstdlib>
+#include <cstring>
 #include <mutex>
 #include <algorithm>
+#include <limits>
+
+#if defined(__x86_64__)
+#  include <immintrin.h>
+#elif defined(__aarch64__)
+#  include <arm_neon.h>
+#endif
 
 namespace nix {
 
-static constexpr auto refLength = StorePath::HashLen;
+/**
+ * Set bit `j` of `out[k]` if byte `64 * k + j` of `p` is a base-32
+ * character, for `nBlocks` blocks of 64 bytes.
+ */
+using ClassifyFn = void (*)(const char * p, size_t nBlocks, uint64_t * out);
 
-static void search(std::string_view s, StringSet & hashes, StringSet & seen)
+static void classifyScalar(const char * p, size_t nBlocks, uint64_t * out)
 {
-    for (size_t i = 0; i + refLength <= s.size();) {
-        int j;
-        bool match = true;
-        for (j = refLength - 1; j >= 0; --j)
-            if (!BaseNix32::lookupReverse(s[i + j])) {
-                i += j + 1;
-                match = false;
+    for (size_t k = 0; k < nBlocks; ++k, p += 64) {
+        uint64_t bits = 0;
+        for (size_t j = 0; j < 64; ++j)
+            bits |= uint64_t(BaseNix32::lookupReverse(p[j]).has_value()) << j;
+        out[k] = bits;
+    }
+}
+
+/* The base-32 alphabet consists of these ranges of characters. A byte
+   is in the range [lo, lo + len] iff `byte - lo <= len`, as an unsigned
+   comparison. */
+static constexpr std::pair<char, char> nix32Ranges[] = {
+    {'0', '9' - '0'},
+    {'a', 'd' - 'a'},
+    {'f', 'n' - 'f'},
+    {'p', 's' - 'p'},
+    {'v', 'z' - 'v'},
+};
+
+#if defined(__x86_64__)
+
+static inline uint64_t classify16Sse2(const char * p)
+{
+    auto x = _mm_loadu_si128((const __m128i *) p);
+    auto valid = _mm_setzero_si128();
+    for (auto [lo, len] : nix32Ranges) {
+        auto d = _mm_sub_epi8(x, _mm_set1_epi8(lo));
+        auto l = _mm_set1_epi8(len);
+        valid = _mm_or_si128(valid, _mm_cmpeq_epi8(_mm_min_epu8(d, l), d));
+    }
+    return uint16_t(_mm_movemask_epi8(valid));
+}
+
+static void classifySse2(const char * p, size_t nBlocks, uint64_t * out)
+{
+    for (size_t k = 0; k < nBlocks; ++k, p += 64)
+        out[k] = classify16Sse2(p) | classify16Sse2(p + 16) << 16 | classify16Sse2(p + 32) << 32
+                 | classify16Sse2(p + 48) << 48;
+}
+
+__attribute__((target("avx2"))) static inline uint64_t classify32Avx2(const char * p)
+{
+    auto x = _mm256_loadu_si256((const __m256i *) p);
+    auto valid = _mm256_setzero_si256();
+    for (auto [lo, len] : nix32Ranges) {
+        auto d = _mm256_sub_epi8(x, _mm256_set1_epi8(lo));
+        auto l = _mm256_set1_epi8(len);
+        valid = _mm256_or_si256(valid, _mm256_cmpeq_epi8(_mm256_min_epu8(d, l), d));
+    }
+    return uint32_t(_mm256_movemask_epi8(valid));
+}
+
+__attribute__((target("avx2"))) static void classifyAvx2(const char * p, size_t nBlocks, uint64_t * out)
+{
+    for (size_t k = 0; k < nBlocks; ++k, p += 64)
+        out[k] = classify32Avx2(p) | classify32Avx2(p + 32) << 32;
+}
+
+static ClassifyFn getClassifier()
+{
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return classifyAvx2;
+    return classifySse2;
+}
+
+#elif defined(__aarch64__)
+
+static inline uint64_t classify16Neon(const char * p)
+{
+    auto x = vld1q_u8((const uint8_t *) p);
+    auto valid = vdupq_n_u8(0);
+    for (auto [lo, len] : nix32Ranges)
+        valid = vorrq_u8(valid, vcleq_u8(vsubq_u8(x, vdupq_n_u8(lo)), vdupq_n_u8(len)));
+    /* NEON has no movemask, so weigh each byte by its bit and add up
+       each half. */
+    static const uint8_t weights[16] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+    auto m = vandq_u8(valid, vld1q_u8(weights));
+    return uint64_t(vaddv_u8(vget_low_u8(m))) | uint64_t(vaddv_u8(vget_high_u8(m))) << 8;
+}
+
+static void classifyNeon(const char * p, size_t nBlocks, uint64_t * out)
+{
+    for (size_t k = 0; k < nBlocks; ++k, p += 64)
+        out[k] = classify16Neon(p) | classify16Neon(p + 16) << 16 | classify16Neon(p + 32) << 32
+                 | classify16Neon(p + 48) << 48;
+}
+
+static ClassifyFn getClassifier()
+{
+    return classifyNeon;
+}
+
+#else
+
+static ClassifyFn getClassifier()
+{
+    return classifyScalar;
+}
+
+#endif
+
+static const ClassifyFn classify = getClassifier();
+
+/**
+ * Compute a bitmap of the base-32 characters in `s`, with an extra zero
+ * word so that a 32-bit window can always be read from two words.
+ */
+static void classifyString(std::string_view s, std::vector<uint64_t> & bitmap)
+{
+    auto nBlocks = s.size() / 64;
+    bitmap.resize(nBlocks + 2);
+    classify(s.data(), nBlocks, bitmap.data());
+    bitmap[nBlocks] = 0;
+    for (size_t j = nBlocks * 64; j < s.size(); ++j)
+        bitmap[nBlocks] |= uint64_t(BaseNix32::lookupReverse(s[j]).has_value()) << (j % 64);
+    bitmap[nBlocks + 1] = 0;
+}
+
+static inline uint32_t bitmapWindow(const std::vector<uint64_t> & bitmap, size_t i)
+{
+    auto w = i / 64, b = i % 64;
+    return uint32_t(bitmap[w] >> b | (b ? bitmap[w + 1] << (64 - b) : 0));
+}
+
+RefScanSink::RefScanSink(StringSet && hashes)
+{
+    for (auto & hash : hashes)
+        if (hash.size() == refLength) {
+            auto & h = this->hashes.emplace_back();
+            std::memcpy(h.data(), hash.data(), refLength);
+        }
+    found.resize(this->hashes.size());
+
+    size_t tableSize = 2;
+    tableShift = 63;
+    while (tableSize < 2 * this->hashes.size()) {
+        tableSize *= 2;
+        --tableShift;
+    }
+    table.resize(tableSize);
+
+    auto slotFor = [&](const char * p) {
+        /* The hashes are random, so their first 8 bytes make a fine
+           key. */
+        uint64_t key;
+        std::memcpy(&key, p, sizeof(key));
+        return (key * 0x9e3779b97f4a7c15ULL) >> tableShift;
+    };
+
+    for (uint32_t i = 0; i < this->hashes.size(); ++i)
+        for (auto slot = slotFor(this->hashes[i].data());; slot = (slot + 1) & (tableSize - 1))
+            if (!table[slot]) {
+                table[slot] = i + 1;
                 break;
             }
-        if (!match)
+}
+
+void RefScanSink::search(std::string_view s)
+{
+    if (s.size() < refLength)
+        return;
+
+    classifyString(s, bitmap);
+
+    for (size_t i = 0; i + refLength <= s.size();) {
+        auto window = bitmapWindow(bitmap, i);
+
+        /* Skip past the last non-base-32 character in the window. */
+        if (window != 0xffffffff) {
+            i += 32 - std::countl_zero(uint32_t(~window));
             continue;
-        std::string ref(s.substr(i, refLength));
-        if (hashes.erase(ref)) {
-            debug("found reference to '%1%' at offset '%2%'", ref, i);
-            seen.insert(ref);
+        }
+
+        uint64_t key;
+        std::memcpy(&key, s.data() + i, sizeof(key));
+        for (auto slot = (key * 0x9e3779b97f4a7c15ULL) >> tableShift; table[slot];
+             slot = (slot + 1) & (table.size() - 1)) {
+            auto j = table[slot] - 1;
+            if (std::memcmp(hashes[j].data(), s.data() + i, refLength) == 0) {
+                if (!found[j]) {
+                    found[j] = true;
+                    std::string ref(s.substr(i, refLength));
+                    debug("found reference to '%1%' at offset '%2%'", ref, i);
+                    seen.insert(std::move(ref));
+                }
+                break;
+            }
         }
         ++i;
     }
@@ -42,9 +228,9 @@ void RefScanSink::operator()(std::string_view data)
     auto s = tail;
     auto tailLen = std::min(data.size(), refLength);
     s.append(data.data(), tailLen);
-    search(s, hashes, seen);
+    search(s);
 
-    search(data, hashes, seen);
+    search(data);
 
     auto rest = refLength - tailLen;
     if (rest < tail.size())
@@ -52,6 +238,13 @@ void RefScanSink::operator()(std::string_view data)
     tail.append(data.data() + data.size() - tailLen, tailLen);
 }
 
+static constexpr size_t prefixFilterSize = 1 << 16;
+
+static inline uint32_t prefixFilterIndex(uint64_t key)
+{
+    return (uint32_t(key) * 0x9e3779b1U) >> 16;
+}
+
 RewritingSink::RewritingSink(const std::string & from, const std::string & to, Sink & nextSink)
     : RewritingSink({{from, to}}, nextSink)
 {
@@ -62,38 +255,177 @@ RewritingSink::RewritingSink(const StringMap & rewrites, Sink & nextSink)
     , nextSink(nextSink)
 {
     std::string::size_type maxRewriteSize = 0;
+    minRewriteSize = std::numeric_limits<size_t>::max();
+    nix32Patterns = true;
     for (auto & [from, to] : rewrites) {
         assert(from.size() == to.size());
+        if (from == to)
+            continue;
+        patterns.emplace_back(from, to);
         maxRewriteSize = std::max(maxRewriteSize, from.size());
+        minRewriteSize = std::min(minRewriteSize, from.size());
+        for (auto c : from)
+            if (!BaseNix32::lookupReverse(c))
+                nix32Patterns = false;
     }
     this->maxRewriteSize = maxRewriteSize;
+    keyMask = minRewriteSize >= sizeof(uint64_t) ? ~uint64_t(0) : (uint64_t(1) << (8 * minRewriteSize)) - 1;
+
+    size_t tableSize = 2;
+    tableShift = 63;
+    while (tableSize < 2 * patterns.size()) {
+        tableSize *= 2;
+        --tableShift;
+    }
+    table.resize(tableSize);
+    prefixFilter.resize(prefixFilterSize / 64);
+
+    for (uint32_t i = 0; i < patterns.size(); ++i) {
+        uint64_t key = 0;
+        std::memcpy(&key, patterns[i].first.data(), std::min(patterns[i].first.size(), sizeof(key)));
+        key &= keyMask;
+        auto f = prefixFilterIndex(key);
+        prefixFilter[f / 64] |= uint64_t(1) << (f % 64);
+        for (auto slot = (key * 0x9e3779b97f4a7c15ULL) >> tableShift;; slot = (slot + 1) & (tableSize - 1))
+            if (!table[slot].index) {
+                table[slot] = {.key = key, .index = i + 1};
+                break;
+            }
+    }
+}
+
+size_t RewritingSink::rewrite(std::string_view s, size_t start, size_t end)
+{
+    if (start >= end)
+        return start;
+
+    /* The bytes in `s[last, end)` haven't been passed on yet, and no
+       key may start before `last`. */
+    size_t last = start;
+
+    auto limit = s.size() < minRewriteSize ? start : std::min(end, s.size() - minRewriteSize + 1);
+
+    /* Only keys that are entirely base-32 start in a run of base-32
+       characters that's at least as long as the shortest key. */
+    size_t runLength = std::bit_floor(std::min<size_t>(minRewriteSize, 32));
+    if (nix32Patterns)
+        classifyString(s, bitmap);
+
+    for (size_t block = start / 64 * 64; block < limit; block += 64) {
+        /* Compute a bitmap of the positions in this block where a key
+           may start, without branching on each position. */
+        uint64_t candidates = ~uint64_t(0);
+        if (nix32Patterns) {
+            auto lo = bitmap[block / 64], hi = bitmap[block / 64 + 1];
+            for (size_t n = 1; n < runLength; n *= 2) {
+                lo &= lo >> n | hi << (64 - n);
+                hi &= hi >> n;
+            }
+            candidates = lo;
+        }
+        if (!candidates)
+            continue;
+
+        auto prefixMatches = [&](size_t i, uint32_t prefix) {
+            auto f = prefixFilterIndex(prefix & uint32_t(keyMask));
+            return uint64_t(prefixFilter[f / 64] >> (f % 64) & 1) << (i - block);
+        };
+        uint64_t prefixes = 0;
+        if (block + 64 + 3 <= s.size())
+            for (size_t i = block; i < block + 64; ++i) {
+                uint32_t prefix;
+                std::memcpy(&prefix, s.data() + i, sizeof(prefix));
+                prefixes |= prefixMatches(i, prefix);
+            }
+        else
+            for (size_t i = block; i < std::min(limit, block + 64); ++i) {
+                uint32_t prefix = 0;
+                std::memcpy(&prefix, s.data() + i, std::min(sizeof(prefix), s.size() - i));
+                prefixes |= prefixMatches(i, prefix);
+            }
+        candidates &= prefixes;
+
+        for (; candidates; candidates &= candidates - 1) {
+            auto i = block + std::countr_zero(candidates);
+            if (i < last)
+                continue;
+            if (i >= limit)
+                break;
+
+            uint64_t key = 0;
+            std::memcpy(&key, s.data() + i, std::min(sizeof(key), s.size() - i));
+            key &= keyMask;
+
+            const std::pair<std::string, std::string> * best = nullptr;
+            for (auto slot = (key * 0x9e3779b97f4a7c15ULL) >> tableShift; table[slot].index;
+                 slot = (slot + 1) & (table.size() - 1)) {
+                if (table[slot].key != key)
+                    continue;
+                auto & p = patterns[table[slot].index - 1];
+                if ((!best || p.first.size() > best->first.size()) && i + p.first.size() <= s.size()
+                    && std::memcmp(p.first.data(), s.data() + i, p.first.size()) == 0)
+                    best = &p;
+            }
+
+            if (!best)
+                continue;
+
+            if (last < i)
+                nextSink(s.substr(last, i - last));
+            nextSink(best->second);
+            last = i + best->first.size();
+        }
+    }
+
+    if (last < end) {
+        nextSink(s.substr(last, end - last));
+        last = end;
+    }
+
+    return last;
 }
 
 void RewritingSink::operator()(std::string_view data)
 {
-    std::string s(prev);
-    s.append(data);
+    if (patterns.empty()) {
+        pos += data.size();
+        nextSink(data);
+        return;
+    }
 
-    s = rewriteStrings(s, rewrites);
+    /* Keep back the bytes that may be the start of a key that continues
+       in the next fragment. */
+    auto keep = maxRewriteSize - 1;
 
-    prev = s.size() < maxRewriteSize ? s
-           : maxRewriteSize == 0     ? ""
-                                     : std::string(s, s.size() - maxRewriteSize + 1, maxRewriteSize - 1);
+    if (data.size() < maxRewriteSize) {
+        prev.append(data);
+        auto consumed = rewrite(prev, 0, prev.size() > keep ? prev.size() - keep : 0);
+        pos += consumed;
+        prev.erase(0, consumed);
+        return;
+    }
 
-    auto consumed = s.size() - prev.size();
+    /* Finish the keys that start in the bytes kept back from the
+       previous fragment, without copying the current one. */
+    size_t start = 0;
+    if (!prev.empty()) {
+        junction = prev;
+        junction.append(data.substr(0, keep));
+        start = rewrite(junction, 0, prev.size()) - prev.size();
+        pos += prev.size();
+        prev.clear();
+    }
 
+    auto consumed = rewrite(data, start, data.size() - keep);
     pos += consumed;
-
-    if (consumed)
-        nextSink(s.substr(0, consumed));
+    prev = data.substr(consumed);
 }
 
 void RewritingSink::flush()
 {
     if (prev.empty())
         return;
-    pos += prev.size();
-    nextSink(prev);
+    pos += rewrite(prev, 0, prev.size());
     prev.clear();
 }
 
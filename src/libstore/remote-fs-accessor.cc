@@ -1,5 +1,8 @@
 #include <nlohmann/json.hpp>
 #include "nix/store/remote-fs-accessor.hh"
+#include "nix/store/binary-cache-store.hh"
+#include "nix/store/nar-info.hh"
+#include "nix/util/compression.hh"
 #include "nix/util/nar-accessor.hh"
 
 #include <sys/types.h>
@@ -37,16 +40,59 @@ ref<SourceAccessor> RemoteFSAccessor::addToCache(std::string_view hashPart, std:
     auto narAccessor = makeNarAccessor(std::move(nar));
     nars.emplace(hashPart, narAccessor);
 
+    writeListing(hashPart, *narAccessor);
+
+    return narAccessor;
+}
+
+void RemoteFSAccessor::writeListing(std::string_view hashPart, SourceAccessor & narAccessor)
+{
     if (cacheDir != "") {
         try {
-            nlohmann::json j = listNarDeep(*narAccessor, CanonPath::root);
+            nlohmann::json j = listNarDeep(narAccessor, CanonPath::root);
             writeFile(makeCacheFile(hashPart, "ls"), j.dump());
         } catch (...) {
             ignoreExceptionExceptInterrupt();
         }
     }
+}
 
-    return narAccessor;
+std::shared_ptr<SourceAccessor> RemoteFSAccessor::accessRemotely(const StorePath & storePath)
+{
+    auto cache = store.dynamic_pointer_cast<BinaryCacheStore>();
+    if (!cache)
+        return nullptr;
+
+    /* Reading a file from an uncompressed or seekable NAR only
+       requires knowing where it is in the NAR, which the NAR listing
+       tells us. */
+    auto info = store->queryPathInfo(storePath).dynamic_pointer_cast<const NarInfo>();
+    if (!info || (info->compression != "none" && info->compression != "xz"))
+        return nullptr;
+
+    /* Prefer the binary listing, which is cheaper to parse. */
+    auto binaryListing = cache->getFile(cache->fileForHashPart(storePath.hashPart(), ".lsb"));
+    auto listing = binaryListing ? std::nullopt : cache->getFile(cache->fileForHashPart(storePath.hashPart(), ".ls"));
+    if (!binaryListing && !listing)
+        return nullptr;
+
+    GetNarBytes getNarBytes = [cache, url{info->url}](uint64_t offset, uint64_t length) {
+        return cache->getFileRange(url, offset, length);
+    };
+
+    if (info->compression == "xz") {
+        auto reader = info->fileSize ? makeSeekableXzReader(getNarBytes, info->fileSize) : std::nullopt;
+        if (!reader)
+            return nullptr;
+        getNarBytes = std::move(*reader);
+    }
+
+    if (binaryListing) {
+        StringSource source(*binaryListing);
+        return makeLazyNarAccessor(readNarListingBinary(source), getNarBytes).get_ptr();
+    }
+
+    return makeLazyNarAccessor(nlohmann::json::parse(*listing).at("root"), getNarBytes).get_ptr();
 }
 
 std::pair<ref<SourceAccessor>, CanonPath> RemoteFSAccessor::fetch(const CanonPath & path)
@@ -79,14 +125,45 @@ std::shared_ptr<SourceAccessor> RemoteFSAccessor::accessObject(const StorePath &
         } catch (SystemError &) {
         }
 
+        /* The listing is missing, so index the NAR file without
+           reading it into memory, and write the listing for next
+           time. */
         try {
-            auto narAccessor = makeNarAccessor(nix::readFile(cacheFile));
+            auto narAccessor = openNarAccessor(cacheFile);
+            writeListing(storePath.hashPart(), *narAccessor);
             nars.emplace(storePath.hashPart(), narAccessor);
             return narAccessor;
         } catch (SystemError &) {
         }
     }
 
+    if (auto narAccessor = accessRemotely(storePath)) {
+        nars.emplace(storePath.hashPart(), ref(narAccessor));
+        return narAccessor;
+    }
+
+    /* Stream the NAR into the cache rather than into memory. */
+    if (cacheDir != "") {
+        auto tmp = fmt("%s.tmp.%d", cacheFile, getpid());
+        AutoCloseFD fd = toDescriptor(open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666));
+        if (fd) {
+            AutoDelete del(tmp, false);
+            {
+                FdSink sink(fd.get());
+                store->narFromPath(storePath, sink);
+                sink.flush();
+            }
+            fd.close();
+            std::filesystem::rename(tmp, cacheFile);
+            del.cancel();
+
+            auto narAccessor = openNarAccessor(cacheFile);
+            writeListing(storePath.hashPart(), *narAccessor);
+            nars.emplace(storePath.hashPart(), narAccessor);
+            return narAccessor;
+        }
+    }
+
     StringSink sink;
     store->narFromPath(storePath, sink);
     return addToCache(storePath.hashPart(), std::move(sink.s));
@@ -9,12 +9,15 @@
 #include "nix/store/worker-protocol.hh"
 #include "nix/store/worker-protocol-impl.hh"
 #include "nix/util/archive.hh"
+#include "nix/util/compression.hh"
+#include "nix/store/nar-delta.hh"
 #include "nix/store/globals.hh"
 #include "nix/store/derivations.hh"
 #include "nix/util/pool.hh"
 #include "nix/util/finally.hh"
 #include "nix/util/git.hh"
 #include "nix/util/logging.hh"
+#include "nix/util/tracing.hh"
 #include "nix/util/callback.hh"
 #include "nix/store/filetransfer.hh"
 #include "nix/util/signals.hh"
@@ -68,6 +71,14 @@ ref<RemoteStore::Connection> RemoteStore::openConnectionWrapper()
     }
 }
 
+WorkerProto::FeatureSet RemoteStore::getSupportedFeatures()
+{
+    auto features = WorkerProto::allFeatures;
+    features.erase(std::string(WorkerProto::featureZstdNar));
+    features.erase(std::string(WorkerProto::featureNarDelta));
+    return features;
+}
+
 void RemoteStore::initConnection(Connection & conn)
 {
     /* Send the magic greeting, check for the reply. */
@@ -78,7 +89,7 @@ void RemoteStore::initConnection(Connection & conn)
         TeeSource tee(conn.from, saved);
         try {
             auto [protoVersion, features] =
-                WorkerProto::BasicClientConnection::handshake(conn.to, tee, PROTOCOL_VERSION, WorkerProto::allFeatures);
+                WorkerProto::BasicClientConnection::handshake(conn.to, tee, PROTOCOL_VERSION, getSupportedFeatures());
             if (protoVersion < MINIMUM_PROTOCOL_VERSION)
                 throw Error("the Nix daemon version is too old");
             conn.protoVersion = protoVersion;
@@ -130,6 +141,8 @@ void RemoteStore::setOptions(Connection & conn)
     overrides.erase(loggerSettings.showTrace.name);
     overrides.erase(experimentalFeatureSettings.experimentalFeatures.name);
     overrides.erase("plugin-files");
+    if (auto traceParent = getTraceParent())
+        overrides.insert_or_assign(loggerSettings.traceParent.name, Config::SettingInfo{.value = *traceParent});
     conn.to << overrides.size();
     for (auto & i : overrides)
         conn.to << i.first << i.second.value;
@@ -237,6 +250,59 @@ void RemoteStore::queryPathInfoUncached(
     }
 }
 
+std::map<StorePath, std::shared_ptr<const ValidPathInfo>>
+RemoteStore::queryMultiplePathInfosUncached(const StorePathSet & paths)
+{
+    auto infos = ({
+        auto conn(getConnection());
+        /* Older daemons only support one path per request, but we
+           can still pipeline those requests over one connection. */
+        conn->features.contains(WorkerProto::featureQueryMultiplePathInfos)
+            ? conn->queryMultiplePathInfos(*this, &conn.daemonException, paths)
+            : conn->queryPathInfos(*this, &conn.daemonException, paths);
+    });
+
+    std::map<StorePath, std::shared_ptr<const ValidPathInfo>> res;
+    for (auto & [path, info] : infos)
+        res.insert_or_assign(path, std::make_shared<ValidPathInfo>(StorePath{path}, std::move(info)));
+    return res;
+}
+
+void RemoteStore::computeFSClosure(
+    const StorePathSet & paths, StorePathSet & out, bool flipDirection, bool includeOutputs, bool includeDerivers)
+{
+    if (!getConnection()->features.contains(WorkerProto::featureQueryClosure))
+        return Store::computeFSClosure(paths, out, flipDirection, includeOutputs, includeDerivers);
+
+    StorePathSet startPaths;
+    for (auto & path : paths)
+        if (!out.contains(path))
+            startPaths.insert(path);
+
+    if (startPaths.empty())
+        return;
+
+    auto infos = ({
+        auto conn(getConnection());
+        conn->queryClosure(*this, &conn.daemonException, startPaths, flipDirection, includeOutputs, includeDerivers);
+    });
+
+    /* Callers typically want the path infos of the closure next, so
+       cache the ones we got. */
+    for (auto & [path, info] : infos) {
+        out.insert(path);
+        cachePathInfo(path, std::make_shared<const ValidPathInfo>(StorePath{path}, std::move(info)));
+    }
+}
+
+std::map<StorePath, DrvHash> RemoteStore::queryDerivationHashesModulo(const StorePathSet & drvPaths)
+{
+    if (drvPaths.empty() || !getConnection()->features.contains(WorkerProto::featureQueryDerivationHashesModulo))
+        return Store::queryDerivationHashesModulo(drvPaths);
+    auto conn(getConnection());
+    return conn->queryDerivationHashesModulo(*this, &conn.daemonException, drvPaths);
+}
+
 void RemoteStore::queryReferrers(const StorePath & path, StorePathSet & referrers)
 {
     auto conn(getConnection());
@@ -432,16 +498,41 @@ void RemoteStore::addToStore(const ValidPathInfo & info, Source & source, Repair
 {
     auto conn(getConnection());
 
+    auto writeInfo = [&]() {
+        WorkerProto::write(*this, *conn, info.path);
+        WorkerProto::write(*this, *conn, info.deriver);
+        conn->to << info.narHash.to_string(HashFormat::Base16, false);
+        WorkerProto::write(*this, *conn, info.references);
+        conn->to << info.registrationTime << info.narSize << info.ultimate << info.sigs
+                 << renderContentAddress(info.ca) << repair << !checkSigs;
+    };
+
+    /* If the daemon has a previous version of this path, only send
+       the chunks of the NAR that it doesn't have. */
+    if (conn->features.contains(WorkerProto::featureNarDelta) && info.narSize >= narDeltaMinSize) {
+        if (auto base = conn->queryDeltaBase(*this, &conn.daemonException, info.path, info.narSize)) {
+            auto & [basePath, baseChunks] = *base;
+            conn->to << WorkerProto::Op::AddToStoreNarDelta;
+            writeInfo();
+            WorkerProto::write(*this, *conn, basePath);
+            conn.withFramedNarSink([&](Sink & sink) {
+                auto bytesSaved = writeNarDelta(source, baseChunks, sink);
+                debug(
+                    "sent '%s' as a delta against '%s', saving %d of %d bytes",
+                    printStorePath(info.path),
+                    printStorePath(basePath),
+                    bytesSaved,
+                    info.narSize);
+            });
+            return;
+        }
+    }
+
     conn->to << WorkerProto::Op::AddToStoreNar;
-    WorkerProto::write(*this, *conn, info.path);
-    WorkerProto::write(*this, *conn, info.deriver);
-    conn->to << info.narHash.to_string(HashFormat::Base16, false);
-    WorkerProto::write(*this, *conn, info.references);
-    conn->to << info.registrationTime << info.narSize << info.ultimate << info.sigs << renderContentAddress(info.ca)
-             << repair << !checkSigs;
+    writeInfo();
 
     if (GET_PROTOCOL_MINOR(conn->protoVersion) >= 23) {
-        conn.withFramedSink([&](Sink & sink) { copyNAR(source, sink); });
+        conn.withFramedNarSink([&](Sink & sink) { copyNAR(source, sink); });
     } else if (GET_PROTOCOL_MINOR(conn->protoVersion) >= 21) {
         conn.processStderr(0, &source);
     } else {
@@ -489,7 +580,7 @@ void RemoteStore::addMultipleToStore(Source & source, RepairFlag repair, CheckSi
     if (GET_PROTOCOL_MINOR(getConnection()->protoVersion) >= 32) {
         auto conn(getConnection());
         conn->to << WorkerProto::Op::AddMultipleToStore << repair << !checkSigs;
-        conn.withFramedSink([&](Sink & sink) { source.drainInto(sink); });
+        conn.withFramedNarSink([&](Sink & sink) { source.drainInto(sink); });
     } else
         Store::addMultipleToStore(source, repair, checkSigs);
 }
@@ -542,6 +633,23 @@ void RemoteStore::queryRealisationUncached(
     }
 }
 
+std::map<DrvOutput, std::shared_ptr<const UnkeyedRealisation>>
+RemoteStore::queryRealisationsUncached(const std::set<DrvOutput> & outputs)
+{
+    if (!getConnection()->features.contains(WorkerProto::featureQueryRealisations))
+        return Store::queryRealisationsUncached(outputs);
+
+    auto realisations = ({
+        auto conn(getConnection());
+        conn->queryRealisations(*this, &conn.daemonException, outputs);
+    });
+
+    std::map<DrvOutput, std::shared_ptr<const UnkeyedRealisation>> res;
+    for (auto & realisation : realisations)
+        res.insert_or_assign(realisation.id, std::make_shared<const UnkeyedRealisation>(realisation));
+    return res;
+}
+
 void RemoteStore::copyDrvsFromEvalStore(const std::vector<DerivedPath> & paths, std::shared_ptr<Store> evalStore)
 {
     if (evalStore && evalStore.get() != this) {
@@ -621,6 +729,16 @@ std::vector<KeyedBuildResult> RemoteStore::buildPathsWithResults(
                         auto drv = evalStore->readDerivation(drvPath);
                         const auto outputHashes = staticOutputHashes(*evalStore, drv); // FIXME: expensive
                         auto built = resolveDerivedPath(*this, bfd, &*evalStore);
+
+                        std::map<DrvOutput, std::shared_ptr<const UnkeyedRealisation>> realisations;
+                        if (experimentalFeatureSettings.isEnabled(Xp::CaDerivations)) {
+                            std::set<DrvOutput> outputIds;
+                            for (auto & [output, _] : built)
+                                if (auto outputHash = get(outputHashes, output))
+                                    outputIds.insert(DrvOutput{*outputHash, output});
+                            realisations = queryRealisations(outputIds);
+                        }
+
                         for (auto & [output, outputPath] : built) {
                             auto outputHash = get(outputHashes, output);
                             if (!outputHash)
@@ -630,10 +748,10 @@ std::vector<KeyedBuildResult> RemoteStore::buildPathsWithResults(
                                     output);
                             auto outputId = DrvOutput{*outputHash, output};
                             if (experimentalFeatureSettings.isEnabled(Xp::CaDerivations)) {
-                                auto realisation = queryRealisation(outputId);
-                                if (!realisation)
+                                auto realisation = realisations.find(outputId);
+                                if (realisation == realisations.end())
                                     throw MissingRealisation(outputId);
-                                success.builtOutputs.emplace(output, Realisation{*realisation, outputId});
+                                success.builtOutputs.emplace(output, Realisation{*realisation->second, outputId});
                             } else {
                                 success.builtOutputs.emplace(
                                     output,
@@ -682,6 +800,14 @@ void RemoteStore::addTempRoot(const StorePath & path)
     conn->addTempRoot(*this, &conn.daemonException, path);
 }
 
+void RemoteStore::addTempRoots(const StorePathSet & paths)
+{
+    if (paths.empty() || !getConnection()->features.contains(WorkerProto::featureAddTempRoots))
+        return Store::addTempRoots(paths);
+    auto conn(getConnection());
+    conn->addTempRoots(*this, &conn.daemonException, paths);
+}
+
 Roots RemoteStore::findRoots(bool censor)
 {
     auto conn(getConnection());
@@ -714,7 +840,7 @@ void RemoteStore::collectGarbage(const GCOptions & options, GCResults & results)
     results.bytesFreed = readLongLong(conn->from);
     readLongLong(conn->from); // obsolete
 
-    pathInfoCache->lock()->clear();
+    clearPathInfoCache();
 }
 
 void RemoteStore::optimiseStore()
@@ -803,6 +929,13 @@ void RemoteStore::flushBadConnections()
     connections->flushBad();
 }
 
+bool RemoteStore::prepareForFork()
+{
+    /* The child opens its own connections when it needs them. */
+    connections->clear();
+    return true;
+}
+
 void RemoteStore::shutdownConnections()
 {
 #ifndef _WIN32
@@ -820,7 +953,15 @@ void RemoteStore::shutdownConnections()
 void RemoteStore::narFromPath(const StorePath & path, Sink & sink)
 {
     auto conn(getConnection());
-    conn->narFromPath(*this, &conn.daemonException, path, [&](Source & source) { copyNAR(conn->from, sink); });
+    conn->narFromPath(*this, &conn.daemonException, path, [&](Source & source) {
+        if (conn->features.contains(WorkerProto::featureZstdNar)) {
+            FramedSource framed(source);
+            auto decompressor = makeDecompressionSink("zstd", sink);
+            framed.drainInto(*decompressor);
+            decompressor->finish();
+        } else
+            copyNAR(source, sink);
+    });
 }
 
 ref<RemoteFSAccessor> RemoteStore::getRemoteFSAccessor(bool requireValidPath)
@@ -855,4 +996,16 @@ void RemoteStore::ConnectionHandle::withFramedSink(std::function<void(Sink & sin
     processStderr(nullptr, nullptr, false);
 }
 
+void RemoteStore::ConnectionHandle::withFramedNarSink(std::function<void(Sink & sink)> fun)
+{
+    if (!(*this)->features.contains(WorkerProto::featureZstdNar))
+        return withFramedSink(fun);
+
+    withFramedSink([&](Sink & sink) {
+        auto compressor = makeCompressionSink("zstd", sink);
+        fun(*compressor);
+        compressor->finish();
+    });
+}
+
 } // namespace nix
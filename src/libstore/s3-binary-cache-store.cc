@@ -8,6 +8,7 @@
 
 #include <cassert>
 #include <cstring>
+#include <deque>
 #include <ranges>
 #include <regex>
 #include <span>
@@ -34,6 +35,13 @@ public:
     void upsertFile(
         const std::string & path, RestartableSource & source, const std::string & mimeType, uint64_t sizeHint) override;
 
+    /**
+     * Downloads NARs larger than `download-part-size` as several
+     * concurrent range requests, so a failed part only needs that part
+     * to be fetched again.
+     */
+    void getFile(const std::string & path, Sink & sink) override;
+
 private:
     ref<S3BinaryCacheStoreConfig> s3Config;
 
@@ -72,7 +80,8 @@ private:
     /**
      * A Sink that manages a complete S3 multipart upload lifecycle.
      * Creates the upload on construction, buffers and uploads chunks as data arrives,
-     * and completes or aborts the upload appropriately.
+     * and completes or aborts the upload appropriately. Up to
+     * `multipart-upload-concurrency` chunks are uploaded at the same time.
      */
     struct MultipartSink : Sink
     {
@@ -84,6 +93,22 @@ private:
         std::vector<std::string> partEtags;
         std::string buffer;
 
+        /**
+         * A part whose upload is in progress. The transfer refers to
+         * `payload`, so this must stay alive until it has finished.
+         */
+        struct Part
+        {
+            uint64_t partNumber;
+            std::string data;
+            StringSource payload{data};
+            std::future<FileTransferResult> result;
+        };
+
+        std::deque<std::unique_ptr<Part>> inFlight;
+
+        bool completed = false;
+
         MultipartSink(
             S3BinaryCacheStore & store,
             std::string_view path,
@@ -91,9 +116,16 @@ private:
             std::string_view mimeType,
             std::optional<Headers> headers);
 
+        ~MultipartSink();
+
         void operator()(std::string_view data) override;
         void finish();
         void uploadChunk(std::string chunk);
+
+        /**
+         * Wait for the oldest part in flight and record its ETag.
+         */
+        void waitForPart();
     };
 
     /**
@@ -111,7 +143,8 @@ private:
      *
      * @returns the [ETag](https://en.wikipedia.org/wiki/HTTP_ETag)
      */
-    std::string uploadPart(std::string_view key, std::string_view uploadId, uint64_t partNumber, std::string data);
+    std::future<FileTransferResult>
+    uploadPart(std::string_view key, std::string_view uploadId, uint64_t partNumber, StringSource & payload);
 
     /**
      * Completes a multipart upload by combining all uploaded parts.
@@ -160,6 +193,63 @@ void S3BinaryCacheStore::upsertFile(
     }
 }
 
+void S3BinaryCacheStore::getFile(const std::string & path, Sink & sink)
+{
+    auto partSize = s3Config->downloadPartSize.get();
+
+    /* Objects with a Content-Encoding are decompressed by the file
+       transfer, which requires the whole object. */
+    if (partSize == 0 || !hasPrefix(path, "nar/") || getCompressionMethod(path))
+        return HttpBinaryCacheStore::getFile(path, sink);
+
+    checkEnabled();
+
+    auto downloadRange = [&](uint64_t offset, uint64_t length) {
+        auto request(makeRequest(path));
+        request.headers.emplace_back("Range", fmt("bytes=%d-%d", offset, offset + length - 1));
+        return getFileTransfer()->enqueueFileTransfer(request);
+    };
+
+    try {
+        /* The first part tells us the size of the object. */
+        auto first = downloadRange(0, partSize).get();
+        sink(first.data);
+        if (!first.totalSize || *first.totalSize <= first.data.size())
+            return;
+
+        auto totalSize = *first.totalSize;
+        uint64_t next = first.data.size();
+        debug("downloading '%s' (%d bytes) from S3 in ranges of %d bytes", path, totalSize, partSize);
+        std::deque<std::pair<uint64_t, std::future<FileTransferResult>>> inFlight;
+
+        while (next < totalSize || !inFlight.empty()) {
+            while (next < totalSize && inFlight.size() < std::max(1U, s3Config->downloadConcurrency.get())) {
+                auto length = std::min(partSize, totalSize - next);
+                inFlight.emplace_back(length, downloadRange(next, length));
+                next += length;
+            }
+
+            auto [length, result] = std::move(inFlight.front());
+            inFlight.pop_front();
+            auto part = result.get();
+            if (part.data.size() != length)
+                throw Error(
+                    "range request for '%s' in binary cache '%s' returned %d bytes instead of %d",
+                    path,
+                    config->getHumanReadableURI(),
+                    part.data.size(),
+                    length);
+            sink(part.data);
+        }
+    } catch (FileTransferError & e) {
+        if (e.error == FileTransfer::NotFound || e.error == FileTransfer::Forbidden)
+            throw NoSuchBinaryCacheFile(
+                "file '%s' does not exist in binary cache '%s'", path, config->getHumanReadableURI());
+        maybeDisable();
+        throw;
+    }
+}
+
 void S3BinaryCacheStore::upload(
     std::string_view path,
     RestartableSource & source,
@@ -234,6 +324,22 @@ S3BinaryCacheStore::MultipartSink::MultipartSink(
     uploadId = store.createMultipartUpload(path, mimeType, std::move(headers));
 }
 
+S3BinaryCacheStore::MultipartSink::~MultipartSink()
+{
+    if (completed)
+        return;
+
+    /* The source failed or a part couldn't be uploaded. Wait for the
+       remaining parts, since they refer to our buffers, and then abort
+       the upload. */
+    for (auto & part : inFlight)
+        try {
+            part->result.get();
+        } catch (...) {
+        }
+    store.abortMultipartUpload(path, uploadId);
+}
+
 void S3BinaryCacheStore::MultipartSink::operator()(std::string_view data)
 {
     buffer.append(data);
@@ -257,13 +363,16 @@ void S3BinaryCacheStore::MultipartSink::finish()
         uploadChunk(std::move(buffer));
     }
 
+    while (!inFlight.empty())
+        waitForPart();
+
     try {
         if (partEtags.empty()) {
             throw Error("no data read from stream");
         }
         store.completeMultipartUpload(path, uploadId, partEtags);
+        completed = true;
     } catch (Error & e) {
-        store.abortMultipartUpload(path, uploadId);
         e.addTrace({}, "while finishing an S3 multipart upload");
         throw;
     }
@@ -271,15 +380,35 @@ void S3BinaryCacheStore::MultipartSink::finish()
 
 void S3BinaryCacheStore::MultipartSink::uploadChunk(std::string chunk)
 {
-    auto partNumber = partEtags.size() + 1;
+    while (inFlight.size() >= std::max(1U, store.s3Config->multipartUploadConcurrency.get()))
+        waitForPart();
+
+    auto partNumber = partEtags.size() + inFlight.size() + 1;
+    auto part = std::make_unique<Part>(partNumber, std::move(chunk));
     try {
-        std::string etag = store.uploadPart(path, uploadId, partNumber, std::move(chunk));
-        partEtags.push_back(std::move(etag));
+        part->result = store.uploadPart(path, uploadId, partNumber, part->payload);
     } catch (Error & e) {
-        store.abortMultipartUpload(path, uploadId);
         e.addTrace({}, "while uploading part %d of an S3 multipart upload", partNumber);
         throw;
     }
+    inFlight.push_back(std::move(part));
+}
+
+void S3BinaryCacheStore::MultipartSink::waitForPart()
+{
+    auto part = std::move(inFlight.front());
+    inFlight.pop_front();
+    try {
+        auto result = part->result.get();
+        if (result.etag.empty()) {
+            throw Error("S3 UploadPart response missing ETag for part %d", part->partNumber);
+        }
+        debug("Part %d uploaded, ETag: %s", part->partNumber, result.etag);
+        partEtags.push_back(std::move(result.etag));
+    } catch (Error & e) {
+        e.addTrace({}, "while uploading part %d of an S3 multipart upload", part->partNumber);
+        throw;
+    }
 }
 
 std::string S3BinaryCacheStore::createMultipartUpload(
@@ -317,8 +446,8 @@ std::string S3BinaryCacheStore::createMultipartUpload(
     throw Error("S3 CreateMultipartUpload response missing <UploadId>");
 }
 
-std::string
-S3BinaryCacheStore::uploadPart(std::string_view key, std::string_view uploadId, uint64_t partNumber, std::string data)
+std::future<FileTransferResult>
+S3BinaryCacheStore::uploadPart(std::string_view key, std::string_view uploadId, uint64_t partNumber, StringSource & payload)
 {
     if (partNumber > AWS_MAX_PART_COUNT) {
         throw Error("S3 multipart upload exceeded %d part limit", AWS_MAX_PART_COUNT);
@@ -332,18 +461,10 @@ S3BinaryCacheStore::uploadPart(std::string_view key, std::string_view uploadId,
     url.query["partNumber"] = std::to_string(partNumber);
     url.query["uploadId"] = uploadId;
     req.uri = VerbatimURL(url);
-    StringSource payload{data};
     req.data = {payload};
     req.mimeType = "application/octet-stream";
 
-    auto result = getFileTransfer()->enqueueFileTransfer(req).get();
-
-    if (result.etag.empty()) {
-        throw Error("S3 UploadPart response missing ETag for part %d", partNumber);
-    }
-
-    debug("Part %d uploaded, ETag: %s", partNumber, result.etag);
-    return std::move(result.etag);
+    return getFileTransfer()->enqueueFileTransfer(req);
 }
 
 void S3BinaryCacheStore::abortMultipartUpload(std::string_view key, std::string_view uploadId) noexcept
@@ -18,8 +18,10 @@ create table if not exists Refs (
     foreign key (reference) references ValidPaths(id) on delete restrict
 );
 
-create index if not exists IndexReferrer on Refs(referrer);
-create index if not exists IndexReference on Refs(reference);
+-- Lookups by referrer use the primary key. This index covers lookups
+-- by reference, so that finding the referrers of a path doesn't have
+-- to touch the table itself.
+create index if not exists IndexReferenceReferrer on Refs(reference, referrer);
 
 -- Paths can refer to themselves, causing a tuple (N, N) in the Refs
 -- table.  This causes a deletion of the corresponding row in
@@ -0,0 +1,154 @@
+#include "nix/store/sqlite-file-hash-cache.hh"
+#include "nix/store/sqlite.hh"
+#include "nix/util/users.hh"
+#include "nix/util/sync.hh"
+
+#include <sqlite3.h>
+
+namespace nix {
+
+static const char * schema = R"sql(
+
+create table if not exists FileHashes (
+    key       text primary key not null,
+    hash      text not null,
+    size      integer not null,
+    timestamp integer not null
+);
+
+create table if not exists LastPurge (
+    dummy     text primary key,
+    value     integer
+);
+)sql";
+
+struct SQLiteFileHashCache : FileHashCache
+{
+    /**
+     * Keys are derived from file metadata, so there is no way to tell
+     * whether the files of an entry still exist. Instead, entries that
+     * haven't been used for this long are removed.
+     */
+    static constexpr time_t maxAge = 30 * 24 * 3600;
+
+    /**
+     * How often to purge expired entries from the cache.
+     */
+    static constexpr time_t purgeInterval = 24 * 3600;
+
+    /**
+     * Write pending entries to the database in a single transaction
+     * once there are this many.
+     */
+    static constexpr size_t maxPendingWrites = 1024;
+
+    struct State
+    {
+        SQLite db;
+        SQLiteStmt upsert, lookup;
+        std::vector<std::pair<std::string, HashResult>> pending;
+    };
+
+    Sync<State> _state;
+
+    SQLiteFileHashCache()
+    {
+        auto state(_state.lock());
+
+        auto dbPath = (getCacheDir() / "file-hashes-v1.sqlite").string();
+        createDirs(dirOf(dbPath));
+
+        state->db = SQLite(dbPath);
+        state->db.isCache();
+        state->db.exec(schema);
+
+        state->upsert.create(
+            state->db, "insert or replace into FileHashes(key, hash, size, timestamp) values (?, ?, ?, ?)");
+
+        state->lookup.create(state->db, "select hash, size from FileHashes where key = ?");
+
+        /* Periodically purge expired entries from the database. */
+        retrySQLite<void>([&]() {
+            auto now = time(0);
+
+            SQLiteStmt queryLastPurge(state->db, "select value from LastPurge");
+            auto queryLastPurge_(queryLastPurge.use());
+
+            if (!queryLastPurge_.next() || queryLastPurge_.getInt(0) < now - purgeInterval) {
+                SQLiteStmt(state->db, "delete from FileHashes where timestamp < ?").use()(now - maxAge).exec();
+
+                debug("deleted %d entries from the file hash cache", sqlite3_changes(state->db));
+
+                SQLiteStmt(state->db, "insert or replace into LastPurge(dummy, value) values ('', ?)")
+                    .use()(now)
+                    .exec();
+            }
+        });
+    }
+
+    ~SQLiteFileHashCache()
+    {
+        try {
+            flush(*_state.lock());
+        } catch (...) {
+            ignoreExceptionInDestructor();
+        }
+    }
+
+    void flush(State & state)
+    {
+        if (state.pending.empty())
+            return;
+
+        auto now = time(0);
+        SQLiteTxn txn(state.db);
+        for (auto & [key, res] : state.pending)
+            state.upsert.use()(key)(res.hash.to_string(HashFormat::SRI, true))((int64_t) res.numBytesDigested)(
+                    (int64_t) now)
+                .exec();
+        txn.commit();
+
+        state.pending.clear();
+    }
+
+    std::optional<HashResult> lookup(std::string_view key) override
+    {
+        auto state(_state.lock());
+
+        for (auto & [key2, res] : state->pending)
+            if (key2 == key)
+                return res;
+
+        auto stmt(state->lookup.use()(key));
+        if (!stmt.next())
+            return std::nullopt;
+
+        HashResult res{
+            .hash = Hash::parseSRI(stmt.getStr(0)),
+            .numBytesDigested = (uint64_t) stmt.getInt(1),
+        };
+
+        /* Refresh the timestamp of the entry so that it isn't purged
+           while it's still in use. */
+        state->pending.emplace_back(key, res);
+        if (state->pending.size() >= maxPendingWrites)
+            flush(*state);
+
+        return res;
+    }
+
+    void upsert(std::string_view key, const HashResult & result) override
+    {
+        auto state(_state.lock());
+        state->pending.emplace_back(key, result);
+        if (state->pending.size() >= maxPendingWrites)
+            flush(*state);
+    }
+};
+
+ref<FileHashCache> openSQLiteFileHashCache()
+{
+    return make_ref<SQLiteFileHashCache>();
+}
+
+} // namespace nix
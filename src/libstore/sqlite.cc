@@ -1,8 +1,10 @@
 #include "nix/store/sqlite.hh"
 #include "nix/store/globals.hh"
+#include "nix/store/store-metrics.hh"
 #include "nix/util/util.hh"
 #include "nix/util/url.hh"
 #include "nix/util/signals.hh"
+#include "nix/util/sync.hh"
 
 #ifdef __linux__
 #  include <sys/vfs.h>
@@ -11,6 +13,8 @@
 #include <sqlite3.h>
 
 #include <atomic>
+#include <condition_variable>
+#include <optional>
 #include <thread>
 
 namespace nix {
@@ -62,6 +66,143 @@ static void traceSQL(void * x, const char * sql)
     notice("SQL<[%1%]>", sql);
 };
 
+/**
+ * How long to wait for a lock before giving up with `SQLITE_BUSY`.
+ */
+static constexpr int busyTimeoutMs = 60 * 60 * 1000;
+
+/**
+ * Like the handler installed by `sqlite3_busy_timeout()`, with the
+ * same backoff, but recording the time spent waiting, and giving up
+ * early on interrupts so that `retrySQLite()` can notice them.
+ */
+static int busyHandler(void *, int count)
+{
+    static constexpr int delays[] = {1, 2, 5, 10, 15, 20, 25, 25, 25, 50, 50, 100};
+    static constexpr int totals[] = {0, 1, 3, 8, 18, 33, 53, 78, 103, 128, 178, 228};
+    static constexpr int nrDelays = std::size(delays);
+
+    int delay, prior;
+    if (count < nrDelays) {
+        delay = delays[count];
+        prior = totals[count];
+    } else {
+        delay = delays[nrDelays - 1];
+        prior = totals[nrDelays - 1] + delay * (count - (nrDelays - 1));
+    }
+    if (prior + delay > busyTimeoutMs) {
+        delay = busyTimeoutMs - prior;
+        if (delay <= 0)
+            return 0;
+    }
+
+    if (isInterrupted())
+        return 0;
+
+    if (auto metrics = getStoreMetrics()) {
+        if (count == 0)
+            metrics->sqliteBusyWaits++;
+        metrics->sqliteBusyWaitUs += delay * 1000;
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds{delay});
+    return 1;
+}
+
+/**
+ * Checkpoints the WAL of a database from a background thread, so that
+ * commits don't have to. The thread uses its own connection, opened
+ * when the first checkpoint is due.
+ */
+struct SQLiteCheckpointer
+{
+    const std::filesystem::path path;
+
+    /**
+     * The WAL size in pages above which to checkpoint.
+     */
+    const int threshold;
+
+    struct State
+    {
+        bool requested = false;
+        bool quit = false;
+    };
+
+    Sync<State> state_;
+    std::condition_variable wakeup;
+    std::thread thread;
+
+    SQLiteCheckpointer(std::filesystem::path path, int threshold)
+        : path(std::move(path))
+        , threshold(threshold)
+        , thread([this]() { run(); })
+    {
+    }
+
+    ~SQLiteCheckpointer()
+    {
+        state_.lock()->quit = true;
+        wakeup.notify_one();
+        thread.join();
+    }
+
+    static int walHook(void * data, sqlite3 *, const char *, int nrPages)
+    {
+        auto & checkpointer = *static_cast<SQLiteCheckpointer *>(data);
+        if (nrPages >= checkpointer.threshold) {
+            checkpointer.state_.lock()->requested = true;
+            checkpointer.wakeup.notify_one();
+        }
+        return SQLITE_OK;
+    }
+
+    void run()
+    {
+        std::optional<SQLite> db;
+
+        while (true) {
+            {
+                auto state(state_.lock());
+                while (!state->requested && !state->quit)
+                    state.wait(wakeup);
+                if (state->quit)
+                    return;
+                state->requested = false;
+            }
+
+            try {
+                if (!db)
+                    db.emplace(path, SQLiteOpenMode::NoCreate);
+
+                auto before = std::chrono::steady_clock::now();
+
+                /* A passive checkpoint copies as much of the WAL as it
+                   can without waiting for readers or writers. */
+                int nrLogPages = 0, nrCheckpointed = 0;
+                auto ret = sqlite3_wal_checkpoint_v2(
+                    *db, nullptr, SQLITE_CHECKPOINT_PASSIVE, &nrLogPages, &nrCheckpointed);
+                if (ret != SQLITE_OK && ret != SQLITE_BUSY)
+                    SQLiteError::throw_(*db, "checkpointing the WAL");
+
+                auto duration = std::chrono::steady_clock::now() - before;
+                if (auto metrics = getStoreMetrics())
+                    metrics->sqliteCheckpoint.observe(
+                        std::chrono::duration_cast<std::chrono::microseconds>(duration));
+
+                debug(
+                    "checkpointed %d of %d WAL pages of '%s' in %d ms",
+                    nrCheckpointed,
+                    nrLogPages,
+                    path.string(),
+                    std::chrono::duration_cast<std::chrono::milliseconds>(duration).count());
+            } catch (std::exception & e) {
+                debug("cannot checkpoint '%s': %s", path.string(), e.what());
+            }
+        }
+    }
+};
+
 SQLite::SQLite(const std::filesystem::path & path, SQLiteOpenMode mode)
 {
     // Work around a ZFS issue where SQLite's truncate() call on
@@ -101,8 +242,8 @@ SQLite::SQLite(const std::filesystem::path & path, SQLiteOpenMode mode)
         throw Error("cannot open SQLite database '%s': %s", path, err);
     }
 
-    if (sqlite3_busy_timeout(db, 60 * 60 * 1000) != SQLITE_OK)
-        SQLiteError::throw_(db, "setting timeout");
+    if (sqlite3_busy_handler(db, busyHandler, nullptr) != SQLITE_OK)
+        SQLiteError::throw_(db, "setting busy handler");
 
     if (getEnv("NIX_DEBUG_SQLITE_TRACES") == "1") {
         // To debug sqlite statements; trace all of them
@@ -112,6 +253,14 @@ SQLite::SQLite(const std::filesystem::path & path, SQLiteOpenMode mode)
     exec("pragma foreign_keys = 1");
 }
 
+SQLite & SQLite::operator=(SQLite && from) noexcept
+{
+    db = from.db;
+    from.db = 0;
+    checkpointer = std::move(from.checkpointer);
+    return *this;
+}
+
 SQLite::~SQLite()
 {
     try {
@@ -126,6 +275,31 @@ void SQLite::isCache()
 {
     exec("pragma synchronous = off");
     exec("pragma main.journal_mode = wal");
+    tune({
+        .mmapSize = settings.cacheDbMmapSize,
+        .cacheSize = settings.cacheDbPageCacheSize,
+    });
+}
+
+void SQLite::tune(const SQLiteTuning & tuning)
+{
+    if (tuning.mmapSize)
+        exec(fmt("pragma mmap_size = %d", tuning.mmapSize));
+
+    /* A negative size is in KiB rather than pages. */
+    if (tuning.cacheSize)
+        exec(fmt("pragma cache_size = -%d", tuning.cacheSize));
+
+    auto path = sqlite3_db_filename(db, "main");
+
+    if (tuning.backgroundCheckpoint && path && *path) {
+        /* This replaces the hook that does automatic checkpoints. 1000
+           pages is SQLite's default threshold. */
+        checkpointer = std::make_unique<SQLiteCheckpointer>(
+            path, tuning.walAutoCheckpoint ? (int) tuning.walAutoCheckpoint : 1000);
+        sqlite3_wal_hook(db, SQLiteCheckpointer::walHook, checkpointer.get());
+    } else if (tuning.walAutoCheckpoint)
+        exec(fmt("pragma wal_autocheckpoint = %d", tuning.walAutoCheckpoint));
 }
 
 void SQLite::exec(const std::string & stmt)
@@ -240,6 +414,12 @@ std::string SQLiteStmt::Use::getStr(int col)
     return s;
 }
 
+std::string_view SQLiteStmt::Use::getBlob(int col)
+{
+    auto data = (const char *) sqlite3_column_blob(stmt, col);
+    return {data ? data : "", (size_t) sqlite3_column_bytes(stmt, col)};
+}
+
 int64_t SQLiteStmt::Use::getInt(int col)
 {
     // FIXME: detect nulls?
@@ -278,6 +458,9 @@ SQLiteTxn::~SQLiteTxn()
 
 void handleSQLiteBusy(const SQLiteBusy & e, time_t & nextWarning)
 {
+    if (auto metrics = getStoreMetrics())
+        metrics->sqliteBusy++;
+
     time_t now = time(0);
     if (now > nextWarning) {
         nextWarning = now + 10;
@@ -288,7 +471,10 @@ void handleSQLiteBusy(const SQLiteBusy & e, time_t & nextWarning)
        is likely to fail again. */
     checkInterrupt();
     /* <= 0.1s */
-    std::this_thread::sleep_for(std::chrono::milliseconds{rand() % 100});
+    auto delay = rand() % 100;
+    if (auto metrics = getStoreMetrics())
+        metrics->sqliteBusyWaitUs += delay * 1000;
+    std::this_thread::sleep_for(std::chrono::milliseconds{delay});
 }
 
 } // namespace nix
@@ -78,6 +78,16 @@ protected:
 
     SSHMaster master;
 
+    WorkerProto::FeatureSet getSupportedFeatures() override
+    {
+        auto features = RemoteStore::getSupportedFeatures();
+        if (config->compressNars)
+            features.insert(std::string(WorkerProto::featureZstdNar));
+        if (config->deltaTransfer)
+            features.insert(std::string(WorkerProto::featureNarDelta));
+        return features;
+    }
+
     void setOptions(RemoteStore::Connection & conn) override {
         /* TODO Add a way to explicitly ask for some options to be
            forwarded. One option: A way to query the daemon for its
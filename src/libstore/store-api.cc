@@ -11,6 +11,7 @@
 #include "nix/store/nar-info-disk-cache.hh"
 #include "nix/util/thread-pool.hh"
 #include "nix/util/archive.hh"
+#include "nix/util/file-hash-cache.hh"
 #include "nix/util/callback.hh"
 #include "nix/util/git.hh"
 #include "nix/util/posix-source-accessor.hh"
@@ -18,6 +19,7 @@
 // `addMultipleToStore`.
 #include "nix/store/worker-protocol.hh"
 #include "nix/util/signals.hh"
+#include "nix/util/finally.hh"
 
 #include <filesystem>
 #include <nlohmann/json.hpp>
@@ -93,6 +95,23 @@ StorePath Store::addToStore(
     PathFilter & filter,
     RepairFlag repair)
 {
+    /* If the file hash cache knows the hash of `path`, and the
+       resulting store path already exists, there is nothing to
+       copy. */
+    auto fileHashCache = getFileHashCache();
+    std::optional<std::string> cacheKey;
+    if (fileHashCache && method.getFileIngestionMethod() != FileIngestionMethod::Git)
+        cacheKey = fileHashCacheKey(path, method.getFileIngestionMethod(), hashAlgo, filter);
+    if (cacheKey)
+        if (auto res = fileHashCache->lookup(*cacheKey)) {
+            auto storePath = makeFixedOutputPathFromCA(
+                name, ContentAddressWithReferences::fromParts(method, res->hash, {.others = references, .self = false}));
+            if (!repair && isValidPath(storePath)) {
+                debug("file hash cache hit for '%s'", path);
+                return storePath;
+            }
+        }
+
     FileSerialisationMethod fsm;
     switch (method.getFileIngestionMethod()) {
     case FileIngestionMethod::Flat:
@@ -107,14 +126,23 @@ StorePath Store::addToStore(
         break;
     }
     std::optional<StorePath> storePath;
+    uint64_t size = 0;
     auto sink = sourceToSink([&](Source & source) {
         LengthSource lengthSource(source);
         storePath = addToStoreFromDump(lengthSource, name, fsm, method, hashAlgo, references, repair);
+        size = lengthSource.total;
         if (settings.warnLargePathThreshold && lengthSource.total >= settings.warnLargePathThreshold)
             warn("copied large path '%s' to the store (%s)", path, renderSize(lengthSource.total));
     });
     dumpPath(path, *sink, fsm, filter);
     sink->finish();
+
+    /* Remember the hash, unless `path` changed while it was being
+       copied. */
+    if (cacheKey && fileHashCacheKey(path, method.getFileIngestionMethod(), hashAlgo, filter) == cacheKey)
+        if (auto ca = queryPathInfo(*storePath)->ca)
+            fileHashCache->upsert(*cacheKey, {.hash = ca->hash, .numBytesDigested = size});
+
     return storePath.value();
 }
 
@@ -138,8 +166,21 @@ void Store::addMultipleToStore(PathsSource && pathsToCopy, Activity & act, Repai
 
     act.setExpected(actCopyPath, bytesExpected);
 
+    if (checkSigs) {
+        std::vector<const ValidPathInfo *> infos;
+        for (auto & [info, _] : pathsToCopy)
+            infos.push_back(&info);
+        precheckSignatures(infos);
+    }
+
     auto showProgress = [&, nrTotal = pathsToCopy.size()]() { act.progress(nrDone, nrTotal, nrRunning, nrFailed); };
 
+    /* Limit the combined NAR size of the paths being added at the
+       same time, since some stores buffer the whole NAR in memory. */
+    uint64_t maxBytesInFlight = settings.copyMaxBytesInFlight;
+    Sync<uint64_t> bytesInFlight_{0};
+    std::condition_variable bytesInFlightCV;
+
     processGraph<StorePath>(
         storePathsToAdd,
 
@@ -170,6 +211,20 @@ void Store::addMultipleToStore(PathsSource && pathsToCopy, Activity & act, Repai
             auto source = std::move(source_);
 
             if (!isValidPath(info.path)) {
+                if (maxBytesInFlight) {
+                    auto bytesInFlight(bytesInFlight_.lock());
+                    while (*bytesInFlight && *bytesInFlight + info.narSize > maxBytesInFlight) {
+                        bytesInFlight.wait_for(bytesInFlightCV, std::chrono::milliseconds(100));
+                        checkInterrupt();
+                    }
+                    *bytesInFlight += info.narSize;
+                }
+                Finally releaseBytes([&]() {
+                    if (maxBytesInFlight) {
+                        *bytesInFlight_.lock() -= info.narSize;
+                        bytesInFlightCV.notify_all();
+                    }
+                });
                 MaintainCount<decltype(nrRunning)> mc(nrRunning);
                 showProgress();
                 try {
@@ -186,7 +241,8 @@ void Store::addMultipleToStore(PathsSource && pathsToCopy, Activity & act, Repai
 
             nrDone++;
             showProgress();
-        });
+        },
+        settings.copyPathJobs);
 }
 
 void Store::addMultipleToStore(Source & source, RepairFlag repair, CheckSigsFlag checkSigs)
@@ -206,6 +262,89 @@ void Store::addMultipleToStore(Source & source, RepairFlag repair, CheckSigsFlag
     }
 }
 
+std::vector<StorePath> Store::addMultipleToStoreFromDump(std::vector<DumpToAdd> && dumps, RepairFlag repair)
+{
+    std::vector<std::optional<StorePath>> paths(dumps.size());
+    std::vector<std::pair<ValidPathInfo, std::string>> nars;
+    std::vector<size_t> slow;
+
+    for (size_t i = 0; i < dumps.size(); ++i) {
+        auto & d = dumps[i];
+
+        if (static_cast<FileIngestionMethod>(d.dumpMethod) != d.hashMethod.getFileIngestionMethod()) {
+            slow.push_back(i);
+            continue;
+        }
+
+        auto desc = ContentAddressWithReferences::fromParts(
+            d.hashMethod,
+            hashString(d.hashAlgo, d.dump),
+            {
+                .others = d.references,
+                .self = false,
+            });
+
+        std::string nar;
+        if (d.dumpMethod == FileSerialisationMethod::NixArchive)
+            nar = std::move(d.dump);
+        else {
+            StringSink sink;
+            dumpString(d.dump, sink);
+            nar = std::move(sink.s);
+        }
+
+        auto info = ValidPathInfo::makeFromCA(*this, d.name, std::move(desc), hashString(HashAlgorithm::SHA256, nar));
+        info.narSize = nar.size();
+        paths[i] = info.path;
+        nars.emplace_back(std::move(info), std::move(nar));
+    }
+
+    StorePathSet valid;
+    if (!repair) {
+        StorePathSet all;
+        for (auto & [info, _] : nars)
+            all.insert(info.path);
+        valid = queryValidPaths(all);
+    }
+
+    uint64_t nrPaths = 0;
+    StringSink batch;
+    for (auto & [info, nar] : nars) {
+        if (!valid.insert(info.path).second)
+            continue;
+        WorkerProto::Serialise<ValidPathInfo>::write(
+            *this,
+            WorkerProto::WriteConn{
+                .to = batch,
+                .version = 16,
+            },
+            info);
+        batch(nar);
+        nar = {};
+        nrPaths++;
+    }
+
+    if (nrPaths) {
+        StringSink header;
+        header << nrPaths;
+        StringSource headerSource{header.s}, batchSource{batch.s};
+        ChainSource source{headerSource, batchSource};
+        /* Content-addressed paths don't need signatures. */
+        addMultipleToStore(source, repair, NoCheckSigs);
+    }
+
+    for (auto i : slow) {
+        auto & d = dumps[i];
+        StringSource source{d.dump};
+        paths[i] = addToStoreFromDump(source, d.name, d.dumpMethod, d.hashMethod, d.hashAlgo, d.references, repair);
+    }
+
+    std::vector<StorePath> res;
+    for (auto & path : paths)
+        res.push_back(std::move(*path));
+    return res;
+}
+
 /*
 The aim of this function is to compute in one pass the correct ValidPathInfo for
 the files that we are trying to add to the store. To accomplish that in one
@@ -324,6 +463,9 @@ Store::Store(const Store::Config & config)
     : StoreDirConfig{config}
     , config{config}
     , pathInfoCache(make_ref<decltype(pathInfoCache)::element_type>((size_t) config.pathInfoCacheSize))
+    , negativePathInfoCache(
+          make_ref<decltype(negativePathInfoCache)::element_type>((size_t) config.pathInfoNegativeCacheSize))
+    , derivationCache(make_ref<decltype(derivationCache)::element_type>((size_t) config.derivationCacheSize))
 {
     assertLibStoreInitialized();
 }
@@ -343,7 +485,32 @@ bool Store::PathInfoCacheValue::isKnownNow()
 
 void Store::invalidatePathInfoCacheFor(const StorePath & path)
 {
-    pathInfoCache->lock()->erase(path);
+    pathInfoCache->erase(path);
+    negativePathInfoCache->erase(path);
+}
+
+void Store::cachePathInfo(const StorePath & path, std::shared_ptr<const ValidPathInfo> info)
+{
+    if (info) {
+        negativePathInfoCache->erase(path);
+        pathInfoCache->upsert(path, PathInfoCacheValue{.value = std::move(info)});
+    } else {
+        pathInfoCache->erase(path);
+        negativePathInfoCache->upsert(path, PathInfoCacheValue{});
+    }
+}
+
+std::optional<Store::PathInfoCacheValue> Store::lookupPathInfoCache(const StorePath & path)
+{
+    if (auto res = pathInfoCache->get(path); res && res->isKnownNow()) {
+        stats.pathInfoCacheHits++;
+        return res;
+    }
+    if (auto res = negativePathInfoCache->get(path); res && res->isKnownNow()) {
+        stats.pathInfoNegativeCacheHits++;
+        return res;
+    }
+    return std::nullopt;
 }
 
 std::map<std::string, std::optional<StorePath>> Store::queryStaticPartialDerivationOutputMap(const StorePath & path)
@@ -367,11 +534,14 @@ Store::queryPartialDerivationOutputMap(const StorePath & path, Store * evalStore
         return outputs;
 
     auto drv = evalStore.readInvalidDerivation(path);
-    auto drvHashes = staticOutputHashes(*this, drv);
-    for (auto & [outputName, hash] : drvHashes) {
-        auto realisation = queryRealisation(DrvOutput{hash, outputName});
-        if (realisation) {
-            outputs.insert_or_assign(outputName, realisation->outPath);
+    std::set<DrvOutput> ids;
+    for (auto & [outputName, hash] : staticOutputHashes(*this, drv))
+        ids.insert(DrvOutput{hash, outputName});
+    auto realisations = queryRealisations(ids);
+    for (auto & id : ids) {
+        auto & outputName = id.outputName;
+        if (auto i = realisations.find(id); i != realisations.end()) {
+            outputs.insert_or_assign(outputName, i->second->outPath);
         } else {
             // queryStaticPartialDerivationOutputMap is not guaranteed
             // to return std::nullopt for outputs which are not
@@ -410,14 +580,20 @@ void Store::querySubstitutablePathInfos(const StorePathCAMap & paths, Substituta
     if (!settings.useSubstitutes)
         return;
 
+    auto subs = getDefaultSubstituters();
+
+    /* Start the lookups of all paths on all substituters at once,
+       rather than one after the other. For HTTP binary caches these
+       are multiplexed over the file transfer's connections, so a miss
+       on a high-priority substituter no longer delays asking the next
+       one. The results are still used in order of priority. */
+    using Lookup = std::optional<std::future<ref<const ValidPathInfo>>>;
+    std::vector<std::vector<Lookup>> lookups;
+
     for (auto & path : paths) {
-        std::optional<Error> lastStoresException = std::nullopt;
-        for (auto & sub : getDefaultSubstituters()) {
-            if (lastStoresException.has_value()) {
-                logError(lastStoresException->info());
-                lastStoresException.reset();
-            }
+        auto & pathLookups = lookups.emplace_back();
 
+        for (auto & sub : subs) {
             auto subPath(path.first);
 
             // Recompute store path so that we can use a different store root.
@@ -432,15 +608,44 @@ void Store::querySubstitutablePathInfos(const StorePathCAMap & paths, Substituta
                         printStorePath(path.first),
                         sub->printStorePath(subPath),
                         sub->config.getHumanReadableURI());
-            } else if (sub->storeDir != storeDir)
+            } else if (sub->storeDir != storeDir) {
+                pathLookups.push_back(std::nullopt);
                 continue;
+            }
 
             debug(
                 "checking substituter '%s' for path '%s'",
                 sub->config.getHumanReadableURI(),
                 sub->printStorePath(subPath));
+
+            auto promise = std::make_shared<std::promise<ref<const ValidPathInfo>>>();
+            pathLookups.push_back(promise->get_future());
+            sub->queryPathInfo(subPath, {[promise](std::future<ref<const ValidPathInfo>> result) {
+                                   try {
+                                       promise->set_value(result.get());
+                                   } catch (...) {
+                                       promise->set_exception(std::current_exception());
+                                   }
+                               }});
+        }
+    }
+
+    auto pathLookups = lookups.begin();
+    for (auto & path : paths) {
+        std::optional<Error> lastStoresException = std::nullopt;
+        auto lookup = pathLookups++->begin();
+        for (auto & sub : subs) {
+            auto & result = *lookup++;
+            if (!result)
+                continue;
+
+            if (lastStoresException.has_value()) {
+                logError(lastStoresException->info());
+                lastStoresException.reset();
+            }
+
             try {
-                auto info = sub->queryPathInfo(subPath);
+                auto info = result->get();
 
                 if (sub->storeDir != storeDir && !(info->isContentAddressed(*sub) && info->references.empty()))
                     continue;
@@ -473,8 +678,7 @@ void Store::querySubstitutablePathInfos(const StorePathCAMap & paths, Substituta
 
 bool Store::isValidPath(const StorePath & storePath)
 {
-    auto res = pathInfoCache->lock()->get(storePath);
-    if (res && res->isKnownNow()) {
+    if (auto res = lookupPathInfoCache(storePath)) {
         stats.narInfoReadAverted++;
         return res->didExist();
     }
@@ -484,10 +688,7 @@ bool Store::isValidPath(const StorePath & storePath)
             config.getReference().render(/*FIXME withParams=*/false), std::string(storePath.hashPart()));
         if (res.first != NarInfoDiskCache::oUnknown) {
             stats.narInfoReadAverted++;
-            pathInfoCache->lock()->upsert(
-                storePath,
-                res.first == NarInfoDiskCache::oInvalid ? PathInfoCacheValue{}
-                                                        : PathInfoCacheValue{.value = res.second});
+            cachePathInfo(storePath, res.first == NarInfoDiskCache::oInvalid ? nullptr : res.second);
             return res.first == NarInfoDiskCache::oValid;
         }
     }
@@ -539,8 +740,7 @@ std::optional<std::shared_ptr<const ValidPathInfo>> Store::queryPathInfoFromClie
 {
     auto hashPart = std::string(storePath.hashPart());
 
-    auto res = pathInfoCache->lock()->get(storePath);
-    if (res && res->isKnownNow()) {
+    if (auto res = lookupPathInfoCache(storePath)) {
         stats.narInfoReadAverted++;
         if (res->didExist())
             return std::make_optional(res->value);
@@ -552,10 +752,7 @@ std::optional<std::shared_ptr<const ValidPathInfo>> Store::queryPathInfoFromClie
         auto res = diskCache->lookupNarInfo(config.getReference().render(/*FIXME withParams=*/false), hashPart);
         if (res.first != NarInfoDiskCache::oUnknown) {
             stats.narInfoReadAverted++;
-            pathInfoCache->lock()->upsert(
-                storePath,
-                res.first == NarInfoDiskCache::oInvalid ? PathInfoCacheValue{}
-                                                        : PathInfoCacheValue{.value = res.second});
+            cachePathInfo(storePath, res.first == NarInfoDiskCache::oInvalid ? nullptr : res.second);
             if (res.first == NarInfoDiskCache::oInvalid || !goodStorePath(storePath, res.second->path))
                 return std::make_optional(nullptr);
             assert(res.second);
@@ -593,7 +790,7 @@ void Store::queryPathInfo(const StorePath & storePath, Callback<ref<const ValidP
                 if (diskCache)
                     diskCache->upsertNarInfo(config.getReference().render(/*FIXME withParams=*/false), hashPart, info);
 
-                pathInfoCache->lock()->upsert(storePath, PathInfoCacheValue{.value = info});
+                cachePathInfo(storePath, info);
 
                 if (!info || !goodStorePath(storePath, info->path)) {
                     stats.narInfoMissing++;
@@ -607,6 +804,79 @@ void Store::queryPathInfo(const StorePath & storePath, Callback<ref<const ValidP
         }});
 }
 
+std::map<StorePath, ref<const ValidPathInfo>> Store::queryMultiplePathInfos(const StorePathSet & paths)
+{
+    std::map<StorePath, ref<const ValidPathInfo>> res;
+
+    StorePathSet uncached;
+    for (auto & path : paths) {
+        if (auto r = queryPathInfoFromClientCache(path)) {
+            if (*r)
+                res.insert_or_assign(path, ref(*r));
+        } else
+            uncached.insert(path);
+    }
+
+    if (uncached.empty())
+        return res;
+
+    auto infos = queryMultiplePathInfosUncached(uncached);
+
+    for (auto & path : uncached) {
+        auto i = infos.find(path);
+        std::shared_ptr<const ValidPathInfo> info = i != infos.end() ? i->second : nullptr;
+
+        if (diskCache)
+            diskCache->upsertNarInfo(
+                config.getReference().render(/*FIXME withParams=*/false), std::string(path.hashPart()), info);
+
+        cachePathInfo(path, info);
+
+        if (!info || !goodStorePath(path, info->path)) {
+            stats.narInfoMissing++;
+            continue;
+        }
+
+        res.insert_or_assign(path, ref(info));
+    }
+
+    return res;
+}
+
+std::map<StorePath, std::shared_ptr<const ValidPathInfo>>
+Store::queryMultiplePathInfosUncached(const StorePathSet & paths)
+{
+    struct State
+    {
+        size_t left;
+        std::map<StorePath, std::shared_ptr<const ValidPathInfo>> infos;
+        std::exception_ptr exc;
+    };
+
+    Sync<State> state_{State{.left = paths.size()}};
+    std::condition_variable wakeup;
+
+    for (auto & path : paths)
+        queryPathInfoUncached(path, {[&, path](std::future<std::shared_ptr<const ValidPathInfo>> fut) {
+                                  auto state(state_.lock());
+                                  try {
+                                      state->infos.insert_or_assign(path, fut.get());
+                                  } catch (...) {
+                                      if (!state->exc)
+                                          state->exc = std::current_exception();
+                                  }
+                                  if (!--state->left)
+                                      wakeup.notify_one();
+                              }});
+
+    auto state(state_.lock());
+    while (state->left)
+        state.wait(wakeup);
+    if (state->exc)
+        std::rethrow_exception(state->exc);
+    return std::move(state->infos);
+}
+
 void Store::queryRealisation(
     const DrvOutput & id, Callback<std::shared_ptr<const UnkeyedRealisation>> callback) noexcept
 {
@@ -671,6 +941,84 @@ std::shared_ptr<const UnkeyedRealisation> Store::queryRealisation(const DrvOutpu
     return promise.get_future().get();
 }
 
+std::map<DrvOutput, std::shared_ptr<const UnkeyedRealisation>>
+Store::queryRealisations(const std::set<DrvOutput> & outputs)
+{
+    std::map<DrvOutput, std::shared_ptr<const UnkeyedRealisation>> res;
+
+    auto uri = config.getReference().render(/*FIXME withParams=*/false);
+
+    std::set<DrvOutput> uncached;
+    for (auto & id : outputs) {
+        if (diskCache) {
+            auto [cacheOutcome, maybeCachedRealisation] = diskCache->lookupRealisation(uri, id);
+            if (cacheOutcome == NarInfoDiskCache::oValid) {
+                res.insert_or_assign(id, std::move(maybeCachedRealisation));
+                continue;
+            }
+            if (cacheOutcome == NarInfoDiskCache::oInvalid)
+                continue;
+        }
+        uncached.insert(id);
+    }
+
+    if (uncached.empty())
+        return res;
+
+    auto realisations = queryRealisationsUncached(uncached);
+
+    for (auto & id : uncached) {
+        auto i = realisations.find(id);
+        std::shared_ptr<const UnkeyedRealisation> info = i != realisations.end() ? i->second : nullptr;
+
+        if (diskCache) {
+            if (info)
+                diskCache->upsertRealisation(uri, {*info, id});
+            else
+                diskCache->upsertAbsentRealisation(uri, id);
+        }
+
+        if (info)
+            res.insert_or_assign(id, std::move(info));
+    }
+
+    return res;
+}
+
+std::map<DrvOutput, std::shared_ptr<const UnkeyedRealisation>>
+Store::queryRealisationsUncached(const std::set<DrvOutput> & outputs)
+{
+    struct State
+    {
+        size_t left;
+        std::map<DrvOutput, std::shared_ptr<const UnkeyedRealisation>> realisations;
+        std::exception_ptr exc;
+    };
+
+    Sync<State> state_{State{.left = outputs.size()}};
+    std::condition_variable wakeup;
+
+    for (auto & id : outputs)
+        queryRealisationUncached(id, {[&, id](std::future<std::shared_ptr<const UnkeyedRealisation>> fut) {
+                                     auto state(state_.lock());
+                                     try {
+                                         state->realisations.insert_or_assign(id, fut.get());
+                                     } catch (...) {
+                                         if (!state->exc)
+                                             state->exc = std::current_exception();
+                                     }
+                                     if (!--state->left)
+                                         wakeup.notify_one();
+                                 }});
+
+    auto state(state_.lock());
+    while (state->left)
+        state.wait(wakeup);
+    if (state->exc)
+        std::rethrow_exception(state->exc);
+    return std::move(state->realisations);
+}
+
 void Store::substitutePaths(const StorePathSet & paths)
 {
     std::vector<DerivedPath> paths2;
@@ -817,7 +1165,8 @@ StorePathSet Store::exportReferences(const StorePathSet & storePaths, const Stor
 
 const Store::Stats & Store::getStats()
 {
-    stats.pathInfoCacheSize = pathInfoCache->readLock()->size();
+    stats.pathInfoCacheSize = pathInfoCache->size();
+    stats.pathInfoNegativeCacheSize = negativePathInfoCache->size();
     return stats;
 }
 
@@ -962,6 +1311,21 @@ std::map<StorePath, StorePath> copyPaths(
 
     Activity act(*logger, lvlInfo, actCopyPaths, fmt("copying %d paths", missing.size()));
 
+    /* Query the path infos in parallel, since for remote stores each
+       query is a round trip. This also warms the path info cache
+       used by topoSortPaths(). */
+    Sync<std::map<StorePath, ref<const ValidPathInfo>>> infos_;
+    {
+        ThreadPool pool(settings.copyPathJobs);
+        for (auto & path : missing)
+            pool.enqueue([&, path]() {
+                auto info = srcStore.queryPathInfo(path);
+                infos_.lock()->insert_or_assign(path, info);
+            });
+        pool.process();
+    }
+    auto infos = std::move(*infos_.lock());
+
     // In the general case, `addMultipleToStore` requires a sorted list of
     // store paths to add, so sort them right now
     auto sortedMissing = srcStore.topoSortPaths(missing);
@@ -992,7 +1356,7 @@ std::map<StorePath, StorePath> copyPaths(
     };
 
     for (auto & missingPath : sortedMissing) {
-        auto info = srcStore.queryPathInfo(missingPath);
+        auto info = infos.at(missingPath);
 
         auto storePathForDst = computeStorePathForDst(*info);
         pathsMap.insert_or_assign(missingPath, storePathForDst);
@@ -1140,13 +1504,19 @@ Derivation Store::derivationFromPath(const StorePath & drvPath)
     return readDerivation(drvPath);
 }
 
-static Derivation readDerivationCommon(Store & store, const StorePath & drvPath, bool requireValidPath)
+Derivation Store::readDerivationCommon(const StorePath & drvPath, bool requireValidPath)
 {
-    auto accessor = store.requireStoreObjectAccessor(drvPath, requireValidPath);
+    if (auto drv = derivationCache->get(drvPath); drv && (!requireValidPath || isValidPath(drvPath)))
+        return **drv;
+
+    auto accessor = requireStoreObjectAccessor(drvPath, requireValidPath);
     try {
-        return parseDerivation(store, accessor->readFile(CanonPath::root), Derivation::nameFromPath(drvPath));
+        auto drv = std::make_shared<const Derivation>(
+            parseDerivation(*this, accessor->readFile(CanonPath::root), Derivation::nameFromPath(drvPath)));
+        derivationCache->upsert(drvPath, drv);
+        return *drv;
     } catch (FormatError & e) {
-        throw Error("error parsing derivation '%s': %s", store.printStorePath(drvPath), e.msg());
+        throw Error("error parsing derivation '%s': %s", printStorePath(drvPath), e.msg());
     }
 }
 
@@ -1179,14 +1549,19 @@ std::optional<StorePath> Store::getBuildDerivationPath(const StorePath & path)
     return path;
 }
 
+std::map<StorePath, DrvHash> Store::queryDerivationHashesModulo(const StorePathSet & drvPaths)
+{
+    return {};
+}
+
 Derivation Store::readDerivation(const StorePath & drvPath)
 {
-    return readDerivationCommon(*this, drvPath, true);
+    return readDerivationCommon(drvPath, true);
 }
 
 Derivation Store::readInvalidDerivation(const StorePath & drvPath)
 {
-    return readDerivationCommon(*this, drvPath, false);
+    return readDerivationCommon(drvPath, false);
 }
 
 void Store::signPathInfo(ValidPathInfo & info)
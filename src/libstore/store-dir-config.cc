@@ -1,5 +1,6 @@
 #include "nix/util/source-path.hh"
 #include "nix/util/util.hh"
+#include "nix/util/file-hash-cache.hh"
 #include "nix/store/store-dir-config.hh"
 #include "nix/store/derivations.hh"
 #include "nix/store/globals.hh"
@@ -156,7 +157,7 @@ std::pair<StorePath, Hash> StoreDirConfig::computeStorePath(
     const StorePathSet & references,
     PathFilter & filter) const
 {
-    auto [h, size] = hashPath(path, method.getFileIngestionMethod(), hashAlgo, filter);
+    auto [h, size] = hashPathCached(path, method.getFileIngestionMethod(), hashAlgo, filter);
     if (settings.warnLargePathThreshold && size && *size >= settings.warnLargePathThreshold)
         warn("hashed large path '%s' (%s)", path, renderSize(*size));
     return {
@@ -0,0 +1,198 @@
+#include "nix/store/store-metrics.hh"
+#include "nix/store/globals.hh"
+
+#ifndef _WIN32
+#  include <sys/mman.h>
+#endif
+
+namespace nix {
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "metrics in shared memory require lock-free atomics");
+
+void LatencyHistogram::observe(std::chrono::microseconds duration)
+{
+    uint64_t us = duration.count();
+    auto i = std::ranges::lower_bound(bounds, us) - bounds.begin();
+    buckets[i].fetch_add(1, std::memory_order_relaxed);
+    sumUs.fetch_add(us, std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::count() const
+{
+    uint64_t n = 0;
+    for (auto & bucket : buckets)
+        n += bucket.load(std::memory_order_relaxed);
+    return n;
+}
+
+static StoreMetrics * storeMetrics = nullptr;
+
+StoreMetrics * getStoreMetrics()
+{
+    return storeMetrics;
+}
+
+void enableStoreMetrics()
+{
+    if (storeMetrics)
+        return;
+#ifndef _WIN32
+    auto p = mmap(nullptr, sizeof(StoreMetrics), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        throw SysError("allocating shared memory for metrics");
+    storeMetrics = new (p) StoreMetrics;
+#else
+    storeMetrics = new StoreMetrics;
+#endif
+}
+
+namespace {
+
+struct StoreStatInfo
+{
+    std::atomic<uint64_t> Store::Stats::* field;
+    std::string_view name;
+    std::string_view help;
+};
+
+/**
+ * The counters in `Store::Stats`. The sizes of the path info caches
+ * are left out because they are per-process gauges, which can't be
+ * summed meaningfully.
+ */
+const StoreStatInfo storeStatInfos[] = {
+    {&Store::Stats::narInfoRead, "narinfo_read", "narinfo files read."},
+    {&Store::Stats::narInfoReadAverted, "narinfo_read_averted", "narinfo lookups answered from the cache."},
+    {&Store::Stats::narInfoMissing, "narinfo_missing", "narinfo lookups for paths that don't exist."},
+    {&Store::Stats::narInfoWrite, "narinfo_write", "narinfo files written."},
+    {&Store::Stats::pathInfoCacheHits, "path_info_cache_hits", "Path info lookups answered from memory."},
+    {&Store::Stats::pathInfoNegativeCacheHits,
+     "path_info_negative_cache_hits",
+     "Negative path info lookups answered from memory."},
+    {&Store::Stats::narRead, "nar_read", "NARs read."},
+    {&Store::Stats::narReadBytes, "nar_read_bytes", "Uncompressed bytes of NARs read."},
+    {&Store::Stats::narReadCompressedBytes, "nar_read_compressed_bytes", "Compressed bytes of NARs read."},
+    {&Store::Stats::narWrite, "nar_write", "NARs written."},
+    {&Store::Stats::narWriteAverted, "nar_write_averted", "NAR writes skipped because the NAR already existed."},
+    {&Store::Stats::narWriteBytes, "nar_write_bytes", "Uncompressed bytes of NARs written."},
+    {&Store::Stats::narWriteCompressedBytes, "nar_write_compressed_bytes", "Compressed bytes of NARs written."},
+    {&Store::Stats::narWriteCompressionTimeMs,
+     "nar_write_compression_milliseconds",
+     "Milliseconds spent compressing NARs."},
+};
+
+} // namespace
+
+void StoreStatsReporter::report(Store & store)
+{
+    auto metrics = getStoreMetrics();
+    if (!metrics)
+        return;
+
+    auto & stats = store.getStats();
+    reported.resize(std::size(storeStatInfos), 0);
+    for (size_t i = 0; i < std::size(storeStatInfos); ++i) {
+        auto field = storeStatInfos[i].field;
+        auto value = (stats.*field).load(std::memory_order_relaxed);
+        if (value > reported[i]) {
+            (metrics->storeStats.*field).fetch_add(value - reported[i], std::memory_order_relaxed);
+            reported[i] = value;
+        }
+    }
+}
+
+std::string renderOpenMetrics(const StoreMetrics & metrics)
+{
+    std::string out;
+
+    auto metric = [&](std::string_view name, std::string_view type, std::string_view help) {
+        out += fmt("# TYPE nix_%s %s\n# HELP nix_%s %s\n", name, type, name, help);
+    };
+
+    auto counter = [&](std::string_view name, std::string_view help, uint64_t value) {
+        metric(name, "counter", help);
+        out += fmt("nix_%s_total %d\n", name, value);
+    };
+
+    auto gauge = [&](std::string_view name, std::string_view help, int64_t value) {
+        metric(name, "gauge", help);
+        out += fmt("nix_%s %d\n", name, value);
+    };
+
+    auto load = [](auto & x) { return x.load(std::memory_order_relaxed); };
+
+    counter("daemon_connections", "Connections accepted by the daemon.", load(metrics.connections));
+    gauge("daemon_connections_active", "Connections currently being served.", load(metrics.connectionsActive));
+
+    auto histogram = [&](std::string_view name, const std::string & labels, const LatencyHistogram & histogram) {
+        auto bucketLabels = labels.empty() ? "" : labels + ",";
+        auto sumLabels = labels.empty() ? "" : "{" + labels + "}";
+        uint64_t cumulative = 0;
+        for (size_t i = 0; i < histogram.buckets.size(); ++i) {
+            cumulative += load(histogram.buckets[i]);
+            auto le = i < LatencyHistogram::bounds.size() ? fmt("%s", LatencyHistogram::bounds[i] / 1e6) : "+Inf";
+            out += fmt("nix_%s_bucket{%sle=\"%s\"} %d\n", name, bucketLabels, le, cumulative);
+        }
+        out += fmt("nix_%s_sum%s %.6f\n", name, sumLabels, load(histogram.sumUs) / 1e6);
+        out += fmt("nix_%s_count%s %d\n", name, sumLabels, cumulative);
+    };
+
+    metric("daemon_op_duration_seconds", "histogram", "Time taken by worker protocol operations, by op code.");
+    for (size_t op = 0; op < StoreMetrics::maxOps; ++op)
+        if (metrics.opLatency[op].count())
+            histogram("daemon_op_duration_seconds", fmt("op=\"%d\"", op), metrics.opLatency[op]);
+
+    metric("daemon_op_errors", "counter", "Worker protocol operations that failed, by op code.");
+    for (size_t op = 0; op < StoreMetrics::maxOps; ++op)
+        if (auto n = load(metrics.opErrors[op]))
+            out += fmt("nix_daemon_op_errors_total{op=\"%d\"} %d\n", op, n);
+
+    counter("sqlite_busy", "SQLite transactions retried because the database was busy.", load(metrics.sqliteBusy));
+    counter("sqlite_busy_waits", "SQLite statements that waited for a database lock.", load(metrics.sqliteBusyWaits));
+    metric("sqlite_busy_wait_seconds", "counter", "Time spent waiting for SQLite database locks.");
+    out += fmt("nix_sqlite_busy_wait_seconds_total %.6f\n", load(metrics.sqliteBusyWaitUs) / 1e6);
+    metric("sqlite_checkpoint_seconds", "histogram", "Time taken by background SQLite WAL checkpoints.");
+    histogram("sqlite_checkpoint_seconds", "", metrics.sqliteCheckpoint);
+
+    counter("path_locks_acquired", "Path locks acquired.", load(metrics.pathLocksAcquired));
+    counter(
+        "path_locks_contended",
+        "Path locks that were held by another process or goal when first tried.",
+        load(metrics.pathLocksContended));
+    metric("path_lock_wait_seconds", "histogram", "Time taken to acquire contended path locks.");
+    histogram("path_lock_wait_seconds", "", metrics.pathLockWait);
+
+    gauge("gc_running", "Garbage collections currently running.", load(metrics.gcRunning));
+    counter("gc_runs", "Garbage collections started.", load(metrics.gcRuns));
+    counter("gc_paths_deleted", "Store paths deleted by the garbage collector.", load(metrics.gcPathsDeleted));
+    counter("gc_freed_bytes", "Bytes freed by the garbage collector.", load(metrics.gcBytesFreed));
+
+    counter("optimise_queued", "Store paths queued for automatic optimisation.", load(metrics.optimiseQueued));
+    gauge(
+        "optimise_backlog",
+        "Store paths waiting for or undergoing automatic optimisation.",
+        load(metrics.optimiseBacklog));
+    counter(
+        "optimise_files_linked", "Files replaced by links by automatic optimisation.", load(metrics.optimiseFilesLinked));
+    counter("optimise_freed_bytes", "Bytes freed by automatic optimisation.", load(metrics.optimiseBytesFreed));
+
+    gauge("build_slots", "Build slots, as set by `max-jobs`.", settings.maxBuildJobs.get());
+    gauge("builds_running", "Build slots in use by local builds.", load(metrics.buildsRunning));
+    gauge(
+        "substitution_slots",
+        "Substitution slots, as set by `max-substitution-jobs`.",
+        settings.maxSubstitutionJobs.get());
+    gauge("substitutions_running", "Substitution slots in use.", load(metrics.substitutionsRunning));
+    gauge("goals_waiting", "Goals waiting for a free build or substitution slot.", load(metrics.goalsWaiting));
+
+    for (auto & info : storeStatInfos)
+        counter(
+            fmt("store_%s", info.name),
+            info.help,
+            load(metrics.storeStats.*info.field));
+
+    out += "# EOF\n";
+    return out;
+}
+
+} // namespace nix
@@ -857,6 +857,9 @@ PathsInChroot DerivationBuilderImpl::getPathsInSandbox()
     }
     pathsInChroot[tmpDirInSandbox()] = {.source = tmpDir};
 
+    if (jobserverFifo)
+        pathsInChroot[*jobserverFifo] = {.source = *jobserverFifo};
+
     PathSet allowedPaths = settings.allowedImpureHostPrefixes;
 
     /* This works like the above, except on a per-derivation level */
@@ -1046,6 +1049,12 @@ void DerivationBuilderImpl::initEnv()
     /* The maximum number of cores to utilize for parallel building. */
     env["NIX_BUILD_CORES"] = fmt("%d", settings.buildCores ? settings.buildCores : settings.getDefaultCores());
 
+    /* Let build tools share the cores with the other builds. */
+    if (jobserverFifo) {
+        env["MAKEFLAGS"] = jobserverMakeFlags;
+        env["CARGO_MAKEFLAGS"] = jobserverMakeFlags;
+    }
+
     /* Write the final environment. Note that this is intentionally
        *not* `drv.env`, because we've desugared things like like
        "passAFile", "expandReferencesGraph", structured attrs, etc. */
@@ -1119,6 +1128,7 @@ void DerivationBuilderImpl::startDaemon()
         [&] {
             auto config = make_ref<LocalStore::Config>(*this->store.config);
             config->pathInfoCacheSize = 0;
+            config->pathInfoNegativeCacheSize = 0;
             config->stateDir = "/no-such-path";
             config->logDir = "/no-such-path";
             return config;
@@ -1256,6 +1266,7 @@ void DerivationBuilderImpl::runChild(RunChildArgs args)
         BuiltinBuilderContext ctx{
             .drv = drv,
             .tmpDirInSandbox = tmpDirInSandbox(),
+            .storeDir = store.storeDir,
 #if NIX_WITH_AWS_AUTH
             .awsCredentials = args.awsCredentials,
 #endif
@@ -1302,6 +1313,9 @@ void DerivationBuilderImpl::runChild(RunChildArgs args)
                 for (auto & e : drv.outputs)
                     ctx.outputs.insert_or_assign(e.first, store.printStorePath(scratchOutputs.at(e.first)));
 
+                for (auto & i : inputPaths)
+                    ctx.inputPaths.insert(store.printStorePath(i));
+
                 std::string builtinName = drv.builder.substr(8);
                 assert(RegisterBuiltinBuilder::builtinBuilders);
                 if (auto builtin = get(RegisterBuiltinBuilder::builtinBuilders(), builtinName))
@@ -1412,6 +1426,18 @@ SingleDrvOutputs DerivationBuilderImpl::registerOutputs()
     for (auto & [outputName, path] : scratchOutputs)
         scratchOutputsInverse.insert_or_assign(path, outputName);
 
+    /* If every output is input-addressed and built in its final
+       location, no output will be rewritten below, so we can compute
+       the NAR hash of each output in the same pass as the reference
+       scan rather than reading it again. */
+    bool hashWhileScanning = outputRewrites.empty();
+    for (auto & [outputName, output] : drv.outputs) {
+        auto ia = std::get_if<DerivationOutput::InputAddressed>(&output.raw);
+        if (!ia || ia->path != scratchOutputs.at(outputName))
+            hashWhileScanning = false;
+    }
+    std::map<std::string, HashResult> narHashes;
+
     std::map<std::string, std::variant<AlreadyRegistered, PerhapsNeedToRegister>> outputReferencesIfUnregistered;
     std::map<std::string, struct stat> outputStats;
     for (auto & [outputName, _] : drv.outputs) {
@@ -1475,9 +1501,12 @@ SingleDrvOutputs DerivationBuilderImpl::registerOutputs()
         else {
             debug("scanning for references for output '%s' in temp location %s", outputName, actualPath);
 
-            /* Pass blank Sink as we are not ready to hash data at this stage. */
-            NullSink blank;
-            references = scanForReferences(blank, actualPath, referenceablePaths);
+            if (hashWhileScanning) {
+                HashSink narSink{HashAlgorithm::SHA256};
+                references = scanForReferences(narSink, actualPath, referenceablePaths);
+                narHashes.insert_or_assign(outputName, narSink.finish());
+            } else
+                references = scanForReferences(actualPath, referenceablePaths);
         }
 
         StringSet referencedOutputs;
@@ -1533,6 +1562,9 @@ SingleDrvOutputs DerivationBuilderImpl::registerOutputs()
 
     OutputPathMap finalOutputs;
 
+    /* The new outputs to deduplicate once they're registered. */
+    StorePathSet toOptimise;
+
     for (auto & outputName : sortedOutputNames) {
         auto output = get(drv.outputs, outputName);
         auto scratchPath = get(scratchOutputs, outputName);
@@ -1566,10 +1598,14 @@ SingleDrvOutputs DerivationBuilderImpl::registerOutputs()
             continue;
         auto references = *referencesOpt;
 
+        /* Whether the output was replaced since it was canonicalised. */
+        bool replaced = false;
+
         auto rewriteOutput = [&](const StringMap & rewrites) {
             /* Apply hash rewriting if necessary. */
             if (!rewrites.empty()) {
                 debug("rewriting hashes in %1%; cross fingers", actualPath);
+                replaced = true;
 
                 /* FIXME: Is this actually streaming? */
                 auto source = sinkToSource([&](Sink & nextSink) {
@@ -1688,10 +1724,14 @@ SingleDrvOutputs DerivationBuilderImpl::registerOutputs()
                         outputRewrites.insert_or_assign(
                             std::string{scratchPath->hashPart()}, std::string{requiredFinalPath.hashPart()});
                     rewriteOutput(outputRewrites);
-                    HashResult narHashAndSize = hashPath(
-                        {getFSSourceAccessor(), CanonPath(actualPath.native())},
-                        FileSerialisationMethod::NixArchive,
-                        HashAlgorithm::SHA256);
+                    auto narHashAndSize = [&]() -> HashResult {
+                        if (auto narHash = get(narHashes, outputName); narHash && !replaced)
+                            return *narHash;
+                        return hashPath(
+                            {getFSSourceAccessor(), CanonPath(actualPath.native())},
+                            FileSerialisationMethod::NixArchive,
+                            HashAlgorithm::SHA256);
+                    }();
                     ValidPathInfo newInfo0{requiredFinalPath, {store, narHashAndSize.hash}};
                     newInfo0.narSize = narHashAndSize.numBytesDigested;
                     auto refs = rewriteRefs();
@@ -1710,6 +1750,7 @@ SingleDrvOutputs DerivationBuilderImpl::registerOutputs()
                     copyFile(actualPath, tmpOutput, true);
 
                     std::filesystem::rename(tmpOutput, actualPath);
+                    replaced = true;
 
                     return newInfoFromCA(
                         DerivationOutput::CAFloating{
@@ -1739,7 +1780,8 @@ SingleDrvOutputs DerivationBuilderImpl::registerOutputs()
 
         /* FIXME: set proper permissions in restorePath() so
             we don't have to do another traversal. */
-        canonicalisePathMetaData(actualPath, {}, inodesSeen);
+        if (replaced)
+            canonicalisePathMetaData(actualPath, {}, inodesSeen);
 
         /* Calculate where we'll move the output files. In the checking case we
            will leave leave them where they are, for now, rather than move to
@@ -1828,8 +1870,7 @@ SingleDrvOutputs DerivationBuilderImpl::registerOutputs()
             }
 
             if (!store.isValidPath(newInfo.path))
-                store.optimisePath(
-                    store.toRealPath(finalDestPath), NoRepair); // FIXME: combine with scanForReferences()
+                toOptimise.insert(newInfo.path);
 
             newInfo.deriver = drvPath;
             newInfo.ultimate = true;
@@ -1876,6 +1917,11 @@ SingleDrvOutputs DerivationBuilderImpl::registerOutputs()
         store.registerValidPaths(infos2);
     }
 
+    /* Deduplicate the new outputs in the background, so that the goals
+       waiting for them don't have to wait for that too. */
+    for (auto & path : toOptimise)
+        store.optimisePathLater(path);
+
     /* If we made it this far, we are sure the output matches the
        derivation That means it's safe to link the derivation to the
        output hash. We must do that for floating CA derivations, which
@@ -1995,6 +2041,13 @@ std::unique_ptr<DerivationBuilder> makeDerivationBuilder(
         else if (settings.sandboxMode == smRelaxed)
             // FIXME: cache derivationType
             useSandbox = params.drv.type().isSandboxed() && !params.drvOptions.noChroot;
+
+        /* Builtins that only write their outputs from their inputs
+           don't need to be isolated, and they are typically used for
+           many tiny derivations, so skip the sandbox setup for them. */
+        if (params.drv.isBuiltin()
+            && RegisterBuiltinBuilder::unsandboxedBuiltinBuilders().count(params.drv.builder.substr(8)))
+            useSandbox = false;
     }
 
     if (store.storeDir != store.config->realStoreDir.get()) {
@@ -0,0 +1,34 @@
+#include "nix/store/build/jobserver.hh"
+#include "nix/util/fmt.hh"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+namespace nix {
+
+Jobserver::Jobserver(unsigned int tokens)
+    : tokens(tokens)
+    , tmpDir(createTempDir("", "nix-jobserver"), true)
+    , fifo(tmpDir.path() / "fifo")
+{
+    if (mkfifo(fifo.c_str(), 0666) == -1)
+        throw SysError("creating jobserver FIFO %1%", fifo);
+    /* Builds run as other users, so don't let the umask get in the
+       way. */
+    if (chmod(fifo.c_str(), 0666) == -1)
+        throw SysError("changing permissions of %1%", fifo);
+
+    /* Opening a FIFO for reading and writing doesn't block. */
+    fd = toDescriptor(open(fifo.c_str(), O_RDWR | O_CLOEXEC));
+    if (!fd)
+        throw SysError("opening jobserver FIFO %1%", fifo);
+
+    writeFull(fd.get(), std::string(tokens, '+'));
+}
+
+std::string Jobserver::makeFlags() const
+{
+    return fmt("-j%d --jobserver-auth=fifo:%s", tokens + 1, fifo.string());
+}
+
+} // namespace nix
@@ -15,21 +15,26 @@
 #  include <sys/param.h>
 #  include <sys/mount.h>
 #  include <sys/syscall.h>
+#  include <sys/statvfs.h>
 
 #  if HAVE_SECCOMP
 #    include <seccomp.h>
+#    include <linux/filter.h>
+#    include <linux/seccomp.h>
+#    include <sys/prctl.h>
 #  endif
 
 #  define pivot_root(new_root, put_old) (syscall(SYS_pivot_root, new_root, put_old))
 
 namespace nix {
 
-static void setupSeccomp()
-{
-    if (!settings.filterSyscalls)
-        return;
-
 #  if HAVE_SECCOMP
+
+/**
+ * Compile the system call filter for builders into a BPF program.
+ */
+static std::vector<sock_filter> compileSeccompProgram()
+{
     scmp_filter_ctx ctx;
 
     if (!(ctx = seccomp_init(SCMP_ACT_ALLOW)))
@@ -111,10 +116,63 @@ static void setupSeccomp()
         || seccomp_rule_add(ctx, SCMP_ACT_ERRNO(ENOTSUP), SCMP_SYS(fsetxattr), 0) != 0)
         throw SysError("unable to add seccomp rule");
 
-    if (seccomp_attr_set(ctx, SCMP_FLTATR_CTL_NNP, settings.allowNewPrivileges ? 0 : 1) != 0)
-        throw SysError("unable to set 'no new privileges' seccomp attribute");
+    AutoCloseFD fd = memfd_create("seccomp-bpf", MFD_CLOEXEC);
+    if (!fd)
+        throw SysError("creating memfd for the seccomp BPF program");
+
+    if (int err = seccomp_export_bpf(ctx, fd.get()); err != 0)
+        throw SysError(-err, "unable to export seccomp BPF program");
+
+    if (lseek(fd.get(), 0, SEEK_SET) == -1)
+        throw SysError("seeking in the seccomp BPF program");
+
+    auto bpf = drainFD(fd.get());
+    if (bpf.size() % sizeof(sock_filter) != 0)
+        throw Error("seccomp BPF program has an invalid size");
+
+    std::vector<sock_filter> program(bpf.size() / sizeof(sock_filter));
+    memcpy(program.data(), bpf.data(), bpf.size());
+    return program;
+}
+
+static const std::vector<sock_filter> & getSeccompProgram()
+{
+    static const auto program = compileSeccompProgram();
+    return program;
+}
+
+#  endif
+
+/**
+ * Compile the system call filter for builders once per process, rather
+ * than in every build process. This must be called in the parent
+ * before forking the builder.
+ */
+static void prepareSeccomp()
+{
+#  if HAVE_SECCOMP
+    if (settings.filterSyscalls)
+        getSeccompProgram();
+#  endif
+}
 
-    if (seccomp_load(ctx) != 0)
+static void setupSeccomp()
+{
+    if (!settings.filterSyscalls)
+        return;
+
+#  if HAVE_SECCOMP
+    auto & program = getSeccompProgram();
+
+    if (!settings.allowNewPrivileges && prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) == -1)
+        throw SysError("unable to set 'no new privileges'");
+
+    struct sock_fprog prog = {
+        .len = (unsigned short) program.size(),
+        .filter = const_cast<sock_filter *>(program.data()),
+    };
+
+    if (prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &prog, 0, 0) == -1)
         throw SysError("unable to load seccomp BPF program");
 #  else
     throw Error(
@@ -141,16 +199,22 @@ static void doBind(const std::filesystem::path & source, const std::filesystem::
     }
     auto st = *maybeSt;
 
+    /* The target may already exist if it was created in the lower
+       layer of the store overlay. */
     if (S_ISDIR(st.st_mode)) {
         createDirs(target);
         bindMount();
     } else if (S_ISLNK(st.st_mode)) {
         // Symlinks can (apparently) not be bind-mounted, so just copy it
-        createDirs(target.parent_path());
-        copyFile(source, target, false);
+        if (!maybeLstat(target)) {
+            createDirs(target.parent_path());
+            copyFile(source, target, false);
+        }
     } else {
-        createDirs(target.parent_path());
-        writeFile(target, "");
+        if (!maybeLstat(target)) {
+            createDirs(target.parent_path());
+            writeFile(target, "");
+        }
         bindMount();
     }
 }
@@ -159,6 +223,13 @@ struct LinuxDerivationBuilder : virtual DerivationBuilderImpl
 {
     using DerivationBuilderImpl::DerivationBuilderImpl;
 
+    void prepareSandbox() override
+    {
+        DerivationBuilderImpl::prepareSandbox();
+
+        prepareSeccomp();
+    }
+
     void enterChroot() override
     {
         setupSeccomp();
@@ -189,6 +260,12 @@ struct ChrootLinuxDerivationBuilder : ChrootDerivationBuilder, LinuxDerivationBu
      */
     bool usingUserNamespace = true;
 
+    /**
+     * Whether the build directory in the sandbox is a tmpfs, see
+     * `sandbox-build-dir-tmpfs-size`.
+     */
+    bool buildDirOnTmpfs = false;
+
     /**
      * The cgroup of the builder, if any.
      */
@@ -213,6 +290,134 @@ struct ChrootLinuxDerivationBuilder : ChrootDerivationBuilder, LinuxDerivationBu
                                   : ChrootDerivationBuilder::sandboxGid();
     }
 
+    /**
+     * Mount an overlay on the sandbox's Nix store, with the store
+     * directory of the chroot as its upper layer, so the outputs still
+     * end up there, and as its lower layer a tmpfs holding the mount
+     * points of the paths in `pathsInChroot` that are in the store.
+     * This avoids creating and later deleting one directory on the
+     * store's file system per input, which dominates the setup time of
+     * sandboxes with large input closures.
+     *
+     * @return Whether the overlay could be mounted. If not, the mount
+     * points are created in the store directory of the chroot as usual.
+     */
+    /**
+     * Mount a tmpfs on the build directory in the sandbox, and copy the
+     * files that were already written to the build directory on the
+     * host into it.
+     *
+     * @return Whether the tmpfs could be mounted. If not, the build
+     * directory on the host is used.
+     */
+    bool mountBuildDirTmpfs()
+    {
+        auto target = chrootRootDir / tmpDirInSandbox().relative_path();
+        auto staging = chrootRootDir.parent_path() / "build-tmpfs";
+        createDirs(staging);
+
+        if (mount("none", staging.c_str(), "tmpfs", 0, fmt("size=%s,mode=0700", settings.sandboxBuildDirTmpfsSize).c_str())
+            == -1)
+            return false;
+
+        std::function<void(const std::filesystem::path &, const std::filesystem::path &)> copy;
+        copy = [&](const std::filesystem::path & from, const std::filesystem::path & to) {
+            auto st = lstat(from);
+            if (S_ISDIR(st.st_mode)) {
+                if (to != staging)
+                    createDir(to, st.st_mode & 07777);
+                for (auto & entry : DirectoryIterator(from))
+                    copy(entry.path(), to / entry.path().filename());
+            } else if (S_ISREG(st.st_mode) || S_ISLNK(st.st_mode))
+                copyFile(from, to, false);
+            else
+                return;
+            if (lchown(to.c_str(), st.st_uid, st.st_gid) == -1)
+                throw SysError("changing owner of '%1%'", to);
+        };
+        copy(tmpDir, staging);
+
+        if (mount(staging.c_str(), target.c_str(), 0, MS_MOVE, 0) == -1)
+            throw SysError("moving the build directory tmpfs to %1%", target);
+
+        return true;
+    }
+
+    /**
+     * Get the number of bytes used in the tmpfs build directory of the
+     * sandbox, which still exists in `sandboxMountNamespace` after the
+     * builder has exited.
+     */
+    std::optional<uint64_t> getBuildDirTmpfsUsage()
+    {
+        Pipe pipe;
+        pipe.create();
+
+        Pid child(startProcess([&]() {
+            pipe.readSide.close();
+
+            if (usingUserNamespace && (setns(sandboxUserNamespace.get(), 0) == -1))
+                throw SysError("entering sandbox user namespace");
+
+            if (setns(sandboxMountNamespace.get(), 0) == -1)
+                throw SysError("entering sandbox mount namespace");
+
+            struct statvfs st;
+            auto path = chrootRootDir / tmpDirInSandbox().relative_path();
+            if (statvfs(path.c_str(), &st) == -1)
+                throw SysError("getting status of %1%", path);
+
+            writeFull(pipe.writeSide.get(), fmt("%d\n", (uint64_t) (st.f_blocks - st.f_bfree) * st.f_frsize));
+            _exit(0);
+        }));
+
+        pipe.writeSide.close();
+        auto line = FdSource(pipe.readSide.get()).readLine(true);
+
+        if (child.wait() != 0)
+            return std::nullopt;
+        return string2Int<uint64_t>(line);
+    }
+
+    bool mountStoreOverlay(const std::filesystem::path & chrootStoreDir)
+    {
+        auto lowerDir = chrootRootDir.parent_path() / "lower";
+        auto workDir = chrootRootDir.parent_path() / "work";
+        createDirs(lowerDir);
+        createDirs(workDir);
+
+        if (mount("none", lowerDir.c_str(), "tmpfs", 0, "mode=0755") == -1)
+            return false;
+
+        std::filesystem::path storeDir = store.storeDir;
+        for (auto & [target, chrootPath] : pathsInChroot) {
+            if (!isInDir(target, storeDir))
+                continue;
+            auto st = maybeLstat(chrootPath.source);
+            if (!st)
+                continue;
+            auto mountPoint = lowerDir / target.lexically_relative(storeDir);
+            if (S_ISDIR(st->st_mode))
+                createDirs(mountPoint);
+            else {
+                createDirs(mountPoint.parent_path());
+                if (S_ISLNK(st->st_mode))
+                    copyFile(chrootPath.source, mountPoint, false);
+                else
+                    writeFile(mountPoint, "");
+            }
+        }
+
+        auto options =
+            fmt("lowerdir=%s,upperdir=%s,workdir=%s", lowerDir.native(), chrootStoreDir.native(), workDir.native());
+        if (mount("overlay", chrootStoreDir.c_str(), "overlay", 0, options.c_str()) == -1) {
+            umount2(lowerDir.c_str(), MNT_DETACH);
+            return false;
+        }
+
+        return true;
+    }
+
     std::unique_ptr<UserLock> getBuildUser() override
     {
         return acquireUserLock(drvOptions.useUidRange(drv) ? 65536 : 1, true);
@@ -267,6 +472,14 @@ struct ChrootLinuxDerivationBuilder : ChrootDerivationBuilder, LinuxDerivationBu
     {
         ChrootDerivationBuilder::prepareSandbox();
 
+        prepareSeccomp();
+
+        /* The contents of a tmpfs build directory are lost when the
+           sandbox goes away, and the recursive Nix socket can't be
+           copied into it. */
+        buildDirOnTmpfs = !settings.sandboxBuildDirTmpfsSize.get().empty() && !settings.keepFailed
+                          && !drvOptions.getRequiredSystemFeatures(drv).count("recursive-nix");
+
         if (cgroup) {
             if (mkdir(cgroup->c_str(), 0755) != 0)
                 throw SysError("creating cgroup %s", *cgroup);
@@ -495,6 +708,11 @@ struct ChrootLinuxDerivationBuilder : ChrootDerivationBuilder, LinuxDerivationBu
         if (mount(chrootRootDir.c_str(), chrootRootDir.c_str(), 0, MS_BIND, 0) == -1)
             throw SysError("unable to bind mount %1%", chrootRootDir);
 
+        std::filesystem::path chrootStoreDir = chrootRootDir / std::filesystem::path(store.storeDir).relative_path();
+
+        if (settings.sandboxStoreOverlay)
+            mountStoreOverlay(chrootStoreDir);
+
         /* Bind-mount the sandbox's Nix store onto itself so that
            we can mark it as a "shared" subtree, allowing bind
            mounts made in *this* mount namespace to be propagated
@@ -503,7 +721,6 @@ struct ChrootLinuxDerivationBuilder : ChrootDerivationBuilder, LinuxDerivationBu
 
            Marking chrootRootDir as MS_SHARED causes pivot_root()
            to fail with EINVAL. Don't know why. */
-        std::filesystem::path chrootStoreDir = chrootRootDir / std::filesystem::path(store.storeDir).relative_path();
 
         if (mount(chrootStoreDir.c_str(), chrootStoreDir.c_str(), 0, MS_BIND, 0) == -1)
             throw SysError("unable to bind mount the Nix store", chrootStoreDir);
@@ -594,6 +811,9 @@ struct ChrootLinuxDerivationBuilder : ChrootDerivationBuilder, LinuxDerivationBu
             }
         }
 
+        if (buildDirOnTmpfs)
+            buildDirOnTmpfs = mountBuildDirTmpfs();
+
         /* Bind a new instance of procfs on /proc. */
         createDirs(chrootRootDir / "proc");
         if (mount("none", (chrootRootDir / "proc").c_str(), "proc", 0, 0) == -1)
@@ -696,12 +916,32 @@ struct ChrootLinuxDerivationBuilder : ChrootDerivationBuilder, LinuxDerivationBu
 
     SingleDrvOutputs unprepareBuild() override
     {
+        if (buildDirOnTmpfs) {
+            try {
+                if (auto used = getBuildDirTmpfsUsage())
+                    printMsg(
+                        lvlTalkative,
+                        "build directory of '%s' held %s in memory when the build finished",
+                        store.printStorePath(drvPath),
+                        renderSize(*used));
+            } catch (Error & e) {
+                debug("cannot get the size of the build directory: %s", e.what());
+            }
+        }
+
         sandboxMountNamespace = -1;
         sandboxUserNamespace = -1;
 
         return DerivationBuilderImpl::unprepareBuild();
     }
 
+    std::optional<uint64_t> getMemoryUsage() override
+    {
+        if (!cgroup)
+            return std::nullopt;
+        return getCgroupStats(*cgroup).memoryCurrent;
+    }
+
     void killSandbox(bool getStats) override
     {
         if (cgroup) {
@@ -709,6 +949,12 @@ struct ChrootLinuxDerivationBuilder : ChrootDerivationBuilder, LinuxDerivationBu
             if (getStats) {
                 buildResult.cpuUser = stats.cpuUser;
                 buildResult.cpuSystem = stats.cpuSystem;
+                buildResult.peakMemory = stats.memoryPeak;
+                buildResult.ioRead = stats.ioRead;
+                buildResult.ioWrite = stats.ioWrite;
+                buildResult.cpuStall = stats.cpuStall;
+                buildResult.memoryStall = stats.memoryStall;
+                buildResult.ioStall = stats.ioStall;
             }
             return;
         }
@@ -0,0 +1,462 @@
+#include "nix/store/build/remote-builders.hh"
+#include "nix/store/globals.hh"
+#include "nix/store/local-store.hh"
+#include "nix/store/log-store.hh"
+#include "nix/util/finally.hh"
+#include "nix/util/strings.hh"
+#include "nix/util/sync.hh"
+
+#include <mutex>
+
+namespace nix {
+
+void buildOnRemoteStore(
+    Store & localStore,
+    Store & remoteStore,
+    const std::string & storeUri,
+    const StorePath & drvPath,
+    Derivation drv,
+    const StorePathSet & inputs,
+    const StringSet & wantedOutputs)
+{
+    std::optional<BuildResult> optResult;
+
+    auto substitute = settings.buildersUseSubstitutes ? Substitute : NoSubstitute;
+
+    // If we don't know whether we are trusted (e.g. `ssh://`
+    // stores), we assume we are. This is necessary for backwards
+    // compat.
+    bool trustedOrLegacy = ({
+        std::optional trusted = remoteStore.isTrustedClient();
+        !trusted || *trusted;
+    });
+
+    // See the very large comment in `case WorkerProto::Op::BuildDerivation:` in
+    // `src/libstore/daemon.cc` that explains the trust model here.
+    //
+    // This condition mirrors that: that code enforces the "rules" outlined there;
+    // we do the best we can given those "rules".
+    if (trustedOrLegacy || drv.type().isCA()) {
+        // Hijack the inputs paths of the derivation to include all
+        // the paths that come from the `inputDrvs` set. We don’t do
+        // that for the derivations whose `inputDrvs` is empty
+        // because:
+        //
+        // 1. It’s not needed
+        //
+        // 2. Changing the `inputSrcs` set changes the associated
+        //    output ids, which break CA derivations
+        if (!drv.inputDrvs.map.empty())
+            drv.inputSrcs = inputs;
+        optResult = remoteStore.buildDerivation(drvPath, static_cast<const BasicDerivation &>(drv));
+        auto & result = *optResult;
+        if (auto * failureP = result.tryGetFailure()) {
+            if (settings.keepFailed) {
+                warn(
+                    "The failed build directory was kept on the remote builder due to `--keep-failed`.%s",
+                    (settings.thisSystem == drv.platform || settings.extraPlatforms.get().count(drv.platform) > 0)
+                        ? " You can re-run the command with `--builders ''` to disable remote building for this invocation."
+                        : "");
+            }
+            throw Error(
+                "build of '%s' on '%s' failed: %s", localStore.printStorePath(drvPath), storeUri, failureP->errorMsg);
+        }
+    } else {
+        copyClosure(localStore, remoteStore, StorePathSet{drvPath}, NoRepair, NoCheckSigs, substitute);
+        auto res = remoteStore.buildPathsWithResults({DerivedPath::Built{
+            .drvPath = makeConstantStorePathRef(drvPath),
+            .outputs = OutputsSpec::All{},
+        }});
+        // One path to build should produce exactly one build result
+        assert(res.size() == 1);
+        optResult = std::move(res[0]);
+    }
+
+    auto outputHashes = staticOutputHashes(localStore, drv);
+    std::set<Realisation> missingRealisations;
+    StorePathSet missingPaths;
+    if (experimentalFeatureSettings.isEnabled(Xp::CaDerivations) && !drv.type().hasKnownOutputPaths()) {
+        for (auto & outputName : wantedOutputs) {
+            auto thisOutputHash = outputHashes.at(outputName);
+            auto thisOutputId = DrvOutput{thisOutputHash, outputName};
+            if (!localStore.queryRealisation(thisOutputId)) {
+                debug("missing output %s", outputName);
+                assert(optResult);
+                auto & result = *optResult;
+                if (auto * successP = result.tryGetSuccess()) {
+                    auto & success = *successP;
+                    auto i = success.builtOutputs.find(outputName);
+                    assert(i != success.builtOutputs.end());
+                    auto & newRealisation = i->second;
+                    missingRealisations.insert(newRealisation);
+                    missingPaths.insert(newRealisation.outPath);
+                }
+            }
+        }
+    } else {
+        auto outputPaths = drv.outputsAndOptPaths(localStore);
+        for (auto & [outputName, hopefullyOutputPath] : outputPaths) {
+            assert(hopefullyOutputPath.second);
+            if (!localStore.isValidPath(*hopefullyOutputPath.second))
+                missingPaths.insert(*hopefullyOutputPath.second);
+        }
+    }
+
+    if (!missingPaths.empty()) {
+        Activity act(*logger, lvlTalkative, actUnknown, fmt("copying outputs from '%s'", storeUri));
+        /* The caller holds the locks on the output paths, so tell the
+           local store not to take them again. */
+        auto localFSStore = dynamic_cast<LocalStore *>(&localStore);
+        if (localFSStore) {
+            auto locksHeld(localFSStore->locksHeld.lock());
+            for (auto & path : missingPaths)
+                locksHeld->insert(localStore.printStorePath(path));
+        }
+        Finally releaseLocks([&]() {
+            if (localFSStore) {
+                auto locksHeld(localFSStore->locksHeld.lock());
+                for (auto & path : missingPaths)
+                    locksHeld->erase(localStore.printStorePath(path));
+            }
+        });
+        copyPaths(remoteStore, localStore, missingPaths, NoRepair, NoCheckSigs, NoSubstitute);
+    }
+    // XXX: Should be done as part of `copyPaths`
+    for (auto & realisation : missingRealisations) {
+        // Should hold, because if the feature isn't enabled the set
+        // of missing realisations should be empty
+        experimentalFeatureSettings.require(Xp::CaDerivations);
+        localStore.registerDrvOutput(realisation);
+    }
+}
+
+/**
+ * A connection to a remote builder that is kept open between builds.
+ */
+struct RemoteBuild::Connection
+{
+    ref<Store> store;
+
+    /**
+     * The paths that we have uploaded over this connection. The
+     * remote daemon holds temporary roots for them for as long as the
+     * connection is open, so they don't have to be checked again.
+     */
+    StorePathSet uploadedPaths;
+};
+
+struct RemoteBuild::MachineState
+{
+    Machine machine;
+
+    /**
+     * Serialises the uploads to the machine, like the upload lock of
+     * `build-remote`.
+     */
+    std::mutex uploadLock;
+
+    struct State
+    {
+        /**
+         * The number of slots in use.
+         */
+        unsigned int active = 0;
+
+        std::vector<std::unique_ptr<Connection>> idle;
+    };
+
+    Sync<State> state;
+
+    MachineState(Machine machine)
+        : machine(std::move(machine))
+    {
+    }
+};
+
+RemoteBuild::RemoteBuild(std::shared_ptr<MachineState> machine, std::unique_ptr<Connection> connection)
+    : machineName(machine->machine.storeUri.render())
+    , machine(std::move(machine))
+    , connection(std::move(connection))
+{
+}
+
+RemoteBuild::~RemoteBuild()
+{
+    try {
+        if (thread.joinable())
+            thread.join();
+        auto state(machine->state.lock());
+        assert(state->active > 0);
+        state->active--;
+        /* Don't reuse connections that may be in a bad state. */
+        if (!error)
+            state->idle.push_back(std::move(connection));
+    } catch (...) {
+        ignoreExceptionInDestructor();
+    }
+}
+
+void RemoteBuild::start(
+    Store & localStore,
+    const StorePath & drvPath,
+    std::shared_ptr<const Derivation> drv,
+    StorePathSet inputs,
+    StringSet wantedOutputs)
+{
+    done.create();
+
+    thread = std::thread([this,
+                          &localStore,
+                          drvPath,
+                          drv,
+                          inputs{std::move(inputs)},
+                          wantedOutputs{std::move(wantedOutputs)}]() {
+        try {
+            auto & remoteStore = *connection->store;
+
+            StorePathSet missing;
+            for (auto & path : inputs)
+                if (!connection->uploadedPaths.contains(path))
+                    missing.insert(path);
+
+            if (!missing.empty()) {
+                std::lock_guard uploadLock(machine->uploadLock);
+                Activity act(*logger, lvlTalkative, actUnknown, fmt("copying dependencies to '%s'", machineName));
+                /* Only remember the paths that we upload ourselves, since
+                   nothing keeps alive the ones that are already there. */
+                for (auto & path : remoteStore.queryValidPaths(missing))
+                    missing.erase(path);
+                copyPaths(
+                    localStore,
+                    remoteStore,
+                    missing,
+                    NoRepair,
+                    NoCheckSigs,
+                    settings.buildersUseSubstitutes ? Substitute : NoSubstitute);
+                connection->uploadedPaths.insert(missing.begin(), missing.end());
+            }
+
+            buildOnRemoteStore(localStore, remoteStore, machineName, drvPath, *drv, inputs, wantedOutputs);
+
+            if (auto logStore = dynamic_cast<LogStore *>(&remoteStore)) {
+                try {
+                    log = logStore->getBuildLog(drvPath);
+                } catch (Error & e) {
+                    debug("cannot get the build log of '%s' from '%s': %s", drvPath.to_string(), machineName, e.msg());
+                }
+            }
+        } catch (...) {
+            error = std::current_exception();
+        }
+        done.writeSide.close();
+    });
+}
+
+std::optional<std::string> RemoteBuild::wait()
+{
+    thread.join();
+    if (error)
+        std::rethrow_exception(error);
+    return std::move(log);
+}
+
+RemoteBuilders::RemoteBuilders()
+{
+    for (auto & machine : getMachines()) {
+        auto * generic = std::get_if<StoreReference::Specified>(&machine.storeUri.variant);
+        /* Builds on `ssh://` machines write their log to a file
+           descriptor that is fixed for the lifetime of the connection,
+           so they can't share connections. Other stores, like local
+           ones, would run the build in this process. */
+        if (!generic || (generic->scheme != "ssh-ng" && generic->scheme != "mounted-ssh-ng")) {
+            warn(
+                "ignoring remote builder '%s' because 'in-process-builders' requires 'ssh-ng://' machines",
+                machine.storeUri.render());
+            continue;
+        }
+        machines.push_back(std::make_shared<RemoteBuild::MachineState>(std::move(machine)));
+    }
+    debug("got %d remote builders", machines.size());
+}
+
+RemoteBuilders::~RemoteBuilders() = default;
+
+/**
+ * Estimate the number of bytes that we have to upload to `machine` to
+ * build a derivation whose inputs have the given NAR sizes. If there is
+ * an idle connection to the machine, ask it which of the inputs it
+ * already has; otherwise assume that it has none of them.
+ */
+static uint64_t estimateUpload(RemoteBuild::MachineState & machine, const std::map<StorePath, uint64_t> & narSizes)
+{
+    std::unique_ptr<RemoteBuild::Connection> connection;
+    {
+        auto state(machine.state.lock());
+        if (!state->idle.empty()) {
+            connection = std::move(state->idle.back());
+            state->idle.pop_back();
+        }
+    }
+
+    StorePathSet missing;
+    for (auto & [path, _] : narSizes)
+        if (!connection || !connection->uploadedPaths.contains(path))
+            missing.insert(path);
+
+    if (connection && !missing.empty()) {
+        try {
+            for (auto & path : connection->store->queryValidPaths(missing))
+                missing.erase(path);
+        } catch (Error & e) {
+            debug("cannot query the valid paths of '%s': %s", machine.machine.storeUri.render(), e.msg());
+            connection.reset();
+        }
+    }
+
+    if (connection)
+        machine.state.lock()->idle.push_back(std::move(connection));
+
+    uint64_t bytes = 0;
+    for (auto & path : missing)
+        bytes += narSizes.at(path);
+    return bytes;
+}
+
+RemoteBuilders::Reply RemoteBuilders::tryAcquire(
+    Store & localStore,
+    const std::string & neededSystem,
+    const StringSet & requiredFeatures,
+    bool canBuildLocally,
+    bool couldBuildLocally,
+    const StorePath & drvPath,
+    const StorePathSet & inputs,
+    std::unique_ptr<RemoteBuild> & build)
+{
+    if (machines.empty())
+        return Reply::DeclinePermanently;
+
+    while (true) {
+        bool rightType = false;
+
+        struct Candidate
+        {
+            std::shared_ptr<RemoteBuild::MachineState> machine;
+            uint64_t load;
+            uint64_t upload = 0;
+        };
+
+        std::vector<Candidate> candidates;
+        for (auto & m : machines) {
+            auto & machine = m->machine;
+            debug("considering building on remote machine '%s'", machine.storeUri.render());
+
+            if (!machine.enabled || !machine.systemSupported(neededSystem) || !machine.allSupported(requiredFeatures)
+                || !machine.mandatoryMet(requiredFeatures))
+                continue;
+
+            rightType = true;
+
+            uint64_t load = m->state.lock()->active;
+            if (load < machine.maxJobs)
+                candidates.push_back({m, load});
+        }
+
+        /* Prefer the machine that already has most of the input
+           closure. */
+        if (candidates.size() > 1 && !inputs.empty()) {
+            std::map<StorePath, uint64_t> narSizes;
+            for (auto & [path, info] : localStore.queryMultiplePathInfos(inputs))
+                narSizes.emplace(path, info->narSize);
+            for (auto & candidate : candidates) {
+                candidate.upload = estimateUpload(*candidate.machine, narSizes);
+                debug(
+                    "building on '%s' requires uploading %d bytes",
+                    candidate.machine->machine.storeUri.render(),
+                    candidate.upload);
+            }
+        }
+
+        std::shared_ptr<RemoteBuild::MachineState> bestMachine;
+        uint64_t bestLoad = 0;
+        uint64_t bestUpload = 0;
+        for (auto & [m, load, upload] : candidates) {
+            auto & machine = m->machine;
+            bool best = false;
+            if (!bestMachine || upload < bestUpload) {
+                best = true;
+            } else if (upload > bestUpload) {
+                best = false;
+            } else if (load / machine.speedFactor < bestLoad / bestMachine->machine.speedFactor) {
+                best = true;
+            } else if (load / machine.speedFactor == bestLoad / bestMachine->machine.speedFactor) {
+                if (machine.speedFactor > bestMachine->machine.speedFactor) {
+                    best = true;
+                } else if (machine.speedFactor == bestMachine->machine.speedFactor) {
+                    if (load < bestLoad) {
+                        best = true;
+                    }
+                }
+            }
+            if (best) {
+                bestLoad = load;
+                bestUpload = upload;
+                bestMachine = m;
+            }
+        }
+
+        if (!bestMachine) {
+            if (rightType && !canBuildLocally)
+                return Reply::Postpone;
+
+            std::string msg =
+                fmt("Failed to find a machine for remote build!\n"
+                    "derivation: %s\nrequired (system, features): (%s, [%s])\n"
+                    "%s available machines:\n"
+                    "(systems, maxjobs, supportedFeatures, mandatoryFeatures)",
+                    drvPath.to_string(),
+                    neededSystem,
+                    concatStringsSep<StringSet>(", ", requiredFeatures),
+                    machines.size());
+            for (auto & m : machines)
+                msg +=
+                    fmt("\n([%s], %s, [%s], [%s])",
+                        concatStringsSep<StringSet>(", ", m->machine.systemTypes),
+                        m->machine.maxJobs,
+                        concatStringsSep<StringSet>(", ", m->machine.supportedFeatures),
+                        concatStringsSep<StringSet>(", ", m->machine.mandatoryFeatures));
+            printMsg(couldBuildLocally ? lvlChatty : lvlWarn, msg);
+
+            return Reply::Decline;
+        }
+
+        std::unique_ptr<RemoteBuild::Connection> connection;
+        {
+            auto state(bestMachine->state.lock());
+            state->active++;
+            if (!state->idle.empty()) {
+                connection = std::move(state->idle.back());
+                state->idle.pop_back();
+            }
+        }
+
+        if (!connection) {
+            auto storeUri = bestMachine->machine.storeUri.render();
+            try {
+                Activity act(*logger, lvlTalkative, actUnknown, fmt("connecting to '%s'", storeUri));
+                auto store = bestMachine->machine.openStore();
+                store->connect();
+                connection = std::make_unique<RemoteBuild::Connection>(store);
+            } catch (std::exception & e) {
+                bestMachine->state.lock()->active--;
+                printError("cannot build on '%s': %s", storeUri, e.what());
+                bestMachine->machine.enabled = false;
+                continue;
+            }
+        }
+
+        build = std::make_unique<RemoteBuild>(bestMachine, std::move(connection));
+        return Reply::Accept;
+    }
+}
+
+} // namespace nix
@@ -0,0 +1,49 @@
+#pragma once
+///@file
+
+#include "nix/util/file-descriptor.hh"
+#include "nix/util/file-system.hh"
+
+namespace nix {
+
+/**
+ * A GNU make compatible jobserver that is shared by all local builds
+ * of a `Worker`. Build tools that speak the jobserver protocol (GNU
+ * make 4.4+, ninja 1.13+, cargo, ...) take a token from the FIFO for
+ * every job beyond their first, so concurrent builds share one pool
+ * of cores instead of each assuming that they have the whole machine.
+ */
+struct Jobserver
+{
+    /**
+     * @param tokens The number of tokens to put in the pool. Every
+     * client holds one implicit token on top of these.
+     */
+    Jobserver(unsigned int tokens);
+
+    /**
+     * The FIFO that clients read tokens from and write them back to.
+     */
+    const std::filesystem::path & getFifo() const
+    {
+        return fifo;
+    }
+
+    /**
+     * The value of `MAKEFLAGS` that makes a client use this jobserver.
+     */
+    std::string makeFlags() const;
+
+private:
+    unsigned int tokens;
+    AutoDelete tmpDir;
+    std::filesystem::path fifo;
+
+    /**
+     * Keeps the FIFO open, so that the tokens in it survive while no
+     * client has it open.
+     */
+    AutoCloseFD fd;
+};
+
+} // namespace nix
@@ -0,0 +1,127 @@
+#pragma once
+///@file
+
+#include "nix/store/machines.hh"
+#include "nix/store/derivations.hh"
+#include "nix/store/build-result.hh"
+#include "nix/util/file-descriptor.hh"
+
+#include <thread>
+
+namespace nix {
+
+/**
+ * Build `drvPath` on `remoteStore`, whose inputs must have been copied
+ * there already, and copy the missing outputs in `wantedOutputs` back
+ * to `localStore`.
+ *
+ * @throws Error if the build fails.
+ */
+void buildOnRemoteStore(
+    Store & localStore,
+    Store & remoteStore,
+    const std::string & storeUri,
+    const StorePath & drvPath,
+    Derivation drv,
+    const StorePathSet & inputs,
+    const StringSet & wantedOutputs);
+
+struct RemoteBuilders;
+
+/**
+ * A build that runs on a remote builder from a thread of the local
+ * process. `done` is closed when the build has finished.
+ */
+struct RemoteBuild
+{
+    struct MachineState;
+    struct Connection;
+
+    /**
+     * The store URI of the remote machine.
+     */
+    std::string machineName;
+
+    Pipe done;
+
+    RemoteBuild(std::shared_ptr<MachineState> machine, std::unique_ptr<Connection> connection);
+
+    /**
+     * Joins the thread, so it blocks until the remote build has
+     * finished if it is still running.
+     */
+    ~RemoteBuild();
+
+    /**
+     * Start copying the inputs, building and copying back the outputs.
+     */
+    void start(
+        Store & localStore,
+        const StorePath & drvPath,
+        std::shared_ptr<const Derivation> drv,
+        StorePathSet inputs,
+        StringSet wantedOutputs);
+
+    /**
+     * Wait for the build to finish, and return the build log from the
+     * remote machine, if it has one.
+     *
+     * @throws Error if the build failed.
+     */
+    std::optional<std::string> wait();
+
+private:
+
+    std::shared_ptr<MachineState> machine;
+    std::unique_ptr<Connection> connection;
+    std::thread thread;
+    std::exception_ptr error;
+    std::optional<std::string> log;
+};
+
+/**
+ * Dispatches remote builds to the machines in the `builders` setting
+ * from within the worker process, as an alternative to running the
+ * `build-hook` for every build. Connections to the machines are kept
+ * open and reused, and the slots of each machine are accounted for in
+ * memory.
+ */
+struct RemoteBuilders
+{
+    enum struct Reply { Accept, Postpone, Decline, DeclinePermanently };
+
+    RemoteBuilders();
+
+    ~RemoteBuilders();
+
+    /**
+     * Reserve a slot on the best machine for a derivation. Among the
+     * machines with a free slot, this prefers the one that requires
+     * uploading the fewest bytes of `inputs`, then the least loaded
+     * one relative to its speed factor.
+     *
+     * @param canBuildLocally Whether the derivation can be built
+     * locally right now.
+     *
+     * @param couldBuildLocally Whether the derivation can be built
+     * locally once local build slots become available.
+     *
+     * @param build Set to the build that holds the slot if the reply
+     * is `Accept`.
+     */
+    Reply tryAcquire(
+        Store & localStore,
+        const std::string & neededSystem,
+        const StringSet & requiredFeatures,
+        bool canBuildLocally,
+        bool couldBuildLocally,
+        const StorePath & drvPath,
+        const StorePathSet & inputs,
+        std::unique_ptr<RemoteBuild> & build);
+
+private:
+
+    std::vector<std::shared_ptr<RemoteBuild::MachineState>> machines;
+};
+
+} // namespace nix
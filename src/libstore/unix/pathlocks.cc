@@ -1,4 +1,5 @@
 #include "nix/store/pathlocks.hh"
+#include "nix/store/store-metrics.hh"
 #include "nix/util/util.hh"
 #include "nix/util/sync.hh"
 #include "nix/util/signals.hh"
@@ -97,7 +98,13 @@ bool PathLocks::lockPaths(const std::set<std::filesystem::path> & paths, const s
                 if (wait) {
                     if (waitMsg != "")
                         printError(waitMsg);
+                    auto start = std::chrono::steady_clock::now();
                     lockFile(fd.get(), ltWrite, true);
+                    if (auto metrics = getStoreMetrics()) {
+                        metrics->pathLocksContended++;
+                        metrics->pathLockWait.observe(std::chrono::duration_cast<std::chrono::microseconds>(
+                            std::chrono::steady_clock::now() - start));
+                    }
                 } else {
                     /* Failed to lock this path; release all other
                        locks. */
@@ -123,6 +130,9 @@ bool PathLocks::lockPaths(const std::set<std::filesystem::path> & paths, const s
                 break;
         }
 
+        if (auto metrics = getStoreMetrics())
+            metrics->pathLocksAcquired++;
+
         /* Use borrow so that the descriptor isn't closed. */
         fds.push_back(FDPair(fd.release(), lockPath));
     }
@@ -135,6 +145,12 @@ void PathLocks::unlock()
     for (auto & i : fds) {
         if (deletePaths)
             deleteLockFile(i.second, i.first);
+        else
+            /* Touch the lock file, so that waiting goals watching it
+               (see `Worker::waitForLocks()`) retry right away rather
+               than at the next poll interval. Waiters only open and
+               lock it, which doesn't change its attributes. */
+            futimens(i.first, nullptr);
 
         if (close(i.first) == -1)
             printError("error (ignored): cannot close lock file on %1%", i.second);
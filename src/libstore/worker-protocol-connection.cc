@@ -2,10 +2,19 @@
 #include "nix/store/worker-protocol-impl.hh"
 #include "nix/store/build-result.hh"
 #include "nix/store/derivations.hh"
+#include "nix/store/realisation.hh"
 
 namespace nix {
 
-const WorkerProto::FeatureSet WorkerProto::allFeatures{};
+const WorkerProto::FeatureSet WorkerProto::allFeatures{
+    std::string(WorkerProto::featureQueryMultiplePathInfos),
+    std::string(WorkerProto::featureQueryClosure),
+    std::string(WorkerProto::featureQueryDerivationHashesModulo),
+    std::string(WorkerProto::featureZstdNar),
+    std::string(WorkerProto::featureNarDelta),
+    std::string(WorkerProto::featureAddTempRoots),
+    std::string(WorkerProto::featureQueryRealisations),
+};
 
 WorkerProto::BasicClientConnection::~BasicClientConnection()
 {
@@ -248,6 +257,55 @@ std::optional<UnkeyedValidPathInfo> WorkerProto::BasicClientConnection::queryPat
     const StoreDirConfig & store, bool * daemonException, const StorePath & path)
 {
     to << WorkerProto::Op::QueryPathInfo << store.printStorePath(path);
+    return readPathInfoResponse(store, daemonException);
+}
+
+std::map<StorePath, UnkeyedValidPathInfo> WorkerProto::BasicClientConnection::queryPathInfos(
+    const StoreDirConfig & store, bool * daemonException, const StorePathSet & paths)
+{
+    /* Bound the number of outstanding requests, so that we can't
+       block writing requests while the daemon blocks writing
+       responses. */
+    constexpr size_t maxInFlight = 64;
+
+    std::map<StorePath, UnkeyedValidPathInfo> res;
+    std::exception_ptr ex;
+
+    for (auto i = paths.begin(); i != paths.end();) {
+        std::vector<StorePath> batch;
+        for (; i != paths.end() && batch.size() < maxInFlight; ++i) {
+            to << WorkerProto::Op::QueryPathInfo << store.printStorePath(*i);
+            batch.push_back(*i);
+        }
+
+        for (auto & path : batch) {
+            bool remoteError = false;
+            try {
+                if (auto info = readPathInfoResponse(store, &remoteError))
+                    res.insert_or_assign(path, std::move(*info));
+            } catch (...) {
+                /* The daemon carries on with the next request after
+                   an error, so read the remaining responses to keep
+                   the connection usable. */
+                if (!remoteError)
+                    throw;
+                if (!ex)
+                    ex = std::current_exception();
+            }
+        }
+    }
+
+    if (ex) {
+        *daemonException = true;
+        std::rethrow_exception(ex);
+    }
+
+    return res;
+}
+
+std::optional<UnkeyedValidPathInfo>
+WorkerProto::BasicClientConnection::readPathInfoResponse(const StoreDirConfig & store, bool * daemonException)
+{
     try {
         processStderr(daemonException);
     } catch (Error & e) {
@@ -265,6 +323,79 @@ std::optional<UnkeyedValidPathInfo> WorkerProto::BasicClientConnection::queryPat
     return WorkerProto::Serialise<UnkeyedValidPathInfo>::read(store, *this);
 }
 
+std::map<StorePath, UnkeyedValidPathInfo> WorkerProto::BasicClientConnection::queryMultiplePathInfos(
+    const StoreDirConfig & store, bool * daemonException, const StorePathSet & paths)
+{
+    assert(features.contains(WorkerProto::featureQueryMultiplePathInfos));
+    to << WorkerProto::Op::QueryMultiplePathInfos;
+    WorkerProto::write(store, *this, paths);
+    processStderr(daemonException);
+    return WorkerProto::Serialise<std::map<StorePath, UnkeyedValidPathInfo>>::read(store, *this);
+}
+
+std::set<Realisation> WorkerProto::BasicClientConnection::queryRealisations(
+    const StoreDirConfig & store, bool * daemonException, const std::set<DrvOutput> & outputs)
+{
+    assert(features.contains(WorkerProto::featureQueryRealisations));
+    to << WorkerProto::Op::QueryRealisations;
+    WorkerProto::write(store, *this, outputs);
+    processStderr(daemonException);
+    return WorkerProto::Serialise<std::set<Realisation>>::read(store, *this);
+}
+
+std::map<StorePath, UnkeyedValidPathInfo> WorkerProto::BasicClientConnection::queryClosure(
+    const StoreDirConfig & store,
+    bool * daemonException,
+    const StorePathSet & paths,
+    bool flipDirection,
+    bool includeOutputs,
+    bool includeDerivers)
+{
+    assert(features.contains(WorkerProto::featureQueryClosure));
+    to << WorkerProto::Op::QueryClosure;
+    WorkerProto::write(store, *this, paths);
+    to << flipDirection << includeOutputs << includeDerivers;
+    processStderr(daemonException);
+    return WorkerProto::Serialise<std::map<StorePath, UnkeyedValidPathInfo>>::read(store, *this);
+}
+
+std::map<StorePath, DrvHash> WorkerProto::BasicClientConnection::queryDerivationHashesModulo(
+    const StoreDirConfig & store, bool * daemonException, const StorePathSet & drvPaths)
+{
+    assert(features.contains(WorkerProto::featureQueryDerivationHashesModulo));
+    to << WorkerProto::Op::QueryDerivationHashesModulo;
+    WorkerProto::write(store, *this, drvPaths);
+    processStderr(daemonException);
+    std::map<StorePath, DrvHash> res;
+    auto count = readNum<size_t>(from);
+    while (count--) {
+        auto drvPath = WorkerProto::Serialise<StorePath>::read(store, *this);
+        DrvHash drvHash{.kind = readNum<bool>(from) ? DrvHash::Kind::Deferred : DrvHash::Kind::Regular};
+        auto nrOutputs = readNum<size_t>(from);
+        while (nrOutputs--) {
+            auto outputName = readString(from);
+            drvHash.hashes.insert_or_assign(outputName, Hash::parseSRI(readString(from)));
+        }
+        res.insert_or_assign(std::move(drvPath), std::move(drvHash));
+    }
+    return res;
+}
+
+std::optional<std::pair<StorePath, StringSet>> WorkerProto::BasicClientConnection::queryDeltaBase(
+    const StoreDirConfig & store, bool * daemonException, const StorePath & path, uint64_t narSize)
+{
+    assert(features.contains(WorkerProto::featureNarDelta));
+    to << WorkerProto::Op::QueryDeltaBase;
+    WorkerProto::write(store, *this, path);
+    to << narSize;
+    processStderr(daemonException);
+    auto base = WorkerProto::Serialise<std::optional<StorePath>>::read(store, *this);
+    auto chunks = readStrings<StringSet>(from);
+    if (!base)
+        return std::nullopt;
+    return std::pair{std::move(*base), std::move(chunks)};
+}
+
 StorePathSet WorkerProto::BasicClientConnection::queryValidPaths(
     const StoreDirConfig & store, bool * daemonException, const StorePathSet & paths, SubstituteFlag maybeSubstitute)
 {
@@ -286,6 +417,16 @@ void WorkerProto::BasicClientConnection::addTempRoot(
     readInt(from);
 }
 
+void WorkerProto::BasicClientConnection::addTempRoots(
+    const StoreDirConfig & store, bool * daemonException, const StorePathSet & paths)
+{
+    assert(features.contains(WorkerProto::featureAddTempRoots));
+    to << WorkerProto::Op::AddTempRoots;
+    WorkerProto::write(store, *this, paths);
+    processStderr(daemonException);
+    readInt(from);
+}
+
 void WorkerProto::BasicClientConnection::putBuildDerivationRequest(
     const StoreDirConfig & store,
     bool * daemonException,
@@ -0,0 +1,87 @@
+#include "nix/util/archive.hh"
+#include "nix/util/config-global.hh"
+#include "nix/util/file-system.hh"
+
+#include <benchmark/benchmark.h>
+
+#include <filesystem>
+
+using namespace nix;
+
+// Create a tree of `nrFiles` small files in directories of 100 files each
+static void createTree(const std::filesystem::path & root, int64_t nrFiles)
+{
+    std::filesystem::create_directory(root);
+    for (int64_t i = 0; i < nrFiles; ++i) {
+        auto dir = root / std::to_string(i / 100);
+        if (i % 100 == 0)
+            std::filesystem::create_directory(dir);
+        writeFile(dir / std::to_string(i), std::string(100 + i % 4000, 'x'));
+    }
+}
+
+static void setUseIoUring(benchmark::State & state)
+{
+    globalConfig.set("use-io-uring", state.range(1) ? "true" : "false");
+}
+
+// Benchmark unpacking a NAR of many small files, as done when substituting
+static void BM_RestorePath(benchmark::State & state)
+{
+    setUseIoUring(state);
+
+    AutoDelete tmpDir(createTempDir());
+    createTree(tmpDir.path() / "src", state.range(0));
+    StringSink nar;
+    dumpPath((tmpDir.path() / "src").string(), nar);
+
+    int64_t n = 0;
+    for (auto _ : state) {
+        auto dst = tmpDir.path() / std::to_string(n++);
+        StringSource source(nar.s);
+        restorePath(dst, source);
+        state.PauseTiming();
+        deletePath(dst);
+        state.ResumeTiming();
+    }
+
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    state.SetBytesProcessed(state.iterations() * nar.s.size());
+}
+
+// Benchmark serialising a tree of many small files, as done when adding or hashing paths
+static void BM_DumpPath(benchmark::State & state)
+{
+    setUseIoUring(state);
+
+    AutoDelete tmpDir(createTempDir());
+    createTree(tmpDir.path() / "src", state.range(0));
+
+    for (auto _ : state) {
+        NullSink sink;
+        dumpPath((tmpDir.path() / "src").string(), sink);
+    }
+
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// Benchmark deleting a tree of many small files, as done by garbage collection
+static void BM_DeletePath(benchmark::State & state)
+{
+    setUseIoUring(state);
+
+    AutoDelete tmpDir(createTempDir());
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        createTree(tmpDir.path() / "tree", state.range(0));
+        state.ResumeTiming();
+        deletePath(tmpDir.path() / "tree");
+    }
+
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+BENCHMARK(BM_RestorePath)->ArgsProduct({{10'000, 100'000}, {0, 1}})->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK(BM_DumpPath)->ArgsProduct({{10'000, 100'000}, {0, 1}})->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK(BM_DeletePath)->ArgsProduct({{10'000, 100'000}, {0, 1}})->Unit(benchmark::kMillisecond)->UseRealTime();
@@ -1,4 +1,5 @@
 #include "nix/util/archive.hh"
+#include "nix/util/memory-source-accessor.hh"
 #include "nix/util/tests/characterization.hh"
 #include "nix/util/tests/gmock-matchers.hh"
 
@@ -58,4 +59,42 @@ INSTANTIATE_TEST_SUITE_P(
         // Test that the 'name' field cannot come before the 'node' field in a directory entry.
         std::pair{"name-after-node", "bad archive: expected tag 'name'"}));
 
+TEST(dumpPath, manyFilesWithFilter)
+{
+    using File = MemorySourceAccessor::File;
+
+    auto src = make_ref<MemorySourceAccessor>();
+    auto expected = make_ref<MemorySourceAccessor>();
+    src->open(CanonPath::root, File::Directory{});
+    expected->open(CanonPath::root, File::Directory{});
+
+    for (int d = 0; d < 8; ++d) {
+        CanonPath dir(fmt("/d%d", d));
+        src->open(dir, File::Directory{});
+        expected->open(dir, File::Directory{});
+        for (int f = 0; f < 16; ++f) {
+            auto path = dir / fmt(f % 3 ? "f%d" : "skip%d", f);
+            std::string contents(f * 1000, 'a' + d);
+            src->addFile(path, std::string(contents));
+            if (f % 3)
+                expected->addFile(path, std::move(contents));
+        }
+    }
+
+    PathFilter filter = [](const Path & p) { return p.find("/skip") == std::string::npos; };
+
+    StringSink nar;
+    src->dumpPath(CanonPath::root, nar, filter);
+
+    StringSink expectedNar;
+    expected->dumpPath(CanonPath::root, expectedNar);
+    ASSERT_EQ(nar.s, expectedNar.s);
+
+    auto result = make_ref<MemorySourceAccessor>();
+    MemorySink sink{*result};
+    StringSource source{nar.s};
+    parseDump(sink, source);
+    ASSERT_EQ(*result, *expected);
+}
+
 } // namespace nix
@@ -0,0 +1,42 @@
+#include "nix/util/background-sink.hh"
+#include "nix/util/error.hh"
+#include <gtest/gtest.h>
+
+namespace nix {
+
+TEST(BackgroundSink, writesEverythingInOrder)
+{
+    StringSink out;
+    std::string expected;
+    {
+        BackgroundSink sink(out, 16);
+        for (int i = 0; i < 1000; ++i) {
+            auto s = std::to_string(i) + "\n";
+            sink(s);
+            expected += s;
+        }
+        sink.finish();
+    }
+    ASSERT_EQ(out.s, expected);
+}
+
+TEST(BackgroundSink, destructorFlushes)
+{
+    StringSink out;
+    {
+        BackgroundSink sink(out);
+        sink("foo");
+        sink("bar");
+    }
+    ASSERT_EQ(out.s, "foobar");
+}
+
+TEST(BackgroundSink, rethrowsErrors)
+{
+    LambdaSink failing([](std::string_view) { throw Error("disk full"); });
+    BackgroundSink sink(failing);
+    sink("foo");
+    ASSERT_THROW(sink.finish(), Error);
+}
+
+} // namespace nix
@@ -2,6 +2,8 @@
 
 #include <gtest/gtest.h>
 
+#include <thread>
+
 namespace nix {
 TEST(ChunkedVector, InitEmpty)
 {
@@ -53,4 +55,31 @@ TEST(ChunkedVector, OverflowOK)
     }
 }
 
+TEST(ChunkedVector, ConcurrentReadsDuringAdd)
+{
+    // Readers may look up any element that has already been added while
+    // the (single) writer keeps growing the vector.
+    auto v = ChunkedVector<int, 4>(1);
+    v.add(0);
+    constexpr int n = 100000;
+
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 4; t++)
+        readers.emplace_back([&]() {
+            while (v.size() < n) {
+                auto idx = v.size() - 1;
+                ASSERT_EQ(v[idx], int(idx));
+            }
+        });
+
+    for (int i = 1; i < n; i++)
+        v.add(i);
+
+    for (auto & t : readers)
+        t.join();
+
+    for (int i = 0; i < n; i++)
+        ASSERT_EQ(v[i], i);
+}
+
 } // namespace nix
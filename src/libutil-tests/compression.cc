@@ -48,6 +48,22 @@ TEST(decompress, decompressXzCompressed)
     ASSERT_EQ(o, str);
 }
 
+TEST(decompress, decompressParallelXzCompressed)
+{
+    std::string str;
+    for (int i = 0; i < 100000; ++i)
+        str += std::to_string(i) + "\n";
+
+    ASSERT_EQ(decompress("xz", compress("xz", str, true)), str);
+}
+
+TEST(decompress, decompressTruncatedXzThrowsCompressionError)
+{
+    auto compressed = compress("xz", "slfja;sljfklsa;jfklsjfkl;sdjfkl;sadjfkl;sdjf;lsdfjsadlf");
+
+    ASSERT_THROW(decompress("xz", compressed.substr(0, compressed.size() - 8)), Error);
+}
+
 TEST(decompress, decompressBzip2Compressed)
 {
     auto method = "bzip2";
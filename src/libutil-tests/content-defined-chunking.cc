@@ -0,0 +1,77 @@
+#include "nix/util/content-defined-chunking.hh"
+
+#include <gtest/gtest.h>
+
+#include <random>
+#include <set>
+
+namespace nix {
+
+static std::string randomData(size_t size, unsigned int seed)
+{
+    std::mt19937 gen(seed);
+    std::string s(size, '\0');
+    for (auto & c : s)
+        c = (char) gen();
+    return s;
+}
+
+static std::vector<std::string> chunk(std::string_view data, size_t writeSize = 4096)
+{
+    std::vector<std::string> chunks;
+    ChunkingSink sink([&](std::string_view chunk) { chunks.emplace_back(chunk); }, 1024, 4096, 16384);
+    for (size_t i = 0; i < data.size(); i += writeSize)
+        sink(data.substr(i, writeSize));
+    sink.finish();
+    return chunks;
+}
+
+TEST(ChunkingSink, empty)
+{
+    ASSERT_TRUE(chunk("").empty());
+}
+
+TEST(ChunkingSink, chunksConcatenateToInput)
+{
+    auto data = randomData(1 << 20, 1);
+    auto chunks = chunk(data);
+    ASSERT_GT(chunks.size(), 1u);
+
+    std::string joined;
+    for (auto & c : chunks) {
+        ASSERT_LE(c.size(), 16384u);
+        joined += c;
+    }
+    ASSERT_EQ(joined, data);
+
+    for (size_t i = 0; i + 1 < chunks.size(); ++i)
+        ASSERT_GT(chunks[i].size(), 1024u);
+}
+
+TEST(ChunkingSink, boundariesDontDependOnWriteSize)
+{
+    auto data = randomData(256 * 1024, 2);
+    ASSERT_EQ(chunk(data, 1), chunk(data, 100000));
+}
+
+TEST(ChunkingSink, insertionOnlyChangesNearbyChunks)
+{
+    auto data = randomData(1 << 20, 3);
+    auto chunks1 = chunk(data);
+    auto chunks2 = chunk("some inserted bytes" + data);
+
+    std::set<std::string> set1(chunks1.begin(), chunks1.end());
+    size_t shared = 0;
+    for (auto & c : chunks2)
+        shared += set1.count(c);
+
+    ASSERT_GE(shared, chunks2.size() - 2);
+}
+
+TEST(ChunkingSink, invalidSizes)
+{
+    ASSERT_THROW(ChunkingSink([](std::string_view) {}, 1024, 3000, 16384), Error);
+    ASSERT_THROW(ChunkingSink([](std::string_view) {}, 8192, 4096, 16384), Error);
+}
+
+} // namespace nix
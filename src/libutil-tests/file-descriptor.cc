@@ -1,9 +1,11 @@
 #include <gtest/gtest.h>
 
 #include "nix/util/file-descriptor.hh"
+#include "nix/util/file-system.hh"
 #include "nix/util/serialise.hh"
 
 #include <cstring>
+#include <thread>
 
 namespace nix {
 
@@ -242,4 +244,85 @@ TEST(BufferedSourceReadLine, BufferExhaustedThenEof)
     EXPECT_EQ(source.readLine(/*eofOk=*/true), "");
 }
 
+TEST(WritevFull, WritesAllParts)
+{
+    Pipe pipe;
+    pipe.create();
+
+    std::string_view parts[] = {"hello", "", " ", "world\n"};
+    writevFull(pipe.writeSide.get(), parts, /*allowInterrupts=*/false);
+    pipe.writeSide.close();
+
+    EXPECT_EQ(readLine(pipe.readSide.get()), "hello world");
+}
+
+TEST(BufferedSource, GrowsBufferOnFullReads)
+{
+    std::string data(10000, 'x');
+    struct Source : TestBufferedStringSource
+    {
+        using TestBufferedStringSource::TestBufferedStringSource;
+        size_t reads = 0;
+
+        size_t readUnbuffered(char * buf, size_t len) override
+        {
+            reads++;
+            return TestBufferedStringSource::readUnbuffered(buf, len);
+        }
+    } source(data, 16);
+    source.maxBufSize = 4096;
+
+    EXPECT_EQ(source.drain(), data);
+    EXPECT_EQ(source.bufSize, 4096u);
+    /* 16 + 32 + ... + 2048 bytes take 8 reads, and the remaining 5920
+       bytes take 2 more. Another read reports the end of the data. */
+    EXPECT_EQ(source.reads, 11u);
+}
+
+TEST(FdSink, WritesFramesVectored)
+{
+    Pipe pipe;
+    pipe.create();
+
+    std::string data(100000, 'y');
+    std::thread writer([&]() {
+        FdSink sink(pipe.writeSide.get());
+        {
+            FramedSink framed(sink, []() {});
+            framed(data);
+        }
+        pipe.writeSide.close();
+    });
+
+    FdSource source(pipe.readSide.get());
+    std::string received;
+    {
+        FramedSource framed(source);
+        received = framed.drain();
+    }
+    writer.join();
+
+    EXPECT_EQ(received, data);
+}
+
+TEST(FdSink, WritesFromFd)
+{
+    auto [inFd, inPath] = createTempFile();
+    AutoDelete delIn(inPath, false);
+    std::string data(200000, 'z');
+    writeFull(inFd.get(), data, /*allowInterrupts=*/false);
+    ASSERT_EQ(lseek(inFd.get(), 0, SEEK_SET), 0);
+
+    auto [outFd, outPath] = createTempFile();
+    AutoDelete delOut(outPath, false);
+    {
+        FdSink sink(outFd.get());
+        sink("header");
+        auto n = sink.writeFromFd(inFd.get(), data.size());
+        sink(std::string_view(data).substr(n));
+    }
+
+    EXPECT_EQ(readFile(outPath), "header" + data);
+}
+
 } // namespace nix
@@ -414,6 +414,34 @@ TEST(FdSource, restartWorks)
     EXPECT_EQ(source.drain(), "");
 }
 
+/* ----------------------------------------------------------------------------
+ * readFile
+ * --------------------------------------------------------------------------*/
+
+TEST(readFile, intoFdSink)
+{
+    auto tmpDir = createTempDir();
+    nix::AutoDelete delTmpDir(tmpDir, /*recursive=*/true);
+
+    std::string contents(300000, 'x');
+    for (size_t i = 0; i < contents.size(); i += 1000)
+        contents[i] = 'a' + i % 26;
+    writeFile(tmpDir + "/in", contents);
+
+    {
+        AutoCloseFD out = toDescriptor(open((tmpDir + "/out").c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0600));
+        ASSERT_TRUE(out);
+        FdSink sink(out.get());
+        sink("header");
+        readFile(tmpDir + "/in", sink);
+        sink("trailer");
+        sink.flush();
+        EXPECT_EQ(sink.written, contents.size() + 13);
+    }
+
+    EXPECT_EQ(readFile(tmpDir + "/out"), "header" + contents + "trailer");
+}
+
 TEST(createTempDir, works)
 {
     auto tmpDir = createTempDir();
@@ -0,0 +1,100 @@
+#include "nix/util/hash.hh"
+
+#include <benchmark/benchmark.h>
+
+#include <random>
+
+using namespace nix;
+
+static std::string randomBytes(std::mt19937 & urng, size_t size)
+{
+    std::string res(size, 0);
+    std::uniform_int_distribution<int> dist(0, 255);
+    for (auto & c : res)
+        c = dist(urng);
+    return res;
+}
+
+// Benchmark hashing a large buffer through a HashSink
+static void BM_HashSinkSHA256(benchmark::State & state)
+{
+    std::mt19937 urng(0);
+    auto bytes = randomBytes(urng, state.range());
+
+    for (auto _ : state) {
+        HashSink sink(HashAlgorithm::SHA256);
+        sink(bytes);
+        benchmark::DoNotOptimize(sink.finish());
+    }
+
+    state.SetBytesProcessed(state.iterations() * bytes.size());
+}
+
+BENCHMARK(BM_HashSinkSHA256)->Arg(4'096)->Arg(1'000'000)->Arg(64'000'000);
+
+// Benchmark hashing a large file-like stream of 64 KiB writes with BLAKE3
+static void BM_HashSinkBLAKE3(benchmark::State & state)
+{
+    ExperimentalFeatureSettings xpSettings;
+    xpSettings.set("experimental-features", "blake3-hashes");
+
+    std::mt19937 urng(0);
+    auto bytes = randomBytes(urng, state.range());
+
+    for (auto _ : state) {
+        HashSink sink(HashAlgorithm::BLAKE3, xpSettings);
+        for (std::string_view data = bytes; !data.empty();) {
+            auto chunk = data.substr(0, 65536);
+            sink(chunk);
+            data.remove_prefix(chunk.size());
+        }
+        benchmark::DoNotOptimize(sink.finish());
+    }
+
+    state.SetBytesProcessed(state.iterations() * bytes.size());
+}
+
+BENCHMARK(BM_HashSinkBLAKE3)->Arg(1'000'000)->Arg(64'000'000);
+
+// Benchmark hashing many small inputs, one at a time and with hashStrings()
+static std::vector<std::string> smallInputs(size_t count)
+{
+    std::mt19937 urng(0);
+    std::uniform_int_distribution<size_t> sizeDist(100, 16'384);
+    std::vector<std::string> res;
+    for (size_t i = 0; i < count; ++i)
+        res.push_back(randomBytes(urng, sizeDist(urng)));
+    return res;
+}
+
+static void BM_HashStringSmallSHA256(benchmark::State & state)
+{
+    auto inputs = smallInputs(state.range());
+    size_t processed = 0;
+
+    for (auto _ : state)
+        for (auto & s : inputs) {
+            benchmark::DoNotOptimize(hashString(HashAlgorithm::SHA256, s));
+            processed += s.size();
+        }
+
+    state.SetBytesProcessed(processed);
+}
+
+static void BM_HashStringsSmallSHA256(benchmark::State & state)
+{
+    auto inputs = smallInputs(state.range());
+    std::vector<std::string_view> views(inputs.begin(), inputs.end());
+    size_t processed = 0;
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(hashStrings(HashAlgorithm::SHA256, views));
+        for (auto & s : inputs)
+            processed += s.size();
+    }
+
+    state.SetBytesProcessed(processed);
+}
+
+BENCHMARK(BM_HashStringSmallSHA256)->Arg(100)->Arg(10'000);
+BENCHMARK(BM_HashStringsSmallSHA256)->Arg(100)->Arg(10'000);
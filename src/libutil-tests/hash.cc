@@ -68,6 +68,26 @@ TEST_F(BLAKE3HashTest, testKnownBLAKE3Hashes3)
         "blake3:83a2de1ee6f4e6ab686889248f4ec0cf4cc5709446a682ffd1cbb4d6165181e2");
 }
 
+TEST_F(BLAKE3HashTest, hashSinkMatchesHashString)
+{
+    /* Large enough to be hashed on several threads if BLAKE3 was
+       built with TBB. */
+    std::string s;
+    for (size_t i = 0; s.size() < 5 * 1024 * 1024; ++i)
+        s += std::to_string(i);
+
+    HashSink sink(HashAlgorithm::BLAKE3, mockXpSettings);
+    for (std::string_view data = s; !data.empty();) {
+        auto chunk = data.substr(0, 65536 - 7);
+        sink(chunk);
+        data.remove_prefix(chunk.size());
+    }
+    auto res = sink.finish();
+
+    ASSERT_EQ(res.numBytesDigested, s.size());
+    ASSERT_EQ(res.hash, hashString(HashAlgorithm::BLAKE3, s, mockXpSettings));
+}
+
 TEST(hashString, testKnownMD5Hashes1)
 {
     // values taken from: https://tools.ietf.org/html/rfc1321
@@ -147,6 +167,24 @@ TEST(hashString, testKnownSHA512Hashes2)
         "c7d329eeb6dd26545e96e55b874be909");
 }
 
+TEST(hashStrings, matchesHashString)
+{
+    /* Enough data to be split over several threads. */
+    std::vector<std::string> strings;
+    for (size_t i = 0; i < 3000; ++i)
+        strings.push_back(std::string(i, 'a' + i % 26));
+    std::vector<std::string_view> inputs(strings.begin(), strings.end());
+
+    for (auto ha : {HashAlgorithm::MD5, HashAlgorithm::SHA256}) {
+        auto hashes = hashStrings(ha, inputs);
+        ASSERT_EQ(hashes.size(), inputs.size());
+        for (size_t i = 0; i < inputs.size(); ++i)
+            ASSERT_EQ(hashes[i], hashString(ha, inputs[i]));
+    }
+
+    ASSERT_TRUE(hashStrings(HashAlgorithm::SHA256, {}).empty());
+}
+
 /* ----------------------------------------------------------------------------
  * parsing hashes
  * --------------------------------------------------------------------------*/
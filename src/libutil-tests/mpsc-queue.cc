@@ -0,0 +1,75 @@
+#include "nix/util/mpsc-queue.hh"
+#include <gtest/gtest.h>
+
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace nix {
+
+TEST(BoundedMPSCQueue, popFromEmptyQueue)
+{
+    BoundedMPSCQueue<std::string> q(4);
+    ASSERT_EQ(q.tryPop(), std::nullopt);
+}
+
+TEST(BoundedMPSCQueue, fifo)
+{
+    BoundedMPSCQueue<std::string> q(4);
+    ASSERT_TRUE(q.tryPush("a"));
+    ASSERT_TRUE(q.tryPush("b"));
+    ASSERT_EQ(q.tryPop(), "a");
+    ASSERT_TRUE(q.tryPush("c"));
+    ASSERT_EQ(q.tryPop(), "b");
+    ASSERT_EQ(q.tryPop(), "c");
+    ASSERT_EQ(q.tryPop(), std::nullopt);
+}
+
+TEST(BoundedMPSCQueue, pushToFullQueue)
+{
+    BoundedMPSCQueue<std::string> q(2);
+    ASSERT_TRUE(q.tryPush("a"));
+    ASSERT_TRUE(q.tryPush("b"));
+    std::string c = "c";
+    ASSERT_FALSE(q.tryPush(std::move(c)));
+    ASSERT_EQ(c, "c");
+    ASSERT_EQ(q.tryPop(), "a");
+    ASSERT_TRUE(q.tryPush(std::move(c)));
+    ASSERT_EQ(q.tryPop(), "b");
+    ASSERT_EQ(q.tryPop(), "c");
+}
+
+TEST(BoundedMPSCQueue, concurrentProducers)
+{
+    constexpr int nrThreads = 4, perThread = 10000;
+    BoundedMPSCQueue<int> q(64);
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < nrThreads; ++t)
+        threads.emplace_back([&, t]() {
+            for (int i = 0; i < perThread; ++i)
+                while (!q.tryPush(t * perThread + i))
+                    std::this_thread::yield();
+        });
+
+    /* Items from the same producer must come out in order. */
+    std::vector<int> last(nrThreads, -1);
+    std::set<int> seen;
+    while (seen.size() < nrThreads * perThread) {
+        auto n = q.tryPop();
+        if (!n) {
+            std::this_thread::yield();
+            continue;
+        }
+        ASSERT_GT(*n % perThread, last[*n / perThread]);
+        last[*n / perThread] = *n % perThread;
+        ASSERT_TRUE(seen.insert(*n).second);
+    }
+
+    for (auto & thread : threads)
+        thread.join();
+    ASSERT_EQ(q.tryPop(), std::nullopt);
+}
+
+} // namespace nix
@@ -1,10 +1,14 @@
 #include <string_view>
 
 #include "nix/util/nar-accessor.hh"
+#include "nix/util/serialise.hh"
 #include "nix/util/tests/json-characterization.hh"
 
 namespace nix {
 
+using namespace std::string_literals;
+using namespace std::string_view_literals;
+
 // Forward declaration from memory-source-accessor.cc
 namespace memory_source_accessor {
 ref<MemorySourceAccessor> exampleComplex();
@@ -80,4 +84,62 @@ INSTANTIATE_TEST_SUITE_P(
             listNarShallow(*memory_source_accessor::exampleComplex(), CanonPath::root),
         }));
 
+/* ----------------------------------------------------------------------------
+ * Binary
+ * --------------------------------------------------------------------------*/
+
+TEST(NarListingBinary, roundTrip)
+{
+    StringSink nar;
+    memory_source_accessor::exampleComplex()->dumpPath(CanonPath::root, nar);
+    auto listing = listNarDeep(*makeNarAccessor(std::move(nar.s)), CanonPath::root);
+
+    StringSink sink;
+    writeNarListingBinary(listing, sink);
+    StringSource source(sink.s);
+    ASSERT_EQ(readNarListingBinary(source), listing);
+    ASSERT_EQ(source.drain(), "");
+}
+
+TEST(NarListingBinary, lazyAccessor)
+{
+    StringSink nar;
+    memory_source_accessor::exampleComplex()->dumpPath(CanonPath::root, nar);
+    auto listing = listNarDeep(*makeNarAccessor(std::string(nar.s)), CanonPath::root);
+
+    auto accessor = makeLazyNarAccessor(listing, [&](uint64_t offset, uint64_t length) {
+        return nar.s.substr(offset, length);
+    });
+    ASSERT_EQ(accessor->readFile(CanonPath("bar/baz")), "good day,\n\0\n\tworld!"s);
+    ASSERT_TRUE(accessor->lstat(CanonPath("bar/baz")).isExecutable);
+    ASSERT_EQ(accessor->readLink(CanonPath("bar/quux")), "/over/there");
+}
+
+TEST(NarListingBinary, readFileRange)
+{
+    StringSink nar;
+    memory_source_accessor::exampleComplex()->dumpPath(CanonPath::root, nar);
+    auto listing = listNarDeep(*makeNarAccessor(std::string(nar.s)), CanonPath::root);
+
+    size_t bytesRead = 0;
+    auto accessor = makeLazyNarAccessor(listing, [&](uint64_t offset, uint64_t length) {
+        bytesRead += length;
+        return nar.s.substr(offset, length);
+    });
+    ASSERT_EQ(accessor->readFileRange(CanonPath("bar/baz"), 5, 3), "day"s);
+    ASSERT_EQ(bytesRead, 3u);
+    ASSERT_EQ(accessor->readFileRange(CanonPath("bar/baz"), 13, 100), "world!"s);
+    ASSERT_EQ(accessor->readFileRange(CanonPath("bar/baz"), 100, 1), ""s);
+
+    /* The same on an accessor that holds the whole NAR in memory. */
+    auto eager = makeNarAccessor(std::move(nar.s));
+    ASSERT_EQ(eager->readFileRange(CanonPath("bar/baz"), 5, 3), "day"s);
+}
+
+TEST(NarListingBinary, rejectsGarbage)
+{
+    StringSource source{"not a listing"sv};
+    ASSERT_THROW(readNarListingBinary(source), Error);
+}
+
 } // namespace nix
@@ -1,6 +1,7 @@
 #include <gtest/gtest.h>
 
 #include "nix/util/position.hh"
+#include "nix/util/pos-table.hh"
 
 namespace nix {
 
@@ -121,4 +122,43 @@ TEST(Position, example_1)
     ASSERT_EQ(start.getSnippetUpTo(end), "/** Very close */");
 }
 
+static void checkPosTable(const std::string & source)
+{
+    PosTable table;
+    auto origin = table.addOrigin(makeStdin(source), source.size());
+
+    uint32_t line = 1, column = 1;
+    for (size_t offset = 0; offset <= source.size(); ++offset) {
+        auto pos = table[table.add(origin, offset)];
+        ASSERT_EQ(pos.line, line) << "at offset " << offset;
+        ASSERT_EQ(pos.column, column) << "at offset " << offset;
+        if (offset < source.size() && source[offset] == '\n') {
+            line++;
+            column = 1;
+        } else
+            column++;
+    }
+}
+
+TEST(PosTable, lines)
+{
+    std::string source;
+    for (size_t i = 0; i < 100; ++i)
+        source += std::string(i % 7, 'x') + "\n";
+    source += "last";
+    checkPosTable(source);
+}
+
+TEST(PosTable, longLines)
+{
+    // Blocks longer than 64 KiB need wide offsets.
+    std::string source = "a\n" + std::string(70000, 'x') + "\nb\n" + std::string(100, 'y');
+    checkPosTable(source);
+}
+
+TEST(PosTable, empty)
+{
+    checkPosTable("");
+}
+
 } // namespace nix
@@ -0,0 +1,99 @@
+#include "nix/util/sharded-cache.hh"
+#include <gtest/gtest.h>
+
+#include <thread>
+
+namespace nix {
+
+TEST(ShardedCache, getFromEmptyCache)
+{
+    ShardedCache<std::string, std::string> c(10);
+    ASSERT_EQ(c.get("x"), std::nullopt);
+    ASSERT_EQ(c.size(), 0u);
+}
+
+TEST(ShardedCache, getExistingValue)
+{
+    ShardedCache<std::string, std::string> c(10);
+    c.upsert("foo", "bar");
+    ASSERT_EQ(c.get("foo"), "bar");
+    ASSERT_EQ(c.get("another"), std::nullopt);
+    ASSERT_EQ(c.size(), 1u);
+}
+
+TEST(ShardedCache, updateExistingValue)
+{
+    ShardedCache<std::string, std::string> c(10);
+    c.upsert("foo", "bar");
+    c.upsert("foo", "baz");
+    ASSERT_EQ(c.get("foo"), "baz");
+    ASSERT_EQ(c.size(), 1u);
+}
+
+TEST(ShardedCache, upsertOnZeroCapacityCache)
+{
+    ShardedCache<std::string, std::string> c(0);
+    c.upsert("foo", "bar");
+    ASSERT_EQ(c.get("foo"), std::nullopt);
+}
+
+TEST(ShardedCache, erase)
+{
+    ShardedCache<std::string, std::string> c(10);
+    c.upsert("foo", "bar");
+    c.upsert("bar", "baz");
+    ASSERT_TRUE(c.erase("foo"));
+    ASSERT_FALSE(c.erase("foo"));
+    ASSERT_EQ(c.get("foo"), std::nullopt);
+    ASSERT_EQ(c.get("bar"), "baz");
+}
+
+TEST(ShardedCache, clear)
+{
+    ShardedCache<std::string, std::string> c(10);
+    c.upsert("foo", "bar");
+    c.clear();
+    ASSERT_EQ(c.size(), 0u);
+    ASSERT_EQ(c.get("foo"), std::nullopt);
+}
+
+TEST(ShardedCache, sizeIsBounded)
+{
+    ShardedCache<int, int> c(64, 4);
+    for (int i = 0; i < 1000; ++i)
+        c.upsert(i, i);
+    ASSERT_LE(c.size(), 64u);
+    ASSERT_EQ(c.get(999), 999);
+}
+
+TEST(ShardedCache, referencedEntriesSurviveEviction)
+{
+    ShardedCache<int, int> c(2, 1);
+    c.upsert(1, 1);
+    c.upsert(2, 2);
+    c.get(1);
+    c.upsert(3, 3);
+    ASSERT_EQ(c.get(1), 1);
+    ASSERT_EQ(c.get(2), std::nullopt);
+    ASSERT_EQ(c.get(3), 3);
+}
+
+TEST(ShardedCache, concurrentAccess)
+{
+    ShardedCache<int, int> c(100);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t)
+        threads.emplace_back([&, t]() {
+            for (int i = 0; i < 10000; ++i) {
+                c.upsert(i % 200, t);
+                c.get((i * 7) % 200);
+                if (i % 13 == 0)
+                    c.erase(i % 200);
+            }
+        });
+    for (auto & thread : threads)
+        thread.join();
+    ASSERT_LE(c.size(), 112u);
+}
+
+} // namespace nix
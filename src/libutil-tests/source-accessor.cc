@@ -1,5 +1,6 @@
 #include "nix/util/fs-sink.hh"
 #include "nix/util/file-system.hh"
+#include "nix/util/posix-source-accessor.hh"
 #include "nix/util/processes.hh"
 
 #include <gtest/gtest.h>
@@ -137,4 +138,33 @@ TEST_F(FSSourceAccessorTest, works)
     }
 }
 
+TEST_F(FSSourceAccessorTest, cacheInvalidation)
+{
+    auto accessor = makeFSSourceAccessor(tmpDir);
+
+    writeFile(tmpDir / "file1", "content1");
+    EXPECT_THAT(accessor, HasContents(CanonPath("file1"), "content1"));
+
+    std::filesystem::remove(tmpDir / "file1");
+    PosixSourceAccessor::invalidateCache(tmpDir / "file1");
+    EXPECT_FALSE(accessor->pathExists(CanonPath("file1")));
+
+    writeFile(tmpDir / "file1", "content2");
+    PosixSourceAccessor::invalidateCache(tmpDir / "file1");
+    EXPECT_THAT(accessor, HasContents(CanonPath("file1"), "content2"));
+
+#ifndef _WIN32
+    /* Listings of read-only directories are cached too. */
+    createDirs(tmpDir / "ro");
+    writeFile(tmpDir / "ro" / "a", "");
+    std::filesystem::permissions(tmpDir / "ro", std::filesystem::perms::owner_write, std::filesystem::perm_options::remove);
+    EXPECT_THAT(accessor, HasDirectory(CanonPath("ro"), std::set<std::string>{"a"}));
+
+    std::filesystem::permissions(tmpDir / "ro", std::filesystem::perms::owner_write, std::filesystem::perm_options::add);
+    writeFile(tmpDir / "ro" / "b", "");
+    PosixSourceAccessor::invalidateCache(tmpDir / "ro" / "b");
+    EXPECT_THAT(accessor, HasDirectory(CanonPath("ro"), std::set<std::string>{"a", "b"}));
+#endif
+}
+
 } // namespace nix
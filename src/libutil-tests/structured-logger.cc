@@ -0,0 +1,102 @@
+#include "nix/util/logging.hh"
+#include "nix/util/file-descriptor.hh"
+#include "nix/util/strings.hh"
+#include "nix/util/util.hh"
+
+#include <gtest/gtest.h>
+#include <nlohmann/json.hpp>
+
+namespace nix {
+
+/**
+ * Run `f` with a structured logger writing to a pipe, and return the
+ * events it wrote.
+ */
+static std::vector<nlohmann::json> logEvents(StructuredLogFormat format, std::function<void(Logger &)> f)
+{
+    Pipe pipe;
+    pipe.create();
+
+    {
+        auto logger = makeStructuredLogger(pipe.writeSide.get(), format);
+        f(*logger);
+        logger->stop();
+    }
+    pipe.writeSide.close();
+
+    auto data = drainFD(pipe.readSide.get());
+
+    std::vector<nlohmann::json> events;
+    if (format == StructuredLogFormat::CBOR) {
+        /* A CBOR sequence is a concatenation of CBOR items. */
+        size_t pos = 0;
+        while (pos < data.size()) {
+            std::string_view rest(data.data() + pos, data.size() - pos);
+            auto event = nlohmann::json::from_cbor(rest.begin(), rest.end(), false);
+            auto encoded = nlohmann::json::to_cbor(event);
+            pos += encoded.size();
+            events.push_back(std::move(event));
+        }
+    } else {
+        for (auto & line : tokenizeString<std::vector<std::string>>(data, "\n")) {
+            EXPECT_TRUE(hasPrefix(line, "@nix "));
+            events.push_back(nlohmann::json::parse(line.substr(5)));
+        }
+    }
+    return events;
+}
+
+static void logActivity(Logger & logger)
+{
+    logger.startActivity(1, lvlInfo, actBuild, "building \"foo\"\n\x01\xff", {"/nix/store/foo.drv", "", uint64_t(1), uint64_t(1)}, 0);
+    for (uint64_t i = 0; i < 100; ++i)
+        logger.result(1, resProgress, {i, uint64_t(100), uint64_t(0), uint64_t(0)});
+    logger.result(1, resBuildLogLine, {"line"});
+    logger.log(lvlWarn, "a message");
+    logger.stopActivity(1);
+}
+
+static void checkEvents(const std::vector<nlohmann::json> & events, std::string_view expectedText)
+{
+    ASSERT_GE(events.size(), 5u);
+
+    auto & start = events.front();
+    ASSERT_EQ(start["action"], "start");
+    ASSERT_EQ(start["id"], 1);
+    ASSERT_EQ(start["level"], lvlInfo);
+    ASSERT_EQ(start["type"], actBuild);
+    ASSERT_EQ(start["parent"], 0);
+    ASSERT_EQ(start["fields"], nlohmann::json::parse(R"(["/nix/store/foo.drv", "", 1, 1])"));
+    ASSERT_EQ(start["text"], expectedText);
+
+    /* Intermediate progress updates may be dropped, but not the last
+       one, and the other events stay in order. */
+    std::vector<nlohmann::json> progress, rest;
+    for (auto & event : events)
+        (event["action"] == "result" && event["type"] == resProgress ? progress : rest).push_back(event);
+
+    ASSERT_FALSE(progress.empty());
+    ASSERT_EQ(progress.back()["fields"][0], 99);
+    ASSERT_EQ(events[progress.size()], rest[1]);
+
+    ASSERT_EQ(rest.size(), 4u);
+    ASSERT_EQ(rest[1]["type"], resBuildLogLine);
+    ASSERT_EQ(rest[1]["fields"][0], "line");
+    ASSERT_EQ(rest[2]["action"], "msg");
+    ASSERT_EQ(rest[2]["msg"], "a message");
+    ASSERT_EQ(rest[3]["action"], "stop");
+    ASSERT_EQ(rest[3]["id"], 1);
+}
+
+TEST(StructuredLogger, json)
+{
+    /* Invalid UTF-8 is replaced by U+FFFD. */
+    checkEvents(logEvents(StructuredLogFormat::JSON, logActivity), "building \"foo\"\n\x01\xef\xbf\xbd");
+}
+
+TEST(StructuredLogger, cbor)
+{
+    checkEvents(logEvents(StructuredLogFormat::CBOR, logActivity), "building \"foo\"\n\x01\xff");
+}
+
+} // namespace nix
@@ -0,0 +1,98 @@
+#include "nix/util/tarfile.hh"
+#include "nix/util/compression.hh"
+#include "nix/util/file-system.hh"
+
+#include <archive_entry.h>
+#include <gtest/gtest.h>
+
+namespace nix {
+
+namespace {
+
+struct TarballBuilder
+{
+    struct archive * archive = archive_write_new();
+    std::vector<char> buf = std::vector<char>(8 * 1024 * 1024);
+    size_t used = 0;
+
+    TarballBuilder()
+    {
+        archive_write_set_format_pax_restricted(archive);
+        archive_write_open_memory(archive, buf.data(), buf.size(), &used);
+    }
+
+    ~TarballBuilder()
+    {
+        archive_write_free(archive);
+    }
+
+    void add(const std::string & path, unsigned int type, std::string_view contents = "", const char * link = nullptr)
+    {
+        auto entry = archive_entry_new();
+        archive_entry_set_pathname(entry, path.c_str());
+        archive_entry_set_filetype(entry, type);
+        archive_entry_set_perm(entry, 0755);
+        archive_entry_set_size(entry, contents.size());
+        if (type == AE_IFLNK)
+            archive_entry_set_symlink(entry, link);
+        else if (link)
+            archive_entry_set_hardlink(entry, link);
+        archive_write_header(archive, entry);
+        archive_write_data(archive, contents.data(), contents.size());
+        archive_entry_free(entry);
+    }
+
+    std::string finish()
+    {
+        archive_write_close(archive);
+        return std::string(buf.data(), used);
+    }
+};
+
+std::string makeTarball()
+{
+    TarballBuilder builder;
+    builder.add("source", AE_IFDIR);
+    for (int i = 0; i < 500; ++i)
+        builder.add(fmt("source/dir-%d/file", i % 10 * 10), AE_IFREG, std::to_string(i));
+    builder.add("source/big", AE_IFREG, std::string(3 * 1024 * 1024, 'x'));
+    builder.add("source/link", AE_IFLNK, "", "big");
+    builder.add("source/hardlink", AE_IFREG, "", "source/dir-0/file");
+    return builder.finish();
+}
+
+void checkUnpacked(const std::filesystem::path & dir)
+{
+    /* Later entries for the same path replace earlier ones. */
+    for (int i = 0; i < 10; ++i)
+        ASSERT_EQ(readFile(dir / "source" / fmt("dir-%d", i * 10) / "file"), std::to_string(490 + i));
+    ASSERT_EQ(readFile(dir / "source" / "big").size(), 3 * 1024 * 1024);
+    ASSERT_EQ(readLink(dir / "source" / "link").string(), "big");
+    ASSERT_EQ(readFile(dir / "source" / "hardlink"), "490");
+}
+
+} // namespace
+
+TEST(unpackTarfile, writesFilesInOrder)
+{
+    auto tmpDir = createTempDir();
+    AutoDelete delTmpDir(tmpDir, true);
+
+    StringSource source(makeTarball());
+    unpackTarfile(source, tmpDir);
+
+    checkUnpacked(tmpDir);
+}
+
+TEST(unpackTarfile, xz)
+{
+    auto tmpDir = createTempDir();
+    AutoDelete delTmpDir(tmpDir, true);
+
+    StringSource source(compress("xz", makeTarball(), true));
+    unpackTarfile(source, tmpDir);
+
+    checkUnpacked(tmpDir);
+}
+
+} // namespace nix
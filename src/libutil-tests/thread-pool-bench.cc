@@ -0,0 +1,76 @@
+#include "nix/util/thread-pool.hh"
+
+#include <benchmark/benchmark.h>
+
+using namespace nix;
+
+// Benchmark enqueueing many tiny items from the thread that runs process()
+static void BM_ThreadPoolTinyItems(benchmark::State & state)
+{
+    for (auto _ : state) {
+        ThreadPool pool(8);
+        std::atomic<size_t> count{0};
+        for (int64_t i = 0; i < state.range(); ++i)
+            pool.enqueue([&]() { count.fetch_add(1, std::memory_order_relaxed); });
+        pool.process();
+        benchmark::DoNotOptimize(count.load());
+    }
+
+    state.SetItemsProcessed(state.iterations() * state.range());
+}
+
+BENCHMARK(BM_ThreadPoolTinyItems)->Arg(1'000)->Arg(100'000)->UseRealTime();
+
+// Benchmark tiny items that recursively enqueue more items, as in processGraph()
+static void BM_ThreadPoolFanOut(benchmark::State & state)
+{
+    size_t items = 0;
+
+    for (auto _ : state) {
+        ThreadPool pool(8);
+        std::atomic<size_t> count{0};
+
+        std::function<void(int64_t)> fanOut = [&](int64_t depth) {
+            count.fetch_add(1, std::memory_order_relaxed);
+            if (depth)
+                for (int i = 0; i < 4; ++i)
+                    pool.enqueue([&, depth]() { fanOut(depth - 1); });
+        };
+
+        pool.enqueue([&]() { fanOut(state.range()); });
+        pool.process();
+        items += count;
+    }
+
+    state.SetItemsProcessed(items);
+}
+
+BENCHMARK(BM_ThreadPoolFanOut)->Arg(5)->Arg(8)->UseRealTime();
+
+// Benchmark processGraph() on a closure-like DAG where every node depends on a few earlier nodes
+static void BM_ProcessGraph(benchmark::State & state)
+{
+    std::set<int64_t> nodes;
+    for (int64_t i = 0; i < state.range(); ++i)
+        nodes.insert(i);
+
+    for (auto _ : state) {
+        std::atomic<size_t> count{0};
+        processGraph<int64_t>(
+            nodes,
+            [](const int64_t & n) {
+                std::set<int64_t> deps;
+                for (int64_t d : {1, 7, 100, 1000})
+                    if (n >= d)
+                        deps.insert(n - d);
+                return deps;
+            },
+            [&](const int64_t &) { count.fetch_add(1, std::memory_order_relaxed); },
+            8);
+        benchmark::DoNotOptimize(count.load());
+    }
+
+    state.SetItemsProcessed(state.iterations() * state.range());
+}
+
+BENCHMARK(BM_ProcessGraph)->Arg(10'000)->Arg(100'000)->UseRealTime();
@@ -0,0 +1,191 @@
+#include "nix/util/thread-pool.hh"
+#include "nix/util/signals.hh"
+#include <gtest/gtest.h>
+
+namespace nix {
+
+TEST(ThreadPool, processEmptyPool)
+{
+    ThreadPool pool(4);
+    pool.process();
+}
+
+TEST(ThreadPool, runsAllItems)
+{
+    ThreadPool pool(4);
+    std::atomic<size_t> count{0};
+    for (size_t i = 0; i < 10000; ++i)
+        pool.enqueue([&]() { count++; });
+    pool.process();
+    ASSERT_EQ(count, 10000u);
+}
+
+TEST(ThreadPool, itemsCanEnqueueItems)
+{
+    ThreadPool pool(4);
+    std::atomic<size_t> count{0};
+
+    std::function<void(size_t)> fanOut = [&](size_t depth) {
+        count++;
+        if (depth)
+            for (int i = 0; i < 4; ++i)
+                pool.enqueue([&, depth]() { fanOut(depth - 1); });
+    };
+
+    pool.enqueue([&]() { fanOut(6); });
+    pool.process();
+
+    /* 1 + 4 + ... + 4^6 */
+    ASSERT_EQ(count, 5461u);
+}
+
+TEST(ThreadPool, itemsCanBeEnqueuedFromOtherThreads)
+{
+    ThreadPool pool(4);
+    std::atomic<size_t> count{0};
+
+    std::thread other([&]() {
+        for (size_t i = 0; i < 1000; ++i)
+            pool.enqueue([&]() { count++; });
+    });
+    other.join();
+
+    pool.process();
+    ASSERT_EQ(count, 1000u);
+}
+
+TEST(ThreadPool, singleThread)
+{
+    ThreadPool pool(1);
+    std::vector<int> order;
+    for (int i = 0; i < 3; ++i)
+        pool.enqueue([&, i]() { order.push_back(i); });
+    pool.process();
+    ASSERT_EQ(order.size(), 3u);
+}
+
+TEST(ThreadPool, exceptionIsPropagated)
+{
+    ThreadPool pool(4);
+    try {
+        for (int i = 0; i < 100; ++i)
+            pool.enqueue([i]() {
+                if (i == 50)
+                    throw Error("item %d failed", i);
+            });
+    } catch (ThreadPoolShutDown &) {
+        /* The workers may already have hit the failing item. */
+    }
+    ASSERT_THROW(pool.process(), Error);
+    ASSERT_THROW(pool.enqueue([]() {}), ThreadPoolShutDown);
+}
+
+TEST(ThreadPool, submitReturnsResult)
+{
+    ThreadPool pool(4);
+    auto a = pool.submit([]() { return 6 * 7; });
+    auto b = pool.submit([]() -> int { throw Error("failed"); });
+    pool.process();
+    ASSERT_EQ(a.get(), 42);
+    ASSERT_THROW(b.get(), Error);
+}
+
+TEST(ThreadPool, moveOnlyItems)
+{
+    ThreadPool pool(2);
+    auto p = std::make_unique<int>(42);
+    int result = 0;
+    pool.enqueue([&result, p{std::move(p)}]() { result = *p; });
+    pool.process();
+    ASSERT_EQ(result, 42);
+}
+
+TEST(ThreadPool, submitWithoutProcess)
+{
+    /* A single-threaded pool still needs a worker thread, since
+       nobody calls process(). */
+    ThreadPool pool(1);
+    auto a = pool.submit([]() { return 6 * 7; });
+    ASSERT_EQ(a.get(), 42);
+}
+
+#ifndef _WIN32
+TEST(ThreadPool, unprocessedItemsAreDestroyed)
+{
+    auto p = std::make_shared<int>(0);
+    {
+        ThreadPool pool(1);
+        /* Keep the only worker busy until the pool shuts down, which
+           interrupts it. */
+        std::promise<void> started;
+        pool.enqueue([&]() {
+            started.set_value();
+            while (true) {
+                checkInterrupt();
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        });
+        started.get_future().wait();
+        pool.enqueue([p]() {});
+        ASSERT_EQ(p.use_count(), 2);
+    }
+    ASSERT_EQ(p.use_count(), 1);
+}
+#endif
+
+TEST(ThreadPool, processGraph)
+{
+    std::set<int> nodes{1, 2, 3, 4, 5, 6};
+    Sync<std::vector<int>> done_;
+
+    processGraph<int>(
+        nodes,
+        [](const int & n) { return n > 1 ? std::set<int>{n - 1} : std::set<int>{}; },
+        [&](const int & n) { done_.lock()->push_back(n); },
+        4);
+
+    ASSERT_EQ(*done_.lock(), (std::vector<int>{1, 2, 3, 4, 5, 6}));
+}
+
+TEST(ThreadPool, processGraphRespectsDependencies)
+{
+    /* Node n depends on all its proper divisors, and on nodes that
+       aren't in the graph. */
+    std::set<int> nodes;
+    for (int i = 1; i <= 2000; ++i)
+        nodes.insert(i);
+
+    std::vector<std::atomic<bool>> done(2001);
+    std::atomic<size_t> violations{0};
+
+    processGraph<int>(
+        nodes,
+        [](const int & n) {
+            std::set<int> deps{n, -n};
+            for (int d = 1; d < n; ++d)
+                if (n % d == 0)
+                    deps.insert(d);
+            return deps;
+        },
+        [&](const int & n) {
+            for (int d = 1; d < n; ++d)
+                if (n % d == 0 && !done[d])
+                    violations++;
+            done[n] = true;
+        },
+        8);
+
+    ASSERT_EQ(violations, 0u);
+    for (int i = 1; i <= 2000; ++i)
+        ASSERT_TRUE(done[i]);
+}
+
+TEST(ThreadPool, processGraphDetectsCycles)
+{
+    ASSERT_THROW(
+        processGraph<int>(
+            {1, 2, 3}, [](const int & n) { return std::set<int>{n % 3 + 1}; }, [](const int &) {}, 4),
+        Error);
+}
+
+} // namespace nix
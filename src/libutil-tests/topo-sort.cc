@@ -131,6 +131,41 @@ TEST_P(TopoSortTest, ProducesCorrectResult)
         testCase.expected);
 }
 
+TEST_P(TopoSortTest, DenseMatchesSetBased)
+{
+    const auto & testCase = GetParam();
+
+    std::vector<std::string> names(testCase.nodes.begin(), testCase.nodes.end());
+    std::map<std::string, uint32_t> ids;
+    for (auto & name : names)
+        ids.emplace(name, ids.size());
+
+    std::vector<std::vector<uint32_t>> edges(names.size());
+    for (auto & [parent, children] : testCase.edges)
+        for (auto & child : children)
+            if (ids.count(parent) && ids.count(child))
+                edges[ids[parent]].push_back(ids[child]);
+
+    auto expected = runTopoSort(testCase.nodes, testCase.edges);
+
+    std::visit(
+        overloaded{
+            [&](const std::vector<uint32_t> & sorted) {
+                ASSERT_TRUE(holds_alternative<std::vector<std::string>>(expected));
+                std::vector<std::string> sortedNames;
+                for (auto id : sorted)
+                    sortedNames.push_back(names[id]);
+                ASSERT_EQ(sortedNames, get<std::vector<std::string>>(expected));
+            },
+            [&](const Cycle<uint32_t> & cycle) {
+                ASSERT_TRUE(holds_alternative<Cycle<std::string>>(expected));
+                auto & expectedCycle = get<Cycle<std::string>>(expected);
+                ASSERT_EQ(names[cycle.path], expectedCycle.path);
+                ASSERT_EQ(names[cycle.parent], expectedCycle.parent);
+            }},
+        topoSortDense(edges));
+}
+
 INSTANTIATE_TEST_SUITE_P(
     TopoSort,
     TopoSortTest,
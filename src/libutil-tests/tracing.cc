@@ -0,0 +1,33 @@
+#include <gtest/gtest.h>
+
+#include "nix/util/tracing.hh"
+
+namespace nix {
+
+TEST(TraceParent, roundTrip)
+{
+    auto s = "00-4bf92f3577b34da6a3ce929d0e0e4736-00f067aa0ba902b7-01";
+    auto traceParent = TraceParent::parse(s);
+    ASSERT_TRUE(traceParent);
+    ASSERT_EQ(traceParent->traceId[0], 0x4b);
+    ASSERT_EQ(traceParent->traceId[15], 0x36);
+    ASSERT_EQ(traceParent->spanId, 0x00f067aa0ba902b7u);
+    ASSERT_EQ(traceParent->to_string(), s);
+}
+
+TEST(TraceParent, rejectsInvalid)
+{
+    ASSERT_FALSE(TraceParent::parse(""));
+    // Unsupported version.
+    ASSERT_FALSE(TraceParent::parse("01-4bf92f3577b34da6a3ce929d0e0e4736-00f067aa0ba902b7-01"));
+    // Uppercase hex digits are not allowed.
+    ASSERT_FALSE(TraceParent::parse("00-4BF92F3577B34DA6A3CE929D0E0E4736-00f067aa0ba902b7-01"));
+    // Wrong lengths.
+    ASSERT_FALSE(TraceParent::parse("00-4bf92f3577b34da6a3ce929d0e0e47-00f067aa0ba902b7-01"));
+    ASSERT_FALSE(TraceParent::parse("00-4bf92f3577b34da6a3ce929d0e0e4736-00f067aa0ba902b7-1"));
+    // All-zero IDs.
+    ASSERT_FALSE(TraceParent::parse("00-00000000000000000000000000000000-00f067aa0ba902b7-01"));
+    ASSERT_FALSE(TraceParent::parse("00-4bf92f3577b34da6a3ce929d0e0e4736-0000000000000000-01"));
+}
+
+} // namespace nix
@@ -101,4 +101,24 @@ TEST(XMLWriter, writeEmptyElementWithAttributes)
     ASSERT_EQ(out.str(), "<?xml version='1.0' encoding='utf-8'?>\n<foobar foo=\"bar\" />");
 }
 
+TEST(XMLWriter, sinkWithNestedElementsAndEscaping)
+{
+    StringSink sink;
+    {
+        XMLWriter t(true, sink);
+        t.openElement("a");
+        t.openElement("b");
+        t.writeEmptyElement("c", {{"value", "x\"y\nz&"}});
+    }
+
+    ASSERT_EQ(
+        sink.s,
+        "<?xml version='1.0' encoding='utf-8'?>\n"
+        "<a>\n"
+        "  <b>\n"
+        "    <c value=\"x&quot;y&#xA;z&amp;\" />\n"
+        "  </b>\n"
+        "</a>\n");
+}
+
 } // namespace nix
@@ -2,6 +2,8 @@
 #include <algorithm>
 #include <vector>
 #include <map>
+#include <thread>
+#include <unordered_map>
 
 #include <strings.h> // for strcasecmp
 
@@ -12,6 +14,12 @@
 #include "nix/util/source-path.hh"
 #include "nix/util/file-system.hh"
 #include "nix/util/signals.hh"
+#include "nix/util/sync.hh"
+
+#ifdef __linux__
+#  include "nix/util/io-uring.hh"
+#  include <fcntl.h>
+#endif
 
 namespace nix {
 
@@ -34,10 +42,298 @@ static GlobalConfig::Register rArchiveSettings(&archiveSettings);
 
 PathFilter defaultPathFilter = [](const Path &) { return true; };
 
+/**
+ * Reads small regular files on a set of worker threads ahead of the
+ * NAR serialiser, so that file system latency overlaps with hashing
+ * and compression of the preceding files. Files are handed out in the
+ * order in which the serialiser needs them, and at most
+ * `maxBytesInFlight` bytes of file contents are buffered at any time.
+ *
+ * On Linux, if `use-io-uring` is enabled and the files are in the
+ * local file system, a single thread reads them in batches through an
+ * io_uring instead.
+ */
+struct FilePrefetcher
+{
+    static constexpr uint64_t maxFileSize = 1 << 20;
+    static constexpr uint64_t maxBytesInFlight = 64 << 20;
+
+    /**
+     * Don't bother starting threads for trees with fewer files.
+     */
+    static constexpr size_t minFiles = 16;
+
+    struct File
+    {
+        CanonPath path;
+        uint64_t size;
+        std::optional<std::string> contents;
+        std::exception_ptr exception;
+        bool done = false;
+    };
+
+    SourceAccessor & accessor;
+    std::vector<File> files;
+
+    struct State
+    {
+        size_t nextToRead = 0;
+        size_t nextToConsume = 0;
+        uint64_t bytesInFlight = 0;
+        bool quit = false;
+    };
+
+    Sync<State> state_;
+    std::condition_variable wakeup;
+    std::vector<std::thread> workers;
+
+#ifdef __linux__
+    static constexpr size_t maxBatchSize = 64;
+
+    AutoCloseFD rootFd;
+    std::optional<IoUringBatch> batch;
+#endif
+
+    FilePrefetcher(SourceAccessor & accessor, std::vector<File> && files)
+        : accessor(accessor)
+        , files(std::move(files))
+    {
+#ifdef __linux__
+        if (useIoUring() && dynamic_cast<PosixSourceAccessor *>(&accessor))
+            if (auto root = accessor.getPhysicalPath(CanonPath::root)) {
+                rootFd = open(root->c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+                if (rootFd)
+                    try {
+                        batch.emplace(maxBatchSize);
+                        workers.emplace_back([this]() { workBatched(); });
+                        return;
+                    } catch (Error & e) {
+                        debug("not using io_uring: %s", e.msg());
+                    }
+            }
+#endif
+        auto nrThreads = std::clamp<size_t>(std::thread::hardware_concurrency(), 2, 8);
+        for (size_t i = 0; i < nrThreads; ++i)
+            workers.emplace_back([this]() { work(); });
+    }
+
+    ~FilePrefetcher()
+    {
+        state_.lock()->quit = true;
+        wakeup.notify_all();
+        for (auto & thread : workers)
+            thread.join();
+    }
+
+    void work()
+    {
+        while (true) {
+            size_t n;
+            {
+                auto state(state_.lock());
+                /* Always allow reading the file that the consumer is
+                   waiting for, otherwise we could deadlock. */
+                while (!state->quit && state->nextToRead < files.size() && state->nextToRead != state->nextToConsume
+                       && state->bytesInFlight + files[state->nextToRead].size > maxBytesInFlight)
+                    state.wait(wakeup);
+                if (state->quit || state->nextToRead >= files.size())
+                    return;
+                n = state->nextToRead++;
+                state->bytesInFlight += files[n].size;
+            }
+
+            auto & file = files[n];
+            try {
+                file.contents = accessor.readFile(file.path);
+            } catch (...) {
+                file.exception = std::current_exception();
+            }
+
+            {
+                auto state(state_.lock());
+                file.done = true;
+            }
+            wakeup.notify_all();
+        }
+    }
+
+#ifdef __linux__
+    /**
+     * Read the files in batches of up to `maxBatchSize` by opening,
+     * reading and closing all files of a batch in one io_uring
+     * submission each. Files that can't be read this way (e.g. because
+     * they were replaced by a symlink) are read through the accessor.
+     */
+    void workBatched()
+    {
+        while (true) {
+            size_t first, end;
+            {
+                auto state(state_.lock());
+                while (!state->quit && state->nextToRead < files.size() && state->nextToRead != state->nextToConsume
+                       && state->bytesInFlight + files[state->nextToRead].size > maxBytesInFlight)
+                    state.wait(wakeup);
+                if (state->quit || state->nextToRead >= files.size())
+                    return;
+                first = end = state->nextToRead;
+                do
+                    state->bytesInFlight += files[end++].size;
+                while (end < files.size() && end - first < maxBatchSize
+                       && state->bytesInFlight + files[end].size <= maxBytesInFlight);
+                state->nextToRead = end;
+            }
+
+            auto n = end - first;
+
+            try {
+                batch->clear();
+                for (size_t i = first; i < end; ++i)
+                    batch->openBeneath(rootFd.get(), files[i].path.rel_c_str(), O_RDONLY | O_CLOEXEC);
+                batch->submit();
+
+                std::vector<AutoCloseFD> fds(n);
+                for (size_t i = 0; i < n; ++i)
+                    if (batch->result(i) >= 0)
+                        fds[i] = batch->result(i);
+
+                /* Read one byte more than expected to detect files that
+                   grew since we stat'ed them. */
+                batch->clear();
+                std::vector<size_t> reads(n, SIZE_MAX);
+                for (size_t i = 0; i < n; ++i)
+                    if (fds[i]) {
+                        auto & file = files[first + i];
+                        file.contents.emplace(file.size + 1, '\0');
+                        reads[i] = batch->read(fds[i].get(), file.contents->data(), file.size + 1, 0);
+                    }
+                batch->submit();
+
+                for (size_t i = 0; i < n; ++i) {
+                    auto & file = files[first + i];
+                    if (reads[i] != SIZE_MAX && (uint64_t) batch->result(reads[i]) == file.size)
+                        file.contents->resize(file.size);
+                    else
+                        file.contents.reset();
+                }
+
+                batch->clear();
+                for (auto & fd : fds)
+                    if (fd)
+                        batch->close(fd.release());
+                batch->submit();
+            } catch (...) {
+                /* Fall back to the accessor for the whole batch. */
+                for (size_t i = first; i < end; ++i)
+                    files[i].contents.reset();
+            }
+
+            for (size_t i = first; i < end; ++i) {
+                auto & file = files[i];
+                if (!file.contents)
+                    try {
+                        file.contents = accessor.readFile(file.path);
+                    } catch (...) {
+                        file.exception = std::current_exception();
+                    }
+
+                {
+                    auto state(state_.lock());
+                    file.done = true;
+                }
+                wakeup.notify_all();
+            }
+        }
+    }
+#endif
+
+    /**
+     * Return the contents of `path` if it is the next file to be
+     * consumed.
+     */
+    std::optional<std::string> take(const CanonPath & path)
+    {
+        auto state(state_.lock());
+        auto n = state->nextToConsume;
+        if (n >= files.size() || files[n].path != path)
+            return std::nullopt;
+        auto & file = files[n];
+        while (!file.done)
+            state.wait(wakeup);
+        state->nextToConsume++;
+        state->bytesInFlight -= file.size;
+        wakeup.notify_all();
+        if (file.exception)
+            std::rethrow_exception(file.exception);
+        return std::move(file.contents);
+    }
+};
+
 void SourceAccessor::dumpPath(const CanonPath & path, Sink & sink, PathFilter & filter)
 {
+    /* If we're on a case-insensitive system like macOS, undo the case
+       hack applied by restorePath(). Returns a map from the original
+       names to the names on disk. */
+    auto listDirectory = [&](const CanonPath & path) {
+        StringMap unhacked;
+        for (auto & i : readDirectory(path))
+            if (archiveSettings.useCaseHack) {
+                std::string name(i.first);
+                size_t pos = i.first.find(caseHackSuffix);
+                if (pos != std::string::npos) {
+                    debug("removing case hack suffix from '%s'", path / i.first);
+                    name.erase(pos);
+                }
+                if (!unhacked.emplace(name, i.first).second)
+                    throw Error(
+                        "file name collision between '%s' and '%s'", (path / unhacked[name]), (path / i.first));
+            } else
+                unhacked.emplace(i.first, i.first);
+        return unhacked;
+    };
+
+    /* For directories, first walk the tree to find the small regular
+       files that we can read in parallel. The filter is called only
+       once per path, since it may be expensive (e.g. a Nix function). */
+    std::optional<FilePrefetcher> prefetcher;
+    std::unordered_map<Path, bool> decisions;
+
+    if (lstat(path).type == tDirectory) {
+        std::vector<FilePrefetcher::File> files;
+
+        [&](this const auto & walk, const CanonPath & path) -> void {
+            checkInterrupt();
+            for (auto & i : listDirectory(path)) {
+                auto child = path / i.first;
+                auto accept = filter(child.abs());
+                decisions.emplace(child.abs(), accept);
+                if (!accept)
+                    continue;
+                auto onDisk = path / i.second;
+                auto st = lstat(onDisk);
+                if (st.type == tDirectory)
+                    walk(onDisk);
+                else if (st.type == tRegular && st.fileSize && *st.fileSize <= FilePrefetcher::maxFileSize)
+                    files.push_back({.path = onDisk, .size = *st.fileSize});
+            }
+        }(path);
+
+        if (files.size() >= FilePrefetcher::minFiles)
+            prefetcher.emplace(*this, std::move(files));
+    }
+
+    auto filter2 = [&](const CanonPath & path) {
+        auto i = decisions.find(path.abs());
+        return i != decisions.end() ? i->second : filter(path.abs());
+    };
+
     auto dumpContents = [&](const CanonPath & path) {
         sink << "contents";
+        if (auto contents = prefetcher ? prefetcher->take(path) : std::nullopt) {
+            sink << contents->size();
+            sink(*contents);
+            writePadding(contents->size(), sink);
+            return;
+        }
         std::optional<uint64_t> size;
         readFile(path, sink, [&](uint64_t _size) {
             size = _size;
@@ -66,25 +362,8 @@ void SourceAccessor::dumpPath(const CanonPath & path, Sink & sink, PathFilter &
         else if (st.type == tDirectory) {
             sink << "type" << "directory";
 
-            /* If we're on a case-insensitive system like macOS, undo
-               the case hack applied by restorePath(). */
-            StringMap unhacked;
-            for (auto & i : this_.readDirectory(path))
-                if (archiveSettings.useCaseHack) {
-                    std::string name(i.first);
-                    size_t pos = i.first.find(caseHackSuffix);
-                    if (pos != std::string::npos) {
-                        debug("removing case hack suffix from '%s'", path / i.first);
-                        name.erase(pos);
-                    }
-                    if (!unhacked.emplace(name, i.first).second)
-                        throw Error(
-                            "file name collision between '%s' and '%s'", (path / unhacked[name]), (path / i.first));
-                } else
-                    unhacked.emplace(i.first, i.first);
-
-            for (auto & i : unhacked)
-                if (filter((path / i.first).abs())) {
+            for (auto & i : listDirectory(path))
+                if (filter2(path / i.first)) {
                     sink << "entry" << "(" << "name" << i.first << "node";
                     dump(path / i.second);
                     sink << ")";
@@ -135,18 +414,7 @@ static void parseContents(CreateRegularFileSink & sink, Source & source)
         return;
     }
 
-    uint64_t left = size;
-    std::array<char, 65536> buf;
-
-    while (left) {
-        checkInterrupt();
-        auto n = buf.size();
-        if ((uint64_t) n > left)
-            n = left;
-        source(buf.data(), n);
-        sink({buf.data(), n});
-        left -= n;
-    }
+    source.readInto(sink, size);
 
     readPadding(size, source);
 }
@@ -281,7 +549,9 @@ void restorePath(const std::filesystem::path & path, Source & source, bool start
 {
     RestoreSink sink{startFsync};
     sink.dstPath = path;
+    sink.enableParallelWrites();
     parseDump(sink, source);
+    sink.finish();
 }
 
 void copyNAR(Source & source, Sink & sink)
@@ -0,0 +1,84 @@
+#include "nix/util/background-sink.hh"
+
+namespace nix {
+
+BackgroundSink::BackgroundSink(Sink & nextSink, size_t maxBuffered)
+    : nextSink(nextSink)
+    , maxBuffered(maxBuffered)
+{
+    thread = std::thread([this]() { run(); });
+}
+
+BackgroundSink::~BackgroundSink()
+{
+    stop();
+}
+
+void BackgroundSink::run()
+{
+    std::string data;
+
+    while (true) {
+        {
+            auto state_(state.lock());
+            while (state_->pending.empty() && !state_->finished)
+                state_.wait(wakeup);
+            if (state_->pending.empty())
+                return;
+            std::swap(data, state_->pending);
+        }
+
+        spaceAvailable.notify_all();
+
+        try {
+            nextSink(data);
+        } catch (...) {
+            auto state_(state.lock());
+            state_->error = std::current_exception();
+            state_->pending.clear();
+            spaceAvailable.notify_all();
+            return;
+        }
+
+        data.clear();
+    }
+}
+
+void BackgroundSink::operator()(std::string_view data)
+{
+    auto state_(state.lock());
+
+    while (!state_->error && !state_->pending.empty() && state_->pending.size() + data.size() > maxBuffered)
+        state_.wait(spaceAvailable);
+
+    if (state_->error)
+        std::rethrow_exception(state_->error);
+
+    state_->pending.append(data);
+
+    wakeup.notify_one();
+}
+
+void BackgroundSink::stop()
+{
+    if (!thread.joinable())
+        return;
+
+    {
+        auto state_(state.lock());
+        state_->finished = true;
+    }
+    wakeup.notify_one();
+
+    thread.join();
+}
+
+void BackgroundSink::finish()
+{
+    stop();
+
+    if (auto error = state.lock()->error)
+        std::rethrow_exception(error);
+}
+
+} // namespace nix
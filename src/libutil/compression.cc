@@ -4,14 +4,21 @@
 #include "nix/util/finally.hh"
 #include "nix/util/logging.hh"
 
+#include "util-config-private.hh"
+
 #include <archive.h>
 #include <archive_entry.h>
 #include <cstdio>
 #include <cstring>
+#include <mutex>
 
 #include <brotli/decode.h>
 #include <brotli/encode.h>
 
+#if HAVE_LIBLZMA
+#  include <lzma.h>
+#endif
+
 namespace nix {
 
 static const int COMPRESSION_LEVEL_DEFAULT = -1;
@@ -240,6 +247,69 @@ struct BrotliDecompressionSink : ChunkedCompressionSink
     }
 };
 
+#if HAVE_LIBLZMA
+/**
+ * libarchive decodes xz on a single thread. liblzma can decode the
+ * blocks of a multi-block file (as written by `xz -T`, or by
+ * `ArchiveCompressionSink` when `parallel` is set) on all cores.
+ * Single-block files are decoded on one thread as before.
+ */
+struct XzDecompressionSink : ChunkedCompressionSink
+{
+    Sink & nextSink;
+    lzma_stream strm = LZMA_STREAM_INIT;
+    bool finished = false;
+
+    XzDecompressionSink(Sink & nextSink)
+        : nextSink(nextSink)
+    {
+        lzma_mt mt{};
+        mt.flags = LZMA_CONCATENATED;
+        mt.threads = std::max(1u, lzma_cputhreads());
+        /* Fall back to one thread rather than use more than a quarter
+           of the RAM, but never fail because of memory use. */
+        mt.memlimit_threading = std::max<uint64_t>(lzma_physmem() / 4, 64 * 1024 * 1024);
+        mt.memlimit_stop = UINT64_MAX;
+        if (lzma_stream_decoder_mt(&strm, &mt) != LZMA_OK)
+            throw CompressionError("unable to initialise xz decoder");
+    }
+
+    ~XzDecompressionSink()
+    {
+        lzma_end(&strm);
+    }
+
+    void finish() override
+    {
+        flush();
+        writeInternal({});
+    }
+
+    void writeInternal(std::string_view data) override
+    {
+        strm.next_in = (const uint8_t *) data.data();
+        strm.avail_in = data.size();
+        auto action = data.data() ? LZMA_RUN : LZMA_FINISH;
+
+        while (!finished && (action == LZMA_FINISH || strm.avail_in)) {
+            checkInterrupt();
+
+            strm.next_out = outbuf;
+            strm.avail_out = sizeof(outbuf);
+
+            auto ret = lzma_code(&strm, action);
+            if (ret == LZMA_STREAM_END)
+                finished = true;
+            else if (ret != LZMA_OK)
+                throw CompressionError("error %d while decompressing xz file", ret);
+
+            if (strm.avail_out < sizeof(outbuf))
+                nextSink({(char *) outbuf, sizeof(outbuf) - strm.avail_out});
+        }
+    }
+};
+#endif
+
 std::string decompress(const std::string & method, std::string_view in)
 {
     StringSink ssink;
@@ -255,6 +325,10 @@ std::unique_ptr<FinishSink> makeDecompressionSink(const std::string & method, Si
         return std::make_unique<NoneSink>(nextSink);
     else if (method == "br")
         return std::make_unique<BrotliDecompressionSink>(nextSink);
+#if HAVE_LIBLZMA
+    else if (method == "xz")
+        return std::make_unique<XzDecompressionSink>(nextSink);
+#endif
     else
         return sourceToSink([method, &nextSink](Source & source) {
             auto decompressionSource = std::make_unique<ArchiveDecompressionSource>(source, method);
@@ -367,6 +441,190 @@ ref<CompressionSink> makeCompressionSink(CompressionAlgo method, Sink & nextSink
     unreachable();
 }
 
+#if HAVE_LIBLZMA
+struct XzCompressionSink : ChunkedCompressionSink
+{
+    Sink & nextSink;
+    lzma_stream strm = LZMA_STREAM_INIT;
+    bool finished = false;
+
+    XzCompressionSink(Sink & nextSink, uint64_t blockSize, bool parallel, int level)
+        : nextSink(nextSink)
+    {
+        /* The multi-threaded encoder is the one that supports a block
+           size, even on one thread. */
+        lzma_mt mt{};
+        mt.threads = parallel ? std::max(1u, lzma_cputhreads()) : 1;
+        mt.block_size = blockSize;
+        mt.preset = level == COMPRESSION_LEVEL_DEFAULT ? LZMA_PRESET_DEFAULT : level;
+        mt.check = LZMA_CHECK_CRC64;
+        if (lzma_stream_encoder_mt(&strm, &mt) != LZMA_OK)
+            throw CompressionError("unable to initialise xz encoder");
+    }
+
+    ~XzCompressionSink()
+    {
+        lzma_end(&strm);
+    }
+
+    void finish() override
+    {
+        flush();
+        writeInternal({});
+    }
+
+    void writeInternal(std::string_view data) override
+    {
+        strm.next_in = (const uint8_t *) data.data();
+        strm.avail_in = data.size();
+        auto action = data.data() ? LZMA_RUN : LZMA_FINISH;
+
+        while (!finished && (action == LZMA_FINISH || strm.avail_in)) {
+            checkInterrupt();
+
+            strm.next_out = outbuf;
+            strm.avail_out = sizeof(outbuf);
+
+            auto ret = lzma_code(&strm, action);
+            if (ret == LZMA_STREAM_END)
+                finished = true;
+            else if (ret != LZMA_OK)
+                throw CompressionError("error %d while compressing xz file", ret);
+
+            if (strm.avail_out < sizeof(outbuf))
+                nextSink({(char *) outbuf, sizeof(outbuf) - strm.avail_out});
+        }
+    }
+};
+
+struct SeekableXzReader
+{
+    ReadRange readCompressed;
+    lzma_index * index = nullptr;
+    lzma_check check;
+
+    /**
+     * The last block that was decompressed, since reads tend to be
+     * close to each other.
+     */
+    std::optional<std::pair<uint64_t, std::string>> lastBlock;
+
+    std::mutex mutex;
+
+    ~SeekableXzReader()
+    {
+        lzma_index_end(index, nullptr);
+    }
+
+    std::string decompressBlock(const lzma_index_iter & iter)
+    {
+        auto in = readCompressed(iter.block.compressed_file_offset, iter.block.total_size);
+        if (in.empty())
+            throw CompressionError("xz block is empty");
+
+        lzma_filter filters[LZMA_FILTERS_MAX + 1];
+        lzma_block block{};
+        block.version = 1;
+        block.check = check;
+        block.filters = filters;
+        block.header_size = lzma_block_header_size_decode((uint8_t) in[0]);
+        if (block.header_size > in.size() || lzma_block_header_decode(&block, nullptr, (const uint8_t *) in.data()) != LZMA_OK)
+            throw CompressionError("invalid xz block header");
+        Finally freeFilters([&]() { lzma_filters_free(filters, nullptr); });
+
+        std::string out(iter.block.uncompressed_size, 0);
+        size_t inPos = block.header_size, outPos = 0;
+        if (lzma_block_buffer_decode(
+                &block,
+                nullptr,
+                (const uint8_t *) in.data(),
+                &inPos,
+                in.size(),
+                (uint8_t *) out.data(),
+                &outPos,
+                out.size())
+                != LZMA_OK
+            || outPos != out.size())
+            throw CompressionError("error while decompressing xz block");
+
+        return out;
+    }
+
+    std::string read(uint64_t offset, uint64_t length)
+    {
+        std::lock_guard lock(mutex);
+
+        std::string res;
+        res.reserve(length);
+
+        while (res.size() < length) {
+            lzma_index_iter iter;
+            lzma_index_iter_init(&iter, index);
+            if (lzma_index_iter_locate(&iter, offset))
+                throw CompressionError("read beyond the end of xz file");
+
+            auto blockStart = iter.block.uncompressed_file_offset;
+            if (!lastBlock || lastBlock->first != blockStart)
+                lastBlock = {blockStart, decompressBlock(iter)};
+
+            auto n = std::min<uint64_t>(length - res.size(), iter.block.uncompressed_size - (offset - blockStart));
+            res.append(lastBlock->second, offset - blockStart, n);
+            offset += n;
+        }
+
+        return res;
+    }
+};
+#endif
+
+ref<CompressionSink> makeSeekableXzCompressionSink(Sink & nextSink, uint64_t blockSize, const bool parallel, int level)
+{
+#if HAVE_LIBLZMA
+    return make_ref<XzCompressionSink>(nextSink, blockSize, parallel, level);
+#else
+    throw Error("seekable xz compression is not supported by this version of Nix");
+#endif
+}
+
+std::optional<ReadRange> makeSeekableXzReader(ReadRange readCompressed, uint64_t compressedSize)
+{
+#if HAVE_LIBLZMA
+    if (compressedSize < 2 * LZMA_STREAM_HEADER_SIZE)
+        return std::nullopt;
+
+    auto footer = readCompressed(compressedSize - LZMA_STREAM_HEADER_SIZE, LZMA_STREAM_HEADER_SIZE);
+    lzma_stream_flags flags;
+    if (lzma_stream_footer_decode(&flags, (const uint8_t *) footer.data()) != LZMA_OK)
+        return std::nullopt;
+
+    if (flags.backward_size > compressedSize - 2 * LZMA_STREAM_HEADER_SIZE)
+        return std::nullopt;
+
+    auto indexData = readCompressed(compressedSize - LZMA_STREAM_HEADER_SIZE - flags.backward_size, flags.backward_size);
+
+    auto reader = std::make_shared<SeekableXzReader>();
+    reader->readCompressed = std::move(readCompressed);
+    reader->check = flags.check;
+
+    uint64_t memlimit = UINT64_MAX;
+    size_t pos = 0;
+    if (lzma_index_buffer_decode(
+            &reader->index, &memlimit, nullptr, (const uint8_t *) indexData.data(), &pos, indexData.size())
+        != LZMA_OK)
+        return std::nullopt;
+
+    /* The file offsets in the index are only right if this is the
+       only stream in the file. */
+    if (lzma_index_stream_flags(reader->index, &flags) != LZMA_OK || lzma_index_file_size(reader->index) != compressedSize
+        || lzma_index_block_count(reader->index) < 2)
+        return std::nullopt;
+
+    return [reader](uint64_t offset, uint64_t length) { return reader->read(offset, length); };
+#else
+    return std::nullopt;
+#endif
+}
+
 std::string compress(const std::string & method, std::string_view in, const bool parallel, int level)
 {
     StringSink ssink;
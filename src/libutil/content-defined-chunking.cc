@@ -0,0 +1,84 @@
+#include "nix/util/content-defined-chunking.hh"
+#include "nix/util/error.hh"
+
+#include <array>
+#include <bit>
+
+namespace nix {
+
+/**
+ * The random values that the gear hash maps each byte to. These must
+ * never change, since that would change the chunk boundaries of
+ * everything chunked before.
+ */
+static constexpr std::array<uint64_t, 256> gearTable = [] {
+    std::array<uint64_t, 256> table;
+    /* splitmix64 */
+    uint64_t state = 0x6e69782d63646321ULL;
+    for (auto & entry : table) {
+        uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        entry = z ^ (z >> 31);
+    }
+    return table;
+}();
+
+ChunkingSink::ChunkingSink(ChunkCallback onChunk, size_t minSize, size_t avgSize, size_t maxSize)
+    : onChunk(std::move(onChunk))
+    , minSize(minSize)
+    , avgSize(avgSize)
+    , maxSize(maxSize)
+{
+    if (!std::has_single_bit(avgSize) || avgSize < 64 || minSize > avgSize || avgSize > maxSize)
+        throw Error("invalid chunk sizes %d/%d/%d", minSize, avgSize, maxSize);
+
+    /* The gear hash shifts left on every byte, so its high bits depend
+       on the most bytes and are the ones to test. */
+    auto bits = std::countr_zero(avgSize);
+    maskSmall = ~0ULL << (64 - std::min(bits + 2, 63));
+    maskLarge = ~0ULL << (64 - (bits - 2));
+}
+
+void ChunkingSink::operator()(std::string_view data)
+{
+    while (!data.empty()) {
+        size_t n = 0;
+        bool cut = false;
+
+        while (n < data.size()) {
+            auto size = chunk.size() + n + 1;
+            auto c = (unsigned char) data[n++];
+            /* Like FastCDC, don't bother hashing the bytes that are
+               too early for a cut. */
+            if (size <= minSize)
+                continue;
+            fingerprint = (fingerprint << 1) + gearTable[c];
+            if (size >= maxSize || !(fingerprint & (size < avgSize ? maskSmall : maskLarge))) {
+                cut = true;
+                break;
+            }
+        }
+
+        chunk.append(data.substr(0, n));
+        data.remove_prefix(n);
+
+        if (cut)
+            emit();
+    }
+}
+
+void ChunkingSink::finish()
+{
+    if (!chunk.empty())
+        emit();
+}
+
+void ChunkingSink::emit()
+{
+    onChunk(chunk);
+    chunk.clear();
+    fingerprint = 0;
+}
+
+} // namespace nix
@@ -8,6 +8,7 @@
 #include "nix/util/processes.hh"
 #include "nix/util/signals.hh"
 #include "nix/util/environment-variables.hh"
+#include "nix/util/sync.hh"
 #include <math.h>
 
 #ifdef __APPLE__
@@ -27,6 +28,25 @@
 
 namespace nix {
 
+static Sync<std::map<std::string, std::chrono::microseconds>> startupTimes;
+
+StartupPhaseTimer::StartupPhaseTimer(std::string_view phase)
+    : phase(phase)
+    , start(std::chrono::steady_clock::now())
+{
+}
+
+StartupPhaseTimer::~StartupPhaseTimer()
+{
+    auto time = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+    (*startupTimes.lock())[phase] += time;
+}
+
+std::map<std::string, std::chrono::microseconds> getStartupTimes()
+{
+    return *startupTimes.lock();
+}
+
 unsigned int getMaxCPU()
 {
 #ifdef __linux__
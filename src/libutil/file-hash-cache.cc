@@ -0,0 +1,172 @@
+#include "nix/util/file-hash-cache.hh"
+#include "nix/util/archive.hh"
+#include "nix/util/config-global.hh"
+#include "nix/util/git.hh"
+#include "nix/util/logging.hh"
+#include "nix/util/signals.hh"
+#include "nix/util/source-path.hh"
+
+#include <sys/stat.h>
+
+namespace nix {
+
+FileHashCacheSettings fileHashCacheSettings;
+
+static GlobalConfig::Register rFileHashCacheSettings(&fileHashCacheSettings);
+
+std::function<ref<FileHashCache>()> openFileHashCache;
+
+FileHashCache * getFileHashCache()
+{
+    if (!fileHashCacheSettings.fileHashCache || !openFileHashCache)
+        return nullptr;
+    static auto cache = openFileHashCache();
+    return &*cache;
+}
+
+#ifndef _WIN32
+
+/**
+ * Append the metadata of `path` that is expected to change whenever
+ * its contents change. Returns false if it was changed so recently
+ * that this can't be relied on.
+ */
+static bool describeStat(Sink & sink, const struct stat & st)
+{
+    /* Like Git's "racy" check: a file that was changed in the current
+       second might change again without a visible change in its
+       timestamps. */
+    auto now = time(nullptr);
+    if (st.st_mtime >= now - 1 || st.st_ctime >= now - 1)
+        return false;
+
+    sink << (uint64_t) st.st_dev << (uint64_t) st.st_ino << (uint64_t) st.st_mode << (uint64_t) st.st_size
+         << (uint64_t) st.st_mtime << (uint64_t) st.st_ctime;
+    return true;
+}
+
+/**
+ * Compute a key for the file system object `path` describing the
+ * metadata of every object below it that `filter` accepts, or
+ * `std::nullopt` if it can't be described reliably.
+ */
+static std::optional<std::string> describeTree(
+    std::string_view kind, const SourcePath & path, const std::filesystem::path & physPath, PathFilter & filter)
+{
+    HashSink sink(HashAlgorithm::SHA256);
+    sink << kind;
+
+    auto walk = [&](this auto & self, const CanonPath & rel) -> bool {
+        checkInterrupt();
+
+        auto st = nix::lstat((physPath / rel.rel()).string());
+        sink << rel.abs();
+        if (!describeStat(sink, st))
+            return false;
+
+        if (S_ISDIR(st.st_mode)) {
+            for (auto & [name, _] : path.accessor->readDirectory(path.path / rel)) {
+                /* The names in the NAR differ from the names on disk,
+                   and so may the filter's decisions. */
+                if (name.find(caseHackSuffix) != std::string::npos)
+                    return false;
+                auto child = rel / name;
+                if (!filter((path.path / child).abs()))
+                    continue;
+                if (!self(child))
+                    return false;
+            }
+        }
+
+        return true;
+    };
+
+    if (!walk(CanonPath::root))
+        return std::nullopt;
+
+    return sink.finish().hash.to_string(HashFormat::Nix32, false);
+}
+
+#endif
+
+std::optional<std::string>
+fileHashCacheKey(const SourcePath & path, FileIngestionMethod method, HashAlgorithm ha, PathFilter & filter)
+{
+#ifndef _WIN32
+    assert(method != FileIngestionMethod::Git);
+    auto physPath = path.getPhysicalPath();
+    if (!physPath)
+        return std::nullopt;
+    return describeTree(
+        fmt("%s:%s", renderFileIngestionMethod(method), printHashAlgo(ha)),
+        path,
+        *physPath,
+        method == FileIngestionMethod::Flat ? defaultPathFilter : filter);
+#else
+    return std::nullopt;
+#endif
+}
+
+std::pair<Hash, std::optional<uint64_t>>
+hashPathCached(const SourcePath & path, FileIngestionMethod method, HashAlgorithm ha, PathFilter & filter)
+{
+#ifndef _WIN32
+    auto cache = getFileHashCache();
+    auto physPath = cache ? path.getPhysicalPath() : std::nullopt;
+
+    if (!physPath)
+        return hashPath(path, method, ha, filter);
+
+    if (method == FileIngestionMethod::Git) {
+        /* Git hashes are Merkle trees, so only the blobs need to be
+           cached; the trees above them are cheap to recompute. */
+        std::function<git::DumpHook> hook;
+        hook = [&](const SourcePath & path) -> git::TreeEntry {
+            std::optional<std::string> key;
+            if (auto physPath = path.getPhysicalPath()) {
+                auto st = nix::lstat(physPath->string());
+                if (S_ISREG(st.st_mode)) {
+                    key = describeTree(fmt("git-blob:%s", printHashAlgo(ha)), path, *physPath, defaultPathFilter);
+                    if (key)
+                        if (auto res = cache->lookup(*key))
+                            return {
+                                .mode = st.st_mode & S_IXUSR ? git::Mode::Executable : git::Mode::Regular,
+                                .hash = res->hash,
+                            };
+                }
+            }
+
+            HashSink hashSink(ha);
+            auto mode = git::dump(path, hashSink, hook, filter);
+            auto res = hashSink.finish();
+            if (key)
+                cache->upsert(*key, res);
+            return {
+                .mode = mode,
+                .hash = res.hash,
+            };
+        };
+
+        return {hook(path).hash, std::nullopt};
+    }
+
+    auto key = fileHashCacheKey(path, method, ha, filter);
+
+    if (key)
+        if (auto res = cache->lookup(*key)) {
+            debug("file hash cache hit for '%s'", path);
+            return {res->hash, res->numBytesDigested};
+        }
+
+    auto res = hashPath(path, (FileSerialisationMethod) method, ha, filter);
+
+    if (key)
+        cache->upsert(*key, res);
+
+    return {res.hash, res.numBytesDigested};
+#else
+    return hashPath(path, method, ha, filter);
+#endif
+}
+
+} // namespace nix
@@ -271,6 +271,29 @@ std::string readFile(const std::filesystem::path & path)
 
 void readFile(const Path & path, Sink & sink, bool memory_map)
 {
+    AutoCloseFD fd = toDescriptor(open(
+        path.c_str(),
+        O_RDONLY
+#ifdef O_CLOEXEC
+            | O_CLOEXEC
+#endif
+        ));
+    if (!fd)
+        throw SysError("opening file '%s'", path);
+
+    /* Let the sink copy the file without passing it through
+       userspace if it can, e.g. when it's a socket. */
+    struct stat st;
+    if (fstat(fromDescriptorReadOnly(fd.get()), &st) == 0 && S_ISREG(st.st_mode)) {
+        auto n = sink.writeFromFd(fd.get(), st.st_size);
+        if (n == (uint64_t) st.st_size)
+            return;
+        if (n) {
+            drainFD(fd.get(), sink);
+            return;
+        }
+    }
+
     // Memory-map the file for faster processing where possible.
     if (memory_map) {
         try {
@@ -285,15 +308,6 @@ void readFile(const Path & path, Sink & sink, bool memory_map)
     }
 
     // Stream the file instead if memory-mapping fails or is disabled.
-    AutoCloseFD fd = toDescriptor(open(
-        path.c_str(),
-        O_RDONLY
-#ifdef O_CLOEXEC
-            | O_CLOEXEC
-#endif
-        ));
-    if (!fd)
-        throw SysError("opening file '%s'", path);
     drainFD(fd.get(), sink);
 }
 
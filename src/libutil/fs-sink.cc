@@ -3,6 +3,11 @@
 #include "nix/util/error.hh"
 #include "nix/util/config-global.hh"
 #include "nix/util/fs-sink.hh"
+#include "nix/util/thread-pool.hh"
+
+#ifdef __linux__
+#  include "nix/util/io-uring.hh"
+#endif
 
 #ifdef _WIN32
 #  include <fileapi.h>
@@ -55,7 +60,14 @@ void copyRecursive(SourceAccessor & accessor, const CanonPath & from, FileSystem
 struct RestoreSinkSettings : Config
 {
     Setting<bool> preallocateContents{
-        this, false, "preallocate-contents", "Whether to preallocate files when writing objects with known size."};
+        this,
+#ifdef __linux__
+        true,
+#else
+        false,
+#endif
+        "preallocate-contents",
+        "Whether to preallocate files when writing objects with known size."};
 };
 
 static RestoreSinkSettings restoreSinkSettings;
@@ -70,6 +82,210 @@ static std::filesystem::path append(const std::filesystem::path & src, const Can
     return dst;
 }
 
+struct RestoreRegularFile : CreateRegularFileSink
+{
+    AutoCloseFD fd;
+    bool startFsync = false;
+
+    ~RestoreRegularFile()
+    {
+        /* Initiate an fsync operation without waiting for the
+           result. The real fsync should be run before registering a
+           store path, but this is a performance optimization to allow
+           the disk write to start early. */
+        if (fd && startFsync)
+            fd.startFsync();
+    }
+
+    void operator()(std::string_view data) override;
+    void isExecutable() override;
+    void preallocateContents(uint64_t size) override;
+};
+
+#ifndef _WIN32
+/**
+ * Files up to this size are written by the workers of a
+ * `ParallelWriter`.
+ */
+static constexpr uint64_t maxParallelFileSize = 1 << 20;
+
+struct RestoreSink::ParallelWriter
+{
+    static constexpr uint64_t maxBytesInFlight = 64 << 20;
+
+    ThreadPool pool{std::clamp<size_t>(std::thread::hardware_concurrency(), 2, 8)};
+
+    /**
+     * The directory of the root sink.
+     */
+    Descriptor rootFd = INVALID_DESCRIPTOR;
+
+    /**
+     * The amount of file contents that has been queued but not
+     * written yet. Files that would exceed `maxBytesInFlight` are
+     * written synchronously instead.
+     */
+    std::atomic<uint64_t> bytesInFlight{0};
+
+#  ifdef __linux__
+    static constexpr size_t maxBatchSize = 64;
+    static constexpr uint64_t maxBatchBytes = 16 << 20;
+
+    /**
+     * If `use-io-uring` is enabled, small files are not written by
+     * the thread pool but collected in `pending` and written in
+     * batches through this io_uring. This is not done if an fsync
+     * must be started for every file.
+     */
+    std::optional<IoUringBatch> batch;
+
+    struct PendingFile
+    {
+        CanonPath path;
+        bool executable;
+        std::string contents;
+    };
+
+    std::vector<PendingFile> pending;
+    uint64_t pendingBytes = 0;
+
+    /**
+     * Create and write the files in `pending`.
+     */
+    void flush();
+#  endif
+};
+
+/**
+ * Buffers the contents of a small file so that a worker can write
+ * it. Large files are written directly.
+ */
+struct BufferedRegularFile : CreateRegularFileSink
+{
+    std::function<RestoreRegularFile &()> openDirect;
+    RestoreRegularFile * direct = nullptr;
+    bool executable = false;
+    std::string contents;
+
+    void operator()(std::string_view data) override
+    {
+        if (direct)
+            (*direct)(data);
+        else
+            contents.append(data);
+    }
+
+    void isExecutable() override
+    {
+        executable = true;
+    }
+
+    void preallocateContents(uint64_t size) override
+    {
+        if (size > maxParallelFileSize) {
+            direct = &openDirect();
+            if (executable)
+                direct->isExecutable();
+            direct->preallocateContents(size);
+        } else
+            contents.reserve(size);
+    }
+};
+
+static void makeExecutable(Descriptor fd)
+{
+    struct stat st;
+    if (fstat(fd, &st) == -1)
+        throw SysError("fstat");
+    if (fchmod(fd, st.st_mode | (S_IXUSR | S_IXGRP | S_IXOTH)) == -1)
+        throw SysError("fchmod");
+}
+
+#  ifdef __linux__
+void RestoreSink::ParallelWriter::flush()
+{
+    if (pending.empty())
+        return;
+
+    Finally clear([&]() {
+        pending.clear();
+        pendingBytes = 0;
+    });
+
+    batch->clear();
+    for (auto & file : pending)
+        batch->openBeneath(rootFd, file.path.rel_c_str(), O_CREAT | O_EXCL | O_WRONLY | O_CLOEXEC, 0666);
+    batch->submit();
+
+    std::vector<AutoCloseFD> fds;
+    for (size_t i = 0; i < pending.size(); ++i)
+        fds.emplace_back(batch->result(i) >= 0 ? batch->result(i) : INVALID_DESCRIPTOR);
+    for (size_t i = 0; i < pending.size(); ++i)
+        if (auto res = batch->result(i); res < 0)
+            throw SysError(-res, "creating file '%1%'", pending[i].path);
+
+    for (size_t i = 0; i < pending.size(); ++i)
+        if (pending[i].executable)
+            makeExecutable(fds[i].get());
+
+    batch->clear();
+    std::vector<size_t> writes(pending.size(), SIZE_MAX);
+    for (size_t i = 0; i < pending.size(); ++i)
+        if (auto & contents = pending[i].contents; !contents.empty())
+            writes[i] = batch->write(fds[i].get(), contents.data(), contents.size(), 0);
+    batch->submit();
+
+    for (size_t i = 0; i < pending.size(); ++i) {
+        if (writes[i] == SIZE_MAX)
+            continue;
+        auto res = batch->result(writes[i]);
+        if (res < 0)
+            throw SysError(-res, "writing to file '%1%'", pending[i].path);
+        /* Short writes are unlikely for regular files, but handle
+           them anyway. */
+        if ((size_t) res < pending[i].contents.size())
+            writeFull(fds[i].get(), std::string_view(pending[i].contents).substr(res), false);
+    }
+
+    batch->clear();
+    for (auto & fd : fds)
+        batch->close(fd.release());
+    batch->submit();
+
+    for (size_t i = 0; i < pending.size(); ++i)
+        if (auto res = batch->result(i); res < 0)
+            throw SysError(-res, "closing file '%1%'", pending[i].path);
+}
+#  endif
+
+void RestoreSink::enableParallelWrites()
+{
+    writer = std::make_shared<ParallelWriter>();
+#  ifdef __linux__
+    if (useIoUring())
+        try {
+            writer->batch.emplace(ParallelWriter::maxBatchSize);
+        } catch (Error & e) {
+            debug("not using io_uring: %s", e.msg());
+        }
+#  endif
+}
+
+void RestoreSink::finish()
+{
+    if (writer) {
+#  ifdef __linux__
+        writer->flush();
+#  endif
+        writer->pool.process();
+    }
+}
+#else
+void RestoreSink::enableParallelWrites() {}
+
+void RestoreSink::finish() {}
+#endif
+
 #ifndef _WIN32
 void RestoreSink::createDirectory(const CanonPath & path, DirectoryCreatedCallback callback)
 {
@@ -84,6 +300,8 @@ void RestoreSink::createDirectory(const CanonPath & path, DirectoryCreatedCallba
 
     RestoreSink dirSink{startFsync};
     dirSink.dstPath = append(dstPath, path);
+    dirSink.writer = writer;
+    dirSink.prefix = prefix / path;
     dirSink.dirFd =
         unix::openFileEnsureBeneathNoSymlinks(dirFd.get(), path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
 
@@ -123,35 +341,86 @@ void RestoreSink::createDirectory(const CanonPath & path)
         dirFd = open(p.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
         if (!dirFd)
             throw SysError("creating directory '%1%'", p.string());
+        if (writer)
+            writer->rootFd = dirFd.get();
     }
 #endif
 };
 
-struct RestoreRegularFile : CreateRegularFileSink
+void RestoreSink::createRegularFile(const CanonPath & path, std::function<void(CreateRegularFileSink &)> func)
 {
-    AutoCloseFD fd;
-    bool startFsync = false;
+#ifndef _WIN32
+    if (writer && dirFd) {
+        std::optional<RestoreRegularFile> direct;
+        BufferedRegularFile brf;
+        brf.openDirect = [&]() -> RestoreRegularFile & {
+            openRegularFile(path, direct.emplace());
+            return *direct;
+        };
+        func(brf);
+        if (direct)
+            return;
+
+        auto size = brf.contents.size();
+
+#  ifdef __linux__
+        if (writer->batch && !startFsync) {
+            writer->pendingBytes += size;
+            writer->pending.push_back({prefix / path, brf.executable, std::move(brf.contents)});
+            if (writer->pending.size() >= ParallelWriter::maxBatchSize
+                || writer->pendingBytes >= ParallelWriter::maxBatchBytes)
+                writer->flush();
+            return;
+        }
+#  endif
 
-    ~RestoreRegularFile()
-    {
-        /* Initiate an fsync operation without waiting for the
-           result. The real fsync should be run before registering a
-           store path, but this is a performance optimization to allow
-           the disk write to start early. */
-        if (fd && startFsync)
-            fd.startFsync();
+        if (writer->bytesInFlight + size > ParallelWriter::maxBytesInFlight) {
+            RestoreRegularFile crf;
+            openRegularFile(path, crf);
+            if (brf.executable)
+                crf.isExecutable();
+            crf(brf.contents);
+            return;
+        }
+
+        writer->bytesInFlight += size;
+        auto work = [writer(writer.get()),
+                     path(prefix / path),
+                     startFsync(startFsync),
+                     executable(brf.executable),
+                     contents(std::move(brf.contents))]() {
+            Finally done([&]() { writer->bytesInFlight -= contents.size(); });
+            RestoreRegularFile crf;
+            crf.startFsync = startFsync;
+            crf.fd = unix::openFileEnsureBeneathNoSymlinks(
+                writer->rootFd, path, O_CREAT | O_EXCL | O_WRONLY | O_CLOEXEC, 0666);
+            if (!crf.fd)
+                throw SysError("creating file '%1%'", path);
+            if (executable)
+                crf.isExecutable();
+            crf(contents);
+        };
+
+        try {
+            writer->pool.enqueue(std::move(work));
+        } catch (ThreadPoolShutDown &) {
+            /* A worker failed, so report its error. */
+            writer->pool.process();
+            throw;
+        }
+        return;
     }
+#endif
 
-    void operator()(std::string_view data) override;
-    void isExecutable() override;
-    void preallocateContents(uint64_t size) override;
-};
+    RestoreRegularFile crf;
+    openRegularFile(path, crf);
+    func(crf);
+}
 
-void RestoreSink::createRegularFile(const CanonPath & path, std::function<void(CreateRegularFileSink &)> func)
+void RestoreSink::openRegularFile(const CanonPath & path, RestoreRegularFile & crf)
 {
     auto p = append(dstPath, path);
 
-    RestoreRegularFile crf;
     crf.startFsync = startFsync;
     crf.fd =
 #ifdef _WIN32
@@ -176,7 +445,6 @@ void RestoreSink::createRegularFile(const CanonPath & path, std::function<void(C
         ;
     if (!crf.fd)
         throw NativeSysError("creating file '%1%'", p);
-    func(crf);
 }
 
 void RestoreRegularFile::isExecutable()
@@ -184,20 +452,23 @@ void RestoreRegularFile::isExecutable()
     // Windows doesn't have a notion of executable file permissions we
     // care about here, right?
 #ifndef _WIN32
-    struct stat st;
-    if (fstat(fd.get(), &st) == -1)
-        throw SysError("fstat");
-    if (fchmod(fd.get(), st.st_mode | (S_IXUSR | S_IXGRP | S_IXOTH)) == -1)
-        throw SysError("fchmod");
+    makeExecutable(fd.get());
 #endif
 }
 
 void RestoreRegularFile::preallocateContents(uint64_t len)
 {
-    if (!restoreSinkSettings.preallocateContents)
+    /* Small files are written in one go anyway. */
+    if (!restoreSinkSettings.preallocateContents || len < 65536)
         return;
 
-#if HAVE_POSIX_FALLOCATE
+#ifdef __linux__
+    /* Unlike posix_fallocate(), this doesn't fall back to writing
+       zeroes if the filesystem doesn't support preallocation, which
+       would double the amount of I/O. */
+    if (fallocate(fd.get(), 0, 0, len) == -1 && errno != EINVAL && errno != EOPNOTSUPP && errno != ENOSYS)
+        throw SysError("preallocating file of %1% bytes", len);
+#elif HAVE_POSIX_FALLOCATE
     if (len) {
         errno = posix_fallocate(fd.get(), 0, len);
         /* Note that EINVAL may indicate that the underlying
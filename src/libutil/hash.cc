@@ -14,6 +14,7 @@
 #include "nix/util/base-n.hh"
 #include "nix/util/base-nix-32.hh"
 #include "nix/util/json-utils.hh"
+#include "nix/util/thread-pool.hh"
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -369,6 +370,52 @@ Hash hashString(HashAlgorithm ha, std::string_view s, const ExperimentalFeatureS
     return hash;
 }
 
+std::vector<Hash> hashStrings(HashAlgorithm ha, std::span<const std::string_view> inputs)
+{
+    /* Don't bother with threads for less than this much data per
+       batch. */
+    static constexpr size_t minBatchSize = 1 << 20;
+
+    size_t totalSize = 0;
+    for (auto & s : inputs)
+        totalSize += s.size();
+
+    std::vector<Hash> hashes(inputs.size(), Hash(ha));
+
+    auto hashRange = [&](size_t begin, size_t end) {
+        Hash::Ctx ctx;
+        for (auto i = begin; i < end; ++i) {
+            start(ha, ctx);
+            update(ha, ctx, inputs[i]);
+            finish(ha, ctx, hashes[i].hash);
+        }
+    };
+
+    auto nrThreads = std::min<size_t>(std::thread::hardware_concurrency(), totalSize / minBatchSize);
+    if (nrThreads <= 1) {
+        hashRange(0, inputs.size());
+        return hashes;
+    }
+
+    /* Split the inputs into batches of roughly equal size, a few per
+       thread so that a batch of large inputs doesn't hold everything
+       up. */
+    ThreadPool pool(nrThreads);
+    auto batchSize = std::max(minBatchSize, totalSize / (nrThreads * 4));
+    size_t begin = 0, size = 0;
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        size += inputs[i].size();
+        if (size >= batchSize || i + 1 == inputs.size()) {
+            pool.enqueue([&hashRange, begin, end(i + 1)]() { hashRange(begin, end); });
+            begin = i + 1;
+            size = 0;
+        }
+    }
+    pool.process();
+
+    return hashes;
+}
+
 Hash hashFile(HashAlgorithm ha, const Path & path)
 {
     HashSink sink(ha);
@@ -376,8 +423,24 @@ Hash hashFile(HashAlgorithm ha, const Path & path)
     return sink.finish().hash;
 }
 
-HashSink::HashSink(HashAlgorithm ha)
-    : ha(ha)
+/**
+ * BLAKE3 hashes large updates on several threads, but only above
+ * `blake3TbbThreshold`, so give it updates that are large enough.
+ * Sources typically write much smaller pieces than that.
+ */
+static size_t hashSinkBufferSize(HashAlgorithm ha)
+{
+#ifdef BLAKE3_USE_TBB
+    if (ha == HashAlgorithm::BLAKE3)
+        return std::max<size_t>(1 << 20, blake3TbbThreshold);
+#endif
+    return 32 * 1024;
+}
+
+HashSink::HashSink(HashAlgorithm ha, const ExperimentalFeatureSettings & xpSettings)
+    : BufferedSink(hashSinkBufferSize(ha))
+    , ha(ha)
+    , xpSettings(xpSettings)
 {
     ctx = new Hash::Ctx;
     bytes = 0;
@@ -399,7 +462,7 @@ void HashSink::writeUnbuffered(std::string_view data)
 HashResult HashSink::finish()
 {
     flush();
-    Hash hash(ha);
+    Hash hash(ha, xpSettings);
     nix::finish(ha, *ctx, hash.hash);
     return HashResult(hash, bytes);
 }
@@ -408,7 +471,7 @@ HashResult HashSink::currentHash()
 {
     flush();
     Hash::Ctx ctx2 = *ctx;
-    Hash hash(ha);
+    Hash hash(ha, xpSettings);
     nix::finish(ha, ctx2, hash.hash);
     return HashResult(hash, bytes);
 }
@@ -0,0 +1,58 @@
+#pragma once
+///@file
+
+#include "nix/util/serialise.hh"
+#include "nix/util/sync.hh"
+
+#include <condition_variable>
+#include <thread>
+
+namespace nix {
+
+/**
+ * A sink that passes its data to another sink from a background
+ * thread, so that a slow destination (such as a compressor writing to
+ * disk) doesn't hold up the writer. Writes only block when more than
+ * `maxBuffered` bytes are waiting to be written.
+ *
+ * An exception thrown by the destination is rethrown by the next write
+ * or by `finish()`.
+ */
+struct BackgroundSink : FinishSink
+{
+    BackgroundSink(Sink & nextSink, size_t maxBuffered = 8 * 1024 * 1024);
+
+    /**
+     * Waits for the pending data to be written, ignoring errors.
+     */
+    ~BackgroundSink();
+
+    void operator()(std::string_view data) override;
+
+    /**
+     * Wait until all data has been written to the destination and stop
+     * the background thread.
+     */
+    void finish() override;
+
+private:
+
+    struct State
+    {
+        std::string pending;
+        bool finished = false;
+        std::exception_ptr error;
+    };
+
+    Sink & nextSink;
+    size_t maxBuffered;
+    Sync<State> state;
+    std::condition_variable wakeup, spaceAvailable;
+    std::thread thread;
+
+    void run();
+
+    void stop();
+};
+
+} // namespace nix
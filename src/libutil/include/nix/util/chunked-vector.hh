@@ -1,8 +1,11 @@
 #pragma once
 ///@file
 
+#include <algorithm>
+#include <atomic>
 #include <cstdint>
 #include <cstdlib>
+#include <memory>
 #include <vector>
 #include <limits>
 
@@ -18,14 +21,29 @@ namespace nix {
  * on large data sets by on average (growth factor)/2, mostly
  * eliminates copies within the vector during resizing, and provides stable
  * references to its elements.
+ *
+ * Calls to `add()` must be serialised by the caller, but `operator[]`
+ * may be called concurrently with `add()` for any index that was
+ * returned by a previous `add()`. To make that possible, lookups go
+ * through a separate table of chunk pointers that is never modified in
+ * place: when it runs out of space, a larger copy is published and the
+ * old one is kept alive until the vector is destroyed.
  */
 template<typename T, size_t ChunkSize>
 class ChunkedVector
 {
 private:
-    uint32_t size_ = 0;
+    std::atomic<uint32_t> size_ = 0;
     std::vector<std::vector<T>> chunks;
 
+    /**
+     * Chunk pointer tables. Only the last one is used for lookups, the
+     * others are retained for readers that may still be using them.
+     */
+    std::vector<std::unique_ptr<const T *[]>> tables;
+    std::atomic<const T * const *> table = nullptr;
+    size_t tableCapacity = 0;
+
     /**
      * Keep this out of the ::add hot path
      */
@@ -36,31 +54,46 @@ private:
             unreachable();
         chunks.emplace_back();
         chunks.back().reserve(ChunkSize);
+        if (chunks.size() > tableCapacity) {
+            auto newCapacity = std::max<size_t>(tableCapacity * 2, chunks.capacity());
+            auto newTable = std::make_unique<const T *[]>(newCapacity);
+            for (size_t i = 0; i + 1 < chunks.size(); ++i)
+                newTable[i] = chunks[i].data();
+            tables.push_back(std::move(newTable));
+            tableCapacity = newCapacity;
+        }
+        auto & current = tables.back();
+        current[chunks.size() - 1] = chunks.back().data();
+        table.store(current.get(), std::memory_order_release);
         return chunks.back();
     }
 
 public:
     ChunkedVector(uint32_t reserve)
     {
-        chunks.reserve(reserve);
+        chunks.reserve(std::max<uint32_t>(reserve, 1));
         addChunk();
     }
 
+    ChunkedVector(const ChunkedVector &) = delete;
+    ChunkedVector & operator=(const ChunkedVector &) = delete;
+
     uint32_t size() const noexcept
     {
-        return size_;
+        return size_.load(std::memory_order_acquire);
     }
 
     template<typename... Args>
     std::pair<T &, uint32_t> add(Args &&... args)
     {
-        const auto idx = size_++;
+        const auto idx = size_.load(std::memory_order_relaxed);
         auto & chunk = [&]() -> auto & {
             if (auto & back = chunks.back(); back.size() < ChunkSize)
                 return back;
             return addChunk();
         }();
         auto & result = chunk.emplace_back(std::forward<Args>(args)...);
+        size_.store(idx + 1, std::memory_order_release);
         return {result, idx};
     }
 
@@ -71,15 +104,21 @@ public:
      */
     const T & operator[](uint32_t idx) const noexcept
     {
-        return chunks[idx / ChunkSize][idx % ChunkSize];
+        return table.load(std::memory_order_acquire)[idx / ChunkSize][idx % ChunkSize];
     }
 
+    /**
+     * Call `fn` on every element. Like `operator[]`, this may run
+     * concurrently with `add()`, in which case elements added after
+     * the call started are not visited.
+     */
     template<typename Fn>
     void forEach(Fn fn) const
     {
-        for (const auto & c : chunks)
-            for (const auto & e : c)
-                fn(e);
+        const auto n = size();
+        const auto * const * t = table.load(std::memory_order_acquire);
+        for (uint32_t i = 0; i < n; ++i)
+            fn(t[i / ChunkSize][i % ChunkSize]);
     }
 };
 } // namespace nix
@@ -5,6 +5,7 @@
 #include "nix/util/types.hh"
 #include "nix/util/serialise.hh"
 
+#include <functional>
 #include <string>
 
 namespace nix {
@@ -44,6 +45,30 @@ makeCompressionSink(const std::string & method, Sink & nextSink, const bool para
 ref<CompressionSink>
 makeCompressionSink(CompressionAlgo method, Sink & nextSink, const bool parallel = false, int level = -1);
 
+/**
+ * Return a sink that compresses to xz, starting a new xz block every
+ * `blockSize` bytes of input. The blocks can be decompressed
+ * independently, which `makeSeekableXzReader()` takes advantage of.
+ */
+ref<CompressionSink>
+makeSeekableXzCompressionSink(Sink & nextSink, uint64_t blockSize, const bool parallel = false, int level = -1);
+
+/**
+ * Reads `length` bytes at `offset` of some file.
+ */
+using ReadRange = std::function<std::string(uint64_t offset, uint64_t length)>;
+
+/**
+ * Provide random access to the uncompressed contents of an xz file,
+ * given random access to the file itself. The index at the end of the
+ * file is used to decompress only the blocks that overlap the range
+ * being read.
+ *
+ * @return `std::nullopt` if the file doesn't consist of a single
+ * stream with multiple blocks, so seeking in it isn't worthwhile.
+ */
+std::optional<ReadRange> makeSeekableXzReader(ReadRange readCompressed, uint64_t compressedSize);
+
 MakeError(UnknownCompressionMethod, Error);
 
 MakeError(CompressionError, Error);
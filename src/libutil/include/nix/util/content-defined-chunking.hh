@@ -0,0 +1,62 @@
+#pragma once
+///@file
+
+#include "nix/util/serialise.hh"
+
+#include <functional>
+
+namespace nix {
+
+/**
+ * A sink that splits the data written to it into content-defined
+ * chunks using the FastCDC algorithm, and passes each chunk to a
+ * callback.
+ *
+ * Chunk boundaries depend only on the bytes preceding them, so
+ * inserting or removing data only changes the chunks around the
+ * edit. This makes the chunks suitable for deduplicating similar
+ * files.
+ */
+struct ChunkingSink : FinishSink
+{
+    using ChunkCallback = std::function<void(std::string_view chunk)>;
+
+    /**
+     * @param avgSize The desired average chunk size. Must be a power
+     * of two.
+     */
+    ChunkingSink(
+        ChunkCallback onChunk,
+        size_t minSize = 256 * 1024,
+        size_t avgSize = 1024 * 1024,
+        size_t maxSize = 4 * 1024 * 1024);
+
+    void operator()(std::string_view data) override;
+
+    /**
+     * Pass the remaining data to the callback as the last chunk.
+     */
+    void finish() override;
+
+private:
+
+    ChunkCallback onChunk;
+
+    size_t minSize, avgSize, maxSize;
+
+    /**
+     * Masks that are tested against the rolling hash before and after
+     * reaching `avgSize`. The first one has more bits set, making a
+     * cut less likely, which keeps the chunk sizes closer to the
+     * average ("normalized chunking").
+     */
+    uint64_t maskSmall, maskLarge;
+
+    uint64_t fingerprint = 0;
+
+    std::string chunk;
+
+    void emit();
+};
+
+} // namespace nix
@@ -3,6 +3,8 @@
 
 #include <optional>
 #include <chrono>
+#include <map>
+#include <string_view>
 
 #ifndef _WIN32
 #  include <sys/resource.h>
@@ -17,6 +19,27 @@ namespace nix {
  */
 std::chrono::microseconds getCpuUserTime();
 
+/**
+ * Count the wall-clock time between construction and destruction
+ * towards the startup phase `phase` (such as loading the
+ * configuration or opening the store). The totals are reported by
+ * `NIX_SHOW_STATS`. Phases may nest.
+ */
+class StartupPhaseTimer
+{
+    std::string phase;
+    std::chrono::steady_clock::time_point start;
+
+public:
+    StartupPhaseTimer(std::string_view phase);
+    ~StartupPhaseTimer();
+};
+
+/**
+ * The total time spent in each startup phase so far.
+ */
+std::map<std::string, std::chrono::microseconds> getStartupTimes();
+
 /**
  * If cgroups are active, attempt to calculate the number of CPUs available.
  * If cgroups are unavailable or if cpu.max is set to "max", return 0.
@@ -4,6 +4,8 @@
 #include "nix/util/canon-path.hh"
 #include "nix/util/error.hh"
 
+#include <span>
+
 #ifdef _WIN32
 #  define WIN32_LEAN_AND_MEAN
 #  include <windows.h>
@@ -75,6 +77,23 @@ void readFull(Descriptor fd, char * buf, size_t count);
 
 void writeFull(Descriptor fd, std::string_view s, bool allowInterrupts = true);
 
+/**
+ * Like `writeFull()`, but writes several pieces of data, using a
+ * single `writev()` call where possible.
+ */
+void writevFull(Descriptor fd, std::span<const std::string_view> parts, bool allowInterrupts = true);
+
+/**
+ * Copy up to `len` bytes from the current position of `from` to `to`
+ * without passing them through userspace, if the platform and the
+ * types of the files allow it (currently using `copy_file_range()`
+ * or `sendfile()` on Linux).
+ *
+ * @return The number of bytes copied, which is less than `len` if
+ * `from` reaches its end or if nothing could be copied this way.
+ */
+uint64_t copyFdInKernel(Descriptor from, Descriptor to, uint64_t len);
+
 /**
  * Read a line from an unbuffered file descriptor.
  * See BufferedSource::readLine for a buffered variant.
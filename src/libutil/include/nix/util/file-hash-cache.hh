@@ -0,0 +1,79 @@
+#pragma once
+///@file
+
+#include "nix/util/configuration.hh"
+#include "nix/util/file-content-address.hh"
+#include "nix/util/ref.hh"
+
+namespace nix {
+
+struct FileHashCacheSettings : Config
+{
+    Setting<bool> fileHashCache{
+        this,
+        false,
+        "file-hash-cache",
+        R"(
+          Whether to remember the hashes of local files and directories
+          in a cache under `~/.cache/nix`, keyed by their device, inode
+          number, size, modification and status change times. Hashing a
+          path that hasn't changed since it was last hashed (for
+          instance by `nix hash path`, `nix store add` or importing a
+          local path during evaluation) then only requires a walk over
+          the file metadata. With the `git` method, only the files that
+          changed are rehashed.
+
+          Files that were modified less than a second before they were
+          hashed are not cached, since a further change within the same
+          second could go unnoticed. Entries that haven't been used for
+          30 days are removed from the cache.
+        )"};
+};
+
+extern FileHashCacheSettings fileHashCacheSettings;
+
+/**
+ * A persistent mapping from a description of the metadata of a local
+ * file system object to its hash.
+ */
+struct FileHashCache
+{
+    virtual ~FileHashCache() = default;
+
+    virtual std::optional<HashResult> lookup(std::string_view key) = 0;
+
+    virtual void upsert(std::string_view key, const HashResult & result) = 0;
+};
+
+/**
+ * Open the file hash cache. This is set by libstore, which provides
+ * the SQLite-based implementation; if it isn't set, `file-hash-cache`
+ * has no effect.
+ */
+extern std::function<ref<FileHashCache>()> openFileHashCache;
+
+/**
+ * @return The file hash cache, or `nullptr` if it's disabled.
+ */
+FileHashCache * getFileHashCache();
+
+/**
+ * Compute the key of `path` in the file hash cache for the Flat or
+ * NixArchive method, from the metadata of every file system object
+ * below `path` that `filter` accepts. Returns `std::nullopt` if `path`
+ * isn't a physical path or recent modifications make the metadata
+ * unreliable.
+ */
+std::optional<std::string>
+fileHashCacheKey(const SourcePath & path, FileIngestionMethod method, HashAlgorithm ha, PathFilter & filter);
+
+/**
+ * Like `hashPath()`, but use the file hash cache if it's enabled and
+ * `path` is a physical path. This must not be used when the hash is
+ * used to check the integrity of a path (e.g. in `nix store verify`),
+ * because the cache only looks at file metadata.
+ */
+std::pair<Hash, std::optional<uint64_t>> hashPathCached(
+    const SourcePath & path, FileIngestionMethod method, HashAlgorithm ha, PathFilter & filter = defaultPathFilter);
+
+} // namespace nix
@@ -93,6 +93,8 @@ struct NullFileSystemObjectSink : FileSystemObjectSink
     void createRegularFile(const CanonPath & path, std::function<void(CreateRegularFileSink &)>) override;
 };
 
+struct RestoreRegularFile;
+
 /**
  * Write files at the given path
  */
@@ -127,6 +129,42 @@ struct RestoreSink : FileSystemObjectSink
     void createRegularFile(const CanonPath & path, std::function<void(CreateRegularFileSink &)>) override;
 
     void createSymlink(const CanonPath & path, const std::string & target) override;
+
+    /**
+     * Write small regular files on worker threads, so that the latency
+     * of creating them overlaps with producing the rest of the tree.
+     * Directories and symlinks are still created in order. `finish()`
+     * must be called to wait for the files to be written.
+     */
+    void enableParallelWrites();
+
+    /**
+     * Wait until all files have been written, rethrowing the first
+     * error that occurred while writing them.
+     */
+    void finish();
+
+private:
+
+    void openRegularFile(const CanonPath & path, RestoreRegularFile & crf);
+
+#ifndef _WIN32
+    struct ParallelWriter;
+
+    /**
+     * Shared with the sinks of subdirectories. Declared after `dirFd`,
+     * since the workers may still be using the latter.
+     */
+    std::shared_ptr<ParallelWriter> writer;
+
+    /**
+     * The path of `dstPath` relative to the `dstPath` of the root
+     * sink. The workers open files relative to the root directory,
+     * since the directory descriptors of subdirectory sinks are
+     * closed as soon as they're done.
+     */
+    CanonPath prefix = CanonPath::root;
+#endif
 };
 
 /**
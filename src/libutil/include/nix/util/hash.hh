@@ -7,6 +7,8 @@
 #include "nix/util/file-system.hh"
 #include "nix/util/json-impls.hh"
 
+#include <span>
+
 namespace nix {
 
 MakeError(BadHash, Error);
@@ -160,6 +162,15 @@ Hash newHashAllowEmpty(std::string_view hashStr, std::optional<HashAlgorithm> ha
 Hash hashString(
     HashAlgorithm ha, std::string_view s, const ExperimentalFeatureSettings & xpSettings = experimentalFeatureSettings);
 
+/**
+ * Compute the hashes of many independent strings, such as the
+ * contents of small files. The strings are hashed in batches on
+ * several threads, which only pays off if there are many of them.
+ *
+ * @return The hashes, in the same order as `inputs`.
+ */
+std::vector<Hash> hashStrings(HashAlgorithm ha, std::span<const std::string_view> inputs);
+
 /**
  * Compute the hash of the given file, hashing its contents directly.
  *
@@ -225,9 +236,10 @@ private:
     HashAlgorithm ha;
     Hash::Ctx * ctx;
     uint64_t bytes;
+    const ExperimentalFeatureSettings & xpSettings;
 
 public:
-    HashSink(HashAlgorithm ha);
+    HashSink(HashAlgorithm ha, const ExperimentalFeatureSettings & xpSettings = experimentalFeatureSettings);
     HashSink(const HashSink & h);
     ~HashSink();
     void writeUnbuffered(std::string_view data) override;
@@ -27,6 +27,7 @@ typedef enum {
     actPostBuildHook = 110,
     actBuildWaiting = 111,
     actFetchTree = 112,
+    actCollectGarbage = 113,
 } ActivityType;
 
 typedef enum {
@@ -39,6 +40,7 @@ typedef enum {
     resSetExpected = 106,
     resPostBuildLogLine = 107,
     resFetchStatus = 108,
+    resBuildResources = 109,
 } ResultType;
 
 typedef uint64_t ActivityId;
@@ -65,6 +67,29 @@ struct LoggerSettings : Config
           Concurrent writes to the same file by multiple Nix processes are not supported and
           may result in interleaved or corrupted log records.
         )"};
+
+    Setting<std::optional<std::filesystem::path>> traceFile{
+        this,
+        {},
+        "trace-file",
+        R"(
+          A file to which Nix appends an [OpenTelemetry](https://opentelemetry.io/) span for every activity (such as a build, a substitution, a path copy or a file transfer) when it finishes.
+          Each line is an `ExportTraceServiceRequest` in the OTLP JSON encoding, which can be read by the OpenTelemetry Collector's `otlpjsonfile` receiver.
+
+          The trace context is passed to the Nix daemon and to remote builders reached over `ssh-ng://`, so if they also have `trace-file` set, their spans become part of the same trace.
+        )"};
+
+    Setting<std::string> traceParent{
+        this,
+        "",
+        "trace-parent",
+        R"(
+          The [W3C trace context](https://www.w3.org/TR/trace-context/#traceparent-header) (e.g. `00-4bf92f3577b34da6a3ce929d0e0e4736-00f067aa0ba902b7-01`) of the span that caused this invocation of Nix.
+          The spans written to [`trace-file`](#conf-trace-file) for activities without a parent become children of this span.
+          This allows a CI system to include Nix's spans in a trace of its own.
+
+          If empty, the value of the `TRACEPARENT` environment variable is used.
+        )"};
 };
 
 extern LoggerSettings loggerSettings;
@@ -268,8 +293,36 @@ makeTeeLogger(std::unique_ptr<Logger> mainLogger, std::vector<std::unique_ptr<Lo
 
 std::unique_ptr<Logger> makeJSONLogger(Descriptor fd, bool includeNixPrefix = true);
 
+/**
+ * Create a JSON logger that writes to a file or Unix domain socket.
+ * Activity events are written asynchronously, like with
+ * `makeStructuredLogger()`.
+ */
 std::unique_ptr<Logger> makeJSONLogger(const std::filesystem::path & path, bool includeNixPrefix = true);
 
+enum struct StructuredLogFormat {
+    /**
+     * One JSON object per line.
+     */
+    JSON,
+    /**
+     * A sequence of CBOR maps (RFC 8742), with the same contents as
+     * the JSON objects.
+     */
+    CBOR,
+};
+
+/**
+ * Create a logger for machine-readable output that queues activity
+ * events in a lock-free buffer and writes them from a separate thread,
+ * so that logging doesn't slow down the threads doing the work.
+ * Superseded progress updates are dropped. Messages are written
+ * synchronously. `stop()` must be called to flush the queue before the
+ * process `exec()`s.
+ */
+std::unique_ptr<Logger> makeStructuredLogger(
+    Descriptor fd, StructuredLogFormat format = StructuredLogFormat::JSON, bool includeNixPrefix = true);
+
 void applyJSONLogger();
 
 /**
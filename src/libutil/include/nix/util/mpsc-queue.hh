@@ -0,0 +1,104 @@
+#pragma once
+///@file
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <memory>
+#include <optional>
+
+namespace nix {
+
+/**
+ * A bounded, lock-free queue with multiple producers and a single
+ * consumer, after Dmitry Vyukov's bounded MPMC queue. Every slot has a
+ * sequence number that tells producers whether the slot is free, and
+ * the consumer whether it has been filled.
+ */
+template<typename T>
+class BoundedMPSCQueue
+{
+    struct Slot
+    {
+        std::atomic<size_t> seq;
+        std::optional<T> item;
+    };
+
+    size_t mask;
+    std::unique_ptr<Slot[]> slots;
+
+    /**
+     * The position of the next push. Kept on its own cache line, since
+     * all producers write to it.
+     */
+    alignas(64) std::atomic<size_t> head{0};
+
+    /**
+     * The position of the next pop. Only accessed by the consumer.
+     */
+    alignas(64) size_t tail = 0;
+
+public:
+
+    /**
+     * @param capacity The maximum number of items in the queue,
+     * rounded up to a power of two.
+     */
+    BoundedMPSCQueue(size_t capacity)
+        : mask(std::bit_ceil(std::max<size_t>(capacity, 2)) - 1)
+        , slots(std::make_unique<Slot[]>(mask + 1))
+    {
+        for (size_t i = 0; i <= mask; ++i)
+            slots[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    /**
+     * Append `item` to the queue. `item` is only moved from if this
+     * succeeds.
+     *
+     * @return false if the queue is full.
+     */
+    bool tryPush(T && item)
+    {
+        auto pos = head.load(std::memory_order_relaxed);
+        while (true) {
+            auto & slot = slots[pos & mask];
+            auto seq = slot.seq.load(std::memory_order_acquire);
+            auto diff = (intptr_t) seq - (intptr_t) pos;
+            if (diff == 0) {
+                if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    slot.item.emplace(std::move(item));
+                    slot.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0)
+                /* The consumer hasn't popped this slot yet. */
+                return false;
+            else
+                /* Another producer claimed this slot. */
+                pos = head.load(std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * Remove the first item from the queue. Must not be called by
+     * several threads concurrently.
+     *
+     * @return std::nullopt if the queue is empty, or if the producer
+     * of the first item hasn't finished pushing it.
+     */
+    std::optional<T> tryPop()
+    {
+        auto & slot = slots[tail & mask];
+        if (slot.seq.load(std::memory_order_acquire) != tail + 1)
+            return std::nullopt;
+        auto item = std::move(slot.item);
+        slot.item.reset();
+        slot.seq.store(tail + mask + 1, std::memory_order_release);
+        ++tail;
+        return item;
+    }
+};
+
+} // namespace nix
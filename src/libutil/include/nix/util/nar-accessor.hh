@@ -10,6 +10,7 @@
 namespace nix {
 
 struct Source;
+struct Sink;
 
 /**
  * Return an object that provides access to the contents of a NAR
@@ -42,6 +43,13 @@ ref<SourceAccessor> makeLazyNarAccessor(const nlohmann::json & listing, GetNarBy
  */
 ref<SourceAccessor> makeLazyNarAccessor(Source & source, GetNarBytes getNarBytes);
 
+/**
+ * Return an accessor for the NAR file at `path`. Only the index of
+ * the NAR is kept in memory; file contents are read from the NAR
+ * file on demand.
+ */
+ref<SourceAccessor> openNarAccessor(const Path & path);
+
 struct NarListingRegularFile
 {
     /**
@@ -83,6 +91,25 @@ NarListing listNarDeep(SourceAccessor & accessor, const CanonPath & path);
  */
 ShallowNarListing listNarShallow(SourceAccessor & accessor, const CanonPath & path);
 
+/**
+ * Write a NAR listing in a compact binary format that is cheaper to
+ * produce and parse than JSON. It consists of a magic string followed
+ * by a pre-order traversal of the tree, in which every object is a type
+ * tag followed by its attributes, encoded like the fields of a NAR.
+ */
+void writeNarListingBinary(const NarListing & listing, Sink & sink);
+
+/**
+ * Read a NAR listing written by `writeNarListingBinary()`.
+ */
+NarListing readNarListingBinary(Source & source);
+
+/**
+ * Create a NAR accessor from a NAR listing. See
+ * `makeLazyNarAccessor(const nlohmann::json &, GetNarBytes)`.
+ */
+ref<SourceAccessor> makeLazyNarAccessor(const NarListing & listing, GetNarBytes getNarBytes);
+
 // All json_avoids_null and JSON_IMPL covered by generic templates in memory-source-accessor.hh
 
 } // namespace nix
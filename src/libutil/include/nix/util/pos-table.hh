@@ -2,6 +2,7 @@
 ///@file
 
 #include <cstdint>
+#include <functional>
 #include <vector>
 
 #include "nix/util/lru-cache.hh"
@@ -37,19 +38,51 @@ public:
         }
     };
 
-private:
     /**
-     * Vector of byte offsets (in the virtual input buffer) of initial line character's position.
-     * Sorted by construction. Binary search over it allows for efficient translation of arbitrary
-     * byte offsets in the virtual input buffer to its line + column position.
+     * Byte offsets of the first character of each line of an origin.
+     * Binary search over it allows for efficient translation of
+     * arbitrary byte offsets to line + column positions.
+     *
+     * To save memory, offsets are stored as 16-bit deltas from the
+     * start of their block of `linesPerBlock` lines. Sources with a
+     * block longer than 64 KiB fall back to 32-bit offsets.
      */
-    using Lines = std::vector<uint32_t>;
+    class Lines
+    {
+        static constexpr size_t linesPerBlock = 16;
+
+        std::vector<uint32_t> blockStarts;
+        std::vector<uint16_t> deltas;
+        std::vector<uint32_t> wide;
+
+    public:
+        explicit Lines(std::string_view content);
+
+        /**
+         * @return The 0-based number and the start offset of the line
+         * containing `offset`.
+         */
+        std::pair<size_t, uint32_t> find(uint32_t offset) const;
+    };
+
+private:
     /**
      * Cache from byte offset in the virtual buffer of Origins -> @ref Lines in that origin.
      */
     using LinesCache = LRUCache<uint32_t, Lines>;
 
-    std::map<uint32_t, Origin> origins;
+    /**
+     * Nodes of a `std::map` are stable, so pointers to `Origin`s remain
+     * valid after the lock is released.
+     */
+    SharedSync<std::map<uint32_t, Origin>> origins;
+
+    /**
+     * The offset of the next origin. Protected by the lock of
+     * `origins`. This isn't derived from the last origin, so that the
+     * offsets of origins removed by `retain()` are never reused.
+     */
+    uint32_t nextOffset = 0;
 
     mutable Sync<LinesCache> linesCache;
 
@@ -60,10 +93,16 @@ private:
 
         const auto idx = p.id - 1;
         /* we want the last key <= idx, so we'll take prev(first key > idx).
-            this is guaranteed to never rewind origin.begin because the first
-            key is always 0. */
-        const auto pastOrigin = origins.upper_bound(idx);
-        return &std::prev(pastOrigin)->second;
+            `idx` may be before the first origin or between two origins
+            if its own origin was removed by `retain()`. */
+        auto origins(this->origins.readLock());
+        const auto pastOrigin = origins->upper_bound(idx);
+        if (pastOrigin == origins->begin())
+            return nullptr;
+        auto & origin = std::prev(pastOrigin)->second;
+        if (idx > origin.offset + origin.size)
+            return nullptr;
+        return &origin;
     }
 
 public:
@@ -74,15 +113,15 @@ public:
 
     Origin addOrigin(Pos::Origin origin, size_t size)
     {
-        uint32_t offset = 0;
-        if (auto it = origins.rbegin(); it != origins.rend())
-            offset = it->first + it->second.size;
+        auto origins(this->origins.lock());
+        uint32_t offset = nextOffset;
         // +1 because all PosIdx are offset by 1 to begin with, and
         // another +1 to ensure that all origins can point to EOF, eg
         // on (invalid) empty inputs.
         if (2 + offset + size < offset)
             return Origin{origin, offset, 0};
-        return origins.emplace(offset, Origin{origin, offset, size}).first->second;
+        nextOffset = offset + size;
+        return origins->emplace(offset, Origin{origin, offset, size}).first->second;
     }
 
     PosIdx add(const Origin & origin, size_t offset)
@@ -119,7 +158,26 @@ public:
     {
         auto lines = linesCache.lock();
         lines->clear();
-        origins.clear();
+        auto origins(this->origins.lock());
+        origins->clear();
+        nextOffset = 0;
+    }
+
+    /**
+     * Remove the origins for which `keep` returns false, visiting them
+     * from the most recently added one. Positions in removed origins
+     * no longer resolve.
+     */
+    void retain(std::function<bool(const Origin &)> keep)
+    {
+        auto lines = linesCache.lock();
+        lines->clear();
+        auto origins(this->origins.lock());
+        for (auto i = origins->end(); i != origins->begin();) {
+            --i;
+            if (!keep(i->second))
+                i = origins->erase(i);
+        }
     }
 };
 
@@ -78,6 +78,21 @@ public:
         return trackLastModified ? std::optional{mtime} : std::nullopt;
     }
 
+    /**
+     * `PosixSourceAccessor`s share a bounded cache of `lstat()`
+     * results and of the listings of read-only directories, so code
+     * that modifies a file that may have been accessed before must
+     * call this to forget about `path` and the listing of its parent.
+     * This does not affect the cache entries of the descendants of
+     * `path`.
+     */
+    static void invalidateCache(const std::filesystem::path & path);
+
+    /**
+     * Forget everything in the cache.
+     */
+    static void clearCache();
+
 private:
 
     /**
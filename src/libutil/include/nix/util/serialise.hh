@@ -2,6 +2,7 @@
 ///@file
 
 #include <memory>
+#include <span>
 #include <type_traits>
 
 #include "nix/util/types.hh"
@@ -27,6 +28,19 @@ struct Sink
     {
         return true;
     }
+
+    /**
+     * Write `len` bytes read from the current position of `fd`, if
+     * the sink can do so without copying them through a userspace
+     * buffer.
+     *
+     * @return The number of bytes written. The caller must write the
+     * remaining ones as usual.
+     */
+    virtual uint64_t writeFromFd(Descriptor fd, uint64_t len)
+    {
+        return 0;
+    }
 };
 
 /**
@@ -51,20 +65,40 @@ struct BufferedSink : virtual Sink
     size_t bufSize, bufPos;
     std::unique_ptr<char[]> buffer;
 
-    BufferedSink(size_t bufSize = 32 * 1024)
+    /**
+     * Every time the buffer fills up, its size is doubled up to this
+     * limit, since the data is apparently being written in bulk.
+     */
+    size_t maxBufSize;
+
+    BufferedSink(size_t bufSize = 32 * 1024, size_t maxBufSize = 0)
         : bufSize(bufSize)
         , bufPos(0)
         , buffer(nullptr)
+        , maxBufSize(std::max(bufSize, maxBufSize))
     {
     }
 
     void operator()(std::string_view data) override;
 
+    /**
+     * Write several pieces of data. If they don't fit in the buffer,
+     * they are passed to `writeUnbufferedVectored()` together with
+     * the buffered data.
+     */
+    void writeVectored(std::span<const std::string_view> parts);
+
     void flush();
 
 protected:
 
     virtual void writeUnbuffered(std::string_view data) = 0;
+
+    /**
+     * Write several pieces of data at once. By default they're
+     * written one by one.
+     */
+    virtual void writeUnbufferedVectored(std::span<const std::string_view> parts);
 };
 
 /**
@@ -99,6 +133,13 @@ struct Source
     std::string drain();
 
     virtual void skip(size_t len);
+
+    /**
+     * Write exactly `len` bytes to `sink`. Sources that already have
+     * the data in memory override this to pass it on without copying
+     * it into an intermediate buffer.
+     */
+    virtual void readInto(Sink & sink, uint64_t len);
 };
 
 /**
@@ -110,16 +151,26 @@ struct BufferedSource : virtual Source
     size_t bufSize, bufPosIn, bufPosOut;
     std::unique_ptr<char[]> buffer;
 
-    BufferedSource(size_t bufSize = 32 * 1024)
+    /**
+     * Every time a read fills the whole buffer, its size is doubled up
+     * to this limit for the next read, since the underlying source can
+     * apparently deliver data faster than it is consumed.
+     */
+    size_t maxBufSize;
+
+    BufferedSource(size_t bufSize = 32 * 1024, size_t maxBufSize = 0)
         : bufSize(bufSize)
         , bufPosIn(0)
         , bufPosOut(0)
         , buffer(nullptr)
+        , maxBufSize(std::max(bufSize, maxBufSize))
     {
     }
 
     size_t read(char * data, size_t len) override;
 
+    void readInto(Sink & sink, uint64_t len) override;
+
     std::string readLine(bool eofOk = false);
 
     /**
@@ -132,6 +183,15 @@ protected:
      * Underlying read call, to be overridden.
      */
     virtual size_t readUnbuffered(char * data, size_t len) = 0;
+
+private:
+
+    bool bufFilled = false;
+
+    /**
+     * Read into the empty buffer, growing it first if necessary.
+     */
+    size_t fill();
 };
 
 /**
@@ -150,13 +210,18 @@ struct FdSink : BufferedSink
     Descriptor fd;
     size_t written = 0;
 
+    /* Grow the buffer up to 1 MiB to save system calls when
+       streaming large amounts of data, such as NARs. */
+
     FdSink()
-        : fd(INVALID_DESCRIPTOR)
+        : BufferedSink(32 * 1024, 1024 * 1024)
+        , fd(INVALID_DESCRIPTOR)
     {
     }
 
     FdSink(Descriptor fd)
-        : fd(fd)
+        : BufferedSink(32 * 1024, 1024 * 1024)
+        , fd(fd)
     {
     }
 
@@ -177,6 +242,14 @@ struct FdSink : BufferedSink
 
     void writeUnbuffered(std::string_view data) override;
 
+    void writeUnbufferedVectored(std::span<const std::string_view> parts) override;
+
+    /**
+     * On Linux, this copies the data in the kernel, see
+     * `copyFdInKernel()`.
+     */
+    uint64_t writeFromFd(Descriptor from, uint64_t len) override;
+
     bool good() override;
 
 private:
@@ -194,12 +267,14 @@ struct FdSource : BufferedSource, RestartableSource
     bool isSeekable = true;
 
     FdSource()
-        : fd(INVALID_DESCRIPTOR)
+        : BufferedSource(32 * 1024, 1024 * 1024)
+        , fd(INVALID_DESCRIPTOR)
     {
     }
 
     FdSource(Descriptor fd)
-        : fd(fd)
+        : BufferedSource(32 * 1024, 1024 * 1024)
+        , fd(fd)
     {
     }
 
@@ -721,8 +796,12 @@ struct FramedSink : nix::BufferedSink
         /* Don't send more data if an error has occurred. */
         checkError();
 
-        to << data.size();
-        to(data);
+        /* Send the frame header and the data in one go. */
+        unsigned char header[8];
+        for (int i = 0; i < 8; ++i)
+            header[i] = (data.size() >> (8 * i)) & 0xff;
+        std::string_view parts[] = {{(char *) header, sizeof(header)}, data};
+        to.writeVectored(parts);
     };
 };
 
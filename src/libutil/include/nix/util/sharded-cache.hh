@@ -0,0 +1,186 @@
+#pragma once
+///@file
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+#include "nix/util/sync.hh"
+
+namespace nix {
+
+/**
+ * A thread-safe, fixed-capacity cache that uses CLOCK (second chance)
+ * eviction.
+ *
+ * Unlike `LRUCache`, a lookup doesn't reorder anything: it only sets
+ * the entry's "referenced" bit, so it only needs a read lock on the
+ * shard that holds the key. Keys are spread over a number of shards
+ * that each have their own lock, so concurrent writers mostly don't
+ * contend either.
+ */
+template<typename Key, typename Value, typename Hash = std::hash<Key>>
+class ShardedCache
+{
+private:
+
+    struct Entry
+    {
+        Value value;
+
+        /**
+         * Index of this entry in `Shard::clock`.
+         */
+        size_t slot;
+
+        /**
+         * Set on every hit, cleared when the clock hand passes by.
+         */
+        mutable std::atomic<bool> referenced{false};
+
+        Entry(const Value & value, size_t slot)
+            : value(value)
+            , slot(slot)
+        {
+        }
+    };
+
+    using Map = std::unordered_map<Key, Entry, Hash>;
+
+    struct Shard
+    {
+        Map data;
+
+        /**
+         * The entries in `data` in clock order. References to the
+         * elements of an `std::unordered_map` are stable, unlike its
+         * iterators.
+         */
+        std::vector<typename Map::value_type *> clock;
+
+        size_t hand = 0;
+
+        void erase(typename Map::iterator i)
+        {
+            auto slot = i->second.slot;
+            clock[slot] = clock.back();
+            clock[slot]->second.slot = slot;
+            clock.pop_back();
+            if (hand >= clock.size())
+                hand = 0;
+            data.erase(i);
+        }
+
+        /**
+         * Advance the clock hand to the first entry that hasn't been
+         * used since the hand last passed it, and evict it.
+         */
+        void evict()
+        {
+            while (true) {
+                auto & e = clock[hand]->second;
+                if (!e.referenced.exchange(false, std::memory_order_relaxed)) {
+                    erase(data.find(clock[hand]->first));
+                    return;
+                }
+                hand = (hand + 1) % clock.size();
+            }
+        }
+    };
+
+    size_t shardCapacity;
+
+    std::vector<SharedSync<Shard>> shards;
+
+    SharedSync<Shard> & shardFor(const Key & key)
+    {
+        /* Mix the hash, since it may come straight from the key's
+           bytes. */
+        uint64_t h = Hash{}(key) * 0x9e3779b97f4a7c15ULL;
+        return shards[(h >> 32) % shards.size()];
+    }
+
+public:
+
+    /**
+     * @param capacity The maximum number of entries in the cache. It is
+     * split evenly between the shards.
+     */
+    ShardedCache(size_t capacity, size_t nrShards = 16)
+        : shardCapacity(capacity == 0 ? 0 : (capacity + nrShards - 1) / nrShards)
+        , shards(std::max<size_t>(1, std::min(nrShards, capacity)))
+    {
+    }
+
+    /**
+     * Insert or update an item in the cache.
+     */
+    void upsert(const Key & key, const Value & value)
+    {
+        if (shardCapacity == 0)
+            return;
+
+        auto shard(shardFor(key).lock());
+
+        if (auto i = shard->data.find(key); i != shard->data.end()) {
+            i->second.value = value;
+            i->second.referenced.store(true, std::memory_order_relaxed);
+            return;
+        }
+
+        if (shard->data.size() >= shardCapacity)
+            shard->evict();
+
+        auto res = shard->data.try_emplace(key, value, shard->clock.size());
+        assert(res.second);
+        shard->clock.push_back(&*res.first);
+    }
+
+    bool erase(const Key & key)
+    {
+        auto shard(shardFor(key).lock());
+        auto i = shard->data.find(key);
+        if (i == shard->data.end())
+            return false;
+        shard->erase(i);
+        return true;
+    }
+
+    /**
+     * Look up an item in the cache, marking it as recently used.
+     *
+     * @returns corresponding cache entry, std::nullopt if it's not in the cache
+     */
+    std::optional<Value> get(const Key & key)
+    {
+        auto shard(shardFor(key).readLock());
+        auto i = shard->data.find(key);
+        if (i == shard->data.end())
+            return {};
+        i->second.referenced.store(true, std::memory_order_relaxed);
+        return i->second.value;
+    }
+
+    size_t size()
+    {
+        size_t n = 0;
+        for (auto & shard : shards)
+            n += shard.readLock()->data.size();
+        return n;
+    }
+
+    void clear()
+    {
+        for (auto & shard : shards) {
+            auto shard_(shard.lock());
+            shard_->data.clear();
+            shard_->clock.clear();
+            shard_->hand = 0;
+        }
+    }
+};
+
+} // namespace nix
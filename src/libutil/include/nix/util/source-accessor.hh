@@ -78,6 +78,17 @@ struct SourceAccessor : std::enable_shared_from_this<SourceAccessor>
     virtual void
     readFile(const CanonPath & path, Sink & sink, std::function<void(uint64_t)> sizeCallback = [](uint64_t size) {});
 
+    /**
+     * Return up to `length` bytes of the contents of a file, starting
+     * at `offset`. The result is shorter than `length` only at the end
+     * of the file.
+     *
+     * The default implementation reads the whole file. Accessors that
+     * can read parts of files more cheaply, like lazy NAR accessors,
+     * override this.
+     */
+    virtual std::string readFileRange(const CanonPath & path, uint64_t offset, uint64_t length);
+
     virtual bool pathExists(const CanonPath & path);
 
     enum Type {
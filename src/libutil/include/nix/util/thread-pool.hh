@@ -4,19 +4,37 @@
 #include "nix/util/error.hh"
 #include "nix/util/sync.hh"
 
-#include <queue>
+#include <algorithm>
 #include <functional>
+#include <future>
 #include <thread>
 #include <map>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <memory>
 #include <atomic>
+#include <deque>
+#include <vector>
 
 namespace nix {
 
 MakeError(ThreadPoolShutDown, Error);
 
 /**
- * A simple thread pool that executes a queue of work items
- * (lambdas).
+ * A work-stealing thread pool that executes work items (lambdas).
+ *
+ * Every worker thread, as well as the thread that created the pool,
+ * has its own deque of work items. Items enqueued by a thread that
+ * owns a deque are pushed onto it and popped again in LIFO order
+ * without taking any lock; idle threads steal the oldest items from
+ * the other deques. Items enqueued by any other thread go to a shared
+ * queue.
+ *
+ * `maxThreads` includes the thread that calls `process()`, so at most
+ * `maxThreads - 1` worker threads are started, but always at least
+ * one. Thus items make progress even if nobody calls `process()`, e.g.
+ * when the caller only waits for the futures returned by `submit()`.
  */
 class ThreadPool
 {
@@ -27,16 +45,37 @@ public:
     ~ThreadPool();
 
     /**
-     * An individual work item.
-     *
-     * \todo use std::packaged_task?
+     * An individual work item. The callable is stored inline, so
+     * enqueueing a lambda costs a single allocation.
      */
-    typedef std::function<void()> work_t;
+    struct Task
+    {
+        virtual ~Task() = default;
+        virtual void run() = 0;
+    };
 
     /**
      * Enqueue a function to be executed by the thread pool.
      */
-    void enqueue(work_t t);
+    template<typename F>
+    void enqueue(F && f)
+    {
+        push(std::make_unique<TaskImpl<std::decay_t<F>>>(std::forward<F>(f)));
+    }
+
+    /**
+     * Enqueue a function and return a future for its result. Unlike
+     * with `enqueue()`, an exception thrown by the function is stored
+     * in the future rather than stopping the pool.
+     */
+    template<typename F>
+    std::future<std::invoke_result_t<std::decay_t<F> &>> submit(F && f)
+    {
+        std::packaged_task<std::invoke_result_t<std::decay_t<F> &>()> task(std::forward<F>(f));
+        auto future = task.get_future();
+        enqueue(std::move(task));
+        return future;
+    }
 
     /**
      * Execute work items until the queue is empty.
@@ -58,104 +97,193 @@ public:
      */
     void shutdown();
 
+    /**
+     * A deque of work items, defined in thread-pool.cc.
+     */
+    struct Worker;
+
 private:
 
+    template<typename F>
+    struct TaskImpl : Task
+    {
+        F f;
+
+        template<typename G>
+        explicit TaskImpl(G && g)
+            : f(std::forward<G>(g))
+        {
+        }
+
+        void run() override
+        {
+            f();
+        }
+    };
+
+    void push(std::unique_ptr<Task> task);
+
     size_t maxThreads;
 
+    /**
+     * The thread that created the pool. It owns `deques[0]`; the
+     * worker threads own the others.
+     */
+    std::thread::id creator;
+
+    std::vector<std::unique_ptr<Worker>> deques;
+
     struct State
     {
-        std::queue<work_t> pending;
-        size_t active = 0;
+        /**
+         * Items enqueued by threads that don't own a deque.
+         */
+        std::deque<std::unique_ptr<Task>> injected;
         std::exception_ptr exception;
         std::vector<std::thread> workers;
-        bool draining = false;
     };
 
     std::atomic_bool quit{false};
 
+    std::atomic_bool draining{false};
+
+    /**
+     * The number of items that are queued but haven't been picked up
+     * by a thread yet. Idle threads sleep while this is zero.
+     */
+    std::atomic<size_t> pending{0};
+
+    /**
+     * The number of items that are queued or running. `process()`
+     * returns when this drops to zero.
+     */
+    std::atomic<size_t> outstanding{0};
+
+    std::atomic<size_t> nrInjected{0};
+
+    std::atomic<size_t> nrWorkers{0};
+
+    std::atomic<size_t> sleepers{0};
+
     Sync<State> state_;
 
     std::condition_variable work;
 
-    void doWork(bool mainThread);
+    /**
+     * Signalled when `quit` is set because all items are done or one
+     * of them failed.
+     */
+    std::condition_variable done;
+
+    std::unique_ptr<Task> findWork(Worker * own, size_t start);
+
+    void doWork(Worker * own, size_t index);
 };
 
 /**
  * Process in parallel a set of items of type T that have a partial
  * ordering between them. Thus, any item is only processed after all
- * its dependencies have been processed.
+ * its dependencies have been processed. At most `maxThreads` items
+ * are processed concurrently (0 means the number of cores).
+ *
+ * The nodes are numbered, and each one keeps an atomic count of its
+ * unprocessed dependencies, so a node becomes ready without any
+ * global lock. Only registering a node as a dependent of another one
+ * takes the latter's lock.
  */
 template<typename T>
 void processGraph(
     const std::set<T> & nodes,
     std::function<std::set<T>(const T &)> getEdges,
-    std::function<void(const T &)> processNode)
+    std::function<void(const T &)> processNode,
+    size_t maxThreads = 0)
 {
-    struct Graph
+    /* `nodes` is sorted, so a node's number is its position in it. */
+    std::vector<const T *> index;
+    index.reserve(nodes.size());
+    for (auto & node : nodes)
+        index.push_back(&node);
+
+    auto lookup = [&](const T & node) -> std::optional<size_t> {
+        auto i = std::lower_bound(
+            index.begin(), index.end(), &node, [](const T * a, const T * b) { return *a < *b; });
+        if (i == index.end() || node < **i)
+            return std::nullopt;
+        return i - index.begin();
+    };
+
+    struct Node
     {
-        std::set<T> left;
-        std::map<T, std::set<T>> refs, rrefs;
+        /**
+         * Protects `done` and `rrefs`.
+         */
+        std::mutex lock;
+
+        bool done = false;
+
+        /**
+         * The nodes that are waiting for this one.
+         */
+        std::vector<size_t> rrefs;
+
+        /**
+         * The number of unprocessed dependencies, plus one until all
+         * of them have been registered.
+         */
+        std::atomic<size_t> remaining{1};
     };
 
-    Sync<Graph> graph_(Graph{nodes, {}, {}});
+    auto graph = std::make_unique<Node[]>(index.size());
+
+    std::atomic<size_t> left{index.size()};
 
-    std::function<void(const T &)> worker;
+    std::function<void(size_t)> doWork;
 
     /* Create pool last to ensure threads are stopped before other destructors
      * run */
-    ThreadPool pool;
-
-    worker = [&](const T & node) {
-        {
-            auto graph(graph_.lock());
-            auto i = graph->refs.find(node);
-            if (i == graph->refs.end())
-                goto getRefs;
-            goto doWork;
-        }
+    ThreadPool pool(maxThreads);
 
-    getRefs: {
-        auto refs = getEdges(node);
-        refs.erase(node);
+    doWork = [&](size_t i) {
+        processNode(*index[i]);
 
+        std::vector<size_t> rrefs;
         {
-            auto graph(graph_.lock());
-            for (auto & ref : refs)
-                if (graph->left.count(ref)) {
-                    graph->refs[node].insert(ref);
-                    graph->rrefs[ref].insert(node);
-                }
-            if (graph->refs[node].empty())
-                goto doWork;
+            std::lock_guard<std::mutex> lock(graph[i].lock);
+            graph[i].done = true;
+            std::swap(rrefs, graph[i].rrefs);
         }
-    }
-
-        return;
 
-    doWork:
-        processNode(node);
+        left--;
 
         /* Enqueue work for all nodes that were waiting on this one
            and have no unprocessed dependencies. */
-        {
-            auto graph(graph_.lock());
-            for (auto & rref : graph->rrefs[node]) {
-                auto & refs(graph->refs[rref]);
-                auto i = refs.find(node);
-                assert(i != refs.end());
-                refs.erase(i);
-                if (refs.empty())
-                    pool.enqueue(std::bind(worker, rref));
-            }
-            graph->left.erase(node);
-            graph->refs.erase(node);
-            graph->rrefs.erase(node);
+        for (auto j : rrefs)
+            if (!--graph[j].remaining)
+                pool.enqueue([&doWork, j]() { doWork(j); });
+    };
+
+    auto getRefs = [&](size_t i) {
+        auto & node = graph[i];
+
+        for (auto & ref : getEdges(*index[i])) {
+            auto j = lookup(ref);
+            if (!j || *j == i)
+                continue;
+            auto & dep = graph[*j];
+            std::lock_guard<std::mutex> lock(dep.lock);
+            if (dep.done)
+                continue;
+            node.remaining++;
+            dep.rrefs.push_back(i);
         }
+
+        if (!--node.remaining)
+            doWork(i);
     };
 
-    for (auto & node : nodes) {
+    for (size_t i = 0; i < index.size(); ++i) {
         try {
-            pool.enqueue(std::bind(worker, std::ref(node)));
+            pool.enqueue([&getRefs, i]() { getRefs(i); });
         } catch (ThreadPoolShutDown &) {
             /* Stop if the thread pool is shutting down. It means a
                previous work item threw an exception, so process()
@@ -166,7 +294,7 @@ void processGraph(
 
     pool.process();
 
-    if (!graph_.lock()->left.empty())
+    if (left)
         throw Error("graph processing incomplete (cyclic reference?)");
 }
 
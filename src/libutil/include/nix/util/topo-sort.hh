@@ -4,6 +4,8 @@
 #include "nix/util/error.hh"
 #include <variant>
 #include <concepts>
+#include <cstdint>
+#include <vector>
 
 namespace nix {
 
@@ -65,4 +67,59 @@ TopoSortResult<T> topoSort(std::set<T, Compare> items, F && getChildren)
     return sorted;
 }
 
+/**
+ * Like `topoSort()`, but for a graph whose nodes are the integers `0`
+ * to `edges.size() - 1`, and where `edges[i]` are the children of `i`.
+ * The result is the same as that of `topoSort()` on the corresponding
+ * graph, but this avoids its set operations and recursion, so it is
+ * much cheaper on large graphs.
+ */
+template<std::unsigned_integral Id>
+TopoSortResult<Id> topoSortDense(const std::vector<std::vector<Id>> & edges)
+{
+    enum : uint8_t { unvisited, onStack, done };
+    std::vector<uint8_t> state(edges.size(), unvisited);
+
+    std::vector<Id> sorted;
+    sorted.reserve(edges.size());
+
+    /* The nodes being visited, and the index of the next child of each
+       to visit. */
+    std::vector<std::pair<Id, size_t>> stack;
+
+    for (size_t root = 0; root < edges.size(); ++root) {
+        if (state[root] != unvisited)
+            continue;
+        state[root] = onStack;
+        stack.emplace_back(root, 0);
+
+        while (!stack.empty()) {
+            auto [node, next] = stack.back();
+            auto & children = edges[node];
+
+            if (next == children.size()) {
+                state[node] = done;
+                sorted.push_back(node);
+                stack.pop_back();
+                continue;
+            }
+
+            stack.back().second++;
+            auto child = children[next];
+            if (child == node)
+                continue;
+            if (state[child] == onStack)
+                return Cycle<Id>{child, node};
+            if (state[child] == unvisited) {
+                state[child] = onStack;
+                stack.emplace_back(child, 0);
+            }
+        }
+    }
+
+    std::reverse(sorted.begin(), sorted.end());
+
+    return sorted;
+}
+
 } // namespace nix
@@ -0,0 +1,49 @@
+#pragma once
+///@file
+
+#include "nix/util/logging.hh"
+
+#include <array>
+
+namespace nix {
+
+/**
+ * A [W3C trace context](https://www.w3.org/TR/trace-context/):
+ * the trace and the span that some work belongs to.
+ */
+struct TraceParent
+{
+    std::array<uint8_t, 16> traceId;
+
+    uint64_t spanId;
+
+    /**
+     * Parse a `traceparent` header value.
+     *
+     * @return std::nullopt if `s` is not a valid version 00 trace
+     * context.
+     */
+    static std::optional<TraceParent> parse(std::string_view s);
+
+    std::string to_string() const;
+};
+
+/**
+ * The value to send as `trace-parent` to another process (such as the
+ * daemon) that does work on behalf of the activity `act`, or
+ * std::nullopt if tracing is not enabled in this process.
+ */
+std::optional<std::string> getTraceParent(ActivityId act = getCurActivity());
+
+/**
+ * Create a logger that writes an OpenTelemetry span to `path` for every
+ * activity of this process when it stops.
+ */
+std::unique_ptr<Logger> makeTracingLogger(const std::filesystem::path & path);
+
+/**
+ * Add a tracing logger to `logger` if `trace-file` is set.
+ */
+void applyTracingLogger();
+
+} // namespace nix
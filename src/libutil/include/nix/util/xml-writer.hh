@@ -1,28 +1,43 @@
 #pragma once
 ///@file
 
+#include "nix/util/serialise.hh"
+
 #include <iostream>
+#include <memory>
 #include <string>
-#include <list>
+#include <vector>
 #include <map>
 
 namespace nix {
 
 typedef std::map<std::string, std::string, std::less<>> XMLAttrs;
 
+/**
+ * Writes an XML document to a `Sink` as it is generated, without
+ * building it in memory first. The sink should be buffered (like
+ * `FdSink` or `StringSink`), since the document is written in small
+ * pieces.
+ */
 class XMLWriter
 {
 private:
 
-    std::ostream & output;
+    /**
+     * Adapter for the `std::ostream` constructor.
+     */
+    std::unique_ptr<Sink> streamSink;
+
+    Sink & sink;
 
     bool indent;
     bool closed;
 
-    std::list<std::string> pendingElems;
+    std::vector<std::string> pendingElems;
 
 public:
 
+    XMLWriter(bool indent, Sink & sink);
     XMLWriter(bool indent, std::ostream & output);
     ~XMLWriter();
 
@@ -73,6 +73,49 @@ CgroupStats getCgroupStats(const std::filesystem::path & cgroup)
         }
     }
 
+    auto memoryPeakPath = cgroup / "memory.peak";
+
+    if (pathExists(memoryPeakPath))
+        stats.memoryPeak = string2Int<uint64_t>(trim(readFile(memoryPeakPath)));
+
+    auto memoryCurrentPath = cgroup / "memory.current";
+
+    if (pathExists(memoryCurrentPath))
+        stats.memoryCurrent = string2Int<uint64_t>(trim(readFile(memoryCurrentPath)));
+
+    auto ioStatPath = cgroup / "io.stat";
+
+    if (pathExists(ioStatPath)) {
+        stats.ioRead = 0;
+        stats.ioWrite = 0;
+        for (auto & line : tokenizeString<std::vector<std::string>>(readFile(ioStatPath), "\n"))
+            for (auto & field : tokenizeString<std::vector<std::string>>(line, " ")) {
+                if (hasPrefix(field, "rbytes="))
+                    *stats.ioRead += string2Int<uint64_t>(field.substr(7)).value_or(0);
+                else if (hasPrefix(field, "wbytes="))
+                    *stats.ioWrite += string2Int<uint64_t>(field.substr(7)).value_or(0);
+            }
+    }
+
+    auto readStall = [&](const std::string & resource) -> std::optional<std::chrono::microseconds> {
+        auto pressurePath = cgroup / (resource + ".pressure");
+        if (!pathExists(pressurePath))
+            return std::nullopt;
+        for (auto & line : tokenizeString<std::vector<std::string>>(readFile(pressurePath), "\n")) {
+            if (!hasPrefix(line, "some "))
+                continue;
+            for (auto & field : tokenizeString<std::vector<std::string>>(line, " "))
+                if (hasPrefix(field, "total="))
+                    if (auto n = string2Int<uint64_t>(field.substr(6)))
+                        return std::chrono::microseconds(*n);
+        }
+        return std::nullopt;
+    };
+
+    stats.cpuStall = readStall("cpu");
+    stats.memoryStall = readStall("memory");
+    stats.ioStall = readStall("io");
+
     return stats;
 }
 
@@ -16,6 +16,29 @@ StringMap getCgroups(const std::filesystem::path & cgroupFile);
 struct CgroupStats
 {
     std::optional<std::chrono::microseconds> cpuUser, cpuSystem;
+
+    /**
+     * Peak memory usage in bytes, from `memory.peak`.
+     */
+    std::optional<uint64_t> memoryPeak;
+
+    /**
+     * Current memory usage in bytes, from `memory.current`.
+     */
+    std::optional<uint64_t> memoryCurrent;
+
+    /**
+     * Bytes read from and written to block devices, summed over the
+     * devices in `io.stat`.
+     */
+    std::optional<uint64_t> ioRead, ioWrite;
+
+    /**
+     * Total time during which some tasks were stalled on CPU, memory
+     * or I/O, from the `some` lines of `cpu.pressure`, `memory.pressure`
+     * and `io.pressure`.
+     */
+    std::optional<std::chrono::microseconds> cpuStall, memoryStall, ioStall;
 };
 
 /**
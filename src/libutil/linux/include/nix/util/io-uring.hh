@@ -0,0 +1,93 @@
+#pragma once
+///@file
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <sys/stat.h>
+
+namespace nix {
+
+/**
+ * Whether bulk file system operations (restoring and dumping NARs,
+ * deleting trees) should use io_uring. This is the case if the
+ * `use-io-uring` setting is enabled, Nix was built with liburing, and
+ * the kernel supports the required operations.
+ */
+bool useIoUring();
+
+/**
+ * A batch of independent file system operations that are submitted to
+ * an io_uring together, so that the kernel can process many of them
+ * concurrently. Operations are queued with the methods below, which
+ * return the index of the operation, and are executed by `submit()`.
+ * Any paths and buffers passed to them must stay valid until then.
+ */
+class IoUringBatch
+{
+public:
+
+    /**
+     * @param queueDepth The maximum number of operations in flight.
+     */
+    IoUringBatch(unsigned int queueDepth = 64);
+
+    ~IoUringBatch();
+
+    /**
+     * Like `openat2()` with `RESOLVE_BENEATH | RESOLVE_NO_SYMLINKS`,
+     * so `path` must not contain symlinks or escape `dirFd`.
+     */
+    size_t openBeneath(int dirFd, const char * path, int flags, mode_t mode = 0);
+
+    /**
+     * Like `statx()`.
+     */
+    size_t stat(int dirFd, const char * path, int flags, unsigned int mask, struct ::statx * buf);
+
+    size_t read(int fd, char * buf, size_t len, uint64_t offset);
+
+    size_t write(int fd, const char * buf, size_t len, uint64_t offset);
+
+    size_t close(int fd);
+
+    /**
+     * Like `unlinkat()`.
+     */
+    size_t unlink(int dirFd, const char * path, int flags);
+
+    /**
+     * Execute the queued operations and wait until all of them have
+     * finished.
+     */
+    void submit();
+
+    /**
+     * @return The result of operation `i` after `submit()`: the return
+     * value of the corresponding system call, or `-errno`.
+     */
+    int result(size_t i) const
+    {
+        return results.at(i);
+    }
+
+    size_t size() const;
+
+    /**
+     * Forget all operations and their results.
+     */
+    void clear();
+
+private:
+
+    struct Ring;
+    std::unique_ptr<Ring> ring;
+
+    struct Op;
+    std::vector<Op> ops;
+
+    std::vector<int> results;
+};
+
+} // namespace nix
@@ -0,0 +1,268 @@
+#include "nix/util/io-uring.hh"
+#include "nix/util/config-global.hh"
+#include "nix/util/error.hh"
+#include "nix/util/finally.hh"
+#include "nix/util/logging.hh"
+#include "nix/util/signals.hh"
+
+#include "util-config-private.hh"
+
+#include <linux/openat2.h>
+
+#if HAVE_LIBURING
+#  include <liburing.h>
+#endif
+
+namespace nix {
+
+struct IoUringSettings : Config
+{
+    Setting<bool> useIoUring{
+        this,
+        false,
+        "use-io-uring",
+        R"(
+          Whether to use io_uring for bulk file system operations, namely
+          for writing the small files of a NAR while unpacking it, for
+          reading the small files of a directory tree while serialising
+          it, and for deleting directory trees. This lets the kernel
+          process many of these operations concurrently.
+
+          This is only supported on Linux, if Nix was built with
+          liburing. It is ignored if the kernel doesn't support the
+          required io_uring operations (Linux 5.6 or newer).
+        )"};
+};
+
+static IoUringSettings ioUringSettings;
+
+static GlobalConfig::Register rIoUringSettings(&ioUringSettings);
+
+bool useIoUring()
+{
+#if HAVE_LIBURING
+    if (!ioUringSettings.useIoUring)
+        return false;
+
+    static bool supported = []() {
+        struct io_uring ring;
+        if (auto ret = io_uring_queue_init(2, &ring, 0); ret < 0) {
+            debug("not using io_uring: %s", SysError(-ret, "creating io_uring").msg());
+            return false;
+        }
+        Finally cleanup([&]() { io_uring_queue_exit(&ring); });
+
+        auto probe = io_uring_get_probe_ring(&ring);
+        if (!probe)
+            return false;
+        Finally freeProbe([&]() { io_uring_free_probe(probe); });
+
+        for (auto op :
+             {IORING_OP_OPENAT2, IORING_OP_STATX, IORING_OP_READ, IORING_OP_WRITE, IORING_OP_CLOSE, IORING_OP_UNLINKAT})
+            if (!io_uring_opcode_supported(probe, op)) {
+                debug("not using io_uring: the kernel doesn't support operation %d", op);
+                return false;
+            }
+
+        return true;
+    }();
+
+    return supported;
+#else
+    return false;
+#endif
+}
+
+struct IoUringBatch::Op
+{
+    enum { Open, Stat, Read, Write, Close, Unlink } type;
+
+    int fd;
+    const char * path = nullptr;
+    int flags = 0;
+    struct open_how how{};
+    unsigned int mask = 0;
+    struct ::statx * statxBuf = nullptr;
+    char * buf = nullptr;
+    size_t len = 0;
+    uint64_t offset = 0;
+};
+
+struct IoUringBatch::Ring
+{
+    unsigned int queueDepth;
+
+#if HAVE_LIBURING
+    struct io_uring ring;
+
+    Ring(unsigned int queueDepth)
+        : queueDepth(queueDepth)
+    {
+        if (auto ret = io_uring_queue_init(queueDepth, &ring, 0); ret < 0)
+            throw SysError(-ret, "creating io_uring");
+    }
+
+    ~Ring()
+    {
+        io_uring_queue_exit(&ring);
+    }
+
+    void prepare(struct io_uring_sqe * sqe, Op & op)
+    {
+        switch (op.type) {
+        case Op::Open:
+            io_uring_prep_openat2(sqe, op.fd, op.path, &op.how);
+            break;
+        case Op::Stat:
+            io_uring_prep_statx(sqe, op.fd, op.path, op.flags, op.mask, op.statxBuf);
+            break;
+        case Op::Read:
+            io_uring_prep_read(sqe, op.fd, op.buf, op.len, op.offset);
+            break;
+        case Op::Write:
+            io_uring_prep_write(sqe, op.fd, op.buf, op.len, op.offset);
+            break;
+        case Op::Close:
+            io_uring_prep_close(sqe, op.fd);
+            break;
+        case Op::Unlink:
+            io_uring_prep_unlinkat(sqe, op.fd, op.path, op.flags);
+            break;
+        }
+    }
+
+    /**
+     * Submit the operations that have been prepared, wait for at
+     * least `wait` completions, and record the results of all
+     * available completions.
+     *
+     * @return The number of completions.
+     */
+    unsigned int reap(unsigned int wait, std::vector<int> & results)
+    {
+        while (true) {
+            auto ret = io_uring_submit_and_wait(&ring, wait);
+            if (ret >= 0)
+                break;
+            if (ret != -EINTR)
+                throw SysError(-ret, "submitting io_uring operations");
+        }
+
+        struct io_uring_cqe * cqe;
+        unsigned int head, count = 0;
+        io_uring_for_each_cqe(&ring, head, cqe)
+        {
+            results[io_uring_cqe_get_data64(cqe)] = cqe->res;
+            ++count;
+        }
+        io_uring_cq_advance(&ring, count);
+        return count;
+    }
+#else
+    Ring(unsigned int queueDepth)
+        : queueDepth(queueDepth)
+    {
+        throw Error("this Nix was built without io_uring support");
+    }
+#endif
+};
+
+IoUringBatch::IoUringBatch(unsigned int queueDepth)
+    : ring(std::make_unique<Ring>(queueDepth))
+{
+}
+
+IoUringBatch::~IoUringBatch() = default;
+
+size_t IoUringBatch::openBeneath(int dirFd, const char * path, int flags, mode_t mode)
+{
+    ops.push_back(
+        {.type = Op::Open,
+         .fd = dirFd,
+         .path = path,
+         .how = {.flags = (uint64_t) flags, .mode = mode, .resolve = RESOLVE_BENEATH | RESOLVE_NO_SYMLINKS}});
+    return ops.size() - 1;
+}
+
+size_t IoUringBatch::stat(int dirFd, const char * path, int flags, unsigned int mask, struct ::statx * buf)
+{
+    ops.push_back({.type = Op::Stat, .fd = dirFd, .path = path, .flags = flags, .mask = mask, .statxBuf = buf});
+    return ops.size() - 1;
+}
+
+size_t IoUringBatch::read(int fd, char * buf, size_t len, uint64_t offset)
+{
+    ops.push_back({.type = Op::Read, .fd = fd, .buf = buf, .len = len, .offset = offset});
+    return ops.size() - 1;
+}
+
+size_t IoUringBatch::write(int fd, const char * buf, size_t len, uint64_t offset)
+{
+    ops.push_back({.type = Op::Write, .fd = fd, .buf = (char *) buf, .len = len, .offset = offset});
+    return ops.size() - 1;
+}
+
+size_t IoUringBatch::close(int fd)
+{
+    ops.push_back({.type = Op::Close, .fd = fd});
+    return ops.size() - 1;
+}
+
+size_t IoUringBatch::unlink(int dirFd, const char * path, int flags)
+{
+    ops.push_back({.type = Op::Unlink, .fd = dirFd, .path = path, .flags = flags});
+    return ops.size() - 1;
+}
+
+void IoUringBatch::submit()
+{
+#if HAVE_LIBURING
+    results.assign(ops.size(), 0);
+
+    size_t next = 0;
+    unsigned int inFlight = 0;
+
+    /* Wait for the operations in flight before propagating an
+       exception, since the kernel may still access their buffers. */
+    auto drain = [&]() {
+        while (inFlight)
+            inFlight -= ring->reap(inFlight, results);
+    };
+
+    while (next < ops.size() || inFlight) {
+        /* Keep the ring full. */
+        while (next < ops.size() && inFlight < ring->queueDepth) {
+            auto sqe = io_uring_get_sqe(&ring->ring);
+            if (!sqe)
+                break;
+            ring->prepare(sqe, ops[next]);
+            io_uring_sqe_set_data64(sqe, next);
+            ++next;
+            ++inFlight;
+        }
+
+        try {
+            inFlight -= ring->reap(1, results);
+            checkInterrupt();
+        } catch (...) {
+            drain();
+            throw;
+        }
+    }
+#else
+    throw Error("this Nix was built without io_uring support");
+#endif
+}
+
+size_t IoUringBatch::size() const
+{
+    return ops.size();
+}
+
+void IoUringBatch::clear()
+{
+    ops.clear();
+    results.clear();
+}
+
+} // namespace nix
@@ -1,5 +1,6 @@
 #include "nix/util/logging.hh"
 #include "nix/util/file-descriptor.hh"
+#include "nix/util/mpsc-queue.hh"
 #include "nix/util/environment-variables.hh"
 #include "nix/util/terminal.hh"
 #include "nix/util/util.hh"
@@ -10,7 +11,10 @@
 #include "nix/util/unix-domain-socket.hh"
 
 #include <atomic>
+#include <mutex>
+#include <set>
 #include <sstream>
+#include <thread>
 #include <nlohmann/json.hpp>
 #include <iostream>
 
@@ -206,14 +210,287 @@ void to_json(nlohmann::json & json, std::shared_ptr<const Pos> pos)
     }
 }
 
+/**
+ * Return the length of the well-formed UTF-8 sequence at the start of
+ * `s`, or 0 if there is none.
+ */
+static size_t utf8SequenceLength(std::string_view s)
+{
+    unsigned char c = s[0];
+    size_t n;
+    uint32_t cp;
+    if (c >= 0xc2 && c <= 0xdf)
+        n = 2, cp = c & 0x1f;
+    else if (c >= 0xe0 && c <= 0xef)
+        n = 3, cp = c & 0x0f;
+    else if (c >= 0xf0 && c <= 0xf4)
+        n = 4, cp = c & 0x07;
+    else
+        return 0;
+    if (s.size() < n)
+        return 0;
+    for (size_t i = 1; i < n; ++i) {
+        unsigned char d = s[i];
+        if ((d & 0xc0) != 0x80)
+            return 0;
+        cp = (cp << 6) | (d & 0x3f);
+    }
+    if ((n == 3 && (cp < 0x800 || (cp >= 0xd800 && cp <= 0xdfff))) || (n == 4 && (cp < 0x10000 || cp > 0x10ffff)))
+        return 0;
+    return n;
+}
+
+/**
+ * Appends log events to a buffer, either as JSON objects on a line of
+ * their own, or as CBOR maps (i.e. a CBOR sequence). This lets us
+ * write the frequent activity events without building a
+ * `nlohmann::json` object for each of them.
+ */
+struct LogEventWriter
+{
+    std::string & out;
+    StructuredLogFormat format;
+    bool includeNixPrefix;
+
+    /**
+     * Whether the next JSON object key or array element is the first
+     * one.
+     */
+    bool first = true;
+
+    void head(uint8_t major, uint64_t n)
+    {
+        major <<= 5;
+        auto bigEndian = [&](uint8_t info, int bytes) {
+            out.push_back(major | info);
+            for (int i = bytes - 1; i >= 0; --i)
+                out.push_back((char) (n >> (i * 8)));
+        };
+        if (n < 24)
+            out.push_back(major | n);
+        else if (n <= 0xff)
+            bigEndian(24, 1);
+        else if (n <= 0xffff)
+            bigEndian(25, 2);
+        else if (n <= 0xffffffff)
+            bigEndian(26, 4);
+        else
+            bigEndian(27, 8);
+    }
+
+    void separator()
+    {
+        if (!first)
+            out.push_back(',');
+        first = false;
+    }
+
+    void beginEvent(size_t nrKeys)
+    {
+        if (format == StructuredLogFormat::CBOR)
+            head(5, nrKeys);
+        else {
+            if (includeNixPrefix)
+                out.append("@nix ");
+            out.push_back('{');
+            first = true;
+        }
+    }
+
+    void endEvent()
+    {
+        if (format == StructuredLogFormat::JSON)
+            out.append("}\n");
+    }
+
+    void key(std::string_view k)
+    {
+        if (format == StructuredLogFormat::JSON)
+            separator();
+        string(k);
+        if (format == StructuredLogFormat::JSON)
+            out.push_back(':');
+    }
+
+    /**
+     * Write a string. In JSON, invalid UTF-8 is replaced by U+FFFD,
+     * like `nlohmann::json::error_handler_t::replace` does.
+     */
+    void string(std::string_view s)
+    {
+        if (format == StructuredLogFormat::CBOR) {
+            head(3, s.size());
+            out.append(s);
+            return;
+        }
+
+        out.push_back('"');
+        for (size_t i = 0; i < s.size();) {
+            unsigned char c = s[i];
+            if (c >= 0x80) {
+                if (auto n = utf8SequenceLength(s.substr(i))) {
+                    out.append(s.substr(i, n));
+                    i += n;
+                } else {
+                    out.append("\xef\xbf\xbd");
+                    ++i;
+                }
+                continue;
+            }
+            switch (c) {
+            case '"':
+                out.append("\\\"");
+                break;
+            case '\\':
+                out.append("\\\\");
+                break;
+            case '\b':
+                out.append("\\b");
+                break;
+            case '\f':
+                out.append("\\f");
+                break;
+            case '\n':
+                out.append("\\n");
+                break;
+            case '\r':
+                out.append("\\r");
+                break;
+            case '\t':
+                out.append("\\t");
+                break;
+            default:
+                if (c < 0x20) {
+                    static constexpr char hex[] = "0123456789abcdef";
+                    out.append("\\u00");
+                    out.push_back(hex[c >> 4]);
+                    out.push_back(hex[c & 0xf]);
+                } else
+                    out.push_back(c);
+            }
+            ++i;
+        }
+        out.push_back('"');
+    }
+
+    void number(uint64_t n)
+    {
+        if (format == StructuredLogFormat::CBOR)
+            head(0, n);
+        else
+            out.append(std::to_string(n));
+    }
+
+    void fields(const Logger::Fields & fields)
+    {
+        if (format == StructuredLogFormat::CBOR)
+            head(4, fields.size());
+        else {
+            out.push_back('[');
+            first = true;
+        }
+        for (auto & f : fields) {
+            if (format == StructuredLogFormat::JSON)
+                separator();
+            if (f.type == Logger::Field::tInt)
+                number(f.i);
+            else if (f.type == Logger::Field::tString)
+                string(f.s);
+            else
+                unreachable();
+        }
+        if (format == StructuredLogFormat::JSON) {
+            out.push_back(']');
+            first = false;
+        }
+    }
+
+    /* The keys of each event are in alphabetical order, like
+       `nlohmann::json` would write them. */
+
+    void startActivity(
+        ActivityId act,
+        Verbosity lvl,
+        ActivityType type,
+        std::string_view s,
+        const Logger::Fields & fields,
+        ActivityId parent)
+    {
+        beginEvent(fields.empty() ? 6 : 7);
+        key("action");
+        string("start");
+        if (!fields.empty()) {
+            key("fields");
+            this->fields(fields);
+        }
+        key("id");
+        number(act);
+        key("level");
+        number(lvl);
+        key("parent");
+        number(parent);
+        key("text");
+        string(s);
+        key("type");
+        number(type);
+        endEvent();
+    }
+
+    void stopActivity(ActivityId act)
+    {
+        beginEvent(2);
+        key("action");
+        string("stop");
+        key("id");
+        number(act);
+        endEvent();
+    }
+
+    void result(ActivityId act, ResultType type, const Logger::Fields & fields)
+    {
+        beginEvent(fields.empty() ? 3 : 4);
+        key("action");
+        string("result");
+        if (!fields.empty()) {
+            key("fields");
+            this->fields(fields);
+        }
+        key("id");
+        number(act);
+        key("type");
+        number(type);
+        endEvent();
+    }
+
+    void event(const nlohmann::json & json)
+    {
+        if (format == StructuredLogFormat::CBOR) {
+            auto cbor = nlohmann::json::to_cbor(json);
+            out.append(cbor.begin(), cbor.end());
+        } else {
+            if (includeNixPrefix)
+                out.append("@nix ");
+            out.append(json.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace));
+            out.push_back('\n');
+        }
+    }
+};
+
 struct JSONLogger : Logger
 {
     Descriptor fd;
     bool includeNixPrefix;
+    StructuredLogFormat format;
+
+    /**
+     * Set if this logger owns `fd`.
+     */
+    AutoCloseFD ownedFd;
 
-    JSONLogger(Descriptor fd, bool includeNixPrefix)
+    JSONLogger(Descriptor fd, bool includeNixPrefix, StructuredLogFormat format = StructuredLogFormat::JSON)
         : fd(fd)
         , includeNixPrefix(includeNixPrefix)
+        , format(format)
     {
     }
 
@@ -222,18 +499,9 @@ struct JSONLogger : Logger
         return true;
     }
 
-    void addFields(nlohmann::json & json, const Fields & fields)
+    LogEventWriter writer(std::string & out)
     {
-        if (fields.empty())
-            return;
-        auto & arr = json["fields"] = nlohmann::json::array();
-        for (auto & f : fields)
-            if (f.type == Logger::Field::tInt)
-                arr.push_back(f.i);
-            else if (f.type == Logger::Field::tString)
-                arr.push_back(f.s);
-            else
-                unreachable();
+        return {.out = out, .format = format, .includeNixPrefix = includeNixPrefix};
     }
 
     struct State
@@ -243,17 +511,17 @@ struct JSONLogger : Logger
 
     Sync<State> _state;
 
-    void write(const nlohmann::json & json)
+    /**
+     * Write a sequence of encoded events to `fd`.
+     */
+    void writeEncoded(std::string_view data)
     {
-        auto line =
-            (includeNixPrefix ? "@nix " : "") + json.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace);
-
         /* Acquire a lock to prevent log messages from clobbering each
            other. */
         try {
             auto state(_state.lock());
             if (state->enabled)
-                writeLine(fd, line);
+                writeFull(fd, data);
         } catch (...) {
             bool enabled = false;
             std::swap(_state.lock()->enabled, enabled);
@@ -264,6 +532,13 @@ struct JSONLogger : Logger
         }
     }
 
+    virtual void write(const nlohmann::json & json)
+    {
+        std::string out;
+        writer(out).event(json);
+        writeEncoded(out);
+    }
+
     void log(Verbosity lvl, std::string_view s) override
     {
         nlohmann::json json;
@@ -308,33 +583,262 @@ struct JSONLogger : Logger
         const Fields & fields,
         ActivityId parent) override
     {
-        nlohmann::json json;
-        json["action"] = "start";
-        json["id"] = act;
-        json["level"] = lvl;
-        json["type"] = type;
-        json["text"] = s;
-        json["parent"] = parent;
-        addFields(json, fields);
-        write(json);
+        std::string out;
+        writer(out).startActivity(act, lvl, type, s, fields, parent);
+        writeEncoded(out);
     }
 
     void stopActivity(ActivityId act) override
     {
-        nlohmann::json json;
-        json["action"] = "stop";
-        json["id"] = act;
-        write(json);
+        std::string out;
+        writer(out).stopActivity(act);
+        writeEncoded(out);
     }
 
     void result(ActivityId act, ResultType type, const Fields & fields) override
     {
-        nlohmann::json json;
-        json["action"] = "result";
-        json["id"] = act;
-        json["type"] = type;
-        addFields(json, fields);
-        write(json);
+        std::string out;
+        writer(out).result(act, type, fields);
+        writeEncoded(out);
+    }
+};
+
+#ifndef _WIN32
+/**
+ * Incremented in the child after every fork(), so that a logger can
+ * tell that its writer thread doesn't exist in the current process.
+ */
+static std::atomic<unsigned int> forkGeneration{0};
+#endif
+
+/**
+ * A `JSONLogger` that queues activity events in a lock-free ring
+ * buffer, from which a writer thread formats and writes them in
+ * batches. Progress updates that are superseded by a later update in
+ * the same batch are dropped. Messages flush the queue and are written
+ * synchronously, so that they aren't lost if the process dies.
+ */
+struct AsyncJSONLogger : JSONLogger
+{
+    struct Event
+    {
+        enum Kind : uint8_t { Start, Stop, Result, Encoded } kind;
+
+        ActivityId act = 0;
+        Verbosity lvl = lvlError;
+        ActivityType actType = actUnknown;
+        ResultType resType = resFileLinked;
+        ActivityId parent = 0;
+
+        /**
+         * The text of an activity, or the encoding of an `Encoded`
+         * event.
+         */
+        std::string text;
+
+        Fields fields;
+    };
+
+    BoundedMPSCQueue<Event> queue{8192};
+
+    /**
+     * Bumped after pushing to `queue` to wake up the writer thread.
+     */
+    std::atomic<uint32_t> pushed{0};
+
+    std::atomic<bool> quit{false};
+
+    /**
+     * Held while draining the queue, since it only supports one
+     * consumer. It is recursive because a write error logs a warning,
+     * which may come back to this logger.
+     */
+    std::recursive_mutex consumer;
+
+    std::thread writerThread;
+
+#ifndef _WIN32
+    unsigned int generation;
+#endif
+
+    AsyncJSONLogger(Descriptor fd, bool includeNixPrefix, StructuredLogFormat format)
+        : JSONLogger(fd, includeNixPrefix, format)
+    {
+#ifndef _WIN32
+        static std::once_flag registered;
+        std::call_once(registered, []() { pthread_atfork(nullptr, nullptr, []() { forkGeneration++; }); });
+        generation = forkGeneration;
+#endif
+        writerThread = std::thread([this]() { writerLoop(); });
+    }
+
+    ~AsyncJSONLogger()
+    {
+        stop();
+    }
+
+    /**
+     * Whether we're in a forked child, where the writer thread
+     * doesn't exist and the locks may be held by threads that don't
+     * exist either. Then we write directly without locking.
+     */
+    bool forked() const
+    {
+#ifndef _WIN32
+        return generation != forkGeneration.load(std::memory_order_relaxed);
+#else
+        return false;
+#endif
+    }
+
+    void stop() override
+    {
+        if (forked()) {
+            if (writerThread.joinable())
+                writerThread.detach();
+            return;
+        }
+        if (!writerThread.joinable())
+            return;
+        quit = true;
+        pushed.fetch_add(1, std::memory_order_release);
+        pushed.notify_one();
+        writerThread.join();
+        drain();
+    }
+
+    void writerLoop()
+    {
+        uint32_t seen = 0;
+        while (true) {
+            pushed.wait(seen, std::memory_order_acquire);
+            /* Give other events a moment to arrive, so that we write
+               them in one go. */
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            seen = pushed.load(std::memory_order_acquire);
+            drain();
+            if (quit)
+                return;
+        }
+    }
+
+    void push(Event && event)
+    {
+        while (!queue.tryPush(std::move(event)))
+            drain();
+        /* Once stopped, there is no writer thread to do it. */
+        if (quit) {
+            drain();
+            return;
+        }
+        pushed.fetch_add(1, std::memory_order_release);
+        pushed.notify_one();
+    }
+
+    void drain()
+    {
+        std::lock_guard lock(consumer);
+
+        std::vector<Event> batch;
+        while (auto event = queue.tryPop())
+            batch.push_back(std::move(*event));
+        if (batch.empty())
+            return;
+
+        /* Progress updates carry absolute values, so only the last
+           update of each kind for an activity matters. */
+        std::set<std::tuple<ActivityId, ResultType, uint64_t>> seen;
+        std::vector<bool> superseded(batch.size(), false);
+        for (size_t i = batch.size(); i-- > 0;) {
+            auto & event = batch[i];
+            if (event.kind != Event::Result || (event.resType != resProgress && event.resType != resSetExpected))
+                continue;
+            auto sub = event.resType == resSetExpected && !event.fields.empty() ? event.fields[0].i : 0;
+            superseded[i] = !seen.emplace(event.act, event.resType, sub).second;
+        }
+
+        std::string out;
+        auto w = writer(out);
+        for (size_t i = 0; i < batch.size(); ++i) {
+            auto & event = batch[i];
+            if (superseded[i])
+                continue;
+            switch (event.kind) {
+            case Event::Start:
+                w.startActivity(event.act, event.lvl, event.actType, event.text, event.fields, event.parent);
+                break;
+            case Event::Stop:
+                w.stopActivity(event.act);
+                break;
+            case Event::Result:
+                w.result(event.act, event.resType, event.fields);
+                break;
+            case Event::Encoded:
+                out.append(event.text);
+                break;
+            }
+        }
+
+        writeEncoded(out);
+    }
+
+    void write(const nlohmann::json & json) override
+    {
+        std::string out;
+        writer(out).event(json);
+        if (forked()) {
+            writeDirect(out);
+            return;
+        }
+        push({.kind = Event::Encoded, .text = std::move(out)});
+        drain();
+    }
+
+    void writeDirect(std::string_view data)
+    {
+        try {
+            writeFull(fd, data, false);
+        } catch (...) {
+        }
+    }
+
+    void startActivity(
+        ActivityId act,
+        Verbosity lvl,
+        ActivityType type,
+        const std::string & s,
+        const Fields & fields,
+        ActivityId parent) override
+    {
+        if (forked()) {
+            std::string out;
+            writer(out).startActivity(act, lvl, type, s, fields, parent);
+            writeDirect(out);
+            return;
+        }
+        push({.kind = Event::Start, .act = act, .lvl = lvl, .actType = type, .parent = parent, .text = s, .fields = fields});
+    }
+
+    void stopActivity(ActivityId act) override
+    {
+        if (forked()) {
+            std::string out;
+            writer(out).stopActivity(act);
+            writeDirect(out);
+            return;
+        }
+        push({.kind = Event::Stop, .act = act});
+    }
+
+    void result(ActivityId act, ResultType type, const Fields & fields) override
+    {
+        if (forked()) {
+            std::string out;
+            writer(out).result(act, type, fields);
+            writeDirect(out);
+            return;
+        }
+        push({.kind = Event::Result, .act = act, .resType = type, .fields = fields});
     }
 };
 
@@ -345,24 +849,20 @@ std::unique_ptr<Logger> makeJSONLogger(Descriptor fd, bool includeNixPrefix)
 
 std::unique_ptr<Logger> makeJSONLogger(const std::filesystem::path & path, bool includeNixPrefix)
 {
-    struct JSONFileLogger : JSONLogger
-    {
-        AutoCloseFD fd;
-
-        JSONFileLogger(AutoCloseFD && fd, bool includeNixPrefix)
-            : JSONLogger(fd.get(), includeNixPrefix)
-            , fd(std::move(fd))
-        {
-        }
-    };
-
     AutoCloseFD fd = std::filesystem::is_socket(path)
                          ? connect(path)
                          : toDescriptor(open(path.string().c_str(), O_CREAT | O_APPEND | O_WRONLY, 0644));
     if (!fd)
         throw SysError("opening log file %1%", path);
 
-    return std::make_unique<JSONFileLogger>(std::move(fd), includeNixPrefix);
+    auto logger = std::make_unique<AsyncJSONLogger>(fd.get(), includeNixPrefix, StructuredLogFormat::JSON);
+    logger->ownedFd = std::move(fd);
+    return logger;
+}
+
+std::unique_ptr<Logger> makeStructuredLogger(Descriptor fd, StructuredLogFormat format, bool includeNixPrefix)
+{
+    return std::make_unique<AsyncJSONLogger>(fd, includeNixPrefix, format);
 }
 
 void applyJSONLogger()
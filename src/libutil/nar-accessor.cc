@@ -1,6 +1,8 @@
 #include "nix/util/nar-accessor.hh"
 #include "nix/util/file-descriptor.hh"
 #include "nix/util/archive.hh"
+#include "nix/util/serialise.hh"
+#include "nix/util/util.hh"
 
 #include <map>
 #include <stack>
@@ -127,6 +129,14 @@ struct NarAccessor : public SourceAccessor
             pos += n;
             return n;
         }
+
+        /* File contents are skipped, which lets the source seek over
+           them if it can. */
+        void skip(size_t len) override
+        {
+            source.skip(len);
+            pos += len;
+        }
     };
 
     NarAccessor(std::string && _nar)
@@ -175,6 +185,33 @@ struct NarAccessor : public SourceAccessor
         }(root, listing);
     }
 
+    NarAccessor(const NarListing & listing, GetNarBytes getNarBytes)
+        : getNarBytes(std::move(getNarBytes))
+    {
+        [&](this const auto & recurse, NarMember & member, const NarListing & object) -> void {
+            std::visit(
+                overloaded{
+                    [&](const NarListing::Regular & regular) {
+                        member.stat = {
+                            .type = Type::tRegular,
+                            .fileSize = regular.contents.fileSize,
+                            .isExecutable = regular.executable,
+                            .narOffset = regular.contents.narOffset.value_or(0)};
+                    },
+                    [&](const NarListing::Directory & dir) {
+                        member.stat = {.type = Type::tDirectory};
+                        for (auto & [name, child] : dir.entries)
+                            recurse(member.children[name], child);
+                    },
+                    [&](const NarListing::Symlink & symlink) {
+                        member.stat = {.type = Type::tSymlink};
+                        member.target = symlink.target;
+                    },
+                },
+                object.raw);
+        }(root, listing);
+    }
+
     NarMember * find(const CanonPath & path)
     {
         NarMember * current = &root;
@@ -234,6 +271,23 @@ struct NarAccessor : public SourceAccessor
         return std::string(*nar, *i.stat.narOffset, *i.stat.fileSize);
     }
 
+    std::string readFileRange(const CanonPath & path, uint64_t offset, uint64_t length) override
+    {
+        auto i = get(path);
+        if (i.stat.type != Type::tRegular)
+            throw Error("path '%1%' inside NAR file is not a regular file", path);
+
+        if (offset >= *i.stat.fileSize)
+            return "";
+        length = std::min(length, *i.stat.fileSize - offset);
+
+        if (getNarBytes)
+            return getNarBytes(*i.stat.narOffset + offset, length);
+
+        assert(nar);
+        return std::string(*nar, *i.stat.narOffset + offset, length);
+    }
+
     std::string readLink(const CanonPath & path) override
     {
         auto i = get(path);
@@ -258,11 +312,32 @@ ref<SourceAccessor> makeLazyNarAccessor(const nlohmann::json & listing, GetNarBy
     return make_ref<NarAccessor>(listing, getNarBytes);
 }
 
+ref<SourceAccessor> makeLazyNarAccessor(const NarListing & listing, GetNarBytes getNarBytes)
+{
+    return make_ref<NarAccessor>(listing, std::move(getNarBytes));
+}
+
 ref<SourceAccessor> makeLazyNarAccessor(Source & source, GetNarBytes getNarBytes)
 {
     return make_ref<NarAccessor>(source, getNarBytes);
 }
 
+ref<SourceAccessor> openNarAccessor(const Path & path)
+{
+    AutoCloseFD fd = toDescriptor(open(
+        path.c_str(),
+        O_RDONLY
+#ifdef O_CLOEXEC
+            | O_CLOEXEC
+#endif
+        ));
+    if (!fd)
+        throw SysError("opening NAR file '%s'", path);
+
+    FdSource source(fd.get());
+    return makeLazyNarAccessor(source, seekableGetNarBytes(path));
+}
+
 GetNarBytes seekableGetNarBytes(const Path & path)
 {
     AutoCloseFD fd = toDescriptor(open(
@@ -282,11 +357,28 @@ GetNarBytes seekableGetNarBytes(const Path & path)
 GetNarBytes seekableGetNarBytes(Descriptor fd)
 {
     return [fd](uint64_t offset, uint64_t length) {
+        std::string buf(length, 0);
+
+#ifndef _WIN32
+        /* Use pread() rather than seeking, so that several threads can
+           read from the NAR at the same time. */
+        for (size_t done = 0; done < length;) {
+            auto n = pread(fd, buf.data() + done, length - done, offset + done);
+            if (n == -1) {
+                if (errno == EINTR)
+                    continue;
+                throw SysError("reading from NAR file");
+            }
+            if (n == 0)
+                throw EndOfFile("unexpected end-of-file");
+            done += n;
+        }
+#else
         if (lseek(fd, offset, SEEK_SET) == -1)
             throw SysError("seeking in file");
 
-        std::string buf(length, 0);
         readFull(fd, buf.data(), length);
+#endif
 
         return buf;
     };
@@ -344,4 +436,77 @@ ShallowNarListing listNarShallow(SourceAccessor & accessor, const CanonPath & pa
     return listNarImpl<false>(accessor, path);
 }
 
+static constexpr std::string_view narListingMagic = "nix-nar-listing-1";
+
+enum struct NarListingTag : uint64_t {
+    Regular = 1,
+    Executable = 2,
+    Directory = 3,
+    Symlink = 4,
+};
+
+void writeNarListingBinary(const NarListing & listing, Sink & sink)
+{
+    sink << narListingMagic;
+
+    [&](this const auto & writeObject, const NarListing & object) -> void {
+        std::visit(
+            overloaded{
+                [&](const NarListing::Regular & regular) {
+                    sink << (uint64_t) (regular.executable ? NarListingTag::Executable : NarListingTag::Regular)
+                         << regular.contents.fileSize.value_or(0) << regular.contents.narOffset.value_or(0);
+                },
+                [&](const NarListing::Directory & dir) {
+                    sink << (uint64_t) NarListingTag::Directory << dir.entries.size();
+                    for (auto & [name, child] : dir.entries) {
+                        sink << name;
+                        writeObject(child);
+                    }
+                },
+                [&](const NarListing::Symlink & symlink) {
+                    sink << (uint64_t) NarListingTag::Symlink << symlink.target;
+                },
+            },
+            object.raw);
+    }(listing);
+}
+
+NarListing readNarListingBinary(Source & source)
+{
+    if (readString(source, narListingMagic.size()) != narListingMagic)
+        throw Error("input is not a binary NAR listing");
+
+    return [&](this const auto & readObject) -> NarListing {
+        auto tag = readNum<uint64_t>(source);
+        switch ((NarListingTag) tag) {
+        case NarListingTag::Regular:
+        case NarListingTag::Executable: {
+            auto fileSize = readNum<uint64_t>(source);
+            auto narOffset = readNum<uint64_t>(source);
+            return NarListing::Regular{
+                .executable = tag == (uint64_t) NarListingTag::Executable,
+                .contents =
+                    NarListingRegularFile{
+                        .fileSize = fileSize,
+                        .narOffset = narOffset ? std::optional{narOffset} : std::nullopt,
+                    },
+            };
+        }
+        case NarListingTag::Directory: {
+            NarListing::Directory dir;
+            auto count = readNum<uint64_t>(source);
+            for (uint64_t i = 0; i < count; ++i) {
+                auto name = readString(source);
+                dir.entries.insert_or_assign(std::move(name), readObject());
+            }
+            return dir;
+        }
+        case NarListingTag::Symlink:
+            return NarListing::Symlink{.target = readString(source)};
+        default:
+            throw Error("invalid object type %d in binary NAR listing", tag);
+        }
+    }();
+}
+
 } // namespace nix
@@ -9,8 +9,10 @@
   libblake3,
   libcpuid,
   libsodium,
+  liburing,
   nlohmann_json,
   openssl,
+  xz,
 
   # Configuration Options
 
@@ -52,8 +54,10 @@ mkMesonLibrary (finalAttrs: {
     libblake3
     libsodium
     openssl
+    xz
   ]
-  ++ lib.optional stdenv.hostPlatform.isx86_64 libcpuid;
+  ++ lib.optional stdenv.hostPlatform.isx86_64 libcpuid
+  ++ lib.optional stdenv.hostPlatform.isLinux liburing;
 
   propagatedBuildInputs = [
     boost
@@ -63,6 +67,7 @@ mkMesonLibrary (finalAttrs: {
 
   mesonFlags = [
     (lib.mesonEnable "cpuid" stdenv.hostPlatform.isx86_64)
+    (lib.mesonEnable "liburing" stdenv.hostPlatform.isLinux)
   ];
 
   meta = {
@@ -4,6 +4,46 @@
 
 namespace nix {
 
+PosTable::Lines::Lines(std::string_view content)
+{
+    std::vector<uint32_t> starts;
+    const char * begin = content.data();
+    for (Pos::LinesIterator it(content), end; it != end; it++)
+        starts.push_back(it->data() - begin);
+    /* The first line starts at byte 0 and is always present. */
+    if (starts.empty())
+        starts.push_back(0);
+
+    for (size_t i = 0; i < starts.size(); i += linesPerBlock) {
+        auto last = starts[std::min(i + linesPerBlock, starts.size()) - 1];
+        if (last - starts[i] > UINT16_MAX) {
+            wide = std::move(starts);
+            blockStarts.clear();
+            deltas.clear();
+            return;
+        }
+        blockStarts.push_back(starts[i]);
+        for (size_t j = i; j < std::min(i + linesPerBlock, starts.size()); ++j)
+            deltas.push_back(starts[j] - starts[i]);
+    }
+}
+
+std::pair<size_t, uint32_t> PosTable::Lines::find(uint32_t offset) const
+{
+    if (!wide.empty()) {
+        auto i = std::prev(std::upper_bound(wide.begin(), wide.end(), offset));
+        return {i - wide.begin(), *i};
+    }
+
+    auto block = std::prev(std::upper_bound(blockStarts.begin(), blockStarts.end(), offset));
+    auto first = deltas.begin() + (block - blockStarts.begin()) * linesPerBlock;
+    auto last = first + std::min<size_t>(linesPerBlock, deltas.end() - first);
+    /* Offsets past 64 KiB into the block can only be on its last line. */
+    auto delta = std::min<uint32_t>(offset - *block, UINT16_MAX);
+    auto i = std::prev(std::upper_bound(first, last, delta));
+    return {i - deltas.begin(), *block + *i};
+}
+
 /* Position table. */
 
 Pos PosTable::operator[](PosIdx p) const
@@ -20,31 +60,18 @@ Pos PosTable::operator[](PosIdx p) const
     /* Try the origin's line cache */
     const auto * linesForInput = linesCache->getOrNullptr(origin->offset);
 
-    auto fillCacheForOrigin = [](std::string_view content) {
-        auto contentLines = Lines();
-
-        const char * begin = content.data();
-        for (Pos::LinesIterator it(content), end; it != end; it++)
-            contentLines.push_back(it->data() - begin);
-        if (contentLines.empty())
-            contentLines.push_back(0);
-
-        return contentLines;
-    };
-
     /* Calculate line offsets and fill the cache */
     if (!linesForInput) {
         auto originContent = result.getSource().value_or("");
-        linesCache->upsert(origin->offset, fillCacheForOrigin(originContent));
+        linesCache->upsert(origin->offset, Lines(originContent));
         linesForInput = linesCache->getOrNullptr(origin->offset);
     }
 
     assert(linesForInput);
 
-    // as above: the first line starts at byte 0 and is always present
-    auto lineStartOffset = std::prev(std::upper_bound(linesForInput->begin(), linesForInput->end(), offset));
-    result.line = 1 + (lineStartOffset - linesForInput->begin());
-    result.column = 1 + (offset - *lineStartOffset);
+    auto [line, lineStart] = linesForInput->find(offset);
+    result.line = 1 + line;
+    result.column = 1 + (offset - lineStart);
     return result;
 }
 
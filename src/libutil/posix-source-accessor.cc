@@ -1,12 +1,37 @@
 #include "nix/util/posix-source-accessor.hh"
 #include "nix/util/source-path.hh"
+#include "nix/util/sharded-cache.hh"
 #include "nix/util/signals.hh"
-#include "nix/util/sync.hh"
-
-#include <boost/unordered/concurrent_flat_map.hpp>
 
 namespace nix {
 
+namespace {
+
+/**
+ * Process-wide caches of lstat() results and directory listings,
+ * keyed by absolute path. They are shared by all
+ * `PosixSourceAccessor`s.
+ */
+struct FSCache
+{
+    ShardedCache<Path, std::optional<struct stat>> stats{1 << 16};
+
+    /**
+     * Only listings of directories that aren't writable (such as
+     * those in the Nix store) are cached, since other directories
+     * can change behind our back.
+     */
+    ShardedCache<Path, std::shared_ptr<const SourceAccessor::DirEntries>> listings{1 << 12};
+};
+
+FSCache & fsCache()
+{
+    static FSCache cache;
+    return cache;
+}
+
+} // namespace
+
 PosixSourceAccessor::PosixSourceAccessor(std::filesystem::path && argRoot, bool trackLastModified)
     : root(std::move(argRoot))
     , trackLastModified(trackLastModified)
@@ -63,6 +88,10 @@ void PosixSourceAccessor::readFile(const CanonPath & path, Sink & sink, std::fun
 
     off_t left = st.st_size;
 
+    /* Let the sink copy the contents straight from the file if it
+       can, e.g. when it's a socket. */
+    left -= sink.writeFromFd(fd.get(), left);
+
     std::array<unsigned char, 64 * 1024> buf;
     while (left) {
         checkInterrupt();
@@ -84,30 +113,43 @@ bool PosixSourceAccessor::pathExists(const CanonPath & path)
 {
     if (auto parent = path.parent())
         assertNoSymlinks(*parent);
-    return nix::pathExists(makeAbsPath(path).string());
+    return cachedLstat(path).has_value();
 }
 
 std::optional<struct stat> PosixSourceAccessor::cachedLstat(const CanonPath & path)
 {
-    using Cache = boost::concurrent_flat_map<Path, std::optional<struct stat>>;
-    static Cache cache;
-
     // Note: we convert std::filesystem::path to Path because the
     // former is not hashable on libc++.
     Path absPath = makeAbsPath(path).string();
 
-    if (auto res = getConcurrent(cache, absPath))
+    auto & cache = fsCache().stats;
+
+    if (auto res = cache.get(absPath))
         return *res;
 
     auto st = nix::maybeLstat(absPath.c_str());
 
-    if (cache.size() >= 16384)
-        cache.clear();
-    cache.emplace(std::move(absPath), st);
+    cache.upsert(absPath, st);
 
     return st;
 }
 
+void PosixSourceAccessor::invalidateCache(const std::filesystem::path & path)
+{
+    auto & cache = fsCache();
+    cache.stats.erase(path.string());
+    cache.listings.erase(path.string());
+    if (path.has_relative_path())
+        cache.listings.erase(path.parent_path().string());
+}
+
+void PosixSourceAccessor::clearCache()
+{
+    auto & cache = fsCache();
+    cache.stats.clear();
+    cache.listings.clear();
+}
+
 std::optional<SourceAccessor::Stat> PosixSourceAccessor::maybeLstat(const CanonPath & path)
 {
     if (auto parent = path.parent())
@@ -142,8 +184,16 @@ std::optional<SourceAccessor::Stat> PosixSourceAccessor::maybeLstat(const CanonP
 SourceAccessor::DirEntries PosixSourceAccessor::readDirectory(const CanonPath & path)
 {
     assertNoSymlinks(path);
+
+    auto absPath = makeAbsPath(path);
+
+    auto & cache = fsCache().listings;
+
+    if (auto res = cache.get(absPath.string()))
+        return **res;
+
     DirEntries res;
-    for (auto & entry : DirectoryIterator{makeAbsPath(path)}) {
+    for (auto & entry : DirectoryIterator{absPath}) {
         checkInterrupt();
         auto type = [&]() -> std::optional<Type> {
             try {
@@ -188,6 +238,10 @@ SourceAccessor::DirEntries PosixSourceAccessor::readDirectory(const CanonPath &
         }();
         res.emplace(entry.path().filename().string(), type);
     }
+
+    if (auto st = cachedLstat(path); st && S_ISDIR(st->st_mode) && !(st->st_mode & (S_IWUSR | S_IWGRP | S_IWOTH)))
+        cache.upsert(absPath.string(), std::make_shared<const DirEntries>(res));
+
     return res;
 }
 
@@ -39,9 +39,42 @@ void BufferedSink::operator()(std::string_view data)
         memcpy(buffer.get() + bufPos, data.data(), n);
         data.remove_prefix(n);
         bufPos += n;
-        if (bufPos == bufSize)
+        if (bufPos == bufSize) {
             flush();
+            if (bufSize < maxBufSize) {
+                bufSize = std::min(bufSize * 2, maxBufSize);
+                buffer = decltype(buffer)(new char[bufSize]);
+            }
+        }
+    }
+}
+
+void BufferedSink::writeVectored(std::span<const std::string_view> parts)
+{
+    size_t total = 0;
+    for (auto & part : parts)
+        total += part.size();
+
+    if (bufPos + total < bufSize) {
+        for (auto & part : parts)
+            (*this)(part);
+        return;
     }
+
+    std::vector<std::string_view> all;
+    all.reserve(parts.size() + 1);
+    if (bufPos)
+        all.emplace_back(buffer.get(), bufPos);
+    all.insert(all.end(), parts.begin(), parts.end());
+    bufPos = 0;
+    writeUnbufferedVectored(all);
+}
+
+void BufferedSink::writeUnbufferedVectored(std::span<const std::string_view> parts)
+{
+    for (auto & part : parts)
+        if (!part.empty())
+            writeUnbuffered(part);
 }
 
 void BufferedSink::flush()
@@ -73,6 +106,37 @@ void FdSink::writeUnbuffered(std::string_view data)
     }
 }
 
+void FdSink::writeUnbufferedVectored(std::span<const std::string_view> parts)
+{
+    for (auto & part : parts)
+        written += part.size();
+    try {
+        writevFull(fd, parts);
+    } catch (SystemError & e) {
+        _good = false;
+        throw;
+    }
+}
+
+uint64_t FdSink::writeFromFd(Descriptor from, uint64_t len)
+{
+    /* Small files are cheaper to copy through the buffer, since
+       that doesn't require flushing it. */
+    if (len < 64 * 1024)
+        return 0;
+
+    flush();
+
+    try {
+        auto n = copyFdInKernel(from, fd, len);
+        written += n;
+        return n;
+    } catch (SystemError & e) {
+        _good = false;
+        throw;
+    }
+}
+
 bool FdSink::good()
 {
     return _good;
@@ -122,13 +186,52 @@ void Source::skip(size_t len)
     }
 }
 
-size_t BufferedSource::read(char * data, size_t len)
+void Source::readInto(Sink & sink, uint64_t len)
 {
+    std::array<char, 65536> buf;
+    while (len) {
+        checkInterrupt();
+        auto n = read(buf.data(), std::min<uint64_t>(len, buf.size()));
+        sink({buf.data(), n});
+        len -= n;
+    }
+}
+
+size_t BufferedSource::fill()
+{
+    if (bufFilled && bufSize < maxBufSize) {
+        bufSize = std::min(bufSize * 2, maxBufSize);
+        buffer.reset();
+    }
     if (!buffer)
         buffer = std::make_unique_for_overwrite<char[]>(bufSize);
+    auto n = readUnbuffered(buffer.get(), bufSize);
+    bufFilled = n == bufSize;
+    return n;
+}
+
+void BufferedSource::readInto(Sink & sink, uint64_t len)
+{
+    while (len) {
+        checkInterrupt();
 
+        if (!bufPosIn)
+            bufPosIn = fill();
+
+        /* Pass on the data in the buffer directly. */
+        auto n = std::min<uint64_t>(len, bufPosIn - bufPosOut);
+        sink({buffer.get() + bufPosOut, n});
+        bufPosOut += n;
+        if (bufPosIn == bufPosOut)
+            bufPosIn = bufPosOut = 0;
+        len -= n;
+    }
+}
+
+size_t BufferedSource::read(char * data, size_t len)
+{
     if (!bufPosIn)
-        bufPosIn = readUnbuffered(buffer.get(), bufSize);
+        bufPosIn = fill();
 
     /* Copy out the data in the buffer. */
     auto n = std::min(len, bufPosIn - bufPosOut);
@@ -170,7 +273,7 @@ std::string BufferedSource::readLine(bool eofOk)
 
         size_t n = 0;
         try {
-            n = readUnbuffered(buffer.get(), bufSize);
+            n = fill();
         } catch (EndOfFile & e) {
             return handleEof();
         }
@@ -398,7 +501,10 @@ std::unique_ptr<Source> sinkToSource(std::function<void(Sink &)> fun, std::funct
 
         std::string_view cur;
 
-        size_t read(char * data, size_t len) override
+        /**
+         * Make sure that `cur` is not empty.
+         */
+        void fill()
         {
             bool hasCoro = coro.has_value();
             if (!hasCoro) {
@@ -424,12 +530,32 @@ std::unique_ptr<Source> sinkToSource(std::function<void(Sink &)> fun, std::funct
                     unreachable();
                 }
             }
+        }
+
+        size_t read(char * data, size_t len) override
+        {
+            fill();
 
             size_t n = cur.copy(data, len);
             cur.remove_prefix(n);
 
             return n;
         }
+
+        void readInto(Sink & sink, uint64_t len) override
+        {
+            while (len) {
+                checkInterrupt();
+                fill();
+
+                /* Hand the producer's data to the sink directly. It
+                   stays valid until the coroutine is resumed. */
+                auto n = std::min<uint64_t>(len, cur.size());
+                sink(cur.substr(0, n));
+                cur.remove_prefix(n);
+                len -= n;
+            }
+        }
     };
 
     return std::make_unique<SinkToSource>(fun, eof);
@@ -3,6 +3,8 @@
 #include "nix/util/file-system.hh"
 #include "nix/util/base-n.hh"
 #include "nix/util/util.hh"
+#include "nix/util/hash.hh"
+#include "nix/util/sharded-cache.hh"
 #include <sodium.h>
 
 namespace nix {
@@ -90,6 +92,20 @@ bool PublicKey::verifyDetached(std::string_view data, std::string_view sig) cons
     return verifyDetachedAnon(data, ss.payload);
 }
 
+/**
+ * The signatures that have been verified successfully in this process,
+ * keyed by the SHA-256 hash of the public key, the signature and the
+ * data. The same signatures tend to be checked several times (e.g.
+ * when a path info is fetched from a substituter and again when the
+ * path is added to the store), and hashing is much cheaper than
+ * verifying.
+ */
+static ShardedCache<std::string, bool> & verifiedSignatures()
+{
+    static ShardedCache<std::string, bool> cache(65536);
+    return cache;
+}
+
 bool PublicKey::verifyDetachedAnon(std::string_view data, std::string_view sig) const
 {
     std::string sig2;
@@ -101,9 +117,29 @@ bool PublicKey::verifyDetachedAnon(std::string_view data, std::string_view sig)
     if (sig2.size() != crypto_sign_BYTES)
         throw Error("signature is not valid");
 
-    return crypto_sign_verify_detached(
-               (unsigned char *) sig2.data(), (unsigned char *) data.data(), data.size(), (unsigned char *) key.data())
-           == 0;
+    /* The key and signature have a fixed size, so the concatenation
+       is unambiguous. */
+    HashSink hashSink(HashAlgorithm::SHA256);
+    hashSink(key);
+    hashSink(sig2);
+    hashSink(data);
+    auto hash = hashSink.finish().hash;
+    std::string cacheKey((const char *) hash.hash, hash.hashSize);
+
+    if (verifiedSignatures().get(cacheKey))
+        return true;
+
+    bool valid = crypto_sign_verify_detached(
+                     (unsigned char *) sig2.data(),
+                     (unsigned char *) data.data(),
+                     data.size(),
+                     (unsigned char *) key.data())
+                 == 0;
+
+    if (valid)
+        verifiedSignatures().upsert(cacheKey, true);
+
+    return valid;
 }
 
 bool verifyDetached(std::string_view data, std::string_view sig, const PublicKeys & publicKeys)
@@ -61,6 +61,14 @@ void SourceAccessor::readFile(const CanonPath & path, Sink & sink, std::function
     sink(s);
 }
 
+std::string SourceAccessor::readFileRange(const CanonPath & path, uint64_t offset, uint64_t length)
+{
+    auto s = readFile(path);
+    if (offset >= s.size())
+        return "";
+    return s.substr(offset, length);
+}
+
 Hash SourceAccessor::hashPath(const CanonPath & path, PathFilter & filter, HashAlgorithm ha)
 {
     HashSink sink(ha);
@@ -5,6 +5,17 @@
 #include "nix/util/serialise.hh"
 #include "nix/util/tarfile.hh"
 #include "nix/util/file-system.hh"
+#include "nix/util/compression.hh"
+#include "nix/util/sync.hh"
+
+#include "util-config-private.hh"
+
+#include <fcntl.h>
+
+#include <condition_variable>
+#include <deque>
+#include <set>
+#include <thread>
 
 namespace nix {
 
@@ -123,9 +134,197 @@ TarArchive::~TarArchive()
         archive_read_free(this->archive);
 }
 
+namespace {
+
+constexpr int extractFlags = ARCHIVE_EXTRACT_TIME | ARCHIVE_EXTRACT_SECURE_SYMLINKS | ARCHIVE_EXTRACT_SECURE_NODOTDOT;
+
+/**
+ * Regular files up to this size are written by `ParallelFileWriter`;
+ * larger ones are streamed to disk by the parsing thread.
+ */
+constexpr uint64_t maxParallelFileSize = 1024 * 1024;
+
+/**
+ * An `archive_write_disk` handle. It must only be used by one thread
+ * at a time.
+ */
+struct DiskWriter
+{
+    struct archive * disk;
+
+    DiskWriter()
+        : disk{archive_write_disk_new()}
+    {
+        archive_write_disk_set_options(disk, extractFlags);
+        archive_write_disk_set_standard_lookup(disk);
+    }
+
+    DiskWriter(const DiskWriter &) = delete;
+
+    ~DiskWriter()
+    {
+        archive_write_free(disk);
+    }
+};
+
+using Entry = std::unique_ptr<struct archive_entry, decltype(&archive_entry_free)>;
+
+/**
+ * Writes the contents of regular files on a set of worker threads, so
+ * that libarchive can decompress and parse the next entries in the
+ * meantime. At most `maxBuffered` bytes of file contents (plus the
+ * file being queued) are held in memory.
+ */
+class ParallelFileWriter
+{
+    struct Job
+    {
+        Entry entry{nullptr, archive_entry_free};
+        std::string contents;
+    };
+
+    struct State
+    {
+        std::deque<Job> queue;
+        size_t buffered = 0;
+        size_t active = 0;
+        bool quit = false;
+        std::exception_ptr error;
+    };
+
+    size_t maxBuffered;
+    Sync<State> state_;
+    std::condition_variable wakeup, progress;
+    std::vector<std::thread> workers;
+
+    void run()
+    {
+        DiskWriter writer;
+
+        while (true) {
+            Job job;
+            {
+                auto state(state_.lock());
+                while (state->queue.empty() && !state->quit)
+                    state.wait(wakeup);
+                if (state->quit)
+                    return;
+                job = std::move(state->queue.front());
+                state->queue.pop_front();
+                state->active++;
+            }
+
+            std::exception_ptr error;
+            try {
+                writeFile(writer.disk, job.entry.get(), job.contents);
+            } catch (...) {
+                error = std::current_exception();
+            }
+
+            {
+                auto state(state_.lock());
+                state->active--;
+                state->buffered -= job.contents.size();
+                if (error && !state->error)
+                    state->error = error;
+            }
+            progress.notify_all();
+        }
+    }
+
+    static void writeFile(struct archive * disk, struct archive_entry * entry, std::string_view contents)
+    {
+        checkLibArchive(disk, archive_write_header(disk, entry), "failed to extract archive (%s)");
+        while (!contents.empty()) {
+            auto n = archive_write_data(disk, contents.data(), contents.size());
+            if (n < 0)
+                checkLibArchive(disk, n, "failed to extract archive (%s)");
+            contents.remove_prefix(n);
+        }
+        checkLibArchive(disk, archive_write_finish_entry(disk), "failed to extract archive (%s)");
+    }
+
+public:
+
+    ParallelFileWriter(size_t maxBuffered = 64 * 1024 * 1024)
+        : maxBuffered(maxBuffered)
+    {
+        auto nrThreads = std::max(1u, std::thread::hardware_concurrency());
+        for (unsigned int i = 0; i < nrThreads; ++i)
+            workers.emplace_back([this]() { run(); });
+    }
+
+    ~ParallelFileWriter()
+    {
+        stop();
+    }
+
+    /**
+     * Stop the workers, discarding any queued files.
+     */
+    void stop()
+    {
+        {
+            auto state(state_.lock());
+            state->quit = true;
+        }
+        wakeup.notify_all();
+        for (auto & worker : workers)
+            worker.join();
+        workers.clear();
+    }
+
+    void write(Entry entry, std::string contents)
+    {
+        auto state(state_.lock());
+        while (!state->error && state->buffered && state->buffered + contents.size() > maxBuffered)
+            state.wait(progress);
+        if (state->error)
+            std::rethrow_exception(state->error);
+        state->buffered += contents.size();
+        state->queue.push_back({std::move(entry), std::move(contents)});
+        wakeup.notify_one();
+    }
+
+    /**
+     * Wait until all queued files have been written, and rethrow the
+     * first error encountered by a worker.
+     */
+    void wait()
+    {
+        auto state(state_.lock());
+        while (!state->error && (!state->queue.empty() || state->active))
+            state.wait(progress);
+        if (state->error)
+            std::rethrow_exception(state->error);
+    }
+};
+
+} // namespace
+
 static void extract_archive(TarArchive & archive, const std::filesystem::path & destDir)
 {
-    int flags = ARCHIVE_EXTRACT_TIME | ARCHIVE_EXTRACT_SECURE_SYMLINKS | ARCHIVE_EXTRACT_SECURE_NODOTDOT;
+    /* Directories, symlinks, hard links and large files are created
+       by this thread; the fixups that set the mode and time of
+       directories are applied when it's closed, i.e. after all files
+       have been written. */
+    DiskWriter mainWriter;
+
+    ParallelFileWriter fileWriter;
+
+    /* The files handed to `fileWriter` since the last `wait()`. An
+       entry that replaces one of them (or a directory containing
+       them), or a hard link to one of them, has to wait until they
+       have been written. */
+    std::set<std::string> pending;
+
+    auto waitFor = [&](const std::string & path) {
+        auto i = pending.lower_bound(path + "/");
+        if (pending.contains(path) || (i != pending.end() && i->starts_with(path + "/"))) {
+            fileWriter.wait();
+            pending.clear();
+        }
+    };
 
     for (;;) {
         struct archive_entry * entry;
@@ -140,7 +339,8 @@ static void extract_archive(TarArchive & archive, const std::filesystem::path &
         else
             archive.check(r);
 
-        archive_entry_copy_pathname(entry, (destDir / name).string().c_str());
+        auto path = (destDir / name).string();
+        archive_entry_copy_pathname(entry, path.c_str());
 
         // sources can and do contain dirs with no rx bits
         if (archive_entry_filetype(entry) == AE_IFDIR && (archive_entry_mode(entry) & 0500) != 0500)
@@ -149,29 +349,114 @@ static void extract_archive(TarArchive & archive, const std::filesystem::path &
         // Patch hardlink path
         const char * original_hardlink = archive_entry_hardlink(entry);
         if (original_hardlink) {
-            archive_entry_copy_hardlink(entry, (destDir / original_hardlink).string().c_str());
+            auto target = (destDir / original_hardlink).string();
+            archive_entry_copy_hardlink(entry, target.c_str());
+            waitFor(target);
         }
 
-        archive.check(archive_read_extract(archive.archive, entry, flags));
+        waitFor(path);
+
+        if (!original_hardlink && archive_entry_filetype(entry) == AE_IFREG && archive_entry_size_is_set(entry)
+            && archive_entry_size(entry) >= 0 && (uint64_t) archive_entry_size(entry) <= maxParallelFileSize) {
+            std::string contents(archive_entry_size(entry), 0);
+            size_t pos = 0;
+            while (pos < contents.size()) {
+                auto n = archive_read_data(archive.archive, contents.data() + pos, contents.size() - pos);
+                if (n < 0)
+                    checkLibArchive(archive.archive, n, "cannot read file from tarball: %s");
+                if (n == 0)
+                    break;
+                pos += n;
+            }
+            contents.resize(pos);
+            fileWriter.write(Entry(archive_entry_clone(entry), archive_entry_free), std::move(contents));
+            pending.insert(std::move(path));
+            continue;
+        }
+
+        archive.check(archive_read_extract2(archive.archive, entry, mainWriter.disk));
     }
 
+    /* Stop the workers first, as closing their disk handles may apply
+       fixups of their own. */
+    fileWriter.wait();
+    fileWriter.stop();
+
+    checkLibArchive(mainWriter.disk, archive_write_close(mainWriter.disk), "failed to extract archive (%s)");
+
     archive.close();
 }
 
-void unpackTarfile(Source & source, const std::filesystem::path & destDir)
+#if HAVE_LIBLZMA
+/**
+ * libarchive decodes xz on a single thread, so decode xz tarballs
+ * with `makeDecompressionSink()` instead, which uses all cores for
+ * multi-block files.
+ */
+static void unpackTarfileDecodingXz(Source & source, const std::filesystem::path & destDir)
 {
-    auto archive = TarArchive(source);
+    constexpr std::string_view xzMagic{"\xfd" "7zXZ\0", 6};
 
+    std::string magic(xzMagic.size(), 0);
+    size_t n = 0;
+    try {
+        while (n < magic.size())
+            n += source.read(magic.data() + n, magic.size() - n);
+    } catch (EndOfFile &) {
+    }
+    magic.resize(n);
+
+    StringSource magicSource(magic);
+    ChainSource input(magicSource, source);
+
+    if (magic != xzMagic) {
+        auto archive = TarArchive(input);
+        extract_archive(archive, destDir);
+        return;
+    }
+
+    auto decompressed = sinkToSource([&](Sink & sink) {
+        auto decompressor = makeDecompressionSink("xz", sink);
+        input.drainInto(*decompressor);
+        decompressor->finish();
+    });
+    auto archive = TarArchive(*decompressed);
+    extract_archive(archive, destDir);
+}
+#endif
+
+void unpackTarfile(Source & source, const std::filesystem::path & destDir)
+{
     createDirs(destDir);
+
+#if HAVE_LIBLZMA
+    unpackTarfileDecodingXz(source, destDir);
+#else
+    auto archive = TarArchive(source);
     extract_archive(archive, destDir);
+#endif
 }
 
 void unpackTarfile(const std::filesystem::path & tarFile, const std::filesystem::path & destDir)
 {
+#if HAVE_LIBLZMA
+    AutoCloseFD fd = toDescriptor(open(
+        tarFile.string().c_str(),
+        O_RDONLY
+#  ifdef O_CLOEXEC
+            | O_CLOEXEC
+#  endif
+        ));
+    if (!fd)
+        throw SysError("opening file '%s'", tarFile.string());
+    FdSource source(fd.get());
+    unpackTarfile(source, destDir);
+#else
     auto archive = TarArchive(tarFile);
 
     createDirs(destDir);
     extract_archive(archive, destDir);
+#endif
 }
 
 time_t unpackTarfileToSink(TarArchive & archive, ExtendedFileSystemObjectSink & parseSink)
@@ -1,11 +1,129 @@
 #include "nix/util/thread-pool.hh"
 #include "nix/util/signals.hh"
+#include "nix/util/finally.hh"
 #include "nix/util/util.hh"
 
 namespace nix {
 
+/**
+ * A Chase-Lev work-stealing deque, following "Correct and Efficient
+ * Work-Stealing for Weak Memory Models" (Lê et al., PPoPP 2013). Only
+ * the owning thread calls `push()` and `take()`, which operate on the
+ * bottom end; any thread may `steal()` from the top end.
+ */
+struct ThreadPool::Worker
+{
+    struct Array
+    {
+        /**
+         * Always a power of two.
+         */
+        int64_t capacity;
+
+        std::unique_ptr<std::atomic<Task *>[]> tasks;
+
+        Array(int64_t capacity)
+            : capacity(capacity)
+            , tasks(new std::atomic<Task *>[capacity])
+        {
+        }
+
+        Task * get(int64_t i)
+        {
+            return tasks[i & (capacity - 1)].load(std::memory_order_relaxed);
+        }
+
+        void put(int64_t i, Task * task)
+        {
+            tasks[i & (capacity - 1)].store(task, std::memory_order_relaxed);
+        }
+    };
+
+    std::atomic<int64_t> top{0}, bottom{0};
+
+    std::atomic<Array *> array;
+
+    /**
+     * Every array this deque has used. Thieves may still be reading
+     * from an array after it has been replaced by a bigger one, so
+     * they are only freed together with the deque.
+     */
+    std::vector<std::unique_ptr<Array>> arrays;
+
+    Worker()
+    {
+        arrays.push_back(std::make_unique<Array>(64));
+        array.store(arrays.back().get(), std::memory_order_relaxed);
+    }
+
+    ~Worker()
+    {
+        while (auto task = take())
+            delete task;
+    }
+
+    void push(Task * task)
+    {
+        auto b = bottom.load(std::memory_order_relaxed);
+        auto t = top.load(std::memory_order_acquire);
+        auto a = array.load(std::memory_order_relaxed);
+        if (b - t > a->capacity - 1) {
+            auto bigger = std::make_unique<Array>(a->capacity * 2);
+            for (auto i = t; i < b; ++i)
+                bigger->put(i, a->get(i));
+            a = bigger.get();
+            arrays.push_back(std::move(bigger));
+            array.store(a, std::memory_order_release);
+        }
+        a->put(b, task);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom.store(b + 1, std::memory_order_relaxed);
+    }
+
+    Task * take()
+    {
+        auto b = bottom.load(std::memory_order_relaxed) - 1;
+        auto a = array.load(std::memory_order_relaxed);
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto t = top.load(std::memory_order_relaxed);
+        if (t > b) {
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        auto task = a->get(b);
+        if (t == b) {
+            /* This is the last item, so race against thieves for it. */
+            if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                task = nullptr;
+            bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return task;
+    }
+
+    Task * steal()
+    {
+        auto t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto b = bottom.load(std::memory_order_acquire);
+        if (t >= b)
+            return nullptr;
+        auto a = array.load(std::memory_order_acquire);
+        auto task = a->get(t);
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            return nullptr;
+        return task;
+    }
+};
+
+/**
+ * The pool whose worker thread this is, and the deque it owns.
+ */
+static thread_local std::pair<const ThreadPool *, ThreadPool::Worker *> currentWorker{nullptr, nullptr};
+
 ThreadPool::ThreadPool(size_t _maxThreads)
     : maxThreads(_maxThreads)
+    , creator(std::this_thread::get_id())
 {
     if (!maxThreads) {
         maxThreads = std::thread::hardware_concurrency();
@@ -13,7 +131,13 @@ ThreadPool::ThreadPool(size_t _maxThreads)
             maxThreads = 1;
     }
 
-    debug("starting pool of %d threads", maxThreads - 1);
+    /* Allocate all deques up front, so that thieves can scan them
+       without synchronising with thread creation. There is always room
+       for at least one worker thread, see push(). */
+    for (size_t i = 0; i < std::max(maxThreads, (size_t) 2); ++i)
+        deques.push_back(std::make_unique<Worker>());
+
+    debug("starting pool of %d threads", deques.size() - 1);
 }
 
 ThreadPool::~ThreadPool()
@@ -41,28 +165,68 @@ void ThreadPool::shutdown()
         thr.join();
 }
 
-void ThreadPool::enqueue(work_t t)
+void ThreadPool::push(std::unique_ptr<Task> task)
 {
-    auto state(state_.lock());
     if (quit)
         throw ThreadPoolShutDown("cannot enqueue a work item while the thread pool is shutting down");
-    state->pending.push(std::move(t));
-    /* Note: process() also executes items, so count it as a worker. */
-    if (state->pending.size() > state->workers.size() + 1 && state->workers.size() + 1 < maxThreads)
-        state->workers.emplace_back(&ThreadPool::doWork, this, false);
-    work.notify_one();
+
+    outstanding++;
+
+    /* Count the item before it becomes visible, so that a thread
+       that takes it doesn't see `pending` drop below zero. */
+    auto n = ++pending;
+
+    if (currentWorker.first == this)
+        currentWorker.second->push(task.release());
+    else if (std::this_thread::get_id() == creator)
+        deques[0]->push(task.release());
+    else {
+        auto state(state_.lock());
+        state->injected.push_back(std::move(task));
+        nrInjected++;
+    }
+
+    /* Note: process() also executes items, so count it as a worker
+       once it has been called. Before that, the caller may be blocked
+       waiting for the result of a `submit()`, so make sure there is at
+       least one worker even if `maxThreads` is 1. */
+    if (n > nrWorkers + (draining ? 1 : 0) && nrWorkers + 1 < deques.size()) {
+        auto state(state_.lock());
+        auto nr = state->workers.size();
+        if (!quit && nr + 1 < deques.size()) {
+            state->workers.emplace_back(&ThreadPool::doWork, this, deques[nr + 1].get(), nr + 1);
+            nrWorkers = nr + 1;
+        }
+    }
+
+    if (sleepers) {
+        auto state(state_.lock());
+        work.notify_one();
+    }
 }
 
 void ThreadPool::process()
 {
-    state_.lock()->draining = true;
+    draining = true;
 
     /* Do work until no more work is pending or active. */
     try {
-        doWork(true);
+        if (!outstanding) {
+            auto state(state_.lock());
+            quit = true;
+            work.notify_all();
+        }
+
+        /* If a single-threaded pool already has its one worker, just
+           wait for it, to keep to `maxThreads`. */
+        if (nrWorkers < maxThreads)
+            doWork(std::this_thread::get_id() == creator ? deques[0].get() : nullptr, 0);
 
         auto state(state_.lock());
 
+        while (!quit)
+            state.wait(done);
+
         assert(quit);
 
         if (state->exception)
@@ -79,86 +243,118 @@ void ThreadPool::process()
     }
 }
 
-void ThreadPool::doWork(bool mainThread)
+std::unique_ptr<ThreadPool::Task> ThreadPool::findWork(Worker * own, size_t start)
+{
+    if (own)
+        if (auto task = own->take())
+            return std::unique_ptr<Task>(task);
+
+    if (nrInjected) {
+        auto state(state_.lock());
+        if (!state->injected.empty()) {
+            auto task = std::move(state->injected.front());
+            state->injected.pop_front();
+            nrInjected--;
+            return task;
+        }
+    }
+
+    for (size_t i = 0; i < deques.size(); ++i) {
+        auto & victim = deques[(start + i) % deques.size()];
+        if (victim.get() == own)
+            continue;
+        if (auto task = victim->steal())
+            return std::unique_ptr<Task>(task);
+    }
+
+    return nullptr;
+}
+
+void ThreadPool::doWork(Worker * own, size_t index)
 {
     ReceiveInterrupts receiveInterrupts;
 
+    bool mainThread = index == 0;
+
 #ifndef _WIN32 // Does Windows need anything similar for async exit handling?
     if (!mainThread)
         unix::interruptCheck = [&]() { return (bool) quit; };
 #endif
 
-    bool didWork = false;
-    std::exception_ptr exc;
+    auto prevWorker = currentWorker;
+    if (own)
+        currentWorker = {this, own};
+    Finally restoreWorker([&]() { currentWorker = prevWorker; });
 
-    while (true) {
-        work_t w;
-        {
-            auto state(state_.lock());
+    /* Start stealing from different deques in different threads. */
+    auto start = index + 1;
 
-            if (didWork) {
-                assert(state->active);
-                state->active--;
-
-                if (exc) {
-
-                    if (!state->exception) {
-                        state->exception = exc;
-                        // Tell the other workers to quit.
-                        quit = true;
-                        work.notify_all();
-                    } else {
-                        /* Print the exception, since we can't
-                           propagate it. */
-                        try {
-                            std::rethrow_exception(exc);
-                        } catch (const Interrupted &) {
-                            // The interrupted state may be picked up by multiple
-                            // workers, which is expected, so we should ignore
-                            // it silently and let the first one bubble up,
-                            // rethrown via the original state->exception.
-                        } catch (const ThreadPoolShutDown &) {
-                            // Similarly expected.
-                        } catch (std::exception & e) {
-                            ignoreExceptionExceptInterrupt();
-                        }
-                    }
-                }
-            }
+    while (true) {
+        if (quit)
+            return;
 
-            /* Wait until a work item is available or we're asked to
-               quit. */
-            while (true) {
-                if (quit)
-                    return;
-
-                if (!state->pending.empty())
-                    break;
-
-                /* If there are no active or pending items, and the
-                   main thread is running process(), then no new items
-                   can be added. So exit. */
-                if (!state->active && state->draining) {
-                    quit = true;
-                    work.notify_all();
-                    return;
-                }
+        auto task = findWork(own, start);
 
+        if (!task) {
+            /* Sleep until an item is enqueued. `push()` increments
+               `pending` before checking `sleepers`, and we increment
+               `sleepers` before checking `pending`, so we can't both
+               miss each other. */
+            auto state(state_.lock());
+            sleepers++;
+            while (!quit && !pending)
                 state.wait(work);
-            }
-
-            w = std::move(state->pending.front());
-            state->pending.pop();
-            state->active++;
+            sleepers--;
+            continue;
         }
 
+        pending--;
+
+        std::exception_ptr exc;
+
         try {
-            w();
+            task->run();
         } catch (...) {
             exc = std::current_exception();
         }
 
-        didWork = true;
+        task.reset();
+
+        if (exc) {
+            auto state(state_.lock());
+            if (!state->exception) {
+                state->exception = exc;
+                // Tell the other workers to quit.
+                quit = true;
+                work.notify_all();
+                done.notify_all();
+            } else {
+                /* Print the exception, since we can't
+                   propagate it. */
+                try {
+                    std::rethrow_exception(exc);
+                } catch (const Interrupted &) {
+                    // The interrupted state may be picked up by multiple
+                    // workers, which is expected, so we should ignore
+                    // it silently and let the first one bubble up,
+                    // rethrown via the original state->exception.
+                } catch (const ThreadPoolShutDown &) {
+                    // Similarly expected.
+                } catch (std::exception & e) {
+                    ignoreExceptionExceptInterrupt();
+                }
+            }
+        }
+
+        /* If there are no active or pending items, and the main
+           thread is running process(), then no new items can be
+           added. So exit. */
+        if (!--outstanding && draining) {
+            auto state(state_.lock());
+            quit = true;
+            work.notify_all();
+            done.notify_all();
+        }
     }
 }
 
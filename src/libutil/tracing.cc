@@ -0,0 +1,409 @@
+#include "nix/util/tracing.hh"
+#include "nix/util/environment-variables.hh"
+#include "nix/util/file-descriptor.hh"
+#include "nix/util/strings.hh"
+#include "nix/util/sync.hh"
+#include "nix/util/util.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <span>
+#include <nlohmann/json.hpp>
+
+#ifdef _WIN32
+#  include <windows.h>
+#endif
+
+namespace nix {
+
+static std::string toHex(std::span<const uint8_t> bytes)
+{
+    static constexpr char digits[] = "0123456789abcdef";
+    std::string s;
+    for (auto b : bytes) {
+        s.push_back(digits[b >> 4]);
+        s.push_back(digits[b & 0xf]);
+    }
+    return s;
+}
+
+static std::string toHex(uint64_t n)
+{
+    std::array<uint8_t, 8> bytes;
+    for (size_t i = 0; i < bytes.size(); ++i)
+        bytes[i] = n >> (56 - 8 * i);
+    return toHex(bytes);
+}
+
+static std::optional<uint8_t> parseHexDigit(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return std::nullopt;
+}
+
+static bool parseHex(std::string_view s, std::span<uint8_t> bytes)
+{
+    if (s.size() != bytes.size() * 2)
+        return false;
+    for (size_t i = 0; i < bytes.size(); ++i) {
+        auto hi = parseHexDigit(s[2 * i]), lo = parseHexDigit(s[2 * i + 1]);
+        if (!hi || !lo)
+            return false;
+        bytes[i] = *hi << 4 | *lo;
+    }
+    return true;
+}
+
+std::optional<TraceParent> TraceParent::parse(std::string_view s)
+{
+    auto parts = tokenizeString<std::vector<std::string>>(s, "-");
+    if (parts.size() != 4 || parts[0] != "00" || parts[3].size() != 2)
+        return std::nullopt;
+
+    TraceParent res;
+    std::array<uint8_t, 8> spanId;
+    if (!parseHex(parts[1], res.traceId) || !parseHex(parts[2], spanId))
+        return std::nullopt;
+
+    res.spanId = 0;
+    for (auto b : spanId)
+        res.spanId = res.spanId << 8 | b;
+
+    /* All-zero IDs are invalid. */
+    if (res.spanId == 0 || std::ranges::all_of(res.traceId, [](auto b) { return b == 0; }))
+        return std::nullopt;
+
+    return res;
+}
+
+std::string TraceParent::to_string() const
+{
+    return "00-" + toHex(traceId) + "-" + toHex(spanId) + "-01";
+}
+
+namespace {
+
+/**
+ * Random numbers that make the trace and span IDs of this process
+ * unique across processes and machines.
+ */
+struct Randomness
+{
+    std::array<uint8_t, 16> traceId;
+    uint64_t salt;
+
+    Randomness()
+    {
+        std::random_device rd;
+        for (auto & b : traceId)
+            b = rd();
+        salt = (uint64_t) rd() << 32 | rd();
+    }
+};
+
+Randomness & randomness()
+{
+    static Randomness r;
+    return r;
+}
+
+std::atomic<bool> tracingEnabled{false};
+
+uint64_t getPid()
+{
+#ifndef _WIN32
+    return getpid();
+#else
+    return GetCurrentProcessId();
+#endif
+}
+
+/**
+ * Whether `act` was created by this process, rather than forwarded
+ * from another (e.g. the daemon), which writes its own spans.
+ */
+bool isOwnActivity(ActivityId act)
+{
+    return act && (act >> 32) == (getPid() & 0xffffffff);
+}
+
+uint64_t spanIdOf(ActivityId act)
+{
+    auto id = act ^ randomness().salt;
+    return id ? id : 1;
+}
+
+/**
+ * The trace context passed in by whoever started this process.
+ */
+std::optional<TraceParent> getIncomingTraceParent()
+{
+    auto s = loggerSettings.traceParent.get();
+    if (s.empty())
+        s = getEnv("TRACEPARENT").value_or("");
+    if (s.empty())
+        return std::nullopt;
+    return TraceParent::parse(s);
+}
+
+uint64_t nowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::system_clock::now().time_since_epoch())
+        .count();
+}
+
+std::string_view spanName(ActivityType type)
+{
+    switch (type) {
+    case actCopyPath:
+        return "copy path";
+    case actFileTransfer:
+        return "file transfer";
+    case actRealise:
+        return "realise";
+    case actCopyPaths:
+        return "copy paths";
+    case actBuilds:
+        return "builds";
+    case actBuild:
+        return "build";
+    case actOptimiseStore:
+        return "optimise store";
+    case actVerifyPaths:
+        return "verify paths";
+    case actSubstitute:
+        return "substitute";
+    case actQueryPathInfo:
+        return "query path info";
+    case actPostBuildHook:
+        return "post-build hook";
+    case actBuildWaiting:
+        return "wait for build";
+    case actFetchTree:
+        return "fetch tree";
+    case actCollectGarbage:
+        return "collect garbage";
+    default:
+        return "activity";
+    }
+}
+
+/**
+ * The OpenTelemetry attribute names of the fields of an activity.
+ */
+std::vector<std::string_view> fieldNames(ActivityType type)
+{
+    switch (type) {
+    case actBuild:
+        return {"nix.drv_path", "nix.machine"};
+    case actSubstitute:
+        return {"nix.store_path", "nix.substituter"};
+    case actCopyPath:
+        return {"nix.store_path", "nix.source", "nix.destination"};
+    case actFileTransfer:
+        return {"url.full"};
+    case actQueryPathInfo:
+        return {"nix.store_path", "nix.store"};
+    default:
+        return {};
+    }
+}
+
+nlohmann::json attribute(std::string_view key, const Logger::Field & field)
+{
+    if (field.type == Logger::Field::tInt)
+        return {{"key", key}, {"value", {{"intValue", std::to_string(field.i)}}}};
+    else
+        return {{"key", key}, {"value", {{"stringValue", field.s}}}};
+}
+
+struct TracingLogger : Logger
+{
+    struct Span
+    {
+        ActivityType type;
+        std::string text;
+        Fields fields;
+        std::array<uint8_t, 16> traceId;
+        uint64_t parentSpanId;
+        uint64_t startNs;
+        nlohmann::json events = nlohmann::json::array();
+    };
+
+    AutoCloseFD fd;
+
+    Sync<std::map<ActivityId, Span>> spans_;
+
+    TracingLogger(AutoCloseFD && fd)
+        : fd(std::move(fd))
+    {
+    }
+
+    ~TracingLogger()
+    {
+        try {
+            stop();
+        } catch (...) {
+            ignoreExceptionInDestructor();
+        }
+    }
+
+    /**
+     * Write the spans of activities that are still running, e.g.
+     * because of an error.
+     */
+    void stop() override
+    {
+        auto spans(spans_.lock());
+        for (auto & [act, span] : *spans)
+            write(act, span);
+        spans->clear();
+    }
+
+    void log(Verbosity lvl, std::string_view s) override {}
+
+    void logEI(const ErrorInfo & ei) override {}
+
+    void startActivity(
+        ActivityId act,
+        Verbosity lvl,
+        ActivityType type,
+        const std::string & s,
+        const Fields & fields,
+        ActivityId parent) override
+    {
+        if (!isOwnActivity(act))
+            return;
+
+        auto incoming = getIncomingTraceParent();
+
+        Span span{
+            .type = type,
+            .text = s,
+            .fields = fields,
+            .traceId = incoming ? incoming->traceId : randomness().traceId,
+            .parentSpanId = isOwnActivity(parent) ? spanIdOf(parent) : incoming ? incoming->spanId : 0,
+            .startNs = nowNs(),
+        };
+
+        spans_.lock()->insert_or_assign(act, std::move(span));
+    }
+
+    void result(ActivityId act, ResultType type, const Fields & fields) override
+    {
+        if (type != resSetPhase || fields.empty())
+            return;
+        auto spans(spans_.lock());
+        if (auto span = get(*spans, act))
+            span->events.push_back({
+                {"timeUnixNano", std::to_string(nowNs())},
+                {"name", "phase " + fields[0].s},
+            });
+    }
+
+    void stopActivity(ActivityId act) override
+    {
+        auto spans(spans_.lock());
+        auto i = spans->find(act);
+        if (i == spans->end())
+            return;
+        write(act, i->second);
+        spans->erase(i);
+    }
+
+    void write(ActivityId act, const Span & span)
+    {
+        auto attributes = nlohmann::json::array();
+        auto names = fieldNames(span.type);
+        for (size_t i = 0; i < span.fields.size(); ++i)
+            if (i < names.size())
+                attributes.push_back(attribute(names[i], span.fields[i]));
+        if (!span.text.empty())
+            attributes.push_back(attribute("nix.description", span.text));
+
+        nlohmann::json jsonSpan{
+            {"traceId", toHex(span.traceId)},
+            {"spanId", toHex(spanIdOf(act))},
+            {"name", spanName(span.type)},
+            {"kind", 1}, // SPAN_KIND_INTERNAL
+            {"startTimeUnixNano", std::to_string(span.startNs)},
+            {"endTimeUnixNano", std::to_string(nowNs())},
+            {"attributes", std::move(attributes)},
+            {"events", span.events},
+        };
+        if (span.parentSpanId)
+            jsonSpan["parentSpanId"] = toHex(span.parentSpanId);
+
+        nlohmann::json request{
+            {"resourceSpans",
+             {{
+                 {"resource",
+                  {{"attributes",
+                    {
+                        attribute("service.name", "nix"),
+                        attribute("process.pid", getPid()),
+                    }}}},
+                 {"scopeSpans", {{{"scope", {{"name", "nix"}}}, {"spans", {std::move(jsonSpan)}}}}},
+             }}},
+        };
+
+        try {
+            writeFull(fd.get(), request.dump() + "\n", false);
+        } catch (...) {
+        }
+    }
+};
+
+} // namespace
+
+std::optional<std::string> getTraceParent(ActivityId act)
+{
+    auto incoming = getIncomingTraceParent();
+
+    if (!tracingEnabled || !isOwnActivity(act))
+        return incoming ? std::optional{incoming->to_string()} : std::nullopt;
+
+    return TraceParent{
+        .traceId = incoming ? incoming->traceId : randomness().traceId,
+        .spanId = spanIdOf(act),
+    }
+        .to_string();
+}
+
+std::unique_ptr<Logger> makeTracingLogger(const std::filesystem::path & path)
+{
+    AutoCloseFD fd = toDescriptor(open(path.string().c_str(), O_CREAT | O_APPEND | O_WRONLY, 0644));
+    if (!fd)
+        throw SysError("opening trace file %1%", path);
+#ifndef _WIN32
+    unix::closeOnExec(fd.get());
+#endif
+    tracingEnabled = true;
+    return std::make_unique<TracingLogger>(std::move(fd));
+}
+
+void applyTracingLogger()
+{
+    if (auto & opt = loggerSettings.traceFile.get()) {
+        try {
+            std::vector<std::unique_ptr<Logger>> loggers;
+            loggers.push_back(makeTracingLogger(*opt));
+            try {
+                logger = makeTeeLogger(std::move(logger), std::move(loggers));
+            } catch (...) {
+                // `logger` is now gone so give up.
+                abort();
+            }
+        } catch (...) {
+            ignoreExceptionExceptInterrupt();
+        }
+    }
+}
+
+} // namespace nix
@@ -8,6 +8,13 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <poll.h>
+#include <climits>
+#include <sys/uio.h>
+
+#ifdef __linux__
+#  include <sys/sendfile.h>
+#  include <sys/stat.h>
+#endif
 
 #if defined(__linux__) && defined(__NR_openat2)
 #  define HAVE_OPENAT2 1
@@ -91,6 +98,78 @@ void writeFull(int fd, std::string_view s, bool allowInterrupts)
     }
 }
 
+void writevFull(int fd, std::span<const std::string_view> parts, bool allowInterrupts)
+{
+    std::vector<struct iovec> iov;
+    iov.reserve(parts.size());
+    for (auto & part : parts)
+        if (!part.empty())
+            iov.push_back({.iov_base = (void *) part.data(), .iov_len = part.size()});
+
+    for (size_t i = 0; i < iov.size();) {
+        if (allowInterrupts)
+            checkInterrupt();
+        ssize_t res = writev(fd, iov.data() + i, std::min<size_t>(iov.size() - i, IOV_MAX));
+        if (res == -1) {
+            switch (errno) {
+            case EINTR:
+                continue;
+            case EAGAIN:
+                pollFD(fd, POLLOUT);
+                continue;
+            }
+            throw SysError("writing to file");
+        }
+        /* Skip over what was written, which may end in the middle
+           of an element. */
+        for (size_t n = res; n;) {
+            auto m = std::min(n, iov[i].iov_len);
+            iov[i].iov_base = (char *) iov[i].iov_base + m;
+            iov[i].iov_len -= m;
+            n -= m;
+            if (!iov[i].iov_len)
+                ++i;
+        }
+    }
+}
+
+uint64_t copyFdInKernel(int from, int to, uint64_t len)
+{
+    uint64_t done = 0;
+#ifdef __linux__
+    /* Between regular files, copy_file_range() can share extents on
+       file systems that support reflinks. */
+    struct stat st;
+    bool toFile = fstat(to, &st) == 0 && S_ISREG(st.st_mode);
+
+    while (done < len) {
+        checkInterrupt();
+        auto chunk = std::min<uint64_t>(len - done, 1 << 30);
+        auto n = toFile ? copy_file_range(from, nullptr, to, nullptr, chunk, 0) : sendfile(to, from, nullptr, chunk);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN) {
+                pollFD(to, POLLOUT);
+                continue;
+            }
+            if (toFile && (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP)) {
+                toFile = false;
+                continue;
+            }
+            /* sendfile() doesn't support every kind of file. */
+            if (!done && (errno == EINVAL || errno == ENOSYS))
+                return 0;
+            throw SysError("copying data between file descriptors");
+        }
+        if (n == 0)
+            break;
+        done += n;
+    }
+#endif
+    return done;
+}
+
 std::string readLine(int fd, bool eofOk)
 {
     std::string s;
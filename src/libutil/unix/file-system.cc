@@ -18,6 +18,10 @@
 #include "nix/util/signals.hh"
 #include "nix/util/util.hh"
 
+#ifdef __linux__
+#  include "nix/util/io-uring.hh"
+#endif
+
 #include "util-unix-config-private.hh"
 
 namespace nix {
@@ -87,6 +91,102 @@ void setWriteTime(
 #  define MOUNTEDPATHS_ARG
 #endif
 
+static void _deletePath(
+    Descriptor parentfd,
+    const std::filesystem::path & path,
+    uint64_t & bytesFreed,
+    std::exception_ptr & ex MOUNTEDPATHS_PARAM);
+
+static void countFreedBytes(nlink_t nlink, uint64_t size, uint64_t & bytesFreed)
+{
+    /* We are about to delete a file. Will it likely free space? */
+
+    switch (nlink) {
+    /* Yes: last link. */
+    case 1:
+        bytesFreed += size;
+        break;
+    /* Maybe: yes, if 'auto-optimise-store' or manual optimisation
+       was performed. Instead of checking for real let's assume
+       it's an optimised file and space will be freed.
+
+       In worst case we will double count on freed space for files
+       with exactly two hardlinks for unoptimised packages.
+     */
+    case 2:
+        bytesFreed += size;
+        break;
+    /* No: 3+ links. */
+    default:
+        break;
+    }
+}
+
+static void recordUnlinkError(const std::filesystem::path & path, int errNo, std::exception_ptr & ex)
+{
+    try {
+        throw SysError(errNo, "cannot unlink %1%", path);
+    } catch (...) {
+        if (!ex)
+            ex = std::current_exception();
+        else
+            ignoreExceptionExceptInterrupt();
+    }
+}
+
+#ifdef __linux__
+/**
+ * Delete the entries of a directory by getting their status and
+ * unlinking the non-directories in io_uring batches. Subdirectories
+ * are deleted recursively by `_deletePath()`.
+ */
+static void deleteEntriesBatched(
+    IoUringBatch & batch,
+    Descriptor dirfd,
+    const std::filesystem::path & path,
+    const std::vector<std::string> & names,
+    uint64_t & bytesFreed,
+    std::exception_ptr & ex)
+{
+    std::vector<struct ::statx> st(names.size());
+    for (size_t i = 0; i < names.size(); ++i)
+        batch.stat(
+            dirfd,
+            names[i].c_str(),
+            AT_SYMLINK_NOFOLLOW,
+            STATX_TYPE | STATX_MODE | STATX_NLINK | STATX_SIZE,
+            &st[i]);
+    batch.submit();
+
+    std::vector<size_t> subdirs, unlinked;
+    for (size_t i = 0; i < names.size(); ++i) {
+        if (auto res = batch.result(i); res < 0) {
+            if (res == -ENOENT)
+                continue;
+            throw SysError(-res, "getting status of %1%", path / names[i]);
+        }
+        if (S_ISDIR(st[i].stx_mode))
+            subdirs.push_back(i);
+        else {
+            countFreedBytes(st[i].stx_nlink, st[i].stx_size, bytesFreed);
+            unlinked.push_back(i);
+        }
+    }
+
+    batch.clear();
+    for (auto i : unlinked)
+        batch.unlink(dirfd, names[i].c_str(), 0);
+    batch.submit();
+
+    for (size_t j = 0; j < unlinked.size(); ++j)
+        if (auto res = batch.result(j); res < 0 && res != -ENOENT)
+            recordUnlinkError(path / names[unlinked[j]], -res, ex);
+
+    for (auto i : subdirs)
+        _deletePath(dirfd, path / names[i], bytesFreed, ex);
+}
+#endif
+
 static void _deletePath(
     Descriptor parentfd,
     const std::filesystem::path & path,
@@ -112,29 +212,8 @@ static void _deletePath(
         throw SysError("getting status of %1%", path);
     }
 
-    if (!S_ISDIR(st.st_mode)) {
-        /* We are about to delete a file. Will it likely free space? */
-
-        switch (st.st_nlink) {
-        /* Yes: last link. */
-        case 1:
-            bytesFreed += st.st_size;
-            break;
-        /* Maybe: yes, if 'auto-optimise-store' or manual optimisation
-           was performed. Instead of checking for real let's assume
-           it's an optimised file and space will be freed.
-
-           In worst case we will double count on freed space for files
-           with exactly two hardlinks for unoptimised packages.
-         */
-        case 2:
-            bytesFreed += st.st_size;
-            break;
-        /* No: 3+ links. */
-        default:
-            break;
-        }
-    }
+    if (!S_ISDIR(st.st_mode))
+        countFreedBytes(st.st_nlink, st.st_size, bytesFreed);
 
     if (S_ISDIR(st.st_mode)) {
         /* Make the directory accessible. */
@@ -151,30 +230,52 @@ static void _deletePath(
         if (!dir)
             throw SysError("opening directory %1%", path);
 
+#ifdef __linux__
+        /* Batching only pays off for directories with a fair number of
+           entries, since it requires setting up an io_uring. */
+        static constexpr size_t minBatchedEntries = 16;
+        bool batched = useIoUring();
+        std::vector<std::string> names;
+#endif
+
         struct dirent * dirent;
         while (errno = 0, dirent = readdir(dir.get())) { /* sic */
             checkInterrupt();
             std::string childName = dirent->d_name;
             if (childName == "." || childName == "..")
                 continue;
+#ifdef __linux__
+            if (batched) {
+                names.push_back(std::move(childName));
+                continue;
+            }
+#endif
             _deletePath(dirfd(dir.get()), path / childName, bytesFreed, ex MOUNTEDPATHS_ARG);
         }
         if (errno)
             throw SysError("reading directory %1%", path);
+
+#ifdef __linux__
+        std::optional<IoUringBatch> batch;
+        if (names.size() >= minBatchedEntries)
+            try {
+                batch.emplace();
+            } catch (Error & e) {
+                debug("not using io_uring: %s", e.msg());
+            }
+        if (batch)
+            deleteEntriesBatched(*batch, dirfd(dir.get()), path, names, bytesFreed, ex);
+        else
+            for (auto & childName : names)
+                _deletePath(dirfd(dir.get()), path / childName, bytesFreed, ex);
+#endif
     }
 
     int flags = S_ISDIR(st.st_mode) ? AT_REMOVEDIR : 0;
     if (unlinkat(parentfd, name.c_str(), flags) == -1) {
         if (errno == ENOENT)
             return;
-        try {
-            throw SysError("cannot unlink %1%", path);
-        } catch (...) {
-            if (!ex)
-                ex = std::current_exception();
-            else
-                ignoreExceptionExceptInterrupt();
-        }
+        recordUnlinkError(path, errno, ex);
     }
 }
 
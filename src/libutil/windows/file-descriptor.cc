@@ -60,6 +60,17 @@ void writeFull(HANDLE handle, std::string_view s, bool allowInterrupts)
     }
 }
 
+void writevFull(HANDLE handle, std::span<const std::string_view> parts, bool allowInterrupts)
+{
+    for (auto & part : parts)
+        writeFull(handle, part, allowInterrupts);
+}
+
+uint64_t copyFdInKernel(HANDLE from, HANDLE to, uint64_t len)
+{
+    return 0;
+}
+
 std::string readLine(HANDLE handle, bool eofOk)
 {
     std::string s;
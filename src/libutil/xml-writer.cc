@@ -4,11 +4,20 @@
 
 namespace nix {
 
+XMLWriter::XMLWriter(bool indent, Sink & sink)
+    : sink(sink)
+    , indent(indent)
+{
+    sink("<?xml version='1.0' encoding='utf-8'?>\n");
+    closed = false;
+}
+
 XMLWriter::XMLWriter(bool indent, std::ostream & output)
-    : output(output)
+    : streamSink(std::make_unique<LambdaSink>([&output](std::string_view data) { output << data; }))
+    , sink(*streamSink)
     , indent(indent)
 {
-    output << "<?xml version='1.0' encoding='utf-8'?>" << std::endl;
+    sink("<?xml version='1.0' encoding='utf-8'?>\n");
     closed = false;
 }
 
@@ -30,18 +39,22 @@ void XMLWriter::indent_(size_t depth)
 {
     if (!indent)
         return;
-    output << std::string(depth * 2, ' ');
+    static constexpr std::string_view spaces = "                                ";
+    for (auto n = depth * 2; n;) {
+        auto m = std::min(n, spaces.size());
+        sink(spaces.substr(0, m));
+        n -= m;
+    }
 }
 
 void XMLWriter::openElement(std::string_view name, const XMLAttrs & attrs)
 {
     assert(!closed);
     indent_(pendingElems.size());
-    output << "<" << name;
+    sink("<");
+    sink(name);
     writeAttrs(attrs);
-    output << ">";
-    if (indent)
-        output << std::endl;
+    sink(indent ? ">\n" : ">");
     pendingElems.push_back(std::string(name));
 }
 
@@ -49,9 +62,9 @@ void XMLWriter::closeElement()
 {
     assert(!pendingElems.empty());
     indent_(pendingElems.size() - 1);
-    output << "</" << pendingElems.back() << ">";
-    if (indent)
-        output << std::endl;
+    sink("</");
+    sink(pendingElems.back());
+    sink(indent ? ">\n" : ">");
     pendingElems.pop_back();
     if (pendingElems.empty())
         closed = true;
@@ -61,35 +74,51 @@ void XMLWriter::writeEmptyElement(std::string_view name, const XMLAttrs & attrs)
 {
     assert(!closed);
     indent_(pendingElems.size());
-    output << "<" << name;
+    sink("<");
+    sink(name);
     writeAttrs(attrs);
-    output << " />";
-    if (indent)
-        output << std::endl;
+    sink(indent ? " />\n" : " />");
 }
 
 void XMLWriter::writeAttrs(const XMLAttrs & attrs)
 {
     for (auto & i : attrs) {
-        output << " " << i.first << "=\"";
-        for (size_t j = 0; j < i.second.size(); ++j) {
-            char c = i.second[j];
-            if (c == '"')
-                output << "&quot;";
-            else if (c == '<')
-                output << "&lt;";
-            else if (c == '>')
-                output << "&gt;";
-            else if (c == '&')
-                output << "&amp;";
+        sink(" ");
+        sink(i.first);
+        sink("=\"");
+        /* Write the runs of characters that don't need escaping in
+           one go. */
+        std::string_view value = i.second;
+        size_t start = 0;
+        for (size_t j = 0; j < value.size(); ++j) {
+            std::string_view escaped;
+            switch (value[j]) {
+            case '"':
+                escaped = "&quot;";
+                break;
+            case '<':
+                escaped = "&lt;";
+                break;
+            case '>':
+                escaped = "&gt;";
+                break;
+            case '&':
+                escaped = "&amp;";
+                break;
             /* Escape newlines to prevent attribute normalisation (see
                XML spec, section 3.3.3. */
-            else if (c == '\n')
-                output << "&#xA;";
-            else
-                output << c;
+            case '\n':
+                escaped = "&#xA;";
+                break;
+            default:
+                continue;
+            }
+            sink(value.substr(start, j - start));
+            sink(escaped);
+            start = j + 1;
         }
-        output << "\"";
+        sink(value.substr(start));
+        sink("\"");
     }
 }
 
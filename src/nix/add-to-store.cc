@@ -2,15 +2,31 @@
 #include "nix/main/common-args.hh"
 #include "nix/store/store-api.hh"
 #include "nix/util/archive.hh"
+#include "nix/util/file-content-address.hh"
 #include "nix/util/git.hh"
 #include "nix/util/posix-source-accessor.hh"
 #include "nix/cmd/misc-store-flags.hh"
 
 using namespace nix;
 
+/**
+ * Paths whose serialisation is larger than this are streamed into the
+ * store one by one, rather than being batched in memory.
+ */
+static constexpr size_t maxBatchedPathSize = 1 << 20;
+
+/**
+ * Add the batched paths once their serialisations take up this much
+ * memory.
+ */
+static constexpr size_t maxBatchSize = 64 << 20;
+
+struct PathTooLarge
+{};
+
 struct CmdAddToStore : MixDryRun, StoreCommand
 {
-    Path path;
+    std::vector<std::string> paths;
     std::optional<std::string> namePart;
     ContentAddressMethod caMethod = ContentAddressMethod::Raw::NixArchive;
     HashAlgorithm hashAlgo = HashAlgorithm::SHA256;
@@ -18,12 +34,14 @@ struct CmdAddToStore : MixDryRun, StoreCommand
     CmdAddToStore()
     {
         // FIXME: completion
-        expectArg("path", &path);
+        expectArgs("paths", &paths);
 
         addFlag({
             .longName = "name",
             .shortName = 'n',
-            .description = "Override the name component of the store path. It defaults to the base name of *path*.",
+            .description =
+                "Override the name component of the store path. It defaults to the base name of *path*. "
+                "Only allowed with a single *path*.",
             .labels = {"name"},
             .handler = {&namePart},
         });
@@ -35,15 +53,76 @@ struct CmdAddToStore : MixDryRun, StoreCommand
 
     void run(ref<Store> store) override
     {
-        if (!namePart)
-            namePart = baseNameOf(path);
-
-        auto sourcePath = PosixSourceAccessor::createAtRoot(makeParentCanonical(path));
-
-        auto storePath = dryRun ? store->computeStorePath(*namePart, sourcePath, caMethod, hashAlgo, {}).first
-                                : store->addToStoreSlow(*namePart, sourcePath, caMethod, hashAlgo, {}).path;
-
-        logger->cout("%s", store->printStorePath(storePath));
+        if (namePart && paths.size() != 1)
+            throw UsageError("'--name' requires exactly one path");
+
+        /* Small paths are dominated by the per-path overhead of adding
+           them, so add them in batches. */
+        if (paths.size() > 1 && !dryRun) {
+            auto fsm = caMethod.getFileIngestionMethod() == FileIngestionMethod::Flat
+                           ? FileSerialisationMethod::Flat
+                           : FileSerialisationMethod::NixArchive;
+
+            std::vector<Store::DumpToAdd> batch;
+            size_t batchSize = 0;
+
+            auto flush = [&]() {
+                if (batch.empty())
+                    return;
+                for (auto & storePath : store->addMultipleToStoreFromDump(std::move(batch)))
+                    logger->cout("%s", store->printStorePath(storePath));
+                batch.clear();
+                batchSize = 0;
+            };
+
+            for (auto & path : paths) {
+                auto name = std::string(baseNameOf(path));
+                auto sourcePath = PosixSourceAccessor::createAtRoot(makeParentCanonical(path));
+
+                /* Give up on batching the path as soon as it turns out
+                   to be large. */
+                StringSink sink;
+                LambdaSink limitedSink([&](std::string_view data) {
+                    if (sink.s.size() + data.size() > maxBatchedPathSize)
+                        throw PathTooLarge();
+                    sink(data);
+                });
+                try {
+                    dumpPath(sourcePath, limitedSink, fsm);
+                } catch (PathTooLarge &) {
+                    /* Keep the output in the order of the arguments. */
+                    flush();
+                    auto storePath = store->addToStoreSlow(name, sourcePath, caMethod, hashAlgo, {}).path;
+                    logger->cout("%s", store->printStorePath(storePath));
+                    continue;
+                }
+
+                batchSize += sink.s.size();
+                batch.push_back({
+                    .name = std::move(name),
+                    .dump = std::move(sink.s),
+                    .dumpMethod = fsm,
+                    .hashMethod = caMethod,
+                    .hashAlgo = hashAlgo,
+                });
+                if (batchSize >= maxBatchSize)
+                    flush();
+            }
+
+            flush();
+            return;
+        }
+
+        for (auto & path : paths) {
+            auto name = namePart ? *namePart : std::string(baseNameOf(path));
+
+            auto sourcePath = PosixSourceAccessor::createAtRoot(makeParentCanonical(path));
+
+            auto storePath = dryRun ? store->computeStorePath(name, sourcePath, caMethod, hashAlgo, {}).first
+                                    : store->addToStoreSlow(name, sourcePath, caMethod, hashAlgo, {}).path;
+
+            logger->cout("%s", store->printStorePath(storePath));
+        }
     }
 };
 
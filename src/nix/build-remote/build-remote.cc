@@ -10,6 +10,7 @@
 #endif
 
 #include "nix/store/machines.hh"
+#include "nix/store/build/remote-builders.hh"
 #include "nix/main/shared.hh"
 #include "nix/main/plugin.hh"
 #include "nix/store/pathlocks.hh"
@@ -293,103 +294,14 @@ static int main_build_remote(int argc, char ** argv)
 
         uploadLock = -1;
 
-        auto drv = store->readDerivation(*drvPath);
-
-        std::optional<BuildResult> optResult;
-
-        // If we don't know whether we are trusted (e.g. `ssh://`
-        // stores), we assume we are. This is necessary for backwards
-        // compat.
-        bool trustedOrLegacy = ({
-            std::optional trusted = sshStore->isTrustedClient();
-            !trusted || *trusted;
-        });
-
-        // See the very large comment in `case WorkerProto::Op::BuildDerivation:` in
-        // `src/libstore/daemon.cc` that explains the trust model here.
-        //
-        // This condition mirrors that: that code enforces the "rules" outlined there;
-        // we do the best we can given those "rules".
-        if (trustedOrLegacy || drv.type().isCA()) {
-            // Hijack the inputs paths of the derivation to include all
-            // the paths that come from the `inputDrvs` set. We don’t do
-            // that for the derivations whose `inputDrvs` is empty
-            // because:
-            //
-            // 1. It’s not needed
-            //
-            // 2. Changing the `inputSrcs` set changes the associated
-            //    output ids, which break CA derivations
-            if (!drv.inputDrvs.map.empty())
-                drv.inputSrcs = store->parseStorePathSet(inputs);
-            optResult = sshStore->buildDerivation(*drvPath, static_cast<const BasicDerivation &>(drv));
-            auto & result = *optResult;
-            if (auto * failureP = result.tryGetFailure()) {
-                if (settings.keepFailed) {
-                    warn(
-                        "The failed build directory was kept on the remote builder due to `--keep-failed`.%s",
-                        (settings.thisSystem == drv.platform || settings.extraPlatforms.get().count(drv.platform) > 0)
-                            ? " You can re-run the command with `--builders ''` to disable remote building for this invocation."
-                            : "");
-                }
-                throw Error(
-                    "build of '%s' on '%s' failed: %s", store->printStorePath(*drvPath), storeUri, failureP->errorMsg);
-            }
-        } else {
-            copyClosure(*store, *sshStore, StorePathSet{*drvPath}, NoRepair, NoCheckSigs, substitute);
-            auto res = sshStore->buildPathsWithResults({DerivedPath::Built{
-                .drvPath = makeConstantStorePathRef(*drvPath),
-                .outputs = OutputsSpec::All{},
-            }});
-            // One path to build should produce exactly one build result
-            assert(res.size() == 1);
-            optResult = std::move(res[0]);
-        }
-
-        auto outputHashes = staticOutputHashes(*store, drv);
-        std::set<Realisation> missingRealisations;
-        StorePathSet missingPaths;
-        if (experimentalFeatureSettings.isEnabled(Xp::CaDerivations) && !drv.type().hasKnownOutputPaths()) {
-            for (auto & outputName : wantedOutputs) {
-                auto thisOutputHash = outputHashes.at(outputName);
-                auto thisOutputId = DrvOutput{thisOutputHash, outputName};
-                if (!store->queryRealisation(thisOutputId)) {
-                    debug("missing output %s", outputName);
-                    assert(optResult);
-                    auto & result = *optResult;
-                    if (auto * successP = result.tryGetSuccess()) {
-                        auto & success = *successP;
-                        auto i = success.builtOutputs.find(outputName);
-                        assert(i != success.builtOutputs.end());
-                        auto & newRealisation = i->second;
-                        missingRealisations.insert(newRealisation);
-                        missingPaths.insert(newRealisation.outPath);
-                    }
-                }
-            }
-        } else {
-            auto outputPaths = drv.outputsAndOptPaths(*store);
-            for (auto & [outputName, hopefullyOutputPath] : outputPaths) {
-                assert(hopefullyOutputPath.second);
-                if (!store->isValidPath(*hopefullyOutputPath.second))
-                    missingPaths.insert(*hopefullyOutputPath.second);
-            }
-        }
-
-        if (!missingPaths.empty()) {
-            Activity act(*logger, lvlTalkative, actUnknown, fmt("copying outputs from '%s'", storeUri));
-            if (auto localStore = store.dynamic_pointer_cast<LocalStore>())
-                for (auto & path : missingPaths)
-                    localStore->locksHeld.insert(store->printStorePath(path)); /* FIXME: ugly */
-            copyPaths(*sshStore, *store, missingPaths, NoRepair, NoCheckSigs, NoSubstitute);
-        }
-        // XXX: Should be done as part of `copyPaths`
-        for (auto & realisation : missingRealisations) {
-            // Should hold, because if the feature isn't enabled the set
-            // of missing realisations should be empty
-            experimentalFeatureSettings.require(Xp::CaDerivations);
-            store->registerDrvOutput(realisation);
-        }
+        buildOnRemoteStore(
+            *store,
+            *sshStore,
+            storeUri,
+            *drvPath,
+            store->readDerivation(*drvPath),
+            store->parseStorePathSet(inputs),
+            wantedOutputs);
 
         return 0;
     }
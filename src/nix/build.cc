@@ -100,6 +100,18 @@ builtPathsWithResultToJSON(const std::vector<BuiltPathWithResult> & buildables,
                 j["cpuUser"] = ((double) b.result->cpuUser->count()) / 1000000;
             if (b.result->cpuSystem)
                 j["cpuSystem"] = ((double) b.result->cpuSystem->count()) / 1000000;
+            if (b.result->peakMemory)
+                j["peakMemory"] = *b.result->peakMemory;
+            if (b.result->ioRead)
+                j["ioRead"] = *b.result->ioRead;
+            if (b.result->ioWrite)
+                j["ioWrite"] = *b.result->ioWrite;
+            if (b.result->cpuStall)
+                j["cpuStall"] = ((double) b.result->cpuStall->count()) / 1000000;
+            if (b.result->memoryStall)
+                j["memoryStall"] = ((double) b.result->memoryStall->count()) / 1000000;
+            if (b.result->ioStall)
+                j["ioStall"] = ((double) b.result->ioStall->count()) / 1000000;
         }
         res.push_back(j);
     }
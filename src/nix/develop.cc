@@ -8,6 +8,7 @@
 #include "nix/store/globals.hh"
 #include "nix/store/outputs-spec.hh"
 #include "nix/store/derivations.hh"
+#include "nix/util/users.hh"
 
 #ifndef _WIN32 // TODO re-enable on Windows
 #  include "run.hh"
@@ -234,7 +235,7 @@ const static std::string getEnvSh =
  * initial environment variables, that just writes the resulting
  * environment to a file and exits.
  */
-static StorePath getDerivationEnvironment(ref<Store> store, ref<Store> evalStore, const StorePath & drvPath)
+static StorePath buildDerivationEnvironment(ref<Store> store, ref<Store> evalStore, const StorePath & drvPath)
 {
     auto drv = evalStore->derivationFromPath(drvPath);
 
@@ -314,6 +315,53 @@ static StorePath getDerivationEnvironment(ref<Store> store, ref<Store> evalStore
     throw Error("get-env.sh failed to produce an environment");
 }
 
+/**
+ * The file that records the environment output built for `drvPath`.
+ * The environment derivation is a function of the original derivation
+ * and `get-env.sh`, so the key covers both.
+ */
+static std::filesystem::path getEnvironmentCacheFile(Store & store, const StorePath & drvPath)
+{
+    auto key = hashString(HashAlgorithm::SHA256, fmt("%s\n%s", store.printStorePath(drvPath), getEnvSh))
+                   .to_string(HashFormat::Nix32, false);
+    return getCacheDir() / "dev-env-v1" / key;
+}
+
+/**
+ * Like `buildDerivationEnvironment()`, but cached per derivation, so
+ * entering the same shell again doesn't have to write and build the
+ * modified derivation.
+ */
+static StorePath getDerivationEnvironment(ref<Store> store, ref<Store> evalStore, const StorePath & drvPath)
+{
+    auto cacheFile = getEnvironmentCacheFile(*store, drvPath);
+
+    try {
+        if (pathExists(cacheFile)) {
+            auto path = store->parseStorePath(trim(readFile(cacheFile)));
+            if (store->isValidPath(path)) {
+                debug("using cached environment '%s' of '%s'", store->printStorePath(path), store->printStorePath(drvPath));
+                return path;
+            }
+        }
+    } catch (Error & e) {
+        debug("ignoring environment cache entry '%s': %s", cacheFile.string(), e.msg());
+    }
+
+    auto envPath = buildDerivationEnvironment(store, evalStore, drvPath);
+
+    try {
+        createDirs(cacheFile.parent_path());
+        auto tmp = makeTempPath(cacheFile);
+        writeFile(tmp.string(), store->printStorePath(envPath));
+        std::filesystem::rename(tmp, cacheFile);
+    } catch (std::exception & e) {
+        debug("cannot write environment cache entry '%s': %s", cacheFile.string(), e.what());
+    }
+
+    return envPath;
+}
+
 struct Common : InstallableCommand, MixProfile
 {
     StringSet ignoreVars{
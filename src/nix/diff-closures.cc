@@ -2,53 +2,94 @@
 #include "nix/main/shared.hh"
 #include "nix/store/store-api.hh"
 #include "nix/main/common-args.hh"
-#include "nix/store/names.hh"
-
-#include <regex>
-
 #include "nix/util/strings.hh"
 
+#include <algorithm>
+
 namespace nix {
 
-namespace {
+/**
+ * Split a store path name into a package name and version. This
+ * strips the output name first, which is ambiguous (we can't
+ * distinguish between output names like "bin" and version suffixes
+ * like "unstable"), and then splits like `DrvName`, but without
+ * copying the name.
+ */
+static std::pair<std::string_view, std::string_view> splitPathName(std::string_view name)
+{
+    if (auto dash = name.rfind('-'); dash != name.npos) {
+        auto suffix = name.substr(dash + 1);
+        if (suffix == "lib32" || suffix == "lib64"
+            || (!suffix.empty() && std::ranges::all_of(suffix, [](char c) { return c >= 'a' && c <= 'z'; })))
+            name = name.substr(0, dash);
+    }
+
+    for (size_t i = 0; i + 1 < name.size(); ++i)
+        if (name[i] == '-' && !isalpha(name[i + 1]))
+            return {name.substr(0, i), name.substr(i + 1)};
 
-struct Info
+    return {name, {}};
+}
+
+ClosureDiffer::ClosureDiffer(ref<Store> store)
+    : store(store)
 {
-    std::string outputName;
-};
+}
 
-} // namespace
+void ClosureDiffer::prefetch(const StorePathSet & paths)
+{
+    StorePathSet todo;
+    for (auto & path : paths)
+        if (!entries.contains(path))
+            todo.insert(path);
+
+    while (!todo.empty()) {
+        auto infos = store->queryMultiplePathInfos(todo);
+
+        StorePathSet next;
+        for (auto & path : todo) {
+            auto i = infos.find(path);
+            if (i == infos.end())
+                throw InvalidPath("path '%s' is not valid", store->printStorePath(path));
+            auto & info = *i->second;
+
+            auto entry = entries.emplace(path, Entry{.narSize = info.narSize, .references = info.references}).first;
+            std::tie(entry->second.name, entry->second.version) = splitPathName(entry->first.name());
+
+            for (auto & ref : info.references)
+                if (!entries.contains(ref) && !todo.contains(ref))
+                    next.insert(ref);
+        }
 
-// name -> version -> store paths
-typedef std::map<std::string, std::map<std::string, std::map<StorePath, Info>>> GroupedPaths;
+        todo = std::move(next);
+    }
+}
 
-GroupedPaths getClosureInfo(ref<Store> store, const StorePath & toplevel)
+const ClosureDiffer::GroupedPaths & ClosureDiffer::getClosureInfo(const StorePath & toplevel)
 {
-    StorePathSet closure;
-    store->computeFSClosure({toplevel}, closure);
+    if (auto i = closures.find(toplevel); i != closures.end())
+        return i->second;
+
+    prefetch({toplevel});
 
     GroupedPaths groupedPaths;
 
-    for (auto const & path : closure) {
-        /* Strip the output name. Unfortunately this is ambiguous (we
-           can't distinguish between output names like "bin" and
-           version suffixes like "unstable"). */
-        static std::regex regex("(.*)-([a-z]+|lib32|lib64)");
-        std::cmatch match;
-        std::string name{path.name()};
-        std::string_view const origName = path.name();
-        std::string outputName;
-
-        if (std::regex_match(origName.begin(), origName.end(), match, regex)) {
-            name = match[1];
-            outputName = match[2];
+    std::set<const Entry *> seen;
+    std::vector<const Entry *> todo{&entries.at(toplevel)};
+    seen.insert(todo.back());
+
+    while (!todo.empty()) {
+        auto entry = todo.back();
+        todo.pop_back();
+        groupedPaths[entry->name][entry->version] += entry->narSize;
+        for (auto & ref : entry->references) {
+            auto refEntry = &entries.at(ref);
+            if (seen.insert(refEntry).second)
+                todo.push_back(refEntry);
         }
-
-        DrvName drvName(name);
-        groupedPaths[drvName.name][drvName.version].emplace(path, Info{.outputName = outputName});
     }
 
-    return groupedPaths;
+    return closures.emplace(toplevel, std::move(groupedPaths)).first->second;
 }
 
 std::string showVersions(const StringSet & versions)
@@ -61,27 +102,31 @@ std::string showVersions(const StringSet & versions)
     return concatStringsSep(", ", versions2);
 }
 
-void printClosureDiff(
-    ref<Store> store, const StorePath & beforePath, const StorePath & afterPath, std::string_view indent)
+void ClosureDiffer::printDiff(const StorePath & beforePath, const StorePath & afterPath, std::string_view indent)
 {
-    auto beforeClosure = getClosureInfo(store, beforePath);
-    auto afterClosure = getClosureInfo(store, afterPath);
+    prefetch({beforePath, afterPath});
+
+    auto & beforeClosure = getClosureInfo(beforePath);
+    auto & afterClosure = getClosureInfo(afterPath);
 
-    StringSet allNames;
+    std::set<std::string_view> allNames;
     for (auto & [name, _] : beforeClosure)
         allNames.insert(name);
     for (auto & [name, _] : afterClosure)
         allNames.insert(name);
 
+    static const std::map<std::string_view, uint64_t> noVersions;
+
     for (auto & name : allNames) {
-        auto & beforeVersions = beforeClosure[name];
-        auto & afterVersions = afterClosure[name];
+        auto i = beforeClosure.find(name);
+        auto & beforeVersions = i != beforeClosure.end() ? i->second : noVersions;
+        auto j = afterClosure.find(name);
+        auto & afterVersions = j != afterClosure.end() ? j->second : noVersions;
 
-        auto totalSize = [&](const std::map<std::string, std::map<StorePath, Info>> & versions) {
+        auto totalSize = [&](const std::map<std::string_view, uint64_t> & versions) {
             uint64_t sum = 0;
-            for (auto & [_, paths] : versions)
-                for (auto & [path, _] : paths)
-                    sum += store->queryPathInfo(path)->narSize;
+            for (auto & [_, size] : versions)
+                sum += size;
             return sum;
         };
 
@@ -93,14 +138,14 @@ void printClosureDiff(
         StringSet removed, unchanged;
         for (auto & [version, _] : beforeVersions)
             if (!afterVersions.count(version))
-                removed.insert(version);
+                removed.insert(std::string(version));
             else
-                unchanged.insert(version);
+                unchanged.insert(std::string(version));
 
         StringSet added;
         for (auto & [version, _] : afterVersions)
             if (!beforeVersions.count(version))
-                added.insert(version);
+                added.insert(std::string(version));
 
         if (showDelta || !removed.empty() || !added.empty()) {
             std::vector<std::string> items;
@@ -113,6 +158,12 @@ void printClosureDiff(
     }
 }
 
+void printClosureDiff(
+    ref<Store> store, const StorePath & beforePath, const StorePath & afterPath, std::string_view indent)
+{
+    ClosureDiffer(store).printDiff(beforePath, afterPath, indent);
+}
+
 } // namespace nix
 
 using namespace nix;
@@ -66,6 +66,26 @@ struct CmdShell : InstallablesCommand, MixEnvironment
             ;
     }
 
+    void run(ref<Store> store, std::vector<std::string> && rawInstallables) override
+    {
+        InstallableResolutionCache cache("shell", *this, *store, rawInstallables);
+
+        if (auto paths = cache.lookup()) {
+            StorePaths outPaths;
+            for (auto & path : *paths)
+                outPaths.push_back(store->parseStorePath(path));
+            auto storeFS = makeMountedSourceAccessor({
+                {CanonPath::root, makeEmptySourceAccessor()},
+                {CanonPath(store->storeDir), store->getFSAccessor()},
+            });
+            exec(store, *storeFS, outPaths);
+            return;
+        }
+
+        resolutionCache = &cache;
+        InstallablesCommand::run(store, std::move(rawInstallables));
+    }
+
     void run(ref<Store> store, Installables && installables) override
     {
         auto state = getEvalState();
@@ -73,6 +93,26 @@ struct CmdShell : InstallablesCommand, MixEnvironment
         auto outPaths =
             Installable::toStorePaths(getEvalStore(), store, Realise::Outputs, OperateOn::Output, installables);
 
+        if (resolutionCache) {
+            Strings paths;
+            for (auto & path : outPaths)
+                paths.push_back(store->printStorePath(path));
+            resolutionCache->upsert(paths);
+        }
+
+        // Release our references to eval caches to ensure they are persisted to disk, because
+        // we are about to exec out of this process without running C++ destructors.
+        state->evalCaches.clear();
+
+        exec(store, *state->storeFS, outPaths);
+    }
+
+private:
+
+    InstallableResolutionCache * resolutionCache = nullptr;
+
+    void exec(ref<Store> store, SourceAccessor & storeFS, const StorePaths & outPaths)
+    {
         boost::unordered_flat_set<StorePath, std::hash<StorePath>> done;
         std::queue<StorePath> todo;
         for (auto & path : outPaths)
@@ -88,16 +128,16 @@ struct CmdShell : InstallablesCommand, MixEnvironment
             if (!done.insert(path).second)
                 continue;
 
-            auto binDir = state->storeFS->resolveSymlinks(CanonPath(store->printStorePath(path)) / "bin");
+            auto binDir = storeFS.resolveSymlinks(CanonPath(store->printStorePath(path)) / "bin");
             if (!store->isInStore(binDir.abs()))
                 throw Error("path '%s' is not in the Nix store", binDir);
 
             pathAdditions.push_back(binDir.abs());
 
-            auto propPath = state->storeFS->resolveSymlinks(
+            auto propPath = storeFS.resolveSymlinks(
                 CanonPath(store->printStorePath(path)) / "nix-support" / "propagated-user-env-packages");
-            if (auto st = state->storeFS->maybeLstat(propPath); st && st->type == SourceAccessor::tRegular) {
-                for (auto & p : tokenizeString<Paths>(state->storeFS->readFile(propPath)))
+            if (auto st = storeFS.maybeLstat(propPath); st && st->type == SourceAccessor::tRegular) {
+                for (auto & p : tokenizeString<Paths>(storeFS.readFile(propPath)))
                     todo.push(store->parseStorePath(p));
             }
         }
@@ -112,10 +152,6 @@ struct CmdShell : InstallablesCommand, MixEnvironment
         for (auto & arg : command)
             args.push_back(arg);
 
-        // Release our references to eval caches to ensure they are persisted to disk, because
-        // we are about to exec out of this process without running C++ destructors.
-        state->evalCaches.clear();
-
         execProgramInStore(store, UseLookupPath::Use, *command.begin(), args);
     }
 };
@@ -119,6 +119,16 @@ struct CmdEval : MixJSON, InstallableValueCommand, MixReadOnlyOption
                 *state->coerceToString(noPos, *v, context, "while generating the eval command output"));
         }
 
+        else if (json && !outputPretty) {
+            /* Stream the output, so that a large value doesn't have to be
+               held in memory twice. */
+            logger->stop();
+            FdSink sink(getStandardOutput());
+            printValueAsJSON(*state, true, *v, pos, sink, context, false);
+            sink("\n");
+            sink.flush();
+        }
+
         else if (json) {
             printJSON(printValueAsJSON(*state, true, *v, pos, context, false));
         }
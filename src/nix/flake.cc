@@ -17,10 +17,14 @@
 #include "nix/fetchers/fetch-to-store.hh"
 #include "nix/store/local-fs-store.hh"
 #include "nix/store/globals.hh"
+#include "nix/util/sync.hh"
+#include "nix/util/thread-pool.hh"
+#include "nix/store/filetransfer.hh"
 
 #include <filesystem>
 #include <nlohmann/json.hpp>
 #include <iomanip>
+#include <thread>
 
 #include "nix/util/strings-inline.hh"
 
@@ -313,6 +317,208 @@ struct CmdFlakeInfo : CmdFlakeMetadata
     }
 };
 
+namespace {
+
+/**
+ * Builds the checks found by `nix flake check` in a background thread
+ * while the rest of the flake is still being evaluated. The worker
+ * can't accept new goals while it is building, so checks submitted
+ * during a build are built together as the next batch.
+ *
+ * Failures are reported as soon as their batch has finished. With
+ * `keep-going`, they are logged right away; otherwise building stops at
+ * the first failure, which `submit()` and `finish()` rethrow.
+ */
+struct CheckBuilder
+{
+    ref<Store> store;
+
+    CheckBuilder(ref<Store> store)
+        : store(store)
+    {
+    }
+
+    ~CheckBuilder()
+    {
+        quit = true;
+        wakeup.notify_one();
+        if (thread.joinable())
+            thread.join();
+    }
+
+    /**
+     * Queue `path` for building. `attrPath` is the attribute it was
+     * found at, for error messages.
+     */
+    void submit(const DerivedPath & path, std::string attrPath)
+    {
+        rethrow();
+
+        std::optional<std::string> failure;
+        {
+            auto state(state_.lock());
+            auto & attrPaths = state->attrPathsByDrv[path];
+            attrPaths.push_back(attrPath);
+            if (attrPaths.size() == 1)
+                state->pending.push_back(path);
+            else if (auto i = state->failures.find(path); i != state->failures.end())
+                /* Already built (and failed) under another attribute. */
+                failure = i->second;
+        }
+
+        if (failure)
+            reportError(Error(
+                "failed to build attribute '%s', build of '%s' failed: %s",
+                attrPath,
+                path.to_string(*store),
+                *failure));
+
+        if (!thread.joinable())
+            thread = std::thread([this]() { run(); });
+        wakeup.notify_one();
+    }
+
+    /**
+     * Wait for the submitted checks to be built.
+     *
+     * @return Whether any of them failed.
+     */
+    bool finish()
+    {
+        state_.lock()->done = true;
+        wakeup.notify_one();
+        if (thread.joinable())
+            thread.join();
+        rethrow();
+        return hasErrors;
+    }
+
+private:
+
+    struct State
+    {
+        std::map<DerivedPath, std::vector<std::string>> attrPathsByDrv;
+        std::vector<DerivedPath> pending;
+        std::map<DerivedPath, std::string> failures;
+        bool done = false;
+        std::exception_ptr error;
+    };
+
+    Sync<State> state_;
+
+    std::condition_variable wakeup;
+
+    std::atomic<bool> quit{false};
+
+    std::atomic<bool> hasErrors{false};
+
+    std::thread thread;
+
+    void rethrow()
+    {
+        if (auto error = state_.lock()->error)
+            std::rethrow_exception(error);
+    }
+
+    void reportError(const Error & e)
+    {
+        if (settings.keepGoing) {
+            logError(e.info());
+            hasErrors = true;
+        } else {
+            state_.lock()->error = std::make_exception_ptr(e);
+            quit = true;
+        }
+    }
+
+    void run()
+    {
+        ReceiveInterrupts receiveInterrupts;
+
+#ifndef _WIN32
+        unix::interruptCheck = [&]() { return (bool) quit; };
+#endif
+
+        try {
+            while (true) {
+                std::vector<DerivedPath> batch;
+                {
+                    auto state(state_.lock());
+                    while (state->pending.empty() && !state->done && !quit)
+                        state.wait(wakeup);
+                    if (quit || state->pending.empty())
+                        return;
+                    std::swap(batch, state->pending);
+                }
+                buildBatch(batch);
+            }
+        } catch (...) {
+            auto state(state_.lock());
+            if (!state->error)
+                state->error = std::current_exception();
+            quit = true;
+        }
+    }
+
+    void buildBatch(const std::vector<DerivedPath> & batch)
+    {
+        // TODO: This filtering of substitutable paths is a temporary workaround until
+        // https://github.com/NixOS/nix/issues/5025 (union stores) is implemented.
+        //
+        // Once union stores are available, this code should be replaced with a proper
+        // union store configuration. Ideally, we'd use a union of multiple destination
+        // stores to preserve the current behavior where different substituters can
+        // cache different check results.
+        //
+        // For now, we skip building derivations whose outputs are already available
+        // via substitution, as `nix flake check` only needs to verify buildability,
+        // not actually produce the outputs.
+        auto missing = store->queryMissing(batch);
+
+        std::vector<DerivedPath> toBuild;
+        for (auto & path : missing.willBuild) {
+            toBuild.emplace_back(
+                DerivedPath::Built{
+                    .drvPath = makeConstantStorePathRef(path),
+                    .outputs = OutputsSpec::All{},
+                });
+        }
+
+        if (toBuild.empty())
+            return;
+
+        Activity act(*logger, lvlInfo, actUnknown, fmt("running %d flake checks", toBuild.size()));
+        auto results = store->buildPathsWithResults(toBuild);
+
+        // Report build failures with attribute paths
+        for (auto & result : results) {
+            if (auto * failure = result.tryGetFailure()) {
+                std::vector<std::string> attrPaths;
+                {
+                    auto state(state_.lock());
+                    state->failures.insert_or_assign(result.path, failure->errorMsg);
+                    if (auto i = state->attrPathsByDrv.find(result.path); i != state->attrPathsByDrv.end())
+                        attrPaths = i->second;
+                }
+                if (!attrPaths.empty()) {
+                    for (auto & attrPath : attrPaths)
+                        reportError(Error(
+                            "failed to build attribute '%s', build of '%s' failed: %s",
+                            attrPath,
+                            result.path.to_string(*store),
+                            failure->errorMsg));
+                } else
+                    // Derivation has no attribute path (e.g., a build dependency)
+                    reportError(Error("build of '%s' failed: %s", result.path.to_string(*store), failure->errorMsg));
+                if (quit)
+                    return;
+            }
+        }
+    }
+};
+
+} // namespace
+
 struct CmdFlakeCheck : FlakeCommand
 {
     bool build = true;
@@ -421,7 +627,7 @@ struct CmdFlakeCheck : FlakeCommand
             return std::nullopt;
         };
 
-        std::map<DerivedPath, std::vector<AttrPath>> attrPathsByDrv;
+        CheckBuilder builder(store);
 
         auto checkApp = [&](const std::string & attrPath, Value & v, const PosIdx pos) {
             try {
@@ -620,9 +826,11 @@ struct CmdFlakeCheck : FlakeCommand
                                             .outputs = OutputsSpec::All{},
                                         };
 
-                                        // Build and store the attribute path for error reporting
-                                        AttrPath attrPath{state->symbols.create(name), attr.name, attr2.name};
-                                        attrPathsByDrv[path].push_back(std::move(attrPath));
+                                        if (build) {
+                                            // Start building while we evaluate the remaining outputs
+                                            AttrPath attrPath{state->symbols.create(name), attr.name, attr2.name};
+                                            builder.submit(path, attrPath.to_string(*state));
+                                        }
                                     }
                                 }
                             }
@@ -786,54 +994,9 @@ struct CmdFlakeCheck : FlakeCommand
             });
         }
 
-        if (build && !attrPathsByDrv.empty()) {
-            auto keys = std::views::keys(attrPathsByDrv);
-            std::vector<DerivedPath> drvPaths(keys.begin(), keys.end());
-            // TODO: This filtering of substitutable paths is a temporary workaround until
-            // https://github.com/NixOS/nix/issues/5025 (union stores) is implemented.
-            //
-            // Once union stores are available, this code should be replaced with a proper
-            // union store configuration. Ideally, we'd use a union of multiple destination
-            // stores to preserve the current behavior where different substituters can
-            // cache different check results.
-            //
-            // For now, we skip building derivations whose outputs are already available
-            // via substitution, as `nix flake check` only needs to verify buildability,
-            // not actually produce the outputs.
-            auto missing = store->queryMissing(drvPaths);
-
-            std::vector<DerivedPath> toBuild;
-            for (auto & path : missing.willBuild) {
-                toBuild.emplace_back(
-                    DerivedPath::Built{
-                        .drvPath = makeConstantStorePathRef(path),
-                        .outputs = OutputsSpec::All{},
-                    });
-            }
+        if (builder.finish())
+            hasErrors = true;
 
-            Activity act(*logger, lvlInfo, actUnknown, fmt("running %d flake checks", toBuild.size()));
-            auto results = store->buildPathsWithResults(toBuild);
-
-            // Report build failures with attribute paths
-            for (auto & result : results) {
-                if (auto * failure = result.tryGetFailure()) {
-                    auto it = attrPathsByDrv.find(result.path);
-                    if (it != attrPathsByDrv.end() && !it->second.empty()) {
-                        for (auto & attrPath : it->second) {
-                            reportError(Error(
-                                "failed to build attribute '%s', build of '%s' failed: %s",
-                                attrPath.to_string(*state),
-                                result.path.to_string(*store),
-                                failure->errorMsg));
-                        }
-                    } else {
-                        // Derivation has no attribute path (e.g., a build dependency)
-                        reportError(
-                            Error("build of '%s' failed: %s", result.path.to_string(*store), failure->errorMsg));
-                    }
-                }
-            }
-        }
         if (hasErrors)
             throw Error("some errors were encountered during the evaluation");
 
@@ -1084,50 +1247,103 @@ struct CmdFlakeArchive : FlakeCommand, MixJSON, MixDryRun, MixNoCheckSigs
     {
         auto flake = lockFlake();
 
-        StorePathSet sources;
-
         auto storePath = store->toStorePath(flake.flake.path.path.abs()).first;
 
-        sources.insert(storePath);
-
-        // FIXME: use graph output, handle cycles.
-        std::function<nlohmann::json(const Node & node)> traverse;
-        traverse = [&](const Node & node) {
-            nlohmann::json jsonObj2 = json ? json::object() : nlohmann::json(nullptr);
-            for (auto & [inputName, input] : node.inputs) {
-                if (auto inputNode = std::get_if<0>(&input)) {
-                    std::optional<StorePath> storePath;
-                    if (!(*inputNode)->lockedRef.input.isRelative()) {
-                        storePath = dryRun ? (*inputNode)->lockedRef.input.computeStorePath(*store)
-                                           : (*inputNode)->lockedRef.input.fetchToStore(fetchSettings, *store).first;
-                        sources.insert(*storePath);
-                    }
-                    if (json) {
+        /* Collect the locked inputs, visiting nodes that are shared by
+           several inputs once. */
+        std::vector<const LockedNode *> nodes;
+        {
+            std::set<const Node *> visited;
+            auto visit = [&](this const auto & visit, const Node & node) -> void {
+                for (auto & [inputName, input] : node.inputs)
+                    if (auto inputNode = std::get_if<0>(&input))
+                        if (visited.insert(&**inputNode).second) {
+                            nodes.push_back(&**inputNode);
+                            visit(**inputNode);
+                        }
+            };
+            visit(*flake.lockFile.root);
+        }
+
+        /* The store paths of the inputs that we can compute without
+           fetching them. */
+        std::map<const LockedNode *, StorePath> paths;
+        for (auto node : nodes) {
+            if (node->lockedRef.input.isRelative())
+                continue;
+            try {
+                paths.insert_or_assign(node, node->lockedRef.input.computeStorePath(*store));
+            } catch (Error &) {
+                if (dryRun)
+                    throw;
+            }
+        }
+
+        if (!dryRun) {
+            auto dstStore = dstUri.empty() ? nullptr : openStore(dstUri).get_ptr();
+
+            /* Don't fetch or copy the inputs that the destination
+               already has. */
+            StorePathSet valid;
+            if (dstStore) {
+                StorePathSet known{storePath};
+                for (auto & [_, path] : paths)
+                    known.insert(path);
+                valid = dstStore->queryValidPaths(known);
+            }
+
+            auto copy = [&](const StorePath & path) {
+                if (dstStore && !valid.contains(path))
+                    copyPaths(*store, *dstStore, {path}, NoRepair, checkSigs, substitute);
+            };
+
+            /* Fetch the inputs concurrently, and upload each one as soon
+               as it has been fetched. */
+            Sync<std::map<const LockedNode *, StorePath>> fetched_;
+            ThreadPool pool{fileTransferSettings.httpConnections};
+
+            pool.enqueue([&]() { copy(storePath); });
+
+            for (auto node : nodes) {
+                if (node->lockedRef.input.isRelative())
+                    continue;
+                if (auto path = get(paths, node); path && valid.contains(*path))
+                    continue;
+                pool.enqueue([&, node]() {
+                    Activity act(*logger, lvlInfo, actUnknown, fmt("fetching '%s'", node->lockedRef));
+                    auto path = node->lockedRef.input.fetchToStore(fetchSettings, *store).first;
+                    fetched_.lock()->insert_or_assign(node, path);
+                    copy(path);
+                });
+            }
+
+            pool.process();
+
+            for (auto & [node, path] : *fetched_.lock())
+                paths.insert_or_assign(node, path);
+        }
+
+        if (json) {
+            // FIXME: use graph output, handle cycles.
+            std::function<nlohmann::json(const Node & node)> traverse;
+            traverse = [&](const Node & node) {
+                nlohmann::json jsonObj2 = json::object();
+                for (auto & [inputName, input] : node.inputs) {
+                    if (auto inputNode = std::get_if<0>(&input)) {
                         auto & jsonObj3 = jsonObj2[inputName];
-                        if (storePath)
-                            jsonObj3["path"] = store->printStorePath(*storePath);
+                        if (auto path = get(paths, &**inputNode))
+                            jsonObj3["path"] = store->printStorePath(*path);
                         jsonObj3["inputs"] = traverse(**inputNode);
-                    } else
-                        traverse(**inputNode);
+                    }
                 }
-            }
-            return jsonObj2;
-        };
+                return jsonObj2;
+            };
 
-        if (json) {
             nlohmann::json jsonRoot = {
                 {"path", store->printStorePath(storePath)},
                 {"inputs", traverse(*flake.lockFile.root)},
             };
             printJSON(jsonRoot);
-        } else {
-            traverse(*flake.lockFile.root);
-        }
-
-        if (!dryRun && !dstUri.empty()) {
-            ref<Store> dstStore = dstUri.empty() ? openStore() : openStore(dstUri);
-
-            copyPaths(*store, *dstStore, sources, NoRepair, checkSigs, substitute);
         }
     }
 };
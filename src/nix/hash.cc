@@ -6,6 +6,7 @@
 #include "nix/store/references.hh"
 #include "nix/util/archive.hh"
 #include "nix/util/git.hh"
+#include "nix/util/file-hash-cache.hh"
 #include "nix/util/posix-source-accessor.hh"
 #include "nix/cmd/misc-store-flags.hh"
 #include "man-pages.hh"
@@ -90,42 +91,45 @@ struct CmdHashBase : Command
             };
 
             Hash h{HashAlgorithm::SHA256}; // throwaway def to appease C++
-            switch (mode) {
-            case FileIngestionMethod::Flat: {
-                // While usually we could use the some code as for NixArchive,
-                // the Flat method needs to support FIFOs, such as those
-                // produced by bash process substitution, e.g.:
-                //     nix hash --mode flat <(echo hi)
-                // Also symlinks semantics are unambiguous in the flat case,
-                // so we don't need to go low-level, or reject symlink `path`s.
-                auto hashSink = makeSink();
-                readFile(path, *hashSink);
-                h = hashSink->finish().hash;
-                break;
-            }
-            case FileIngestionMethod::NixArchive: {
-                auto sourcePath = makeSourcePath();
-                auto hashSink = makeSink();
-                dumpPath(sourcePath, *hashSink, (FileSerialisationMethod) mode);
-                h = hashSink->finish().hash;
-                break;
-            }
-            case FileIngestionMethod::Git: {
-                auto sourcePath = makeSourcePath();
-                std::function<git::DumpHook> hook;
-                hook = [&](const SourcePath & path) -> git::TreeEntry {
+            if (!modulus && mode != FileIngestionMethod::Flat)
+                h = hashPathCached(makeSourcePath(), mode, hashAlgo).first;
+            else
+                switch (mode) {
+                case FileIngestionMethod::Flat: {
+                    // While usually we could use the some code as for NixArchive,
+                    // the Flat method needs to support FIFOs, such as those
+                    // produced by bash process substitution, e.g.:
+                    //     nix hash --mode flat <(echo hi)
+                    // Also symlinks semantics are unambiguous in the flat case,
+                    // so we don't need to go low-level, or reject symlink `path`s.
+                    auto hashSink = makeSink();
+                    readFile(path, *hashSink);
+                    h = hashSink->finish().hash;
+                    break;
+                }
+                case FileIngestionMethod::NixArchive: {
+                    auto sourcePath = makeSourcePath();
                     auto hashSink = makeSink();
-                    auto mode = dump(path, *hashSink, hook);
-                    auto hash = hashSink->finish().hash;
-                    return {
-                        .mode = mode,
-                        .hash = hash,
+                    dumpPath(sourcePath, *hashSink, (FileSerialisationMethod) mode);
+                    h = hashSink->finish().hash;
+                    break;
+                }
+                case FileIngestionMethod::Git: {
+                    auto sourcePath = makeSourcePath();
+                    std::function<git::DumpHook> hook;
+                    hook = [&](const SourcePath & path) -> git::TreeEntry {
+                        auto hashSink = makeSink();
+                        auto mode = dump(path, *hashSink, hook);
+                        auto hash = hashSink->finish().hash;
+                        return {
+                            .mode = mode,
+                            .hash = hash,
+                        };
                     };
-                };
-                h = hook(sourcePath).hash;
-                break;
-            }
-            }
+                    h = hook(sourcePath).hash;
+                    break;
+                }
+                }
 
             if (truncate && h.hashSize > 20)
                 h = compressHash(h, 20);
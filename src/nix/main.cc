@@ -15,6 +15,7 @@
 #include "nix/cmd/markdown.hh"
 #include "nix/util/memory-source-accessor.hh"
 #include "nix/util/terminal.hh"
+#include "nix/util/tracing.hh"
 #include "nix/util/users.hh"
 #include "nix/cmd/network-proxy.hh"
 #include "nix/expr/eval-cache.hh"
@@ -375,8 +376,14 @@ void mainWrapped(int argc, char ** argv)
     }
 #endif
 
-    initNix();
-    initGC();
+    {
+        StartupPhaseTimer timer("initNix");
+        initNix();
+    }
+    {
+        StartupPhaseTimer timer("initGC");
+        initGC();
+    }
     flakeSettings.configureEvalSettings(evalSettings);
 
     /* Set the build hook location
@@ -501,6 +508,7 @@ void mainWrapped(int argc, char ** argv)
     });
 
     try {
+        StartupPhaseTimer timer("parseArgs");
         auto isNixCommand = std::regex_search(programName, std::regex("nix$"));
         auto allowShebang = isNixCommand && argc > 1;
         args.parseCmdline(argvToStrings(argc, argv), allowShebang);
@@ -510,6 +518,7 @@ void mainWrapped(int argc, char ** argv)
     }
 
     applyJSONLogger();
+    applyTracingLogger();
 
     if (args.helpRequested) {
         std::vector<std::string> subcommand;
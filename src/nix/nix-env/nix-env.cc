@@ -169,6 +169,61 @@ static void loadSourceExpr(EvalState & state, const SourcePath & path, Value & v
         throw Error("path '%s' is not a directory or a Nix expression", path);
 }
 
+/**
+ * Return a fingerprint of the Nix expressions in `path` (as loaded by
+ * `loadSourceExpr()`) for the evaluation cache, or nothing if any of
+ * them is not immutable. As for flakes, fetched trees are identified
+ * by the fingerprint of their accessor, and other store paths such as
+ * channels by their NAR hash, like tarball inputs.
+ */
+static std::optional<std::string> getSourceExprFingerprint(EvalState & state, const SourcePath & path)
+{
+    auto path2 = path.resolveSymlinks();
+
+    if (auto [subpath, fingerprint] = path2.accessor->getFingerprint(path2.path); fingerprint)
+        return *fingerprint + ";" + subpath.abs();
+
+    auto & store = *state.store;
+    if (path2.accessor == state.rootFS && store.isInStore(path2.path.abs())) {
+        auto [storePath, rest] = store.toStorePath(path2.path.abs());
+        return store.queryPathInfo(storePath)->narHash.to_string(HashFormat::SRI, true) + ";" + rest;
+    }
+
+    /* A directory like ~/.nix-defexpr, whose expressions must all be
+       immutable. */
+    auto st = path2.lstat();
+    if (isNixExpr(path2, st) || st.type != SourceAccessor::tDirectory)
+        return std::nullopt;
+
+    std::string res;
+    for (auto & [name, _] : path2.readDirectory()) {
+        if (name == "manifest.nix")
+            continue;
+        std::optional<std::string> fingerprint;
+        try {
+            fingerprint = getSourceExprFingerprint(state, path2 / name);
+        } catch (Error &) {
+            continue; // ignore dangling symlinks, like getAllExprs()
+        }
+        if (!fingerprint)
+            return std::nullopt;
+        res += fmt("%s=%s;", name, *fingerprint);
+    }
+    return res;
+}
+
+static void filterBySystem(PackageInfos & elems, const std::string & systemFilter)
+{
+    /* Filter out all derivations not applicable to the current
+       system. */
+    for (PackageInfos::iterator i = elems.begin(), j; i != elems.end(); i = j) {
+        j = i;
+        j++;
+        if (systemFilter != "*" && i->querySystem() != systemFilter)
+            elems.erase(i);
+    }
+}
+
 static void loadDerivations(
     EvalState & state,
     const SourcePath & nixExprPath,
@@ -184,14 +239,50 @@ static void loadDerivations(
 
     getDerivations(state, v, pathPrefix, autoArgs, elems, true);
 
-    /* Filter out all derivations not applicable to the current
-       system. */
-    for (PackageInfos::iterator i = elems.begin(), j; i != elems.end(); i = j) {
-        j = i;
-        j++;
-        if (systemFilter != "*" && i->querySystem() != systemFilter)
-            elems.erase(i);
-    }
+    filterBySystem(elems, systemFilter);
+}
+
+/**
+ * Like `loadDerivations()`, but use the evaluation cache if the Nix
+ * expressions are immutable and no arguments are passed to them,
+ * since the result then only depends on the evaluator.
+ *
+ * @return false if the evaluation cache can't be used.
+ */
+static bool loadDerivationsCached(
+    EvalState & state,
+    const SourcePath & nixExprPath,
+    std::string systemFilter,
+    Bindings & autoArgs,
+    const std::string & pathPrefix,
+    PackageInfos & elems)
+{
+    if (!state.settings.useEvalCache || !autoArgs.empty())
+        return false;
+
+    auto exprFingerprint = getSourceExprFingerprint(state, nixExprPath);
+    if (!exprFingerprint)
+        return false;
+
+    auto fingerprint = hashString(
+        HashAlgorithm::SHA256,
+        fmt("nix-env;%s;%s;%s", *exprFingerprint, pathPrefix, state.settings.getCurrentSystem()));
+
+    getDerivationsCached(
+        state,
+        fingerprint,
+        [&state, nixExprPath, pathPrefix, autoArgs{&autoArgs}]() {
+            auto vRoot = state.allocValue();
+            loadSourceExpr(state, nixExprPath, *vRoot);
+            return findAlongAttrPath(state, pathPrefix, *autoArgs, *vRoot).first;
+        },
+        pathPrefix,
+        autoArgs,
+        elems);
+
+    filterBySystem(elems, systemFilter);
+
+    return true;
 }
 
 static NixInt getPriority(EvalState & state, PackageInfo & drv)
@@ -941,6 +1032,7 @@ static void opQuery(Globals & globals, Strings opFlags, Strings opArgs)
     bool compareVersions = false;
     bool xmlOutput = false;
     bool jsonOutput = false;
+    bool useEvalCache = false;
 
     enum { sInstalled, sAvailable } source = sInstalled;
 
@@ -968,6 +1060,8 @@ static void opQuery(Globals & globals, Strings opFlags, Strings opArgs)
             source = sInstalled;
         else if (arg == "--available" || arg == "-a")
             source = sAvailable;
+        else if (arg == "--eval-cache")
+            useEvalCache = true;
         else if (arg == "--xml")
             xmlOutput = true;
         else if (arg == "--json")
@@ -989,7 +1083,16 @@ static void opQuery(Globals & globals, Strings opFlags, Strings opArgs)
     if (source == sInstalled || compareVersions || printStatus)
         installedElems = queryInstalled(*globals.state, globals.profile);
 
-    if (source == sAvailable || compareVersions)
+    if ((source == sAvailable || compareVersions)
+        && !(
+            useEvalCache
+            && loadDerivationsCached(
+                *globals.state,
+                *globals.instSource.nixExprPath,
+                globals.instSource.systemFilter,
+                *globals.instSource.autoArgs,
+                attrPath,
+                availElems)))
         loadDerivations(
             *globals.state,
             *globals.instSource.nixExprPath,
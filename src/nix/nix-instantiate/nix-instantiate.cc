@@ -74,14 +74,26 @@ void processExpr(
         } else {
             PackageInfos drvs;
             getDerivations(state, v, "", autoArgs, drvs, false);
+
+            /* Instantiate everything first, so that the derivations
+               can be written to the store in batches. */
+            std::vector<std::pair<StorePath, std::string>> outputs;
             for (auto & i : drvs) {
                 auto drvPath = i.requireDrvPath();
-                auto drvPathS = state.store->printStorePath(drvPath);
 
                 /* What output do we want? */
                 std::string outputName = i.queryOutputName();
                 if (outputName == "")
-                    throw Error("derivation '%1%' lacks an 'outputName' attribute", drvPathS);
+                    throw Error(
+                        "derivation '%1%' lacks an 'outputName' attribute", state.store->printStorePath(drvPath));
+
+                outputs.emplace_back(std::move(drvPath), std::move(outputName));
+            }
+
+            state.flushDerivations();
+
+            for (auto & [drvPath, outputName] : outputs) {
+                auto drvPathS = state.store->printStorePath(drvPath);
 
                 if (gcRoot == "")
                     printGCWarning();
@@ -97,6 +109,9 @@ void processExpr(
             }
         }
     }
+
+    /* Derivations instantiated by `--eval` must exist as well. */
+    state.flushDerivations();
 }
 
 static int main_nix_instantiate(int argc, char ** argv)
@@ -171,6 +186,7 @@ static int main_nix_instantiate(int argc, char ** argv)
 
         auto state = std::make_unique<EvalState>(myArgs.lookupPath, evalStore, fetchSettings, evalSettings, store);
         state->repair = myArgs.repair;
+        state->batchDerivations = true;
 
         Bindings & autoArgs = *myArgs.getAutoArgs(*state);
 
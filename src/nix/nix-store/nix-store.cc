@@ -766,8 +766,20 @@ static void opRestore(Strings opFlags, Strings opArgs)
 
 static void opExport(Strings opFlags, Strings opArgs)
 {
-    for (auto & i : opFlags)
-        throw UsageError("unknown flag '%1%'", i);
+    unsigned int version = 1;
+    std::string compression = "none";
+
+    for (auto i = opFlags.begin(); i != opFlags.end(); ++i)
+        if (*i == "--format-version")
+            version = getIntArg<unsigned int>(*i, i, opFlags.end(), false);
+        else if (*i == "--compression")
+            compression = getArg(*i, i, opFlags.end());
+        else
+            throw UsageError("unknown flag '%1%'", *i);
+
+    /* Compression implies the format that supports it. */
+    if (compression != "none" && version == 1)
+        version = 2;
 
     StorePathSet paths;
 
@@ -775,7 +787,7 @@ static void opExport(Strings opFlags, Strings opArgs)
         paths.insert(store->followLinksToStorePath(i));
 
     FdSink sink(getStandardOutput());
-    exportPaths(*store, paths, sink);
+    exportPaths(*store, paths, sink, version, compression);
     sink.flush();
 }
 
@@ -956,8 +968,7 @@ static void opServe(Strings opFlags, Strings opArgs)
             bool substitute = readInt(in);
             auto paths = ServeProto::Serialise<StorePathSet>::read(*store, rconn);
             if (lock && writeAllowed)
-                for (auto & path : paths)
-                    store->addTempRoot(path);
+                store->addTempRoots(paths);
 
             if (substitute && writeAllowed) {
                 store->substitutePaths(paths);
@@ -1213,7 +1224,8 @@ static int main_nix_store(int argc, char ** argv)
                 noOutput = true;
             else if (*arg != "" && arg->at(0) == '-') {
                 opFlags.push_back(*arg);
-                if (*arg == "--max-freed" || *arg == "--max-links" || *arg == "--max-atime") /* !!! hack */
+                if (*arg == "--max-freed" || *arg == "--max-links" || *arg == "--max-atime" || *arg == "--format-version"
+                    || *arg == "--compression") /* !!! hack */
                     opFlags.push_back(getArg(*arg, arg, end));
             } else
                 opArgs.push_back(*arg);
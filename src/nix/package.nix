@@ -7,6 +7,7 @@
   nix-expr,
   nix-main,
   nix-cmd,
+  fuse3,
 
   # Configuration Options
 
@@ -69,9 +70,11 @@ mkMesonExecutable (finalAttrs: {
     nix-expr
     nix-main
     nix-cmd
-  ];
+  ]
+  ++ lib.optional stdenv.hostPlatform.isLinux fuse3;
 
   mesonFlags = [
+    (lib.mesonEnable "fuse" stdenv.hostPlatform.isLinux)
   ];
 
   postInstall = lib.optionalString stdenv.hostPlatform.isStatic ''
@@ -14,20 +14,6 @@
 using namespace nix;
 using nlohmann::json;
 
-/**
- * @return the total size of a set of store objects (specified by path),
- * that is, the sum of the size of the NAR serialisation of each object
- * in the set.
- */
-static uint64_t getStoreObjectsTotalSize(Store & store, const StorePathSet & closure)
-{
-    uint64_t totalNarSize = 0;
-    for (auto & p : closure) {
-        totalNarSize += store.queryPathInfo(p)->narSize;
-    }
-    return totalNarSize;
-}
-
 /**
  * Write a JSON representation of store object metadata, such as the
  * hash and the references.
@@ -65,24 +51,14 @@ pathInfoToJSON(Store & store, const StorePathSet & storePaths, bool showClosureS
             jsonObject["storeDir"] = store.storeDir;
 
             if (showClosureSize) {
-                StorePathSet closure;
-                store.computeFSClosure(storePath, closure, false, false);
+                auto size = store.queryClosureSize({storePath});
 
-                jsonObject["closureSize"] = getStoreObjectsTotalSize(store, closure);
+                jsonObject["closureSize"] = size.narSize;
 
                 if (dynamic_cast<const NarInfo *>(&*info)) {
-                    uint64_t totalDownloadSize = 0;
-                    for (auto & p : closure) {
-                        auto depInfo = store.queryPathInfo(p);
-                        if (auto * depNarInfo = dynamic_cast<const NarInfo *>(&*depInfo))
-                            totalDownloadSize += depNarInfo->fileSize;
-                        else
-                            throw Error(
-                                "Missing .narinfo for dep %s of %s",
-                                store.printStorePath(p),
-                                store.printStorePath(storePath));
-                    }
-                    jsonObject["closureDownloadSize"] = totalDownloadSize;
+                    if (!size.downloadSize)
+                        throw Error("missing .narinfo for a dependency of %s", store.printStorePath(storePath));
+                    jsonObject["closureDownloadSize"] = *size.downloadSize;
                 }
             }
         } catch (InvalidPath &) {
@@ -213,11 +189,8 @@ struct CmdPathInfo : StorePathsCommand, MixJSON
                 if (showSize)
                     printSize(str, info->narSize);
 
-                if (showClosureSize) {
-                    StorePathSet closure;
-                    store->computeFSClosure(storePath, closure, false, false);
-                    printSize(str, getStoreObjectsTotalSize(*store, closure));
-                }
+                if (showClosureSize)
+                    printSize(str, store->queryClosureSize({storePath}).narSize);
 
                 if (showSigs) {
                     str << '\t';
@@ -117,6 +117,13 @@ struct ProfileManifest
 
     std::map<ProfileElementName, ProfileElement> elements;
 
+    /**
+     * The profile that this manifest was read from, and its packages,
+     * so that `build()` can add packages to it instead of linking all
+     * of them again.
+     */
+    std::optional<std::pair<Path, Packages>> prev;
+
     ProfileManifest() {}
 
     ProfileManifest(EvalState & state, const std::filesystem::path & profile)
@@ -173,6 +180,11 @@ struct ProfileManifest
 
                 addElement(name, std::move(element));
             }
+
+            prev = {
+                state.store->printStorePath(state.store->followLinksToStorePath(profile.string())),
+                getPackages(*state.store),
+            };
         }
 
         else if (std::filesystem::exists(profile / "manifest.nix")) {
@@ -232,22 +244,29 @@ struct ProfileManifest
         return json;
     }
 
+    Packages getPackages(const StoreDirConfig & store) const
+    {
+        Packages pkgs;
+        for (auto & [name, element] : elements)
+            if (element.active)
+                for (auto & path : element.storePaths)
+                    pkgs.emplace_back(store.printStorePath(path), true, element.priority);
+        return pkgs;
+    }
+
     StorePath build(ref<Store> store)
     {
         auto tempDir = createTempDir();
 
         StorePathSet references;
-
-        Packages pkgs;
-        for (auto & [name, element] : elements) {
-            for (auto & path : element.storePaths) {
-                if (element.active)
-                    pkgs.emplace_back(store->printStorePath(path), true, element.priority);
+        for (auto & [name, element] : elements)
+            for (auto & path : element.storePaths)
                 references.insert(path);
-            }
-        }
 
-        buildProfile(tempDir.string(), std::move(pkgs));
+        if (!prev
+            || !buildProfileIncremental(
+                tempDir.string(), prev->first, Packages(prev->second), getPackages(*store)))
+            buildProfile(tempDir.string(), getPackages(*store));
 
         writeFile(tempDir / "manifest.json", toJSON(*store).dump());
 
@@ -839,23 +858,27 @@ struct CmdProfileDiffClosures : virtual StoreCommand, MixDefaultProfile
     {
         auto [gens, curGen] = findGenerations(*profile);
 
-        std::optional<Generation> prevGen;
-        bool first = true;
+        /* Adjacent generations share most of their closures, so fetch
+           the path infos of all of them at once, and let the differ
+           reuse the closure of each generation for the next diff. */
+        ClosureDiffer differ(store);
 
+        std::vector<std::pair<GenerationNumber, StorePath>> toplevels;
+        StorePathSet allToplevels;
         for (auto & gen : gens) {
-            if (prevGen) {
-                if (!first)
-                    logger->cout("");
-                first = false;
-                logger->cout("Version %d -> %d:", prevGen->number, gen.number);
-                printClosureDiff(
-                    store,
-                    store->followLinksToStorePath(prevGen->path.string()),
-                    store->followLinksToStorePath(gen.path.string()),
-                    "  ");
-            }
+            auto toplevel = store->followLinksToStorePath(gen.path.string());
+            allToplevels.insert(toplevel);
+            toplevels.emplace_back(gen.number, std::move(toplevel));
+        }
+        differ.prefetch(allToplevels);
 
-            prevGen = gen;
+        for (size_t i = 1; i < toplevels.size(); ++i) {
+            auto & [prevNumber, prevToplevel] = toplevels[i - 1];
+            auto & [number, toplevel] = toplevels[i];
+            if (i > 1)
+                logger->cout("");
+            logger->cout("Version %d -> %d:", prevNumber, number);
+            differ.printDiff(prevToplevel, toplevel, "  ");
         }
     }
 };
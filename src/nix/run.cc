@@ -12,6 +12,10 @@
 #include "nix/expr/eval.hh"
 #include "nix/util/util.hh"
 #include "nix/store/globals.hh"
+#include "nix/cmd/common-eval-args.hh"
+#include "nix/fetchers/cache.hh"
+#include "nix/fetchers/fetch-settings.hh"
+#include "nix/flake/flakeref.hh"
 
 #include <filesystem>
 
@@ -109,6 +113,72 @@ void execProgramInStore(
     throw SysError("unable to execute '%s'", program);
 }
 
+InstallableResolutionCache::InstallableResolutionCache(
+    std::string_view command,
+    SourceExprCommand & cmd,
+    Store & store,
+    const std::vector<std::string> & rawInstallables)
+    : store(store)
+{
+    auto & lockFlags = cmd.lockFlags;
+    if (!evalSettings.useEvalCache || !evalSettings.pureEval || cmd.file || cmd.expr || rawInstallables.empty()
+        || !lockFlags.inputOverrides.empty() || !lockFlags.inputUpdates.empty() || lockFlags.recreateLockFile
+        || lockFlags.referenceLockFilePath || lockFlags.outputLockFilePath || lockFlags.useRegistries == false)
+        return;
+
+    /* The resolved flake references capture all registry entries
+       that matter, including `--override-flake`. */
+    std::string resolved;
+    try {
+        for (auto & s : rawInstallables) {
+            auto [flakeRef, fragment, extendedOutputsSpec] = parseFlakeRefWithFragmentAndExtendedOutputsSpec(
+                fetchSettings, expandTilde(s), absPath(cmd.getCommandBaseDir()));
+            auto ref = flakeRef.resolve(fetchSettings, store);
+            if (ref.input.getSourcePath())
+                return;
+            if (!ref.input.isLocked(fetchSettings))
+                locked = false;
+            resolved += fmt("%s#%s^%s\n", ref.to_string(), fragment, extendedOutputsSpec.to_string());
+        }
+    } catch (Error & e) {
+        /* Not a flake reference, e.g. a store path. */
+        debug("not caching the resolution of %s: %s", concatStringsSep(" ", rawInstallables), e.msg());
+        return;
+    }
+
+    key = fetchers::Attrs{
+        {"command", std::string(command)},
+        {"installables", resolved},
+        {"system", settings.thisSystem.get()},
+        {"nixVersion", nixVersion},
+    };
+}
+
+std::optional<Strings> InstallableResolutionCache::lookup()
+{
+    if (!key)
+        return std::nullopt;
+
+    auto cache = fetchSettings.getCache();
+    auto res = locked ? cache->lookup({"installable", *key}) : cache->lookupWithTTL({"installable", *key});
+    if (!res)
+        return std::nullopt;
+
+    auto paths = tokenizeString<Strings>(fetchers::getStrAttr(*res, "paths"), "\n");
+    for (auto & path : paths)
+        if (!store.isValidPath(store.toStorePath(path).first))
+            return std::nullopt;
+
+    debug("using cached resolution of %s", fetchers::getStrAttr(*key, "installables"));
+    return paths;
+}
+
+void InstallableResolutionCache::upsert(const Strings & paths)
+{
+    if (key)
+        fetchSettings.getCache()->upsert({"installable", *key}, {{"paths", concatStringsSep("\n", paths)}});
+}
+
 } // namespace nix
 
 struct CmdRun : InstallableValueCommand, MixEnvironment
@@ -153,6 +223,19 @@ struct CmdRun : InstallableValueCommand, MixEnvironment
         return res;
     }
 
+    void run(ref<Store> store) override
+    {
+        InstallableResolutionCache cache("run", *this, *store, {getInstallable()});
+
+        if (auto programs = cache.lookup()) {
+            exec(store, programs->front());
+            return;
+        }
+
+        resolutionCache = &cache;
+        InstallableCommand::run(store);
+    }
+
     void run(ref<Store> store, ref<InstallableValue> installable) override
     {
         auto state = getEvalState();
@@ -160,17 +243,29 @@ struct CmdRun : InstallableValueCommand, MixEnvironment
         lockFlags.applyNixConfig = true;
         auto app = installable->toApp(*state).resolve(getEvalStore(), store);
 
-        Strings allArgs{app.program.string()};
-        for (auto & i : args)
-            allArgs.push_back(i);
+        if (resolutionCache)
+            resolutionCache->upsert({app.program.string()});
 
         // Release our references to eval caches to ensure they are persisted to disk, because
         // we are about to exec out of this process without running C++ destructors.
         state->evalCaches.clear();
 
+        exec(store, app.program.string());
+    }
+
+private:
+
+    InstallableResolutionCache * resolutionCache = nullptr;
+
+    void exec(ref<Store> store, const std::string & program)
+    {
+        Strings allArgs{program};
+        for (auto & i : args)
+            allArgs.push_back(i);
+
         setEnviron();
 
-        execProgramInStore(store, UseLookupPath::DontUse, app.program.string(), allArgs);
+        execProgramInStore(store, UseLookupPath::DontUse, program, allArgs);
     }
 };
 
@@ -2,6 +2,7 @@
 ///@file
 
 #include "nix/store/store-api.hh"
+#include "nix/fetchers/attrs.hh"
 
 namespace nix {
 
@@ -15,4 +16,46 @@ void execProgramInStore(
     std::optional<std::string_view> system = std::nullopt,
     std::optional<StringMap> env = std::nullopt);
 
+struct SourceExprCommand;
+
+/**
+ * Remembers what the installables of `nix run` and `nix shell`
+ * resolved to, so that running the same remote flake again needs
+ * neither fetching nor evaluating it. Entries of unlocked flakes are
+ * fresh for `tarball-ttl` seconds, like the fetches they stand for.
+ *
+ * Only remote flakes are cached, since local ones may change without
+ * notice, and only in pure evaluation mode without lock file
+ * overrides, where the result depends on nothing but the resolved
+ * flake references, the system type and the Nix version.
+ */
+struct InstallableResolutionCache
+{
+    InstallableResolutionCache(
+        std::string_view command,
+        SourceExprCommand & cmd,
+        Store & store,
+        const std::vector<std::string> & rawInstallables);
+
+    /**
+     * @return The cached store paths (or paths inside store objects),
+     * or `std::nullopt` if there is no fresh entry or one of the store
+     * objects is no longer valid.
+     */
+    std::optional<Strings> lookup();
+
+    void upsert(const Strings & paths);
+
+private:
+
+    Store & store;
+
+    /**
+     * `std::nullopt` if the installables are not cacheable.
+     */
+    std::optional<fetchers::Attrs> key;
+
+    bool locked = true;
+};
+
 } // namespace nix
@@ -11,6 +11,7 @@
 #include "nix/expr/attr-path.hh"
 #include "nix/util/hilite.hh"
 #include "nix/util/strings-inline.hh"
+#include "nix/util/thread-pool.hh"
 
 #include <regex>
 #include <fstream>
@@ -88,7 +89,104 @@ struct CmdSearch : InstallableValueCommand, MixJSON
         if (json)
             jsonOut = json::object();
 
-        uint64_t results = 0;
+        /* A derivation that still has to be matched against the
+           regexes. Matching and formatting don't touch the evaluator,
+           so they run on a thread pool while the main thread keeps
+           walking the package tree. */
+        struct Candidate
+        {
+            size_t seq;
+            std::string attrPathStr;
+            std::string pname;
+            std::string version;
+            std::string description;
+        };
+
+        /* Results are emitted in traversal order, as soon as all
+           preceding candidates have been matched. */
+        struct Output
+        {
+            size_t next = 0;
+            std::map<size_t, std::optional<Candidate>> pending;
+            uint64_t results = 0;
+        };
+
+        Sync<Output> output_;
+        size_t nrCandidates = 0;
+
+        auto emit = [&](Output & output, Candidate & c) {
+            output.results++;
+            if (json) {
+                (*jsonOut)[c.attrPathStr] = {
+                    {"pname", c.pname},
+                    {"version", c.version},
+                    {"description", c.description},
+                };
+            } else {
+                std::vector<std::smatch> attrPathMatches;
+                std::vector<std::smatch> descriptionMatches;
+                std::vector<std::smatch> nameMatches;
+
+                for (auto & regex : regexes) {
+                    auto addAll = [](std::sregex_iterator it, std::vector<std::smatch> & vec) {
+                        const auto end = std::sregex_iterator();
+                        while (it != end)
+                            vec.push_back(*it++);
+                    };
+
+                    addAll(std::sregex_iterator(c.attrPathStr.begin(), c.attrPathStr.end(), regex), attrPathMatches);
+                    addAll(std::sregex_iterator(c.pname.begin(), c.pname.end(), regex), nameMatches);
+                    addAll(
+                        std::sregex_iterator(c.description.begin(), c.description.end(), regex), descriptionMatches);
+                }
+
+                if (output.results > 1)
+                    logger->cout("");
+                logger->cout(
+                    "* %s%s",
+                    wrap("\e[0;1m", hiliteMatches(c.attrPathStr, attrPathMatches, ANSI_GREEN, "\e[0;1m")),
+                    optionalBracket(" (", c.version, ")"));
+                if (c.description != "")
+                    logger->cout("  %s", hiliteMatches(c.description, descriptionMatches, ANSI_GREEN, ANSI_NORMAL));
+            }
+        };
+
+        auto match = [&](Candidate c) {
+            bool found = true;
+
+            for (auto & regex : excludeRegexes) {
+                if (std::regex_search(c.attrPathStr, regex) || std::regex_search(c.pname, regex)
+                    || std::regex_search(c.description, regex)) {
+                    found = false;
+                    break;
+                }
+            }
+
+            if (found)
+                for (auto & regex : regexes) {
+                    if (!std::regex_search(c.attrPathStr, regex) && !std::regex_search(c.pname, regex)
+                        && !std::regex_search(c.description, regex)) {
+                        found = false;
+                        break;
+                    }
+                }
+
+            auto output(output_.lock());
+            auto seq = c.seq;
+            output->pending.emplace(seq, found ? std::optional<Candidate>(std::move(c)) : std::nullopt);
+            for (auto i = output->pending.begin(); i != output->pending.end() && i->first == output->next;
+                 i = output->pending.erase(i), output->next++)
+                if (i->second)
+                    emit(*output, *i->second);
+        };
+
+        /* Create the pool after everything its work items refer to, so
+           that the threads are stopped first. With a single core, match
+           synchronously. */
+        auto nrCores = evalSettings.getEvalCores();
+        std::optional<ThreadPool> pool;
+        if (nrCores > 1)
+            pool.emplace(nrCores);
 
         std::function<void(eval_cache::AttrCursor & cursor, const AttrPath & attrPath, bool initialRecurse)> visit;
 
@@ -115,55 +213,17 @@ struct CmdSearch : InstallableValueCommand, MixJSON
                     auto description = aDescription ? aDescription->getString() : "";
                     std::replace(description.begin(), description.end(), '\n', ' ');
 
-                    std::vector<std::smatch> attrPathMatches;
-                    std::vector<std::smatch> descriptionMatches;
-                    std::vector<std::smatch> nameMatches;
-                    bool found = false;
-
-                    for (auto & regex : excludeRegexes) {
-                        if (std::regex_search(attrPathStr, regex) || std::regex_search(name.name, regex)
-                            || std::regex_search(description, regex))
-                            return;
-                    }
-
-                    for (auto & regex : regexes) {
-                        found = false;
-                        auto addAll = [&found](std::sregex_iterator it, std::vector<std::smatch> & vec) {
-                            const auto end = std::sregex_iterator();
-                            while (it != end) {
-                                vec.push_back(*it++);
-                                found = true;
-                            }
-                        };
-
-                        addAll(std::sregex_iterator(attrPathStr.begin(), attrPathStr.end(), regex), attrPathMatches);
-                        addAll(std::sregex_iterator(name.name.begin(), name.name.end(), regex), nameMatches);
-                        addAll(std::sregex_iterator(description.begin(), description.end(), regex), descriptionMatches);
-
-                        if (!found)
-                            break;
-                    }
-
-                    if (found) {
-                        results++;
-                        if (json) {
-                            (*jsonOut)[attrPathStr] = {
-                                {"pname", name.name},
-                                {"version", name.version},
-                                {"description", description},
-                            };
-                        } else {
-                            if (results > 1)
-                                logger->cout("");
-                            logger->cout(
-                                "* %s%s",
-                                wrap("\e[0;1m", hiliteMatches(attrPathStr, attrPathMatches, ANSI_GREEN, "\e[0;1m")),
-                                optionalBracket(" (", name.version, ")"));
-                            if (description != "")
-                                logger->cout(
-                                    "  %s", hiliteMatches(description, descriptionMatches, ANSI_GREEN, ANSI_NORMAL));
-                        }
-                    }
+                    Candidate c{
+                        .seq = nrCandidates++,
+                        .attrPathStr = std::move(attrPathStr),
+                        .pname = std::move(name.name),
+                        .version = std::move(name.version),
+                        .description = std::move(description),
+                    };
+                    if (pool)
+                        pool->enqueue([&match, c{std::move(c)}]() mutable { match(std::move(c)); });
+                    else
+                        match(std::move(c));
                 }
 
                 else if (
@@ -189,6 +249,11 @@ struct CmdSearch : InstallableValueCommand, MixJSON
         for (auto & cursor : installable->getCursors(*state))
             visit(*cursor, cursor->getAttrPath(), true);
 
+        if (pool)
+            pool->process();
+
+        auto results = output_.lock()->results;
+
         if (json)
             printJSON(*jsonOut);
 
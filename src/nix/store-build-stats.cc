@@ -0,0 +1,82 @@
+#include "nix/cmd/command.hh"
+#include "nix/main/shared.hh"
+#include "nix/store/local-store.hh"
+
+#include <nlohmann/json.hpp>
+
+using namespace nix;
+
+struct CmdStoreBuildStats : StoreCommand, MixJSON
+{
+    std::string derivation;
+
+    size_t limit = 10;
+
+    CmdStoreBuildStats()
+    {
+        expectArgs({
+            .label = "derivation",
+            .handler = {&derivation},
+        });
+
+        addFlag({
+            .longName = "limit",
+            .description = "Show at most *n* builds.",
+            .labels = {"n"},
+            .handler = {&limit},
+        });
+    }
+
+    std::string description() override
+    {
+        return "show statistics of past builds of a derivation";
+    }
+
+    std::string doc() override
+    {
+        return
+#include "store-build-stats.md"
+            ;
+    }
+
+    void run(ref<Store> store) override
+    {
+        auto localStore = dynamic_cast<LocalStore *>(&*store);
+        if (!localStore)
+            throw Error("store '%s' does not record build statistics", store->config.getHumanReadableURI());
+
+        auto builds = localStore->queryBuildStats(derivation, limit);
+
+        if (json) {
+            printJSON(nlohmann::json(builds));
+            return;
+        }
+
+        if (builds.empty())
+            throw Error("no builds of '%s' have been recorded", derivation);
+
+        for (auto & build : builds) {
+            char startTime[64];
+            strftime(startTime, sizeof(startTime), "%Y-%m-%d %H:%M:%S", localtime(&build.startTime));
+
+            auto line = fmt(
+                "%s  %s  %ds  output %s",
+                startTime,
+                build.drvName,
+                build.stopTime - build.startTime,
+                renderSize(build.outputSize));
+            if (build.cpuUser && build.cpuSystem)
+                line += fmt(
+                    "  cpu %.1fs user %.1fs system",
+                    (double) build.cpuUser->count() / 1000000,
+                    (double) build.cpuSystem->count() / 1000000);
+            if (build.peakMemory)
+                line += fmt("  peak memory %s", renderSize(*build.peakMemory));
+            if (!build.machine.empty())
+                line += fmt("  on '%s'", build.machine);
+            logger->cout(line);
+        }
+    }
+};
+
+static auto rCmdStoreBuildStats = registerCommand2<CmdStoreBuildStats>({"store", "build-stats"});
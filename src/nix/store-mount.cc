@@ -0,0 +1,261 @@
+#define FUSE_USE_VERSION 31
+
+#include "nix/cmd/command.hh"
+#include "nix/main/shared.hh"
+#include "nix/store/store-api.hh"
+#include "nix/util/sync.hh"
+
+#include <fuse.h>
+
+using namespace nix;
+
+namespace {
+
+/**
+ * The state of a mounted store. Store paths are looked up the first
+ * time they are accessed, and file contents are fetched from the store
+ * only for the ranges that are actually read.
+ */
+struct MountState
+{
+    ref<Store> store;
+
+    Sync<std::map<StorePath, std::shared_ptr<SourceAccessor>>> accessors;
+
+    MountState(ref<Store> store)
+        : store(store)
+    {
+    }
+
+    /**
+     * Split a FUSE path like `/<hash>-<name>/bin/foo` into an accessor
+     * for the store path and the path inside it.
+     *
+     * @return nullptr if the path doesn't refer to a valid store path.
+     */
+    std::pair<std::shared_ptr<SourceAccessor>, CanonPath> resolve(const char * fusePath)
+    {
+        CanonPath path(fusePath);
+        auto baseName = path.begin();
+        if (baseName == path.end())
+            return {nullptr, CanonPath::root};
+
+        std::optional<StorePath> storePath;
+        try {
+            storePath.emplace(*baseName);
+        } catch (BadStorePath &) {
+            return {nullptr, CanonPath::root};
+        }
+
+        auto rest = CanonPath::root;
+        for (auto i = std::next(baseName); i != path.end(); ++i)
+            rest.push(*i);
+
+        if (auto accessor = get(*accessors.lock(), *storePath))
+            return {*accessor, std::move(rest)};
+
+        /* Don't hold the lock while querying the store, which may
+           involve a network round trip. */
+        auto accessor = store->getFSAccessor(*storePath);
+        if (!accessor)
+            return {nullptr, CanonPath::root};
+
+        auto [i, inserted] = accessors.lock()->emplace(*storePath, accessor);
+        return {i->second, std::move(rest)};
+    }
+};
+
+MountState & getState()
+{
+    return *static_cast<MountState *>(fuse_get_context()->private_data);
+}
+
+/**
+ * Run `fun`, mapping exceptions to a negative errno as FUSE expects.
+ */
+template<typename F>
+int wrap(F && fun)
+{
+    try {
+        return fun();
+    } catch (BadStorePath &) {
+        return -ENOENT;
+    } catch (SysError & e) {
+        return -(e.errNo ? e.errNo : EIO);
+    } catch (std::exception & e) {
+        debug("error in FUSE operation: %s", e.what());
+        return -EIO;
+    }
+}
+
+void fillStat(const SourceAccessor::Stat & st, struct stat * stbuf)
+{
+    memset(stbuf, 0, sizeof(*stbuf));
+    stbuf->st_nlink = 1;
+    /* Like in the store itself. */
+    stbuf->st_mtime = 1;
+    switch (st.type) {
+    case SourceAccessor::tRegular:
+        stbuf->st_mode = S_IFREG | (st.isExecutable ? 0555 : 0444);
+        stbuf->st_size = st.fileSize.value_or(0);
+        break;
+    case SourceAccessor::tSymlink:
+        stbuf->st_mode = S_IFLNK | 0777;
+        break;
+    case SourceAccessor::tDirectory:
+        stbuf->st_mode = S_IFDIR | 0555;
+        stbuf->st_nlink = 2;
+        break;
+    default:
+        stbuf->st_mode = 0;
+    }
+}
+
+int storeGetattr(const char * path, struct stat * stbuf, struct fuse_file_info *)
+{
+    return wrap([&]() {
+        if (std::string_view(path) == "/") {
+            memset(stbuf, 0, sizeof(*stbuf));
+            stbuf->st_mode = S_IFDIR | 0555;
+            stbuf->st_nlink = 2;
+            return 0;
+        }
+        auto [accessor, subpath] = getState().resolve(path);
+        if (!accessor)
+            return -ENOENT;
+        auto st = accessor->maybeLstat(subpath);
+        if (!st)
+            return -ENOENT;
+        fillStat(*st, stbuf);
+        return 0;
+    });
+}
+
+int storeReaddir(
+    const char * path, void * buf, fuse_fill_dir_t filler, off_t, struct fuse_file_info *, enum fuse_readdir_flags)
+{
+    return wrap([&]() {
+        filler(buf, ".", nullptr, 0, (fuse_fill_dir_flags) 0);
+        filler(buf, "..", nullptr, 0, (fuse_fill_dir_flags) 0);
+
+        /* The store can't be enumerated cheaply, so the root only
+           lists the store paths that have been accessed. */
+        if (std::string_view(path) == "/") {
+            for (auto & [storePath, _] : *getState().accessors.lock())
+                filler(buf, std::string(storePath.to_string()).c_str(), nullptr, 0, (fuse_fill_dir_flags) 0);
+            return 0;
+        }
+
+        auto [accessor, subpath] = getState().resolve(path);
+        if (!accessor)
+            return -ENOENT;
+        auto st = accessor->maybeLstat(subpath);
+        if (!st)
+            return -ENOENT;
+        if (st->type != SourceAccessor::tDirectory)
+            return -ENOTDIR;
+        for (auto & [name, _] : accessor->readDirectory(subpath))
+            filler(buf, name.c_str(), nullptr, 0, (fuse_fill_dir_flags) 0);
+        return 0;
+    });
+}
+
+int storeReadlink(const char * path, char * buf, size_t size)
+{
+    return wrap([&]() {
+        auto [accessor, subpath] = getState().resolve(path);
+        if (!accessor)
+            return -ENOENT;
+        auto target = accessor->readLink(subpath);
+        if (size == 0)
+            return -EINVAL;
+        auto n = std::min(target.size(), size - 1);
+        memcpy(buf, target.data(), n);
+        buf[n] = 0;
+        return 0;
+    });
+}
+
+int storeOpen(const char * path, struct fuse_file_info * fi)
+{
+    return wrap([&]() {
+        if ((fi->flags & O_ACCMODE) != O_RDONLY)
+            return -EROFS;
+        auto [accessor, subpath] = getState().resolve(path);
+        if (!accessor)
+            return -ENOENT;
+        auto st = accessor->maybeLstat(subpath);
+        if (!st)
+            return -ENOENT;
+        if (st->type != SourceAccessor::tRegular)
+            return -EISDIR;
+        /* Store paths are immutable, so the kernel may keep cached
+           pages across opens. */
+        fi->keep_cache = 1;
+        return 0;
+    });
+}
+
+int storeRead(const char * path, char * buf, size_t size, off_t offset, struct fuse_file_info *)
+{
+    return wrap([&]() {
+        auto [accessor, subpath] = getState().resolve(path);
+        if (!accessor)
+            return -ENOENT;
+        auto data = accessor->readFileRange(subpath, offset, size);
+        memcpy(buf, data.data(), data.size());
+        return (int) data.size();
+    });
+}
+
+} // namespace
+
+struct CmdStoreMount : StoreCommand
+{
+    std::string mountPoint;
+
+    CmdStoreMount()
+    {
+        expectArgs({
+            .label = "mount-point",
+            .handler = {&mountPoint},
+            .completer = completePath,
+        });
+    }
+
+    std::string description() override
+    {
+        return "mount a store as a read-only file system that fetches file contents on demand";
+    }
+
+    std::string doc() override
+    {
+        return
+#include "store-mount.md"
+            ;
+    }
+
+    void run(ref<Store> store) override
+    {
+        MountState state(store);
+
+        struct fuse_operations ops = {};
+        ops.getattr = storeGetattr;
+        ops.readlink = storeReadlink;
+        ops.open = storeOpen;
+        ops.read = storeRead;
+        ops.readdir = storeReaddir;
+
+        auto options = fmt("ro,default_permissions,fsname=%s", store->config.getHumanReadableURI());
+        std::vector<std::string> args = {"nix", "-f", "-o", options, mountPoint};
+        std::vector<char *> argv;
+        for (auto & arg : args)
+            argv.push_back(arg.data());
+        argv.push_back(nullptr);
+
+        if (auto status = fuse_main(argv.size() - 1, argv.data(), &ops, &state))
+            throw Error("failed to mount '%s' on '%s' (status %d)", store->config.getHumanReadableURI(), mountPoint, status);
+    }
+};
+
+static auto rStoreMount = registerCommand2<CmdStoreMount>({"store", "mount"});
@@ -16,11 +16,14 @@
 #include "nix/util/finally.hh"
 #include "nix/cmd/legacy.hh"
 #include "nix/store/daemon.hh"
+#include "nix/store/store-metrics.hh"
 #include "man-pages.hh"
 
 #include <algorithm>
 #include <climits>
 #include <cstring>
+#include <set>
+#include <thread>
 
 #include <unistd.h>
 #include <signal.h>
@@ -29,7 +32,9 @@
 #include <sys/stat.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <netdb.h>
 #include <sys/select.h>
+#include <poll.h>
 #include <errno.h>
 #include <pwd.h>
 #include <grp.h>
@@ -104,6 +109,42 @@ AuthorizationSettings authorizationSettings;
 
 static GlobalConfig::Register rSettings(&authorizationSettings);
 
+/**
+ * Settings controlling how the daemon runs its worker processes.
+ */
+struct DaemonSettings : Config
+{
+    Setting<unsigned int> preforkedWorkers{
+        this,
+        0,
+        "daemon-preforked-workers",
+        R"(
+          The number of idle worker processes that the Nix daemon keeps ready to accept connections.
+
+          An idle worker has already been forked and has opened the store, so a connecting client doesn't have to wait for either.
+          Each worker still serves a single connection and then exits, so clients remain as isolated from each other as with the default.
+
+          The default, `0`, forks a worker after accepting each connection.
+        )"};
+
+    Setting<std::string> metricsListen{
+        this,
+        "",
+        "daemon-metrics-listen",
+        R"(
+          If set, the Nix daemon serves metrics in the [OpenMetrics](https://openmetrics.io/) text format, which Prometheus can scrape, on this address.
+          This is either `host:port` (e.g. `127.0.0.1:9148` or `[::1]:9148`), or the absolute path of a Unix domain socket.
+
+          The metrics are aggregated over all worker processes, and include connections, the latency of each worker protocol operation by op code, SQLite transactions retried because the database was busy, garbage collector progress, build and substitution slot utilisation, and the counters of the stores opened by the workers.
+
+          The endpoint is not authenticated, so it should only be reachable by trusted hosts.
+        )"};
+};
+
+static DaemonSettings daemonSettings;
+
+static GlobalConfig::Register rDaemonSettings(&daemonSettings);
+
 #ifndef __linux__
 #  define SPLICE_F_MOVE 0
 
@@ -291,6 +332,328 @@ static std::pair<TrustedFlag, std::optional<std::string>> authPeer(const PeerInf
     return {trusted, std::move(user)};
 }
 
+struct ClientInfo
+{
+    PeerInfo peer;
+    TrustedFlag trusted = NotTrusted;
+    std::optional<std::string> userName;
+};
+
+/**
+ * Determine who is on the other end of `remote` and whether to trust
+ * them. Throws if they may not connect.
+ */
+static ClientInfo authClient(Descriptor remote, std::optional<TrustedFlag> forceTrustClientOpt)
+{
+    ClientInfo client;
+
+    if (forceTrustClientOpt)
+        client.trusted = *forceTrustClientOpt;
+    else {
+        client.peer = getPeerInfo(remote);
+        auto [trusted, userName] = authPeer(client.peer);
+        client.trusted = trusted;
+        client.userName = userName;
+    };
+
+    printInfo(
+        (std::string) "accepted connection from pid %1%, user %2%" + (client.trusted ? " (trusted)" : ""),
+        client.peer.pid ? std::to_string(*client.peer.pid) : "<unknown>",
+        client.userName.value_or("<unknown>"));
+
+    return client;
+}
+
+/**
+ * For debugging, stuff the client's pid into argv[1].
+ */
+static void setProcessNameToPeer(const PeerInfo & peer)
+{
+    if (peer.pid && savedArgv[1]) {
+        auto processName = std::to_string(*peer.pid);
+        strncpy(savedArgv[1], processName.c_str(), strlen(savedArgv[1]));
+    }
+}
+
+/**
+ * Serve connections on `fdSocket` from worker processes that are
+ * forked before a client connects. Each worker opens the store, waits
+ * for a single connection and serves it. The parent only forks
+ * replacements: a worker tells it through a pipe when it stops being
+ * idle. Idle workers that die without telling (e.g. because they were
+ * killed) are noticed when they are reaped, and are replaced as well.
+ */
+static void preforkedDaemonLoop(
+    AutoCloseFD & fdSocket, std::optional<TrustedFlag> forceTrustClientOpt, unsigned int nrWorkers)
+{
+    /* Workers race to accept connections, so the losers must not
+       block in accept(). */
+    if (fcntl(fdSocket.get(), F_SETFL, fcntl(fdSocket.get(), F_GETFL) | O_NONBLOCK) == -1)
+        throw SysError("making the daemon socket non-blocking");
+
+    /* Workers write a `Notification` to this pipe after accepting a
+       connection (kind 'a'), or if they fail before that (kind 'f').
+       Notifications are smaller than PIPE_BUF, so writes to the pipe
+       are atomic. */
+    struct Notification
+    {
+        char kind;
+        pid_t pid;
+    };
+
+    Pipe notify;
+    notify.create();
+
+    /* Reap workers ourselves, so that we can tell whether a worker
+       died while it was idle. */
+    setSigChldAction(false);
+
+    /* The workers that haven't accepted a connection yet. */
+    std::set<pid_t> idle;
+
+    /* Idle workers exit when this pipe is closed, i.e. when the parent
+       goes away. Busy workers finish serving their client. */
+    Pipe parentAlive;
+    parentAlive.create();
+
+    auto startWorker = [&]() -> pid_t {
+        ProcessOptions options;
+        options.errorPrefix = "unexpected Nix daemon error: ";
+        options.dieWithParent = false;
+        options.runExitHandlers = true;
+        options.allowVfork = false;
+        return startProcess(
+            [&]() {
+                notify.readSide = -1;
+                parentAlive.writeSide = -1;
+
+                if (setsid() == -1)
+                    throw SysError("creating a new session");
+
+                auto sendNotification = [&](char kind) {
+                    Notification notification{.kind = kind, .pid = getpid()};
+                    writeFull(
+                        notify.writeSide.get(),
+                        std::string_view((char *) &notification, sizeof(notification)),
+                        false);
+                };
+
+                bool notified = false;
+                Finally notifyFailure([&]() {
+                    if (!notified)
+                        sendNotification('f');
+                });
+
+                auto store = openUncachedStore();
+
+                AutoCloseFD remote;
+                while (!remote) {
+                    std::array<struct pollfd, 2> fds{{
+                        {.fd = fdSocket.get(), .events = POLLIN},
+                        {.fd = parentAlive.readSide.get(), .events = POLLIN},
+                    }};
+                    if (poll(fds.data(), fds.size(), -1) == -1) {
+                        if (errno == EINTR)
+                            continue;
+                        throw SysError("waiting for a connection");
+                    }
+                    if (fds[1].revents) {
+                        notified = true;
+                        exit(0);
+                    }
+                    remote = accept(fdSocket.get(), nullptr, nullptr);
+                    if (!remote && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                        throw SysError("accepting connection");
+                }
+
+                fdSocket = -1;
+                parentAlive.readSide = -1;
+
+                sendNotification('a');
+                notified = true;
+                notify.writeSide = -1;
+
+                if (fcntl(remote.get(), F_SETFL, fcntl(remote.get(), F_GETFL) & ~O_NONBLOCK) == -1)
+                    throw SysError("making the connection blocking");
+                unix::closeOnExec(remote.get());
+
+                auto client = authClient(remote.get(), forceTrustClientOpt);
+
+                setProcessNameToPeer(client.peer);
+
+                processConnection(store, FdSource(remote.get()), FdSink(remote.get()), client.trusted, NotRecursive);
+
+                exit(0);
+            },
+            options);
+    };
+
+    /* Replace an idle worker, unless it has been replaced already. A
+       worker that fails while idle is both reported through the pipe
+       and reaped, in either order. */
+    auto replaceWorker = [&](pid_t pid, bool failed) {
+        if (!idle.erase(pid))
+            return;
+        if (failed)
+            /* Don't spin if workers keep failing, e.g. because the
+               store can't be opened. */
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+        idle.insert(startWorker());
+    };
+
+    for (unsigned int i = 0; i < nrWorkers; ++i)
+        idle.insert(startWorker());
+
+    while (1) {
+        try {
+            /* Wake up periodically to reap workers, since they don't
+               interrupt poll() now that SIGCHLD isn't handled. */
+            struct pollfd fd{.fd = notify.readSide.get(), .events = POLLIN};
+            if (poll(&fd, 1, 1000) == -1 && errno != EINTR)
+                throw SysError("waiting for daemon workers");
+            checkInterrupt();
+
+            std::vector<std::pair<pid_t, int>> dead;
+            int status;
+            pid_t pid;
+            while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+                dead.emplace_back(pid, status);
+
+            /* Read the notifications after reaping, so that a worker
+               that accepted a connection and exited isn't mistaken
+               for one that died while idle. */
+            while (poll(&fd, 1, 0) > 0) {
+                Notification notification;
+                readFull(notify.readSide.get(), (char *) &notification, sizeof(notification));
+                replaceWorker(notification.pid, notification.kind == 'f');
+            }
+
+            for (auto & [deadPid, deadStatus] : dead)
+                if (idle.count(deadPid)) {
+                    printError("idle daemon worker %d %s", deadPid, statusToString(deadStatus));
+                    replaceWorker(deadPid, true);
+                }
+        } catch (Interrupted & e) {
+            return;
+        } catch (Error & error) {
+            auto ei = error.info();
+            ei.msg = HintFmt("while starting daemon worker: %1%", ei.msg.str());
+            logError(ei);
+        }
+    }
+}
+
+/**
+ * Open the socket for `daemon-metrics-listen`.
+ */
+static AutoCloseFD openMetricsSocket(const std::string & address)
+{
+    if (hasPrefix(address, "/")) {
+        createDirs(dirOf(address));
+        return createUnixDomainSocket(address, 0666);
+    }
+
+    auto colon = address.rfind(':');
+    if (colon == address.npos)
+        throw UsageError("'daemon-metrics-listen' must be 'host:port' or an absolute path, not '%s'", address);
+    auto host = address.substr(0, colon);
+    if (host.size() >= 2 && host.front() == '[' && host.back() == ']')
+        host = host.substr(1, host.size() - 2);
+    auto port = address.substr(colon + 1);
+
+    struct addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    struct addrinfo * res;
+    if (auto err = getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &res))
+        throw Error("cannot resolve metrics address '%s': %s", address, gai_strerror(err));
+    Finally freeRes([&]() { freeaddrinfo(res); });
+
+    AutoCloseFD fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (!fd)
+        throw SysError("creating metrics socket");
+    unix::closeOnExec(fd.get());
+
+    int one = 1;
+    setsockopt(fd.get(), SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    if (bind(fd.get(), res->ai_addr, res->ai_addrlen) == -1)
+        throw SysError("binding metrics socket to '%s'", address);
+    if (listen(fd.get(), 16) == -1)
+        throw SysError("listening on metrics socket '%s'", address);
+
+    return fd;
+}
+
+/**
+ * Answer a single HTTP request with the current metrics. We don't look
+ * at the request beyond reading its headers.
+ */
+static void serveMetrics(Descriptor fd)
+{
+    /* Don't let a stuck client block other scrapes for long. */
+    struct timeval timeout = {.tv_sec = 10, .tv_usec = 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    std::string request;
+    char buf[4096];
+    while (request.find("\r\n\r\n") == request.npos && request.size() < 65536) {
+        auto n = read(fd, buf, sizeof(buf));
+        if (n <= 0)
+            return;
+        request.append(buf, n);
+    }
+
+    auto body = renderOpenMetrics(*getStoreMetrics());
+    writeFull(
+        fd,
+        fmt("HTTP/1.1 200 OK\r\n"
+            "Content-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n"
+            "Content-Length: %d\r\n"
+            "Connection: close\r\n"
+            "\r\n",
+            body.size())
+            + body);
+}
+
+/**
+ * Start collecting metrics, and fork a process that serves them on
+ * `address`. The metrics live in shared memory, so this must be called
+ * before forking any workers.
+ */
+static void startMetricsServer(const std::string & address)
+{
+    enableStoreMetrics();
+
+    auto fdMetrics = openMetricsSocket(address);
+
+    ProcessOptions options;
+    options.errorPrefix = "unexpected metrics server error: ";
+    options.dieWithParent = true;
+    options.allowVfork = false;
+    startProcess(
+        [&]() {
+            while (true) {
+                AutoCloseFD remote = accept(fdMetrics.get(), nullptr, nullptr);
+                if (!remote) {
+                    if (errno == EINTR)
+                        continue;
+                    throw SysError("accepting metrics connection");
+                }
+                try {
+                    serveMetrics(remote.get());
+                } catch (Error & e) {
+                    debug("while serving metrics: %s", e.what());
+                }
+            }
+        },
+        options);
+
+    printInfo("serving metrics on '%s'", address);
+}
+
 /**
  * Run a server. The loop opens a socket and accepts new connections from that
  * socket.
@@ -304,6 +667,9 @@ static void daemonLoop(std::optional<TrustedFlag> forceTrustClientOpt)
     if (chdir("/") == -1)
         throw SysError("cannot change current directory");
 
+    if (auto & address = daemonSettings.metricsListen.get(); !address.empty())
+        startMetricsServer(address);
+
     AutoCloseFD fdSocket;
 
     //  Handle socket-based activation by systemd.
@@ -345,6 +711,9 @@ static void daemonLoop(std::optional<TrustedFlag> forceTrustClientOpt)
     }
 #endif
 
+    if (daemonSettings.preforkedWorkers > 0)
+        return preforkedDaemonLoop(fdSocket, forceTrustClientOpt, daemonSettings.preforkedWorkers);
+
     //  Loop accepting connections.
     while (1) {
 
@@ -363,23 +732,7 @@ static void daemonLoop(std::optional<TrustedFlag> forceTrustClientOpt)
 
             unix::closeOnExec(remote.get());
 
-            PeerInfo peer;
-            TrustedFlag trusted;
-            std::optional<std::string> userName;
-
-            if (forceTrustClientOpt)
-                trusted = *forceTrustClientOpt;
-            else {
-                peer = getPeerInfo(remote.get());
-                auto [_trusted, _userName] = authPeer(peer);
-                trusted = _trusted;
-                userName = _userName;
-            };
-
-            printInfo(
-                (std::string) "accepted connection from pid %1%, user %2%" + (trusted ? " (trusted)" : ""),
-                peer.pid ? std::to_string(*peer.pid) : "<unknown>",
-                userName.value_or("<unknown>"));
+            auto client = authClient(remote.get(), forceTrustClientOpt);
 
             //  Fork a child to handle the connection.
             ProcessOptions options;
@@ -398,15 +751,15 @@ static void daemonLoop(std::optional<TrustedFlag> forceTrustClientOpt)
                     //  Restore normal handling of SIGCHLD.
                     setSigChldAction(false);
 
-                    //  For debugging, stuff the pid into argv[1].
-                    if (peer.pid && savedArgv[1]) {
-                        auto processName = std::to_string(*peer.pid);
-                        strncpy(savedArgv[1], processName.c_str(), strlen(savedArgv[1]));
-                    }
+                    setProcessNameToPeer(client.peer);
 
                     //  Handle the connection.
                     processConnection(
-                        openUncachedStore(), FdSource(remote.get()), FdSink(remote.get()), trusted, NotRecursive);
+                        openUncachedStore(),
+                        FdSource(remote.get()),
+                        FdSink(remote.get()),
+                        client.trusted,
+                        NotRecursive);
 
                     exit(0);
                 },
@@ -0,0 +1,332 @@
+#include "nix/cmd/command-installable-value.hh"
+#include "nix/main/shared.hh"
+#include "nix/store/store-api.hh"
+#include "nix/expr/eval.hh"
+#include "nix/expr/eval-inline.hh"
+#include "nix/expr/eval-settings.hh"
+#include "nix/expr/get-drvs.hh"
+#include "nix/util/processes.hh"
+#include "nix/util/terminal.hh"
+
+#include <nlohmann/json.hpp>
+
+#include <deque>
+
+#include <poll.h>
+#include <sys/resource.h>
+
+using namespace nix;
+using json = nlohmann::json;
+
+/**
+ * The peak resident set size of this process in bytes.
+ */
+static uint64_t getMaxRSS()
+{
+    struct rusage buf;
+    if (getrusage(RUSAGE_SELF, &buf) != 0)
+        throw SysError("getting resource usage");
+#ifdef __APPLE__
+    return buf.ru_maxrss;
+#else
+    return (uint64_t) buf.ru_maxrss * 1024;
+#endif
+}
+
+using JobPath = std::vector<std::string>;
+
+struct CmdEvalJobs : InstallableValueCommand
+{
+    unsigned int nrWorkers = 0;
+    uint64_t maxMemorySize = 4096;
+    bool forceRecurse = false;
+
+    CmdEvalJobs()
+    {
+        addFlag({
+            .longName = "workers",
+            .description =
+                "The number of worker processes. The default is the value of the `eval-cores` setting.",
+            .labels = {"n"},
+            .handler = {&nrWorkers},
+        });
+
+        addFlag({
+            .longName = "max-memory-size",
+            .description = "Restart a worker after it has used more than *size* MiB of memory.",
+            .labels = {"size"},
+            .handler = {&maxMemorySize},
+        });
+
+        addFlag({
+            .longName = "force-recurse",
+            .description = "Evaluate all nested attribute sets, not just those with `recurseForDerivations = true`.",
+            .handler = {&forceRecurse, true},
+        });
+    }
+
+    std::string description() override
+    {
+        return "evaluate the derivations in a jobset";
+    }
+
+    std::string doc() override
+    {
+        return
+#include "eval-jobs.md"
+            ;
+    }
+
+    Category category() override
+    {
+        return catSecondary;
+    }
+
+    /**
+     * Evaluate the attribute at `jobPath` below `vRoot`, writing any
+     * derivations it produces to the store. The result describes
+     * either a derivation, the names of the attributes to evaluate
+     * next, or an error.
+     */
+    json evalJob(EvalState & state, Value & vRoot, const JobPath & jobPath)
+    {
+        json reply{{"attr", concatStringsSep(".", jobPath)}, {"attrPath", jobPath}};
+
+        try {
+            auto v = &vRoot;
+            for (auto & name : jobPath) {
+                state.forceAttrs(*v, noPos, "while evaluating a jobset");
+                auto a = v->attrs()->get(state.symbols.create(name));
+                if (!a)
+                    throw Error("attribute '%s' does not exist", name);
+                v = a->value;
+            }
+            state.forceValue(*v, noPos);
+
+            if (auto packageInfo = getDerivation(state, *v, false)) {
+                auto drvPath = packageInfo->requireDrvPath();
+                auto outputs = json::object();
+                for (auto & [name, path] : packageInfo->queryOutputs())
+                    outputs[name] = path ? json(state.store->printStorePath(*path)) : json(nullptr);
+
+                /* Write the derivation closure of this job to the store
+                   in one go, before anyone sees its path. */
+                state.flushDerivations();
+
+                reply["name"] = packageInfo->queryName();
+                reply["system"] = packageInfo->querySystem();
+                reply["drvPath"] = state.store->printStorePath(drvPath);
+                reply["outputs"] = std::move(outputs);
+            }
+
+            else if (v->type() == nAttrs) {
+                auto recurse = jobPath.empty() || forceRecurse;
+                if (!recurse)
+                    if (auto a = v->attrs()->get(state.s.recurseForDerivations))
+                        recurse = state.forceBool(
+                            *a->value, a->pos, "while evaluating the 'recurseForDerivations' attribute");
+                if (recurse) {
+                    auto attrs = json::array();
+                    for (auto & attr : v->attrs()->lexicographicOrder(state.symbols))
+                        attrs.push_back(state.symbols[attr->name]);
+                    reply["attrs"] = std::move(attrs);
+                }
+            }
+        } catch (Error & e) {
+            reply["error"] = filterANSIEscapes(e.msg(), true);
+        }
+
+        return reply;
+    }
+
+    /**
+     * The main loop of a worker process: read attribute paths from
+     * `from` and write the results to `to`, one JSON object per line.
+     * Returns when `from` is closed, or after a reply marked with
+     * `restart` once the worker has used more than `maxMemorySize`, so
+     * that the parent forks a fresh one.
+     */
+    void runWorker(EvalState & state, Value & vRoot, Descriptor from, Descriptor to)
+    {
+        while (true) {
+            auto line = readLine(from, true);
+            if (line.empty())
+                return;
+            auto reply = evalJob(state, vRoot, json::parse(line).get<JobPath>());
+            auto restart = getMaxRSS() > maxMemorySize * 1024 * 1024;
+            if (restart)
+                reply["restart"] = true;
+            writeLine(to, reply.dump());
+            if (restart)
+                return;
+        }
+    }
+
+    struct Worker
+    {
+        Pid pid;
+        AutoCloseFD to, from;
+        /**
+         * The part of a reply that has been read so far.
+         */
+        std::string buffer;
+        std::optional<JobPath> job;
+    };
+
+    void run(ref<Store> store, ref<InstallableValue> installable) override
+    {
+        auto state = getEvalState();
+        state->batchDerivations = true;
+
+        /* Evaluate the root before forking, so every worker starts
+           with the parsed files and the root attribute set in its
+           heap. */
+        auto [vRoot, pos] = installable->toValue(*state);
+        state->forceValue(*vRoot, pos);
+
+        std::deque<JobPath> queue{JobPath{}};
+
+        auto handleReply = [&](const json & reply) {
+            if (auto attrs = reply.find("attrs"); attrs != reply.end()) {
+                auto parent = reply.at("attrPath").get<JobPath>();
+                for (auto & name : *attrs) {
+                    auto child = parent;
+                    child.push_back(name.get<std::string>());
+                    queue.push_back(std::move(child));
+                }
+            } else if (reply.contains("drvPath") || reply.contains("error"))
+                logger->cout("%s", reply.dump());
+        };
+
+        auto canFork = [&]() {
+            return state->store->prepareForFork()
+                   && (state->buildStore == state->store || state->buildStore->prepareForFork());
+        };
+
+        if (!canFork()) {
+            warn(
+                "store '%s' can't be shared with worker processes; evaluating in this process without a memory limit",
+                state->store->config.getHumanReadableURI());
+            while (!queue.empty()) {
+                auto jobPath = std::move(queue.front());
+                queue.pop_front();
+                handleReply(evalJob(*state, *vRoot, jobPath));
+            }
+            return;
+        }
+
+        std::vector<Worker> workers(nrWorkers ? nrWorkers : evalSettings.getEvalCores());
+
+        auto startWorker = [&](Worker & worker) {
+            canFork();
+
+            Pipe toWorker, fromWorker;
+            toWorker.create();
+            fromWorker.create();
+
+            worker.pid = startProcess(
+                [&]() {
+                    /* Don't keep the other workers' pipes open, or they
+                       won't notice when we close ours. */
+                    for (auto & other : workers) {
+                        other.to.close();
+                        other.from.close();
+                    }
+                    toWorker.writeSide.close();
+                    fromWorker.readSide.close();
+                    runWorker(*state, *vRoot, toWorker.readSide.get(), fromWorker.writeSide.get());
+                    _exit(0);
+                },
+                {.errorPrefix = "error in evaluation worker: "});
+
+            worker.to = std::move(toWorker.writeSide);
+            worker.from = std::move(fromWorker.readSide);
+            worker.buffer.clear();
+        };
+
+        while (true) {
+            /* Hand out jobs to idle workers, starting new ones as
+               needed. */
+            for (auto & worker : workers) {
+                if (queue.empty())
+                    break;
+                if (worker.job)
+                    continue;
+                if (!worker.from)
+                    startWorker(worker);
+                worker.job = std::move(queue.front());
+                queue.pop_front();
+                writeLine(worker.to.get(), json(*worker.job).dump());
+            }
+
+            std::vector<struct pollfd> fds;
+            std::vector<Worker *> busy;
+            for (auto & worker : workers)
+                if (worker.job) {
+                    fds.push_back({.fd = worker.from.get(), .events = POLLIN, .revents = 0});
+                    busy.push_back(&worker);
+                }
+
+            if (busy.empty())
+                break;
+
+            checkInterrupt();
+
+            /* Wake up regularly to notice interrupts. */
+            if (poll(fds.data(), fds.size(), 1000) == -1) {
+                if (errno == EINTR)
+                    continue;
+                throw SysError("polling evaluation workers");
+            }
+
+            for (size_t i = 0; i < fds.size(); ++i) {
+                if (!fds[i].revents)
+                    continue;
+                auto & worker = *busy[i];
+
+                char buf[65536];
+                auto n = read(worker.from.get(), buf, sizeof(buf));
+                if (n == -1) {
+                    if (errno == EINTR)
+                        continue;
+                    throw SysError("reading from evaluation worker");
+                }
+
+                if (n == 0) {
+                    /* The worker died while evaluating its job, most
+                       likely because it ran out of memory. */
+                    json reply{
+                        {"attr", concatStringsSep(".", *worker.job)},
+                        {"attrPath", *worker.job},
+                        {"error", fmt("evaluation worker exited unexpectedly (%s)", statusToString(worker.pid.wait()))},
+                    };
+                    handleReply(reply);
+                    worker.job.reset();
+                    worker.to.close();
+                    worker.from.close();
+                    continue;
+                }
+
+                worker.buffer.append(buf, n);
+                auto newline = worker.buffer.find('\n');
+                if (newline == std::string::npos)
+                    continue;
+
+                auto reply = json::parse(worker.buffer.substr(0, newline));
+                worker.buffer.erase(0, newline + 1);
+                worker.job.reset();
+
+                if (reply.value("restart", false)) {
+                    reply.erase("restart");
+                    worker.to.close();
+                    worker.from.close();
+                    worker.pid.wait();
+                }
+
+                handleReply(reply);
+            }
+        }
+    }
+};
+
+static auto rCmdEvalJobs = registerCommand<CmdEvalJobs>("eval-jobs");
@@ -208,14 +208,18 @@ struct CmdWhyDepends : SourceExprCommand, MixOperateOnOptions
                contain the reference. */
             std::map<std::string, Strings> hits;
 
-            auto accessor = store->requireStoreObjectAccessor(node.path);
-
             auto getColour = [&](const std::string & hash) {
                 return hash == dependencyPathHash ? ANSI_GREEN : ANSI_BLUE;
             };
 
             if (precise) {
-                // Use scanForReferencesDeep to find files containing references
+                /* For binary caches, this reads the files through the
+                   NAR listing, fetching only the parts of the NAR
+                   that are needed. */
+                auto accessor = store->requireStoreObjectAccessor(node.path);
+
+                // Use scanForReferencesDeep to find files containing references.
+                // This scans the files in parallel.
                 scanForReferencesDeep(*accessor, CanonPath::root, refPaths, [&](FileRefScanResult result) {
                     auto p2 = result.filePath.isRoot() ? result.filePath.abs() : result.filePath.rel();
                     auto st = accessor->lstat(result.filePath);
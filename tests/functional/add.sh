@@ -93,3 +93,27 @@ clearStoreIfPossible
     path2=$(nix eval --impure --raw --expr 'builtins.toFile "dummy" (builtins.readFile ./dummy)')
     [[ "$path1" == "$path2" ]]
 )
+(
+    # Adding several paths at once gives the same paths as adding them one at a time.
+    mkdir -p "$TEST_ROOT/many"
+    for i in $(seq 1 20); do echo "$i" > "$TEST_ROOT/many/file-$i"; done
+    mapfile -t batch < <(nix store add --mode flat "$TEST_ROOT"/many/file-*)
+    [[ ${#batch[@]} == 20 ]]
+    i=0
+    for f in "$TEST_ROOT"/many/file-*; do
+        [[ "${batch[$i]}" == "$(nix store add --mode flat "$f")" ]]
+        [[ "$(cat "${batch[$i]}")" == "$(cat "$f")" ]]
+        i=$((i + 1))
+    done
+    mapfile -t batch < <(nix store add --mode nar "$TEST_ROOT"/many/file-1 ./dummy)
+    [[ "${batch[1]}" == "$(nix store add ./dummy)" ]]
+    nix-store --verify-path "${batch[0]}" "${batch[1]}"
+    # Large paths are added separately, keeping the order of the arguments.
+    head -c 2000000 /dev/zero > "$TEST_ROOT/many/large"
+    mapfile -t batch < <(nix store add --mode flat "$TEST_ROOT"/many/file-1 "$TEST_ROOT"/many/large "$TEST_ROOT"/many/file-2)
+    [[ ${#batch[@]} == 3 ]]
+    [[ "${batch[0]}" == "$(nix store add --mode flat "$TEST_ROOT"/many/file-1)" ]]
+    [[ "${batch[1]}" == "$(nix store add --mode flat "$TEST_ROOT"/many/large)" ]]
+    [[ "${batch[2]}" == "$(nix store add --mode flat "$TEST_ROOT"/many/file-2)" ]]
+    expectStderr 1 nix store add --name foo ./dummy "$TEST_ROOT"/many/file-1 | grepQuiet "requires exactly one path"
+)
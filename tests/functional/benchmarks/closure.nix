@@ -0,0 +1,39 @@
+# A closure with a few large and many small store paths, to benchmark
+# copying and substitution.
+{
+  nrLarge ? 20,
+  nrSmall ? 500,
+}:
+
+with import ../config.nix;
+
+let
+  large = builtins.genList (
+    i:
+    mkDerivation {
+      name = "large-${toString i}";
+      buildCommand = ''
+        mkdir $out
+        head -c 4000000 /dev/urandom > $out/data
+      '';
+    }
+  ) nrLarge;
+
+  small = builtins.genList (
+    i:
+    mkDerivation {
+      name = "small-${toString i}";
+      buildCommand = ''
+        mkdir -p $out/share/doc
+        for j in $(seq 1 20); do
+          echo "file $j of path ${toString i}" > $out/share/doc/$j
+        done
+      '';
+    }
+  ) nrSmall;
+in
+mkDerivation {
+  name = "closure";
+  deps = large ++ small;
+  buildCommand = "echo $deps > $out";
+}
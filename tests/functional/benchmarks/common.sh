@@ -0,0 +1,67 @@
+# shellcheck shell=bash
+source ../common.sh
+
+# Results go to one file of JSON lines per benchmark script, so that
+# the results of two commits can be compared with `compare.sh`.
+benchResults=${NIX_BENCH_RESULTS:-$_NIX_TEST_BUILD_DIR/benchmark-results}
+benchRuns=${NIX_BENCH_RUNS:-5}
+mkdir -p "$benchResults"
+benchFile="$benchResults/$(basename "$TEST_NAME").json"
+: > "$benchFile"
+
+# A pinned nixpkgs source tree, for benchmarks that evaluate it.
+benchNixpkgs=${NIX_BENCH_NIXPKGS:-}
+
+requireNixpkgs() {
+    [[ -n $benchNixpkgs ]] || skipTest "NIX_BENCH_NIXPKGS is not set to a nixpkgs source tree"
+}
+
+# Print the current time in microseconds.
+now() {
+    # The decimal separator depends on the locale.
+    echo "${EPOCHREALTIME/[.,]/}"
+}
+
+# measure NAME COMMAND...
+#
+# Run COMMAND once to warm up and then `benchRuns` times, and print the
+# wall clock times as a JSON object. If `benchSetup` is set, that
+# command is run untimed before every run, e.g. to clear the store.
+measure() {
+    local name=$1
+    shift
+    local times=() start end i
+    for (( i = 0; i <= benchRuns; i++ )); do
+        if [[ -n ${benchSetup-} ]]; then
+            $benchSetup > /dev/null
+        fi
+        start=$(now)
+        "$@" > /dev/null
+        end=$(now)
+        (( i == 0 )) || times+=("$(( end - start ))")
+    done
+    jq -n -c --arg name "$name" '
+        $ARGS.positional | map(tonumber / 1e6) | sort
+        | { name: $name, runs: length, mean: (add / length), median: .[length / 2 | floor], min: .[0], max: .[-1] }
+    ' --args "${times[@]}"
+}
+
+# bench NAME COMMAND...
+#
+# Measure COMMAND and append the result to `benchFile`.
+bench() {
+    measure "$@" | tee -a "$benchFile"
+}
+
+# benchEval NAME COMMAND...
+#
+# Like `bench`, but also record the evaluator statistics of COMMAND
+# (see `NIX_SHOW_STATS`).
+benchEval() {
+    local name=$1
+    shift
+    NIX_SHOW_STATS=1 NIX_SHOW_STATS_PATH="$TEST_ROOT/stats.json" "$@" > /dev/null
+    measure "$name" "$@" \
+        | jq -c --slurpfile stats "$TEST_ROOT/stats.json" '.evalStats = $stats[0]' \
+        | tee -a "$benchFile"
+}
@@ -0,0 +1,27 @@
+#!/usr/bin/env bash
+
+# Compare the results of the benchmark suite for two commits.
+#
+# Usage: compare.sh <old-results-dir> <new-results-dir>
+#
+# Prints the median time of every benchmark in both runs, and the
+# relative change.
+
+set -eu -o pipefail
+
+if [[ $# -ne 2 ]]; then
+    echo "usage: $0 <old-results-dir> <new-results-dir>" >&2
+    exit 1
+fi
+
+jq -n -r --slurpfile old <(cat "$1"/*.json) --slurpfile new <(cat "$2"/*.json) '
+    ($old | map({key: .name, value: .}) | from_entries) as $o
+    | ["benchmark", "old (s)", "new (s)", "change"],
+      ($new[] | select($o[.name]) | [
+        .name,
+        ($o[.name].median * 1000 | round / 1000),
+        (.median * 1000 | round / 1000),
+        ((.median / $o[.name].median - 1) * 100 | round | tostring + "%")
+      ])
+    | @tsv
+'
@@ -0,0 +1,23 @@
+#!/usr/bin/env bash
+
+source common.sh
+
+TODO_NixOS
+
+clearStore
+clearCache
+
+outPath=$(nix-build --no-out-link closure.nix)
+
+for compression in none xz zstd; do
+    benchSetup=clearCache bench "copy-to-file-cache-$compression" \
+        nix copy --to "file://$cacheDir?compression=$compression" "$outPath"
+done
+
+# The cache now holds the zstd-compressed closure.
+clearStoreAndCacheCache() {
+    clearStore
+    clearCacheCache
+}
+benchSetup=clearStoreAndCacheCache bench copy-from-file-cache-zstd \
+    nix copy --from "file://$cacheDir" --no-check-sigs "$outPath"
@@ -0,0 +1,13 @@
+#!/usr/bin/env bash
+
+source common.sh
+
+requireNixpkgs
+
+pkgs="import $benchNixpkgs { config = {}; overlays = []; }"
+
+benchEval eval-hello nix-instantiate --expr "($pkgs).hello"
+benchEval eval-firefox nix-instantiate --expr "($pkgs).firefox"
+benchEval eval-nixos-toplevel nix-instantiate --expr "
+  (import $benchNixpkgs/nixos { configuration = $PWD/nixos-configuration.nix; }).config.system.build.toplevel
+"
@@ -0,0 +1,116 @@
+/* A minimal HTTP server for a binary cache directory, which delays
+   every response to simulate a remote cache.
+
+   Usage: http-cache <cache-dir> <port-file> <latency-ms>
+
+   It listens on an ephemeral port on 127.0.0.1, writes the port
+   number to <port-file>, and then serves GET and HEAD requests until it
+   is killed. Each connection is served by its own thread, and supports
+   keep-alive, like a real cache behind a CDN. */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static std::string cacheDir;
+static std::chrono::milliseconds latency;
+
+static bool writeAll(int fd, std::string_view s)
+{
+    while (!s.empty()) {
+        auto n = write(fd, s.data(), s.size());
+        if (n <= 0)
+            return false;
+        s.remove_prefix(n);
+    }
+    return true;
+}
+
+static void serve(int fd)
+{
+    std::string buf;
+    char chunk[4096];
+
+    while (true) {
+        size_t end;
+        while ((end = buf.find("\r\n\r\n")) == std::string::npos) {
+            auto n = read(fd, chunk, sizeof(chunk));
+            if (n <= 0)
+                return;
+            buf.append(chunk, n);
+        }
+        std::istringstream request(buf.substr(0, end));
+        buf.erase(0, end + 4);
+
+        std::string method, path;
+        request >> method >> path;
+
+        std::this_thread::sleep_for(latency);
+
+        std::string body;
+        bool found = false;
+        if (path.find("..") == std::string::npos) {
+            std::ifstream file(cacheDir + path, std::ios::binary);
+            if (file) {
+                std::ostringstream contents;
+                contents << file.rdbuf();
+                body = contents.str();
+                found = true;
+            }
+        }
+
+        auto header = std::string(found ? "HTTP/1.1 200 OK\r\n" : "HTTP/1.1 404 Not Found\r\n") + "Content-Length: "
+                      + std::to_string(body.size()) + "\r\n\r\n";
+        if (!writeAll(fd, header) || (method != "HEAD" && !writeAll(fd, body)))
+            return;
+    }
+}
+
+int main(int argc, char ** argv)
+{
+    if (argc != 4) {
+        fprintf(stderr, "usage: %s <cache-dir> <port-file> <latency-ms>\n", argv[0]);
+        return 1;
+    }
+    cacheDir = argv[1];
+    latency = std::chrono::milliseconds(atoi(argv[3]));
+
+    signal(SIGPIPE, SIG_IGN);
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (fd == -1 || bind(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1 || listen(fd, 128) == -1
+        || getsockname(fd, (struct sockaddr *) &addr, &len) == -1) {
+        perror("creating socket");
+        return 1;
+    }
+
+    /* Write the port atomically, since the caller polls for the file. */
+    auto portFile = std::string(argv[2]);
+    std::ofstream(portFile + ".tmp") << ntohs(addr.sin_port) << "\n";
+    rename((portFile + ".tmp").c_str(), portFile.c_str());
+
+    while (true) {
+        int remote = accept(fd, nullptr, nullptr);
+        if (remote == -1)
+            continue;
+        std::thread([remote]() {
+            serve(remote);
+            close(remote);
+        }).detach();
+    }
+}
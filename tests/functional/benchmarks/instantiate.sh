@@ -0,0 +1,10 @@
+#!/usr/bin/env bash
+
+source common.sh
+
+benchEval instantiate-synthetic-jobset nix-instantiate jobset.nix
+
+if [[ -n $benchNixpkgs ]]; then
+    benchEval instantiate-nixpkgs-release-small nix-instantiate "$benchNixpkgs/pkgs/top-level/release-small.nix" \
+        --arg supportedSystems "[ \"$system\" ]"
+fi
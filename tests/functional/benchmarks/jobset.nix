@@ -0,0 +1,29 @@
+# A synthetic jobset with `n` jobs, where every job depends on a few
+# earlier ones, like packages in a package set.
+{
+  n ? 2000,
+}:
+
+with import ../config.nix;
+
+let
+  jobs = builtins.genList (
+    i:
+    mkDerivation {
+      name = "job-${toString i}";
+      deps = map (builtins.elemAt jobs) (builtins.filter (j: j >= 0 && j < i) [
+        (i - 1)
+        (i / 2)
+        (i / 3)
+        (i - 100)
+      ]);
+      buildCommand = "echo $deps > $out";
+    }
+  ) n;
+in
+builtins.listToAttrs (
+  builtins.genList (i: {
+    name = "job-${toString i}";
+    value = builtins.elemAt jobs i;
+  }) n
+)
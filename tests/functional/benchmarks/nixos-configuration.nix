@@ -0,0 +1,9 @@
+# A small but complete NixOS system, to benchmark evaluating a
+# toplevel.
+{
+  boot.loader.grub.device = "nodev";
+  fileSystems."/".device = "/dev/disk/by-label/nixos";
+  services.openssh.enable = true;
+  networking.firewall.enable = true;
+  system.stateVersion = "25.05";
+}
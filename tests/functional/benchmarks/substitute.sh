@@ -0,0 +1,40 @@
+#!/usr/bin/env bash
+
+source common.sh
+
+TODO_NixOS
+
+clearStore
+clearCache
+
+outPath=$(nix-build --no-out-link closure.nix)
+nix copy --to "file://$cacheDir?compression=zstd" "$outPath"
+
+httpCachePids=()
+trap 'kill "${httpCachePids[@]}"' EXIT
+
+# Serve `cacheDir` over HTTP, delaying every response by $1
+# milliseconds, and set `httpCacheUrl`.
+startHttpCache() {
+    local portFile=$TEST_ROOT/http-cache-$1.port
+    rm -f "$portFile"
+    "$_NIX_TEST_BUILD_DIR/benchmarks/http-cache" "$cacheDir" "$portFile" "$1" > /dev/null 2>&1 &
+    httpCachePids+=($!)
+    while [[ ! -e $portFile ]]; do
+        sleep 0.1
+    done
+    httpCacheUrl=http://127.0.0.1:$(cat "$portFile")
+}
+
+clearStoreAndCacheCache() {
+    clearStore
+    clearCacheCache
+}
+
+for latency in ${NIX_BENCH_LATENCIES:-0 20 100}; do
+    startHttpCache "$latency"
+    benchSetup=clearStoreAndCacheCache bench "substitute-http-${latency}ms" \
+        nix-store --realise "$outPath" \
+            --option substituters "$httpCacheUrl" \
+            --option require-sigs false
+done
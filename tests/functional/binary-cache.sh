@@ -26,6 +26,59 @@ for path in "${paths[@]}"; do
         || [[ "$path" =~ -dependencies-top$ ]]
 done
 
+# Copying with a tiny in-flight limit copies one path at a time, but
+# still copies all of them.
+clearCache
+nix copy --to "file://$cacheDir" --copy-path-jobs 4 --copy-max-bytes-in-flight 1 "$outPath"
+[[ $(nix path-info --all --store "file://$cacheDir" | wc -l) -eq 3 ]]
+
+# A cache with a path index records every path it receives there, and
+# answers validity queries from it without looking at the .narinfo
+# files.
+clearCache
+nix copy --to "file://$cacheDir?path-index=true" "$outPath"
+grepQuiet "PathIndex: 1" "$cacheDir/nix-cache-info"
+[[ -n $(ls "$cacheDir/nix-cache-index") ]]
+rm "$cacheDir"/*.narinfo
+nix copy --to "file://$cacheDir" "$outPath"
+(! ls "$cacheDir"/*.narinfo)
+
+# A cache with a Bloom filter answers lookups of paths it doesn't have
+# without looking for their .narinfo files.
+clearCache
+nix copy --to "file://$cacheDir?bloom-filter=true" "$outPath"
+grepQuiet "BloomFilter: 1" "$cacheDir/nix-cache-info"
+[[ -n $(ls "$cacheDir/nix-cache-bloom") ]]
+nix path-info --store "file://$cacheDir" "$outPath"
+# The filter rules out a path that isn't in the cache, even if a
+# .narinfo for it appears behind Nix's back.
+otherPath=$(nix-build dependencies.nix -A input1_drv --no-out-link)
+nix copy --to "file://$TEST_ROOT/other-cache" "$otherPath"
+cp "$TEST_ROOT"/other-cache/*.narinfo "$cacheDir/"
+expect 1 nix path-info --store "file://$cacheDir" "$otherPath"
+
+# A cache with chunked NARs stores the chunks separately, and can
+# still be read from.
+clearCache
+nix copy --to "file://$cacheDir?chunk-nars=true" "$outPath"
+[[ -n $(ls "$cacheDir/chunks") ]]
+grepQuiet "Compression: chunked" "$cacheDir/$(basename "$outPath" | cut -c1-32).narinfo"
+[[ $(nix store cat --store "file://$cacheDir?local-chunk-cache=$TEST_ROOT/chunk-cache" "$outPath/foobar") = FOOBAR ]]
+[[ -n $(ls "$TEST_ROOT/chunk-cache") ]]
+
+# A sharded cache stores its files in subdirectories, and readers learn
+# about this from nix-cache-info.
+clearCache
+nix copy --to "file://$cacheDir?sharded-layout=true&fsync=true&fsync-batch-size=2" "$outPath"
+grepQuiet "ShardedLayout: 1" "$cacheDir/nix-cache-info"
+hashPart=$(basename "$outPath" | cut -c1-32)
+[[ -f "$cacheDir/${hashPart:0:2}/$hashPart.narinfo" ]]
+(! ls "$cacheDir"/*.narinfo)
+(! ls "$cacheDir"/*.tmp.* "$cacheDir"/*/*.tmp.*)
+[[ $(nix path-info --all --store "file://$cacheDir" | wc -l) -eq 3 ]]
+nix path-info --store "file://$cacheDir" "$outPath"
+expect 1 nix copy --to "file://$cacheDir?sharded-layout=false" "$outPath"
+
 # Test copying build logs to the binary cache.
 expect 1 nix log --store "file://$cacheDir" "$outPath" 2>&1 | grep 'is not available'
 nix store copy-log --to "file://$cacheDir" "$outPath"
@@ -237,8 +290,46 @@ rm -rfv "$cacheDir/nar"
 
 [[ $(nix store cat --store "file://$cacheDir?local-nar-cache=$narCache" "$outPath/foobar") = FOOBAR ]]
 
+# A cached NAR without a listing is indexed again, and the listing is
+# written back.
+rm "$narCache"/*.ls
+[[ $(nix store cat --store "file://$cacheDir?local-nar-cache=$narCache" "$outPath/foobar") = FOOBAR ]]
+ls "$narCache"/*.ls
+
 (! nix store cat --store "file://$cacheDir" "$outPath/foobar")
 
+# With an uncompressed NAR and a NAR listing, files are read from the
+# NAR in place instead of fetching (and caching) the whole NAR.
+clearCache
+nix copy --to "file://$cacheDir?compression=none&write-nar-listing=true" "$outPath"
+rm -rf "$narCache"
+[[ $(nix store cat --store "file://$cacheDir?local-nar-cache=$narCache" "$outPath/foobar") = FOOBAR ]]
+(! ls "$narCache"/*.nar)
+
+# The binary NAR listing suffices for this.
+rm "$cacheDir"/*.ls
+rm -rf "$narCache"
+[[ $(nix store cat --store "file://$cacheDir?local-nar-cache=$narCache" "$outPath/foobar") = FOOBAR ]]
+(! ls "$narCache"/*.nar)
+
+# The same works for NARs compressed with seekable xz, provided that
+# they're big enough to consist of several blocks.
+clearCache
+# shellcheck disable=SC2016
+bigPath=$(nix-build --no-out-link -E '
+  with import '"${config_nix}"';
+  mkDerivation {
+    name = "seekable";
+    buildCommand = "mkdir $out; seq 1 1000000 > $out/big; echo SMALL > $out/small";
+  }
+')
+nix copy --to "file://$cacheDir?compression=xz-seekable&write-nar-listing=true" "$bigPath"
+grepQuiet "Compression: xz" "$cacheDir/$(basename "$bigPath" | cut -c1-32).narinfo"
+rm -rf "$narCache"
+[[ $(nix store cat --store "file://$cacheDir?local-nar-cache=$narCache" "$bigPath/small") = SMALL ]]
+nix store cat --store "file://$cacheDir?local-nar-cache=$narCache" "$bigPath/big" | diff - "$bigPath/big"
+(! ls "$narCache"/*.nar)
+
 
 # Test NAR listing generation.
 clearCache
@@ -8,4 +8,15 @@ with import ./config.nix;
       echo "$NIX_BUILD_CORES" > $out
     '';
   };
+
+  # Test derivation that takes a token from the jobserver and returns it
+  testJobserver = mkDerivation {
+    name = "test-build-jobserver";
+    buildCommand = ''
+      fifo=''${MAKEFLAGS#*--jobserver-auth=fifo:}
+      read -r -n1 token < "$fifo"
+      printf '%s' "$token" > "$fifo"
+      echo "$MAKEFLAGS $token" > $out
+    '';
+  };
 }
@@ -29,4 +29,15 @@ fi
 echo "PASS: build-cores=0 resolves to NIX_BUILD_CORES=$result (should be > 0)"
 rm -f "$TEST_ROOT"/build-cores-output
 
+# Test 3: With a jobserver, builders get a FIFO with cores - 1 tokens
+echo "Testing build-jobserver..."
+nix-build --cores 4 --option build-jobserver true build-cores.nix -A testJobserver -o "$TEST_ROOT"/build-cores-output
+result=$(cat "$(readlink "$TEST_ROOT"/build-cores-output)")
+if [[ "$result" != "-j4 --jobserver-auth=fifo:"*" +" ]]; then
+    echo "FAIL: Expected a jobserver token, got $result"
+    exit 1
+fi
+echo "PASS: build-jobserver provides a jobserver"
+rm -f "$TEST_ROOT"/build-cores-output
+
 echo "All build-cores tests passed!"
@@ -0,0 +1,41 @@
+#!/usr/bin/env bash
+
+source common.sh
+
+requireSandboxSupport
+requiresUnprivilegedUserNamespaces
+[[ "${busybox-}" =~ busybox ]] || skipTest "no busybox"
+
+# Avoid store dir being inside sandbox build-dir
+unset NIX_STORE_DIR
+
+file=build-hook.nix
+
+builders=(
+  "ssh-ng://localhost?remote-store=$TEST_ROOT/machine1?system-features=foo - - 1 1 foo"
+  "ssh-ng://localhost?remote-store=$TEST_ROOT/machine2?system-features=bar - - 1 1 bar"
+  "ssh-ng://localhost?remote-store=$TEST_ROOT/machine3?system-features=baz - - 1 1 baz"
+)
+
+chmod -R +w "$TEST_ROOT/machine"* || true
+rm -rf "$TEST_ROOT/machine"* || true
+
+nix build -L -v -f "$file" -o "$TEST_ROOT/result" --max-jobs 0 \
+  --arg busybox "$busybox" \
+  --store "$TEST_ROOT/machine0" \
+  --in-process-builders \
+  --builders "$(IFS=';'; echo "${builders[*]}")"
+
+outPath=$(readlink -f "$TEST_ROOT/result")
+
+grep 'FOO BAR BAZ' "$TEST_ROOT/machine0/$outPath"
+
+# Each input was built on the machine with the required feature.
+nix path-info --store "$TEST_ROOT/machine1" --all | grepQuiet builder-build-remote-input-1.sh
+nix path-info --store "$TEST_ROOT/machine2" --all | grepQuiet builder-build-remote-input-2.sh
+nix path-info --store "$TEST_ROOT/machine3" --all | grepQuiet builder-build-remote-input-3.sh
+
+# The build logs are copied back from the remote machines.
+for i in input1 input3; do
+  nix log --store "$TEST_ROOT/machine0" --file "$file" --arg busybox "$busybox" "passthru.$i" | grep hi-$i
+done
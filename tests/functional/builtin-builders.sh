@@ -0,0 +1,51 @@
+#!/usr/bin/env bash
+
+source common.sh
+
+clearStoreIfPossible
+
+# builtin:write-text
+outPath=$(nix-build --no-out-link --expr 'derivation { name = "text"; system = "builtin"; builder = "builtin:write-text"; text = "Hello World"; }')
+[[ $(cat "$outPath") = "Hello World" ]]
+[[ ! -x "$outPath" ]]
+
+outPath=$(nix-build --no-out-link --expr 'derivation { name = "script"; system = "builtin"; builder = "builtin:write-text"; text = "echo hi"; destination = "bin/hi"; executable = "1"; }')
+[[ $(cat "$outPath/bin/hi") = "echo hi" ]]
+[[ -x "$outPath/bin/hi" ]]
+
+expectStderr 100 nix-build --no-out-link --expr 'derivation { name = "escape"; system = "builtin"; builder = "builtin:write-text"; text = ""; destination = "../foo"; }' \
+    | grepQuiet "is not a normalised relative path"
+
+# builtin:symlink-farm
+outPath=$(nix-build --no-out-link --expr 'derivation { name = "farm"; system = "builtin"; builder = "builtin:symlink-farm"; entries = builtins.toJSON { "a" = "/foo"; "b/c" = "../bar"; }; }')
+[[ $(readlink "$outPath/a") = /foo ]]
+[[ $(readlink "$outPath/b/c") = ../bar ]]
+
+# builtin:copy-store-paths
+outPath=$(nix-build --no-out-link --expr '
+  let
+    text = name: destination: derivation { inherit name destination; system = "builtin"; builder = "builtin:write-text"; text = name; };
+  in derivation {
+    name = "copy";
+    system = "builtin";
+    builder = "builtin:copy-store-paths";
+    paths = "${text "foo" "share/foo"} ${text "bar" "share/bar"}";
+  }')
+[[ $(cat "$outPath/share/foo") = foo ]]
+[[ $(cat "$outPath/share/bar") = bar ]]
+[[ ! -L "$outPath/share/foo" ]]
+
+expectStderr 100 nix-build --no-out-link --expr '
+  let
+    text = name: derivation { inherit name; system = "builtin"; builder = "builtin:write-text"; text = name; destination = "foo"; };
+  in derivation {
+    name = "collision";
+    system = "builtin";
+    builder = "builtin:copy-store-paths";
+    paths = "${text "foo"} ${text "bar"}";
+  }' | grepQuiet "collision between"
+
+# Paths that are not inputs of the derivation can't be copied.
+undeclared=$(nix-build --no-out-link --expr 'derivation { name = "undeclared"; system = "builtin"; builder = "builtin:write-text"; text = "foo"; }')
+expectStderr 100 nix-build --no-out-link --expr "derivation { name = \"copy-undeclared\"; system = \"builtin\"; builder = \"builtin:copy-store-paths\"; paths = \"$undeclared\"; }" \
+    | grepQuiet "is not an input of the derivation"
@@ -24,8 +24,11 @@ testCutoffFor () {
     # The seed only changes the root derivation, and not it's output, so the
     # dependent derivations should only need to be built once.
     buildAttr rootCA 2
-    out2=$(buildAttr "$1" 2 -j0)
+    out2=$(buildAttr "$1" 2 -j0 2> "$TEST_ROOT/cutoff.log")
     test "$out1" == "$out2"
+    if [[ "$NIX_REMOTE" != "daemon" ]]; then
+        grepQuiet "skipped by early cutoff" "$TEST_ROOT/cutoff.log"
+    fi
 }
 
 testCutoff () {
@@ -0,0 +1,44 @@
+#!/usr/bin/env bash
+
+source common.sh
+
+# Needs the config option 'daemon-preforked-workers' to work
+requireDaemonNewerThan "2.34.0"
+
+TODO_NixOS
+
+clearStore
+
+echo 'daemon-preforked-workers = 2' >> "$test_nix_conf"
+restartDaemon
+startDaemon
+
+# Run more concurrent clients than there are preforked workers.
+addConcurrently() {
+    local pids=()
+    for i in {1..8}; do
+        echo "$1 $i" > "$TEST_ROOT/preforked-$1-$i"
+        timeout 60 nix-store --add "$TEST_ROOT/preforked-$1-$i" > "$TEST_ROOT/preforked-$1-$i.out" &
+        pids+=($!)
+    done
+    for pid in "${pids[@]}"; do
+        wait "$pid"
+    done
+    for i in {1..8}; do
+        [[ $(cat "$(cat "$TEST_ROOT/preforked-$1-$i.out")") = "$1 $i" ]]
+    done
+}
+
+addConcurrently first
+
+# Kill the idle workers. They can't tell the daemon that they stopped
+# being idle, so it has to notice that they died and replace them.
+children="/proc/$_NIX_TEST_DAEMON_PID/task/$_NIX_TEST_DAEMON_PID/children"
+if [[ -e "$children" ]]; then
+    for worker in $(cat "$children"); do
+        kill -9 "$worker"
+    done
+    addConcurrently second
+fi
+
+killDaemon
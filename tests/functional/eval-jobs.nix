@@ -0,0 +1,23 @@
+with import ./config.nix;
+
+{
+  hello = mkDerivation {
+    name = "hello";
+    buildCommand = "touch $out";
+  };
+  broken = throw "this job is broken";
+  nested = {
+    recurseForDerivations = true;
+    foo = mkDerivation {
+      name = "foo";
+      buildCommand = "touch $out";
+    };
+  };
+  hidden = {
+    bar = mkDerivation {
+      name = "bar";
+      buildCommand = "touch $out";
+    };
+  };
+  notADerivation = 42;
+}
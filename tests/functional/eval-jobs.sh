@@ -0,0 +1,34 @@
+#!/usr/bin/env bash
+
+source common.sh
+
+clearStoreIfPossible
+
+checkJobs() {
+    local jobs="$1"
+
+    [[ $(jq -r 'select(.attr == "hello") | .name' < "$jobs") == hello ]]
+    [[ $(jq -r 'select(.attr == "nested.foo") | .attrPath | join(",")' < "$jobs") == nested,foo ]]
+    jq -r 'select(.attr == "broken") | .error' < "$jobs" | grepQuiet "this job is broken"
+    (( $(wc -l < "$jobs") == 3 ))
+
+    # The derivations have been written to the store.
+    drvPath=$(jq -r 'select(.attr == "hello") | .drvPath' < "$jobs")
+    nix derivation show "$drvPath" | grepQuiet hello
+    nix-build --no-out-link "$drvPath"
+}
+
+nix eval-jobs -f eval-jobs.nix > "$TEST_ROOT/jobs.json"
+checkJobs "$TEST_ROOT/jobs.json"
+
+(( $(nix eval-jobs --force-recurse -f eval-jobs.nix | wc -l) == 4 ))
+
+if ! isTestOnNixOS; then
+    # With the daemon, the jobs are evaluated by worker processes. A
+    # memory limit of 1 MiB restarts the worker after every job.
+    startDaemon
+    clearStore
+    nix eval-jobs --workers 2 --max-memory-size 1 -f eval-jobs.nix > "$TEST_ROOT/jobs-workers.json"
+    checkJobs "$TEST_ROOT/jobs-workers.json"
+    diff <(jq -S -c . < "$TEST_ROOT/jobs.json" | sort) <(jq -S -c . < "$TEST_ROOT/jobs-workers.json" | sort)
+fi
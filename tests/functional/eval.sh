@@ -90,3 +90,29 @@ out="$(expectStderr 0 nix eval --option foobar baz --expr '""' --raw)"
 # Test flag alias
 out="$(nix eval --expr '{}' --build-cores 1)"
 [[ "$(echo "$out" | wc -l)" = 1 ]]
+
+# Test that instantiating the same derivation twice is counted.
+NIX_SHOW_STATS=1 NIX_SHOW_STATS_PATH="$TEST_ROOT/stats.json" nix-instantiate --expr '
+  let mk = n: derivation { name = "dup"; system = "x"; builder = "/bin/sh"; };
+  in [ (mk 1) (mk 2) ]' > /dev/null
+jq -e '.nrDerivations == 2 and .nrDuplicateDerivations == 1' "$TEST_ROOT/stats.json"
+
+# Test per-file import statistics.
+mkdir -p "$TEST_ROOT/stats"
+echo '{ x = 1; }' > "$TEST_ROOT/stats/a.nix"
+NIX_SHOW_STATS=1 NIX_SHOW_STATS_PATH="$TEST_ROOT/stats.json" nix-instantiate --eval --expr "
+  (import $TEST_ROOT/stats/a.nix).x + (import $TEST_ROOT/stats/a.nix).x" > /dev/null
+jq -e '.files[] | select(.file | endswith("/stats/a.nix")) | .imports == 2 and .importsCached == 1 and .parses == 1 and .exprs > 0' "$TEST_ROOT/stats.json"
+jq -e '.fileEvalCache.hits >= 1 and .importResolutionCache.hits >= 1' "$TEST_ROOT/stats.json"
+
+# Test that derivations buffered by nix-instantiate can be read back
+# during evaluation, and are all written out at the end.
+drvPath=$(nix-instantiate --expr '
+  let d = derivation { name = "batched"; system = "x"; builder = "/bin/sh"; };
+  in derivation { name = "reader"; system = "x"; builder = "/bin/sh"; n = builtins.stringLength (builtins.readFile d.drvPath); }')
+nix-store -q --references "$drvPath" | grepQuiet batched.drv
+
+# Test that garbage collection resumes once the heap outgrows NIX_GC_ARENA_SIZE.
+NIX_GC_ARENA_SIZE=1 GC_INITIAL_HEAP_SIZE=1M NIX_SHOW_STATS=1 NIX_SHOW_STATS_PATH="$TEST_ROOT/stats.json" \
+  nix eval --expr 'builtins.length (builtins.genList toString 1000000)' > /dev/null
+jq -e '(.gc.cycles // 1) > 0' "$TEST_ROOT/stats.json"
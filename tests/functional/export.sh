@@ -40,3 +40,28 @@ clearStore
 # Regression test: the derivers in exp_all2 are empty, which shouldn't
 # cause a failure.
 nix-store --import < "$TEST_ROOT"/exp_all2
+
+
+# The version 2 format, with and without compression.
+clearStore
+outPath=$(nix-build dependencies.nix --no-out-link)
+
+nix-store --export --format-version 2 "$outPath" > "$TEST_ROOT"/exp_v2
+# shellcheck disable=SC2046
+nix-store --export --format-version 2 $(nix-store -qR "$outPath") > "$TEST_ROOT"/exp_all_v2
+# shellcheck disable=SC2046
+nix-store --export --compression xz $(nix-store -qR "$outPath") > "$TEST_ROOT"/exp_all_v2_xz
+
+clearStore
+
+# A non-closure is rejected before anything is imported.
+expectStderr 1 nix-store --import < "$TEST_ROOT"/exp_v2 | grepQuiet "which is not in the store"
+[[ ! -e "$outPath" ]]
+
+nix-store --import < "$TEST_ROOT"/exp_all_v2 | grepQuiet "$outPath"
+nix-store --verify-path "$outPath"
+
+clearStore
+
+nix-store --import < "$TEST_ROOT"/exp_all_v2_xz | grepQuiet "$outPath"
+nix-store --verify-path "$outPath"
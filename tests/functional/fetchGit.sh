@@ -314,3 +314,34 @@ git -C "$empty" config user.name "Foobar"
 git -C "$empty" commit --allow-empty --allow-empty-message --message ""
 
 nix eval --impure --expr "let attrs = builtins.fetchGit $empty; in assert attrs.lastModified != 0; assert attrs.rev != \"0000000000000000000000000000000000000000\"; assert attrs.revCount == 1; true"
+
+# Filtered imports of a locked tree are cached across evaluations.
+rev=$(git -C "$repo" rev-parse HEAD)
+filtered="builtins.path { path = builtins.fetchGit { url = \"file://$repo\"; rev = \"$rev\"; }; filter = p: t: baseNameOf p != \"hello\"; }"
+path1=$(nix eval --impure --raw --expr "$filtered")
+[[ ! -e $path1/hello ]]
+expectStderr 0 nix eval -vvvvv --impure --raw --expr "$filtered" | grepQuiet "store path cache hit"
+path2=$(nix eval --impure --raw --expr "${filtered/!=/==}")
+[[ $path1 != "$path2" && -e $path2/hello ]]
+
+# Unchanged subtrees of different commits share store path cache entries.
+mkdir -p "$repo/sub"
+echo sub > "$repo/sub/file"
+git -C "$repo" add sub
+git -C "$repo" commit -m 'Add sub'
+revSub1=$(git -C "$repo" rev-parse HEAD)
+echo other > "$repo/other"
+git -C "$repo" add other
+git -C "$repo" commit -m 'Add other'
+revSub2=$(git -C "$repo" rev-parse HEAD)
+subtree() {
+    echo "builtins.path { path = (builtins.fetchGit { url = \"file://$repo\"; rev = \"$1\"; }) + \"/sub\"; }"
+}
+nix eval --impure --raw --expr "$(subtree "$revSub1")"
+expectStderr 0 nix eval -vvvvv --impure --raw --expr "$(subtree "$revSub2")" | grepQuiet "store path cache hit"
+
+# Scanning the working directory refreshes the stat information in the Git index.
+touch -d @1000000000 "$repo/other"
+(! git -C "$repo" diff-files --quiet)
+nix eval --impure --raw --expr "(builtins.fetchGit \"$repo\").outPath"
+git -C "$repo" diff-files --quiet
@@ -0,0 +1,33 @@
+#!/usr/bin/env bash
+
+source common.sh
+
+clearStoreIfPossible
+
+dir=$TEST_ROOT/file-hash-cache
+rm -rf "$dir"
+mkdir -p "$dir/sub"
+echo foo > "$dir/foo"
+echo bar > "$dir/sub/bar"
+ln -s foo "$dir/link"
+
+# Files modified within the last second are never cached.
+sleep 2
+
+expected=$(nix-hash --type sha256 "$dir")
+
+for _ in 1 2; do
+    [[ $(nix hash path --file-hash-cache "$dir") = $(nix hash convert --hash-algo sha256 --to sri "$expected") ]]
+    path=$(nix store add --file-hash-cache "$dir")
+done
+
+[[ -e "$TEST_HOME/.cache/nix/file-hashes-v1.sqlite" ]]
+[[ $(nix store add "$dir") = "$path" ]]
+
+# A modification must invalidate the cached hash.
+echo baz > "$dir/sub/bar"
+sleep 2
+path2=$(nix store add --file-hash-cache "$dir")
+[[ "$path2" != "$path" ]]
+[[ $(cat "$path2/sub/bar") = baz ]]
+[[ $(nix store add "$dir") = "$path2" ]]
@@ -0,0 +1,38 @@
+#!/usr/bin/env bash
+
+source ./common.sh
+
+needLocalStore "'--no-require-sigs' can’t be used with the daemon"
+
+requireGit
+
+createFlake1
+
+flake3Dir=$TEST_ROOT/flake3
+createGitRepo "$flake3Dir" ""
+
+cat > "$flake3Dir/flake.nix" <<EOF
+{
+  inputs.flake1.url = "git+file://$flake1Dir";
+  outputs = { self, flake1 }: {
+    src = flake1.outPath;
+  };
+}
+EOF
+
+git -C "$flake3Dir" add flake.nix
+nix flake lock "$flake3Dir"
+git -C "$flake3Dir" add flake.lock
+git -C "$flake3Dir" commit -m 'Initial'
+
+flake1Path=$(nix eval --no-eval-cache --raw "$flake3Dir#src")
+
+# Put the locked input in a binary cache and remove every other copy of it.
+cacheDir=$TEST_ROOT/binary-cache
+nix copy --to "file://$cacheDir" "$flake1Path"
+nix store delete "$flake1Path"
+rm -rf "$flake1Dir" "$TEST_HOME/.cache/nix"
+
+# Locking should now substitute the input instead of fetching it.
+[[ $(nix eval --no-eval-cache --raw "$flake3Dir#src" --substituters "file://$cacheDir" --no-require-sigs) = "$flake1Path" ]]
+[[ -e "$flake1Path/flake.nix" ]]
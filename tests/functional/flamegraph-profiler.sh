@@ -9,14 +9,14 @@ expect_trace() {
     expect="$2"
     actual=$(
         nix-instantiate \
-            --eval-profiler flamegraph \
+            --eval-profiler "${mode:-flamegraph}" \
             --eval-profiler-frequency 0 \
             --eval-profile-file /dev/stdout \
             --expr "$expr" |
             grep "«string»" || true
     )
 
-    echo -n "Tracing expression '$expr'"
+    echo -n "Tracing expression '$expr' (${mode:-flamegraph})"
     msg=$(
         diff -swB \
             <(echo "$expect") \
@@ -99,3 +99,45 @@ expect_trace 'builtins.derivationStrict { name = "somepackage"; }' "
 expect_trace 'builtins.derivationStrict { }' "
 «string»:1:1:primop derivationStrict 1
 "
+
+# The sampling profiler records the same stacks
+mode=sampling expect_trace 'let f = arg: arg; in f 1' "
+«string»:1:22:f 1
+"
+
+mode=sampling expect_trace 'let a = builtins.all (let f = x: x; in f); in a [1]' "
+«string»:1:9:primop all 1
+«string»:1:47:primop all 1
+«string»:1:47:primop all;«string»:1:31:f 1
+"
+
+mode=sampling expect_trace '{__functor = x: arg: arg;} 1' "
+«string»:1:1:functor 1
+«string»:1:1:functor;«string»:1:2 1
+"
+
+# ... but doesn't resolve derivation names
+mode=sampling expect_trace 'builtins.derivationStrict { name = "somepackage"; }' "
+«string»:1:1:primop derivationStrict 1
+"
+
+# The allocation profiler weighs stacks by the number of bytes allocated
+nix-instantiate \
+    --eval-profiler allocations \
+    --eval-profile-file /dev/stdout \
+    --expr 'let f = x: [ x x x ]; in f 1' |
+    grepQuiet -E '^«toplevel»;«string»:1:26:f [1-9][0-9]*$'
+
+# The retention profiler charges the list kept alive by the closure's
+# environment to the closure
+cat > "$TEST_ROOT/retain.nix" <<'EOF'
+let
+  mk = n: let big = builtins.genList toString n; in builtins.deepSeq big (_: builtins.length big);
+in
+mk 100000
+EOF
+nix-instantiate \
+    --eval-profiler retention \
+    --eval-profile-file /dev/stdout \
+    --eval --expr "import $TEST_ROOT/retain.nix" |
+    grepQuiet -E '^«imports»;.*/retain\.nix:2:[0-9]+ [0-9]{6,}$'
@@ -32,6 +32,36 @@ nix-env -p "$profiles/test" --delete-generations old
 
 nix-store --gc
 
+# The second call reuses the roots found by the first one.
+nix-store --gc --print-roots --option gc-runtime-roots-ttl 60 | grep "$outPath"
+nix-store --gc --print-roots --option gc-runtime-roots-ttl 60 | grep "$outPath"
+
+# Check that the cached roots are really reused, by adding a root to
+# the cache that no process has.
+rootsCache="$NIX_STATE_DIR/runtime-roots.json"
+[[ -e "$rootsCache" ]]
+echo foo > "$TEST_ROOT/cached-root"
+cachedRoot=$(nix-store --add "$TEST_ROOT/cached-root")
+echo "{\"$cachedRoot\": [\"/proc/1/fd/42\"]}" > "$rootsCache"
+nix-store --gc --print-roots --option gc-runtime-roots-ttl 60 | grep "$cachedRoot"
+
+# The garbage collector itself doesn't trust the cache.
+nix-store --gc --option gc-runtime-roots-ttl 60
+if test -e "$cachedRoot"; then
+    echo "garbage collector used cached runtime roots"
+    exit 1
+fi
+
+# An expired cache is replaced by a new scan.
+cachedRoot=$(nix-store --add "$TEST_ROOT/cached-root")
+echo "{\"$cachedRoot\": [\"/proc/1/fd/42\"]}" > "$rootsCache"
+touch -d '2 minutes ago' "$rootsCache"
+if nix-store --gc --print-roots --option gc-runtime-roots-ttl 60 | grep "$cachedRoot"; then
+    echo "expired runtime roots cache was used"
+    exit 1
+fi
+nix-store --gc --print-roots --option gc-runtime-roots-ttl 60 | grep "$outPath"
+
 kill -- -$child
 
 if ! test -e "$outPath"; then
@@ -51,6 +51,21 @@ nix-collect-garbage
 # Check that the output has been GC'd.
 if test -e "$outPath/foobar"; then false; fi
 
+# Delete garbage in the background with a single deletion thread. This
+# also drains the trash directory left behind by an interrupted
+# collection.
+outPath=$(nix-store -r "$(nix-instantiate dependencies.nix)")
+mkdir -p "$NIX_STORE_DIR/.gc-trash/leftover/dir"
+touch "$NIX_STORE_DIR/.gc-trash/leftover/dir/file"
+nix-collect-garbage --option gc-delete-jobs 1
+if test -e "$outPath"; then false; fi
+if test -e "$NIX_STORE_DIR/.gc-trash"; then false; fi
+
+# The same with several deletion threads and a rate limit.
+outPath=$(nix-store -r "$(nix-instantiate dependencies.nix)")
+nix-collect-garbage --option gc-delete-jobs 2 --option gc-max-delete-rate 1000000000
+if test -e "$outPath"; then false; fi
+
 # Check that the store is empty.
 rmdir "$NIX_STORE_DIR/.links"
 rmdir "$NIX_STORE_DIR"
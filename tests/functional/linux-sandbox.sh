@@ -38,6 +38,18 @@ nix store cat "$outPath"/foobar | grep FOOBAR
 # Test --check without hash rewriting.
 nix-sandbox-build dependencies.nix --check
 
+# Test that the outputs end up in the store when the sandbox's store is
+# an overlay.
+nix-sandbox-build dependencies.nix --check --option sandbox-store-overlay true
+nix-sandbox-build symlink-derivation.nix -A depends_on_symlink --option sandbox-store-overlay true
+
+# Test that the build directory can be a tmpfs.
+nix-sandbox-build dependencies.nix --check --option sandbox-build-dir-tmpfs-size 64M
+nix-sandbox-build --option sandbox-build-dir-tmpfs-size 64M -E 'with import '"${config_nix}"'; mkDerivation {
+  name = "build-dir-tmpfs";
+  buildCommand = "while read -r dev mnt type rest; do if [ \"$mnt\" = \"$NIX_BUILD_TOP\" ] && [ \"$type\" = tmpfs ]; then found=1; fi; done < /proc/mounts; [ -n \"$found\" ]; touch $out";
+}'
+
 # Test that sandboxed builds with --check and -K can move .check directory to store
 nix-sandbox-build check.nix -A nondeterministic
 
@@ -0,0 +1,40 @@
+#!/usr/bin/env bash
+
+set -eu -o pipefail
+
+set -x
+
+source common.sh
+
+# Avoid store dir being inside sandbox build-dir
+unset NIX_STORE_DIR
+unset NIX_STATE_DIR
+
+setupStoreDirs
+
+initLowerStore
+
+mountOverlayfs
+
+# Let the lower store's database settle, so that the snapshot is used.
+sleep 2
+
+# Queries answered from the snapshot of the lower store match those
+# answered by the lower store itself.
+for path in $(nix-store --store "$storeA" --query --requisites "$pathInLowerStore"); do
+  diff <(nix-store --store "$storeB" --query --referrers "$path" | sort) \
+       <(nix-store --store "$storeB&lower-store-snapshot=false" --query --referrers "$path" | sort)
+  nix-store --store "$storeB" --check-validity "$path"
+done
+
+nix-store --store "$storeB" --query --requisites "$pathInLowerStore" | grepQuiet "$pathInLowerStore"
+
+# Paths that are in neither store are still invalid.
+expectStderr 1 nix-store --store "$storeB" --check-validity /nix/store/d3iw9ccf7fqnhvs3rd6cncaf1ddc8n9z-missing \
+  | grepQuiet "is not valid"
+
+# A path added to the lower store afterwards is seen through the overlay.
+lowerPath=$(addTextToStore "$storeA" "lower-file" "Add to lower store")
+sleep 2
+remountOverlayfs
+nix-store --store "$storeB" --check-validity "$lowerPath"
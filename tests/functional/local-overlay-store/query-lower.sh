@@ -0,0 +1,7 @@
+# shellcheck shell=bash
+source common.sh
+source ../common/init.sh
+
+requireEnvironment
+setupConfig
+execUnshare ./query-lower-inner.sh
@@ -18,6 +18,23 @@ rm -rf "$NIX_LOG_DIR"
 nix-build dependencies.nix --no-out-link --compress-build-log
 [ "$(nix-store -l "$path")" = FOO ]
 
+if isDaemonNewer "2.34"; then
+    clearStore
+    rm -rf "$NIX_LOG_DIR"
+    nix-build dependencies.nix --no-out-link --compress-build-log --build-log-compression zstd
+    [ "$(nix-store -l "$path")" = FOO ]
+    find "$NIX_LOG_DIR" -name '*.zst' | grepQuiet .
+
+    # Test rate limiting of build log lines. All lines still end up in
+    # the log file.
+    clearStore
+    drvPath=$(nix-instantiate -E 'with import '"${config_nix}"'; mkDerivation { name = "chatty"; buildCommand = "for i in 1 2 3 4 5 6 7 8 9 10; do echo line-$i; done; mkdir $out"; }')
+    nix-build --no-out-link -L --build-log-lines-per-second 2 "$drvPath" 2> "$TEST_ROOT/chatty.log"
+    grepQuiet 'line-1' "$TEST_ROOT/chatty.log"
+    grepQuietInverse 'line-10' "$TEST_ROOT/chatty.log"
+    [ "$(nix-store -l "$drvPath" | grep -c line-)" = 10 ]
+fi
+
 # test whether empty logs work fine with `nix log`.
 builder="$(realpath "$(mktemp)")"
 echo -e "#!/bin/sh\nmkdir \$out" > "$builder"
@@ -42,3 +59,17 @@ if [[ "$NIX_REMOTE" != "daemon" ]]; then
     grep '{"action":"start","fields":\[".*-dependencies-top.drv","",1,1\],"id":.*,"level":3,"parent":0' "$TEST_ROOT/log.json" >&2
     (( $(grep -c '{"action":"msg","level":5,"msg":"executing builder .*"}' "$TEST_ROOT/log.json" ) == 5 ))
 fi
+
+# Test trace-file.
+if [[ "$NIX_REMOTE" != "daemon" ]]; then
+    clearStore
+    TRACEPARENT=00-4bf92f3577b34da6a3ce929d0e0e4736-00f067aa0ba902b7-01 \
+        nix build --file dependencies.nix --no-link --trace-file "$TEST_ROOT/trace.json"
+    spans='.resourceSpans[].scopeSpans[].spans[]'
+    # All spans belong to the trace that was passed in.
+    [[ $(jq -r "$spans | .traceId" < "$TEST_ROOT/trace.json" | sort -u) == 4bf92f3577b34da6a3ce929d0e0e4736 ]]
+    # Spans of top-level activities are children of the span that was passed in.
+    jq -r "$spans | .parentSpanId" < "$TEST_ROOT/trace.json" | grepQuiet '^00f067aa0ba902b7$'
+    jq -r "$spans | select(.name == \"build\") | .attributes[] | select(.key == \"nix.drv_path\") | .value.stringValue" \
+        < "$TEST_ROOT/trace.json" | grepQuiet 'dependencies-top.drv$'
+fi
@@ -0,0 +1,29 @@
+#!/usr/bin/env bash
+
+source common.sh
+
+# Old daemons don't properly zero out the self-references when
+# calculating the CA hashes.
+requireDaemonNewerThan "2.16.0pre20230524"
+
+clearStoreIfPossible
+
+nonCaPath=$(nix build --json --file ./dependencies.nix --no-link | jq -r .[].outputs.out)
+
+rewrites=$(nix store make-content-addressed --json "$nonCaPath" --copy-path-jobs 4 | jq -r .rewrites)
+caPath=$(jq -r ".[\"$nonCaPath\"]" <<< "$rewrites")
+
+# Every path in the closure is rewritten, and the result doesn't refer
+# to any of the originals.
+[[ $(jq length <<< "$rewrites") = $(nix path-info --recursive "$nonCaPath" | wc -l) ]]
+for path in $(nix path-info --recursive "$caPath"); do
+    nix path-info --json --json-format 2 "$path" | jq -e '.info.[].ca | .method == "nar"'
+    if grep -r -F -f <(jq -r 'keys | .[] | sub("^/.*/"; "") | .[0:32]' <<< "$rewrites") "$path"; then
+        fail "$path refers to a path that wasn't rewritten"
+    fi
+done
+
+nix store verify --recursive "$caPath"
+
+# Rewriting is deterministic.
+[[ $(nix store make-content-addressed --json "$nonCaPath" | jq -r ".rewrites[\"$nonCaPath\"]") = "$caPath" ]]
@@ -16,3 +16,24 @@ nix store info --store "$remoteStore"
 # Regression test for https://github.com/NixOS/nix/issues/6253
 nix copy --to "$remoteStore" "$outPath" --no-check-sigs &
 nix copy --to "$remoteStore" "$outPath" --no-check-sigs
+
+# Copy both ways with NAR compression.
+clearRemoteStore
+nix copy --to "$remoteStore&compress-nars=true" "$outPath" --no-check-sigs
+[ -f "${remoteRoot}""${outPath}"/foobar ]
+nix store dump-path --store "$remoteStore&compress-nars=true" "$outPath" | cmp - <(nix store dump-path "$outPath")
+clearStore
+nix copy --no-check-sigs --from "$remoteStore&compress-nars=true" "$outPath"
+[ -f "$outPath"/foobar ]
+
+# Send a new version of a large path as a delta against the old one.
+clearRemoteStore
+mkdir -p "$TEST_ROOT"/delta/{old,new}
+head -c 5000000 /dev/urandom > "$TEST_ROOT"/delta/old/blob-1.0
+{ cat "$TEST_ROOT"/delta/old/blob-1.0; echo "new data"; } > "$TEST_ROOT"/delta/new/blob-1.1
+oldPath=$(nix-store --add "$TEST_ROOT"/delta/old/blob-1.0)
+newPath=$(nix-store --add "$TEST_ROOT"/delta/new/blob-1.1)
+nix copy --to "$remoteStore" "$oldPath" --no-check-sigs
+nix copy --to "$remoteStore&delta-transfer=true" "$newPath" --no-check-sigs --debug 2>&1 \
+    | grepQuiet "sent '$newPath' as a delta against '$oldPath'"
+cmp "$TEST_ROOT"/delta/new/blob-1.1 "${remoteRoot}${newPath}"
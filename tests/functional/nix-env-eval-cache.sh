@@ -0,0 +1,28 @@
+#!/usr/bin/env bash
+
+source ./common.sh
+
+clearStoreIfPossible
+
+# The evaluation cache is only used for immutable expressions, so put
+# them in the store like a channel.
+exprDir="$TEST_ROOT/nix-env-eval-cache"
+mkdir -p "$exprDir"
+cp ./user-envs.nix ./user-envs.builder.sh "${config_nix}" "$exprDir/"
+expr=$(nix-store --add "$exprDir")/user-envs.nix
+
+expected=$(nix-env -f "$expr" -qaP '*' --description)
+[[ $(nix-env -f "$expr" -qaP '*' --description --eval-cache) = "$expected" ]]
+
+# Everything the previous query needed is cached now.
+[[ $(NIX_ALLOW_EVAL=0 nix-env -f "$expr" -qaP '*' --description --eval-cache) = "$expected" ]]
+
+# Columns that weren't queried before need evaluation.
+expectStderr 1 env NIX_ALLOW_EVAL=0 nix-env -f "$expr" -qa '*' --out-path --eval-cache \
+    | grepQuiet "not everything is cached"
+expected=$(nix-env -f "$expr" -qa '*' --out-path)
+[[ $(nix-env -f "$expr" -qa '*' --out-path --eval-cache) = "$expected" ]]
+[[ $(NIX_ALLOW_EVAL=0 nix-env -f "$expr" -qa '*' --out-path --eval-cache) = "$expected" ]]
+
+# Expressions outside the store are evaluated as usual.
+NIX_ALLOW_EVAL=0 nix-env -f ./user-envs.nix -qa '*' --eval-cache | grepQuiet foo-1.0
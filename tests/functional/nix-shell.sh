@@ -239,6 +239,14 @@ nix print-dev-env "$shellDrv" --json > "$TEST_ROOT"/dev-env2.json
 diff "$TEST_ROOT"/dev-env{,2}.sh
 diff "$TEST_ROOT"/dev-env{,2}.json
 
+# The environment of a derivation is cached, and the same environment
+# is produced when the cache entry is gone.
+nix print-dev-env "$shellDrv" --debug 2>&1 >/dev/null | grepQuiet "using cached environment"
+rm -rf "$TEST_HOME/.cache/nix/dev-env-v1"
+nix print-dev-env "$shellDrv" --debug 2>&1 >/dev/null | grepQuietInverse "using cached environment"
+nix print-dev-env "$shellDrv" > "$TEST_ROOT"/dev-env3.sh
+diff "$TEST_ROOT"/dev-env{,3}.sh
+
 # Ensure `nix print-dev-env --json` contains variable assignments.
 [[ $(jq -r .variables.arr1.value[2] "$TEST_ROOT"/dev-env.json) = '3 4' ]]
 
@@ -4,6 +4,20 @@ source common.sh
 
 clearStoreIfPossible
 
+# New paths are optimised in the background. When building through the
+# daemon, that can still be going on when the client exits, so wait
+# until $1 has link count $2.
+waitForLinks() {
+    for _ in {1..100}; do
+        if [ "$(stat --format=%h "$1")" = "$2" ]; then
+            return 0
+        fi
+        sleep 0.1
+    done
+    echo "link count of '$1' is $(stat --format=%h "$1"), expected $2"
+    return 1
+}
+
 # shellcheck disable=SC2016
 outPath1=$(echo 'with import '"${config_nix}"'; mkDerivation { name = "foo1"; builder = builtins.toFile "builder" "mkdir $out; echo hello > $out/foo"; }' | nix-build - --no-out-link --auto-optimise-store)
 # shellcheck disable=SC2016
@@ -12,6 +26,8 @@ outPath2=$(echo 'with import '"${config_nix}"'; mkDerivation { name = "foo2"; bu
 TODO_NixOS # ignoring the client-specified setting 'auto-optimise-store', because it is a restricted setting and you are not a trusted user
   # TODO: only continue when trusted user or root
 
+waitForLinks "$outPath1"/foo 3
+
 inode1="$(stat --format=%i "$outPath1"/foo)"
 inode2="$(stat --format=%i "$outPath2"/foo)"
 if [ "$inode1" != "$inode2" ]; then
@@ -44,6 +60,35 @@ if [ "$inode1" != "$inode3" ]; then
     exit 1
 fi
 
+# A second run only has to look at paths added since the first one.
+# shellcheck disable=SC2016
+outPath4=$(echo 'with import '"${config_nix}"'; mkDerivation { name = "foo4"; builder = builtins.toFile "builder" "mkdir $out; echo hello > $out/foo"; }' | nix-build - --no-out-link)
+
+NIX_REMOTE="" nix-store --optimise
+
+inode4="$(stat --format=%i "$outPath4"/foo)"
+if [ "$inode1" != "$inode4" ]; then
+    echo "inodes do not match"
+    exit 1
+fi
+
+# With a single background optimisation thread, all new paths still
+# get linked.
+# shellcheck disable=SC2016
+outPaths5=$(echo 'with import '"${config_nix}"'; map (n: mkDerivation { name = "foo5-${toString n}"; builder = builtins.toFile "builder" "mkdir $out; echo hello > $out/foo"; }) [1 2 3 4]' \
+    | nix-build - --no-out-link --auto-optimise-store --option auto-optimise-store-jobs 1)
+
+# foo1 to foo4, the four new paths, and the link in .links.
+waitForLinks "$outPath1"/foo 9
+
+for outPath5 in $outPaths5; do
+    inode5="$(stat --format=%i "$outPath5"/foo)"
+    if [ "$inode1" != "$inode5" ]; then
+        echo "inodes do not match"
+        exit 1
+    fi
+done
+
 nix-store --gc
 
 if [ -n "$(ls "$NIX_STORE_DIR"/.links)" ]; then
@@ -37,3 +37,13 @@ nix path-info --json --json-format 2 "$foo" | jq -e \
 echo | nix path-info --json --json-format 2 --stdin | jq -e \
     --arg storeDir "${NIX_STORE_DIR:-/nix/store}" \
     '.storeDir == $storeDir'
+
+# The closure size of a path without references is its NAR size
+nix path-info --json --json-format 2 --closure-size "$foo" | jq -e \
+    --arg fooBase "$fooBase" \
+    '.info[$fooBase] | .closureSize == .narSize'
+
+# The second time, the closure size comes from the database
+nix path-info --json --json-format 2 --closure-size "$foo" | jq -e \
+    --arg fooBase "$fooBase" \
+    '.info[$fooBase] | .closureSize == .narSize'
@@ -13,6 +13,8 @@ path2=$(nix-store -qR "$path" | grep input-2)
 
 nix-store --verify --check-contents -v
 
+nix-store --verify --check-contents -v --option verify-jobs 2
+
 hash=$(nix-hash "$path2")
 
 # Corrupt a path and check whether nix-build --repair can fix it.
@@ -19,6 +19,11 @@ text=$(cat "$outPath/hello")
 
 TODO_NixOS
 
+# The build was recorded.
+if [[ "$NIX_REMOTE" != "daemon" ]]; then
+    [[ $(nix store build-stats --json simple | jq -r '.[0].drvName') = simple ]]
+fi
+
 # Directed delete: $outPath is not reachable from a root, so it should
 # be deleteable.
 nix-store --delete "$outPath"
@@ -0,0 +1,22 @@
+#!/usr/bin/env bash
+
+source common.sh
+
+TODO_NixOS
+
+clearStore
+
+cacheDir=$TEST_ROOT/upload-cache
+rm -rf "$cacheDir"
+
+outPath=$(nix-build --no-out-link dependencies.nix --upload-outputs-to "file://$cacheDir")
+
+# The outputs and their closure are in the cache.
+for path in $(nix-store -qR "$outPath"); do
+    nix path-info --store "file://$cacheDir" "$path"
+done
+
+# They can be substituted from it.
+clearStore
+nix-store -r "$outPath" --substituters "file://$cacheDir" --no-require-sigs
+[[ -e "$outPath" ]]
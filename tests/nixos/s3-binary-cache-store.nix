@@ -707,6 +707,48 @@ in
 
           print("  ✓ Large file downloaded and verified")
 
+      @setup_s3()
+      def test_multipart_concurrent_parts(bucket):
+          """Test concurrent multipart upload and ranged download"""
+          print("\n--- Test: Concurrent Multipart Upload and Ranged Download ---")
+
+          large_pkg = server.succeed(
+              "nix-store --add $(dd if=/dev/urandom of=/tmp/large-file-2 bs=1M count=20 2>/dev/null && echo /tmp/large-file-2)"
+          ).strip()
+
+          store_url = make_s3_url(
+              bucket,
+              **{
+                  "multipart-upload": "true",
+                  "multipart-threshold": str(5 * 1024 * 1024),
+                  "multipart-chunk-size": str(5 * 1024 * 1024),
+                  "multipart-upload-concurrency": "3",
+              }
+          )
+
+          output = server.succeed(f"{ENV_WITH_CREDS} nix copy --to '{store_url}' {large_pkg} --debug 2>&1")
+          if "5 parts uploaded" not in output:
+              print("Debug output:")
+              print(output)
+              raise Exception("Expected '5 parts uploaded' in output")
+
+          print("  ✓ Parts uploaded concurrently")
+
+          download_url = make_s3_url(
+              bucket,
+              **{
+                  "download-part-size": str(4 * 1024 * 1024),
+                  "download-concurrency": "3",
+              }
+          )
+
+          output = client.succeed(f"{ENV_WITH_CREDS} nix copy --from '{download_url}' {large_pkg} --no-check-sigs --debug 2>&1")
+          if "in ranges of" not in output:
+              raise Exception("Expected ranged download to be used")
+          verify_packages_in_store(client, large_pkg, should_exist=True)
+
+          print("  ✓ Large file downloaded in ranges and verified")
+
       @setup_s3()
       def test_multipart_threshold(bucket):
           """Test that files below threshold use regular upload"""
@@ -922,6 +964,7 @@ in
       test_nix_prefetch_url()
       test_versioned_urls()
       test_multipart_upload_basic()
+      test_multipart_concurrent_parts()
       test_multipart_threshold()
       test_multipart_with_log_compression()
       test_profile_credentials()